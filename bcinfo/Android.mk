@@ -77,11 +77,16 @@ LOCAL_MODULE_CLASS := SHARED_LIBRARIES
 LOCAL_MODULE_TAGS := optional
 LOCAL_IS_HOST_MODULE := true
 
-LOCAL_SRC_FILES := $(libbcinfo_SRC_FILES)
+# Bionic includes the SHA-1 routines the translation cache uses.
+LOCAL_SRC_FILES := \
+  ../lib/Support/sha1.c \
+  $(libbcinfo_SRC_FILES)
 
 LOCAL_CFLAGS += $(local_cflags_for_libbcinfo)
 
-LOCAL_C_INCLUDES := $(libbcinfo_C_INCLUDES)
+LOCAL_C_INCLUDES := \
+  $(libbcinfo_C_INCLUDES) \
+  $(LOCAL_PATH)/../lib/Support
 
 LOCAL_STATIC_LIBRARIES += $(libbcinfo_STATIC_LIBRARIES)
 LOCAL_STATIC_LIBRARIES += libcutils liblog
@@ -34,7 +34,17 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sha1.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 
 namespace bcinfo {
 
@@ -66,102 +76,329 @@ static const unsigned int kMinimumUntranslatedVersion = 16;
 static const unsigned int kMinimumCompatibleVersion_LLVM_3_0 = 14;
 static const unsigned int kMinimumCompatibleVersion_LLVM_2_7 = 11;
 
+/**
+ * Version of the translations in the cache. Bump it whenever the output of the
+ * translation changes (e.g. the bitcode writer is updated.)
+ */
+static const unsigned int kTranslationCacheVersion = 1;
+
+
+/**
+ * Return the path of the cached translation of the \p bitcodeSize bytes of
+ * \p bitcode for the target API \p version in \p cacheDir.
+ */
+static std::string getTranslationCachePath(const char *cacheDir,
+                                           const char *bitcode,
+                                           size_t bitcodeSize,
+                                           unsigned int version) {
+  SHA1_CTX ctx;
+  unsigned char digest[20];
+  SHA1Init(&ctx);
+  SHA1Update(&ctx, reinterpret_cast<const unsigned char *>(bitcode),
+             static_cast<unsigned long>(bitcodeSize));
+  SHA1Final(digest, &ctx);
+
+  char name[64];
+  char *p = name + snprintf(name, sizeof(name), "bctrans%u-",
+                            kTranslationCacheVersion);
+  for (size_t i = 0; i < sizeof(digest); i++) {
+    p += snprintf(p, 3, "%02x", digest[i]);
+  }
+  snprintf(p, sizeof(name) - (p - name), "-%u.bc", version);
+
+  std::string path(cacheDir);
+  path.append("/");
+  path.append(name);
+  return path;
+}
+
+
+/**
+ * Read the cached translation at \p path into a new buffer. The cached
+ * translation must be a wrapped bitcode for \p targetAPI. Return NULL if
+ * there's no (valid) translation.
+ */
+static std::string *readTranslationCache(const std::string &path,
+                                         uint32_t targetAPI) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  std::string *buffer = NULL;
+  struct stat st;
+  if ((fstat(fd, &st) == 0) &&
+      (static_cast<size_t>(st.st_size) > sizeof(AndroidBitcodeWrapper))) {
+    size_t fileSize = static_cast<size_t>(st.st_size);
+    buffer = new std::string(fileSize, '\0');
+    size_t offset = 0;
+    while (offset < fileSize) {
+      ssize_t count = read(fd, &(*buffer)[offset], fileSize - offset);
+      if (count <= 0) {
+        if ((count < 0) && (errno == EINTR)) {
+          continue;
+        }
+        break;
+      }
+      offset += count;
+    }
+
+    AndroidBitcodeWrapper wrapper;
+    memcpy(&wrapper, buffer->data(), sizeof(wrapper));
+    if ((offset != fileSize) ||
+        (wrapper.Magic != 0x0B17C0DE) ||
+        (wrapper.BitcodeOffset != sizeof(wrapper)) ||
+        (wrapper.BitcodeSize != (fileSize - sizeof(wrapper))) ||
+        (wrapper.TargetAPI != targetAPI)) {
+      ALOGW("Ignoring invalid cached bitcode translation %s", path.c_str());
+      delete buffer;
+      buffer = NULL;
+    }
+  }
+
+  close(fd);
+  return buffer;
+}
+
+
+/**
+ * Save the \p size bytes of translation at \p data to \p path. It's
+ * written to a temporary file and renamed, so a reader never sees a partial
+ * translation. Failures only cost the next translation.
+ */
+static void writeTranslationCache(const std::string &path, const char *data,
+                                  size_t size) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d", static_cast<int>(getpid()));
+  std::string tmpPath(path);
+  tmpPath.append(suffix);
+
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ALOGW("Unable to cache the bitcode translation in %s (%s)", path.c_str(),
+          strerror(errno));
+    return;
+  }
+
+  size_t offset = 0;
+  while (offset < size) {
+    ssize_t count = write(fd, data + offset, size - offset);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    offset += count;
+  }
+
+  if ((close(fd) != 0) || (offset != size) ||
+      (rename(tmpPath.c_str(), path.c_str()) != 0)) {
+    ALOGW("Failed to cache the bitcode translation in %s (%s)", path.c_str(),
+          strerror(errno));
+    unlink(tmpPath.c_str());
+  }
+}
+
 
 BitcodeTranslator::BitcodeTranslator(const char *bitcode, size_t bitcodeSize,
                                      unsigned int version)
-    : mBitcode(bitcode), mBitcodeSize(bitcodeSize), mTranslatedBitcode(NULL),
-      mTranslatedBitcodeSize(0), mVersion(version) {
+    : mBitcode(bitcode), mBitcodeSize(bitcodeSize),
+      mWrapper(bitcode, bitcodeSize), mTranslatedBitcode(NULL),
+      mTranslatedBitcodeSize(0), mTranslatedBuffer(NULL), mVersion(version),
+      mCacheDir(NULL) {
+  return;
+}
+
+
+BitcodeTranslator::BitcodeTranslator(const BitcodeWrapper &wrapper,
+                                     unsigned int version)
+    : mBitcode(wrapper.getBitcode()), mBitcodeSize(wrapper.getBitcodeSize()),
+      mWrapper(wrapper), mTranslatedBitcode(NULL),
+      mTranslatedBitcodeSize(0), mTranslatedBuffer(NULL), mVersion(version),
+      mCacheDir(NULL) {
   return;
 }
 
 
 BitcodeTranslator::~BitcodeTranslator() {
-  if (mVersion < kMinimumUntranslatedVersion) {
-    // We didn't actually do a translation in the alternate case, so deleting
-    // the bitcode would be improper.
-    delete [] mTranslatedBitcode;
-  }
+  // If we didn't actually do a translation, mTranslatedBitcode is the input.
+  delete mTranslatedBuffer;
+  mTranslatedBuffer = NULL;
   mTranslatedBitcode = NULL;
   return;
 }
 
 
-bool BitcodeTranslator::translate() {
-  if (!mBitcode || !mBitcodeSize) {
+bool BitcodeTranslator::needsTranslation() const {
+  return (mVersion < kMinimumUntranslatedVersion);
+}
+
+
+/**
+ * Check the supplied bitcode and its version before a translation.
+ */
+static bool checkTranslatorInput(const BitcodeWrapper &BCWrapper,
+                                 unsigned int version) {
+  if (!BCWrapper.getBitcode() || !BCWrapper.getBitcodeSize()) {
     ALOGE("Invalid/empty bitcode");
     return false;
   }
 
-  BitcodeWrapper BCWrapper(mBitcode, mBitcodeSize);
-  if (BCWrapper.getTargetAPI() != mVersion) {
+  if (BCWrapper.getTargetAPI() != version) {
     ALOGE("Bitcode wrapper (%u) and translator (%u) disagree about target API",
-          BCWrapper.getTargetAPI(), mVersion);
+          BCWrapper.getTargetAPI(), version);
   }
 
-  if ((mVersion != kCurrentAPIVersion) &&
-      ((mVersion < kMinimumAPIVersion) ||
-       (mVersion > kMaximumAPIVersion))) {
-    ALOGE("Invalid API version: %u is out of range ('%u' - '%u')", mVersion,
+  if ((version != kCurrentAPIVersion) &&
+      ((version < kMinimumAPIVersion) ||
+       (version > kMaximumAPIVersion))) {
+    ALOGE("Invalid API version: %u is out of range ('%u' - '%u')", version,
          kMinimumAPIVersion, kMaximumAPIVersion);
     return false;
   }
 
-  // We currently don't need to transcode any API version higher than 14 or
-  // the current API version (i.e. 10000)
-  if (mVersion >= kMinimumUntranslatedVersion) {
-    mTranslatedBitcode = mBitcode;
-    mTranslatedBitcodeSize = mBitcodeSize;
-    return true;
-  }
+  return true;
+}
 
-  // Do the actual transcoding by invoking a 2.7-era bitcode reader that can
-  // then write the bitcode back out in a more modern (acceptable) version.
-  llvm::OwningPtr<llvm::LLVMContext> mContext(new llvm::LLVMContext());
+
+/**
+ * Parse the \p bitcodeSize bytes of legacy bitcode at \p bitcode of the
+ * target API \p version into a module of \p context. If \p lazy is true,
+ * only the module-level records are read and the legacy reader is left as
+ * the materializer of the module: each function body is decoded and
+ * upgraded when it's materialized. \p bitcode must then outlive the module.
+ */
+static llvm::Module *parseLegacyBitcode(const char *bitcode,
+                                        size_t bitcodeSize,
+                                        unsigned int version,
+                                        llvm::LLVMContext &context,
+                                        bool lazy) {
   llvm::OwningPtr<llvm::MemoryBuffer> MEM(
     llvm::MemoryBuffer::getMemBuffer(
-      llvm::StringRef(mBitcode, mBitcodeSize), "", false));
+      llvm::StringRef(bitcode, bitcodeSize), "", false));
   std::string error;
 
-  // Module ownership is handled by the context, so we don't need to free it.
   llvm::Module *module = NULL;
 
-  if (mVersion >= kMinimumCompatibleVersion_LLVM_3_0) {
-    module = llvm_3_0::ParseBitcodeFile(MEM.get(), *mContext, &error);
-  } else if (mVersion >= kMinimumCompatibleVersion_LLVM_2_7) {
-    module = llvm_2_7::ParseBitcodeFile(MEM.get(), *mContext, &error);
+  if (version >= kMinimumCompatibleVersion_LLVM_3_0) {
+    module = lazy ?
+        llvm_3_0::getLazyBitcodeModule(MEM.get(), context, &error) :
+        llvm_3_0::ParseBitcodeFile(MEM.get(), context, &error);
+  } else if (version >= kMinimumCompatibleVersion_LLVM_2_7) {
+    module = lazy ?
+        llvm_2_7::getLazyBitcodeModule(MEM.get(), context, &error) :
+        llvm_2_7::ParseBitcodeFile(MEM.get(), context, &error);
   } else {
-    ALOGE("No compatible bitcode reader for API version %d", mVersion);
-    return false;
+    ALOGE("No compatible bitcode reader for API version %d", version);
+    return NULL;
   }
 
   if (!module) {
     ALOGE("Could not parse bitcode file");
     ALOGE("%s", error.c_str());
+    return NULL;
+  }
+
+  if (lazy) {
+    // The reader of a lazy module deletes the buffer.
+    MEM.take();
+  }
+
+  return module;
+}
+
+
+llvm::Module *BitcodeTranslator::translateToModule(
+    llvm::LLVMContext &context) {
+  if (!checkTranslatorInput(mWrapper, mVersion) ||
+      !needsTranslation()) {
+    return NULL;
+  }
+
+  return parseLegacyBitcode(mBitcode, mBitcodeSize, mVersion, context,
+                            /* lazy */true);
+}
+
+
+bool BitcodeTranslator::translate() {
+  if (!checkTranslatorInput(mWrapper, mVersion)) {
     return false;
   }
 
-  std::string Buffer;
+  const BitcodeWrapper &BCWrapper = mWrapper;
+
+  // We currently don't need to transcode any API version higher than 14 or
+  // the current API version (i.e. 10000)
+  if (!needsTranslation()) {
+    mTranslatedBitcode = mBitcode;
+    mTranslatedBitcodeSize = mBitcodeSize;
+    return true;
+  }
 
-  llvm::raw_string_ostream OS(Buffer);
-  // Use the LLVM 3.2 bitcode writer, instead of the top-of-tree version.
-  llvm_3_2::WriteBitcodeToFile(module, OS);
-  OS.flush();
+  // Reuse the translation of a previous run if there's one.
+  std::string CachePath;
+  if (mCacheDir != NULL) {
+    CachePath = getTranslationCachePath(mCacheDir, mBitcode, mBitcodeSize,
+                                        mVersion);
+    mTranslatedBuffer = readTranslationCache(CachePath,
+                                             BCWrapper.getTargetAPI());
+    if (mTranslatedBuffer != NULL) {
+      mTranslatedBitcode = mTranslatedBuffer->data();
+      mTranslatedBitcodeSize = mTranslatedBuffer->size();
+      return true;
+    }
+  }
 
+  // Do the actual transcoding by invoking a 2.7-era bitcode reader that can
+  // then write the bitcode back out in a more modern (acceptable) version.
+  llvm::OwningPtr<llvm::LLVMContext> mContext(new llvm::LLVMContext());
+
+  // Module ownership is handled by the context, so we don't need to free it.
+  // The 3.2 writer enumerates the types and constants of every function body
+  // before it writes the first of them, so the module is fully materialized.
+  // Note that the bodies are decoded one after the other: every instruction
+  // the readers create uniques its types, constants and metadata in the
+  // LLVMContext, which isn't thread-safe, and values can't be moved between
+  // contexts, so the function blocks can't be decoded on several threads.
+  llvm::Module *module = parseLegacyBitcode(mBitcode, mBitcodeSize, mVersion,
+                                            *mContext, /* lazy */false);
+  if (!module) {
+    return false;
+  }
+
+  // The wrapper is written into the space reserved at the front of the
+  // buffer once the size of the bitcode is known, so the output is never
+  // copied. The upgraded bitcode is usually about the size of the input.
   AndroidBitcodeWrapper wrapper;
+  const size_t WrapperLen = sizeof(wrapper);
+  llvm::OwningPtr<std::string> Buffer(new std::string(WrapperLen, '\0'));
+  Buffer->reserve(WrapperLen + mBitcodeSize);
+
+  {
+    llvm::raw_string_ostream OS(*Buffer);
+    // Use the LLVM 3.2 bitcode writer, instead of the top-of-tree version.
+    llvm_3_2::WriteBitcodeToFile(module, OS);
+    OS.flush();
+  }
+
   size_t actualWrapperLen = writeAndroidBitcodeWrapper(
-      &wrapper, Buffer.size(), BCWrapper.getTargetAPI(),
+      &wrapper, Buffer->size() - WrapperLen, BCWrapper.getTargetAPI(),
       BCWrapper.getCompilerVersion(), BCWrapper.getOptimizationLevel());
-  if (!actualWrapperLen) {
+  if (actualWrapperLen != WrapperLen) {
     ALOGE("Couldn't produce bitcode wrapper!");
     return false;
   }
+  memcpy(&(*Buffer)[0], &wrapper, WrapperLen);
 
-  mTranslatedBitcodeSize = actualWrapperLen + Buffer.size();
-  char *c = new char[mTranslatedBitcodeSize];
-  memcpy(c, &wrapper, actualWrapperLen);
-  memcpy(c + actualWrapperLen, Buffer.c_str(), Buffer.size());
+  mTranslatedBuffer = Buffer.take();
+  mTranslatedBitcode = mTranslatedBuffer->data();
+  mTranslatedBitcodeSize = mTranslatedBuffer->size();
 
-  mTranslatedBitcode = c;
+  if (!CachePath.empty()) {
+    writeTranslationCache(CachePath, mTranslatedBitcode,
+                          mTranslatedBitcodeSize);
+  }
 
   return true;
 }
@@ -15,8 +15,6 @@
  */
 
 #include "bcinfo/BitcodeWrapper.h"
-#include "bcinfo/Wrap/bitcode_wrapperer.h"
-#include "bcinfo/Wrap/in_memory_wrapper_input.h"
 
 #define LOG_TAG "bcinfo"
 #include <cutils/log.h>
@@ -28,21 +26,89 @@
 
 namespace bcinfo {
 
+// Number of fixed 4-byte fields in the wrapper (see AndroidBitcodeWrapper.)
+static const size_t kLLVMFields = 4;
+static const size_t kFixedFields = 7;
+
+// Size of the ID and the length of a variable field (see BCHeaderField.)
+static const size_t kFieldTagLenSize = 4;
+
+
+static uint32_t readWord(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 0) |
+         (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+
+static uint16_t readHalf(const uint8_t *p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+
 BitcodeWrapper::BitcodeWrapper(const char *bitcode, size_t bitcodeSize)
     : mFileType(BC_NOT_BC), mBitcode(bitcode),
-      mBitcodeSize(bitcodeSize),
+      mBitcodeSize(bitcodeSize), mRawBitcode(NULL), mRawBitcodeSize(0),
       mHeaderVersion(0), mTargetAPI(0), mCompilerVersion(0),
-      mOptimizationLevel(3) {
-  InMemoryWrapperInput inMem(mBitcode, mBitcodeSize);
-  BitcodeWrapperer wrapperer(&inMem, NULL);
-  if (wrapperer.IsInputBitcodeWrapper()) {
+      mOptimizationLevel(3), mSourceSHA1(NULL) {
+  const uint8_t *buf = reinterpret_cast<const uint8_t *>(bitcode);
+  if (!buf) {
+    return;
+  }
+
+  if ((bitcodeSize >= kLLVMFields * 4) &&
+      (readWord(buf) == 0x0B17C0DE) && (readWord(buf + 4) == 0)) {
     mFileType = BC_WRAPPER;
-    mHeaderVersion = wrapperer.getAndroidHeaderVersion();
-    mTargetAPI = wrapperer.getAndroidTargetAPI();
-    mCompilerVersion = wrapperer.getAndroidCompilerVersion();
-    mOptimizationLevel = wrapperer.getAndroidOptimizationLevel();
-  } else if (wrapperer.IsInputBitcodeFile()) {
+    uint32_t offset = readWord(buf + 8);
+    uint32_t size = readWord(buf + 12);
+    if ((offset <= bitcodeSize) && (size <= bitcodeSize - offset)) {
+      mRawBitcode = bitcode + offset;
+      mRawBitcodeSize = size;
+    }
+
+    if ((bitcodeSize < kFixedFields * 4) || (readWord(buf + 24) != 0)) {
+      // Too short for the Android fields or a bad PNaCl bitcode version.
+      ALOGW("Invalid Android fields in the bitcode wrapper");
+      return;
+    }
+    mHeaderVersion = readWord(buf + 16);
+    mTargetAPI = readWord(buf + 20);
+
+    // The variable fields are between the fixed ones and the bitcode.
+    size_t end = (offset < bitcodeSize) ? offset : bitcodeSize;
+    size_t pos = kFixedFields * 4;
+    while (pos + kFieldTagLenSize <= end) {
+      uint16_t tag = readHalf(buf + pos);
+      uint16_t len = readHalf(buf + pos + 2);
+      const uint8_t *data = buf + pos + kFieldTagLenSize;
+      if (pos + kFieldTagLenSize + len > end) {
+        ALOGE("Raw bitcode offset inconsistent with variable field data");
+        break;
+      }
+      if ((tag == BCHeaderField::kAndroidSourceSHA1) && (len == 20)) {
+        mSourceSHA1 = data;
+      } else if (len == 4) {
+        switch (tag) {
+          case BCHeaderField::kAndroidCompilerVersion:
+            mCompilerVersion = readWord(data);
+            break;
+          case BCHeaderField::kAndroidOptimizationLevel:
+            mOptimizationLevel = readWord(data);
+            break;
+          default:
+            // Ignore other field types for now.
+            break;
+        }
+      }
+      // Fields are padded to 4 bytes.
+      pos += (kFieldTagLenSize + len + 3) & ~3;
+    }
+  } else if ((bitcodeSize >= 4) && (buf[0] == 'B') && (buf[1] == 'C') &&
+             (buf[2] == 0xc0) && (buf[3] == 0xde)) {
     mFileType = BC_RAW;
+    mRawBitcode = bitcode;
+    mRawBitcodeSize = bitcodeSize;
   }
 }
 
@@ -25,13 +25,19 @@
 #endif
 
 #include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitstreamReader.h"
+#include "llvm/Bitcode/LLVMBitCodes.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/MemoryBuffer.h"
 
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 namespace bcinfo {
 
@@ -60,10 +66,334 @@ static const llvm::StringRef ExportForEachMetadataName = "#rs_export_foreach";
 // synced with slang_rs_metadata.h)
 static const llvm::StringRef ObjectSlotMetadataName = "#rs_object_slots";
 
+static bool isExtractedMetadataName(llvm::StringRef Name) {
+  return (Name == PragmaMetadataName) ||
+         (Name == ExportVarMetadataName) ||
+         (Name == ExportFuncMetadataName) ||
+         (Name == ExportForEachNameMetadataName) ||
+         (Name == ExportForEachMetadataName) ||
+         (Name == ObjectSlotMetadataName);
+}
+
+
+namespace {
+
+// Reads the named metadata the extractor needs straight from the bitstream,
+// without materializing the rest of the module. Only the type table (to tell
+// the metadata operands of the nodes) and the module-level metadata block are
+// decoded; the globals, the constants and the function blocks are skipped.
+// The named metadata are then rebuilt in an otherwise empty module so they
+// can be read just like the ones of a parsed module.
+class ModuleMetadataReader {
+ private:
+  // An entry of the metadata value list: either a string or a node whose
+  // operands are the indices of other entries (-1 for the ones that aren't
+  // metadata.)
+  struct MetadataValue {
+    bool IsNode;
+    std::string String;
+    std::vector<int64_t> Operands;
+    llvm::Value *Built;
+    bool Building;
+
+    MetadataValue() : IsNode(false), Built(NULL), Building(false) { }
+  };
+
+  llvm::BitstreamCursor &Stream;
+  llvm::LLVMContext &Context;
+
+  // The IDs of the metadata types in the type table.
+  std::vector<bool> MetadataTypes;
+  std::vector<MetadataValue> Values;
+  // (name, indices of the nodes) of the named metadata of interest
+  std::vector<std::pair<std::string, std::vector<uint64_t> > > NamedNodes;
+
+  bool isMetadataType(uint64_t TypeID) const {
+    return (TypeID < MetadataTypes.size()) && MetadataTypes[TypeID];
+  }
+
+  bool parseTypeTable() {
+    if (Stream.EnterSubBlock(llvm::bitc::TYPE_BLOCK_ID_NEW)) {
+      return false;
+    }
+
+    llvm::SmallVector<uint64_t, 64> Record;
+    while (true) {
+      llvm::BitstreamEntry Entry = Stream.advanceSkippingSubblocks();
+      switch (Entry.Kind) {
+      case llvm::BitstreamEntry::SubBlock:
+      case llvm::BitstreamEntry::Error:
+        return false;
+      case llvm::BitstreamEntry::EndBlock:
+        return true;
+      case llvm::BitstreamEntry::Record:
+        break;
+      }
+
+      Record.clear();
+      switch (Stream.readRecord(Entry.ID, Record)) {
+      case llvm::bitc::TYPE_CODE_NUMENTRY:
+      case llvm::bitc::TYPE_CODE_STRUCT_NAME:
+        // These don't define a type.
+        break;
+      case llvm::bitc::TYPE_CODE_METADATA:
+        MetadataTypes.push_back(true);
+        break;
+      default:
+        MetadataTypes.push_back(false);
+        break;
+      }
+    }
+  }
+
+  static void recordToString(const llvm::SmallVectorImpl<uint64_t> &Record,
+                             std::string &Result) {
+    Result.resize(Record.size());
+    for (unsigned i = 0, e = Record.size(); i != e; i++) {
+      Result[i] = static_cast<char>(Record[i]);
+    }
+  }
+
+  bool parseMetadata() {
+    if (Stream.EnterSubBlock(llvm::bitc::METADATA_BLOCK_ID)) {
+      return false;
+    }
+
+    llvm::SmallVector<uint64_t, 64> Record;
+    std::string Name;
+    while (true) {
+      llvm::BitstreamEntry Entry = Stream.advanceSkippingSubblocks();
+      switch (Entry.Kind) {
+      case llvm::BitstreamEntry::SubBlock:
+      case llvm::BitstreamEntry::Error:
+        return false;
+      case llvm::BitstreamEntry::EndBlock:
+        return true;
+      case llvm::BitstreamEntry::Record:
+        break;
+      }
+
+      Record.clear();
+      switch (Stream.readRecord(Entry.ID, Record)) {
+      default:
+        break;
+      case llvm::bitc::METADATA_STRING: {
+        Values.push_back(MetadataValue());
+        recordToString(Record, Values.back().String);
+        break;
+      }
+      case llvm::bitc::METADATA_NODE:
+      case llvm::bitc::METADATA_FN_NODE: {
+        if ((Record.size() % 2) != 0) {
+          return false;
+        }
+        Values.push_back(MetadataValue());
+        MetadataValue &Node = Values.back();
+        Node.IsNode = true;
+        for (unsigned i = 0, e = Record.size(); i != e; i += 2) {
+          Node.Operands.push_back(isMetadataType(Record[i]) ?
+                                      static_cast<int64_t>(Record[i + 1]) :
+                                      -1);
+        }
+        break;
+      }
+      case llvm::bitc::METADATA_NAME: {
+        recordToString(Record, Name);
+
+        // METADATA_NAME is always followed by METADATA_NAMED_NODE.
+        Entry = Stream.advanceSkippingSubblocks();
+        if (Entry.Kind != llvm::BitstreamEntry::Record) {
+          return false;
+        }
+        Record.clear();
+        if (Stream.readRecord(Entry.ID, Record) !=
+                llvm::bitc::METADATA_NAMED_NODE) {
+          return false;
+        }
+
+        if (isExtractedMetadataName(Name)) {
+          NamedNodes.push_back(std::make_pair(Name, std::vector<uint64_t>(
+                                                  Record.begin(),
+                                                  Record.end())));
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  // Return the value of the entry #Index of the metadata value list, or NULL
+  // if it's invalid (or part of a cycle, which the extracted metadata never
+  // have.)
+  llvm::Value *buildValue(int64_t Index) {
+    if ((Index < 0) || (static_cast<uint64_t>(Index) >= Values.size())) {
+      return NULL;
+    }
+
+    MetadataValue &V = Values[Index];
+    if ((V.Built != NULL) || V.Building) {
+      return V.Built;
+    }
+
+    if (!V.IsNode) {
+      V.Built = llvm::MDString::get(Context, V.String);
+    } else {
+      V.Building = true;
+      llvm::SmallVector<llvm::Value *, 8> Elts;
+      for (unsigned i = 0, e = V.Operands.size(); i != e; i++) {
+        Elts.push_back(buildValue(V.Operands[i]));
+      }
+      // Values may have been reallocated. Don't use V from here on.
+      Values[Index].Built = llvm::MDNode::get(Context, Elts);
+      Values[Index].Building = false;
+    }
+
+    return Values[Index].Built;
+  }
+
+ public:
+  ModuleMetadataReader(llvm::BitstreamCursor &Stream,
+                       llvm::LLVMContext &Context)
+      : Stream(Stream), Context(Context) {
+  }
+
+  // Parse the module block the stream is at. Return the module holding its
+  // named metadata (owned by Context) or NULL if the block is in a format
+  // this reader doesn't handle.
+  llvm::Module *parseModule() {
+    if (Stream.EnterSubBlock(llvm::bitc::MODULE_BLOCK_ID)) {
+      return NULL;
+    }
+
+    bool Done = false;
+    while (!Done) {
+      llvm::BitstreamEntry Entry = Stream.advance();
+      switch (Entry.Kind) {
+      case llvm::BitstreamEntry::Error:
+        return NULL;
+      case llvm::BitstreamEntry::EndBlock:
+        Done = true;
+        break;
+      case llvm::BitstreamEntry::Record:
+        Stream.skipRecord(Entry.ID);
+        break;
+      case llvm::BitstreamEntry::SubBlock:
+        switch (Entry.ID) {
+        case llvm::bitc::BLOCKINFO_BLOCK_ID:
+          if (Stream.ReadBlockInfoBlock()) {
+            return NULL;
+          }
+          break;
+        case llvm::bitc::TYPE_BLOCK_ID_NEW:
+          if (!parseTypeTable()) {
+            return NULL;
+          }
+          break;
+        case llvm::bitc::METADATA_BLOCK_ID:
+          // The module-level metadata block precedes the function blocks and
+          // has all the named metadata. Nothing after it is needed.
+          if (!parseMetadata()) {
+            return NULL;
+          }
+          Done = true;
+          break;
+        default:
+          // The function blocks and everything else.
+          if (Stream.SkipBlock()) {
+            return NULL;
+          }
+          break;
+        }
+        break;
+      }
+    }
+
+    if (MetadataTypes.empty()) {
+      // No (or an older) type table. Leave it to the bitcode reader.
+      return NULL;
+    }
+
+    llvm::Module *M = new llvm::Module("", Context);
+    for (unsigned i = 0, e = NamedNodes.size(); i != e; i++) {
+      llvm::NamedMDNode *NMD =
+          M->getOrInsertNamedMetadata(NamedNodes[i].first);
+      const std::vector<uint64_t> &Nodes = NamedNodes[i].second;
+      for (unsigned j = 0, je = Nodes.size(); j != je; j++) {
+        llvm::MDNode *MD = llvm::dyn_cast_or_null<llvm::MDNode>(
+            buildValue(static_cast<int64_t>(Nodes[j])));
+        if (MD == NULL) {
+          ALOGE("Malformed named metadata %s", NamedNodes[i].first.c_str());
+          delete M;
+          return NULL;
+        }
+        NMD->addOperand(MD);
+      }
+    }
+
+    return M;
+  }
+};
+
+}  // end anonymous namespace
+
+
+// Read the named metadata of interest in the pBitcodeSize bytes of bitcode at
+// pBitcode into a module of pContext without parsing the rest of it. Return
+// NULL if the bitcode can't be read this way.
+static llvm::Module *readModuleMetadata(const char *pBitcode,
+                                        size_t pBitcodeSize,
+                                        llvm::LLVMContext &pContext) {
+  const unsigned char *BufPtr =
+      reinterpret_cast<const unsigned char *>(pBitcode);
+  const unsigned char *BufEnd = BufPtr + pBitcodeSize;
+
+  if (llvm::isBitcodeWrapper(BufPtr, BufEnd) &&
+      llvm::SkipBitcodeWrapperHeader(BufPtr, BufEnd, true)) {
+    return NULL;
+  }
+  if (((BufEnd - BufPtr) % 4) != 0) {
+    return NULL;
+  }
+
+  llvm::BitstreamReader Reader(BufPtr, BufEnd);
+  llvm::BitstreamCursor Stream(Reader);
+
+  // Sniff for the signature.
+  if ((Stream.Read(8) != 'B') ||
+      (Stream.Read(8) != 'C') ||
+      (Stream.Read(4) != 0x0) ||
+      (Stream.Read(4) != 0xC) ||
+      (Stream.Read(4) != 0xE) ||
+      (Stream.Read(4) != 0xD)) {
+    return NULL;
+  }
+
+  while (!Stream.AtEndOfStream()) {
+    llvm::BitstreamEntry Entry = Stream.advance();
+    if (Entry.Kind != llvm::BitstreamEntry::SubBlock) {
+      return NULL;
+    }
+
+    if (Entry.ID == llvm::bitc::BLOCKINFO_BLOCK_ID) {
+      if (Stream.ReadBlockInfoBlock()) {
+        return NULL;
+      }
+    } else if (Entry.ID == llvm::bitc::MODULE_BLOCK_ID) {
+      ModuleMetadataReader MetadataReader(Stream, pContext);
+      return MetadataReader.parseModule();
+    } else if (Stream.SkipBlock()) {
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
 
 MetadataExtractor::MetadataExtractor(const char *bitcode, size_t bitcodeSize)
     : mModule(NULL), mBitcode(bitcode), mBitcodeSize(bitcodeSize),
-      mExportVarCount(0), mExportFuncCount(0), mExportForEachSignatureCount(0),
+      mStringTable(1, '\0'), mExportVarCount(0), mExportFuncCount(0),
+      mExportForEachSignatureCount(0),
       mExportVarNameList(NULL), mExportFuncNameList(NULL),
       mExportForEachNameList(NULL), mExportForEachSignatureList(NULL),
       mPragmaCount(0), mPragmaKeyList(NULL), mPragmaValueList(NULL),
@@ -76,7 +406,8 @@ MetadataExtractor::MetadataExtractor(const char *bitcode, size_t bitcodeSize)
 
 
 MetadataExtractor::MetadataExtractor(const llvm::Module *module)
-    : mModule(module), mBitcode(NULL), mBitcodeSize(0), mExportVarCount(0),
+    : mModule(module), mBitcode(NULL), mBitcodeSize(0),
+      mStringTable(1, '\0'), mExportVarCount(0),
       mExportFuncCount(0), mExportForEachSignatureCount(0),
       mExportVarNameList(NULL), mExportFuncNameList(NULL),
       mExportForEachNameList(NULL), mExportForEachSignatureList(NULL),
@@ -89,46 +420,19 @@ MetadataExtractor::MetadataExtractor(const llvm::Module *module)
 
 
 MetadataExtractor::~MetadataExtractor() {
-  if (mExportVarNameList) {
-    for (size_t i = 0; i < mExportVarCount; i++) {
-        delete [] mExportVarNameList[i];
-        mExportVarNameList[i] = NULL;
-    }
-  }
+  // The names themselves are in mStringTable.
   delete [] mExportVarNameList;
   mExportVarNameList = NULL;
 
-  if (mExportFuncNameList) {
-    for (size_t i = 0; i < mExportFuncCount; i++) {
-        delete [] mExportFuncNameList[i];
-        mExportFuncNameList[i] = NULL;
-    }
-  }
   delete [] mExportFuncNameList;
   mExportFuncNameList = NULL;
 
-  if (mExportForEachNameList) {
-    for (size_t i = 0; i < mExportForEachSignatureCount; i++) {
-        delete [] mExportForEachNameList[i];
-        mExportForEachNameList[i] = NULL;
-    }
-  }
   delete [] mExportForEachNameList;
   mExportForEachNameList = NULL;
 
   delete [] mExportForEachSignatureList;
   mExportForEachSignatureList = NULL;
 
-  for (size_t i = 0; i < mPragmaCount; i++) {
-    if (mPragmaKeyList) {
-      delete [] mPragmaKeyList[i];
-      mPragmaKeyList[i] = NULL;
-    }
-    if (mPragmaValueList) {
-      delete [] mPragmaValueList[i];
-      mPragmaValueList[i] = NULL;
-    }
-  }
   delete [] mPragmaKeyList;
   mPragmaKeyList = NULL;
   delete [] mPragmaValueList;
@@ -160,7 +464,8 @@ bool MetadataExtractor::populateObjectSlotMetadata(
     llvm::MDNode *ObjectSlot = ObjectSlotMetadata->getOperand(i);
     if (ObjectSlot != NULL && ObjectSlot->getNumOperands() == 1) {
       llvm::Value *SlotMDS = ObjectSlot->getOperand(0);
-      if (SlotMDS->getValueID() == llvm::Value::MDStringVal) {
+      if (SlotMDS != NULL &&
+          SlotMDS->getValueID() == llvm::Value::MDStringVal) {
         llvm::StringRef Slot =
             static_cast<llvm::MDString*>(SlotMDS)->getString();
         uint32_t USlot = 0;
@@ -179,18 +484,50 @@ bool MetadataExtractor::populateObjectSlotMetadata(
 }
 
 
-static const char *createStringFromValue(llvm::Value *v) {
-  if (v->getValueID() != llvm::Value::MDStringVal) {
-    return NULL;
+// Append the string v (if it's one) to Table and return its offset in Table,
+// or 0 (the offset of the empty string at the beginning) if it's not a string.
+static uint32_t appendStringFromValue(std::string &Table, llvm::Value *v) {
+  if ((v == NULL) || (v->getValueID() != llvm::Value::MDStringVal)) {
+    return 0;
   }
 
   llvm::StringRef ref = static_cast<llvm::MDString*>(v)->getString();
 
-  char *c = new char[ref.size() + 1];
-  memcpy(c, ref.data(), ref.size());
-  c[ref.size()] = '\0';
+  uint32_t offset = Table.size();
+  Table.append(ref.data(), ref.size());
+  Table.push_back('\0');
+
+  return offset;
+}
+
+
+// Return a list of Offsets.size() strings pointing into Table (NULL for the
+// offset 0) or NULL if Offsets is empty.
+static const char **createListFromOffsets(
+    const std::string &Table, const std::vector<uint32_t> &Offsets) {
+  if (Offsets.empty()) {
+    return NULL;
+  }
+
+  const char **List = new const char*[Offsets.size()];
+  for (size_t i = 0; i < Offsets.size(); i++) {
+    List[i] = (Offsets[i] != 0) ? (Table.data() + Offsets[i]) : NULL;
+  }
 
-  return c;
+  return List;
+}
+
+
+void MetadataExtractor::buildNameLists() {
+  // mStringTable is complete. The pointers into it stay valid from now on.
+  mExportVarNameList = createListFromOffsets(mStringTable,
+                                             mExportVarNameOffsets);
+  mExportFuncNameList = createListFromOffsets(mStringTable,
+                                              mExportFuncNameOffsets);
+  mExportForEachNameList = createListFromOffsets(mStringTable,
+                                                 mExportForEachNameOffsets);
+  mPragmaKeyList = createListFromOffsets(mStringTable, mPragmaKeyOffsets);
+  mPragmaValueList = createListFromOffsets(mStringTable, mPragmaValueOffsets);
 }
 
 
@@ -205,22 +542,20 @@ void MetadataExtractor::populatePragmaMetadata(
     return;
   }
 
-  const char **TmpKeyList = new const char*[mPragmaCount];
-  const char **TmpValueList = new const char*[mPragmaCount];
+  mPragmaKeyOffsets.assign(mPragmaCount, 0);
+  mPragmaValueOffsets.assign(mPragmaCount, 0);
 
   for (size_t i = 0; i < mPragmaCount; i++) {
     llvm::MDNode *Pragma = PragmaMetadata->getOperand(i);
     if (Pragma != NULL && Pragma->getNumOperands() == 2) {
       llvm::Value *PragmaKeyMDS = Pragma->getOperand(0);
-      TmpKeyList[i] = createStringFromValue(PragmaKeyMDS);
+      mPragmaKeyOffsets[i] = appendStringFromValue(mStringTable, PragmaKeyMDS);
       llvm::Value *PragmaValueMDS = Pragma->getOperand(1);
-      TmpValueList[i] = createStringFromValue(PragmaValueMDS);
+      mPragmaValueOffsets[i] = appendStringFromValue(mStringTable,
+                                                     PragmaValueMDS);
     }
   }
 
-  mPragmaKeyList = TmpKeyList;
-  mPragmaValueList = TmpValueList;
-
   // Check to see if we have any FP precision-related pragmas.
   std::string Relaxed("rs_fp_relaxed");
   std::string Imprecise("rs_fp_imprecise");
@@ -229,12 +564,13 @@ void MetadataExtractor::populatePragmaMetadata(
   bool ImprecisePragmaSeen = false;
 
   for (size_t i = 0; i < mPragmaCount; i++) {
-    if (!Relaxed.compare(mPragmaKeyList[i])) {
+    const char *Key = getString(mPragmaKeyOffsets[i]);
+    if (!Relaxed.compare(Key)) {
       if (RelaxedPragmaSeen || ImprecisePragmaSeen) {
         ALOGE("Multiple float precision pragmas specified!");
       }
       RelaxedPragmaSeen = true;
-    } else if (!Imprecise.compare(mPragmaKeyList[i])) {
+    } else if (!Imprecise.compare(Key)) {
       if (RelaxedPragmaSeen || ImprecisePragmaSeen) {
         ALOGE("Multiple float precision pragmas specified!");
       }
@@ -287,17 +623,16 @@ bool MetadataExtractor::populateVarNameMetadata(
     return true;
   }
 
-  const char **TmpNameList = new const char *[mExportVarCount];
+  mExportVarNameOffsets.assign(mExportVarCount, 0);
 
   for (size_t i = 0; i < mExportVarCount; i++) {
     llvm::MDNode *Name = VarNameMetadata->getOperand(i);
     if (Name != NULL && Name->getNumOperands() > 1) {
-      TmpNameList[i] = createStringFromValue(Name->getOperand(0));
+      mExportVarNameOffsets[i] = appendStringFromValue(mStringTable,
+                                                       Name->getOperand(0));
     }
   }
 
-  mExportVarNameList = TmpNameList;
-
   return true;
 }
 
@@ -313,17 +648,16 @@ bool MetadataExtractor::populateFuncNameMetadata(
     return true;
   }
 
-  const char **TmpNameList = new const char*[mExportFuncCount];
+  mExportFuncNameOffsets.assign(mExportFuncCount, 0);
 
   for (size_t i = 0; i < mExportFuncCount; i++) {
     llvm::MDNode *Name = FuncNameMetadata->getOperand(i);
     if (Name != NULL && Name->getNumOperands() == 1) {
-      TmpNameList[i] = createStringFromValue(Name->getOperand(0));
+      mExportFuncNameOffsets[i] = appendStringFromValue(mStringTable,
+                                                        Name->getOperand(0));
     }
   }
 
-  mExportFuncNameList = TmpNameList;
-
   return true;
 }
 
@@ -336,14 +670,12 @@ bool MetadataExtractor::populateForEachMetadata(
     // section for ForEach. We generate a full signature for a "root" function
     // which means that we need to set the bottom 5 bits in the mask.
     mExportForEachSignatureCount = 1;
-    char **TmpNameList = new char*[mExportForEachSignatureCount];
-    TmpNameList[0] = new char[5];
-    strncpy(TmpNameList[0], "root", 5);
+    mExportForEachNameOffsets.assign(1, mStringTable.size());
+    mStringTable.append("root", 5);
 
     uint32_t *TmpSigList = new uint32_t[mExportForEachSignatureCount];
     TmpSigList[0] = 0x1f;
 
-    mExportForEachNameList = (const char**)TmpNameList;
     mExportForEachSignatureList = TmpSigList;
     return true;
   }
@@ -360,18 +692,19 @@ bool MetadataExtractor::populateForEachMetadata(
   }
 
   uint32_t *TmpSigList = new uint32_t[mExportForEachSignatureCount];
-  const char **TmpNameList = new const char*[mExportForEachSignatureCount];
+  mExportForEachNameOffsets.assign(mExportForEachSignatureCount, 0);
 
   for (size_t i = 0; i < mExportForEachSignatureCount; i++) {
     llvm::MDNode *SigNode = Signatures->getOperand(i);
     if (SigNode != NULL && SigNode->getNumOperands() == 1) {
       llvm::Value *SigVal = SigNode->getOperand(0);
-      if (SigVal->getValueID() == llvm::Value::MDStringVal) {
+      if (SigVal != NULL && SigVal->getValueID() == llvm::Value::MDStringVal) {
         llvm::StringRef SigString =
             static_cast<llvm::MDString*>(SigVal)->getString();
         uint32_t Signature = 0;
         if (SigString.getAsInteger(10, Signature)) {
           ALOGE("Non-integer signature value '%s'", SigString.str().c_str());
+          delete [] TmpSigList;
           return false;
         }
         TmpSigList[i] = Signature;
@@ -383,7 +716,8 @@ bool MetadataExtractor::populateForEachMetadata(
     for (size_t i = 0; i < mExportForEachSignatureCount; i++) {
       llvm::MDNode *Name = Names->getOperand(i);
       if (Name != NULL && Name->getNumOperands() == 1) {
-        TmpNameList[i] = createStringFromValue(Name->getOperand(0));
+        mExportForEachNameOffsets[i] =
+            appendStringFromValue(mStringTable, Name->getOperand(0));
       }
     }
   } else {
@@ -391,12 +725,10 @@ bool MetadataExtractor::populateForEachMetadata(
       ALOGE("mExportForEachSignatureCount = %zu, but should be 1",
             mExportForEachSignatureCount);
     }
-    char *RootName = new char[5];
-    strncpy(RootName, "root", 5);
-    TmpNameList[0] = RootName;
+    mExportForEachNameOffsets[0] = mStringTable.size();
+    mStringTable.append("root", 5);
   }
 
-  mExportForEachNameList = TmpNameList;
   mExportForEachSignatureList = TmpSigList;
 
   return true;
@@ -413,6 +745,13 @@ bool MetadataExtractor::extract() {
 
   if (!mModule) {
     mContext.reset(new llvm::LLVMContext());
+
+    // Only the named metadata are needed. Try to get them without parsing
+    // the whole module first.
+    mModule = readModuleMetadata(mBitcode, mBitcodeSize, *mContext);
+  }
+
+  if (!mModule) {
     llvm::OwningPtr<llvm::MemoryBuffer> MEM(
       llvm::MemoryBuffer::getMemBuffer(
         llvm::StringRef(mBitcode, mBitcodeSize), "", false));
@@ -464,6 +803,8 @@ bool MetadataExtractor::extract() {
     return false;
   }
 
+  buildNameLists();
+
   return true;
 }
 
@@ -24,6 +24,7 @@ llvm_wrap_SRC_FILES := \
   file_wrapper_input.cpp \
   file_wrapper_output.cpp \
   in_memory_wrapper_input.cpp \
+  mapped_file_wrapper_input.cpp \
   wrapper_output.cpp
 
 llvm_wrap_C_INCLUDES := $(LOCAL_PATH)/../../include
@@ -47,6 +47,9 @@ static const uint32_t kAndroidTargetAPI = 0;
 static const uint32_t kAndroidDefaultCompilerVersion = 0;
 static const uint32_t kAndroidDefaultOptimizationLevel = 3;
 
+// Size of the data of a kAndroidSourceSHA1 field.
+static const size_t kAndroidSourceSHA1Size = 20;
+
 // PNaCl bitcode version number.
 static const uint32_t kPnaclBitcodeVersion = 0;
 
@@ -61,12 +64,14 @@ BitcodeWrapperer::BitcodeWrapperer(WrapperInput* infile, WrapperOutput* outfile)
       cursor_(0),
       infile_at_eof_(false),
       infile_bc_offset_(0),
+      infile_pos_(0),
       wrapper_bc_offset_(0),
       wrapper_bc_size_(0),
       android_header_version_(kAndroidHeaderVersion),
       android_target_api_(kAndroidTargetAPI),
       android_compiler_version_(kAndroidDefaultCompilerVersion),
       android_optimization_level_(kAndroidDefaultOptimizationLevel),
+      android_source_sha1_(NULL),
       pnacl_bc_version_(0),
       error_(false) {
   buffer_.resize(kBitcodeWrappererBufferSize);
@@ -96,6 +101,7 @@ void BitcodeWrapperer::ClearBuffer() {
 
 bool BitcodeWrapperer::Seek(uint32_t pos) {
   if (infile_ != NULL && infile_->Seek(pos)) {
+    infile_pos_ = pos;
     ClearBuffer();
     return true;
   }
@@ -249,6 +255,11 @@ bool BitcodeWrapperer::ParseWrapperHeader() {
             android_optimization_level_ = tempIntField.val;
           }
           break;
+        case BCHeaderField::kAndroidSourceSHA1:
+          if (field.getLen() == kAndroidSourceSHA1Size) {
+            android_source_sha1_ = variable_field_data_.back();
+          }
+          break;
         default:
           // Ignore other field types for now
           break;
@@ -309,6 +320,18 @@ bool BitcodeWrapperer::IsInputBitcodeFile() {
 }
 
 bool BitcodeWrapperer::BufferCopyInToOut(uint32_t size) {
+  // Write an input that's in memory straight to the output. The bitcode must
+  // be the last thing in the input.
+  const uint8_t* data = (infile_ != NULL) ? infile_->Data() : NULL;
+  if (data != NULL) {
+    off_t in_size = GetInFileSize();
+    if (in_size < 0 || static_cast<size_t>(in_size) < size ||
+        infile_pos_ != static_cast<size_t>(in_size) - size) {
+      return false;
+    }
+    return outfile_->Write(data + infile_pos_, size);
+  }
+
   while (size > 0) {
     // Be sure buffer is non-empty before writing.
     if (0 == buffer_size_) {
@@ -333,6 +356,20 @@ void BitcodeWrapperer::AddHeaderField(BCHeaderField* field) {
   wrapper_bc_offset_ += field->GetTotalSize();
 }
 
+void BitcodeWrapperer::SetAndroidSourceSHA1(const uint8_t* sha1) {
+  if (android_source_sha1_ != NULL) {
+    memcpy(android_source_sha1_, sha1, kAndroidSourceSHA1Size);
+    return;
+  }
+
+  variable_field_data_.push_back(new uint8_t[kAndroidSourceSHA1Size]);
+  android_source_sha1_ = variable_field_data_.back();
+  memcpy(android_source_sha1_, sha1, kAndroidSourceSHA1Size);
+  BCHeaderField field(BCHeaderField::kAndroidSourceSHA1,
+                      kAndroidSourceSHA1Size, android_source_sha1_);
+  AddHeaderField(&field);
+}
+
 bool BitcodeWrapperer::WriteBitcodeWrapperHeader() {
   return
       // Note: This writes out the 4 word header required by llvm wrapped
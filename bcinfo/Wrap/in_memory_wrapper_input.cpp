@@ -50,6 +50,10 @@ off_t InMemoryWrapperInput::Size() {
   return _size;
 }
 
+const uint8_t* InMemoryWrapperInput::Data() {
+  return reinterpret_cast<const uint8_t*>(_buffer);
+}
+
 bool InMemoryWrapperInput::Seek(uint32_t pos) {
   if (pos < _size) {
     _pos = pos;
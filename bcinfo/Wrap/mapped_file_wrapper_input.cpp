@@ -0,0 +1,85 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bcinfo/Wrap/mapped_file_wrapper_input.h"
+
+MappedFileWrapperInput::MappedFileWrapperInput(const char* name) :
+    _name(name), _data(NULL), _pos(0), _size(0) {
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to open: %s\n", name);
+    exit(1);
+  }
+  struct stat st;
+  if (0 != fstat(fd, &st)) {
+    fprintf(stderr, "Unable to compute file size: %s\n", name);
+    exit(1);
+  }
+  _size = st.st_size;
+  if (_size > 0) {
+    void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == data) {
+      fprintf(stderr, "Unable to map: %s\n", name);
+      exit(1);
+    }
+    _data = static_cast<const uint8_t*>(data);
+  }
+  close(fd);
+}
+
+MappedFileWrapperInput::~MappedFileWrapperInput() {
+  if (_data != NULL) {
+    munmap(const_cast<uint8_t*>(_data), _size);
+  }
+}
+
+size_t MappedFileWrapperInput::Read(uint8_t* buffer, size_t wanted) {
+  if (!buffer || _pos >= _size) {
+    return 0;
+  }
+  size_t found = (wanted < _size - _pos) ? wanted : (_size - _pos);
+  memcpy(buffer, _data + _pos, found);
+  _pos += found;
+  return found;
+}
+
+bool MappedFileWrapperInput::AtEof() {
+  return (_pos >= _size);
+}
+
+off_t MappedFileWrapperInput::Size() {
+  return _size;
+}
+
+bool MappedFileWrapperInput::Seek(uint32_t pos) {
+  if (pos < _size) {
+    _pos = pos;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+const uint8_t* MappedFileWrapperInput::Data() {
+  return _data;
+}
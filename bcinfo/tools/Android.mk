@@ -31,6 +31,7 @@ LOCAL_SHARED_LIBRARIES := \
   libbcinfo
 
 LOCAL_STATIC_LIBRARIES := \
+  libbccToolUtil \
   libLLVMBitReader \
   libLLVMBitWriter \
   libLLVMCore \
@@ -39,9 +40,10 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_CFLAGS += -D__HOST__
 
 LOCAL_C_INCLUDES := \
-  $(LOCAL_PATH)/../../include
+  $(LOCAL_PATH)/../../include \
+  $(LOCAL_PATH)/../../tools/common
 
-LOCAL_LDLIBS = -ldl
+LOCAL_LDLIBS = -ldl -lpthread
 
 include $(LLVM_ROOT_PATH)/llvm-host-build.mk
 include $(BUILD_HOST_EXECUTABLE)
@@ -26,8 +26,11 @@
 #include <llvm/IR/Module.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/ToolOutputFile.h>
 
+#include "ToolUtil.h"
+
 #include <ctype.h>
 #include <dlfcn.h>
 #include <stdarg.h>
@@ -36,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <errno.h>
 #include <sys/stat.h>
@@ -48,21 +52,28 @@
 
 // This file corresponds to the standalone bcinfo tool. It prints a variety of
 // information about a supplied bitcode input file.
+//
+// With -b <list>, it instead extracts the metadata of every bitcode file named
+// in <list> (one path per line) on -j <jobs> threads and prints one JSON
+// object per file, in the order of the list.
 
 std::string inFile;
 std::string outFile;
 std::string infoFile;
+std::string batchFile;
 
 extern int opterr;
 extern int optind;
+extern char *optarg;
 
 bool translateFlag = false;
 bool infoFlag = false;
 bool verbose = true;
+unsigned numJobs = 1;
 
 static int parseOption(int argc, char** argv) {
   int c;
-  while ((c = getopt(argc, argv, "itv")) != -1) {
+  while ((c = getopt(argc, argv, "itvb:j:")) != -1) {
     opterr = 0;
 
     switch(c) {
@@ -84,6 +95,17 @@ static int parseOption(int argc, char** argv) {
         verbose = true;
         break;
 
+      case 'b':
+        batchFile = optarg;
+        break;
+
+      case 'j':
+        numJobs = strtoul(optarg, NULL, 10);
+        if (!numJobs) {
+          numJobs = 1;
+        }
+        break;
+
       default:
         // Critical error occurs
         return 0;
@@ -91,6 +113,10 @@ static int parseOption(int argc, char** argv) {
     }
   }
 
+  if (batchFile.length()) {
+    return 1;
+  }
+
   if(optind >= argc) {
     fprintf(stderr, "input file required\n");
     return 0;
@@ -216,48 +242,203 @@ static void dumpMetadata(bcinfo::MetadataExtractor *ME) {
 }
 
 
-static size_t readBitcode(const char **bitcode) {
-  if (!inFile.length()) {
-    fprintf(stderr, "input file required\n");
-    return 0;
+static void appendJSONUInt(std::string &out, const char *key, unsigned v) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%u", v);
+  out += ",\"";
+  out += key;
+  out += "\":";
+  out += buf;
+}
+
+
+static void appendJSONStringList(std::string &out, const char *key,
+                                 const char **list, size_t count) {
+  out += ",\"";
+  out += key;
+  out += "\":[";
+  for (size_t i = 0; i < count; i++) {
+    if (i) {
+      out += ',';
+    }
+    bcc::tools::AppendJSONString(out, list[i]);
   }
+  out += ']';
+}
 
-  struct stat statInFile;
-  if (stat(inFile.c_str(), &statInFile) < 0) {
-    fprintf(stderr, "Unable to stat input file: %s\n", strerror(errno));
-    return 0;
+
+/**
+ * Extract the metadata of the bitcode file \p path into a JSON object (on a
+ * single line) in \p out.
+ */
+static void dumpJSON(const std::string &path, std::string &out) {
+  out = "{\"file\":";
+  bcc::tools::AppendJSONString(out, path);
+
+  bcc::tools::MappedInputFile input;
+  if (!input.map(path)) {
+    out += ",\"error\":\"could not read the file\"}";
+    return;
   }
 
-  if (!S_ISREG(statInFile.st_mode)) {
-    fprintf(stderr, "Input file should be a regular file.\n");
-    return 0;
+  bcinfo::BitcodeWrapper bcWrapper(input.getData(), input.getSize());
+  unsigned int version = 0;
+  if (bcWrapper.getBCFileType() == bcinfo::BC_WRAPPER) {
+    version = bcWrapper.getTargetAPI();
+  } else if (translateFlag) {
+    version = 12;
   }
 
-  FILE *in = fopen(inFile.c_str(), "r");
-  if (!in) {
-    fprintf(stderr, "Could not open input file %s\n", inFile.c_str());
-    return 0;
+  appendJSONUInt(out, "targetAPI", version);
+  appendJSONUInt(out, "compilerVersion", bcWrapper.getCompilerVersion());
+  appendJSONUInt(out, "optimizationLevel", bcWrapper.getOptimizationLevel());
+
+  bcinfo::BitcodeTranslator BT(bcWrapper, version);
+  if (!BT.translate()) {
+    out += ",\"error\":\"failed to translate bitcode\"}";
+    return;
   }
 
-  size_t bitcodeSize = statInFile.st_size;
+  bcinfo::MetadataExtractor ME(BT.getTranslatedBitcode(),
+                               BT.getTranslatedBitcodeSize());
+  if (!ME.extract()) {
+    out += ",\"error\":\"failed to get metadata\"}";
+    return;
+  }
 
-  *bitcode = (const char*) calloc(1, bitcodeSize + 1);
-  size_t nread = fread((void*) *bitcode, 1, bitcodeSize, in);
+  switch (ME.getRSFloatPrecision()) {
+  case bcinfo::RS_FP_Full:
+    out += ",\"floatPrecision\":\"Full\"";
+    break;
+  case bcinfo::RS_FP_Relaxed:
+    out += ",\"floatPrecision\":\"Relaxed\"";
+    break;
+  case bcinfo::RS_FP_Imprecise:
+    out += ",\"floatPrecision\":\"Imprecise\"";
+    break;
+  default:
+    out += ",\"floatPrecision\":\"UNKNOWN\"";
+    break;
+  }
+
+  appendJSONStringList(out, "exportVars", ME.getExportVarNameList(),
+                       ME.getExportVarCount());
+  appendJSONStringList(out, "exportFuncs", ME.getExportFuncNameList(),
+                       ME.getExportFuncCount());
+
+  out += ",\"exportForEach\":[";
+  const char **nameList = ME.getExportForEachNameList();
+  const uint32_t *sigList = ME.getExportForEachSignatureList();
+  for (size_t i = 0; i < ME.getExportForEachSignatureCount(); i++) {
+    out += (i ? ",{\"name\":" : "{\"name\":");
+    bcc::tools::AppendJSONString(out, nameList[i]);
+    appendJSONUInt(out, "signature", sigList[i]);
+    out += '}';
+  }
+  out += ']';
+
+  out += ",\"pragmas\":[";
+  const char **keyList = ME.getPragmaKeyList();
+  const char **valueList = ME.getPragmaValueList();
+  for (size_t i = 0; i < ME.getPragmaCount(); i++) {
+    out += (i ? ",{\"key\":" : "{\"key\":");
+    bcc::tools::AppendJSONString(out, keyList[i]);
+    out += ",\"value\":";
+    bcc::tools::AppendJSONString(out, valueList[i]);
+    out += '}';
+  }
+  out += ']';
+
+  out += ",\"objectSlots\":[";
+  const uint32_t *slotList = ME.getObjectSlotList();
+  for (size_t i = 0; i < ME.getObjectSlotCount(); i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), (i ? ",%u" : "%u"), slotList[i]);
+    out += buf;
+  }
+  out += "]}";
+}
 
-  if (nread != bitcodeSize)
-      fprintf(stderr, "Could not read all of file %s\n", inFile.c_str());
 
-  fclose(in);
-  return nread;
+// State shared among the workers of a batch.
+struct BatchState {
+  std::vector<std::string> inputs;
+  std::vector<std::string> results;
+  pthread_mutex_t lock;
+  // Index of the next input to process.
+  size_t next;
+};
+
+
+static void *runBatchWorker(void *arg) {
+  BatchState *state = static_cast<BatchState *>(arg);
+  while (true) {
+    pthread_mutex_lock(&state->lock);
+    size_t i = state->next++;
+    pthread_mutex_unlock(&state->lock);
+    if (i >= state->inputs.size()) {
+      break;
+    }
+    dumpJSON(state->inputs[i], state->results[i]);
+  }
+  return NULL;
 }
 
 
-static void releaseBitcode(const char **bitcode) {
-  if (bitcode && *bitcode) {
-    free((void*) *bitcode);
-    *bitcode = NULL;
+static int runBatch() {
+  FILE *list = fopen(batchFile.c_str(), "r");
+  if (!list) {
+    fprintf(stderr, "Could not open file list %s\n", batchFile.c_str());
+    return 1;
   }
-  return;
+
+  BatchState state;
+  char line[4096];
+  while (fgets(line, sizeof(line), list)) {
+    size_t l = strlen(line);
+    while (l && isspace((unsigned char) line[l - 1])) {
+      line[--l] = '\0';
+    }
+    if (l) {
+      state.inputs.push_back(line);
+    }
+  }
+  fclose(list);
+
+  state.results.resize(state.inputs.size());
+  state.next = 0;
+  pthread_mutex_init(&state.lock, NULL);
+
+  unsigned jobs = numJobs;
+  if (jobs > state.inputs.size()) {
+    jobs = state.inputs.size();
+  }
+  if ((jobs > 1) && !llvm::llvm_start_multithreaded()) {
+    fprintf(stderr, "LLVM is not built with thread support\n");
+    jobs = 1;
+  }
+
+  // The calling thread is a worker, too.
+  std::vector<pthread_t> workers;
+  for (unsigned i = 1; i < jobs; i++) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, runBatchWorker, &state) != 0) {
+      fprintf(stderr, "Failed to start worker thread #%u\n", i);
+      break;
+    }
+    workers.push_back(worker);
+  }
+  runBatchWorker(&state);
+  for (size_t i = 0; i < workers.size(); i++) {
+    pthread_join(workers[i], NULL);
+  }
+  pthread_mutex_destroy(&state.lock);
+
+  for (size_t i = 0; i < state.results.size(); i++) {
+    printf("%s\n", state.results[i].c_str());
+  }
+
+  return 0;
 }
 
 
@@ -267,8 +448,18 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const char *bitcode = NULL;
-  size_t bitcodeSize = readBitcode(&bitcode);
+  if (batchFile.length()) {
+    return runBatch();
+  }
+
+  bcc::tools::MappedInputFile input;
+  if (!inFile.length()) {
+    fprintf(stderr, "input file required\n");
+  } else {
+    input.map(inFile);
+  }
+  const char *bitcode = input.getData();
+  size_t bitcodeSize = input.getSize();
 
   unsigned int version = 0;
 
@@ -289,7 +480,7 @@ int main(int argc, char** argv) {
   }
 
   llvm::OwningPtr<bcinfo::BitcodeTranslator> BT;
-  BT.reset(new bcinfo::BitcodeTranslator(bitcode, bitcodeSize, version));
+  BT.reset(new bcinfo::BitcodeTranslator(bcWrapper, version));
   if (!BT->translate()) {
     fprintf(stderr, "failed to translate bitcode\n");
     return 3;
@@ -350,7 +541,5 @@ int main(int argc, char** argv) {
     }
   }
 
-  releaseBitcode(&bitcode);
-
   return 0;
 }
@@ -17,7 +17,11 @@
 #ifndef BCC_CONTEXT_H
 #define BCC_CONTEXT_H
 
+#include <cstddef>
+#include <string>
+
 namespace llvm {
+  class BumpPtrAllocator;
   class LLVMContext;
 }
 
@@ -42,6 +46,43 @@ public:
   void addSource(Source &pSource);
   void removeSource(Source &pSource);
 
+  // Return the source of the bitcode library at pPath, loading it into this
+  // context on the first request. The source is owned by the context and is
+  // shared by all the scripts linking with it, so it must not be modified
+  // (merge it with pPreserveSource set.) Return NULL on error.
+  Source *getOrLoadLibrary(const std::string &pPath);
+
+  // The LLVM context keeps the types and constants uniqued by every module
+  // ever created in it. To keep the memory of a long-lived context bounded,
+  // it's replaced with a fresh one (see recycle()) once pMaxCompiles scripts
+  // or pMaxBitcodeSize bytes of bitcode have been compiled in it. A limit of
+  // 0 means no limit, which is the default.
+  void setRecyclePolicy(unsigned pMaxCompiles, size_t pMaxBitcodeSize);
+
+  // Account for the compilation of a script of pBitcodeSize bytes of bitcode
+  // in this context, free the compile arena and recycle the context if the
+  // policy says so. Call it once the sources of the script are destroyed.
+  void recordCompile(size_t pBitcodeSize);
+
+  // The scratch memory of the compilation in progress in this context (e.g.,
+  // the names the passes are handed.) Its allocations are never freed one by
+  // one: the whole arena is released by recordCompile(). Like the LLVM
+  // context, it's used by one compilation at a time, so it takes no lock and
+  // the compilations of different contexts don't contend on it.
+  llvm::BumpPtrAllocator &getCompileArena();
+
+  // Copy pSize bytes of pString into the compile arena, NUL-terminated.
+  const char *copyToCompileArena(const char *pString, size_t pSize);
+
+  // The compilations since the LLVM context was (re)created.
+  unsigned getNumCompiles() const;
+  size_t getCompiledBitcodeSize() const;
+
+  // Destroy the loaded libraries and replace the LLVM context with a new one.
+  // Return false (and do nothing) if any other source is still alive, since
+  // its module lives in the current LLVM context.
+  bool recycle();
+
   // Global BCCContext
   static BCCContext *GetOrCreateGlobalContext();
   static void DestroyGlobalContext();
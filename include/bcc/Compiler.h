@@ -17,6 +17,11 @@
 #ifndef BCC_COMPILER_H
 #define BCC_COMPILER_H
 
+#include <string>
+#include <vector>
+
+#include "bcc/Support/CompilerStats.h"
+
 namespace llvm {
 
 class raw_ostream;
@@ -44,6 +49,9 @@ class Script;
 // 4. Once a compiler instance is created, you can use the compile() service
 //    to compile the file over and over again. Each call uses TargetMachine
 //    instance to construct the compilation passes.
+// 5. The compiler keeps the last few TargetMachines it created. Calling
+//    config() with a configuration seen before just switches back to the
+//    corresponding TargetMachine.
 class Compiler {
 public:
   enum ErrorCode {
@@ -68,15 +76,62 @@ public:
     kErrHookBeforeExecuteCodeGenPasses,
     kErrHookAfterExecuteCodeGenPasses,
 
-    kErrInvalidSource
+    kErrInvalidSource,
+
+    // The CancellationToken of the script was raised.
+    kErrCancelled
   };
 
   static const char *GetErrorString(enum ErrorCode pErrCode);
 
 private:
+  // A TargetMachine created by config() and the configuration it was created
+  // from. The target options aren't part of the key except for the ones the
+  // CompilerConfigs in bcc set up since llvm::TargetOptions can't be
+  // compared.
+  struct TargetEntry {
+    std::string mTriple;
+    std::string mCPU;
+    std::string mFeatureString;
+    int mRelocModel;
+    int mCodeModel;
+    int mOptLevel;
+    int mFloatABIType;
+    bool mUseSoftFloat;
+    bool mNoFramePointerElim;
+    bool mUseInitArray;
+    // The MC relaxation follows the emission profile.
+    bool mRelaxAll;
+
+    llvm::TargetMachine *mTarget;
+
+    TargetEntry(const CompilerConfig &pConfig);
+
+    bool matches(const CompilerConfig &pConfig) const;
+  };
+
+  // Most recently used entry comes first. mTarget is the TargetMachine of the
+  // first entry. Owns the TargetMachines.
+  std::vector<TargetEntry> mTargetPool;
+
+  // Maximum number of entries in mTargetPool.
+  static const unsigned MaxPooledTargets = 4;
+
   llvm::TargetMachine *mTarget;
   // LTO is enabled by default.
   bool mEnableLTO;
+  // CompilerConfig::LTOProfile given to the last config().
+  int mLTOProfile;
+  // CompilerConfig::getPrefetchDistance() of the last config().
+  unsigned mPrefetchDistance;
+  // CompilerConfig::getStreamBlockSize() of the last config().
+  unsigned mStreamBlockSize;
+  // CompilerConfig::getEnableGlobalMerge() of the last config().
+  bool mEnableGlobalMerge;
+
+  // See setStatsCallback().
+  CompilerStatsCallback mStatsCallback;
+  void *mStatsUserData;
 
   enum ErrorCode runLTO(Script &pScript);
   enum ErrorCode runCodeGen(Script &pScript, llvm::raw_ostream &pResult);
@@ -87,7 +142,11 @@ public:
 
   enum ErrorCode config(const CompilerConfig &pConfig);
 
-  // Compile a script and output the result to a LLVM stream.
+  // Compile a script and output the result to a LLVM stream. If the script
+  // has a CancellationToken, it's checked before and after each of its
+  // phases (bitcode materialization, LTO and code generation) and the
+  // compilation returns kErrCancelled once it's raised. A phase already
+  // running isn't interrupted.
   //
   // @param IRStream If not NULL, the LLVM-IR that is fed to code generation
   //                 will be written to IRStream.
@@ -104,6 +163,24 @@ public:
   void enableLTO(bool pEnable = true)
   { mEnableLTO = pEnable; }
 
+  // Return the CompilerConfig::LTOProfile of the following compilations.
+  int getLTOProfile() const
+  { return mLTOProfile; }
+
+  // Return the prefetch distance (in bytes) of the following compilations.
+  unsigned getPrefetchDistance() const
+  { return mPrefetchDistance; }
+
+  // Return the block size (in bytes) of the streaming entry points of the
+  // following compilations.
+  unsigned getStreamBlockSize() const
+  { return mStreamBlockSize; }
+
+  // Install (or remove with NULL) the callback to which each following
+  // compile() reports its CompilerStats.
+  void setStatsCallback(CompilerStatsCallback pCallback, void *pUserData)
+  { mStatsCallback = pCallback; mStatsUserData = pUserData; }
+
   virtual ~Compiler();
 
 protected:
@@ -41,4 +41,18 @@ typedef char ObjectBuffer;
 void registerObjectWithGDB(const ObjectBuffer* Object, std::size_t Size);
 void deregisterObjectWithGDB(const ObjectBuffer* Object);
 
+// Registered objects are handed to the debugger in batches of Size objects.
+// 1 (the default, unless the property debug.bcc.gdb.batch says otherwise)
+// hands each of them over right away and 0 defers them until
+// flushGDBRegistrations().
+void setGDBRegistrationBatchSize(std::size_t Size);
+
+// Hands the pending objects to the debugger. Without a debugger attached, the
+// objects are only linked into the JIT descriptor list, where the debugger
+// finds them once it attaches.
+void flushGDBRegistrations();
+
+// Returns true if a debugger is tracing the process.
+bool isDebuggerAttached();
+
 #endif // BCC_EXECUTION_ENGINE_GDB_JIT_REGISTRAR_H
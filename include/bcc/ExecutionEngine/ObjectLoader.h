@@ -17,12 +17,18 @@
 #ifndef BCC_EXECUTION_ENGINE_OBJECT_LOADER_H
 #define BCC_EXECUTION_ENGINE_OBJECT_LOADER_H
 
+#include <stdint.h>
+
 #include <cstddef>
 
 #include "bcc/Support/Log.h"
 
 #include <utils/Vector.h>
 
+namespace android {
+class FileMap;
+} // end namespace android
+
 namespace bcc {
 
 class FileBase;
@@ -40,12 +46,38 @@ public:
 private:
   ObjectLoaderImpl *mImpl;
 
-  void *mDebugImage;
+  // The object the debug image is built from, or NULL if the image has been
+  // built (or GDB debugging is disabled.)
+  android::FileMap *mDebugSource;
+
+  // The object file registered with GDB. It only has the ELF header, the
+  // section header table and the contents of the sections which aren't loaded
+  // (.debug_*, .symtab, .strtab, ...), see
+  // ObjectLoaderImpl::createDebugImage().
+  uint8_t *mDebugImage;
+  size_t mDebugImageSize;
+  bool mIsDebugImageRegistered;
+
+  ObjectLoader() : mImpl(NULL), mDebugSource(NULL), mDebugImage(NULL),
+                   mDebugImageSize(0), mIsDebugImageRegistered(false) { }
+
+  // If pDebugSource is non-NULL, it maps the same object as pMemStart and the
+  // debug image is built from it on demand (the loader takes a reference to
+  // it.) Otherwise, the debug image is built right after the load since
+  // pMemStart may go away.
+  static ObjectLoader *Load(void *pMemStart, size_t pMemSize, const char *pName,
+                            SymbolResolverInterface &pResolver,
+                            bool pEnableGDBDebug,
+                            android::FileMap *pDebugSource);
 
-  ObjectLoader() : mImpl(NULL), mDebugImage(0) { }
+  bool buildDebugImage();
 
 public:
   // Load from a in-memory object. pName is a descriptive name of this memory.
+  //
+  // If pEnableGDBDebug is true, the object is registered with GDB's JIT
+  // interface if a debugger is attached to the process at the time. If not,
+  // the registration is left to registerWithDebugger().
   static ObjectLoader *Load(void *pMemStart, size_t pMemSize, const char *pName,
                             SymbolResolverInterface &pResolver,
                             bool pEnableGDBDebug);
@@ -55,15 +87,49 @@ public:
                             SymbolResolverInterface &pResolver,
                             bool pEnableGDBDebug);
 
+  // Load the shared object pPath with the system dynamic linker. Its undefined
+  // symbols are bound by the dynamic linker as well, against the libraries
+  // already loaded into the process with global visibility. The sizes and
+  // sections of the symbols aren't available from the result.
+  static ObjectLoader *LoadSharedObject(const char *pPath);
+
+  // Append the names (pointing into pMem) of the undefined symbols of the
+  // relocatable object at pMem to pNames, once each, in the order Load()
+  // resolves them: by their first relocation, going through the relocation
+  // sections in order. Return false if pMem isn't a valid ELF object.
+  static bool GetUndefinedSymbols(const void *pMem, size_t pMemSize,
+                                  android::Vector<const char *> &pNames);
+
   void *getSymbolAddress(const char *pName) const;
 
   size_t getSymbolSize(const char *pName) const;
 
+  // Append the address of the symbol named pNames[i] followed by pSuffix (if
+  // non-NULL) to pAddrs for each i, or NULL if there's no such symbol.
+  void getSymbolAddresses(const android::Vector<const char *> &pNames,
+                          const char *pSuffix,
+                          android::Vector<void *> &pAddrs) const;
+
+  // Return the address where the contents of the section with index pIndex
+  // (in the section header table of the object) are loaded, or NULL if the
+  // section isn't loaded.
+  void *getSectionAddress(unsigned pIndex) const;
+
+  // Return true if any of the loaded sections is writable (.data, .bss, ...),
+  // i.e., the loaded image holds state of its own and can't be shared.
+  bool hasWritableSections() const;
+
   // Get the symbol name where the symbol is of the type pType. If kUnknownType
   // is given, it returns all symbols' names in the object.
   bool getSymbolNameList(android::Vector<const char *>& pNameList,
                          SymbolType pType = kUnknownType) const;
 
+  // Register the object with GDB's JIT interface, whether a debugger is
+  // attached or not. Return false if GDB debugging wasn't enabled at the load
+  // or the debug image couldn't be built. It's a no-op if the object is
+  // registered already.
+  bool registerWithDebugger();
+
   ~ObjectLoader();
 };
 
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_EXECUTION_ENGINE_PERF_MAP_H
+#define BCC_EXECUTION_ENGINE_PERF_MAP_H
+
+namespace bcc {
+
+class ObjectLoader;
+
+/*
+ * PerfMap tells the sampling profilers (perf, simpleperf) where the functions
+ * of the objects loaded by ObjectLoader are. The code of these objects lives
+ * in anonymous memory, so without it the samples in the kernels are unknown
+ * addresses. Each function is appended as "<start> <size> <name> [<object>]"
+ * (in hex) to perf-<pid>.map in the temporary directory (/data/local/tmp on
+ * the device, /tmp on the host), which the profilers read when they
+ * symbolize the samples.
+ *
+ * It's off unless enabled with SetEnabled() or the property
+ * debug.bcc.perfmap. When on, a load costs one line per function; the
+ * entries of an object which is unloaded are left behind, like those of any
+ * JIT writing a perf map.
+ */
+class PerfMap {
+private:
+  PerfMap(); // DISABLED.
+
+public:
+  static void SetEnabled(bool pEnable = true);
+  static bool IsEnabled();
+
+  // Append the functions of pLoader, named after pName (a descriptive name of
+  // the object, e.g., its path.) It's a no-op unless enabled.
+  static void Record(const ObjectLoader &pLoader, const char *pName);
+};
+
+} // end namespace bcc
+
+#endif // BCC_EXECUTION_ENGINE_PERF_MAP_H
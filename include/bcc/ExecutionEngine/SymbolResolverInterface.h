@@ -32,6 +32,13 @@ public:
   // Should this be a const method?
   virtual void *getAddress(const char *pName) = 0;
 
+  // Same as getAddress() for pName, the pOrder-th undefined symbol of the
+  // object being loaded (see ObjectLoader::GetUndefinedSymbols().) The loader
+  // may resolve the symbols out of order through this.
+  virtual void *getAddressOf(size_t pOrder, const char *pName) {
+    return getAddress(pName);
+  }
+
   virtual ~SymbolResolverInterface() { }
 };
 
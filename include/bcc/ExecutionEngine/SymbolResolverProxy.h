@@ -17,6 +17,14 @@
 #ifndef BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_PROXY_H
 #define BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_PROXY_H
 
+#include <stdint.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Mutex.h>
+
 #include "bcc/ExecutionEngine/SymbolResolverInterface.h"
 #include "bcc/Support/Log.h"
 
@@ -25,15 +33,120 @@
 namespace bcc {
 
 class SymbolResolverProxy : public SymbolResolverInterface {
+public:
+  // The ID of the symbols outside the indexed symbols.
+  static const uint32_t InvalidSymbolID = static_cast<uint32_t>(-1);
+
 private:
   android::Vector<SymbolResolverInterface *> mChain;
 
+  // Addresses found by following mChain, keyed by the symbol name. Cleared
+  // whenever mChain changes.
+  llvm::StringMap<void *> mMemo;
+
+  // Guards mChain, mMemo and the counters. Objects may be loaded through the
+  // same proxy from several threads.
+  llvm::sys::Mutex mLock;
+
+  unsigned mNumHits;
+  unsigned mNumMisses;
+
+  // The indexed symbols (see setIndexedSymbols()), not owned. They never
+  // change once set, so they're read without mLock.
+  uint32_t mIndexVersion;
+  const char *const *mIndexNames;
+  void *const *mIndexAddresses;
+  size_t mNumIndexed;
+  llvm::StringMap<uint32_t> mIndexIDs;
+
 public:
-  SymbolResolverProxy() { }
+  SymbolResolverProxy()
+    : mNumHits(0), mNumMisses(0), mIndexVersion(0), mIndexNames(NULL),
+      mIndexAddresses(NULL), mNumIndexed(0) { }
 
   void chainResolver(SymbolResolverInterface &pResolver);
 
   virtual void *getAddress(const char *pName);
+
+  // Forget the memoized addresses. Must be called when a resolver in the chain
+  // changes the way it resolves the symbols.
+  void invalidate();
+
+  // Number of lookups answered from the memo and by following the chain,
+  // respectively.
+  unsigned getNumHits();
+  unsigned getNumMisses();
+
+  // Give the pNumSymbols symbols named pNames[i] at pAddresses[i] the stable
+  // ID i, under pVersion (which changes whenever an ID is reassigned.) The
+  // arrays must outlive the proxy. Call it once, before any load: the objects
+  // built against the IDs record them (see BoundSymbolResolver) and their
+  // loads resolve those symbols by index.
+  void setIndexedSymbols(uint32_t pVersion, const char *const *pNames,
+                         void *const *pAddresses, size_t pNumSymbols);
+
+  inline bool hasIndexedSymbols() const
+  { return (mNumIndexed > 0); }
+  inline uint32_t getIndexedSymbolsVersion() const
+  { return mIndexVersion; }
+
+  // Return the ID of pName or InvalidSymbolID if it isn't indexed.
+  uint32_t getSymbolID(const char *pName) const;
+
+  // Return the address of the indexed symbol pID if it's named pName (one
+  // string compare), NULL otherwise.
+  inline void *getIndexedAddress(uint32_t pID, const char *pName) const {
+    if ((pID < mNumIndexed) && (::strcmp(mIndexNames[pID], pName) == 0)) {
+      return mIndexAddresses[pID];
+    }
+    return NULL;
+  }
+};
+
+/*
+ * Resolves the undefined symbols of an object from the IDs recorded when it
+ * was built: pIDs[i] (possibly InvalidSymbolID) is the ID of its i-th
+ * undefined symbol in the order the loader asks for them (see
+ * ObjectLoader::GetUndefinedSymbols().) Each lookup then takes an index and
+ * a string compare to verify it. The lookups that don't match (or aren't
+ * indexed) go through the proxy. getAddressOf() takes the position of the
+ * symbol instead of following the order.
+ */
+class BoundSymbolResolver : public SymbolResolverInterface {
+private:
+  SymbolResolverProxy &mProxy;
+  const uint32_t *mIDs;
+  size_t mNumIDs;
+  size_t mNext;
+
+public:
+  BoundSymbolResolver(SymbolResolverProxy &pProxy, const uint32_t *pIDs,
+                      size_t pNumIDs)
+    : mProxy(pProxy), mIDs(pIDs), mNumIDs(pNumIDs), mNext(0) { }
+
+  virtual void *getAddress(const char *pName) {
+    if (mNext < mNumIDs) {
+      uint32_t id = mIDs[mNext];
+      if (id == SymbolResolverProxy::InvalidSymbolID) {
+        mNext++;
+      } else if (void *addr = mProxy.getIndexedAddress(id, pName)) {
+        mNext++;
+        return addr;
+      }
+      // Otherwise the object asks in another order. Stay there.
+    }
+    return mProxy.getAddress(pName);
+  }
+
+  virtual void *getAddressOf(size_t pOrder, const char *pName) {
+    if ((pOrder < mNumIDs) &&
+        (mIDs[pOrder] != SymbolResolverProxy::InvalidSymbolID)) {
+      if (void *addr = mProxy.getIndexedAddress(mIDs[pOrder], pName)) {
+        return addr;
+      }
+    }
+    return mProxy.getAddress(pName);
+  }
 };
 
 } // end namespace bcc
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_REGISTRY_H
+#define BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_REGISTRY_H
+
+#include <map>
+#include <utility>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Mutex.h>
+
+#include "bcc/ExecutionEngine/SymbolResolverInterface.h"
+
+namespace bcc {
+
+/*
+ * A resolver shared by all its users in the process, which memoizes the
+ * addresses its backing resolver finds. It's created and destroyed by
+ * SymbolResolverRegistry.
+ */
+class SharedSymbolTable : public SymbolResolverInterface {
+private:
+  friend class SymbolResolverRegistry;
+
+  // Owned.
+  SymbolResolverInterface *mResolver;
+
+  llvm::StringMap<void *> mMemo;
+  llvm::sys::Mutex mLock;
+
+  // Guarded by the lock of the registry.
+  unsigned mRefCount;
+
+  SharedSymbolTable(SymbolResolverInterface *pResolver)
+    : mResolver(pResolver), mRefCount(0) { }
+
+  ~SharedSymbolTable();
+
+public:
+  virtual void *getAddress(const char *pName);
+};
+
+/*
+ * SymbolResolverRegistry holds the resolvers whose answers don't depend on
+ * who asks, once per process: the resolver of libcompiler_rt.so (so that the
+ * library is dlopen()'ed once, not once per RSCompilerDriver) and one per RS
+ * runtime lookup function and context (the drivers created for the scripts
+ * of an RS context all share it.) Each is wrapped in a SharedSymbolTable, so
+ * a new driver starts with the addresses the others already resolved.
+ *
+ * The tables are reference-counted: each acquire*() is balanced by a
+ * release(), and the last release destroys the table (and closes the
+ * library.)
+ */
+class SymbolResolverRegistry {
+public:
+  typedef void *(*LookupFunctionTy)(void *pContext, const char *pName);
+
+private:
+  llvm::sys::Mutex mLock;
+
+  SharedSymbolTable *mCompilerRT;
+
+  typedef std::map<std::pair<LookupFunctionTy, void *>,
+                   SharedSymbolTable *> LookupTableMapTy;
+  LookupTableMapTy mLookupTables;
+
+  SymbolResolverRegistry() : mCompilerRT(NULL) { }
+
+public:
+  // The process-wide registry. It's never destroyed.
+  static SymbolResolverRegistry &GetInstance();
+
+  // Return the table of libcompiler_rt.so, or NULL if it can't be loaded.
+  SharedSymbolTable *acquireCompilerRT();
+
+  // Return the table of pLookupFunc called with pContext. Never NULL unless
+  // out of memory.
+  SharedSymbolTable *acquireLookupFunction(LookupFunctionTy pLookupFunc,
+                                           void *pContext);
+
+  void release(SharedSymbolTable *pTable);
+};
+
+/*
+ * A drop-in replacement for LookupFunctionSymbolResolver<void *> whose
+ * lookups go through the SharedSymbolTable of its function and context.
+ * Setting either rebinds it to another table, which isn't safe while a
+ * lookup is in progress.
+ */
+class SharedLookupFunctionSymbolResolver : public SymbolResolverInterface {
+public:
+  typedef SymbolResolverRegistry::LookupFunctionTy LookupFunctionTy;
+
+private:
+  LookupFunctionTy mLookupFunc;
+  void *mContext;
+
+  // NULL while there's no lookup function.
+  SharedSymbolTable *mTable;
+
+  void rebind();
+
+  SharedLookupFunctionSymbolResolver(
+      const SharedLookupFunctionSymbolResolver &); // DISABLED.
+  void operator=(const SharedLookupFunctionSymbolResolver &); // DISABLED.
+
+public:
+  SharedLookupFunctionSymbolResolver(LookupFunctionTy pLookupFunc = NULL,
+                                     void *pContext = NULL)
+    : mLookupFunc(pLookupFunc), mContext(pContext), mTable(NULL) {
+    rebind();
+  }
+
+  ~SharedLookupFunctionSymbolResolver();
+
+  virtual void *getAddress(const char *pName) {
+    return ((mTable != NULL) ? mTable->getAddress(pName) : NULL);
+  }
+
+  inline LookupFunctionTy getLookupFunction() const
+  { return mLookupFunc; }
+  inline void *getContext() const
+  { return mContext; }
+
+  inline void setLookupFunction(LookupFunctionTy pLookupFunc) {
+    mLookupFunc = pLookupFunc;
+    rebind();
+  }
+  inline void setContext(void *pContext) {
+    mContext = pContext;
+    rebind();
+  }
+};
+
+} // end namespace bcc
+
+#endif // BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_REGISTRY_H
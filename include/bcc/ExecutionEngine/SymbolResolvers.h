@@ -19,6 +19,8 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <stdint.h>
 
 #include "SymbolResolverInterface.h"
 
@@ -51,6 +53,11 @@ public:
 
 /*
  * Symbol lookup by searching through an array of SymbolMap.
+ *
+ * Since Subclass::SymbolArray never changes, a perfect hash over it is built
+ * when the resolver is created. A lookup then costs a hash of the name and a
+ * single string compare. If no perfect hash is found (or there's no memory to
+ * hold it,) the array is searched linearly or with bsearch() as before.
  */
 template<typename Subclass>
 class ArraySymbolResolver : public SymbolResolverInterface {
@@ -66,18 +73,97 @@ private:
   // True if the symbol name is sorted in the array.
   bool mSorted;
 
+  // Perfect hash table. Slot i holds 1 + the index of the symbol in
+  // Subclass::SymbolArray whose name hashes to i, or 0 if there's none. The
+  // number of slots is mSlotMask + 1.
+  uint32_t *mSlots;
+  uint32_t mSlotMask;
+  uint32_t mSeed;
+
   static int CompareSymbolName(const void *pA, const void *pB) {
     return ::strcmp(reinterpret_cast<const SymbolMap *>(pA)->mName,
                     reinterpret_cast<const SymbolMap *>(pB)->mName);
   }
 
+  // FNV-1a with the offset basis perturbed by pSeed.
+  static uint32_t Hash(const char *pName, uint32_t pSeed) {
+    uint32_t h = 2166136261u ^ (pSeed * 0x9e3779b9u);
+    for (const unsigned char *p = reinterpret_cast<const unsigned char *>(pName);
+         *p != '\0'; p++) {
+      h = (h ^ *p) * 16777619u;
+    }
+    return (h ^ (h >> 15));
+  }
+
+  // Try to place all symbols into pSlots (pMask + 1 slots) with pSeed. Return
+  // false on the first collision of two different names. The first one of the
+  // symbols with the same name wins, as it does in the linear search.
+  static bool Fill(uint32_t *pSlots, uint32_t pMask, uint32_t pSeed) {
+    ::memset(pSlots, 0, (pMask + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < Subclass::NumSymbols; i++) {
+      const char *name = Subclass::SymbolArray[i].mName;
+      uint32_t &slot = pSlots[Hash(name, pSeed) & pMask];
+      if (slot == 0) {
+        slot = i + 1;
+      } else if (::strcmp(Subclass::SymbolArray[slot - 1].mName, name) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void buildPerfectHash() {
+    static const unsigned MaxSeedsPerSize = 64;
+    static const size_t MaxLoadFactorInverse = 64;
+
+    if (Subclass::NumSymbols == 0) {
+      return;
+    }
+
+    uint32_t num_slots = 1;
+    while (num_slots < 2 * Subclass::NumSymbols) {
+      num_slots <<= 1;
+    }
+
+    for (; num_slots <= MaxLoadFactorInverse * Subclass::NumSymbols;
+         num_slots <<= 1) {
+      uint32_t *slots = new (std::nothrow) uint32_t [num_slots];
+      if (slots == NULL) {
+        return;
+      }
+      for (uint32_t seed = 0; seed < MaxSeedsPerSize; seed++) {
+        if (Fill(slots, num_slots - 1, seed)) {
+          mSlots = slots;
+          mSlotMask = num_slots - 1;
+          mSeed = seed;
+          return;
+        }
+      }
+      delete [] slots;
+    }
+  }
+
+  // Not copyable since mSlots is owned.
+  ArraySymbolResolver(const ArraySymbolResolver &);
+  void operator=(const ArraySymbolResolver &);
+
 public:
-  ArraySymbolResolver(bool pSorted = false) : mSorted(pSorted) { }
+  ArraySymbolResolver(bool pSorted = false)
+    : mSorted(pSorted), mSlots(NULL), mSlotMask(0), mSeed(0) {
+    buildPerfectHash();
+  }
 
   virtual void *getAddress(const char *pName) {
     const SymbolMap *result = NULL;
 
-    if (mSorted) {
+    if (mSlots != NULL) {
+      // Use the perfect hash.
+      uint32_t slot = mSlots[Hash(pName, mSeed) & mSlotMask];
+      if ((slot != 0) &&
+          (::strcmp(Subclass::SymbolArray[slot - 1].mName, pName) == 0)) {
+        result = &Subclass::SymbolArray[slot - 1];
+      }
+    } else if (mSorted) {
       // Use binary search.
       const SymbolMap key = { pName, NULL };
 
@@ -98,6 +184,10 @@ public:
 
     return ((result != NULL) ? result->mAddr : NULL);
   }
+
+  virtual ~ArraySymbolResolver() {
+    delete [] mSlots;
+  }
 };
 
 template<typename ContextTy = void *>
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_BUILD_JOB_H
+#define BCC_RS_BUILD_JOB_H
+
+#include <cstddef>
+#include <string>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/CancellationToken.h"
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+
+namespace bcc {
+
+class BCCContext;
+class RSBuildJob;
+class RSCompilerThread;
+
+// Invoked on the compiler thread once the build of pJob has finished.
+// pSuccess is the value RSCompilerDriver::build() would have returned.
+typedef void (*RSBuildCompletionCallback)(RSBuildJob *pJob, bool pSuccess,
+                                          void *pUserData);
+
+/*
+ * RSBuildJob is the handle of a build requested through
+ * RSCompilerDriver::buildAsync(). It's owned by the caller and must not be
+ * deleted until the job is done (see wait().)
+ */
+class RSBuildJob {
+public:
+  // The compiler thread runs the queued jobs of a higher priority (lower
+  // value) first, and those of the same priority in the order they were
+  // submitted.
+  enum Priority {
+    // buildAsync(): a script the app is waiting for.
+    kForeground,
+    // prefetch(): a script the app is expected to load soon.
+    kPrefetch,
+    // prefetchWhenIdle(): maintenance, run only while the device is charging.
+    kIdle
+  };
+
+private:
+  friend class RSCompilerThread;
+
+  // Arguments to RSCompilerDriver::build(). The bitcode is not copied and must
+  // outlive the job.
+  BCCContext &mContext;
+  std::string mCacheDir;
+  std::string mResName;
+  const char *mBitcode;
+  size_t mBitcodeSize;
+  std::string mRuntimePath;
+  bool mHasRuntimePath;
+  RSLinkRuntimeCallback mLinkRuntimeCallback;
+
+  RSBuildCompletionCallback mCompletionCallback;
+  void *mUserData;
+
+  Priority mPriority;
+
+  CancellationToken mCancelToken;
+
+  android::Mutex mLock;
+  // The thread the job is queued on, to wake it up on cancel(). NULL once the
+  // job is done.
+  RSCompilerThread *mThread;
+  android::Condition mDoneCond;
+  bool mDone;
+  bool mSuccess;
+
+  void complete(bool pSuccess);
+
+public:
+  RSBuildJob(BCCContext &pContext, const char *pCacheDir,
+             const char *pResName, const char *pBitcode, size_t pBitcodeSize,
+             const char *pRuntimePath,
+             RSLinkRuntimeCallback pLinkRuntimeCallback,
+             RSBuildCompletionCallback pCompletionCallback, void *pUserData,
+             Priority pPriority = kForeground);
+
+  inline const char *getCacheDir() const
+  { return mCacheDir.c_str(); }
+  inline const char *getResName() const
+  { return mResName.c_str(); }
+  inline Priority getPriority() const
+  { return mPriority; }
+  inline bool isPrefetch() const
+  { return (mPriority != kForeground); }
+
+  bool isDone();
+
+  // Give up the job: it's dropped from the queue if it hasn't started yet,
+  // or its compilation stops at the next phase boundary (see
+  // Compiler::compile()). Either way, it completes as failed unless the
+  // build was already past its compilation. Safe to call from any thread at
+  // any time before the job is deleted.
+  void cancel();
+  inline bool isCancelled() const
+  { return mCancelToken.isCancelled(); }
+
+  // Block until the build finishes and return whether it succeeded.
+  bool wait();
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_BUILD_JOB_H
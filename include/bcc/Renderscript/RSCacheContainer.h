@@ -0,0 +1,259 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_CACHE_CONTAINER_H
+#define BCC_RS_CACHE_CONTAINER_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/Sha1Util.h"
+
+#include <utils/String8.h>
+
+namespace bcc {
+
+class RSExecutable;
+class SymbolResolverProxy;
+
+namespace rscache {
+
+/* RS cache container magic */
+#define RSCACHE_MAGIC     "\0rscache"
+
+/* RS cache container version, encoded in 4 bytes of ASCII */
+#define RSCACHE_VERSION   "006\0"
+
+/* RS cache container header */
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  uint32_t headerSize;
+
+  // The RS info (see rsinfo::Header.) It immediately follows this header.
+  uint32_t infoOffset;
+  uint32_t infoSize;
+
+  // The ELF object. Its offset is a multiple of ObjectAlignment unless it's
+  // compressed (see objectRawSize.)
+  uint32_t objectOffset;
+  uint32_t objectSize;
+
+  // The CPUProfile::Features the object requires.
+  uint32_t requiredFeatures;
+
+  // The objects for the CPUs lacking some of requiredFeatures (see
+  // RSCompilerDriver::setMultiversioning()), from the most to the least
+  // demanding. The table of fallbackCount FallbackObjects follows the info.
+  uint32_t fallbackCount;
+  uint32_t fallbackOffset;
+
+  // The bitcode the container was built from: its fingerprint (see
+  // Sha1Util::GetFingerprintFromBuffer(), 0 if unknown) and its SHA-1.
+  uint64_t sourceFingerprint;
+  uint8_t sourceSHA1[SHA1_DIGEST_LENGTH];
+
+  // The IDs of the undefined symbols of the object (see
+  // RSCacheContainer::RuntimeBindings), under bindingVersion of the symbol
+  // table of the RS runtime. The table of bindingCount uint32_t follows the
+  // fallbacks. bindingCount is 0 if none were recorded.
+  uint32_t bindingVersion;
+  uint32_t bindingCount;
+  uint32_t bindingOffset;
+
+  // 0 if the object is stored as is. Otherwise, its objectSize bytes are an
+  // LZ4 block (see bcc::LZ4) which decompresses into the objectRawSize bytes
+  // of the object.
+  uint32_t objectRawSize;
+
+  // The CRC32C (see bcc::CRC32C) of the infoSize bytes of the info and of the
+  // objectSize bytes of the object as stored, checked on each load.
+  uint32_t infoCRC;
+  uint32_t objectCRC;
+};
+
+struct __attribute__((packed)) FallbackObject {
+  uint32_t requiredFeatures;
+
+  // Same as the object in the header. The export locations recorded in the
+  // info are those of that object, not of this one.
+  uint32_t objectOffset;
+  uint32_t objectSize;
+  uint32_t objectRawSize;
+  uint32_t objectCRC;
+};
+
+// Alignment of the object in the container (i.e., the page size.)
+const size_t ObjectAlignment = 4096;
+
+} // end namespace rscache
+
+/*
+ * RSCacheContainer reads and writes the cache of a compiled script as a
+ * single file: a small header followed by the RS info (header, string pool
+ * and lists, exactly as RSInfo::write() produces) and the object image at a
+ * page-aligned offset.
+ *
+ * Compared to the {res}.o/{res}.o.info pair, a load takes one open() and one
+ * mmap() and no file locks: a container is always written to a temporary file
+ * and moved into place with rename(), so a reader either sees the old or the
+ * new file in full. The writes go through CacheWriter, which may complete them
+ * in the background; Load() waits for them.
+ *
+ * The objects may be stored compressed to save storage and reads on slow
+ * flash, at the cost of a decompression into the heap on each load (instead
+ * of handing the loader the mapped file.)
+ *
+ * The info and each object carry a CRC32C, so that a torn or corrupted
+ * container is rebuilt rather than handed to the loader. Unlike the SHA-1
+ * of the whole file, that's cheap enough to check on each load.
+ */
+class RSCacheContainer {
+private:
+  RSCacheContainer(); // DISABLED.
+
+  // CacheWriter::UpdateFunction of UpdateInfo(): replace the info of the
+  // container pCurrent with the serialized info pInfo.
+  static bool ReplaceInfo(const std::string &pPath,
+                          const void *pCurrent, size_t pCurrentSize,
+                          const std::string &pInfo, std::string &pResult);
+
+public:
+  // An object to write to a container and the CPUProfile::Features it
+  // requires. mRawSize is 0 unless mImage is an object already compressed
+  // (i.e., taken out of a container) whose size is mRawSize.
+  struct Object {
+    const void *mImage;
+    size_t mImageSize;
+    uint32_t mRequiredFeatures;
+    size_t mRawSize;
+  };
+
+  // The bitcode a container was built from (see ReadSourceDigest().)
+  struct SourceDigest {
+    uint64_t mFingerprint;
+    uint8_t mSHA1[SHA1_DIGEST_LENGTH];
+  };
+
+  // The IDs (see SymbolResolverProxy::setIndexedSymbols()) of the mCount
+  // undefined symbols of the first object, in the order the loader resolves
+  // them, under the version mVersion of the indexed symbols.
+  struct RuntimeBindings {
+    uint32_t mVersion;
+    const uint32_t *mIDs;
+    size_t mCount;
+  };
+
+  // Return the path of the container for the script whose object would be at
+  // pObjPath (i.e., {pCacheDir}/{pResName}.o becomes {pCacheDir}/{pResName}.rsc.)
+  static android::String8 GetPath(const char *pObjPath);
+
+  // Return the path of the shared object linked from the object of the
+  // container for pObjPath (i.e., {pCacheDir}/{pResName}.so.) See
+  // RSCompilerDriver::setSharedObjectLinker().
+  static android::String8 GetSharedObjectPath(const char *pObjPath);
+
+  // Set pResult to the contents of a container of the serialized info pInfo
+  // (see RSInfo::serialize()) and the pNumObjects (at least one) objects at
+  // pObjects. The first one is the object pInfo describes and the others are
+  // its fallbacks, from the most to the least demanding. pSource (if
+  // non-NULL) is recorded for ReadSourceDigest() and pBindings (if non-NULL)
+  // for Load(). If pCompress is true, the objects are stored compressed
+  // unless that saves less than an eighth of their size. Return false if
+  // there's no object.
+  static bool Serialize(const std::string &pInfo,
+                        const Object *pObjects, size_t pNumObjects,
+                        std::string &pResult,
+                        const SourceDigest *pSource = NULL,
+                        const RuntimeBindings *pBindings = NULL,
+                        bool pCompress = false);
+
+  // Write pInfo and the pImageSize bytes of object at pImage to the container
+  // pPath, replacing the existing file (if any) atomically and flushing it to
+  // the storage as pSync says (see AtomicOutputFile::commit().) Return false
+  // on error, in which case pPath is untouched. A write queued to the writer
+  // thread of CacheWriter only fails in the log.
+  static bool Write(const char *pPath, RSInfo &pInfo,
+                    const void *pImage, size_t pImageSize,
+                    AtomicOutputFile::SyncMode pSync =
+                        AtomicOutputFile::kNoSync,
+                    const SourceDigest *pSource = NULL,
+                    const RuntimeBindings *pBindings = NULL);
+
+  // Same as above but writes the pNumObjects objects at pObjects, compressed
+  // if pCompress is true (see Serialize().)
+  static bool Write(const char *pPath, RSInfo &pInfo,
+                    const Object *pObjects, size_t pNumObjects,
+                    AtomicOutputFile::SyncMode pSync =
+                        AtomicOutputFile::kNoSync,
+                    const SourceDigest *pSource = NULL,
+                    const RuntimeBindings *pBindings = NULL,
+                    bool pCompress = false);
+
+  // Replace the RS info in the container pPath with pInfo and keep the objects
+  // (compressed or not) as they are.
+  // Return false on error. The updates of a container still pending in
+  // CacheWriter are coalesced into one.
+  static bool UpdateInfo(const char *pPath, RSInfo &pInfo);
+
+  // Read the digest of the bitcode the container pPath was built from out of
+  // its header, without reading the rest. This lets a load recognize its
+  // bitcode by fingerprint and take the SHA-1 from here instead of hashing
+  // the bitcode in full. Return false if pPath doesn't exist or records no
+  // digest.
+  static bool ReadSourceDigest(const char *pPath, SourceDigest &pResult);
+
+  // Read the RS info of the container pPath once its header and the CRC32C
+  // of the info are checked. The dependencies recorded in the info are left
+  // unchecked. Return NULL on error. The caller owns the result.
+  static RSInfo *ReadInfo(const char *pPath);
+
+  // Load the container pPath. pDeps are checked against the dependencies
+  // recorded in its RS info. If pCacheSHA1 is non-NULL, the verified contents
+  // are also remembered in RSExecutableCache under pCacheSHA1. Return NULL on
+  // error and if pStatus is non-NULL, set it to the reason why the RS info was
+  // rejected (kReadOK if it was accepted but the object could not be loaded,
+  // kReadCorrupted if the info or the object fails its CRC32C and
+  // kReadNotFound if pPath doesn't exist.)
+  //
+  // The first object of the container the CPU can run is loaded (see
+  // CPUProfile::GetHostFeatures().) A fallback object is neither remembered
+  // in RSExecutableCache nor replaced by the shared object below.
+  //
+  // If pSharedObjectPath is non-NULL and names an existing file, the script is
+  // loaded from that shared object (which must have been linked from the
+  // object in the container) with the system dynamic linker, and pCacheSHA1
+  // is ignored. The object in the container is loaded if that fails.
+  //
+  // The undefined symbols of the object are resolved from the recorded
+  // bindings if pResolver has indexed symbols of the same version, and by
+  // name otherwise.
+  static RSExecutable *Load(const char *pPath,
+                            const RSInfo::DependencyTableTy &pDeps,
+                            SymbolResolverProxy &pResolver,
+                            const uint8_t *pCacheSHA1,
+                            RSInfo::ReadStatus *pStatus = NULL,
+                            const char *pSharedObjectPath = NULL);
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_CACHE_CONTAINER_H
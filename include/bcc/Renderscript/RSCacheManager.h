@@ -0,0 +1,120 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_CACHE_MANAGER_H
+#define BCC_RS_CACHE_MANAGER_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+
+#include "bcc/Support/Sha1Util.h"
+
+namespace bcc {
+
+namespace rscacheindex {
+
+/* RS cache index magic */
+#define RSCACHE_INDEX_MAGIC   "\0rsindex"
+
+/* RS cache index version, encoded in 4 bytes of ASCII */
+#define RSCACHE_INDEX_VERSION "001\0"
+
+/* RS cache index header. numEntries Entry follow it, then the string pool of
+ * strPoolSize bytes holding their NUL-terminated names. */
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  uint32_t headerSize;
+  uint32_t entrySize;
+  uint32_t numEntries;
+  uint32_t strPoolSize;
+};
+
+struct __attribute__((packed)) Entry {
+  // SHA-1 of the bitcode the script was built from.
+  uint8_t sha1[SHA1_DIGEST_LENGTH];
+
+  // Offset of the resource name in the string pool.
+  uint32_t name;
+
+  // Total size of the files of the script, as of the last trim.
+  uint64_t size;
+
+  // Time (seconds since the epoch) of the last build or load of the script.
+  uint64_t lastUse;
+};
+
+} // end namespace rscacheindex
+
+/*
+ * RSCacheManager bounds the size of a cache directory. Each build records its
+ * script in the index of the directory ({pCacheDir}/rscache.index) and each
+ * load from the directory refreshes the recency of its script. Once the files
+ * of the indexed scripts exceed the quota, the least recently used scripts
+ * are evicted along with all their files ({res}.rsc, {res}.so, {res}.prof and
+ * the legacy {res}.o and {res}.o.info.)
+ *
+ * The index is updated under a FileMutex and replaced atomically with
+ * AtomicOutputFile, so it can be read without a lock. A missing or corrupted
+ * index is started over: the scripts it loses are left alone until
+ * Compact() (or their next build) finds them back.
+ */
+class RSCacheManager {
+private:
+  RSCacheManager(); // DISABLED.
+
+public:
+  // The recency of a script is refreshed at most once per this many seconds
+  // to bound the writes of the index on the loads.
+  static const uint64_t RecencyGranularity = 60 * 60;
+
+  static std::string GetIndexPath(const char *pCacheDir);
+
+  // Record the build of pResName from the bitcode with SHA-1 pSHA1 into
+  // pCacheDir and, if pQuota is non-zero, Trim() the directory to pQuota
+  // bytes (never evicting pResName itself.) Return false on error.
+  static bool Record(const char *pCacheDir, const char *pResName,
+                     const uint8_t *pSHA1, uint64_t pQuota);
+
+  // Refresh the recency of pResName in pCacheDir if it's older than
+  // RecencyGranularity. Return false on error.
+  static bool Touch(const char *pCacheDir, const char *pResName);
+
+  // Evict the least recently used scripts of pCacheDir until the rest fits in
+  // pQuota bytes. Return false on error.
+  static bool Trim(const char *pCacheDir, uint64_t pQuota,
+                   const char *pKeepResName = NULL);
+
+  // Clean pCacheDir up: remove the temporary files left by the dead writers
+  // of AtomicOutputFile, the legacy {res}.o/{res}.o.info pairs replaced by a
+  // {res}.rsc, the {res}.so and {res}.prof of the indexed scripts whose
+  // {res}.rsc is gone, and, from the index, the scripts without any file left.
+  // The valid containers missing from the index are added to it. Return false
+  // on error.
+  static bool Compact(const char *pCacheDir);
+
+  // Set pResName to the name of a script of pCacheDir built from the bitcode
+  // with SHA-1 pSHA1. Return false if there's none.
+  static bool Find(const char *pCacheDir, const uint8_t *pSHA1,
+                   std::string &pResName);
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_CACHE_MANAGER_H
@@ -17,15 +17,64 @@
 #ifndef BCC_RS_COMPILER_H
 #define BCC_RS_COMPILER_H
 
+#include <string>
+
 #include "bcc/Compiler.h"
 
 namespace bcc {
 
+class RSScript;
+
 class RSCompiler : public Compiler {
 private:
+  bool mEnableExpandStepOpt;
+  bool mEnableExpandWidening;
+
+  // The identifier of the module being compiled, which the object doesn't
+  // get (see beforeExecuteCodeGenPasses().)
+  std::string mModuleIdentifier;
+
   virtual bool beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM);
+  virtual bool afterAddLTOPasses(Script &pScript, llvm::PassManager &pPM);
+  virtual bool beforeAddCodeGenPasses(Script &pScript,
+                                      llvm::PassManager &pPM);
+  virtual bool beforeExecuteCodeGenPasses(Script &pScript,
+                                          llvm::PassManager &pPM);
+  virtual bool afterExecuteCodeGenPasses(Script &pScript);
   bool addInternalizeSymbolsPass(Script &pScript, llvm::PassManager &pPM);
   bool addExpandForEachPass(Script &pScript, llvm::PassManager &pPM);
+
+  // Keep the precise functions of a full-precision script with relaxed
+  // kernels off NEON (see createRSPreciseFPPass().) Adds nothing otherwise.
+  void addPreciseFPPass(const RSScript &pScript,
+                        llvm::PassManager &pPM) const;
+
+  // Width (in bytes) to which the inner loops of the expanded ForEach kernels
+  // of pScript are widened. Returns 0 if they shouldn't be widened.
+  unsigned getExpandVectorWidth(const RSScript &pScript) const;
+
+  // Distance (in bytes) at which the expanded ForEach loops of pScript
+  // prefetch their input. Returns 0 if they shouldn't prefetch.
+  unsigned getExpandPrefetchDistance(const RSScript &pScript) const;
+
+  // Size (in bytes) of the scratch buffers of the streaming entry points of
+  // the kernels of pScript. Returns 0 if they shouldn't have any.
+  unsigned getExpandStreamBlockSize(const RSScript &pScript) const;
+
+public:
+  RSCompiler() : Compiler(), mEnableExpandStepOpt(true),
+                 mEnableExpandWidening(true) { }
+
+  // Both options of the ForEach expansion are on by default. Turning off the
+  // step optimization makes the expanded loops step by the instep and outstep
+  // given at launch instead of by the element sizes known at compile time
+  // (which also rules out widening.) Turning off the widening keeps the inner
+  // loops scalar. These are meant for measurements (e.g., bcc_kernel_bench)
+  // and aren't part of the cache key: the caller has to rebuild the script.
+  void setEnableExpandStepOpt(bool pEnable)
+  { mEnableExpandStepOpt = pEnable; }
+  void setEnableExpandWidening(bool pEnable)
+  { mEnableExpandWidening = pEnable; }
 };
 
 } // end namespace bcc
@@ -20,23 +20,104 @@
 #include "bcc/ExecutionEngine/CompilerRTSymbolResolver.h"
 #include "bcc/ExecutionEngine/SymbolResolvers.h"
 #include "bcc/ExecutionEngine/SymbolResolverProxy.h"
+#include "bcc/ExecutionEngine/SymbolResolverRegistry.h"
+#include "bcc/Renderscript/RSBuildJob.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Renderscript/RSCompiler.h"
 #include "bcc/Renderscript/RSScript.h"
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/CacheWriter.h"
+#include "bcc/Support/CPUProfile.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <utils/Mutex.h>
+#include <utils/StrongPointer.h>
 
 namespace bcc {
 
 class BCCContext;
 class CompilerConfig;
+class RSBuildJob;
+class RSCompilerThread;
 class RSExecutable;
+class RSProfile;
+
+class RSCompilerDriver;
+
+// A script to build with RSCompilerDriver::BuildBatch().
+struct RSBatchBuildItem {
+  // Arguments to RSCompilerDriver::build().
+  const char *cacheDir;
+  const char *resName;
+  const char *bitcode;
+  size_t bitcodeSize;
+
+  // Set by BuildBatch() to the result of the build.
+  bool success;
+};
+
+// A script of a bundle (see RSCompilerDriver::buildBundle().)
+struct RSBundleScript {
+  const char *resName;
+  const char *bitcode;
+  size_t bitcodeSize;
+};
+
+// Process-wide statistics of the outcomes of RSCompilerDriver::loadScript().
+struct RSCacheStats {
+  enum Outcome {
+    // Loaded from the in-process cache of RSExecutableCache.
+    kMemoryHit,
+    // Loaded from the cache directory.
+    kHit,
+    // Loaded from the shared store (see setSharedCacheDir().)
+    kSharedHit,
+    // No RS cache container in the cache directory.
+    kMiss,
+    // The RS cache container couldn't be read.
+    kIOError,
+    // The RS cache container or its RS info was rejected. See
+    // RSInfo::ReadStatus for details.
+    kVersionMismatch,
+    kCorrupted,
+    kLibBCCChanged,
+    kLibCompilerRTChanged,
+    kLibRSChanged,
+    kLibCLCoreChanged,
+    kSourceChanged,
+    // The cache is valid but the object couldn't be loaded.
+    kLoadFailed,
+
+    kNumOutcomes
+  };
+
+  unsigned mCount[kNumOutcomes];
+  // Total wall time in seconds spent in loadScript() for each outcome.
+  double mTime[kNumOutcomes];
+
+  static const char *GetOutcomeName(Outcome pOutcome);
+};
+
+// Asked by the compiler thread whether the idle jobs may run (see
+// RSCompilerDriver::setChargingCallback().)
+typedef bool (*RSChargingCallback)(void *pUserData);
+
+// Invoked by RSCompilerDriver::BuildBatch() on each driver it creates before
+// the driver is used. Return false to abort the builds of the driver.
+typedef bool (*RSDriverSetupFunction)(RSCompilerDriver &pDriver,
+                                      void *pUserData);
 
 class RSCompilerDriver {
 private:
   CompilerConfig *mConfig;
   RSCompiler mCompiler;
 
-  CompilerRTSymbolResolver *mCompilerRuntime;
-  LookupFunctionSymbolResolver<void*> mRSRuntime;
+  // Shared by the drivers of the process (see SymbolResolverRegistry.)
+  SharedSymbolTable *mCompilerRuntime;
+  SharedLookupFunctionSymbolResolver mRSRuntime;
   SymbolResolverProxy mResolver;
 
   // Are we compiling under an RS debug context with additional checks?
@@ -49,26 +130,271 @@ private:
   // and work with.
   bool mEnableGlobalMerge;
 
-  // Setup the compiler config for the given script. Return true if mConfig has
-  // been changed and false if it remains unchanged.
-  bool setupConfig(const RSScript &pScript);
+  // How much of the written caches is flushed to the storage before they're
+  // published.
+  AtomicOutputFile::SyncMode mCacheSync;
+
+  // Size bound (in bytes) of the cache directories, 0 if unbounded (see
+  // setCacheQuota().)
+  uint64_t mCacheQuota;
+
+  // Store the objects in the RS cache containers compressed (see
+  // setCompressedCaches().)
+  bool mCompressCaches;
+
+  // How long (in milliseconds) a load waits for a build of the same cache in
+  // progress in another process (see setCacheWaitTimeout().)
+  unsigned mCacheWaitTimeout;
+
+  // Cancels the builds not given a token of their own (see
+  // setCancellationToken().) Not owned.
+  const CancellationToken *mCancelToken;
+
+  // Tells whether the idle jobs may run (see setChargingCallback().)
+  RSChargingCallback mChargingCallback;
+  void *mChargingUserData;
+
+  // Hash the bitcode in full on every load and build (see
+  // setParanoidCacheChecks().)
+  bool mParanoidCacheChecks;
+
+  // Set pResult to the SHA-1 of the pBitcodeSize bytes of bitcode at
+  // pBitcode. Unless mParanoidCacheChecks, it's taken from the container
+  // pContainerPath when its bitcode has the same fingerprint.
+  void getBitcodeSHA1(const char *pContainerPath, const char *pBitcode,
+                      size_t pBitcodeSize, uint8_t *pResult) const;
+
+  // CompilerConfig::LTOProfile of the scripts that don't ask for one.
+  int mLTOProfile;
+
+  // CompilerConfig::EmissionProfile of the scripts that don't ask for one,
+  // or -1 to pick it from their optimization level. A profile set
+  // explicitly is in the cache key through mEmissionProfileDigest.
+  int mEmissionProfile;
+  uint8_t mEmissionProfileDigest[SHA1_DIGEST_LENGTH];
+
+  // The digest of the runtime given to setCustomRuntime(), in the cache key
+  // if mHasCustomRuntime.
+  bool mHasCustomRuntime;
+  uint8_t mCustomRuntimeDigest[SHA1_DIGEST_LENGTH];
+
+  // Bound the peak memory usage of the builds (see setLowMemoryMode().)
+  bool mLowMemory;
+
+  // Compile the fallbacks for the CPUs lacking some of the features of the
+  // target (see setMultiversioning().)
+  bool mMultiversioning;
+
+  // Instrument the scripts for an RSProfile (see setProfileInstrumentation().)
+  bool mProfileInstrumentation;
+
+  // Embed the info in the binary encoding (see setEmbedBinaryInfo().)
+  bool mEmbedBinaryInfo;
+
+  // Gather the export vars into one block (see setExportVarBlock().)
+  bool mExportVarBlock;
 
+  // Reach the external symbols through one table (see
+  // setReducedRelocations().)
+  bool mReducedRelocations;
+
+  // Count the calls of the kernels (see setKernelCounters().)
+  bool mKernelCounters;
+  bool mKernelCycleCounters;
+
+  // Push the entry of the RSProfile of the script whose object would be at
+  // pObjPath to pDeps, as build() records it: a marker if the scripts are
+  // instrumented or the digest of its valid profile (read into pProfile,
+  // which must outlive pDeps) if there's one. Return false if neither.
+  bool addProfileDependency(const char *pObjPath, const uint8_t *pBitcodeSHA1,
+                            android::String8 &pProfilePath,
+                            RSProfile *&pProfile,
+                            RSInfo::DependencyTableTy &pDeps) const;
+
+  // The exports each script is declared to use (see setUsedExports().)
+  std::map<std::string, std::set<std::string> > mUsedExports;
+  mutable android::Mutex mUsedExportsLock;
+
+  // Copy the exports declared used by the script pResName into pNames and
+  // push their digest (computed into pDigest, which must outlive pDeps) to
+  // pDeps. Return false and leave them alone if there's no declaration.
+  bool addUsedExportsDependency(const char *pResName,
+                                std::set<std::string> &pNames,
+                                uint8_t pDigest[SHA1_DIGEST_LENGTH],
+                                RSInfo::DependencyTableTy &pDeps) const;
+
+  // Directory of the shared store of compiled scripts. Empty if disabled.
+  android::String8 mSharedCacheDir;
+
+  // Set pObjPath to {mSharedCacheDir}/{key}.o, where key is derived from the
+  // SHA-1 of the bitcode and the digest of the built-in dependencies. The
+  // script itself is stored in {key}.rsc. Return false if the shared store
+  // is disabled or unavailable.
+  bool getSharedCachePath(const uint8_t *pBitcodeSHA1,
+                          android::String8 &pObjPath) const;
+
+  // The linker of the shared objects and its extra arguments separated by
+  // spaces (see setSharedObjectLinker().) Empty if disabled.
+  android::String8 mSharedObjectLinker;
+  android::String8 mSharedObjectLinkerArgs;
+
+  // Link the pImageSize bytes of object at pImage into the shared object
+  // RSCacheContainer::GetSharedObjectPath(pOutputPath) with
+  // mSharedObjectLinker. Return false on error, in which case there's no
+  // shared object.
+  bool linkSharedObject(const char *pOutputPath, const void *pImage,
+                        size_t pImageSize) const;
+
+  // Serializes the use of mConfig and mCompiler between the calling threads
+  // and mCompilerThread.
+  android::Mutex mCompileLock;
+
+  // Compiler state of a compilation that found mCompiler busy. LLVM's
+  // TargetMachine is not thread-safe, so each concurrent compilation needs
+  // its own.
+  struct CompilerSlot {
+    CompilerConfig *mConfig;
+    RSCompiler mCompiler;
+
+    CompilerSlot() : mConfig(NULL) { }
+    ~CompilerSlot();
+  };
+
+  // The idle CompilerSlots, reused by the next concurrent compilations.
+  android::Vector<CompilerSlot *> mIdleCompilers;
+  android::Mutex mIdleCompilersLock;
+
+  // True once the caller has configured mCompiler itself (see setConfig().)
+  // Its configuration can't be reproduced in a CompilerSlot, so concurrent
+  // compilations then wait for mCompiler instead.
+  bool mCustomConfig;
+
+  // Take an idle CompilerSlot or create one. Return NULL if there's none and
+  // one can't be created.
+  CompilerSlot *acquireCompilerSlot();
+  void releaseCompilerSlot(CompilerSlot *pSlot);
+
+  // Runs the jobs of buildAsync() and prefetch(). Started on the first call
+  // to either (see startCompilerThread().)
+  android::sp<RSCompilerThread> mCompilerThread;
+
+  bool startCompilerThread();
+
+  // prefetch() and prefetchWhenIdle().
+  RSBuildJob *submitPrefetch(BCCContext &pContext, const char *pCacheDir,
+                             const char *pResName, const char *pBitcode,
+                             size_t pBitcodeSize, const char *pRuntimePath,
+                             RSBuildCompletionCallback pCompletionCallback,
+                             void *pUserData, RSBuildJob::Priority pPriority);
+
+  // Setup the compiler config pConfig (created if NULL) for the given script.
+  // Return true if pConfig has been changed and false if it remains
+  // unchanged.
+  bool setupConfig(const RSScript &pScript, CompilerConfig *&pConfig);
+
+  // The first build() below. If pTier0 is true, the script is compiled at -O0
+  // regardless of the optimization level it requests. If pLegacyTargetAPI is
+  // non-zero, pBitcode is the untranslated bitcode of a script targeting that
+  // API (see buildLegacy().) If pDeviceCacheDir is non-NULL, the cache is
+  // written to pCacheDir but keyed for pDeviceCacheDir (see
+  // buildForDevice().) If pConstants is non-NULL, the script is specialized
+  // on them (see buildSpecialized().) pCancelToken overrides the token of
+  // the driver (see setCancellationToken().)
+  bool buildImpl(BCCContext &pContext, const char *pCacheDir,
+                 const char *pResName, const char *pBitcode,
+                 size_t pBitcodeSize, const char *pRuntimePath,
+                 RSLinkRuntimeCallback pLinkRuntimeCallback, bool pDumpIR,
+                 bool pTier0, unsigned pLegacyTargetAPI = 0,
+                 const char *pDeviceCacheDir = NULL,
+                 const RSScript::ExportConstantMapTy *pConstants = NULL,
+                 const CancellationToken *pCancelToken = NULL);
+
+  // loadScript(), which also checks that the script was specialized on
+  // pConstants if they're non-NULL.
+  RSExecutable *loadScriptImpl(const char *pCacheDir, const char *pResName,
+                               const char *pBitcode, size_t pBitcodeSize,
+                               const RSScript::ExportConstantMapTy *pConstants);
+
+  // The two stages of buildImpl(), for BuildPipeline() to overlap them
+  // across the scripts of a batch. beginBuild() parses the bitcode, extracts
+  // the info and links the script with the runtime, and finishBuild()
+  // compiles it, writes the cache and destroys pBuild. A PendingBuild holds
+  // the script in pContext, so the context mustn't be used by another thread
+  // until finishBuild() returns. beginBuild() returns NULL on error.
+  struct PendingBuild;
+  PendingBuild *beginBuild(BCCContext &pContext, const char *pCacheDir,
+                           const char *pResName, const char *pBitcode,
+                           size_t pBitcodeSize, const char *pRuntimePath,
+                           RSLinkRuntimeCallback pLinkRuntimeCallback,
+                           bool pDumpIR, bool pTier0,
+                           unsigned pLegacyTargetAPI,
+                           const char *pDeviceCacheDir,
+                           const RSScript::ExportConstantMapTy *pConstants);
+  bool finishBuild(PendingBuild *pBuild);
+
+  // The parsing stage of BuildPipeline(), run on its own thread. Defined in
+  // RSBatchBuild.cpp.
+  struct PipelineState;
+  static void RunPipelineFrontStage(void *pState);
+
+  // Extract the info of pScript (owned by pScript) and link pScript with the
+  // runtime. Return NULL on error.
+  RSInfo *prepareScript(RSScript &pScript, const char *pScriptName,
+                        const char *pRuntimePath,
+                        const RSInfo::DependencyTableTy &pDeps);
+
+  // Compile pScript with mCompiler or, if it's busy, a CompilerSlot. If
+  // pPreparedInfo is non-NULL, pScript has already been through
+  // prepareScript(), which returned it. If pCacheSHA1 is non-NULL, the new
+  // object is also kept in RSExecutableCache under this bitcode SHA-1, so
+  // that the load right after the build is served from memory.
   Compiler::ErrorCode compileScript(RSScript &pScript,
                                     const char* pScriptName,
                                     const char *pOutputPath,
                                     const char *pRuntimePath,
                                     const RSInfo::DependencyTableTy &pDeps,
-                                    bool pSkipLoad, bool pDumpIR = false);
+                                    bool pSkipLoad, bool pDumpIR = false,
+                                    RSInfo *pPreparedInfo = NULL,
+                                    const uint8_t *pCacheSHA1 = NULL);
+
+  // compileScript() with the given compiler state.
+  Compiler::ErrorCode compileScriptWith(CompilerConfig *&pConfig,
+                                        RSCompiler &pCompiler,
+                                        RSScript &pScript,
+                                        const char* pScriptName,
+                                        const char *pOutputPath,
+                                        const char *pRuntimePath,
+                                        const RSInfo::DependencyTableTy &pDeps,
+                                        bool pSkipLoad, bool pDumpIR,
+                                        RSInfo *pPreparedInfo,
+                                        const uint8_t *pCacheSHA1);
 
 public:
   RSCompilerDriver(bool pUseCompilerRT = true);
   ~RSCompilerDriver();
 
   inline void setRSRuntimeLookupFunction(
-      LookupFunctionSymbolResolver<>::LookupFunctionTy pLookupFunc)
-  { mRSRuntime.setLookupFunction(pLookupFunc); }
-  inline void setRSRuntimeLookupContext(void *pContext)
-  { mRSRuntime.setContext(pContext); }
+      SharedLookupFunctionSymbolResolver::LookupFunctionTy pLookupFunc) {
+    mRSRuntime.setLookupFunction(pLookupFunc);
+    mResolver.invalidate();
+  }
+  inline void setRSRuntimeLookupContext(void *pContext) {
+    mRSRuntime.setContext(pContext);
+    mResolver.invalidate();
+  }
+
+  // Give the pNumSymbols symbols of the RS runtime named pNames[i] at
+  // pAddresses[i] the ID i, under pVersion (see
+  // SymbolResolverProxy::setIndexedSymbols().) The scripts built from then on
+  // record the IDs of the runtime symbols they use in their cache, and their
+  // loads under the same pVersion bind those symbols by index instead of
+  // looking their names up. Call it before the first load.
+  inline void setRSRuntimeSymbolTable(uint32_t pVersion,
+                                      const char *const *pNames,
+                                      void *const *pAddresses,
+                                      size_t pNumSymbols) {
+    mResolver.setIndexedSymbols(pVersion, pNames, pAddresses, pNumSymbols);
+  }
 
   RSCompiler *getCompiler() {
     return &mCompiler;
@@ -76,6 +402,7 @@ public:
 
   void setConfig(CompilerConfig *config) {
     mConfig = config;
+    mCustomConfig = true;
   }
 
   void setDebugContext(bool v) {
@@ -93,21 +420,451 @@ public:
     return mEnableGlobalMerge;
   }
 
+  // The cache files are always replaced atomically with rename(). If v is
+  // true, they're also fsync'ed (along with their directory) so that a new
+  // cache survives a power loss. Off by default since it costs a few flushes
+  // per build.
+  void setDurableCacheWrites(bool v) {
+    mCacheSync = (v ? AtomicOutputFile::kSyncAll : AtomicOutputFile::kNoSync);
+  }
+
+  // Same as above with the finer control of AtomicOutputFile::SyncMode
+  // (e.g., kSyncData skips the flush of the directory.)
+  void setCacheSyncMode(AtomicOutputFile::SyncMode pSync) {
+    mCacheSync = pSync;
+  }
+
+  // Write the RS cache containers from the writer thread of CacheWriter
+  // instead of the compile thread. This is process-wide, for all drivers. The
+  // loads of a container wait for its write; a process that exits right after
+  // its builds calls CacheWriter::flush() first.
+  static void setAsyncCacheWrites(bool v) {
+    CacheWriter::GetInstance().setAsynchronous(v);
+  }
+
+  // Keep what's detected of the CPU (the CPUProfile, the host features and
+  // the target features derived from them) in the snapshot file pPath, e.g.,
+  // in the cache directory, so that the next processes don't probe
+  // /proc/cpuinfo again. The snapshot is keyed by the build of libbcc and the
+  // kernel. This is process-wide and has to be called before the first
+  // driver is created (see CPUProfile::SetSnapshotPath().)
+  static void setCPUProfileSnapshot(const char *pPath) {
+    CPUProfile::SetSnapshotPath(pPath);
+  }
+
+  // Bound the cache directory of the builds to pQuota bytes: each build
+  // records its script in the index of the directory and evicts the least
+  // recently used scripts beyond the quota (see RSCacheManager.) 0, the
+  // default, leaves the directory unbounded and unindexed.
+  void setCacheQuota(uint64_t pQuota) {
+    mCacheQuota = pQuota;
+  }
+
+  // Store the objects in the RS cache containers as LZ4 blocks when that
+  // saves at least an eighth of their size. Each load then decompresses the
+  // object into the heap instead of handing the mapped file to the loader,
+  // which is a win where the storage is small or slow to read (e.g., eMMC on
+  // the low-end devices) and a loss where it's fast. The containers written
+  // either way load in both modes. Off by default.
+  void setCompressedCaches(bool v) {
+    mCompressCaches = v;
+  }
+
+  // A build holds {pResName}.rsc.lock in the cache directory until its RS
+  // cache container is published. If a loadScript() finds the container
+  // missing or out of date while another process holds that lock, it waits
+  // up to pTimeoutMs milliseconds (with an exponential backoff) for the
+  // build to end and loads the container again, instead of failing and
+  // having its caller compile the script a second time. The wait can't see
+  // the writes queued to CacheWriter in the other process (see
+  // setAsyncCacheWrites().) 0, the default, doesn't wait.
+  void setCacheWaitTimeout(unsigned pTimeoutMs) {
+    mCacheWaitTimeout = pTimeoutMs;
+  }
+
+  // Raising pToken (which must outlive the builds) cancels the builds of
+  // this driver that weren't given a token of their own, e.g., all the
+  // builds of a BuildBatch() when set by its RSDriverSetupFunction. NULL, the
+  // default, makes them run to completion.
+  void setCancellationToken(const CancellationToken *pToken) {
+    mCancelToken = pToken;
+  }
+
+  // The compiler thread runs the jobs of prefetchWhenIdle() only while
+  // pCallback returns true. NULL, the default, checks whether the device is
+  // charging (see RSCompilerThread.)
+  void setChargingCallback(RSChargingCallback pCallback, void *pUserData) {
+    mChargingCallback = pCallback;
+    mChargingUserData = pUserData;
+  }
+
+  // A load recognizes the bitcode of a cache by a 64-bit fingerprint, which
+  // is several times cheaper to compute than its SHA-1, and takes the SHA-1
+  // recorded in the cache for the dependency check. A bitcode whose wrapper
+  // records its SHA-1 (see bcinfo::writeAndroidBitcodeSourceSHA1()) isn't
+  // hashed at all: the recorded SHA-1 is trusted. If v is true, the bitcode
+  // is hashed in full on every load instead and the SHA-1 of its wrapper is
+  // verified. Off by default.
+  void setParanoidCacheChecks(bool v) {
+    mParanoidCacheChecks = v;
+  }
+
+  // Select the LTO pipeline profile ("fast-compile", "balanced" or
+  // "max-throughput") of the scripts compiled by this driver at the
+  // optimization levels other than 0. The default is "balanced". A script
+  // overrides it with "#pragma rs_lto_profile(<name>)". Return false if
+  // pName is unknown, in which case the profile is unchanged.
+  bool setLTOProfile(const char *pName);
+
+  // Select the code emission profile ("fast-emit", "compact" or "fast-code",
+  // see CompilerConfig::EmissionProfile) of the scripts compiled by this
+  // driver. By default, the scripts at -O0 get "fast-emit" and the others
+  // "fast-code". A script overrides it with
+  // "#pragma rs_emission_profile(<name>)". The profile set here is part of
+  // the dependencies of the caches (and keeps them out of the shared store.)
+  // Return false if pName is unknown, in which case the profile is unchanged.
+  bool setEmissionProfile(const char *pName);
+
+  // Describe the runtime the builds link in place of the built-in one: the
+  // library at pRuntimePath (the pRuntimePath given to build()) and/or the
+  // version pLinkRuntimeVersion of the RSLinkRuntimeCallback given to build()
+  // (any string that changes whenever what the callback links does.) Their
+  // digest is part of the dependencies of the caches, so that loadScript()
+  // rejects the caches built against another runtime instead of the callers
+  // having to rebuild on each start. The library is hashed here, once. Pass
+  // NULL for both to go back to the built-in runtime. Return false if
+  // pRuntimePath can't be read, in which case nothing changes.
+  bool setCustomRuntime(const char *pRuntimePath,
+                        const char *pLinkRuntimeVersion);
+
+  // In the low-memory mode, the builds trade some speed for a lower peak
+  // memory usage: the object is streamed to a scratch file (whose pages the
+  // kernel may reclaim) rather than kept on the heap, the function bodies are
+  // freed right after the code generation, the IR isn't dumped and the
+  // scripts that don't ask for an LTO profile get "fast-compile". The
+  // functions of the script and the runtime are always materialized lazily.
+  // See PhaseStats::mPeakRSS for the resulting peak usage. Off by default.
+  void setLowMemoryMode(bool v) {
+    mLowMemory = v;
+  }
+
+  // In the multiversioning mode, the RS cache container of a script also
+  // holds fallback objects compiled without the optional CPU features its
+  // main object uses (NEON on ARM; AVX, SSE4.1 and SSSE3 on x86, each one
+  // implying the next), and the load picks the first object the running CPU
+  // supports (see CPUProfile::GetHostFeatures().) This lets one container
+  // serve, e.g., the ARM cores with and without NEON. Each fallback costs
+  // another code generation of the script. Ignored in the low-memory mode
+  // and for the object files compiled with skipLoad. Off by default.
+  void setMultiversioning(bool v) {
+    mMultiversioning = v;
+  }
+
+  // In the profile instrumentation mode, the scripts are built with counters
+  // of how many times their kernels, expanded ForEach functions and
+  // invokables are entered and their conditional branches go either way.
+  // The runtime adds them to {pResName}.prof in pCacheDir when an executable
+  // is destroyed (see RSExecutable::writeProfile().) Without the mode, a
+  // build finds that profile (if it was collected from the same bitcode) and
+  // optimizes with it: branch weights for the block placement, optimizing
+  // the functions that never ran for size and inline hints on the hot ones.
+  // The digest of the profile is in the dependencies of the cache, so a new
+  // profile triggers a rebuild. The scripts with a profile (or in the mode)
+  // bypass the shared store. Off by default.
+  void setProfileInstrumentation(bool v) {
+    mProfileInstrumentation = v;
+  }
+
+  // Declare that the runtime only uses the exports (the variables, the
+  // invokables, the kernels and the reductions) in pNames of the script
+  // pResName, e.g., those referenced by the reflected classes of the app.
+  // The builds of the script then strip the others (whose addresses in the
+  // RSExecutable become NULL.) The set is in the dependencies of the cache,
+  // so changing it triggers a rebuild, and such scripts bypass the shared
+  // store. NULL withdraws the declaration.
+  void setUsedExports(const char *pResName,
+                      const std::set<std::string> *pNames);
+
+  // The objects compiled by build(RSScript &, ...) for the compatibility
+  // library embed their info as the binary RSInfo in .rs.info.bin, which the
+  // runtime reads in place with RSInfo::ReadEmbedded(), instead of the text in
+  // .rs.info it parses line by line. Off by default.
+  void setEmbedBinaryInfo(bool v) {
+    mEmbedBinaryInfo = v;
+  }
+
+  // In the export var block mode, the export vars of the scripts built from
+  // now on are laid out contiguously in one global, sorted so that there's
+  // little padding and the most referenced ones share the first cache lines.
+  // The runtime can then set or snapshot them all with one memcpy() of
+  // RSExecutable::getExportVarBlock(). The vars the mode can't move (e.g.,
+  // the constant ones) stay apart. The layout is recorded in the RS info.
+  // The mode isn't part of the cache key: a cache built without it is still
+  // loaded (and has no block) until it's rebuilt. Off by default.
+  void setExportVarBlock(bool v) {
+    mExportVarBlock = v;
+  }
+
+  // In the reduced-relocation mode, the code of the scripts built from now on
+  // reaches the symbols they don't define (the RS runtime, libm, ...) through
+  // one table of their addresses, so that the load of an object relocates a
+  // word per external symbol instead of each call site. The calls to them
+  // become indirect. The references within a script are resolved when it's
+  // compiled, as usual. The mode isn't part of the cache key: the caches
+  // built either way load the same. Off by default.
+  void setReducedRelocations(bool v) {
+    mReducedRelocations = v;
+  }
+
+  // In the kernel counter mode, the expanded ForEach functions of the
+  // kernels and the reductions of the scripts built from now on count how
+  // many times they're called and on how many cells, and with pCycles also
+  // the time they spend, per kernel (see RSExecutable::getKernelCounters().)
+  // It costs a few atomic adds per call of an expanded function, not per
+  // cell, so it's cheap enough to ship. The time is read from the clock the
+  // runtime sets (see RSExecutable::setKernelClock().) Bundles aren't
+  // counted. The mode isn't part of the cache key: a cache built without it
+  // is still loaded (and has no counters) until it's rebuilt. Off by
+  // default.
+  void setKernelCounters(bool v, bool pCycles = false) {
+    mKernelCounters = v;
+    mKernelCycleCounters = pCycles;
+  }
+
+  // Enable the shared store of compiled scripts in pDir (or disable it if
+  // pDir is NULL.) It's content-addressed by the bitcode and the version of
+  // the built-in dependencies, so processes that embed the same bitcode share
+  // one compiled copy. loadScript() consults it before pCacheDir. build()
+  // (but not the -O0 tier of buildTiered()) compiles into it instead of
+  // pCacheDir whenever pDir is writable by this process and there's neither a
+  // custom runtime nor a link callback. Only enable it in processes that use
+  // the default runtime: the store doesn't record such customizations.
+  void setSharedCacheDir(const char *pDir) {
+    mSharedCacheDir.setTo((pDir != NULL) ? pDir : "");
+  }
+
+  // Enable the shared-object output mode (or disable it if pLinker is NULL.)
+  // The scripts are compiled as PIC and, once the RS cache container is
+  // written, the object is linked with "pLinker [pArgs] -shared -o
+  // {pResName}.so <object>" into a shared library next to the container.
+  // loadScript() loads it with dlopen() instead of relocating the object
+  // itself, so the code pages are clean and shared among the processes, and
+  // profilers symbolize it. The undefined symbols of the scripts (i.e., the
+  // RS runtime and compiler-rt functions) are then bound by the dynamic
+  // linker rather than the lookup function of this driver: the libraries
+  // defining them must be loaded with global visibility (or given to the
+  // linker in pArgs.) Scripts aren't compiled into the shared store in this
+  // mode, and the object in the container is loaded whenever the shared
+  // object is missing or fails to load.
+  void setSharedObjectLinker(const char *pLinker, const char *pArgs = NULL) {
+    mSharedObjectLinker.setTo((pLinker != NULL) ? pLinker : "");
+    mSharedObjectLinkerArgs.setTo((pArgs != NULL) ? pArgs : "");
+  }
+
   // FIXME: This method accompany with loadScript and compileScript should
   //        all be const-methods. They're not now because the getAddress() in
   //        SymbolResolverInterface is not a const-method.
-  // Returns true if script is successfully compiled.
+  // Returns true if script is successfully compiled. Several threads may
+  // build on the same driver at once (each with its own pContext): a build
+  // that finds the compiler of the driver busy compiles with a spare one,
+  // unless the compiler was configured with setConfig(). loadScript() may be
+  // called concurrently with anything.
+  // If pCancelToken is non-NULL, raising it makes the build give up (see
+  // Compiler::compile()) and return false without writing the cache.
   bool build(BCCContext &pContext, const char *pCacheDir, const char *pResName,
              const char *pBitcode, size_t pBitcodeSize,
              const char *pRuntimePath,
              RSLinkRuntimeCallback pLinkRuntimeCallback = NULL,
-             bool pDumpIR = false);
+             bool pDumpIR = false,
+             const CancellationToken *pCancelToken = NULL);
+
+  // Same as the first build() above but pBitcode is the bitcode of a script
+  // targeting the API level pTargetAPI as is, i.e., not translated by
+  // bcinfo::BitcodeTranslator even if it's in a legacy format. Legacy bitcode
+  // is upgraded in memory and compiled right away instead of being written
+  // back in the current format and parsed again. The cache is keyed by
+  // pBitcode itself, so the translated bytes are never needed.
+  bool buildLegacy(BCCContext &pContext, const char *pCacheDir,
+                   const char *pResName, const char *pBitcode,
+                   size_t pBitcodeSize, unsigned pTargetAPI,
+                   const char *pRuntimePath,
+                   RSLinkRuntimeCallback pLinkRuntimeCallback = NULL,
+                   bool pDumpIR = false);
 
   // Returns true if script is successfully compiled.
   bool build(RSScript &pScript, const char *pOut, const char *pRuntimePath);
 
+  // Ahead-of-time build of the cache of a device. Same as the first build()
+  // above but the RS cache container is written to pOutDir and records the
+  // dependencies loadScript(pDeviceCacheDir, pResName, ...) checks on the
+  // device, so installing it as {pDeviceCacheDir}/{pResName}.rsc saves the
+  // compilation there. The compiler must be configured for the target of the
+  // device and the digest of its built-in dependencies (its "epoch", printed
+  // by bcc -print-builtin-digest on the device) set with
+  // RSInfo::SetBuiltInDigest(). Neither the shared store nor the profiles
+  // are used.
+  bool buildForDevice(BCCContext &pContext, const char *pOutDir,
+                      const char *pDeviceCacheDir, const char *pResName,
+                      const char *pBitcode, size_t pBitcodeSize,
+                      bool pDumpIR = false);
+
+  // Same as the first build() above but runs on the compiler thread of this
+  // driver and returns immediately. Jobs are run in the order they are
+  // submitted. pContext must not be used by others until the job is done
+  // and pBitcode must stay valid until then, too. The RSExecutable previously
+  // returned by loadScript() for the same script remains usable while the job
+  // is in flight. Returns NULL on error.
+  RSBuildJob *buildAsync(BCCContext &pContext, const char *pCacheDir,
+                         const char *pResName, const char *pBitcode,
+                         size_t pBitcodeSize, const char *pRuntimePath,
+                         RSLinkRuntimeCallback pLinkRuntimeCallback = NULL,
+                         RSBuildCompletionCallback pCompletionCallback = NULL,
+                         void *pUserData = NULL);
+
+  // Warm the caches for a script expected to be loaded soon (e.g., at the
+  // start of an app.) The compiler thread loads the script as loadScript()
+  // would, which verifies its cache and keeps the object in
+  // RSExecutableCache, then drops the executable. If the cache is missing or
+  // stale, the script is built instead with the thread at a background
+  // priority. Either way, the first loadScript() of the script that follows
+  // is then served from memory: it still relocates its own copy of the
+  // object, since the global variables are per-instance. The prefetch jobs
+  // run after the jobs of buildAsync(), which go ahead of them in the
+  // queue. Same requirements as buildAsync() on pContext and pBitcode. The
+  // job succeeds if the script could be loaded or built.
+  RSBuildJob *prefetch(BCCContext &pContext, const char *pCacheDir,
+                       const char *pResName, const char *pBitcode,
+                       size_t pBitcodeSize, const char *pRuntimePath = NULL,
+                       RSBuildCompletionCallback pCompletionCallback = NULL,
+                       void *pUserData = NULL);
+
+  // Same as prefetch() but for maintenance (e.g., rebuilding the caches of
+  // the scripts of an app after an update of the runtime): the job runs
+  // after all the others, and only while the device is charging (see
+  // setChargingCallback().) Until then, it stays in the queue.
+  RSBuildJob *prefetchWhenIdle(BCCContext &pContext, const char *pCacheDir,
+                               const char *pResName, const char *pBitcode,
+                               size_t pBitcodeSize,
+                               const char *pRuntimePath = NULL,
+                               RSBuildCompletionCallback pCompletionCallback =
+                                   NULL,
+                               void *pUserData = NULL);
+
+  // Whether the jobs of prefetchWhenIdle() may run now.
+  bool isCharging() const;
+
   RSExecutable *loadScript(const char *pCacheDir, const char *pResName,
                            const char *pBitcode, size_t pBitcodeSize);
+
+  // Start reading the files of pCacheDir that loadScript() of pResName reads
+  // (the RS cache container, its shared object in the shared-object output
+  // mode and the profile) into the page cache in the background, and return
+  // at once. Unlike prefetch(), nothing is hashed, decoded or built: it only
+  // takes the reads from the storage off the path of a loadScript() issued a
+  // moment later (e.g., for the scripts of a context being created.)
+  void prefetchCacheFiles(const char *pCacheDir, const char *pResName) const;
+
+  // build() followed by loadScript(), except that the executable is created
+  // from the object compiled in memory, with the SHA-1 of pBitcode and the
+  // dependencies computed for the build: nothing is hashed or read back from
+  // the cache directory, whose writes may still be pending (see
+  // setAsyncCacheWrites().) Falls back to loadScript() if the object couldn't
+  // be kept in memory. Returns NULL on error.
+  RSExecutable *buildAndLoad(BCCContext &pContext, const char *pCacheDir,
+                             const char *pResName, const char *pBitcode,
+                             size_t pBitcodeSize, const char *pRuntimePath,
+                             RSLinkRuntimeCallback pLinkRuntimeCallback = NULL,
+                             bool pDumpIR = false);
+
+  // Specialization on constant export variables. buildSpecialized() builds
+  // the script with the export variables in pConstants folded into its code
+  // (see RSScript::setExportConstants()) into {pCacheDir}/{pResName}-spec.rsc,
+  // next to the generic build. loadSpecialized() loads it if it was built on
+  // the same pConstants and returns NULL otherwise, in which case the runtime
+  // keeps running the generic build (from loadScript()) and may rebuild the
+  // specialized one. The values are hashed into the dependencies of the
+  // cache. The runtime specializes on the variables it doesn't expect to
+  // change (e.g., once the script is initialized) and has to go back to the
+  // generic build as soon as one of them is written.
+  bool buildSpecialized(BCCContext &pContext, const char *pCacheDir,
+                        const char *pResName, const char *pBitcode,
+                        size_t pBitcodeSize,
+                        const RSScript::ExportConstantMapTy &pConstants,
+                        const char *pRuntimePath,
+                        RSLinkRuntimeCallback pLinkRuntimeCallback = NULL);
+
+  RSExecutable *loadSpecialized(const char *pCacheDir, const char *pResName,
+                                const char *pBitcode, size_t pBitcodeSize,
+                                const RSScript::ExportConstantMapTy
+                                    &pConstants);
+
+  // Copy out, reset and log (with ALOGI) the statistics of loadScript() calls
+  // in this process, respectively.
+  static void GetCacheStats(RSCacheStats &pStats);
+  static void ResetCacheStats();
+  static void DumpCacheStats();
+
+  // Tiered build and load. If the optimized object of the script is already
+  // in pCacheDir, it's loaded and *pOptimizedJob is set to NULL. Otherwise,
+  // the script is quickly compiled at -O0 (into {pResName}-tier0.o) and
+  // loaded, and the build at the script's optimization level is submitted to
+  // buildAsync(). *pOptimizedJob receives the job (NULL if it couldn't be
+  // submitted.) Once it's done, loadScript() returns the optimized executable
+  // for new instances of the script. An executable returned by this method
+  // is never changed in place since it holds the instance's global variables.
+  // Returns NULL on error.
+  RSExecutable *buildTiered(BCCContext &pContext, const char *pCacheDir,
+                            const char *pResName, const char *pBitcode,
+                            size_t pBitcodeSize, const char *pRuntimePath,
+                            RSLinkRuntimeCallback pLinkRuntimeCallback,
+                            RSBuildCompletionCallback pCompletionCallback,
+                            void *pUserData, RSBuildJob **pOptimizedJob);
+
+  // Script bundles. buildBundle() compiles the scripts of an app in pScripts
+  // into one object, {pCacheDir}/{pBundleName}.rsc, linked with a single copy
+  // of the runtime library: the functions of libclcore they use are shared
+  // instead of being internalized into each script. The global symbols of
+  // each script are prefixed with its position in pScripts, and its own RS
+  // info is written to {pCacheDir}/{pBundleName}.{position}.info.
+  // loadBundle() loads the bundle built from the same pScripts and appends
+  // to pResult one RSExecutable per script, in the order of pScripts, each a
+  // view of the shared image (see RSExecutable::CreateView().) The global
+  // variables of the scripts are in the image, so each loadBundle() makes one
+  // instance of every script. The scripts must require the same floating
+  // point precision, and neither the legacy ones whose kernels aren't named
+  // nor those whose pragmas name kernels ("rs_fuse" and
+  // "rs_fp_relaxed_kernels") can be bundled. Bundles bypass the shared store
+  // and are built without profiles or used exports. Both return false on
+  // error.
+  bool buildBundle(BCCContext &pContext, const char *pCacheDir,
+                   const char *pBundleName,
+                   const android::Vector<RSBundleScript> &pScripts,
+                   const char *pRuntimePath = NULL);
+
+  bool loadBundle(const char *pCacheDir, const char *pBundleName,
+                  const android::Vector<RSBundleScript> &pScripts,
+                  android::Vector<RSExecutable *> &pResult);
+
+  // Build all the scripts in pItems using up to pNumThreads threads. Each
+  // thread has its own RSCompilerDriver and BCCContext (LLVM's TargetMachine
+  // and LLVMContext are not thread-safe). Returns true if all the scripts are
+  // successfully compiled. The result of each is stored in its item.
+  static bool BuildBatch(android::Vector<RSBatchBuildItem> &pItems,
+                         unsigned pNumThreads, const char *pRuntimePath,
+                         RSDriverSetupFunction pSetup = NULL,
+                         void *pSetupUserData = NULL, bool pDumpIR = false);
+
+  // Same as BuildBatch() but the scripts go through two stages run by two
+  // threads with a single RSCompilerDriver: one thread parses the bitcode of
+  // the next scripts and links them with the runtime (see beginBuild()) while
+  // the calling thread compiles the previous one and writes its cache. Up to
+  // pDepth scripts are kept parsed ahead, each in its own BCCContext, which
+  // bounds the memory to pDepth + 1 modules rather than one per thread.
+  static bool BuildPipeline(android::Vector<RSBatchBuildItem> &pItems,
+                            const char *pRuntimePath,
+                            RSDriverSetupFunction pSetup = NULL,
+                            void *pSetupUserData = NULL, bool pDumpIR = false,
+                            unsigned pDepth = 2);
 };
 
 } // end namespace bcc
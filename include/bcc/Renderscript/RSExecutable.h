@@ -18,12 +18,15 @@
 #define BCC_RS_EXECUTABLE_H
 
 #include <cstddef>
+#include <string>
 
+#include <llvm/ADT/StringMap.h>
 
 #include "bcc/ExecutionEngine/ObjectLoader.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Support/Log.h"
 
+#include <utils/RefBase.h>
 #include <utils/Vector.h>
 
 namespace bcc {
@@ -37,17 +40,88 @@ class SymbolResolverProxy;
  */
 class RSExecutable {
 private:
+  // The positions of a name among each kind of exports and among the pragma
+  // keys (-1 where it's absent.)
+  struct NamePositions {
+    int mExportVar;
+    int mExportFunc;
+    int mExportForeach;
+    int mExportReduce;
+    int mPragma;
+
+    NamePositions() : mExportVar(-1), mExportFunc(-1), mExportForeach(-1),
+                      mExportReduce(-1), mPragma(-1) { }
+  };
+
+  // The object file and the loaded object, owned by all the instances of the
+  // script (see createInstance()) or the views of the bundle (see
+  // CreateView().)
+  struct Image : public android::LightRefBase<Image> {
+    FileBase *mObjFile;
+    ObjectLoader *mLoader;
+
+    Image(FileBase &pObjFile, ObjectLoader &pLoader)
+      : mObjFile(&pObjFile), mLoader(&pLoader) { }
+    ~Image();
+  };
+
+  // The names of all the exports and pragmas of the script, built once by
+  // Create() (or CreateView()) for the lookups by name and shared by the
+  // instances.
+  struct NameIndex : public android::LightRefBase<NameIndex> {
+    llvm::StringMap<NamePositions> mNames;
+  };
+
   RSInfo *mInfo;
   bool mIsInfoDirty;
 
   FileBase *mObjFile;
 
+  // True if mObjFile is an RS cache container (see RSCacheContainer) rather
+  // than a plain object file accompanied by a .info file.
+  bool mIsContainer;
+
   ObjectLoader *mLoader;
 
+  android::sp<Image> mImage;
+
+  // NULL if out of memory (the lookups by name then find nothing.)
+  android::sp<NameIndex> mNameIndex;
+
+  // Non-empty in a view of a bundle: the symbols of the script are named with
+  // this prefix in the image.
+  std::string mSymbolPrefix;
+
+  // Fill mPragmaKeys and mPragmaValues from mInfo.
+  void copyPragmas();
+
+  // Build mNameIndex from pInfo.
+  void indexNames(const RSInfo &pInfo);
+
+  // Return the positions of pName or NULL if it's none of the names.
+  inline const NamePositions *lookupName(const char *pName) const {
+    if (mNameIndex == NULL) {
+      return NULL;
+    }
+    llvm::StringMap<NamePositions>::const_iterator it =
+        mNameIndex->mNames.find(pName);
+    return ((it != mNameIndex->mNames.end()) ? &it->getValue() : NULL);
+  }
+
+  void *getPrefixedSymbolAddress(const char *pName) const;
+
   // Memory address of rs export stuffs
   android::Vector<void *> mExportVarAddrs;
   android::Vector<void *> mExportFuncAddrs;
-  android::Vector<void *> mExportForeachFuncAddrs;
+  // Indexed by RSInfo::ExportForeachVariant.
+  android::Vector<void *> mExportForeachAddrs[RSInfo::kNumForeachVariants];
+  // The expanded accumulators and the combiners of RSInfo::getExportReduces().
+  android::Vector<void *> mExportReduceAddrs[RSInfo::kNumForeachVariants];
+  android::Vector<void *> mExportReduceCombinerAddrs;
+
+  // The block of the export vars (see RSInfo::getExportVarLayout()) or NULL
+  // if there's none.
+  void *mExportVarBlock;
 
   // FIXME: These are designed for Renderscript HAL and is initialized in
   //        RSExecutable::Create(). Both of them come from RSInfo::getPragmas().
@@ -55,10 +129,35 @@ private:
   android::Vector<const char *> mPragmaKeys;
   android::Vector<const char *> mPragmaValues;
 
-  RSExecutable(RSInfo &pInfo, FileBase &pObjFile, ObjectLoader &pLoader)
-    : mInfo(&pInfo), mIsInfoDirty(false), mObjFile(&pObjFile), mLoader(&pLoader)
+  RSExecutable(RSInfo &pInfo, Image &pImage)
+    : mInfo(&pInfo), mIsInfoDirty(false), mObjFile(pImage.mObjFile),
+      mIsContainer(false), mLoader(pImage.mLoader), mImage(&pImage),
+      mExportVarBlock(NULL)
   { }
 
+  // Find the block of the export vars and point the addresses of those in
+  // the block to it. Nothing is done if pInfo has no layout.
+  void locateExportVarBlock(const RSInfo &pInfo);
+
+  // Fill the addresses of the exports in pResult by looking their names
+  // (prefixed with pPrefix if it's non-NULL) up in pLoader.
+  static void ResolveExports(const RSInfo &pInfo, const ObjectLoader &pLoader,
+                             RSExecutable &pResult,
+                             const char *pPrefix = NULL);
+
+  // Same as ResolveExports() but the addresses are computed from the locations
+  // recorded in pInfo (see RSInfo::getExportSymbols().)
+  static void LocateExports(const RSInfo &pInfo, const ObjectLoader &pLoader,
+                            RSExecutable &pResult);
+
+  // Return NULL on error. If the return object is non-NULL, it claims the
+  // ownership of pInfo, pObjFile and pLoader. If pLocateExports is false, the
+  // export locations recorded in pInfo are ignored (see ResolveExports().)
+  static RSExecutable *Create(RSInfo &pInfo,
+                              FileBase &pObjFile,
+                              ObjectLoader &pLoader,
+                              bool pLocateExports = true);
+
 public:
   // This is a NULL-terminated string array which specifies "Special" functions
   // in Renderscript (e.g., root().)
@@ -70,6 +169,47 @@ public:
                               FileBase &pObjFile,
                               SymbolResolverProxy &pResolver);
 
+  // Same as above except that pObjFile is an RS cache container and the
+  // object is loaded from pImage, which holds a copy of the pImageSize bytes
+  // of the object in it. syncInfo() updates the info in the container.
+  // pLocateExports is false if pImage isn't the object pInfo was extracted
+  // with (e.g., it's a fallback in the container.) If pBindings is non-NULL,
+  // the undefined symbols of the object are resolved from the pNumBindings
+  // IDs there (see BoundSymbolResolver.)
+  static RSExecutable *Create(RSInfo &pInfo,
+                              FileBase &pObjFile,
+                              const void *pImage, size_t pImageSize,
+                              SymbolResolverProxy &pResolver,
+                              bool pLocateExports = true,
+                              const uint32_t *pBindings = NULL,
+                              size_t pNumBindings = 0);
+
+  // Same as above except that the script is loaded from the shared object
+  // pSharedObjectPath linked from the object in pObjFile (see
+  // ObjectLoader::LoadSharedObject().)
+  static RSExecutable *Create(RSInfo &pInfo,
+                              FileBase &pObjFile,
+                              const char *pSharedObjectPath);
+
+  // Return a new instance of the script which shares the relocated image
+  // with this one (and gets a copy of the RS info), or NULL if it can't be
+  // shared: the sections of the object are relocated against each other in
+  // place, so a script with global variables (i.e., with writable sections)
+  // needs a load of its own (see RSCompilerDriver::build().) The instances may
+  // be destroyed in any order.
+  RSExecutable *createInstance() const;
+
+  // Return the script whose symbols are named with pPrefix in pBundle, the
+  // executable of a bundle of scripts (see RSCompilerDriver::buildBundle()),
+  // or NULL on error. pInfo is the RS info of the script, whose ownership the
+  // result claims if it's non-NULL. The view shares the image (and thus the
+  // global variables of the script) with pBundle and its other views, which
+  // may be destroyed in any order. getSymbolAddress() looks the unprefixed
+  // names up, so the runtime uses a view like any other script. The info of
+  // a view isn't synced back to the bundle.
+  static RSExecutable *CreateView(const RSExecutable &pBundle, RSInfo &pInfo,
+                                  const char *pPrefix);
+
   inline const RSInfo &getInfo() const
   { return *mInfo; }
 
@@ -86,26 +226,173 @@ public:
   }
 
   // Interfaces to ObjectLoader
-  inline void *getSymbolAddress(const char *pName) const
-  { return mLoader->getSymbolAddress(pName); }
+  inline void *getSymbolAddress(const char *pName) const {
+    return (mSymbolPrefix.empty() ? mLoader->getSymbolAddress(pName) :
+                                    getPrefixedSymbolAddress(pName));
+  }
+
+  // Register the script with GDB's JIT interface (see
+  // ObjectLoader::registerWithDebugger().) A script with debug information is
+  // registered at the load only if a debugger is attached at the time.
+  inline bool registerWithDebugger()
+  { return mLoader->registerWithDebugger(); }
 
   bool syncInfo(bool pForce = false);
 
+  // Add the counters of a script compiled with
+  // RSCompilerDriver::setProfileInstrumentation() to its RSProfile next to
+  // the cache and reset them. Also done when the script is destroyed. Return
+  // false on error (and true if the script isn't instrumented.)
+  bool writeProfile();
+
   // Disassemble and dump the relocated functions to the pOutput.
   void dumpDisassembly(OutputFile &pOutput) const;
 
   inline const android::Vector<void *> &getExportVarAddrs() const
   { return mExportVarAddrs; }
+  // The getExportVarBlockSize() bytes holding the export vars of a script
+  // built in the export var block mode (see
+  // RSCompilerDriver::setExportVarBlock()), or NULL. The address of a var in
+  // the block is that of the block plus its offset in
+  // RSInfo::getExportVarLayout().
+  inline void *getExportVarBlock() const
+  { return mExportVarBlock; }
+  inline size_t getExportVarBlockSize() const
+  { return ((mExportVarBlock != NULL) ? mInfo->getExportVarBlockSize() : 0); }
   inline const android::Vector<void *> &getExportFuncAddrs() const
   { return mExportFuncAddrs; }
   inline const android::Vector<void *> &getExportForeachFuncAddrs() const
-  { return mExportForeachFuncAddrs; }
+  { return mExportForeachAddrs[RSInfo::kForeachExpand]; }
+  // Entry points of "<NAME>.expand.tiled" which take a RsExpandTile. An entry
+  // is NULL if the tiled variant is not present in the object.
+  inline const android::Vector<void *> &getExportForeachTiledFuncAddrs() const
+  { return mExportForeachAddrs[RSInfo::kForeachExpandTiled]; }
+  // Entry points of "<NAME>.expand.flat". They take a RsExpandTile like the
+  // tiled ones but walk all its cells in a single loop, so they may only be
+  // used when the rows and the planes of the tile are contiguous in both the
+  // input and the output allocations (i.e., inystride == (x2 - x1) * instep
+  // and inzstride == (y2 - y1) * inystride, and the same for the output.) An
+  // entry is NULL if the kernel takes x or y and thus has no flat variant.
+  inline const android::Vector<void *> &getExportForeachFlatFuncAddrs() const
+  { return mExportForeachAddrs[RSInfo::kForeachExpandFlat]; }
+  // Entry points of "<NAME>.expand.volume" which take a RsExpandVolume, i.e.,
+  // a RsExpandTile extended with the LOD and the face ranges and strides.
+  // They walk all the dimensions of the launch in a single call.
+  inline const android::Vector<void *> &getExportForeachVolumeFuncAddrs() const
+  { return mExportForeachAddrs[RSInfo::kForeachExpandVolume]; }
+  // Entry points of "<NAME>.expand.spans" which take a RsExpandTile (for the
+  // base pointers, steps and strides) and an array of count RsExpandSpan
+  // { uint32_t x1, x2, y, z; }, the runs of active cells of the tile, e.g.,
+  // of a region of interest or a mask. Only the cells of the spans are
+  // visited.
+  inline const android::Vector<void *> &getExportForeachSpansFuncAddrs() const
+  { return mExportForeachAddrs[RSInfo::kForeachExpandSpans]; }
+  // Entry points of "<NAME>.expand.stream", called like those of
+  // "<NAME>.expand" for the launches over allocations in uncached or slow
+  // memory (e.g., camera buffers.) They copy the cells in and out of cached
+  // scratch buffers a block at a time. The entry is NULL for the kernels
+  // without one (e.g., those with neither an input nor an output.)
+  inline const android::Vector<void *> &getExportForeachStreamFuncAddrs() const
+  { return mExportForeachAddrs[RSInfo::kForeachExpandStream]; }
+
+  // The entry point of RSInfo::LaunchBatchName:
+  //
+  //   void (const RsLaunchDesc *descs, uint32_t count)
+  //
+  // It runs count launches of the volume entry points in order, each
+  // described by an RsLaunchDesc { uint32_t slot; const
+  // RsForEachStubParamStruct *p; RsExpandVolume vol; } whose slot is the
+  // index of the foreach function in RSInfo::getExportForeachFuncs(). This
+  // saves a function pointer call per launch on graphs of small launches.
+  // NULL if the script has no foreach function or is a view of a bundle. It
+  // isn't cached: look it up once.
+  inline void *getLaunchBatchFuncAddr() const
+  { return getSymbolAddress(RSInfo::LaunchBatchName); }
+
+  // What a kernel of a script built with RSCompilerDriver::setKernelCounters()
+  // has counted so far (in all the instances of the script.)
+  struct KernelCounters {
+    // The calls of its "<NAME>.expand" (e.g., once per row of a tile.)
+    uint64_t calls;
+    // The cells they were called on.
+    uint64_t cells;
+    // The time spent in the calls, in the unit of the clock given to
+    // setKernelClock(). 0 unless the script is built with pCycles.
+    uint64_t time;
+  };
+
+  // The counters of the foreach functions and then of the reductions, in the
+  // order of RSInfo::getExportForeachFuncs() and getExportReduces(), or NULL
+  // if the script doesn't count them. They're updated with atomic adds by
+  // the kernels: read them with atomic loads, or while nothing runs. It isn't
+  // cached: look it up once.
+  inline KernelCounters *getKernelCounters() const {
+    return reinterpret_cast<KernelCounters *>(
+        getSymbolAddress(RSInfo::KernelCountersName));
+  }
+
+  // Time the kernels with pClock (e.g., reading the cycle counter of the
+  // PMU, or clock_gettime() in ns), or stop timing them if NULL. It must be
+  // callable from any thread running a kernel. Return false if the script
+  // isn't built to time its kernels.
+  bool setKernelClock(uint64_t (*pClock)());
+
+  // The expanded accumulators of the reductions, in the same four variants.
+  // Each folds its cells into the accumulator at p->out, so every thread
+  // passes its own accumulator and 0 for all the out strides. A combiner
+  // void (accum_t *, const accum_t *) merges the accumulators afterwards.
+  // The estimated cost per cell of each foreach function (see
+  // RSInfo::getExportForeachCosts().) Empty if unknown.
+  inline const RSInfo::ExportForeachCostListTy &getExportForeachCosts() const
+  { return mInfo->getExportForeachCosts(); }
+
+  inline const android::Vector<void *> &getExportReduceFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpand]; }
+  inline const android::Vector<void *> &getExportReduceTiledFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpandTiled]; }
+  inline const android::Vector<void *> &getExportReduceFlatFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpandFlat]; }
+  inline const android::Vector<void *> &getExportReduceVolumeFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpandVolume]; }
+  inline const android::Vector<void *> &getExportReduceSpansFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpandSpans]; }
+  inline const android::Vector<void *> &getExportReduceStreamFuncAddrs() const
+  { return mExportReduceAddrs[RSInfo::kForeachExpandStream]; }
+  inline const android::Vector<void *> &getExportReduceCombinerAddrs() const
+  { return mExportReduceCombinerAddrs; }
 
   inline const android::Vector<const char *> &getPragmaKeys() const
   { return mPragmaKeys; }
   inline const android::Vector<const char *> &getPragmaValues() const
   { return mPragmaValues; }
 
+  // Lookups by name with a single hash lookup (the names are indexed once
+  // per image.) Return the index of the export named pName in the address
+  // vectors of its kind above, or -1 if there's none.
+  inline int getExportVarIndex(const char *pName) const {
+    const NamePositions *positions = lookupName(pName);
+    return ((positions != NULL) ? positions->mExportVar : -1);
+  }
+  inline int getExportFuncIndex(const char *pName) const {
+    const NamePositions *positions = lookupName(pName);
+    return ((positions != NULL) ? positions->mExportFunc : -1);
+  }
+  inline int getExportForeachIndex(const char *pName) const {
+    const NamePositions *positions = lookupName(pName);
+    return ((positions != NULL) ? positions->mExportForeach : -1);
+  }
+  inline int getExportReduceIndex(const char *pName) const {
+    const NamePositions *positions = lookupName(pName);
+    return ((positions != NULL) ? positions->mExportReduce : -1);
+  }
+
+  // Return the value of the (first) pragma pKey, or NULL if there's none.
+  inline const char *getPragmaValue(const char *pKey) const {
+    const NamePositions *positions = lookupName(pKey);
+    return (((positions != NULL) && (positions->mPragma >= 0)) ?
+                mPragmaValues[positions->mPragma] : NULL);
+  }
+
   ~RSExecutable();
 };
 
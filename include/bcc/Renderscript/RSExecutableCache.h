@@ -0,0 +1,127 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_EXECUTABLE_CACHE_H
+#define BCC_RS_EXECUTABLE_CACHE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <llvm/Support/Mutex.h>
+
+#include "bcc/Support/Sha1Util.h"
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace bcc {
+
+class RSExecutable;
+class RSInfo;
+class SymbolResolverProxy;
+
+/*
+ * RSExecutableCache keeps the contents of the recently loaded RS object files
+ * and their RSInfo in memory, so that instantiating a script which has been
+ * loaded before in the same process doesn't have to take the file locks and
+ * read and verify its RS cache container (see RSCacheContainer) again.
+ *
+ * The entries are keyed by the path of the container and the SHA-1 of the
+ * bitcode it was compiled from. Each RSExecutable still gets its own relocated
+ * image since the global variables of a script are per-instance.
+ *
+ * Relocation results are neither cached here nor written to the cache
+ * directory: librsloader picks the section addresses when it loads an object
+ * and the runtime libraries may live at different addresses in every process,
+ * so a pre-relocated image can't be reused without re-resolving each symbol.
+ */
+class RSExecutableCache {
+private:
+  struct Entry {
+    android::String8 mObjPath;
+    uint8_t mSHA1[SHA1_DIGEST_LENGTH];
+
+    // Contents of the object file.
+    uint8_t *mImage;
+    size_t mImageSize;
+
+    // Pristine RSInfo of the object. Each load gets its own clone.
+    RSInfo *mInfo;
+
+    // Value of mTick at the last use of the entry.
+    unsigned mLastUse;
+
+    Entry() : mImage(NULL), mImageSize(0), mInfo(NULL), mLastUse(0) { }
+    ~Entry();
+  };
+
+  llvm::sys::Mutex mLock;
+
+  android::Vector<Entry *> mEntries;
+
+  // Sum of mImageSize of all entries.
+  size_t mSize;
+
+  // Maximum of mSize. 0 disables the cache.
+  size_t mBudget;
+
+  unsigned mTick;
+
+  // Return the index of the entry for pObjPath in mEntries or -1 if there's
+  // none. Caller must hold mLock.
+  int find(const char *pObjPath) const;
+
+  // Drop the least recently used entries until pNeeded more bytes fit in the
+  // budget. Caller must hold mLock.
+  void evict(size_t pNeeded);
+
+  void erase(size_t pIdx);
+
+  RSExecutableCache();
+  ~RSExecutableCache();
+
+public:
+  // Default memory budget (in bytes) for the object images.
+  static const size_t DefaultBudget = 1024 * 1024;
+
+  // The process-wide cache.
+  static RSExecutableCache &GetInstance();
+
+  // Set the memory budget (in bytes) of the cache. Entries are evicted if
+  // necessary. 0 disables the cache.
+  void setBudget(size_t pBudget);
+
+  size_t getBudget();
+
+  // Return a new RSExecutable for the object file pObjPath compiled from the
+  // bitcode with SHA-1 pSHA1 or NULL if the cache doesn't hold it.
+  RSExecutable *load(const char *pObjPath, const uint8_t *pSHA1,
+                     SymbolResolverProxy &pResolver);
+
+  // Remember the pImageSize bytes of object at pImage, which is stored in the
+  // RS cache container pObjPath, compiled from the bitcode with SHA-1 pSHA1
+  // and described by pInfo. Return false if it's not cached.
+  bool insert(const char *pObjPath, const uint8_t *pSHA1,
+              const void *pImage, size_t pImageSize, const RSInfo &pInfo);
+
+  // Drop the entry of the object file pObjPath, if any. Must be called
+  // whenever the file is rewritten.
+  void invalidate(const char *pObjPath);
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_EXECUTABLE_CACHE_H
@@ -19,6 +19,10 @@
 
 #include <stdint.h>
 
+#include <cstddef>
+#include <new>
+#include <set>
+#include <string>
 #include <utility>
 
 #include "bcc/Support/Log.h"
@@ -27,6 +31,10 @@
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
+namespace android {
+class FileMap;
+}
+
 namespace llvm {
 class Module;
 }
@@ -48,7 +56,7 @@ namespace rsinfo {
 #define RSINFO_MAGIC      "\0rsinfo\n"
 
 /* RS info file version, encoded in 4 bytes of ASCII */
-#define RSINFO_VERSION    "004\0"
+#define RSINFO_VERSION    "013\0"
 
 struct __attribute__((packed)) ListHeader {
   // The offset from the beginning of the file of data
@@ -72,12 +80,29 @@ struct __attribute__((packed)) Header {
 
   uint32_t strPoolSize;
 
+  // Combined digest of all the built-in dependencies. See
+  // RSInfo::GetBuiltInDigest().
+  uint8_t builtInDigest[SHA1_DIGEST_LENGTH];
+
   struct ListHeader dependencyTable;
   struct ListHeader pragmaList;
   struct ListHeader objectSlotList;
   struct ListHeader exportVarNameList;
   struct ListHeader exportFuncNameList;
   struct ListHeader exportForeachFuncList;
+  struct ListHeader exportReduceList;
+  // Where each export var, export func and foreach kernel is in the object.
+  // See RSInfo::getExportSymbols().
+  struct ListHeader exportSymbolList;
+  // The estimated cost of each foreach function. See
+  // RSInfo::getExportForeachCosts().
+  struct ListHeader exportForeachCostList;
+  // Where each export var is in the block of export vars. See
+  // RSInfo::getExportVarLayout().
+  struct ListHeader exportVarLayoutList;
+  // The runs of object slots in the block of export vars. See
+  // RSInfo::getObjectSlotRanges().
+  struct ListHeader objectSlotRangeList;
 };
 
 typedef uint32_t StringIndexTy;
@@ -115,6 +140,48 @@ struct __attribute__((packed)) ExportForeachFuncItem {
   uint32_t signature;
 };
 
+struct __attribute__((packed)) ExportReduceItem {
+  // The accumulator function.
+  StringIndexTy name;
+  // The combiner function.
+  StringIndexTy combiner;
+  // Same encoding as ExportForeachFuncItem::signature. The accumulator is the
+  // "out" parameter.
+  uint32_t signature;
+};
+
+struct __attribute__((packed)) ExportSymbolItem {
+  // Index of the section containing the symbol in the object or SHN_UNDEF if
+  // the location is unknown.
+  uint16_t section;
+  // Offset of the symbol from the beginning of the section.
+  uint32_t offset;
+};
+
+struct __attribute__((packed)) ExportForeachCostItem {
+  // Number of instructions per cell.
+  uint32_t instructions;
+  // Number of those accessing the memory.
+  uint32_t memoryOps;
+};
+
+struct __attribute__((packed)) ExportVarLayoutItem {
+  // Offset of the variable from the beginning of the block or
+  // gInvalidExportVarOffset if it's not in the block.
+  uint32_t offset;
+  // Size of the variable in bytes.
+  uint32_t size;
+};
+
+const uint32_t gInvalidExportVarOffset = static_cast<uint32_t>(-1);
+
+struct __attribute__((packed)) ObjectSlotRangeItem {
+  // Offset of the run from the beginning of the block of export vars.
+  uint32_t offset;
+  // Size of the run in bytes.
+  uint32_t size;
+};
+
 // Return the human-readable name of the given rsinfo::*Item in the template
 // parameter. This is for debugging and error message.
 template<typename Item>
@@ -144,23 +211,220 @@ template<>
 inline const char *GetItemTypeName<ExportForeachFuncItem>()
 { return "rs export foreach"; }
 
+template<>
+inline const char *GetItemTypeName<ExportReduceItem>()
+{ return "rs export reduce"; }
+
+template<>
+inline const char *GetItemTypeName<ExportSymbolItem>()
+{ return "rs export symbol"; }
+
+template<>
+inline const char *GetItemTypeName<ExportForeachCostItem>()
+{ return "rs export foreach cost"; }
+
+template<>
+inline const char *GetItemTypeName<ExportVarLayoutItem>()
+{ return "rs export var layout"; }
+
+template<>
+inline const char *GetItemTypeName<ObjectSlotRangeItem>()
+{ return "rs object slot range"; }
+
+// A list whose items are stored in the arena of the RSInfo holding it (see
+// RSInfo::mArena.) Its capacity is reserved once when the RSInfo is created,
+// so adding an item never allocates. The items must be trivially copyable.
+template<typename ItemType>
+class ArenaList {
+private:
+  ItemType *mItems;
+  size_t mSize;
+  size_t mCapacity;
+
+  ArenaList(const ArenaList &); // DISABLED.
+  void operator=(const ArenaList &); // DISABLED.
+
+public:
+  typedef const ItemType *const_iterator;
+
+  ArenaList() : mItems(NULL), mSize(0), mCapacity(0) { }
+
+  // Use the pCapacity items at pStorage. The list becomes empty.
+  inline void reset(ItemType *pStorage, size_t pCapacity) {
+    mItems = pStorage;
+    mSize = 0;
+    mCapacity = pCapacity;
+  }
+
+  // Return false (and drop pItem) if the list is full.
+  inline bool push(const ItemType &pItem) {
+    if (mSize >= mCapacity) {
+      return false;
+    }
+    new (&mItems[mSize++]) ItemType(pItem);
+    return true;
+  }
+
+  // Return false (and append nothing) if pOther doesn't fit.
+  bool append(const ArenaList &pOther) {
+    if ((mCapacity - mSize) < pOther.mSize) {
+      return false;
+    }
+    for (size_t i = 0; i < pOther.mSize; i++) {
+      new (&mItems[mSize++]) ItemType(pOther.mItems[i]);
+    }
+    return true;
+  }
+
+  inline void clear()
+  { mSize = 0; }
+
+  inline size_t size() const
+  { return mSize; }
+  inline size_t capacity() const
+  { return mCapacity; }
+  inline bool isEmpty() const
+  { return (mSize == 0); }
+
+  inline const ItemType &operator[](size_t pIndex) const
+  { return mItems[pIndex]; }
+  inline ItemType &editItemAt(size_t pIndex)
+  { return mItems[pIndex]; }
+
+  inline const_iterator begin() const
+  { return mItems; }
+  inline const_iterator end() const
+  { return (mItems + mSize); }
+};
+
 } // end namespace rsinfo
 
 class RSInfo {
 public:
   typedef android::Vector<std::pair<const char *,
                                     const uint8_t *> > DependencyTableTy;
-  typedef android::Vector<std::pair<const char*, const char*> > PragmaListTy;
-  typedef android::Vector<uint32_t> ObjectSlotListTy;
-  typedef android::Vector<const char *> ExportVarNameListTy;
-  typedef android::Vector<const char *> ExportFuncNameListTy;
-  typedef android::Vector<std::pair<const char *,
-                                    uint32_t> > ExportForeachFuncListTy;
+  typedef rsinfo::ArenaList<std::pair<const char*,
+                                      const char*> > PragmaListTy;
+  typedef rsinfo::ArenaList<uint32_t> ObjectSlotListTy;
+  typedef rsinfo::ArenaList<const char *> ExportVarNameListTy;
+  typedef rsinfo::ArenaList<const char *> ExportFuncNameListTy;
+  typedef rsinfo::ArenaList<std::pair<const char *,
+                                      uint32_t> > ExportForeachFuncListTy;
+  // A reduction kernel. The accumulator function
+  //
+  //   void <name>(accum_t *accum, in_t in [, uint32_t x] [, uint32_t y])
+  //
+  // folds one cell of the input into accum, and the combiner function
+  //
+  //   void <combiner>(accum_t *accum, const accum_t *other)
+  //
+  // folds the accumulator of another thread into accum.
+  struct ExportReduce {
+    const char *name;
+    const char *combiner;
+    uint32_t signature;
+  };
+  typedef rsinfo::ArenaList<ExportReduce> ExportReduceListTy;
+  // (section index, offset in the section)
+  typedef rsinfo::ArenaList<std::pair<uint16_t,
+                                      uint32_t> > ExportSymbolListTy;
+  // (instructions, memory operations) per cell
+  typedef rsinfo::ArenaList<std::pair<uint32_t,
+                                      uint32_t> > ExportForeachCostListTy;
+  // (offset in the block of export vars, size)
+  typedef rsinfo::ArenaList<std::pair<uint32_t,
+                                      uint32_t> > ExportVarLayoutListTy;
+  // (offset in the block of export vars, size)
+  typedef rsinfo::ArenaList<std::pair<uint32_t,
+                                      uint32_t> > ObjectSlotRangeListTy;
+
+  // The entry points RSForEachExpandPass generates for each foreach function.
+  enum ExportForeachVariant {
+    // "<NAME>.expand" invoked on a range of cells of a row.
+    kForeachExpand,
+    // "<NAME>.expand.tiled" invoked on a RsExpandTile.
+    kForeachExpandTiled,
+    // "<NAME>.expand.flat" invoked on a RsExpandTile whose rows and planes
+    // are contiguous in both the input and the output.
+    kForeachExpandFlat,
+    // "<NAME>.expand.volume" invoked on a RsExpandVolume (i.e., over the z,
+    // LOD and face dimensions as well.)
+    kForeachExpandVolume,
+    // "<NAME>.expand.spans" invoked on the RsExpandSpan of the active cells
+    // of a RsExpandTile.
+    kForeachExpandSpans,
+    // "<NAME>.expand.stream" invoked like "<NAME>.expand" on allocations in
+    // slow memory, staging blocks of cells through scratch buffers.
+    kForeachExpandStream,
+
+    kNumForeachVariants
+  };
+
+  // The suffix of the name of each ExportForeachVariant.
+  static const char *const ExportForeachSuffixes[kNumForeachVariants];
+
+  // "#pragma rs_fuse(A, B, ...)" exports one more foreach function which runs
+  // the pass-by-value kernels A, B, ... back to back on each cell, the result
+  // of one being the input of the next. Its name is the names of the kernels
+  // joined with this separator (i.e., "A+B+...".)
+  static const char FusedForeachSeparator[];
+
+  // The name of the function RSForEachExpandPass generates to run an array
+  // of launches of the foreach functions back to back (see
+  // RSExecutable::getLaunchBatchFuncAddr().)
+  static const char LaunchBatchName[];
+
+  // The name of the global RSExportVarBlockPass gathers the export vars into
+  // (see getExportVarLayout().)
+  static const char ExportVarBlockName[];
+
+  // The names of the counters of the kernels of a script built with
+  // RSCompilerDriver::setKernelCounters() and of the clock they're timed
+  // with (see RSExecutable::getKernelCounters().)
+  static const char KernelCountersName[];
+  static const char KernelClockName[];
+
+  // The name the dependency on the bitcode of a script is recorded under.
+  // It doesn't depend on where the cache is, so that the same bitcode built
+  // by the same libbcc gives the same cache files anywhere.
+  static const char BitcodeDependencyName[];
+
+  // The outcome of ReadFromFile().
+  enum ReadStatus {
+    kReadOK,
+    // The file doesn't exist (i.e., the script hasn't been built.)
+    kReadNotFound,
+    // The file couldn't be accessed or there's no memory to read it.
+    kReadIOError,
+    // The file has a different magic or version.
+    kReadVersionMismatch,
+    // The file is truncated or has an invalid layout.
+    kReadCorrupted,
+    // One of the built-in dependencies has been updated.
+    kReadLibBCCChanged,
+    kReadLibCompilerRTChanged,
+    kReadLibRSChanged,
+    // libclcore.bc or any of its variants.
+    kReadLibCLCoreChanged,
+    // The bitcode or other dependencies given by the caller differ.
+    kReadSourceChanged
+  };
 
 public:
   // Calculate or load the SHA-1 information of the built-in dependencies.
   static bool LoadBuiltInSHA1Information();
 
+  // Return the digest of all the built-in dependencies, which is computed
+  // once per process, or NULL if it's unavailable. On the target, it's derived
+  // from the SHA-1s in libbcc.sha1.so. On the host, it's the SHA-1 of the
+  // image containing libbcc.
+  static const uint8_t *GetBuiltInDigest();
+
+  // Make GetBuiltInDigest() return pDigest from now on in this process, e.g.,
+  // to build the caches of a device ahead of time on the host (see
+  // RSCompilerDriver::buildForDevice().)
+  static void SetBuiltInDigest(const uint8_t pDigest[SHA1_DIGEST_LENGTH]);
+
   // Return the path of the RS info file corresponded to the given output
   // executable file.
   static android::String8 GetPath(const char *pFilename);
@@ -189,15 +453,32 @@ private:
   static const uint8_t *LibCLCoreNEONSHA1;
 #endif
 
-  static bool CheckDependency(const RSInfo &pInfo,
-                              const char *pInputFilename,
-                              const DependencyTableTy &pDeps);
+  static uint8_t BuiltInDigest[SHA1_DIGEST_LENGTH];
+  static bool ComputeBuiltInDigest(uint8_t pResult[SHA1_DIGEST_LENGTH]);
+
+  // Tell which built-in dependency has changed when the built-in digests
+  // differ. Only used for the diagnosis.
+  static ReadStatus ClassifyBuiltInChange(const RSInfo &pInfo,
+                                          const char *pInputFilename);
+
+  static ReadStatus CheckDependency(const RSInfo &pInfo,
+                                    const char *pInputFilename,
+                                    const DependencyTableTy &pDeps);
   static bool AddBuiltInDependencies(RSInfo &pInfo);
 
   rsinfo::Header mHeader;
 
+  // The single block holding the items of all the lists below but the
+  // dependency table, followed by the string pool (unless this is a view.)
+  // It's allocated once in the constructor.
+  char *mArena;
+
   char *mStringPool;
 
+  // Non-NULL if this is a view: mStringPool then points into the mapping
+  // (which is kept alive until destruction) rather than into mArena.
+  android::FileMap *mView;
+
   // In most of the time, there're 4 source dependencies stored (libbcc.so,
   // libRS.so, libclcore and the input bitcode itself.)
   DependencyTableTy mDependencyTable;
@@ -206,14 +487,53 @@ private:
   ExportVarNameListTy mExportVarNames;
   ExportFuncNameListTy mExportFuncNames;
   ExportForeachFuncListTy mExportForeachFuncs;
+  ExportReduceListTy mExportReduces;
+  ExportSymbolListTy mExportSymbols;
+  ExportForeachCostListTy mExportForeachCosts;
+  ExportVarLayoutListTy mExportVarLayout;
+  ObjectSlotRangeListTy mObjectSlotRanges;
+
+  // The number of items reserved in the arena for each list.
+  struct ListCapacities {
+    size_t pragmas;
+    size_t objectSlots;
+    size_t exportVarNames;
+    size_t exportFuncNames;
+    size_t exportForeachFuncs;
+    size_t exportReduces;
+    // At least getNumExportSymbols() and the number of foreach functions are
+    // reserved for these two, so they can always be recorded after the build.
+    size_t exportSymbols;
+    size_t exportForeachCosts;
+    // Likewise, at least exportVarNames and objectSlots.
+    size_t exportVarLayout;
+    size_t objectSlotRanges;
+
+    ListCapacities() : pragmas(0), objectSlots(0), exportVarNames(0),
+                       exportFuncNames(0), exportForeachFuncs(0),
+                       exportReduces(0), exportSymbols(0),
+                       exportForeachCosts(0), exportVarLayout(0),
+                       objectSlotRanges(0) { }
+  };
 
-  // Initialize an empty RSInfo with its size of string pool is pStringPoolSize.
-  RSInfo(size_t pStringPoolSize);
+  // Initialize an empty RSInfo with its size of string pool is pStringPoolSize
+  // and an arena for the lists of pCapacities. mArena is NULL if it's out of
+  // memory.
+  RSInfo(size_t pStringPoolSize, const ListCapacities &pCapacities);
 
   // layout() assigns value of offset in each ListHeader (i.e., it decides where
   // data should go in the file.) It also updates fields other than offset to
-  // reflect the current RSInfo object states to mHeader.
-  bool layout(off_t initial_offset);
+  // reflect the current RSInfo object states to pHeader, which is a copy of
+  // mHeader.
+  bool layout(off_t initial_offset, rsinfo::Header &pHeader) const;
+
+  // ReadFromBuffer() but the dependencies are only checked if pDeps is
+  // non-NULL.
+  static RSInfo *ReadFromBufferImpl(const uint8_t *pData, size_t pSize,
+                                    const char *pName,
+                                    const DependencyTableTy *pDeps,
+                                    ReadStatus *pStatus,
+                                    android::FileMap *pView);
 
 public:
   ~RSInfo();
@@ -222,13 +542,69 @@ public:
   static RSInfo *ExtractFromSource(const Source &pSource,
                                    const DependencyTableTy &pDeps);
 
-  // Implemented in RSInfoReader.cpp.
+  // Implemented in RSInfoReader.cpp. If pStatus is non-NULL, it receives the
+  // reason why NULL is returned (or kReadOK.)
   static RSInfo *ReadFromFile(InputFile &pInput,
-                              const DependencyTableTy &pDeps);
+                              const DependencyTableTy &pDeps,
+                              ReadStatus *pStatus = NULL);
+
+  // Same as ReadFromFile() except that the info is parsed from the pSize bytes
+  // at pData (e.g., a part of a mapped RS cache container.) pName is used in
+  // the diagnostics and for the dependency check.
+  //
+  // If pView is NULL, the result doesn't refer to pData. Otherwise, pView
+  // must be the read-only mapping containing pData: the result is a view which
+  // serves the strings directly from the mapping instead of copying the
+  // string pool, and holds a reference to pView for its lifetime.
+  static RSInfo *ReadFromBuffer(const uint8_t *pData, size_t pSize,
+                                const char *pName,
+                                const DependencyTableTy &pDeps,
+                                ReadStatus *pStatus = NULL,
+                                android::FileMap *pView = NULL);
+
+  // Same as ReadFromBuffer() except that the dependencies are left unchecked
+  // (e.g., to find out what an RS cache container was built from.) The
+  // result doesn't refer to pData.
+  static RSInfo *ReadFromBufferUnchecked(const uint8_t *pData, size_t pSize,
+                                         const char *pName);
+
+  // Read the info RSEmbedInfoPass embeds in the binary encoding (i.e., what
+  // serialize() produces) as the global .rs.info.bin of an object, e.g., a
+  // shared object of the compatibility library at pData. The dependencies are
+  // left unchecked. The result doesn't refer to pData. Implemented in
+  // RSInfoReader.cpp.
+  static RSInfo *ReadEmbedded(const void *pData, const char *pName);
 
   // Implemneted in RSInfoWriter.cpp
   bool write(OutputFile &pOutput);
 
+  // Append what write() writes to pResult: the header, the string pool and
+  // then the lists of the rsinfo::*Item at the offsets in the header. It can
+  // be read in place (see ReadFromBuffer()) once aligned as the header.
+  // Implemented in RSInfoWriter.cpp.
+  bool serialize(std::string &pResult) const;
+
+  // Record the location of every export in the pImageSize bytes of ELF object
+  // at pImage, which is compiled from the script this RSInfo describes (see
+  // getExportSymbols().) Exports not defined in the object are recorded as
+  // unknown. Return false if pImage isn't a valid object. Implemented in
+  // RSInfoWriter.cpp.
+  bool recordExportSymbols(const void *pImage, size_t pImageSize);
+
+  // Record the costs of the foreach functions estimated on pModule by
+  // RSForEachCostPass (see getExportForeachCosts().) Nothing is recorded if
+  // pModule doesn't have them. Implemented in RSInfoExtractor.cpp.
+  void recordExportForeachCosts(const llvm::Module &pModule);
+
+  // Record where RSExportVarBlockPass has put the export vars of pModule in
+  // their block (see getExportVarLayout()) and the runs of object slots it
+  // makes (see getObjectSlotRanges().) Nothing is recorded if pModule
+  // doesn't have the block. Implemented in RSInfoExtractor.cpp.
+  void recordExportVarLayout(const llvm::Module &pModule);
+
+  // Return a deep copy of this RSInfo (never a view) or NULL on error.
+  RSInfo *clone() const;
+
   void dump() const;
 
   // const getter
@@ -248,6 +624,48 @@ public:
   { return mExportFuncNames; }
   inline const ExportForeachFuncListTy &getExportForeachFuncs() const
   { return mExportForeachFuncs; }
+  inline const ExportReduceListTy &getExportReduces() const
+  { return mExportReduces; }
+  // The locations of export vars, export funcs, the entry points of the
+  // foreach functions (all the "<NAME>.expand", then all the
+  // "<NAME>.expand.tiled" and so on in the order of ExportForeachVariant),
+  // the entry points of the reductions (likewise) and then the combiners of
+  // the reductions, in the order of their lists above. Empty if they weren't
+  // recorded at the build.
+  inline const ExportSymbolListTy &getExportSymbols() const
+  { return mExportSymbols; }
+  // The estimated number of instructions and memory operations each foreach
+  // function spends on a cell in its ".expand" loop, in the order of
+  // getExportForeachFuncs(). They are (0, 0) for a function that wasn't
+  // expanded and the list is empty if they weren't estimated at the build
+  // (e.g., at -O0.) The runtime uses them to size the chunks of cells it
+  // hands to the threads.
+  inline const ExportForeachCostListTy &getExportForeachCosts() const
+  { return mExportForeachCosts; }
+  // Where each export var is in the global ExportVarBlockName, in the order
+  // of getExportVarNames(), if the script was compiled with its export vars
+  // in one block (see RSCompilerDriver::setExportVarBlock().) The offset of
+  // a var left out of the block (e.g., a constant one) is
+  // rsinfo::gInvalidExportVarOffset. Empty if there's no block.
+  inline const ExportVarLayoutListTy &getExportVarLayout() const
+  { return mExportVarLayout; }
+  // The object slots in the block of export vars merged into runs of
+  // contiguous bytes, by increasing offset, so that the runtime initializes
+  // and releases the RS object handles of an instance with a memset() and a
+  // loop per run rather than by looking each slot up. The slots left out of
+  // the block aren't covered (their offset in getExportVarLayout() is
+  // rsinfo::gInvalidExportVarOffset.) Empty if there's no block.
+  inline const ObjectSlotRangeListTy &getObjectSlotRanges() const
+  { return mObjectSlotRanges; }
+  // The number of bytes from the beginning of the block to the end of its
+  // last var (0 if there's no block.)
+  size_t getExportVarBlockSize() const;
+  // The size of getExportSymbols() if the locations are recorded.
+  inline size_t getNumExportSymbols() const {
+    return (mExportVarNames.size() + mExportFuncNames.size() +
+            kNumForeachVariants * mExportForeachFuncs.size() +
+            (kNumForeachVariants + 1) * mExportReduces.size());
+  }
 
   const char *getStringFromPool(rsinfo::StringIndexTy pStrIdx) const;
   rsinfo::StringIndexTy getStringIdxInPool(const char *pStr) const;
@@ -266,6 +684,18 @@ public:
   // Return the minimal floating point precision required for the associated
   // script.
   FloatPrecision getFloatPrecisionRequirement() const;
+
+  // Set pKernels to the names of the kernels of a full-precision script
+  // listed in its "#pragma rs_fp_relaxed_kernels(k1, k2, ...)". Those kernels
+  // (along with their expanded functions) compute with relaxed precision
+  // and the accelerated math library nonetheless, while the rest of the
+  // script keeps full precision. pKernels is empty if the script isn't
+  // FP_Full, since all of its functions are relaxed then.
+  void getRelaxedFPKernels(std::set<std::string> &pKernels) const;
+
+  // Return the value of the first pragma with the key pKey (e.g., "foo" for
+  // "#pragma key(foo)") or NULL if the script has no such pragma.
+  const char *getPragmaValue(const char *pKey) const;
 };
 
 } // end namespace bcc
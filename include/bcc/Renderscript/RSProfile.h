@@ -0,0 +1,120 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_PROFILE_H
+#define BCC_RS_PROFILE_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <vector>
+
+#include <utils/String8.h>
+
+#include "bcc/Support/Sha1Util.h"
+
+namespace bcc {
+
+namespace rsprofile {
+
+/* RS profile magic */
+#define RSPROFILE_MAGIC   "\0rsprof\0"
+
+/* RS profile version, encoded in 4 bytes of ASCII */
+#define RSPROFILE_VERSION "001\0"
+
+/* RS profile header. numCounters uint64_t counters follow it. */
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  uint32_t headerSize;
+
+  // SHA-1 of the bitcode the instrumented script was compiled from.
+  uint8_t sourceSHA1[SHA1_DIGEST_LENGTH];
+
+  uint32_t numCounters;
+};
+
+} // end namespace rsprofile
+
+/*
+ * RSProfile is the execution profile of a script compiled with
+ * RSCompilerDriver::setProfileInstrumentation(). For each instrumented
+ * function (the expanded ForEach functions, the kernels and the invokables),
+ * in the order of the module, there's the number of times it was entered
+ * followed by two counters per conditional branch in it: the times it was
+ * taken and the times it fell through (see createRSProfileInstrumentPass().)
+ *
+ * The instrumented script counts into its global .rs.profile.counters without
+ * synchronization (so the counts are approximate when several threads run a
+ * kernel) and RSExecutable::writeProfile() adds them to {res}.prof next to
+ * the cache. The next build of the script without instrumentation reads it
+ * back (see createRSProfileAnnotatePass().)
+ */
+class RSProfile {
+public:
+  // Names of the globals of an instrumented script: the counters, their
+  // number (uint32_t) and the SHA-1 of the bitcode.
+  static const char CountersName[];
+  static const char NumCountersName[];
+  static const char SourceName[];
+
+  // Recorded in the dependency table of an instrumented build in place of
+  // the digest of the profile.
+  static const uint8_t InstrumentedDigest[SHA1_DIGEST_LENGTH];
+
+private:
+  android::String8 mPath;
+
+  // SHA-1 of the whole file.
+  uint8_t mSHA1[SHA1_DIGEST_LENGTH];
+
+  std::vector<uint64_t> mCounters;
+
+  RSProfile() { }
+
+public:
+  // Return the path of the profile of the script whose object would be at
+  // pObjPath (i.e., {pCacheDir}/{pResName}.o becomes
+  // {pCacheDir}/{pResName}.prof.) pObjPath may also name the RS cache
+  // container.
+  static android::String8 GetPath(const char *pObjPath);
+
+  // Read the profile pPath. Return NULL if it doesn't exist, is corrupted or
+  // was collected from another bitcode than the one with pSourceSHA1.
+  static RSProfile *Read(const char *pPath, const uint8_t *pSourceSHA1);
+
+  // Add the pNumCounters counters at pCounters to the profile pPath (or
+  // start it if it doesn't exist or doesn't match them), replacing the file
+  // atomically. Return false on error. A concurrent update by another
+  // process may be lost.
+  static bool Accumulate(const char *pPath, const uint8_t *pSourceSHA1,
+                         const uint64_t *pCounters, size_t pNumCounters);
+
+  inline const char *getPath() const
+  { return mPath.string(); }
+
+  inline const uint8_t *getSHA1() const
+  { return mSHA1; }
+
+  inline const std::vector<uint64_t> &getCounters() const
+  { return mCounters; }
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_PROFILE_H
@@ -17,6 +17,11 @@
 #ifndef BCC_RS_SCRIPT_H
 #define BCC_RS_SCRIPT_H
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "bcc/Script.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Support/Sha1Util.h"
@@ -27,6 +32,7 @@ namespace llvm {
 
 namespace bcc {
 
+class RSProfile;
 class RSScript;
 class Source;
 
@@ -42,6 +48,10 @@ public:
     kOptLvl3  // -O3
   };
 
+  // Name of an export variable => its value, as the bytes of its type in
+  // the memory layout of the target.
+  typedef std::map<std::string, std::string> ExportConstantMapTy;
+
 private:
   const RSInfo *mInfo;
 
@@ -53,6 +63,46 @@ private:
 
   bool mEmbedInfo;
 
+  // Embed the info in the binary encoding rather than as text.
+  bool mEmbedBinaryInfo;
+
+  // SHA-1 of the bitcode if the script is to be instrumented for an
+  // RSProfile. NULL otherwise.
+  const uint8_t *mProfileSourceSHA1;
+
+  // The profile to optimize the script with (not owned.) NULL if none.
+  const RSProfile *mProfile;
+
+  // The names of the exports the runtime uses (not owned.) NULL if all.
+  const std::set<std::string> *mUsedExports;
+
+  // The values of the export variables to fold (not owned.) NULL if none.
+  const ExportConstantMapTy *mExportConstants;
+
+  // Expected size of the object of the script in bytes (0 if unknown.)
+  size_t mObjectSizeHint;
+
+  // The digest of the bitcode to record in the cache (see
+  // RSCacheContainer::ReadSourceDigest().) mSourceSHA1 is NULL if none.
+  uint64_t mSourceFingerprint;
+  const uint8_t *mSourceSHA1;
+
+  // The prefixes of the scripts of a bundle (not owned.) NULL if the script
+  // isn't one.
+  const std::vector<std::string> *mBundlePrefixes;
+
+  // Gather the export vars into one block (see setExportVarBlock().)
+  bool mExportVarBlock;
+
+  // Reach the external symbols through one table (see
+  // setReducedRelocations().)
+  bool mReducedRelocations;
+
+  // Count the calls of the kernels, and time them if mKernelCycleCounters
+  // (see setKernelCounters().)
+  bool mKernelCounters;
+  bool mKernelCycleCounters;
+
 private:
   // This will be invoked when the containing source has been reset.
   virtual bool doReset();
@@ -102,6 +152,135 @@ public:
   bool getEmbedInfo() const {
     return mEmbedInfo;
   }
+
+  void setEmbedBinaryInfo(bool pEnable) {
+    mEmbedBinaryInfo = pEnable;
+  }
+
+  bool getEmbedBinaryInfo() const {
+    return mEmbedBinaryInfo;
+  }
+
+  // Instrument the script to collect an RSProfile of the bitcode with
+  // pSourceSHA1 (which must outlive the compilation), or don't if it's NULL.
+  void setProfileSourceSHA1(const uint8_t *pSourceSHA1) {
+    mProfileSourceSHA1 = pSourceSHA1;
+  }
+
+  const uint8_t *getProfileSourceSHA1() const {
+    return mProfileSourceSHA1;
+  }
+
+  // Optimize the script with pProfile (which must outlive the compilation.)
+  // Ignored if the script is instrumented.
+  void setProfile(const RSProfile *pProfile) {
+    mProfile = pProfile;
+  }
+
+  const RSProfile *getProfile() const {
+    return mProfile;
+  }
+
+  // Only keep the exports (variables, invokables, kernels and reductions)
+  // named in pUsedExports (which must outlive the compilation) visible. The
+  // others are internalized and stripped if nothing else refers to them.
+  // NULL keeps them all.
+  void setUsedExports(const std::set<std::string> *pUsedExports) {
+    mUsedExports = pUsedExports;
+  }
+
+  const std::set<std::string> *getUsedExports() const {
+    return mUsedExports;
+  }
+
+  // Specialize the script on the values in pConstants (which must outlive
+  // the compilation) of some of its export variables: the code reads them as
+  // constants, so it's only valid while the variables keep these values.
+  // NULL specializes nothing.
+  void setExportConstants(const ExportConstantMapTy *pConstants) {
+    mExportConstants = pConstants;
+  }
+
+  const ExportConstantMapTy *getExportConstants() const {
+    return mExportConstants;
+  }
+
+  // The object is compiled into a buffer of pSize bytes to start with, so
+  // that it's not reallocated as the code generator appends to it.
+  void setObjectSizeHint(size_t pSize) {
+    mObjectSizeHint = pSize;
+  }
+
+  size_t getObjectSizeHint() const {
+    return mObjectSizeHint;
+  }
+
+  // pSourceSHA1 (not owned) is the SHA-1 of the bitcode and pFingerprint its
+  // Sha1Util::GetFingerprintFromBuffer().
+  void setSourceDigest(uint64_t pFingerprint, const uint8_t *pSourceSHA1) {
+    mSourceFingerprint = pFingerprint;
+    mSourceSHA1 = pSourceSHA1;
+  }
+
+  uint64_t getSourceFingerprint() const {
+    return mSourceFingerprint;
+  }
+
+  const uint8_t *getSourceSHA1() const {
+    return mSourceSHA1;
+  }
+
+  // The script is a bundle of the scripts whose global symbols are prefixed
+  // with pPrefixes (which must outlive the compilation.) The special
+  // functions of each are kept under the prefixed names.
+  void setBundlePrefixes(const std::vector<std::string> *pPrefixes) {
+    mBundlePrefixes = pPrefixes;
+  }
+
+  const std::vector<std::string> *getBundlePrefixes() const {
+    return mBundlePrefixes;
+  }
+
+  // Lay the export vars out in one block, whose layout is recorded in the
+  // RSInfo (see RSInfo::getExportVarLayout().) Ignored for a bundle.
+  void setExportVarBlock(bool pEnable) {
+    mExportVarBlock = pEnable;
+  }
+
+  bool getExportVarBlock() const {
+    return mExportVarBlock;
+  }
+
+  // Have the code reach the external symbols through one table of their
+  // addresses, so that the loader relocates one word per symbol rather than
+  // each reference (see createRSExternalTablePass().)
+  void setReducedRelocations(bool pEnable) {
+    mReducedRelocations = pEnable;
+  }
+
+  bool getReducedRelocations() const {
+    return mReducedRelocations;
+  }
+
+  // Have the expanded functions of the kernels count their calls and cells,
+  // and time them if pCycles (see createRSKernelCountersPass().) Ignored for
+  // a bundle.
+  void setKernelCounters(bool pEnable, bool pCycles) {
+    mKernelCounters = pEnable;
+    mKernelCycleCounters = pEnable && pCycles;
+  }
+
+  bool getKernelCounters() const {
+    return mKernelCounters;
+  }
+
+  bool getKernelCycleCounters() const {
+    return mKernelCycleCounters;
+  }
+
+  bool isExportUsed(const char *pName) const {
+    return ((mUsedExports == NULL) || mUsedExports->count(pName));
+  }
 };
 
 } // end namespace bcc
@@ -17,7 +17,14 @@
 #ifndef BCC_RS_TRANSFORMS_H
 #define BCC_RS_TRANSFORMS_H
 
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
 #include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Renderscript/RSScript.h"
 
 namespace llvm {
   class ModulePass;
@@ -25,11 +32,89 @@ namespace llvm {
 
 namespace bcc {
 
+// The accumulators of pReduces are expanded as well. If pPreciseFP is true,
+// the loops of the expanded functions (but those of pRelaxedKernels, if
+// non-NULL) are marked not to be vectorized. If pNoAliasInOut is true, the
+// accesses to the input and the output of the kernels are annotated as not
+// aliasing each other. If pPrefetchDistance is not 0, the loops prefetch their
+// input that many bytes ahead. If pStreamBlockSize is not 0, the kernels get a
+// streaming entry point staging their cells through scratch buffers of that
+// many bytes.
 llvm::ModulePass *
 createRSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                          bool pEnableStepOpt);
+                          const RSInfo::ExportReduceListTy &pReduces,
+                          bool pEnableStepOpt, unsigned pVectorWidth = 0,
+                          bool pPreciseFP = false, bool pNoAliasInOut = false,
+                          unsigned pPrefetchDistance = 0,
+                          unsigned pStreamBlockSize = 0,
+                          const std::set<std::string> *pRelaxedKernels = NULL);
+
+// Embed info in the global .rs.info as text or, if pBinary is true, in the
+// global .rs.info.bin as serialized by RSInfo::serialize() (see
+// RSInfo::ReadEmbedded().)
+llvm::ModulePass * createRSEmbedInfoPass(const RSInfo *info,
+                                         bool pBinary = false);
+
+// Scalarize the vector floating point operations of the functions but the
+// kernels pRelaxedKernels, their expanded functions and those of the
+// accelerated math library linked for them (see RSScript::LinkRuntime()), so
+// that a full-precision script compiled for NEON computes with VFP elsewhere.
+llvm::ModulePass *
+createRSPreciseFPPass(const std::set<std::string> &pRelaxedKernels);
+
+// Count the entries and the branches of the exported functions and kernels
+// of pInfo (and their expanded functions) for an RSProfile of the bitcode with
+// pSourceSHA1.
+llvm::ModulePass *
+createRSProfileInstrumentPass(const RSInfo &pInfo,
+                              const uint8_t *pSourceSHA1);
+
+// Annotate the same functions with the counters pCounters of an RSProfile
+// collected by the pass above. Nothing is annotated if the counters don't
+// match the module.
+llvm::ModulePass *
+createRSProfileAnnotatePass(const RSInfo &pInfo,
+                            const std::vector<uint64_t> &pCounters);
+
+// Fold the export variables of pConstants into the code of the script (see
+// RSScript::setExportConstants().)
+llvm::ModulePass *
+createRSSpecializeExportsPass(const RSScript::ExportConstantMapTy &pConstants);
+
+// Hint the inliner to inline the allocation accessors (rsGetElementAt*(),
+// rsSetElementAt*(), ...) linked from the runtime library into the expanded
+// functions of pForeachFuncs and pReduces.
+llvm::ModulePass *
+createRSInlineAccessorsPass(const RSInfo::ExportForeachFuncListTy
+                                &pForeachFuncs,
+                            const RSInfo::ExportReduceListTy &pReduces);
+
+// Estimate the cost per cell of the expanded foreach functions for
+// RSInfo::recordExportForeachCosts().
+llvm::ModulePass *
+createRSForEachCostPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs);
 
-llvm::ModulePass * createRSEmbedInfoPass(const RSInfo *info);
+// Gather the export vars in pVarNames (but those not in pUsedExports, if
+// non-NULL) into the single global RSInfo::ExportVarBlockName for
+// RSInfo::recordExportVarLayout(), the object slots pObjectSlots next to
+// each other.
+llvm::ModulePass *
+createRSExportVarBlockPass(const RSInfo::ExportVarNameListTy &pVarNames,
+                           const RSInfo::ObjectSlotListTy &pObjectSlots,
+                           const std::set<std::string> *pUsedExports);
+
+// Count the calls, the cells and (if pCycles) the time of the expanded
+// functions of the kernels into RSInfo::KernelCountersName.
+llvm::ModulePass *
+createRSKernelCountersPass(const RSInfo::ExportForeachFuncListTy
+                               &pForeachFuncs,
+                           const RSInfo::ExportReduceListTy &pReduces,
+                           bool pCycles);
+
+// Route the references of the code to the external symbols through one table
+// of their addresses, so that the loader relocates one word per symbol.
+llvm::ModulePass *
+createRSExternalTablePass();
 
 } // end namespace bcc
 
@@ -17,6 +17,8 @@
 #ifndef BCC_SCRIPT_H
 #define BCC_SCRIPT_H
 
+#include "bcc/Support/CancellationToken.h"
+
 namespace bcc {
 
 class Source;
@@ -27,13 +29,16 @@ private:
   // compiled.
   Source *mSource;
 
+  // Not owned. NULL if the compilation of this script can't be cancelled.
+  const CancellationToken *mCancelToken;
+
 protected:
   // This hook will be invoked after the script object is successfully reset.
   virtual bool doReset()
   { return true; }
 
 public:
-  Script(Source &pSource) : mSource(&pSource) { }
+  Script(Source &pSource) : mSource(&pSource), mCancelToken(NULL) { }
 
   virtual ~Script() { }
 
@@ -54,6 +59,14 @@ public:
   { return *mSource; }
   inline const Source &getSource() const
   { return *mSource; }
+
+  // The token must outlive the compilations of this script.
+  inline void setCancellationToken(const CancellationToken *pToken)
+  { mCancelToken = pToken; }
+  inline const CancellationToken *getCancellationToken() const
+  { return mCancelToken; }
+  inline bool isCancelled() const
+  { return ((mCancelToken != NULL) && mCancelToken->isCancelled()); }
 };
 
 } // end namespace bcc
@@ -59,6 +59,16 @@ public:
   // will be destroyed after successfully merged. Return false on error.
   bool merge(Source &pSource, bool pPreserveSource = false);
 
+  // Link only the definitions in pLibrary that this source references, either
+  // directly or through other definitions in pLibrary. pLibrary is preserved,
+  // although the bodies of the functions needed are materialized in it. Return
+  // false on error.
+  //
+  // If pSuffix is non-NULL, only the references to "<name><pSuffix>" are
+  // resolved, with the definition of <name> in pLibrary renamed so. This links
+  // a variant of a library for some of the callers only.
+  bool mergeReferenced(Source &pLibrary, const char *pSuffix = NULL);
+
   inline BCCContext &getContext()
   { return mContext; }
   inline const BCCContext &getContext() const
@@ -66,6 +76,12 @@ public:
 
   void setModule(llvm::Module *pModule);
 
+  // Replace the module with an empty one of the same identifier, freeing
+  // everything the module holds (unless it's not owned by this source.) Used
+  // once the module has been compiled and only the Source object itself is
+  // still referenced. Return false on error, in which case the module is kept.
+  bool releaseModule();
+
   inline llvm::Module &getModule()
   { return *mModule;  }
   inline const llvm::Module &getModule() const
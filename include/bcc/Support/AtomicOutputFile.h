@@ -0,0 +1,71 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
+#define BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
+
+#include <string>
+
+#include "bcc/Support/OutputFile.h"
+
+namespace bcc {
+
+// AtomicOutputFile writes to a temporary file next to pFilename and replaces
+// pFilename with it in commit() using rename(). Readers thus see either the
+// previous or the new contents in full, without any file locks. The temporary
+// file is removed if the object is destroyed before commit() succeeds.
+class AtomicOutputFile : public OutputFile {
+public:
+  // How much of a commit() is flushed to the storage.
+  enum SyncMode {
+    // Nothing. The new file may be lost (or be empty) after a power loss.
+    kNoSync,
+    // The contents (fdatasync()), but not the directory entry.
+    kSyncData,
+    // The contents and the directory entry (fsync() of both.)
+    kSyncAll
+  };
+
+private:
+  std::string mFinalName;
+  bool mCommitted;
+
+  static std::string GetTemporaryName(const std::string &pFilename);
+
+public:
+  // pFlags are passed to OutputFile. The temporary file is always truncated.
+  AtomicOutputFile(const std::string &pFilename, unsigned pFlags = 0);
+
+  ~AtomicOutputFile();
+
+  // Name of the file to be replaced. getName() returns the temporary one.
+  inline const std::string &getFinalName() const
+  { return mFinalName; }
+
+  // Close the file and move it to getFinalName(), flushing it to the storage
+  // as pSync says. Return false on error, in which case the file at
+  // getFinalName() is untouched.
+  bool commit(SyncMode pSync);
+
+  // Same as above. If pDurable is true, the new file survives a power loss
+  // (kSyncAll.)
+  bool commit(bool pDurable = false)
+  { return commit(pDurable ? kSyncAll : kNoSync); }
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
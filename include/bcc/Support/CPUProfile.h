@@ -0,0 +1,97 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_CPU_PROFILE_H
+#define BCC_SUPPORT_CPU_PROFILE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace bcc {
+
+/*
+ * CPUProfile tells how to tune the code for the CPU this process runs on. It
+ * comes from a small database in CPUProfile.cpp keyed by the detected CPU,
+ * which picks the scheduling model for the CPUs LLVM doesn't know (or only
+ * knows under another name) and the features llvm::sys::getHostCPUFeatures()
+ * doesn't report.
+ *
+ * The objects compiled with a profile are only valid on the CPUs having it,
+ * so the profile is part of RSInfo::GetBuiltInDigest().
+ *
+ * The detection parses /proc/cpuinfo (more than once on ARM), which every
+ * process using the compiler would pay for at its start. With a snapshot
+ * (see SetSnapshotPath()), what the first process detects is persisted and
+ * the next ones read it back instead, as long as they run the same build of
+ * libbcc on the same kernel.
+ */
+struct CPUProfile {
+  // The optional features of the CPUs a script may be compiled for in
+  // several versions (see RSCompilerDriver::setMultiversioning().)
+  enum Feature {
+    kFeatureNEON  = 1 << 0,
+    kFeatureSSSE3 = 1 << 1,
+    kFeatureSSE41 = 1 << 2,
+    kFeatureAVX   = 1 << 3
+  };
+
+  // The detected CPU, e.g., "cortex-a9" or "corei7-avx". A device with cores
+  // of several kinds (e.g., big.LITTLE) gets their names sorted and joined
+  // with '+' (e.g., "cortex-a15+cortex-a7".) "generic" if nothing could be
+  // detected.
+  std::string mName;
+
+  // The CPU given to LLVM (i.e., -mcpu), which selects the scheduling model.
+  // Empty to keep the default of the target.
+  std::string mCPU;
+
+  // Features to add to the ones the CompilerConfig selects (e.g., "+ssse3".)
+  std::vector<std::string> mFeatures;
+
+  // Prefetch distance in bytes (see CompilerConfig::setPrefetchDistance()),
+  // or 0 to keep the one of the CompilerConfig.
+  unsigned mPrefetchDistance;
+
+  CPUProfile() : mName("generic"), mPrefetchDistance(0) { }
+
+  // Describe the profile in a single line, e.g., "cortex-a15+cortex-a7
+  // (cpu: cortex-a9, features: +vfp4)".
+  std::string getDescription() const;
+
+  // Return the profile of the host, detected on the first call. Setting the
+  // property debug.rs.no-cpu-profile to 1 yields the generic profile instead.
+  static const CPUProfile &GetHost();
+
+  // Return the Features of the host, detected on the first call. Unlike
+  // GetHost(), this is what the CPU can run and the property doesn't apply.
+  static uint32_t GetHostFeatures();
+
+  // Return true if llvm::sys::getHostCPUFeatures() reports the LLVM subtarget
+  // feature pName (e.g., "neon") as present on the host.
+  static bool HasHostLLVMFeature(const char *pName);
+
+  // Read the detection from the snapshot at pPath (or write it there if it's
+  // missing or stale) rather than probing the host. It must be set before
+  // any of the above is called, or else it's ignored. NULL disables it,
+  // which is the default.
+  static void SetSnapshotPath(const char *pPath);
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_CPU_PROFILE_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_CRC32C_H
+#define BCC_SUPPORT_CRC32C_H
+
+#include <stdint.h>
+
+#include <cstddef>
+
+namespace bcc {
+
+/*
+ * CRC32C (the Castagnoli polynomial, as iSCSI and ext4 use it) catches the
+ * torn and bit-flipped files a SHA-1 would, at a fraction of its cost: on the
+ * CPUs with a CRC32C instruction (SSE4.2 on x86, the CRC extension of ARMv8)
+ * it runs at several bytes per cycle, and a table-driven loop takes over
+ * elsewhere. It's no defense against a forged file.
+ */
+class CRC32C {
+private:
+  CRC32C(); // DISABLED.
+
+public:
+  // Return the CRC32C of the pSize bytes at pData following the bytes whose
+  // CRC32C is pCRC (0 to start), i.e., that of their concatenation.
+  static uint32_t Compute(const void *pData, size_t pSize, uint32_t pCRC = 0);
+
+  // Return true if Compute() uses the instructions of the host. Detected on
+  // the first call.
+  static bool HasHardwareSupport();
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_CRC32C_H
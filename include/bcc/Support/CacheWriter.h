@@ -0,0 +1,128 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_CACHE_WRITER_H
+#define BCC_SUPPORT_CACHE_WRITER_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/StrongPointer.h>
+#include <utils/Thread.h>
+
+#include "bcc/Support/AtomicOutputFile.h"
+
+namespace bcc {
+
+/*
+ * CacheWriter replaces the files of the cache directory (see
+ * AtomicOutputFile) with contents prepared in memory, each with a single
+ * write(). Once setAsynchronous(true) is called, the writes are queued to a
+ * writer thread instead, which takes the flash writes and the syncs off the
+ * compile thread. A write queued for a file that already has one pending
+ * replaces it, so the repeated updates of a file are coalesced into one.
+ *
+ * The readers of a file written through CacheWriter call wait() before
+ * opening it. The pending writes are lost if the process exits before the
+ * writer thread gets to them (see flush()); the cache is rebuilt next time.
+ */
+class CacheWriter {
+public:
+  // Compute the new contents of a file (pResult) from its current contents
+  // (pCurrent, of pCurrentSize bytes) and the data the update was queued with.
+  // Return false if the file can't be updated (it's then left untouched.)
+  typedef bool (*UpdateFunction)(const std::string &pPath,
+                                 const void *pCurrent, size_t pCurrentSize,
+                                 const std::string &pData,
+                                 std::string &pResult);
+
+private:
+  struct Job {
+    // The new contents of the file, or the data of mUpdate.
+    std::string mData;
+    // NULL for a write of mData.
+    UpdateFunction mUpdate;
+    AtomicOutputFile::SyncMode mSync;
+  };
+
+  class WriterThread;
+
+  android::Mutex mLock;
+  android::Condition mChanged;
+
+  bool mAsynchronous;
+  android::sp<WriterThread> mThread;
+
+  // The paths of the pending jobs in the order they're written.
+  std::list<std::string> mOrder;
+  std::map<std::string, Job> mPending;
+
+  // The path of the job being written by the writer thread (empty if none.)
+  std::string mWriting;
+
+  CacheWriter();
+
+  // Run pJob on pPath in the calling thread.
+  static bool Run(const std::string &pPath, const Job &pJob);
+
+  // Queue pJob on pPath. Return false if it has to be run in place instead.
+  bool enqueue(const std::string &pPath, Job &pJob);
+
+  // Write the next pending job. Return false once the writer thread should
+  // stop.
+  bool writeNext();
+
+  bool isBusyLocked(const std::string &pPath) const;
+
+public:
+  // The process-wide writer. It's never destroyed.
+  static CacheWriter &GetInstance();
+
+  // Queue the writes to the writer thread from now on (or stop queueing them
+  // and wait for the queue to drain.)
+  void setAsynchronous(bool pAsynchronous);
+
+  bool isAsynchronous();
+
+  // Replace pPath with pContents as pSync says. pContents is taken (and left
+  // empty.) Return false on error. The errors of a queued write are only
+  // logged.
+  bool write(const std::string &pPath, std::string &pContents,
+             AtomicOutputFile::SyncMode pSync);
+
+  // Replace pPath with the result of pUpdate(current contents, pData). A
+  // pending update of pPath with the same pUpdate is replaced: pData is
+  // expected to carry everything the update changes. pData is taken.
+  bool update(const std::string &pPath, UpdateFunction pUpdate,
+              std::string &pData, AtomicOutputFile::SyncMode pSync);
+
+  // Wait for the pending write of pPath (if any) to complete.
+  void wait(const std::string &pPath);
+
+  // Return true if a write of pPath is queued or in progress.
+  bool isPending(const std::string &pPath);
+
+  // Wait for all the pending writes to complete.
+  void flush();
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_CACHE_WRITER_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_CANCELLATION_TOKEN_H
+#define BCC_SUPPORT_CANCELLATION_TOKEN_H
+
+#include <llvm/Support/Atomic.h>
+
+namespace bcc {
+
+/*
+ * A flag another thread raises to have a compilation give up. The compiler
+ * polls it between its phases (see Compiler::compile()), so the compilation
+ * stops at the next boundary rather than at once. A token can't be reset:
+ * use a new one for the next compilation.
+ */
+class CancellationToken {
+private:
+  volatile llvm::sys::cas_flag mCancelled;
+
+  CancellationToken(const CancellationToken &); // DISABLED.
+  void operator=(const CancellationToken &); // DISABLED.
+
+public:
+  CancellationToken() : mCancelled(0) { }
+
+  inline void cancel()
+  { llvm::sys::CompareAndSwap(&mCancelled, 1, 0); }
+
+  inline bool isCancelled() const
+  { return (mCancelled != 0); }
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_CANCELLATION_TOKEN_H
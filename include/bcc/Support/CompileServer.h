@@ -0,0 +1,61 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_COMPILE_SERVER_H
+#define BCC_SUPPORT_COMPILE_SERVER_H
+
+namespace bcc {
+
+/*
+ * CompileServer lets a command-line tool keep its start-up work warm across
+ * invocations. The tool does the work once (init::Initialize(), loading the
+ * runtime libraries into the global BCCContext, ...) and then Serve()s a
+ * local socket. Each invocation of the tool Forward()s its command line, its
+ * working directory and its standard streams to the server, which forks a
+ * child that runs the main function of the tool on them and reports its exit
+ * status back.
+ *
+ * The fork gives each request the warm state copy-on-write while keeping the
+ * requests isolated from each other: the global options of llvm::cl are
+ * parsed afresh by each child and nothing a compile leaves behind reaches the
+ * next one.
+ */
+class CompileServer {
+private:
+  CompileServer(); // DISABLED.
+
+public:
+  typedef int (*MainFunction)(int pArgc, char **pArgv);
+
+  // The environment variable which names the socket of the server the tools
+  // forward their invocations to.
+  static const char SocketEnvironmentVariable[];
+
+  // Listen on the Unix domain socket pSocketPath (replacing any stale one) and
+  // run pMain on behalf of each client until the process is killed. Return
+  // only on error.
+  static bool Serve(const char *pSocketPath, MainFunction pMain);
+
+  // Have the server at pSocketPath run the command line pArgv in the current
+  // directory with the standard streams of this process. Return its exit
+  // status, or -1 if the server can't be reached (run the command locally
+  // then.)
+  static int Forward(const char *pSocketPath, int pArgc, char **pArgv);
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_COMPILE_SERVER_H
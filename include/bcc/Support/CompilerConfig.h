@@ -33,6 +33,50 @@ class Target;
 namespace bcc {
 
 class CompilerConfig {
+public:
+  // Pipelines of link-time optimizations Compiler::runLTO() can run on a
+  // script at the optimization levels other than -O0.
+  enum LTOProfile {
+    // A few cheap inter-procedural passes and a conservative inliner.
+    kLTOFastCompile,
+    // LLVM's standard LTO pipeline.
+    kLTOBalanced,
+    // Aggressive inlining (e.g., of the kernels into their ForEach loops)
+    // followed by the standard pipeline, loop vectorization and SLP
+    // vectorization.
+    kLTOMaxThroughput
+  };
+
+  // Return the name of pProfile ("fast-compile", "balanced" or
+  // "max-throughput".)
+  static const char *GetLTOProfileName(LTOProfile pProfile);
+
+  // Set pResult to the profile of the given name. Return false if pName is
+  // unknown.
+  static bool ParseLTOProfile(const char *pName, LTOProfile &pResult);
+
+  // How the code generator trades the size of the code for the time it takes
+  // to emit it and for its speed.
+  enum EmissionProfile {
+    // Relax all the instructions (e.g., every branch takes its long form) so
+    // that the assembler does a single pass.
+    kEmitFast,
+    // Leave the branches short when they reach, merge the globals and prefer
+    // Thumb-2 on ARM.
+    kEmitCompact,
+    // Leave the branches short when they reach and keep the target's
+    // default instruction set.
+    kEmitFastCode
+  };
+
+  // Return the name of pProfile ("fast-emit", "compact" or "fast-code".)
+  static const char *GetEmissionProfileName(EmissionProfile pProfile);
+
+  // Set pResult to the profile of the given name. Return false if pName is
+  // unknown.
+  static bool ParseEmissionProfile(const char *pName,
+                                   EmissionProfile &pResult);
+
 private:
   //===--------------------------------------------------------------------===//
   // Available Configurations
@@ -50,6 +94,23 @@ private:
 
   llvm::Reloc::Model mRelocModel;
 
+  LTOProfile mLTOProfile;
+
+  EmissionProfile mEmissionProfile;
+
+  // How far (in bytes) ahead of the current cell the expanded ForEach loops
+  // prefetch their input. 0 disables the prefetching.
+  unsigned mPrefetchDistance;
+
+  // Size (in bytes) of the blocks of cells the streaming ForEach entry points
+  // copy in and out of their scratch buffers. 0 disables them.
+  unsigned mStreamBlockSize;
+
+  // Whether the code generation merges the static globals (so that they're
+  // addressed from one base.) The ARM backend's own -global-merge is turned
+  // off, and Compiler adds the pass for the configs which enable it.
+  bool mEnableGlobalMerge;
+
   // The list of target specific features to enable or disable -- this should
   // be a list of strings starting with '+' (enable) or '-' (disable).
   std::string mFeatureString;
@@ -64,6 +125,10 @@ private:
   llvm::Triple::ArchType mArchType;
   void initializeArch();
 
+protected:
+  // Switch to the target of pTriple (e.g., from ARM to Thumb.)
+  void setTriple(const std::string &pTriple);
+
 public:
   //===--------------------------------------------------------------------===//
   // Getters
@@ -96,6 +161,32 @@ public:
   inline void setRelocationModel(llvm::Reloc::Model pRelocModel)
   { mRelocModel = pRelocModel; }
 
+  inline LTOProfile getLTOProfile() const
+  { return mLTOProfile; }
+  inline void setLTOProfile(LTOProfile pProfile)
+  { mLTOProfile = pProfile; }
+
+  inline EmissionProfile getEmissionProfile() const
+  { return mEmissionProfile; }
+  // Return true if config has been changed after returning from this function.
+  // The targets may adjust more than the relaxation (see kEmitCompact.)
+  virtual bool setEmissionProfile(EmissionProfile pProfile);
+
+  inline unsigned getPrefetchDistance() const
+  { return mPrefetchDistance; }
+  inline void setPrefetchDistance(unsigned pDistance)
+  { mPrefetchDistance = pDistance; }
+
+  inline unsigned getStreamBlockSize() const
+  { return mStreamBlockSize; }
+  inline void setStreamBlockSize(unsigned pSize)
+  { mStreamBlockSize = pSize; }
+
+  inline bool getEnableGlobalMerge() const
+  { return mEnableGlobalMerge; }
+  inline void setEnableGlobalMerge(bool pEnable)
+  { mEnableGlobalMerge = pEnable; }
+
   inline const llvm::Target *getTarget() const
   { return mTarget; }
 
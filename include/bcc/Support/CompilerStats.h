@@ -0,0 +1,70 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_COMPILER_STATS_H
+#define BCC_SUPPORT_COMPILER_STATS_H
+
+#include <stdint.h>
+
+#include <cstddef>
+
+namespace llvm {
+
+class raw_ostream;
+
+} // end namespace llvm
+
+namespace bcc {
+
+/*
+ * CompilerStats describes one Compiler::compile() (see
+ * Compiler::setStatsCallback().)
+ */
+struct CompilerStats {
+  // Wall time in seconds of the LTO passes (0 if LTO is disabled) and of
+  // the code generation passes. The passes are timed as a whole: timing them
+  // one by one would change how the pass managers schedule them.
+  double mLTOTime;
+  double mCodeGenTime;
+
+  // Defined functions and their instructions in the module before and after
+  // LTO. They're the same if LTO is disabled.
+  size_t mFunctionsBeforeLTO;
+  size_t mInstructionsBeforeLTO;
+  size_t mFunctionsAfterLTO;
+  size_t mInstructionsAfterLTO;
+
+  // Bytes of object emitted by the code generation.
+  uint64_t mObjectSize;
+
+  CompilerStats()
+    : mLTOTime(0), mCodeGenTime(0), mFunctionsBeforeLTO(0),
+      mInstructionsBeforeLTO(0), mFunctionsAfterLTO(0),
+      mInstructionsAfterLTO(0), mObjectSize(0) { }
+
+  // Print the stats in the fashion of llvm -time-passes.
+  void print(llvm::raw_ostream &pOut) const;
+};
+
+// Invoked at the end of each compilation of a compiler it's installed on.
+// pName is the identifier of the module compiled.
+typedef void (*CompilerStatsCallback)(const char *pName,
+                                      const CompilerStats &pStats,
+                                      void *pUserData);
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_COMPILER_STATS_H
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <map>
+
 namespace llvm {
   class raw_ostream;
 } // end namespace llvm
@@ -47,6 +49,21 @@ DisassembleResult Disassemble(OutputFile &pOutput, const char *pTriple,
                               const char *pFuncName, const uint8_t *pFunc,
                               size_t pFuncSize);
 
+// The number of profiler samples at each byte offset in a function.
+typedef std::map<uint64_t, uint64_t> DisassemblySamplesTy;
+
+// Same as Disassemble() but annotated for studying the loops of a kernel: the
+// instructions are printed by their offset in the function, and those of its
+// innermost loops (the ranges closed by a backward branch) are marked with
+// the number of their loop. Each loop is then summarized: its instructions,
+// its loads and stores, and how many instructions operate on vector
+// registers (of 128 bits or more) rather than scalar ones. If pSamples is
+// non-NULL, the samples of each instruction and each loop are shown as well.
+DisassembleResult DisassembleLoops(llvm::raw_ostream &pOutput,
+                                   const char *pTriple, const char *pFuncName,
+                                   const uint8_t *pFunc, size_t pFuncSize,
+                                   const DisassemblySamplesTy *pSamples = NULL);
+
 } // end namespace bcc
 
 #endif // BCC_SUPPORT_DISASSEMBLER_H
@@ -61,8 +61,10 @@ public:
 
   inline android::FileMap *createMap(off_t pOffset, size_t pLength,
                                      bool pIsReadOnly =
-                                        (OpenMode == FileBase::kReadMode)) {
-    return FileBase::createMap(pOffset, pLength, pIsReadOnly);
+                                        (OpenMode == FileBase::kReadMode),
+                                     enum AccessPatternEnum pPattern =
+                                        FileBase::kAccessNormal) {
+    return FileBase::createMap(pOffset, pLength, pIsReadOnly, pPattern);
   }
 };
 
@@ -55,12 +55,34 @@ public:
     kWriteLock
   };
 
+  // The hints at how a file is going to be read (see advise().)
+  enum AccessPatternEnum {
+    // No particular pattern: the default read-ahead of the kernel.
+    kAccessNormal,
+
+    // Read once from the beginning to the end: read ahead more aggressively.
+    kAccessSequential,
+
+    // Scattered reads: don't read ahead.
+    kAccessRandom,
+
+    // Going to be read soon: start reading it in the background now.
+    kAccessWillNeed
+  };
+
   // Default configuration to the lock().
   enum {
     kDefaultMaxRetryLock = 4,
     kDefaultRetryLockInterval = 200000UL,
   };
 
+  // The first and the longest waits (in usecs) between the attempts of
+  // lockWithTimeout().
+  enum {
+    kInitialLockBackoff = 1000UL,
+    kMaxLockBackoff = 64000UL,
+  };
+
 protected:
   // Grant direct access of the internal file descriptor to the sub-class and
   // error message such that they can implement their own I/O functionality.
@@ -119,13 +141,37 @@ public:
             unsigned pMaxRetry = kDefaultMaxRetryLock,
             useconds_t pRetryInterval = kDefaultRetryLockInterval);
 
+  // Same as lock() in the non-blocking mode except that it retries for up
+  // to pTimeoutMs milliseconds, with waits which start at kInitialLockBackoff
+  // and double up to kMaxLockBackoff. This bounds the wait for a holder
+  // that's about to release the lock without polling hard or giving up too
+  // early. If pContended is non-NULL, it's set to whether the first attempt
+  // found the lock held. Return false if the lock wasn't acquired in time
+  // or on error.
+  bool lockWithTimeout(enum LockModeEnum pMode, unsigned pTimeoutMs,
+                       bool *pContended = NULL);
+
   void unlock();
 
-  // Map the file content to the memory.
+  // Map the file content to the memory. The mapping is advised of pPattern
+  // unless it's kAccessNormal.
   //
   // One who gets non-null android::FileMap returned from this API is responsible
   // for destroying it after the use.
-  android::FileMap *createMap(off_t pOffset, size_t pLength, bool pIsReadOnly);
+  android::FileMap *createMap(off_t pOffset, size_t pLength, bool pIsReadOnly,
+                              enum AccessPatternEnum pPattern = kAccessNormal);
+
+  // Hint the kernel at the reads of pLength bytes of the file at pOffset (up
+  // to the end of the file if pLength is 0.) The hints are best-effort:
+  // return false if the system doesn't take them, without setting an error.
+  bool advise(enum AccessPatternEnum pPattern, off_t pOffset = 0,
+              off_t pLength = 0);
+
+  // Start reading the file pPath into the page cache in the background, so
+  // that its open and map a moment later don't block on the storage. Return
+  // false if it can't be opened (e.g., it doesn't exist) or if the system
+  // doesn't take the hint.
+  static bool Prefetch(const char *pPath);
 
   size_t getSize();
 
@@ -26,8 +26,11 @@ namespace bcc {
 template<enum FileBase::LockModeEnum LockMode>
 class FileMutex : public FileBase {
 public:
-  FileMutex(const std::string &pFileToLock)
-    : FileBase(pFileToLock + ".lock", O_RDONLY | O_CREAT, kDeleteOnClose) { }
+  // The lock file is removed when the mutex is destroyed unless pFlags says
+  // otherwise, e.g., 0 for a holder that removes it itself while it still
+  // holds the lock (so that it never removes the file of another holder.)
+  FileMutex(const std::string &pFileToLock, unsigned pFlags = kDeleteOnClose)
+    : FileBase(pFileToLock + ".lock", O_RDONLY | O_CREAT, pFlags) { }
 
   // Provide a lock() interface filled with default configuration.
   inline bool lock(bool pNonblocking = true,
@@ -36,6 +39,10 @@ public:
                        FileBase::kDefaultRetryLockInterval) {
     return FileBase::lock(LockMode, pNonblocking, pMaxRetry, pRetryInterval);
   }
+
+  inline bool lockWithTimeout(unsigned pTimeoutMs, bool *pContended = NULL) {
+    return FileBase::lockWithTimeout(LockMode, pTimeoutMs, pContended);
+  }
 };
 
 } // namespace bcc
@@ -21,6 +21,17 @@ namespace bcc {
 
 namespace init {
 
+// Route the fatal errors of LLVM to the log. It touches no target.
+void InitializeErrorHandler();
+
+// Register the backend of DEFAULT_TARGET_TRIPLE_STRING (see Config.h) with
+// the LLVM target registry. It's all a compile for the device needs and it's
+// done by the first CompilerConfig, so the loads from the cache never pay for
+// it.
+void InitializeDefaultTarget();
+
+// Register all the backends of PROVIDE_*_CODEGEN, for the tools which take
+// any target.
 void Initialize();
 
 } // end namespace init
@@ -28,6 +28,11 @@ public:
   InputFile(const std::string &pFilename, unsigned pFlags = 0);
 
   ssize_t read(void *pBuf, size_t count);
+
+  // Map the whole (non-empty) file pFilename read-only. The mapping stays
+  // valid after the file is closed. Return NULL on error. The caller releases
+  // the returned map.
+  static android::FileMap *MapFile(const std::string &pFilename);
 };
 
 } // end namespace bcc
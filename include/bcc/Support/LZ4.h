@@ -0,0 +1,50 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_LZ4_H
+#define BCC_SUPPORT_LZ4_H
+
+#include <cstddef>
+#include <string>
+
+namespace bcc {
+
+/*
+ * A codec of the LZ4 block format (the raw blocks of LZ4_compress() and
+ * LZ4_decompress_safe(), without the frame.) The compressor is the greedy
+ * single-probe one: it favors the speed of the decompression, which is a
+ * plain copy loop, over the ratio.
+ */
+class LZ4 {
+private:
+  LZ4(); // DISABLED.
+
+public:
+  // Set pResult to the pSrcSize bytes at pSrc compressed as a single block.
+  static void Compress(const void *pSrc, size_t pSrcSize,
+                       std::string &pResult);
+
+  // Decompress the block of pSrcSize bytes at pSrc into the pDstSize bytes at
+  // pDst. Return false unless the block is well-formed and decompresses to
+  // exactly pDstSize bytes. Nothing is read or written out of the buffers on
+  // a corrupted block.
+  static bool Decompress(const void *pSrc, size_t pSrcSize,
+                         void *pDst, size_t pDstSize);
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_LZ4_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_PHASE_TIMER_H
+#define BCC_SUPPORT_PHASE_TIMER_H
+
+#include "bcc/Support/Trace.h"
+
+namespace llvm {
+
+class raw_ostream;
+
+} // end namespace llvm
+
+namespace bcc {
+
+// The phases of building and loading a script that are measured.
+enum CompilePhase {
+  kPhaseBitcodeParse,
+  kPhaseExtractInfo,
+  kPhaseLinkRuntime,
+  kPhaseLTO,
+  kPhaseCodeGen,
+  kPhaseWriteInfo,
+  kPhaseCacheLoad,
+  kPhaseRelocation,
+  kPhaseLinkSharedObject,
+
+  kNumCompilePhases
+};
+
+struct PhaseStats {
+  // In seconds. The CPU time is the user and system time of the process.
+  double mWallTime;
+  double mCPUTime;
+
+  // Growth of the peak resident set size of the process in KiB. 0 if the peak
+  // was not raised during the phase or isn't available on the host.
+  long mPeakRSSDelta;
+
+  // The peak resident set size of the process in KiB at the end of the phase
+  // (or the highest of them in the accumulated stats.) 0 if it isn't
+  // available on the host.
+  long mPeakRSS;
+};
+
+// Invoked at the end of each measured phase. pName describes the script being
+// processed and may be NULL if it's unknown at that point. The callback may be
+// invoked from any thread that builds or loads scripts.
+typedef void (*PhaseCallback)(CompilePhase pPhase, const char *pName,
+                              const PhaseStats &pStats, void *pUserData);
+
+/*
+ * PhaseTimer measures the scope it lives in as one occurrence of the given
+ * phase. Nothing is measured unless a callback is installed or accumulation
+ * is enabled (see below.) The scope is also a TraceSection named after the
+ * phase and pName.
+ */
+class PhaseTimer {
+private:
+  TraceSection mTrace;
+
+  CompilePhase mPhase;
+  const char *mName;
+  bool mActive;
+
+  double mStartWallTime;
+  double mStartCPUTime;
+  long mStartPeakRSS;
+
+  PhaseTimer(const PhaseTimer &); // DISABLED.
+  void operator=(const PhaseTimer &); // DISABLED.
+
+public:
+  PhaseTimer(CompilePhase pPhase, const char *pName = NULL);
+  ~PhaseTimer();
+
+  static const char *GetPhaseName(CompilePhase pPhase);
+
+  // Install (or remove with NULL) the process-wide callback.
+  static void SetCallback(PhaseCallback pCallback, void *pUserData);
+
+  // Enable summing up the stats of each phase for PrintReport().
+  static void EnableAccumulation(bool pEnable = true);
+
+  // Print the accumulated stats of each phase in the fashion of
+  // llvm -time-passes and reset them.
+  static void PrintReport(llvm::raw_ostream &pOut);
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_PHASE_TIMER_H
@@ -35,6 +35,41 @@ private:
   Sha1Util(Sha1Util &); // DISABLED.
 
 public:
+  // Incremental SHA-1 computation. Use this to hash several discontiguous
+  // buffers (e.g., a header followed by a payload) without concatenating
+  // them first.
+  //
+  //   Sha1Util::Context ctx;
+  //   ctx.update(pHeader, pHeaderSize);
+  //   ctx.update(pPayload, pPayloadSize);
+  //   ctx.finalize(digest);
+  //
+  // The context is reset after finalize() and can be reused.
+  class Context {
+  private:
+    // Opaque storage for SHA1_CTX, or for the context of the SHA-1
+    // instructions if HasHardwareSupport(). The system sha1.h is deliberately
+    // not included here (see the SHA1_DIGEST_LENGTH guard above.) Their sizes
+    // are checked in Sha1Util.cpp.
+    uint32_t mStorage[24];
+
+    Context(const Context &); // DISABLED.
+    void operator=(const Context &); // DISABLED.
+
+  public:
+    Context() { reset(); }
+
+    void reset();
+
+    void update(const uint8_t *pData, size_t pSize);
+
+    void update(const char *pData, size_t pSize) {
+      update(reinterpret_cast<const uint8_t*>(pData), pSize);
+    }
+
+    void finalize(uint8_t pResult[SHA1_DIGEST_LENGTH]);
+  };
+
   // Return true on success.
   static bool GetSHA1DigestFromFile(uint8_t pResult[SHA1_DIGEST_LENGTH],
                                     const char *pFilename);
@@ -50,6 +85,22 @@ public:
                                    reinterpret_cast<const uint8_t*>(pData),
                                    pSize);
   }
+
+  // Return a 64-bit fingerprint of the pSize bytes at pData (pSize included.)
+  // It's several times cheaper than the SHA-1 but not collision-resistant:
+  // use it to recognize a buffer whose SHA-1 was computed before, never in
+  // place of the digest.
+  static uint64_t GetFingerprintFromBuffer(const uint8_t *pData, size_t pSize);
+
+  static uint64_t GetFingerprintFromBuffer(const char *pData, size_t pSize) {
+    return GetFingerprintFromBuffer(reinterpret_cast<const uint8_t*>(pData),
+                                    pSize);
+  }
+
+  // Return true if the SHA-1 is computed with the instructions of the host
+  // (the SHA extensions on x86, the SHA-1 instructions of ARMv8) rather than
+  // by the C library. Detected on the first call.
+  static bool HasHardwareSupport();
 };
 
 } // end namespace bcc
@@ -17,6 +17,8 @@
 #ifndef BCC_SUPPORT_TARGET_COMPILER_CONFIGS_H
 #define BCC_SUPPORT_TARGET_COMPILER_CONFIGS_H
 
+#include <stdint.h>
+
 #include "bcc/Config/Config.h"
 #include "bcc/Support/CompilerConfig.h"
 
@@ -30,11 +32,17 @@ class ARMBaseCompilerConfig : public CompilerConfig {
 private:
   bool mEnableNEON;
   bool mInThumbMode;
+  // The mode of the triple the config was created with.
+  bool mDefaultThumbMode;
 
   static bool HasThumb2();
 
+  // Append the features for the given mode to pAttributes. They're built
+  // once per process by BuildFeatureVector().
   static void GetFeatureVector(std::vector<std::string> &pAttributes,
                                bool pInThumbMode, bool pEnableNEON);
+  static void BuildFeatureVector(std::vector<std::string> &pAttributes,
+                                 bool pInThumbMode, bool pEnableNEON);
 
 protected:
   ARMBaseCompilerConfig(const std::string &pTriple, bool pInThumbMode);
@@ -43,6 +51,11 @@ public:
   // Return true if config has been changed after returning from this function.
   bool enableNEON(bool pEnable = true);
 
+  // kEmitCompact switches the config to Thumb-2 where it's available. The
+  // other profiles get the mode the config was created with back. There's
+  // one mode per TargetMachine (hence per script) in this version of LLVM.
+  virtual bool setEmissionProfile(EmissionProfile pProfile);
+
   bool isInThumbMode() const
   { return mInThumbMode; }
 };
@@ -80,13 +93,8 @@ public:
 #if defined(PROVIDE_X86_CODEGEN)
 class X86FamilyCompilerConfigBase : public CompilerConfig {
 protected:
-  X86FamilyCompilerConfigBase(const std::string &pTriple)
-    : CompilerConfig(pTriple) {
-    // Disable frame pointer elimination optimization on x86 family.
-    getTargetOptions().NoFramePointerElim = true;
-    getTargetOptions().UseInitArray = true;
-    return;
-  }
+  // Tuned for the host if it's an x86 (see CPUProfile.)
+  X86FamilyCompilerConfigBase(const std::string &pTriple);
 };
 
 class X86_32CompilerConfig : public X86FamilyCompilerConfigBase {
@@ -121,6 +129,17 @@ class DefaultCompilerConfig : public
 #endif
 { };
 
+//===----------------------------------------------------------------------===//
+// Multiversioning (see RSCompilerDriver::setMultiversioning())
+//===----------------------------------------------------------------------===//
+// Return the CPUProfile::Features the code compiled with pConfig requires.
+uint32_t GetRequiredCPUFeatures(const CompilerConfig &pConfig);
+
+// Return a copy of pConfig (sliced to a CompilerConfig) whose code requires
+// no more CPUProfile::Features than pFeatures, or NULL if out of memory.
+CompilerConfig *CreateFallbackConfig(const CompilerConfig &pConfig,
+                                     uint32_t pFeatures);
+
 } // end namespace bcc
 
 #endif // BCC_SUPPORT_TARGET_COMPILER_CONFIGS_H
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_TRACE_H
+#define BCC_SUPPORT_TRACE_H
+
+namespace bcc {
+
+/*
+ * TraceSection emits a section named "bcc:<pSection> <pName>" to the system
+ * trace (atrace, in the "rs" category) for the scope it lives in, so that the
+ * work of bcc shows up by script on the thread that does it in systrace and
+ * perfetto. Nothing is formatted or written unless the category is being
+ * traced. It's a no-op on the host.
+ */
+class TraceSection {
+private:
+  bool mActive;
+
+  TraceSection(const TraceSection &); // DISABLED.
+  void operator=(const TraceSection &); // DISABLED.
+
+public:
+  // pName (e.g., the resource name of the script) may be NULL.
+  TraceSection(const char *pSection, const char *pName = NULL);
+  ~TraceSection();
+
+  // Whether the sections are being recorded.
+  static bool IsEnabled();
+
+  // Emit an empty section, e.g., to tag the enclosing one with the outcome of
+  // its work.
+  static void Mark(const char *pSection, const char *pName = NULL);
+};
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_TRACE_H
@@ -17,7 +17,15 @@
 #ifndef __ANDROID_BCINFO_BITCODETRANSLATOR_H__
 #define __ANDROID_BCINFO_BITCODETRANSLATOR_H__
 
+#include "bcinfo/BitcodeWrapper.h"
+
 #include <cstddef>
+#include <string>
+
+namespace llvm {
+  class LLVMContext;
+  class Module;
+}
 
 namespace bcinfo {
 
@@ -25,9 +33,14 @@ class BitcodeTranslator {
  private:
   const char *mBitcode;
   size_t mBitcodeSize;
+  BitcodeWrapper mWrapper;
   const char *mTranslatedBitcode;
   size_t mTranslatedBitcodeSize;
+  // The buffer mTranslatedBitcode points into if the bitcode was actually
+  // translated (or read back from the cache), NULL otherwise.
+  std::string *mTranslatedBuffer;
   unsigned int mVersion;
+  const char *mCacheDir;
 
  public:
   /**
@@ -40,8 +53,30 @@ class BitcodeTranslator {
   BitcodeTranslator(const char *bitcode, size_t bitcodeSize,
                     unsigned int version);
 
+  /**
+   * Translates the bitcode of the already parsed \p wrapper of a particular
+   * \p version to the latest version.
+   *
+   * \param wrapper - wrapper view of the input bitcode.
+   * \param version - corresponding target SDK version of the bitcode.
+   */
+  BitcodeTranslator(const BitcodeWrapper &wrapper, unsigned int version);
+
   ~BitcodeTranslator();
 
+  /**
+   * Keep the translations of legacy bitcode in \p cacheDir, so translating
+   * the same bitcode again only reads the result back. The entries are keyed
+   * by the SHA-1 of the input bitcode (including its wrapper) and the target
+   * API version.
+   *
+   * \param cacheDir - an existing writable directory or NULL to disable the
+   *                   cache (the default). It must outlive translate().
+   */
+  void setCacheDir(const char *cacheDir) {
+    mCacheDir = cacheDir;
+  }
+
   /**
    * Translate the supplied bitcode to the latest supported version.
    *
@@ -50,6 +85,30 @@ class BitcodeTranslator {
    */
   bool translate();
 
+  /**
+   * \return whether or not the supplied bitcode is in a legacy format that
+   * must be translated before the current bitcode reader can read it.
+   */
+  bool needsTranslation() const;
+
+  /**
+   * Parse the supplied legacy bitcode with the reader of its version into an
+   * upgraded module of \p context. Unlike translate(), the module isn't
+   * written back to bitcode, so it can be compiled without being serialized
+   * and parsed again. Only use translate() when the translated bytes are
+   * needed.
+   *
+   * The module is lazily loaded: the legacy reader stays its materializer and
+   * decodes and upgrades each function body when it's materialized, so the
+   * supplied bitcode must stay valid for as long as the module is in use.
+   *
+   * \param context - context to create the module in.
+   *
+   * \return the module (owned by the caller) or NULL if an error occurred or
+   *         the bitcode doesn't need a translation (see needsTranslation()).
+   */
+  llvm::Module *translateToModule(llvm::LLVMContext &context);
+
   /**
    * \return translated bitcode.
    */
@@ -20,6 +20,7 @@
 #include "bcinfo/Wrap/BCHeaderField.h"
 
 #include <cstddef>
+#include <cstring>
 #include <stdint.h>
 
 namespace bcinfo {
@@ -40,22 +41,40 @@ struct AndroidBitcodeWrapper {
   uint32_t OptimizationLevel;
 };
 
+/* The optional variable field carrying the SHA-1 of the raw bitcode. It
+ * immediately follows AndroidBitcodeWrapper (see
+ * writeAndroidBitcodeSourceSHA1().) */
+struct AndroidBitcodeSourceSHA1 {
+  uint16_t SourceSHA1Tag;
+  uint16_t SourceSHA1Len;
+  uint8_t SourceSHA1[20];
+};
+
 enum BCFileType {
   BC_NOT_BC = 0,
   BC_WRAPPER = 1,
   BC_RAW = 2
 };
 
+/**
+ * A view of the wrapper of a bitcode buffer. The header is decoded in place
+ * once, when the view is constructed, and the view can then be passed along
+ * (and copied) with the buffer instead of parsing the header again. Nothing
+ * is copied out of the buffer, which must outlive the view.
+ */
 class BitcodeWrapper {
  private:
   enum BCFileType mFileType;
   const char *mBitcode;
   size_t mBitcodeSize;
+  const char *mRawBitcode;
+  size_t mRawBitcodeSize;
 
   uint32_t mHeaderVersion;
   uint32_t mTargetAPI;
   uint32_t mCompilerVersion;
   uint32_t mOptimizationLevel;
+  const uint8_t *mSourceSHA1;
 
  public:
   /**
@@ -75,6 +94,35 @@ class BitcodeWrapper {
    */
   bool unwrap();
 
+  /**
+   * \return the (wrapped) bitcode this view was constructed with.
+   */
+  const char *getBitcode() const {
+    return mBitcode;
+  }
+
+  /**
+   * \return the size of the (wrapped) bitcode in bytes.
+   */
+  size_t getBitcodeSize() const {
+    return mBitcodeSize;
+  }
+
+  /**
+   * \return the raw bitcode within the buffer (i.e., past the wrapper) or
+   *         NULL if this isn't bitcode.
+   */
+  const char *getRawBitcode() const {
+    return mRawBitcode;
+  }
+
+  /**
+   * \return the size of the raw bitcode in bytes.
+   */
+  size_t getRawBitcodeSize() const {
+    return mRawBitcodeSize;
+  }
+
   /**
    * \return type of bitcode file.
    */
@@ -110,6 +158,24 @@ class BitcodeWrapper {
     return mOptimizationLevel;
   }
 
+  /**
+   * \return the 20-byte SHA-1 of the raw bitcode recorded in the wrapper
+   *         when it was written (see writeAndroidBitcodeSourceSHA1()) or
+   *         NULL if there's none. It's not verified.
+   */
+  const uint8_t *getSourceSHA1() const {
+    return mSourceSHA1;
+  }
+
+  /**
+   * \return the size of the wrapper header (fixed and variable fields) in
+   *         bytes, 0 if this isn't wrapped bitcode.
+   */
+  size_t getWrapperSize() const {
+    return ((mFileType == BC_WRAPPER) && (mRawBitcode != NULL)) ?
+        static_cast<size_t>(mRawBitcode - mBitcode) : 0;
+  }
+
 };
 
 /**
@@ -148,6 +214,33 @@ static inline size_t writeAndroidBitcodeWrapper(AndroidBitcodeWrapper *wrapper,
   return sizeof(*wrapper);
 }
 
+/**
+ * Helper function to emit the SHA-1 of the raw bitcode right after the
+ * wrapper written by writeAndroidBitcodeWrapper(), returning the number of
+ * bytes that were written. The bitcode then follows \p field instead of
+ * \p wrapper.
+ *
+ * \param wrapper - the wrapper to record the field into.
+ * \param field - where to write the field (immediately after \p wrapper.)
+ * \param sha1 - the 20-byte SHA-1 of the raw bitcode.
+ *
+ * \return number of field bytes written into the \p field.
+ */
+static inline size_t writeAndroidBitcodeSourceSHA1(
+    AndroidBitcodeWrapper *wrapper, AndroidBitcodeSourceSHA1 *field,
+    const uint8_t *sha1) {
+  if (!wrapper || !field || !sha1) {
+    return 0;
+  }
+
+  field->SourceSHA1Tag = BCHeaderField::kAndroidSourceSHA1;
+  field->SourceSHA1Len = sizeof(field->SourceSHA1);
+  memcpy(field->SourceSHA1, sha1, sizeof(field->SourceSHA1));
+  wrapper->BitcodeOffset += sizeof(*field);
+
+  return sizeof(*field);
+}
+
 }  // namespace bcinfo
 
 #endif  // __ANDROID_BCINFO_BITCODEWRAPPER_H__
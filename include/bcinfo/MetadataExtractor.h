@@ -20,6 +20,9 @@
 #include <cstddef>
 #include <stdint.h>
 
+#include <string>
+#include <vector>
+
 namespace llvm {
   class Module;
   class NamedMDNode;
@@ -39,6 +42,16 @@ class MetadataExtractor {
   const char *mBitcode;
   size_t mBitcodeSize;
 
+  // All the names and pragma keys/values as NUL-terminated strings, starting
+  // with an empty string at offset 0 (used for the missing ones.) The lists
+  // below refer to it by offset and the const char ** lists point into it.
+  std::string mStringTable;
+  std::vector<uint32_t> mExportVarNameOffsets;
+  std::vector<uint32_t> mExportFuncNameOffsets;
+  std::vector<uint32_t> mExportForEachNameOffsets;
+  std::vector<uint32_t> mPragmaKeyOffsets;
+  std::vector<uint32_t> mPragmaValueOffsets;
+
   size_t mExportVarCount;
   size_t mExportFuncCount;
   size_t mExportForEachSignatureCount;
@@ -60,6 +73,7 @@ class MetadataExtractor {
   enum RSFloatPrecision mRSFloatPrecision;
 
   // Helper functions for extraction
+  void buildNameLists();
   bool populateVarNameMetadata(const llvm::NamedMDNode *VarNameMetadata);
   bool populateFuncNameMetadata(const llvm::NamedMDNode *FuncNameMetadata);
   bool populateForEachMetadata(const llvm::NamedMDNode *Names,
@@ -92,6 +106,69 @@ class MetadataExtractor {
    */
   bool extract();
 
+  /**
+   * \return the string table holding all the names and pragma keys/values
+   * (see the get*Offsets() accessors) as NUL-terminated strings. It's valid
+   * for the lifetime of this extractor.
+   */
+  const char *getStringTable() const {
+    return mStringTable.data();
+  }
+
+  /**
+   * \return size of the string table (in bytes).
+   */
+  size_t getStringTableSize() const {
+    return mStringTable.size();
+  }
+
+  /**
+   * \return the string at \p offset in the string table.
+   */
+  const char *getString(uint32_t offset) const {
+    return mStringTable.data() + offset;
+  }
+
+  /**
+   * \return offsets in the string table of the exported variable names, or
+   * NULL if there are none. These and the other get*Offsets() accessors
+   * don't need a pointer array per list and point at an empty string for the
+   * entries the const char ** lists have as NULL.
+   */
+  const uint32_t *getExportVarNameOffsets() const {
+    return mExportVarNameOffsets.empty() ? NULL : &mExportVarNameOffsets[0];
+  }
+
+  /**
+   * \return offsets in the string table of the exported function names.
+   */
+  const uint32_t *getExportFuncNameOffsets() const {
+    return mExportFuncNameOffsets.empty() ? NULL : &mExportFuncNameOffsets[0];
+  }
+
+  /**
+   * \return offsets in the string table of the exported ForEach function
+   * names.
+   */
+  const uint32_t *getExportForEachNameOffsets() const {
+    return mExportForEachNameOffsets.empty() ? NULL :
+                                               &mExportForEachNameOffsets[0];
+  }
+
+  /**
+   * \return offsets in the string table of the pragma keys.
+   */
+  const uint32_t *getPragmaKeyOffsets() const {
+    return mPragmaKeyOffsets.empty() ? NULL : &mPragmaKeyOffsets[0];
+  }
+
+  /**
+   * \return offsets in the string table of the pragma values.
+   */
+  const uint32_t *getPragmaValueOffsets() const {
+    return mPragmaValueOffsets.empty() ? NULL : &mPragmaValueOffsets[0];
+  }
+
   /**
    * \return number of exported global variables (slots) in this script/module.
    */
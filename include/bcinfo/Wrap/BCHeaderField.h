@@ -34,7 +34,9 @@ class BCHeaderField {
     kInvalid = 0,
     kBitcodeHash = 1,
     kAndroidCompilerVersion = 0x4001,
-    kAndroidOptimizationLevel = 0x4002
+    kAndroidOptimizationLevel = 0x4002,
+    // SHA-1 (20 bytes) of the raw bitcode, computed when it was wrapped.
+    kAndroidSourceSHA1 = 0x4003
   } Tag;
   typedef uint16_t FixedSubfield;
 
@@ -64,6 +64,11 @@ class BitcodeWrapperer {
   // for freeing the data pointed to by the BCHeaderField.
   void AddHeaderField(BCHeaderField* field);
 
+  // Record the 20-byte SHA-1 of the raw bitcode in the header (a
+  // kAndroidSourceSHA1 field), replacing the one already there if any. The
+  // SHA-1 is copied.
+  void SetAndroidSourceSHA1(const uint8_t* sha1);
+
   // Generate a wrapped bitcode file from the input bitcode file
   // and the current header data. Return true on success.
   bool GenerateWrappedBitcodeFile();
@@ -91,6 +96,12 @@ class BitcodeWrapperer {
     return android_optimization_level_;
   }
 
+  // Returns the 20-byte SHA-1 of the raw bitcode recorded in the header, or
+  // NULL if there's none.
+  const uint8_t* getAndroidSourceSHA1() {
+    return android_source_sha1_;
+  }
+
   ~BitcodeWrapperer();
 
  private:
@@ -150,7 +161,8 @@ class BitcodeWrapperer {
   // generated.
   bool WriteBitcodeWrapperHeader();
 
-  // Copies size bytes of infile to outfile, using the buffer.
+  // Copies size bytes of infile to outfile, using the buffer (or in a single
+  // write if infile is in memory.)
   bool BufferCopyInToOut(uint32_t size);
 
   // Discards the old infile and replaces it with the given file.
@@ -192,6 +204,9 @@ class BitcodeWrapperer {
   // The 32-bit value defining the offset of the raw bitcode in the input file.
   uint32_t infile_bc_offset_;
 
+  // The position of infile after the last successful Seek.
+  size_t infile_pos_;
+
   // The 32-bit value defining the generated offset of the wrapped bitcode.
   // This value changes as new fields are added with AddHeaderField
   uint32_t wrapper_bc_offset_;
@@ -205,6 +220,10 @@ class BitcodeWrapperer {
   uint32_t android_compiler_version_;
   uint32_t android_optimization_level_;
 
+  // Data of the kAndroidSourceSHA1 field (owned by variable_field_data_), or
+  // NULL if there's none.
+  uint8_t* android_source_sha1_;
+
   // PNaCl bitcode version
   uint32_t pnacl_bc_version_;
 
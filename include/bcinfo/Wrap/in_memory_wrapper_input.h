@@ -40,6 +40,8 @@ class InMemoryWrapperInput : public WrapperInput {
   // Moves to the given offset within the buffer. Returns
   // false if unable to move to that position.
   virtual bool Seek(uint32_t pos);
+  // Returns the buffer.
+  virtual const uint8_t* Data();
  private:
   // The actual in-memory buffer
   const char* _buffer;
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Defines utility allowing memory-mapped files for bitcode input wrapping.
+
+#ifndef MAPPED_FILE_WRAPPER_INPUT_H__
+#define MAPPED_FILE_WRAPPER_INPUT_H__
+
+#include <stdio.h>
+
+#include "bcinfo/Wrap/support_macros.h"
+#include "bcinfo/Wrap/wrapper_input.h"
+
+// Define a class to wrap named files through a read-only mapping of the
+// whole file. Unlike FileWrapperInput, the contents are available in place
+// (see Data()), so they don't have to be read into an intermediate buffer.
+class MappedFileWrapperInput : public WrapperInput {
+ public:
+  MappedFileWrapperInput(const char* name);
+  ~MappedFileWrapperInput();
+  // Tries to read the requested number of bytes into the buffer. Returns the
+  // actual number of bytes read.
+  virtual size_t Read(uint8_t* buffer, size_t wanted);
+  // Returns true if at end of file. Note: May return false
+  // until Read is called, and returns 0.
+  virtual bool AtEof();
+  // Returns the size of the file (in bytes).
+  virtual off_t Size();
+  // Moves to the given offset within the file. Returns
+  // false if unable to move to that position.
+  virtual bool Seek(uint32_t pos);
+  // Returns the mapped contents of the file.
+  virtual const uint8_t* Data();
+ private:
+  // The name of the file.
+  const char* _name;
+  // The mapped contents of the file (NULL if the file is empty).
+  const uint8_t* _data;
+  // The position in the file.
+  size_t _pos;
+  // The size of the file.
+  size_t _size;
+ private:
+  DISALLOW_CLASS_COPY_AND_ASSIGN(MappedFileWrapperInput);
+};
+
+#endif // MAPPED_FILE_WRAPPER_INPUT_H__
@@ -42,6 +42,9 @@ class WrapperInput {
   // Moves to the given offset within the input region. Returns false
   // if unable to move to that position.
   virtual bool Seek(uint32_t pos) = 0;
+  // Returns the whole input if it's available in memory (so that it can be
+  // used in place instead of being read), NULL otherwise.
+  virtual const uint8_t* Data() { return NULL; }
  private:
   DISALLOW_CLASS_COPY_AND_ASSIGN(WrapperInput);
 };
@@ -16,7 +16,11 @@
 
 #include "bcc/BCCContext.h"
 
+#include <cstring>
 #include <new>
+#include <vector>
+
+#include <llvm/ADT/STLExtras.h>
 
 #include "bcc/Source.h"
 #include "bcc/Support/Log.h"
@@ -56,11 +60,109 @@ BCCContext::~BCCContext() {
 void BCCContext::addSource(Source &pSource)
 { mImpl->mOwnSources.insert(&pSource); }
 
-void BCCContext::removeSource(Source &pSource)
-{ mImpl->mOwnSources.erase(&pSource); }
+void BCCContext::removeSource(Source &pSource) {
+  mImpl->mOwnSources.erase(&pSource);
+
+  for (llvm::StringMap<Source *>::iterator lib_iter = mImpl->mLibraries.begin(),
+          lib_end = mImpl->mLibraries.end(); lib_iter != lib_end; lib_iter++) {
+    if (lib_iter->getValue() == &pSource) {
+      mImpl->mLibraries.erase(lib_iter);
+      break;
+    }
+  }
+}
+
+Source *BCCContext::getOrLoadLibrary(const std::string &pPath) {
+  llvm::StringMap<Source *>::iterator lib_iter = mImpl->mLibraries.find(pPath);
+  if (lib_iter != mImpl->mLibraries.end()) {
+    return lib_iter->getValue();
+  }
+
+  // The library is lazily loaded. Functions are only materialized when
+  // they're linked into some script for the first time.
+  Source *library = Source::CreateFromFile(*this, pPath);
+  if (library == NULL) {
+    return NULL;
+  }
+
+  mImpl->mLibraries[pPath] = library;
+  return library;
+}
+
+void BCCContext::setRecyclePolicy(unsigned pMaxCompiles,
+                                  size_t pMaxBitcodeSize) {
+  mImpl->mMaxCompiles = pMaxCompiles;
+  mImpl->mMaxBitcodeSize = pMaxBitcodeSize;
+}
+
+void BCCContext::recordCompile(size_t pBitcodeSize) {
+  mImpl->mNumCompiles++;
+  mImpl->mCompiledBitcodeSize += pBitcodeSize;
+
+  // Nothing of the compile outlives it in the arena.
+  mImpl->mCompileArena.Reset();
+
+  if (((mImpl->mMaxCompiles > 0) &&
+       (mImpl->mNumCompiles >= mImpl->mMaxCompiles)) ||
+      ((mImpl->mMaxBitcodeSize > 0) &&
+       (mImpl->mCompiledBitcodeSize >= mImpl->mMaxBitcodeSize))) {
+    if (!recycle()) {
+      ALOGV("LLVM context still in use. Recycle it later.");
+    }
+  }
+}
+
+llvm::BumpPtrAllocator &BCCContext::getCompileArena()
+{ return mImpl->mCompileArena; }
+
+const char *BCCContext::copyToCompileArena(const char *pString,
+                                           size_t pSize) {
+  char *copy = mImpl->mCompileArena.Allocate<char>(pSize + 1);
+  ::memcpy(copy, pString, pSize);
+  copy[pSize] = '\0';
+  return copy;
+}
+
+unsigned BCCContext::getNumCompiles() const
+{ return mImpl->mNumCompiles; }
+
+size_t BCCContext::getCompiledBitcodeSize() const
+{ return mImpl->mCompiledBitcodeSize; }
+
+bool BCCContext::recycle() {
+  // Only the libraries may be left.
+  if (mImpl->mOwnSources.size() != mImpl->mLibraries.size()) {
+    return false;
+  }
+
+  ALOGV("Recycle the LLVM context after %u compilations (%zu bytes of "
+        "bitcode)", mImpl->mNumCompiles, mImpl->mCompiledBitcodeSize);
+
+  // The destruction of a Source calls removeSource(), which updates
+  // mLibraries.
+  std::vector<Source *> libraries;
+  for (llvm::StringMap<Source *>::iterator lib_iter = mImpl->mLibraries.begin(),
+          lib_end = mImpl->mLibraries.end(); lib_iter != lib_end; lib_iter++) {
+    libraries.push_back(lib_iter->getValue());
+  }
+  llvm::DeleteContainerPointers(libraries);
+
+  llvm::LLVMContext *context = new (std::nothrow) llvm::LLVMContext();
+  if (context == NULL) {
+    ALOGE("Out of memory when recycling the LLVM context!");
+    return false;
+  }
+  delete mImpl->mLLVMContext;
+  mImpl->mLLVMContext = context;
+
+  mImpl->mNumCompiles = 0;
+  mImpl->mCompiledBitcodeSize = 0;
+  mImpl->mCompileArena.Reset();
+  return true;
+}
 
 llvm::LLVMContext &BCCContext::getLLVMContext()
-{ return mImpl->mLLVMContext; }
+{ return *mImpl->mLLVMContext; }
 
 const llvm::LLVMContext &BCCContext::getLLVMContext() const
-{ return mImpl->mLLVMContext; }
+{ return *mImpl->mLLVMContext; }
@@ -30,4 +30,6 @@ BCCContextImpl::~BCCContextImpl() {
   // removeSource() and change the content of OwnSources.
   std::vector<Source *> Sources(mOwnSources.begin(), mOwnSources.end());
   llvm::DeleteContainerPointers(Sources);
+
+  delete mLLVMContext;
 }
@@ -18,7 +18,9 @@
 #define BCC_CORE_CONTEXT_IMPL_H
 
 #include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Allocator.h>
 
 namespace bcc {
 
@@ -30,13 +32,32 @@ class Source;
  */
 class BCCContextImpl {
 public:
-  llvm::LLVMContext mLLVMContext;
+  // Replaced when the context is recycled (see BCCContext::recycle().)
+  llvm::LLVMContext *mLLVMContext;
 
   // The set of sources that initialized in this context. They will be destroyed
   // automatically when this context is gone.
   llvm::SmallPtrSet<Source *, 2> mOwnSources;
 
-  BCCContextImpl(BCCContext &pContext) { }
+  // The bitcode libraries (e.g., libclcore.bc) loaded by getOrLoadLibrary()
+  // keyed by their path. They're also in mOwnSources.
+  llvm::StringMap<Source *> mLibraries;
+
+  // Recycle policy (0 for no limit.)
+  unsigned mMaxCompiles;
+  size_t mMaxBitcodeSize;
+
+  // Compilations since mLLVMContext was created.
+  unsigned mNumCompiles;
+  size_t mCompiledBitcodeSize;
+
+  // Freed wholesale at the end of each compilation (see
+  // BCCContext::getCompileArena().)
+  llvm::BumpPtrAllocator mCompileArena;
+
+  BCCContextImpl(BCCContext &pContext)
+    : mLLVMContext(new llvm::LLVMContext()), mMaxCompiles(0),
+      mMaxBitcodeSize(0), mNumCompiles(0), mCompiledBitcodeSize(0) { }
   ~BCCContextImpl();
 };
 
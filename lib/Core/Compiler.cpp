@@ -21,21 +21,91 @@
 #include <llvm/IR/Module.h>
 #include <llvm/PassManager.h>
 #include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TimeValue.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
 
 #include "bcc/Script.h"
 #include "bcc/Source.h"
 #include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/OutputFile.h"
+#include "bcc/Support/PhaseTimer.h"
 
 using namespace bcc;
 
+namespace {
+
+// Inline threshold of CompilerConfig::kLTOFastCompile. Only the small
+// functions are inlined.
+const int FastCompileInlineThreshold = 75;
+
+// Inline threshold of CompilerConfig::kLTOMaxThroughput. Large enough for the
+// typical kernel and its helpers to be inlined into the ForEach loop.
+const int MaxThroughputInlineThreshold = 1000;
+
+void AddFastCompileLTOPasses(llvm::PassManager &pPM) {
+  pPM.add(llvm::createGlobalOptimizerPass());
+  pPM.add(llvm::createIPSCCPPass());
+  pPM.add(llvm::createDeadArgEliminationPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createFunctionInliningPass(FastCompileInlineThreshold));
+  pPM.add(llvm::createSROAPass());
+  pPM.add(llvm::createEarlyCSEPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createCFGSimplificationPass());
+  pPM.add(llvm::createGlobalDCEPass());
+  pPM.add(llvm::createConstantMergePass());
+}
+
+void AddMaxThroughputLTOPasses(llvm::PassManager &pPM) {
+  // Inline first so that the standard pipeline optimizes the kernel bodies
+  // within their loops.
+  pPM.add(llvm::createFunctionInliningPass(MaxThroughputInlineThreshold));
+
+  llvm::PassManagerBuilder Builder;
+  Builder.OptLevel = 3;
+  Builder.populateLTOPassManager(pPM, /*Internalize*/false,
+                                 /*RunInliner*/false);
+
+  // Vectorize the loops and then the straight-line code, and clean up.
+  pPM.add(llvm::createLoopRotatePass());
+  pPM.add(llvm::createLoopVectorizePass());
+  pPM.add(llvm::createSLPVectorizerPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createCFGSimplificationPass());
+}
+
+// Count the defined functions of pModule and their instructions.
+void CountIR(const llvm::Module &pModule, size_t &pFunctions,
+             size_t &pInstructions) {
+  pFunctions = pInstructions = 0;
+  for (llvm::Module::const_iterator F = pModule.begin(), FE = pModule.end();
+       F != FE; ++F) {
+    if (F->isDeclaration()) {
+      continue;
+    }
+    pFunctions++;
+    for (llvm::Function::const_iterator BB = F->begin(), BE = F->end();
+         BB != BE; ++BB) {
+      pInstructions += BB->size();
+    }
+  }
+}
+
+// Seconds of wall time elapsed since pStart.
+double SecondsSince(const llvm::sys::TimeValue &pStart) {
+  llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - pStart;
+  return elapsed.seconds() + elapsed.nanoseconds() * 1e-9;
+}
+
+} // end anonymous namespace
+
 const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
   switch (pErrCode) {
   case kSuccess:
@@ -76,6 +146,8 @@ const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
     return "Error occurred during afterExecuteCodeGenPasses() in subclass.";
   case kErrInvalidSource:
     return "Error loading input bitcode";
+  case kErrCancelled:
+    return "The compilation was cancelled.";
   }
 
   // This assert should never be reached as the compiler verifies that the
@@ -87,12 +159,19 @@ const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
 //===----------------------------------------------------------------------===//
 // Instance Methods
 //===----------------------------------------------------------------------===//
-Compiler::Compiler() : mTarget(NULL), mEnableLTO(true) {
+Compiler::Compiler() : mTarget(NULL), mEnableLTO(true),
+                       mLTOProfile(CompilerConfig::kLTOBalanced),
+                       mPrefetchDistance(0), mStreamBlockSize(0),
+                       mEnableGlobalMerge(false), mStatsCallback(NULL),
+                       mStatsUserData(NULL) {
   return;
 }
 
-Compiler::Compiler(const CompilerConfig &pConfig) : mTarget(NULL),
-                                                    mEnableLTO(true) {
+Compiler::Compiler(const CompilerConfig &pConfig)
+  : mTarget(NULL), mEnableLTO(true),
+    mLTOProfile(CompilerConfig::kLTOBalanced), mPrefetchDistance(0),
+    mStreamBlockSize(0), mEnableGlobalMerge(false), mStatsCallback(NULL),
+    mStatsUserData(NULL) {
   const std::string &triple = pConfig.getTriple();
 
   enum ErrorCode err = config(pConfig);
@@ -105,28 +184,88 @@ Compiler::Compiler(const CompilerConfig &pConfig) : mTarget(NULL),
   return;
 }
 
+Compiler::TargetEntry::TargetEntry(const CompilerConfig &pConfig)
+  : mTriple(pConfig.getTriple()), mCPU(pConfig.getCPU()),
+    mFeatureString(pConfig.getFeatureString()),
+    mRelocModel(pConfig.getRelocationModel()),
+    mCodeModel(pConfig.getCodeModel()),
+    mOptLevel(pConfig.getOptimizationLevel()),
+    mFloatABIType(pConfig.getTargetOptions().FloatABIType),
+    mUseSoftFloat(pConfig.getTargetOptions().UseSoftFloat),
+    mNoFramePointerElim(pConfig.getTargetOptions().NoFramePointerElim),
+    mUseInitArray(pConfig.getTargetOptions().UseInitArray),
+    mRelaxAll(pConfig.getEmissionProfile() == CompilerConfig::kEmitFast),
+    mTarget(NULL) { }
+
+bool Compiler::TargetEntry::matches(const CompilerConfig &pConfig) const {
+  const llvm::TargetOptions &options = pConfig.getTargetOptions();
+  return ((mOptLevel == pConfig.getOptimizationLevel()) &&
+          (mRelocModel == pConfig.getRelocationModel()) &&
+          (mCodeModel == pConfig.getCodeModel()) &&
+          (mFloatABIType == options.FloatABIType) &&
+          (mUseSoftFloat == options.UseSoftFloat) &&
+          (mNoFramePointerElim == options.NoFramePointerElim) &&
+          (mUseInitArray == options.UseInitArray) &&
+          (mRelaxAll ==
+               (pConfig.getEmissionProfile() == CompilerConfig::kEmitFast)) &&
+          (mFeatureString == pConfig.getFeatureString()) &&
+          (mCPU == pConfig.getCPU()) &&
+          (mTriple == pConfig.getTriple()));
+}
+
 enum Compiler::ErrorCode Compiler::config(const CompilerConfig &pConfig) {
   if (pConfig.getTarget() == NULL) {
     return kInvalidConfigNoTarget;
   }
 
-  llvm::TargetMachine *new_target =
-      (pConfig.getTarget())->createTargetMachine(pConfig.getTriple(),
-                                                 pConfig.getCPU(),
-                                                 pConfig.getFeatureString(),
-                                                 pConfig.getTargetOptions(),
-                                                 pConfig.getRelocationModel(),
-                                                 pConfig.getCodeModel(),
-                                                 pConfig.getOptimizationLevel());
+  // Look for a TargetMachine created with the same configuration before.
+  size_t idx = 0;
+  while ((idx < mTargetPool.size()) && !mTargetPool[idx].matches(pConfig)) {
+    idx++;
+  }
 
-  if (new_target == NULL) {
-    return ((mTarget != NULL) ? kErrSwitchTargetMachine :
-                                kErrCreateTargetMachine);
+  if (idx < mTargetPool.size()) {
+    // Move it to the front.
+    TargetEntry entry = mTargetPool[idx];
+    mTargetPool.erase(mTargetPool.begin() + idx);
+    mTargetPool.insert(mTargetPool.begin(), entry);
+  } else {
+    TargetEntry entry(pConfig);
+    entry.mTarget =
+        (pConfig.getTarget())->createTargetMachine(pConfig.getTriple(),
+                                                   pConfig.getCPU(),
+                                                   pConfig.getFeatureString(),
+                                                   pConfig.getTargetOptions(),
+                                                   pConfig.getRelocationModel(),
+                                                   pConfig.getCodeModel(),
+                                                   pConfig.getOptimizationLevel());
+
+    if (entry.mTarget == NULL) {
+      return ((mTarget != NULL) ? kErrSwitchTargetMachine :
+                                  kErrCreateTargetMachine);
+    }
+
+    // Relaxing all the instructions saves the passes of the assembler over
+    // the fragments at the expense of the size (and the i-cache density) of
+    // the code.
+    entry.mTarget->setMCRelaxAll(entry.mRelaxAll);
+
+    // Drop the least recently used TargetMachine if the pool is full.
+    if (mTargetPool.size() >= MaxPooledTargets) {
+      delete mTargetPool.back().mTarget;
+      mTargetPool.pop_back();
+    }
+    mTargetPool.insert(mTargetPool.begin(), entry);
   }
 
-  // Replace the old TargetMachine.
-  delete mTarget;
-  mTarget = new_target;
+  // Switch to the TargetMachine.
+  mTarget = mTargetPool.front().mTarget;
+
+  // The LTO pipeline and the prefetching don't depend on the TargetMachine.
+  mLTOProfile = pConfig.getLTOProfile();
+  mPrefetchDistance = pConfig.getPrefetchDistance();
+  mStreamBlockSize = pConfig.getStreamBlockSize();
+  mEnableGlobalMerge = pConfig.getEnableGlobalMerge();
 
   // Adjust register allocation policy according to the optimization level.
   //  createFastRegisterAllocator: fast but bad quality
@@ -137,14 +276,13 @@ enum Compiler::ErrorCode Compiler::config(const CompilerConfig &pConfig) {
     llvm::RegisterRegAlloc::setDefault(llvm::createGreedyRegisterAllocator);
   }
 
-  // Relax all machine instructions.
-  mTarget->setMCRelaxAll(true);
-
   return kSuccess;
 }
 
 Compiler::~Compiler() {
-  delete mTarget;
+  for (size_t i = 0; i < mTargetPool.size(); i++) {
+    delete mTargetPool[i].mTarget;
+  }
 }
 
 enum Compiler::ErrorCode Compiler::runLTO(Script &pScript) {
@@ -171,10 +309,21 @@ enum Compiler::ErrorCode Compiler::runLTO(Script &pScript) {
     lto_passes.add(llvm::createGlobalOptimizerPass());
     lto_passes.add(llvm::createConstantMergePass());
   } else {
-    // FIXME: Figure out which passes should be executed.
-    llvm::PassManagerBuilder Builder;
-    Builder.populateLTOPassManager(lto_passes, /*Internalize*/false,
-                                   /*RunInliner*/true);
+    switch (mLTOProfile) {
+    case CompilerConfig::kLTOFastCompile:
+      AddFastCompileLTOPasses(lto_passes);
+      break;
+    case CompilerConfig::kLTOMaxThroughput:
+      AddMaxThroughputLTOPasses(lto_passes);
+      break;
+    case CompilerConfig::kLTOBalanced:
+    default: {
+      llvm::PassManagerBuilder Builder;
+      Builder.populateLTOPassManager(lto_passes, /*Internalize*/false,
+                                     /*RunInliner*/true);
+      break;
+    }
+    }
   }
 
   // Invoke "afterAddLTOPasses" after pass manager finished its
@@ -215,6 +364,14 @@ enum Compiler::ErrorCode Compiler::runCodeGen(Script &pScript,
     return kErrHookBeforeAddCodeGenPasses;
   }
 
+  // The merging of the globals is per compile rather than per process (see
+  // CompilerConfig::setEnableGlobalMerge().)
+  if (mEnableGlobalMerge &&
+      (mTarget->getOptLevel() != llvm::CodeGenOpt::None)) {
+    codegen_passes.add(
+        llvm::createGlobalMergePass(mTarget->getTargetLowering()));
+  }
+
   // Add passes to the pass manager to emit machine code through MC layer.
   if (mTarget->addPassesToEmitMC(codegen_passes, mc_context, pResult,
                                  /* DisableVerify */false)) {
@@ -232,7 +389,18 @@ enum Compiler::ErrorCode Compiler::runCodeGen(Script &pScript,
     return kErrHookBeforeExecuteCodeGenPasses;
   }
 
-  // Execute the pass.
+  // Execute the pass. The whole module is compiled on the calling thread.
+  //
+  // FIXME: Splitting the module into groups of kernels and their callees and
+  //        compiling them concurrently isn't done yet. The groups all live in
+  //        the LLVMContext of the source, which mustn't be used by more than
+  //        one thread, so each would first be moved to a context of its own
+  //        (a round-trip through bitcode.) Only the scripts linked into a
+  //        shared object (RSCompilerDriver::setSharedObjectLinker()) could
+  //        then take the objects of the groups: ObjectLoader, which loads the
+  //        others, relocates exactly one object. The compiles of different
+  //        scripts already run concurrently on the compiler slots of
+  //        RSCompilerDriver.
   codegen_passes.run(pScript.getSource().getModule());
 
   // Invokde "afterExecuteCodeGenPasses" before returning.
@@ -253,8 +421,15 @@ enum Compiler::ErrorCode Compiler::compile(Script &pScript,
     return kErrNoTargetMachine;
   }
 
+  const char *name = module.getModuleIdentifier().c_str();
+
+  if (pScript.isCancelled()) {
+    return kErrCancelled;
+  }
+
   // Materialize the bitcode module.
   if (module.getMaterializer() != NULL) {
+    PhaseTimer timer(kPhaseBitcodeParse, name);
     std::string error;
     // A module with non-null materializer means that it is a lazy-load module.
     // Materialize it now via invoking MaterializeAllPermanently(). This
@@ -266,15 +441,53 @@ enum Compiler::ErrorCode Compiler::compile(Script &pScript,
     }
   }
 
-  if (mEnableLTO && ((err = runLTO(pScript)) != kSuccess)) {
-    return err;
+  CompilerStats stats;
+  if (mStatsCallback != NULL) {
+    CountIR(module, stats.mFunctionsBeforeLTO, stats.mInstructionsBeforeLTO);
+  }
+
+  if (mEnableLTO) {
+    if (pScript.isCancelled()) {
+      return kErrCancelled;
+    }
+    PhaseTimer timer(kPhaseLTO, name);
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    if ((err = runLTO(pScript)) != kSuccess) {
+      return err;
+    }
+    stats.mLTOTime = SecondsSince(start);
+  }
+
+  // Code generation takes the longest, so give up before starting it.
+  if (pScript.isCancelled()) {
+    return kErrCancelled;
+  }
+
+  if (mStatsCallback != NULL) {
+    CountIR(module, stats.mFunctionsAfterLTO, stats.mInstructionsAfterLTO);
   }
 
   if (IRStream)
     *IRStream << module;
 
-  if ((err = runCodeGen(pScript, pResult)) != kSuccess) {
-    return err;
+  {
+    PhaseTimer timer(kPhaseCodeGen, name);
+    uint64_t object_start = pResult.tell();
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    if ((err = runCodeGen(pScript, pResult)) != kSuccess) {
+      return err;
+    }
+    stats.mCodeGenTime = SecondsSince(start);
+    stats.mObjectSize = pResult.tell() - object_start;
+  }
+
+  // The caller would discard the object anyway.
+  if (pScript.isCancelled()) {
+    return kErrCancelled;
+  }
+
+  if (mStatsCallback != NULL) {
+    mStatsCallback(name, stats, mStatsUserData);
   }
 
   return kSuccess;
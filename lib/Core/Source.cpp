@@ -16,16 +16,28 @@
 
 #include "bcc/Source.h"
 
+#include <cstring>
 #include <new>
 
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Linker.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/system_error.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include "bcc/BCCContext.h"
+#include "bcc/Support/FileBase.h"
 #include "bcc/Support/Log.h"
 
 #include "BCCContextImpl.h"
@@ -49,6 +61,180 @@ static inline llvm::Module *helper_load_bitcode(llvm::LLVMContext &pContext,
   return module;
 }
 
+typedef llvm::SmallPtrSet<const llvm::GlobalValue *, 64> GlobalValueSetTy;
+typedef llvm::SmallVector<const llvm::GlobalValue *, 64> GlobalValueListTy;
+
+// Add the global values used by pValue (looking through constant
+// expressions and aggregates) to pWorklist if they are not in pVisited yet.
+static void helper_collect_globals(const llvm::Value *pValue,
+                                   GlobalValueSetTy &pVisited,
+                                   GlobalValueListTy &pWorklist,
+                                   llvm::SmallPtrSet<const llvm::Constant *,
+                                                     32> &pVisitedConstants) {
+  if (const llvm::GlobalValue *gv = llvm::dyn_cast<llvm::GlobalValue>(pValue)) {
+    if (pVisited.insert(gv)) {
+      pWorklist.push_back(gv);
+    }
+    return;
+  }
+
+  const llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(pValue);
+  if ((c == NULL) || !pVisitedConstants.insert(c)) {
+    return;
+  }
+
+  for (llvm::Constant::const_op_iterator op_iter = c->op_begin(),
+          op_end = c->op_end(); op_iter != op_end; op_iter++) {
+    helper_collect_globals(*op_iter, pVisited, pWorklist, pVisitedConstants);
+  }
+}
+
+// Return the global value in pLibrary that resolves the declaration named
+// pName, which must end with pSuffix (if non-NULL) to be resolved at all.
+static llvm::GlobalValue *helper_lookup_library(llvm::Module &pLibrary,
+                                                llvm::StringRef pName,
+                                                const char *pSuffix) {
+  if (pSuffix != NULL) {
+    if (!pName.endswith(pSuffix)) {
+      return NULL;
+    }
+    pName = pName.drop_back(::strlen(pSuffix));
+  }
+  return pLibrary.getNamedValue(pName);
+}
+
+// Compute the set of global values in pLibrary that are needed to resolve the
+// undefined references of pModule (only those ending with pSuffix if it's
+// non-NULL.) Function bodies are materialized along the way. Return false on
+// error.
+static bool helper_compute_needed_globals(llvm::Module &pModule,
+                                          llvm::Module &pLibrary,
+                                          GlobalValueSetTy &pNeeded,
+                                          const char *pSuffix) {
+  GlobalValueListTy worklist;
+  llvm::SmallPtrSet<const llvm::Constant *, 32> visited_constants;
+
+  // Seed the worklist with the declarations in pModule. Note that functions
+  // defined in a lazily-loaded pModule are not declarations even if they look
+  // like so before materialization.
+  for (llvm::Module::iterator func_iter = pModule.begin(),
+          func_end = pModule.end(); func_iter != func_end; func_iter++) {
+    if (func_iter->isDeclaration() && !func_iter->isMaterializable()) {
+      llvm::GlobalValue *gv = helper_lookup_library(pLibrary,
+                                                    func_iter->getName(),
+                                                    pSuffix);
+      if ((gv != NULL) && pNeeded.insert(gv)) {
+        worklist.push_back(gv);
+      }
+    }
+  }
+  for (llvm::Module::global_iterator var_iter = pModule.global_begin(),
+          var_end = pModule.global_end(); var_iter != var_end; var_iter++) {
+    if (var_iter->isDeclaration()) {
+      llvm::GlobalValue *gv = helper_lookup_library(pLibrary,
+                                                    var_iter->getName(),
+                                                    pSuffix);
+      if ((gv != NULL) && pNeeded.insert(gv)) {
+        worklist.push_back(gv);
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    llvm::GlobalValue *gv = const_cast<llvm::GlobalValue *>(worklist.back());
+    worklist.pop_back();
+
+    if (llvm::Function *func = llvm::dyn_cast<llvm::Function>(gv)) {
+      std::string error;
+      if (func->isMaterializable() && func->Materialize(&error)) {
+        ALOGE("Failed to materialize function `%s' in `%s'! (%s)",
+              func->getName().str().c_str(),
+              pLibrary.getModuleIdentifier().c_str(), error.c_str());
+        return false;
+      }
+
+      for (llvm::Function::const_iterator bb_iter = func->begin(),
+              bb_end = func->end(); bb_iter != bb_end; bb_iter++) {
+        for (llvm::BasicBlock::const_iterator inst_iter = bb_iter->begin(),
+                inst_end = bb_iter->end(); inst_iter != inst_end; inst_iter++) {
+          for (llvm::User::const_op_iterator op_iter = inst_iter->op_begin(),
+                  op_end = inst_iter->op_end(); op_iter != op_end; op_iter++) {
+            helper_collect_globals(*op_iter, pNeeded, worklist,
+                                   visited_constants);
+          }
+        }
+      }
+    } else if (llvm::GlobalVariable *var =
+                   llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+      if (var->hasInitializer()) {
+        helper_collect_globals(var->getInitializer(), pNeeded, worklist,
+                               visited_constants);
+      }
+    } else if (llvm::GlobalAlias *alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+      helper_collect_globals(alias->getAliasee(), pNeeded, worklist,
+                             visited_constants);
+    }
+  }
+
+  return true;
+}
+
+// Strip the clone pClone of a library down to the definitions whose originals
+// are in pNeeded.
+static void helper_prune_library_clone(llvm::Module &pClone,
+                                       const GlobalValueSetTy &pNeeded,
+                                       llvm::ValueToValueMapTy &pVMap) {
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 64> needed_clones;
+  for (GlobalValueSetTy::const_iterator needed_iter = pNeeded.begin(),
+          needed_end = pNeeded.end(); needed_iter != needed_end;
+       needed_iter++) {
+    llvm::ValueToValueMapTy::iterator map_iter = pVMap.find(*needed_iter);
+    if (map_iter != pVMap.end()) {
+      needed_clones.insert(llvm::cast<llvm::GlobalValue>(map_iter->second));
+    }
+  }
+
+  // Drop the function bodies that are not needed. The bodies of the functions
+  // materialized for other users of the library end up here, too.
+  for (llvm::Module::iterator func_iter = pClone.begin(),
+          func_end = pClone.end(); func_iter != func_end; func_iter++) {
+    if (!needed_clones.count(func_iter) && !func_iter->isDeclaration()) {
+      func_iter->deleteBody();
+    }
+  }
+
+  // Erase the unused globals until there's nothing left to erase.
+  bool changed;
+  do {
+    changed = false;
+    for (llvm::Module::iterator func_iter = pClone.begin();
+         func_iter != pClone.end(); ) {
+      llvm::Function *func = func_iter++;
+      if (!needed_clones.count(func) && func->use_empty()) {
+        func->eraseFromParent();
+        changed = true;
+      }
+    }
+    for (llvm::Module::global_iterator var_iter = pClone.global_begin();
+         var_iter != pClone.global_end(); ) {
+      llvm::GlobalVariable *var = var_iter++;
+      if (!needed_clones.count(var) && var->use_empty()) {
+        var->eraseFromParent();
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  // The unmaterialized functions were cloned as declarations keeping their
+  // (possibly local) linkage. Make the remaining ones valid declarations.
+  for (llvm::Module::iterator func_iter = pClone.begin(),
+          func_end = pClone.end(); func_iter != func_end; func_iter++) {
+    if (func_iter->isDeclaration()) {
+      func_iter->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+}
+
 } // end anonymous namespace
 
 namespace bcc {
@@ -58,6 +244,21 @@ void Source::setModule(llvm::Module *pModule) {
   mModule = pModule;
 }
 
+bool Source::releaseModule() {
+  llvm::Module *empty =
+      new (std::nothrow) llvm::Module(getIdentifier(), mModule->getContext());
+  if (empty == NULL) {
+    ALOGE("Out of memory when releasing LLVM module `%s'!",
+          getIdentifier().c_str());
+    return false;
+  }
+
+  setModule(empty);
+  // The empty module is always ours.
+  mNoDelete = false;
+  return true;
+}
+
 Source *Source::CreateFromBuffer(BCCContext &pContext,
                                  const char *pName,
                                  const char *pBitcode,
@@ -71,7 +272,7 @@ Source *Source::CreateFromBuffer(BCCContext &pContext,
     return NULL;
   }
 
-  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
+  llvm::Module *module = helper_load_bitcode(pContext.getLLVMContext(),
                                              input_memory);
   if (module == NULL) {
     delete input_memory;
@@ -89,7 +290,16 @@ Source *Source::CreateFromBuffer(BCCContext &pContext,
 Source *Source::CreateFromFile(BCCContext &pContext, const std::string &pPath) {
   llvm::OwningPtr<llvm::MemoryBuffer> input_data;
 
-  llvm::error_code ec = llvm::MemoryBuffer::getFile(pPath, input_data);
+  // The functions of the module are materialized from the file on demand, in
+  // no particular order (e.g., those of libclcore the script calls.) Have
+  // all of it read ahead rather than fault on each of them.
+  FileBase::Prefetch(pPath.c_str());
+
+  // The bitcode reader doesn't need a terminating NUL, so the file is mapped
+  // rather than read whenever it's large enough.
+  llvm::error_code ec = llvm::MemoryBuffer::getFile(pPath, input_data, -1,
+                                                    /* RequiresNullTerminator */
+                                                    false);
   if (ec != llvm::error_code::success()) {
     ALOGE("Failed to load bitcode from path %s! (%s)", pPath.c_str(),
                                                        ec.message().c_str());
@@ -97,7 +307,7 @@ Source *Source::CreateFromFile(BCCContext &pContext, const std::string &pPath) {
   }
 
   llvm::MemoryBuffer *input_memory = input_data.take();
-  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
+  llvm::Module *module = helper_load_bitcode(pContext.getLLVMContext(),
                                              input_memory);
   if (module == NULL) {
     delete input_memory;
@@ -156,10 +366,58 @@ bool Source::merge(Source &pSource, bool pPreserveSource) {
   return true;
 }
 
+bool Source::mergeReferenced(Source &pLibrary, const char *pSuffix) {
+  GlobalValueSetTy needed;
+  if (!helper_compute_needed_globals(*mModule, pLibrary.getModule(), needed,
+                                     pSuffix)) {
+    return false;
+  }
+
+  llvm::ValueToValueMapTy vmap;
+  llvm::Module *clone = llvm::CloneModule(&pLibrary.getModule(), vmap);
+  if (clone == NULL) {
+    ALOGE("Out of memory when clone `%s'!", pLibrary.getIdentifier().c_str());
+    return false;
+  }
+
+  helper_prune_library_clone(*clone, needed, vmap);
+
+  // The definitions are linked under the suffixed names, next to the ones
+  // (if any) of the library linked without a suffix.
+  if (pSuffix != NULL) {
+    for (llvm::Module::iterator func_iter = clone->begin(),
+            func_end = clone->end(); func_iter != func_end; func_iter++) {
+      if (!func_iter->isDeclaration()) {
+        func_iter->setName(func_iter->getName() + pSuffix);
+      }
+    }
+    for (llvm::Module::global_iterator var_iter = clone->global_begin(),
+            var_end = clone->global_end(); var_iter != var_end; var_iter++) {
+      if (!var_iter->isDeclaration()) {
+        var_iter->setName(var_iter->getName() + pSuffix);
+      }
+    }
+  }
+
+  std::string error;
+  if (llvm::Linker::LinkModules(mModule, clone, llvm::Linker::DestroySource,
+                                &error) != 0) {
+    ALOGE("Failed to link source `%s' with `%s' (%s)!",
+          getIdentifier().c_str(),
+          pLibrary.getIdentifier().c_str(),
+          error.c_str());
+    delete clone;
+    return false;
+  }
+
+  delete clone;
+  return true;
+}
+
 Source *Source::CreateEmpty(BCCContext &pContext, const std::string &pName) {
   // Create an empty module
   llvm::Module *module =
-      new (std::nothrow) llvm::Module(pName, pContext.mImpl->mLLVMContext);
+      new (std::nothrow) llvm::Module(pName, pContext.getLLVMContext());
 
   if (module == NULL) {
     ALOGE("Out of memory when creating empty LLVM module `%s'!", pName.c_str());
@@ -22,11 +22,14 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_executionengine_SRC_FILES := \
+  DyldObjectLoaderImpl.cpp \
   ELFObjectLoaderImpl.cpp \
   GDBJIT.cpp \
   GDBJITRegistrar.cpp \
   ObjectLoader.cpp \
+  PerfMap.cpp \
   SymbolResolverProxy.cpp \
+  SymbolResolverRegistry.cpp \
   SymbolResolvers.cpp
 
 #=====================================================================
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "DyldObjectLoaderImpl.h"
+
+#include <new>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+
+#include <utils/FileMap.h>
+
+#include "bcc/ExecutionEngine/SymbolResolvers.h"
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Paths of the shared objects opened by a DyldObjectLoaderImpl.
+llvm::sys::Mutex gOpenedSharedObjectsLock;
+llvm::StringMap<bool> gOpenedSharedObjects;
+
+// Copy the file pPath to the temporary file of pCopy. Return false on error.
+bool CopySharedObject(const char *pPath, AtomicOutputFile &pCopy) {
+  android::FileMap *map = InputFile::MapFile(pPath);
+  if (map == NULL) {
+    return false;
+  }
+
+  bool result = !pCopy.hasError() &&
+                (static_cast<size_t>(pCopy.write(map->getDataPtr(),
+                                                 map->getDataLength())) ==
+                     map->getDataLength());
+  map->release();
+
+  pCopy.close();
+  return result;
+}
+
+} // end anonymous namespace
+
+bool DyldObjectLoaderImpl::open(const char *pPath) {
+  bool in_use;
+  {
+    llvm::MutexGuard locked(gOpenedSharedObjectsLock);
+    llvm::StringMapEntry<bool> &entry =
+        gOpenedSharedObjects.GetOrCreateValue(pPath, false);
+    in_use = entry.getValue();
+    entry.setValue(true);
+  }
+
+  if (!in_use) {
+    mPath = pPath;
+    mSharedObject = new (std::nothrow) DyldSymbolResolver(pPath);
+  } else {
+    // The copy is removed once it's loaded (or failed to load.)
+    AtomicOutputFile copy(pPath, FileBase::kBinary);
+    if (!CopySharedObject(pPath, copy)) {
+      ALOGE("Failed to make a private copy of %s! (%s)", pPath,
+            copy.getErrorMessage().c_str());
+      return false;
+    }
+    mSharedObject = new (std::nothrow) DyldSymbolResolver(
+        copy.getName().c_str());
+  }
+
+  if (mSharedObject == NULL) {
+    ALOGE("Out of memory when load the shared object %s!", pPath);
+    return false;
+  }
+
+  if (mSharedObject->hasError()) {
+    ALOGE("%s", mSharedObject->getError());
+    return false;
+  }
+
+  return true;
+}
+
+void *DyldObjectLoaderImpl::getSymbolAddress(const char *pName) const {
+  return mSharedObject->getAddress(pName);
+}
+
+void DyldObjectLoaderImpl::getSymbolAddresses(
+    const android::Vector<const char *> &pNames, const char *pSuffix,
+    android::Vector<void *> &pAddrs) const {
+  llvm::SmallString<64> name;
+
+  pAddrs.setCapacity(pAddrs.size() + pNames.size());
+  for (size_t i = 0, e = pNames.size(); i != e; i++) {
+    if (pSuffix != NULL) {
+      name = pNames[i];
+      name += pSuffix;
+      pAddrs.push_back(mSharedObject->getAddress(name.c_str()));
+    } else {
+      pAddrs.push_back(mSharedObject->getAddress(pNames[i]));
+    }
+  }
+}
+
+DyldObjectLoaderImpl::~DyldObjectLoaderImpl() {
+  delete mSharedObject;
+  if (!mPath.empty()) {
+    llvm::MutexGuard locked(gOpenedSharedObjectsLock);
+    gOpenedSharedObjects.erase(mPath);
+  }
+}
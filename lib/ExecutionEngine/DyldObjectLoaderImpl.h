@@ -0,0 +1,89 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BCC_EXECUTION_ENGINE_DYLD_OBJECT_LOADER_IMPL_H
+#define BCC_EXECUTION_ENGINE_DYLD_OBJECT_LOADER_IMPL_H
+
+#include <string>
+
+#include "ObjectLoaderImpl.h"
+
+namespace bcc {
+
+class DyldSymbolResolver;
+
+// Loader of a shared object linked from a script's object. The system dynamic
+// linker does the loading and the relocation; the symbols are looked up with
+// dlsym() (see DyldSymbolResolver.)
+class DyldObjectLoaderImpl : public ObjectLoaderImpl {
+private:
+  DyldSymbolResolver *mSharedObject;
+
+  // The path of the shared object as given to open(). It's the key of the
+  // registry of the opened shared objects.
+  std::string mPath;
+
+public:
+  DyldObjectLoaderImpl() : ObjectLoaderImpl(), mSharedObject(NULL) { }
+
+  // Open the shared object pPath. The dynamic linker hands out the same copy
+  // of a library for every dlopen() of it but each script instance needs its
+  // own global variables. If pPath is already opened through another loader,
+  // a private copy of it gets opened instead. Return false on error.
+  bool open(const char *pPath);
+
+  // The object has been relocated by the dynamic linker. load() and
+  // relocate() aren't used.
+  virtual bool load(const void *pMem, size_t pMemSize)
+  { return false; }
+
+  virtual bool relocate(SymbolResolverInterface &pResolver)
+  { return true; }
+
+  // The shared object is registered with the debugger by the dynamic linker.
+  virtual uint8_t *createDebugImage(const void *pMem, size_t pMemSize,
+                                    size_t &pDebugImgSize) const
+  { return NULL; }
+
+  virtual void *getSymbolAddress(const char *pName) const;
+
+  // The sizes of the symbols are not available from the dynamic linker.
+  virtual size_t getSymbolSize(const char *pName) const
+  { return 0; }
+
+  virtual void getSymbolAddresses(const android::Vector<const char *> &pNames,
+                                  const char *pSuffix,
+                                  android::Vector<void *> &pAddrs) const;
+
+  // The section header table isn't loaded. The exports are looked up by name.
+  virtual void *getSectionAddress(unsigned pIndex) const
+  { return NULL; }
+
+  // Nor are the program headers. Assume there're global variables.
+  virtual bool hasWritableSections() const
+  { return true; }
+
+  virtual bool getSymbolNameList(android::Vector<const char *>& pNameList,
+                                 ObjectLoader::SymbolType pType) const
+  { return false; }
+
+  ~DyldObjectLoaderImpl();
+};
+
+} // end namespace bcc
+
+#endif // BCC_EXECUTION_ENGINE_DYLD_OBJECT_LOADER_IMPL_H
@@ -16,6 +16,10 @@
 
 #include "ELFObjectLoaderImpl.h"
 
+#include <cstring>
+#include <new>
+
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Support/ELF.h>
 
 // The following files are included from librsloader.
@@ -29,27 +33,100 @@
 
 using namespace bcc;
 
-bool ELFObjectLoaderImpl::load(const void *pMem, size_t pMemSize) {
+template <unsigned Bitwidth>
+bool ELFObjectLoaderImpl<Bitwidth>::load(const void *pMem, size_t pMemSize) {
+  mImage = pMem;
+  mImageSize = pMemSize;
+
   ArchiveReaderLE reader(reinterpret_cast<const unsigned char *>(pMem),
                          pMemSize);
 
-  mObject = ELFObject<32>::read(reader);
+  // The memory of the loaded sections is allocated by ELFObject<>::read(), one
+  // chunk per section (with the stubs of .text in the same chunk), and freed
+  // when mObject is deleted. The section addresses are baked into the code by
+  // relocate(), so the sections can't be moved into memory of the loader's
+  // choosing afterwards. Packing the code of several scripts into shared
+  // executable arenas (or switching them from writable to executable once
+  // they're relocated) requires librsloader to take an allocator here.
+  mObject = ELFObject<Bitwidth>::read(reader);
   if (mObject == NULL) {
     ALOGE("Unable to load the ELF object!");
     return false;
   }
 
   // Retrive the pointer to the symbol table.
-  mSymTab = static_cast<ELFSectionSymTab<32> *>(
+  mSymTab = static_cast<ELFSectionSymTab<Bitwidth> *>(
                 mObject->getSectionByName(".symtab"));
   if (mSymTab == NULL) {
     ALOGW("Object doesn't contain any symbol table.");
+    return true;
+  }
+
+  // Index the symbols by name. Like ELFSectionSymTab<>::getByName(), the first
+  // symbol wins if there're more than one with the same name.
+  for (size_t i = 0, e = mSymTab->size(); i != e; i++) {
+    ELFSymbol<Bitwidth> *symbol = (*mSymTab)[i];
+    if (symbol == NULL) {
+      continue;
+    }
+
+    const char *symbol_name = symbol->getName();
+    if ((symbol_name != NULL) && (symbol_name[0] != '\0')) {
+      mSymbolIndex.GetOrCreateValue(symbol_name, symbol);
+    }
   }
 
   return true;
 }
 
-bool ELFObjectLoaderImpl::relocate(SymbolResolverInterface &pResolver) {
+template <unsigned Bitwidth>
+ELFSymbol<Bitwidth> *
+ELFObjectLoaderImpl<Bitwidth>::lookupSymbol(llvm::StringRef pName) const {
+  typename llvm::StringMap<ELFSymbol<Bitwidth> *>::const_iterator symbol =
+      mSymbolIndex.find(pName);
+  return ((symbol != mSymbolIndex.end()) ? symbol->getValue() : NULL);
+}
+
+template <unsigned Bitwidth>
+void ELFObjectLoaderImpl<Bitwidth>::resolveUndefinedSymbols(
+    SymbolResolverInterface &pResolver) {
+  android::Vector<const char *> names;
+  if ((mSymTab == NULL) ||
+      !ObjectLoader::GetUndefinedSymbols(mImage, mImageSize, names) ||
+      names.isEmpty()) {
+    return;
+  }
+
+  // ELFObject<>::relocate() only looks up the symbols without an address.
+  // Those not found are looked up (and reported) again there.
+  for (size_t i = 0, e = names.size(); i != e; i++) {
+    ELFSymbol<Bitwidth> *symbol = lookupSymbol(names[i]);
+    if (symbol == NULL) {
+      continue;
+    }
+    if (void *address = pResolver.getAddressOf(i, names[i])) {
+      symbol->setAddress(address);
+    }
+  }
+}
+
+template <unsigned Bitwidth>
+bool
+ELFObjectLoaderImpl<Bitwidth>::relocate(SymbolResolverInterface &pResolver) {
+  // All the relocation sections are applied here at once. ELFObject<> neither
+  // tells which function a relocation belongs to nor applies a subset of them,
+  // and the exports are handed to the runtime as plain addresses that it calls
+  // directly (there's no stub to catch the first call.) A per-function lazy
+  // relocation would have to be done by librsloader, or by the dynamic linker
+  // for the shared objects (see ObjectLoader::LoadSharedObject().)
+  //
+  // Neither can the relocations be applied by several threads: ELFObject<>
+  // applies them all in one go. The lookups of the undefined symbols are done
+  // up front instead, once each, so that ELFObject<>::relocate() is left with
+  // the patching. They stay on the calling thread: SymbolResolverProxy
+  // follows its chain under a lock, so workers would only take turns.
+  resolveUndefinedSymbols(pResolver);
+
   mObject->relocate(SymbolResolverInterface::LookupFunction, &pResolver);
 
   if (mObject->getMissingSymbols()) {
@@ -60,51 +137,173 @@ bool ELFObjectLoaderImpl::relocate(SymbolResolverInterface &pResolver) {
   return true;
 }
 
-bool ELFObjectLoaderImpl::prepareDebugImage(void *pDebugImg,
-                                            size_t pDebugImgSize) {
-  // Update the value of sh_addr in pDebugImg to its corresponding section in
-  // the mObject.
-  llvm::ELF::Elf32_Ehdr *elf_header =
-      reinterpret_cast<llvm::ELF::Elf32_Ehdr *>(pDebugImg);
-
-  if (elf_header->e_shoff > pDebugImgSize) {
-    ALOGE("Invalid section header table offset found! (e_shoff = %d)",
-          elf_header->e_shoff);
+namespace {
+
+// The ELF header and section header of each ELF class.
+template <unsigned Bitwidth>
+struct ELFHeaderTypes;
+
+template <>
+struct ELFHeaderTypes<32> {
+  typedef llvm::ELF::Elf32_Ehdr Ehdr;
+  typedef llvm::ELF::Elf32_Shdr Shdr;
+  typedef llvm::ELF::Elf32_Addr Addr;
+};
+
+template <>
+struct ELFHeaderTypes<64> {
+  typedef llvm::ELF::Elf64_Ehdr Ehdr;
+  typedef llvm::ELF::Elf64_Shdr Shdr;
+  typedef llvm::ELF::Elf64_Addr Addr;
+};
+
+// Return true if GDB needs the contents of the section pSection in the debug
+// image. The loaded sections are described by their addresses instead and so
+// are the relocations applied to them.
+template <typename Shdr>
+bool IsDebugImageSection(const Shdr &pSection,
+                         const Shdr *pSectionHeaderTable,
+                         unsigned pNumSections) {
+  if ((pSection.sh_type == llvm::ELF::SHT_NULL) ||
+      (pSection.sh_type == llvm::ELF::SHT_NOBITS) ||
+      (pSection.sh_flags & llvm::ELF::SHF_ALLOC)) {
     return false;
   }
 
-  if ((elf_header->e_shoff +
-       sizeof(llvm::ELF::Elf32_Shdr) * elf_header->e_shnum) > pDebugImgSize) {
+  if ((pSection.sh_type == llvm::ELF::SHT_REL) ||
+      (pSection.sh_type == llvm::ELF::SHT_RELA)) {
+    return ((pSection.sh_info < pNumSections) &&
+            !(pSectionHeaderTable[pSection.sh_info].sh_flags &
+              llvm::ELF::SHF_ALLOC));
+  }
+
+  return true;
+}
+
+inline size_t AlignDebugImageOffset(size_t pOffset, size_t pAlignment) {
+  if (pAlignment <= 1) {
+    return pOffset;
+  }
+  return ((pOffset + pAlignment - 1) / pAlignment) * pAlignment;
+}
+
+} // end anonymous namespace
+
+template <unsigned Bitwidth>
+uint8_t *
+ELFObjectLoaderImpl<Bitwidth>::createDebugImage(const void *pMem,
+                                                size_t pMemSize,
+                                                size_t &pDebugImgSize) const {
+  typedef typename ELFHeaderTypes<Bitwidth>::Ehdr Ehdr;
+  typedef typename ELFHeaderTypes<Bitwidth>::Shdr Shdr;
+  typedef typename ELFHeaderTypes<Bitwidth>::Addr Addr;
+
+  const uint8_t *object = reinterpret_cast<const uint8_t *>(pMem);
+
+  if (pMemSize < sizeof(Ehdr)) {
+    ALOGE("Invalid image supplied (truncated ELF header)!");
+    return NULL;
+  }
+
+  const Ehdr *elf_header = reinterpret_cast<const Ehdr *>(object);
+  unsigned num_sections = elf_header->e_shnum;
+
+  if ((elf_header->e_shoff > pMemSize) ||
+      (elf_header->e_shentsize != sizeof(Shdr)) ||
+      ((sizeof(Shdr) * num_sections) > (pMemSize - elf_header->e_shoff))) {
     ALOGE("Invalid image supplied (debug image doesn't contain all the section"
-          "header or corrupted image)! (e_shoff = %d, e_shnum = %d)",
-          elf_header->e_shoff, elf_header->e_shnum);
-    return false;
+          " header or corrupted image)! (e_shoff = %llu, e_shnum = %u)",
+          static_cast<unsigned long long>(elf_header->e_shoff),
+          static_cast<unsigned>(elf_header->e_shnum));
+    return NULL;
+  }
+
+  const Shdr *section_header_table =
+      reinterpret_cast<const Shdr *>(object + elf_header->e_shoff);
+
+  // Lay out the image: the ELF header, the contents of the sections GDB needs
+  // and the section header table.
+  size_t image_size = sizeof(Ehdr);
+  for (unsigned i = 0; i < num_sections; i++) {
+    const Shdr &section = section_header_table[i];
+    if (!IsDebugImageSection(section, section_header_table, num_sections)) {
+      continue;
+    }
+    if ((section.sh_offset > pMemSize) ||
+        (section.sh_size > (pMemSize - section.sh_offset))) {
+      ALOGE("Invalid image supplied (section %u is out of the range)!", i);
+      return NULL;
+    }
+    image_size = AlignDebugImageOffset(image_size, section.sh_addralign) +
+                 section.sh_size;
   }
 
-  llvm::ELF::Elf32_Shdr *section_header_table =
-      reinterpret_cast<llvm::ELF::Elf32_Shdr *>(
-          reinterpret_cast<uint8_t*>(pDebugImg) + elf_header->e_shoff);
+  size_t section_header_table_offset =
+      AlignDebugImageOffset(image_size, sizeof(Addr));
+  image_size = section_header_table_offset + sizeof(Shdr) * num_sections;
 
-  for (unsigned i = 0; i < elf_header->e_shnum; i++) {
-    if (section_header_table[i].sh_flags & llvm::ELF::SHF_ALLOC) {
-      ELFSectionBits<32> *section =
-          static_cast<ELFSectionBits<32> *>(mObject->getSectionByIndex(i));
-      if (section != NULL) {
-        section_header_table[i].sh_addr =
-            reinterpret_cast<llvm::ELF::Elf32_Addr>(section->getBuffer());
+  uint8_t *image = new (std::nothrow) uint8_t [ image_size ];
+  if (image == NULL) {
+    ALOGE("Out of memory when create the debug image! (%u bytes)",
+          static_cast<unsigned>(image_size));
+    return NULL;
+  }
+  ::memset(image, 0, image_size);
+
+  Ehdr *image_elf_header =
+      reinterpret_cast<Ehdr *>(image);
+  ::memcpy(image_elf_header, elf_header, sizeof(Ehdr));
+  image_elf_header->e_phoff = 0;
+  image_elf_header->e_phnum = 0;
+  image_elf_header->e_shoff = section_header_table_offset;
+
+  Shdr *image_section_header_table =
+      reinterpret_cast<Shdr *>(image + section_header_table_offset);
+  ::memcpy(image_section_header_table, section_header_table,
+           sizeof(Shdr) * num_sections);
+
+  size_t offset = sizeof(Ehdr);
+  for (unsigned i = 0; i < num_sections; i++) {
+    Shdr &section = image_section_header_table[i];
+
+    if (IsDebugImageSection(section_header_table[i], section_header_table,
+                            num_sections)) {
+      offset = AlignDebugImageOffset(offset, section.sh_addralign);
+      ::memcpy(image + offset, object + section.sh_offset, section.sh_size);
+      section.sh_offset = offset;
+      offset += section.sh_size;
+    } else if (section.sh_flags & llvm::ELF::SHF_ALLOC) {
+      // GDB's JIT debugging requires the value of sh_addr to be the memory
+      // address that the section lives in the process image. The contents are
+      // left out of the image.
+      ELFSectionBits<Bitwidth> *loaded_section =
+          static_cast<ELFSectionBits<Bitwidth> *>(
+              mObject->getSectionByIndex(i));
+      if (loaded_section != NULL) {
+        section.sh_addr = static_cast<Addr>(
+            reinterpret_cast<uintptr_t>(loaded_section->getBuffer()));
       }
+      section.sh_type = llvm::ELF::SHT_NOBITS;
+      section.sh_offset = 0;
+    } else if (section.sh_type != llvm::ELF::SHT_NULL) {
+      // Relocations of the loaded sections. They're applied already.
+      section.sh_type = llvm::ELF::SHT_NULL;
+      section.sh_offset = 0;
+      section.sh_size = 0;
     }
   }
 
-  return true;
+  pDebugImgSize = image_size;
+  return image;
 }
 
-void *ELFObjectLoaderImpl::getSymbolAddress(const char *pName) const {
+template <unsigned Bitwidth>
+void *ELFObjectLoaderImpl<Bitwidth>::getSymbolAddress(const char *pName) const {
   if (mSymTab == NULL) {
     return NULL;
   }
 
-  const ELFSymbol<32> *symbol = mSymTab->getByName(pName);
+  const ELFSymbol<Bitwidth> *symbol = lookupSymbol(pName);
   if (symbol == NULL) {
     ALOGV("Request symbol '%s' is not found in the object!", pName);
     return NULL;
@@ -114,12 +313,13 @@ void *ELFObjectLoaderImpl::getSymbolAddress(const char *pName) const {
                             /* autoAlloc */false);
 }
 
-size_t ELFObjectLoaderImpl::getSymbolSize(const char *pName) const {
+template <unsigned Bitwidth>
+size_t ELFObjectLoaderImpl<Bitwidth>::getSymbolSize(const char *pName) const {
   if (mSymTab == NULL) {
     return 0;
   }
 
-  const ELFSymbol<32> *symbol = mSymTab->getByName(pName);
+  const ELFSymbol<Bitwidth> *symbol = lookupSymbol(pName);
 
   if (symbol == NULL) {
     ALOGV("Request symbol '%s' is not found in the object!", pName);
@@ -130,9 +330,74 @@ size_t ELFObjectLoaderImpl::getSymbolSize(const char *pName) const {
 
 }
 
-bool
-ELFObjectLoaderImpl::getSymbolNameList(android::Vector<const char *>& pNameList,
-                                       ObjectLoader::SymbolType pType) const {
+template <unsigned Bitwidth>
+void ELFObjectLoaderImpl<Bitwidth>::getSymbolAddresses(
+    const android::Vector<const char *> &pNames, const char *pSuffix,
+    android::Vector<void *> &pAddrs) const {
+  unsigned machine = mObject->getHeader()->getMachine();
+  llvm::SmallString<64> name;
+
+  pAddrs.setCapacity(pAddrs.size() + pNames.size());
+  for (size_t i = 0, e = pNames.size(); i != e; i++) {
+    const ELFSymbol<Bitwidth> *symbol = NULL;
+
+    if (mSymTab != NULL) {
+      if (pSuffix != NULL) {
+        name = pNames[i];
+        name += pSuffix;
+        symbol = lookupSymbol(name.str());
+      } else {
+        symbol = lookupSymbol(pNames[i]);
+      }
+    }
+
+    pAddrs.push_back((symbol != NULL) ?
+                         symbol->getAddress(machine, /* autoAlloc */false) :
+                         NULL);
+  }
+}
+
+template <unsigned Bitwidth>
+void *ELFObjectLoaderImpl<Bitwidth>::getSectionAddress(unsigned pIndex) const {
+  if ((pIndex == llvm::ELF::SHN_UNDEF) ||
+      (pIndex >= mObject->getHeader()->getSectionHeaderNum())) {
+    return NULL;
+  }
+
+  // Like createDebugImage(), only the allocated sections have a buffer.
+  const ELFSectionHeader<Bitwidth> *section_header =
+      (*mObject->getSectionHeaderTable())[pIndex];
+  if ((section_header == NULL) ||
+      !(section_header->getFlags() & llvm::ELF::SHF_ALLOC)) {
+    return NULL;
+  }
+
+  ELFSectionBits<Bitwidth> *section =
+      static_cast<ELFSectionBits<Bitwidth> *>(
+          mObject->getSectionByIndex(pIndex));
+  return ((section != NULL) ? section->getBuffer() : NULL);
+}
+
+template <unsigned Bitwidth>
+bool ELFObjectLoaderImpl<Bitwidth>::hasWritableSections() const {
+  for (size_t i = 0, e = mObject->getHeader()->getSectionHeaderNum(); i != e;
+       i++) {
+    const ELFSectionHeader<Bitwidth> *section_header =
+        (*mObject->getSectionHeaderTable())[i];
+    if ((section_header != NULL) &&
+        (section_header->getFlags() & llvm::ELF::SHF_ALLOC) &&
+        (section_header->getFlags() & llvm::ELF::SHF_WRITE) &&
+        (section_header->getSize() > 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <unsigned Bitwidth>
+bool ELFObjectLoaderImpl<Bitwidth>::getSymbolNameList(
+    android::Vector<const char *>& pNameList,
+    ObjectLoader::SymbolType pType) const {
   if (mSymTab == NULL) {
     return false;
   }
@@ -153,7 +418,7 @@ ELFObjectLoaderImpl::getSymbolNameList(android::Vector<const char *>& pNameList,
   }
 
   for (size_t i = 0, e = mSymTab->size(); i != e; i++) {
-    ELFSymbol<32> *symbol = (*mSymTab)[i];
+    ELFSymbol<Bitwidth> *symbol = (*mSymTab)[i];
     if (symbol == NULL) {
       continue;
     }
@@ -170,7 +435,15 @@ ELFObjectLoaderImpl::getSymbolNameList(android::Vector<const char *>& pNameList,
   return true;
 }
 
-ELFObjectLoaderImpl::~ELFObjectLoaderImpl() {
+template <unsigned Bitwidth>
+ELFObjectLoaderImpl<Bitwidth>::~ELFObjectLoaderImpl() {
   delete mObject;
   return;
 }
+
+namespace bcc {
+
+template class ELFObjectLoaderImpl<32>;
+template class ELFObjectLoaderImpl<64>;
+
+} // end namespace bcc
@@ -17,36 +17,71 @@
 #ifndef BCC_EXECUTION_ENGINE_ELF_OBJECT_LOADER_IMPL_H
 #define BCC_EXECUTION_ENGINE_ELF_OBJECT_LOADER_IMPL_H
 
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
 #include "ObjectLoaderImpl.h"
 
-// ELFObject and ELFSectionSymTab comes from librsloader. They're both
-// defined under global scope without a namespace enclosed.
+// ELFObject, ELFSectionSymTab and ELFSymbol comes from librsloader. They're
+// all defined under global scope without a namespace enclosed.
 template <unsigned Bitwidth>
 class ELFObject;
 
 template <unsigned Bitwidth>
 class ELFSectionSymTab;
 
+template <unsigned Bitwidth>
+class ELFSymbol;
+
 namespace bcc {
 
+// Loader of the ELF objects of class Bitwidth (32 for ELFCLASS32 and 64 for
+// ELFCLASS64.) The members are instantiated for both classes in
+// ELFObjectLoaderImpl.cpp.
+template <unsigned Bitwidth>
 class ELFObjectLoaderImpl : public ObjectLoaderImpl {
 private:
-  ELFObject<32> *mObject;
-  ELFSectionSymTab<32> *mSymTab;
+  ELFObject<Bitwidth> *mObject;
+  ELFSectionSymTab<Bitwidth> *mSymTab;
+
+  // The image given to load(), which stays valid until relocate() returns.
+  const void *mImage;
+  size_t mImageSize;
+
+  // Symbols in mSymTab keyed by their names. Built once in load() so that the
+  // queries don't have to scan mSymTab.
+  llvm::StringMap<ELFSymbol<Bitwidth> *> mSymbolIndex;
+
+  ELFSymbol<Bitwidth> *lookupSymbol(llvm::StringRef pName) const;
+
+  // Resolve the undefined symbols of the object with pResolver, once each,
+  // before relocate() applies the relocations (see relocate().)
+  void resolveUndefinedSymbols(SymbolResolverInterface &pResolver);
 
 public:
-  ELFObjectLoaderImpl() : ObjectLoaderImpl(), mObject(NULL), mSymTab(NULL) { }
+  ELFObjectLoaderImpl()
+    : ObjectLoaderImpl(), mObject(NULL), mSymTab(NULL), mImage(NULL),
+      mImageSize(0) { }
 
   virtual bool load(const void *pMem, size_t pMemSize);
 
   virtual bool relocate(SymbolResolverInterface &pResolver);
 
-  virtual bool prepareDebugImage(void *pDebugImg, size_t pDebugImgSize);
+  virtual uint8_t *createDebugImage(const void *pMem, size_t pMemSize,
+                                    size_t &pDebugImgSize) const;
 
   virtual void *getSymbolAddress(const char *pName) const;
 
   virtual size_t getSymbolSize(const char *pName) const;
 
+  virtual void getSymbolAddresses(const android::Vector<const char *> &pNames,
+                                  const char *pSuffix,
+                                  android::Vector<void *> &pAddrs) const;
+
+  virtual void *getSectionAddress(unsigned pIndex) const;
+
+  virtual bool hasWritableSections() const;
+
   virtual bool getSymbolNameList(android::Vector<const char *>& pNameList,
                                  ObjectLoader::SymbolType pType) const;
   ~ELFObjectLoaderImpl();
@@ -39,8 +39,14 @@
 #include <llvm/Support/MutexGuard.h>
 
 #include "bcc/ExecutionEngine/GDBJIT.h"
+#include "bcc/Support/Properties.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <vector>
 
 #ifdef ANDROID_ENGINEERING_BUILD
 // Path to write dump output.
@@ -81,9 +87,17 @@ class GDBJITRegistrar {
   /// A map of in-memory object files that have been registered with the GDB JIT interface.
   RegisteredObjectBufferMap ObjectBufferMap;
 
+  /// Entries of ObjectBufferMap which aren't in the descriptor list yet, in
+  /// the order of registration.
+  std::vector<jit_code_entry*> PendingEntries;
+
+  /// Number of pending entries which triggers a flush (see
+  /// setGDBRegistrationBatchSize().)
+  std::size_t BatchSize;
+
 public:
   /// Instantiates the GDB JIT service.
-  GDBJITRegistrar() : ObjectBufferMap() {}
+  GDBJITRegistrar() : ObjectBufferMap(), PendingEntries(), BatchSize(1) {}
 
   /// Unregisters each object that was previously registered with GDB, and
   /// releases all internal resources.
@@ -99,6 +113,15 @@ public:
   /// Returns true if @p Object was found in ObjectBufferMap.
   bool deregisterObject(const ObjectBuffer* Object);
 
+  /// Sets the number of pending objects at which they're handed to the
+  /// debugger. 0 defers them until flush().
+  void setBatchSize(std::size_t Size);
+
+  /// Links the pending objects into the descriptor list. The debugger is
+  /// notified only if it's attached. Otherwise, it finds them in the list
+  /// when it attaches.
+  void flush();
+
 private:
   /// Deregister the debug info for the given object file from the debugger
   /// and delete any temporary copies.  This private method does not remove
@@ -110,9 +133,10 @@ private:
 /// modify global variables.
 llvm::sys::Mutex JITDebugLock;
 
-/// Acquire the lock and do the registration.
-void NotifyGDB(jit_code_entry* JITCodeEntry) {
-  llvm::MutexGuard locked(JITDebugLock);
+/// Do the registration. JITDebugLock must be held. The debugger reads the
+/// relevant entry only when it's notified, so each entry takes a notification
+/// of its own. If @p Notify is false, the entry is only linked into the list.
+void NotifyGDB(jit_code_entry* JITCodeEntry, bool Notify) {
   __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
 
   // Insert this entry at the head of the list.
@@ -124,7 +148,9 @@ void NotifyGDB(jit_code_entry* JITCodeEntry) {
   }
   __jit_debug_descriptor.first_entry = JITCodeEntry;
   __jit_debug_descriptor.relevant_entry = JITCodeEntry;
-  __jit_debug_register_code();
+  if (Notify) {
+    __jit_debug_register_code();
+  }
 }
 
 GDBJITRegistrar* RegistrarSingleton() {
@@ -135,7 +161,13 @@ GDBJITRegistrar* RegistrarSingleton() {
     llvm::MutexGuard locked(JITDebugLock);
     // Check again to be sure another thread didn't create this while we waited
     if (sRegistrar == NULL) {
-      sRegistrar = new GDBJITRegistrar;
+      GDBJITRegistrar* Registrar = new GDBJITRegistrar;
+      // adb shell setprop debug.bcc.gdb.batch <N>
+      uint32_t BatchSize = getProperty("debug.bcc.gdb.batch");
+      if (BatchSize > 0) {
+        Registrar->setBatchSize(BatchSize);
+      }
+      sRegistrar = Registrar;
     }
   }
   return sRegistrar;
@@ -150,6 +182,30 @@ GDBJITRegistrar::~GDBJITRegistrar() {
     deregisterObjectInternal(I);
   }
   ObjectBufferMap.clear();
+  PendingEntries.clear();
+}
+
+void GDBJITRegistrar::setBatchSize(std::size_t Size) {
+  llvm::MutexGuard locked(JITDebugLock);
+  BatchSize = Size;
+  if ((BatchSize > 0) && (PendingEntries.size() >= BatchSize)) {
+    flush();
+  }
+}
+
+void GDBJITRegistrar::flush() {
+  llvm::MutexGuard locked(JITDebugLock);
+  if (PendingEntries.empty()) {
+    return;
+  }
+
+  // Without a debugger, nobody stops at __jit_debug_register_code().
+  bool Notify = isDebuggerAttached();
+  for (std::vector<jit_code_entry*>::iterator I = PendingEntries.begin(),
+       E = PendingEntries.end(); I != E; ++I) {
+    NotifyGDB(*I, Notify);
+  }
+  PendingEntries.clear();
 }
 
 void GDBJITRegistrar::registerObject(const ObjectBuffer* Object, std::size_t Size) {
@@ -167,8 +223,12 @@ void GDBJITRegistrar::registerObject(const ObjectBuffer* Object, std::size_t Siz
     JITCodeEntry->symfile_addr = Object;
     JITCodeEntry->symfile_size = Size;
 
+    llvm::MutexGuard locked(JITDebugLock);
     ObjectBufferMap[Object] = std::make_pair(Size, JITCodeEntry);
-    NotifyGDB(JITCodeEntry);
+    PendingEntries.push_back(JITCodeEntry);
+    if ((BatchSize > 0) && (PendingEntries.size() >= BatchSize)) {
+      flush();
+    }
 
 #ifdef ANDROID_ENGINEERING_BUILD
     if (0 != gDebugDumpDirectory) {
@@ -184,6 +244,7 @@ void GDBJITRegistrar::registerObject(const ObjectBuffer* Object, std::size_t Siz
 }
 
 bool GDBJITRegistrar::deregisterObject(const ObjectBuffer *Object) {
+  llvm::MutexGuard locked(JITDebugLock);
   RegisteredObjectBufferMap::iterator I = ObjectBufferMap.find(Object);
 
   if (I != ObjectBufferMap.end()) {
@@ -199,6 +260,16 @@ void GDBJITRegistrar::deregisterObjectInternal(
 
   jit_code_entry*& JITCodeEntry = I->second.second;
 
+  // The debugger hasn't seen an entry which is still pending.
+  std::vector<jit_code_entry*>::iterator Pending =
+      std::find(PendingEntries.begin(), PendingEntries.end(), JITCodeEntry);
+  if (Pending != PendingEntries.end()) {
+    PendingEntries.erase(Pending);
+    delete JITCodeEntry;
+    JITCodeEntry = NULL;
+    return;
+  }
+
   // Acquire the lock and do the unregistration.
   {
     llvm::MutexGuard locked(JITDebugLock);
@@ -221,7 +292,9 @@ void GDBJITRegistrar::deregisterObjectInternal(
 
     // Tell GDB which entry we removed, and unregister the code.
     __jit_debug_descriptor.relevant_entry = JITCodeEntry;
-    __jit_debug_register_code();
+    if (isDebuggerAttached()) {
+      __jit_debug_register_code();
+    }
   }
 
   delete JITCodeEntry;
@@ -243,3 +316,37 @@ void deregisterObjectWithGDB(const ObjectBuffer* Object) {
     Registrar->deregisterObject(Object);
   }
 }
+
+void setGDBRegistrationBatchSize(std::size_t Size) {
+  GDBJITRegistrar* Registrar = RegistrarSingleton();
+  if (Registrar) {
+    Registrar->setBatchSize(Size);
+  }
+}
+
+void flushGDBRegistrations() {
+  GDBJITRegistrar* Registrar = RegistrarSingleton();
+  if (Registrar) {
+    Registrar->flush();
+  }
+}
+
+bool isDebuggerAttached() {
+  // The debugger (if any) is the tracer of the process.
+  FILE* Status = ::fopen("/proc/self/status", "r");
+  if (Status == NULL) {
+    return false;
+  }
+
+  bool Attached = false;
+  char Line[128];
+  while (::fgets(Line, sizeof(Line), Status) != NULL) {
+    if (::strncmp(Line, "TracerPid:", 10) == 0) {
+      Attached = (::atoi(Line + 10) != 0);
+      break;
+    }
+  }
+
+  ::fclose(Status);
+  return Attached;
+}
@@ -16,20 +16,195 @@
 
 #include "bcc/ExecutionEngine/ObjectLoader.h"
 
+#include <cstring>
+
+#include <llvm/Support/ELF.h>
+
 #include <utils/FileMap.h>
 
 #include "bcc/ExecutionEngine/GDBJITRegistrar.h"
+#include "bcc/ExecutionEngine/PerfMap.h"
 #include "bcc/Support/FileBase.h"
 #include "bcc/Support/Log.h"
+#include "bcc/Support/PhaseTimer.h"
+#include "bcc/Support/Trace.h"
 
+#include "DyldObjectLoaderImpl.h"
 #include "ELFObjectLoaderImpl.h"
 
 using namespace bcc;
 
+namespace {
+
+// The ELF types of each class and the symbol index of their relocations.
+template <unsigned Bitwidth>
+struct ELFTypes;
+
+template <>
+struct ELFTypes<32> {
+  typedef llvm::ELF::Elf32_Ehdr Ehdr;
+  typedef llvm::ELF::Elf32_Shdr Shdr;
+  typedef llvm::ELF::Elf32_Sym Sym;
+  typedef llvm::ELF::Elf32_Rel Rel;
+  typedef llvm::ELF::Elf32_Rela Rela;
+  static const unsigned char Class = llvm::ELF::ELFCLASS32;
+  static uint32_t GetSymbol(uint32_t pInfo) { return (pInfo >> 8); }
+};
+
+template <>
+struct ELFTypes<64> {
+  typedef llvm::ELF::Elf64_Ehdr Ehdr;
+  typedef llvm::ELF::Elf64_Shdr Shdr;
+  typedef llvm::ELF::Elf64_Sym Sym;
+  typedef llvm::ELF::Elf64_Rel Rel;
+  typedef llvm::ELF::Elf64_Rela Rela;
+  static const unsigned char Class = llvm::ELF::ELFCLASS64;
+  static uint32_t GetSymbol(uint64_t pInfo) { return (pInfo >> 32); }
+};
+
+template <unsigned Bitwidth>
+bool GetUndefinedSymbols(const uint8_t *pImage, size_t pImageSize,
+                         android::Vector<const char *> &pNames) {
+  typedef ELFTypes<Bitwidth> Types;
+  typedef typename Types::Ehdr Ehdr;
+  typedef typename Types::Shdr Shdr;
+  typedef typename Types::Sym Sym;
+
+  if (pImageSize < sizeof(Ehdr)) {
+    return false;
+  }
+
+  const Ehdr *elf_header = reinterpret_cast<const Ehdr *>(pImage);
+  if ((::memcmp(elf_header->e_ident, llvm::ELF::ElfMagic,
+                ::strlen(llvm::ELF::ElfMagic)) != 0) ||
+      (elf_header->e_ident[llvm::ELF::EI_CLASS] != Types::Class) ||
+      (elf_header->e_type != llvm::ELF::ET_REL) ||
+      (elf_header->e_shentsize != sizeof(Shdr)) ||
+      (elf_header->e_shoff > pImageSize) ||
+      ((pImageSize - elf_header->e_shoff) / sizeof(Shdr) <
+          elf_header->e_shnum)) {
+    return false;
+  }
+
+  const unsigned num_sections = elf_header->e_shnum;
+  const Shdr *sections =
+      reinterpret_cast<const Shdr *>(pImage + elf_header->e_shoff);
+
+#define SECTION_IN_RANGE(_shdr) \
+    (((_shdr).sh_offset <= pImageSize) && \
+     ((_shdr).sh_size <= (pImageSize - (_shdr).sh_offset)))
+
+  // The symbol table, which all the relocation sections refer to.
+  const Shdr *symtab = NULL;
+  for (unsigned i = 0; i < num_sections; i++) {
+    if (sections[i].sh_type == llvm::ELF::SHT_SYMTAB) {
+      symtab = &sections[i];
+      break;
+    }
+  }
+  if (symtab == NULL) {
+    return true;
+  }
+  if ((symtab->sh_link >= num_sections) ||
+      (symtab->sh_entsize != sizeof(Sym)) ||
+      !SECTION_IN_RANGE(*symtab) ||
+      !SECTION_IN_RANGE(sections[symtab->sh_link])) {
+    return false;
+  }
+
+  const Shdr &strtab = sections[symtab->sh_link];
+  const char *strings =
+      reinterpret_cast<const char *>(pImage + strtab.sh_offset);
+  const Sym *symbols = reinterpret_cast<const Sym *>(pImage +
+                                                     symtab->sh_offset);
+  size_t num_symbols = symtab->sh_size / sizeof(Sym);
+  android::Vector<bool> seen;
+  seen.insertAt(false, 0, num_symbols);
+
+  for (unsigned i = 0; i < num_sections; i++) {
+    const Shdr &section = sections[i];
+    bool is_rela = (section.sh_type == llvm::ELF::SHT_RELA);
+    if (!is_rela && (section.sh_type != llvm::ELF::SHT_REL)) {
+      continue;
+    }
+    // Only the sections that are loaded are relocated.
+    if ((section.sh_info >= num_sections) ||
+        !(sections[section.sh_info].sh_flags & llvm::ELF::SHF_ALLOC)) {
+      continue;
+    }
+    size_t entry_size = (is_rela ? sizeof(typename Types::Rela) :
+                                   sizeof(typename Types::Rel));
+    if ((section.sh_entsize != entry_size) || !SECTION_IN_RANGE(section)) {
+      return false;
+    }
+
+    for (size_t j = 0, e = section.sh_size / entry_size; j != e; j++) {
+      // r_info is at the same place in Rel and Rela.
+      const typename Types::Rel *rel =
+          reinterpret_cast<const typename Types::Rel *>(
+              pImage + section.sh_offset + j * entry_size);
+      uint32_t index = Types::GetSymbol(rel->r_info);
+      if ((index == 0) || (index >= num_symbols) || seen[index]) {
+        continue;
+      }
+      seen.editItemAt(index) = true;
+
+      const Sym &symbol = symbols[index];
+      if ((symbol.st_shndx != llvm::ELF::SHN_UNDEF) ||
+          (symbol.st_name >= strtab.sh_size)) {
+        continue;
+      }
+      const char *name = strings + symbol.st_name;
+      if (::strnlen(name, strtab.sh_size - symbol.st_name) ==
+              (strtab.sh_size - symbol.st_name)) {
+        // Not terminated.
+        return false;
+      }
+      pNames.push(name);
+    }
+  }
+
+#undef SECTION_IN_RANGE
+
+  return true;
+}
+
+} // end anonymous namespace
+
+bool ObjectLoader::GetUndefinedSymbols(const void *pMem, size_t pMemSize,
+                                       android::Vector<const char *> &pNames) {
+  const uint8_t *image = reinterpret_cast<const uint8_t *>(pMem);
+  if ((image == NULL) || (pMemSize < llvm::ELF::EI_NIDENT)) {
+    return false;
+  }
+
+  switch (image[llvm::ELF::EI_CLASS]) {
+    case llvm::ELF::ELFCLASS32: {
+      return ::GetUndefinedSymbols<32>(image, pMemSize, pNames);
+    }
+    case llvm::ELF::ELFCLASS64: {
+      return ::GetUndefinedSymbols<64>(image, pMemSize, pNames);
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
 ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
                                  const char *pName,
                                  SymbolResolverInterface &pResolver,
                                  bool pEnableGDBDebug) {
+  return Load(pMemStart, pMemSize, pName, pResolver, pEnableGDBDebug,
+              /* pDebugSource */NULL);
+}
+
+ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
+                                 const char *pName,
+                                 SymbolResolverInterface &pResolver,
+                                 bool pEnableGDBDebug,
+                                 android::FileMap *pDebugSource) {
+  TraceSection trace("Object load", pName);
   ObjectLoader *result = NULL;
 
   // Check parameters.
@@ -46,52 +221,84 @@ ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
     goto bail;
   }
 
-  // Currently, only ELF object loader is supported. Therefore, there's no codes
-  // to detect the object file type and to select the one appropriated. Directly
-  // try out the ELF object loader.
-  result->mImpl = new (std::nothrow) ELFObjectLoaderImpl();
+  // Currently, only ELF object loader is supported. The ELF class in e_ident
+  // selects the one appropriated.
+  if ((pMemSize < llvm::ELF::EI_NIDENT) ||
+      (::memcmp(pMemStart, llvm::ELF::ElfMagic, 4) != 0)) {
+    ALOGE("%s is not an ELF object!", pName);
+    goto bail;
+  }
+
+  switch (reinterpret_cast<const uint8_t *>(pMemStart)[llvm::ELF::EI_CLASS]) {
+    case llvm::ELF::ELFCLASS32: {
+      result->mImpl = new (std::nothrow) ELFObjectLoaderImpl<32>();
+      break;
+    }
+    case llvm::ELF::ELFCLASS64: {
+      result->mImpl = new (std::nothrow) ELFObjectLoaderImpl<64>();
+      break;
+    }
+    default: {
+      ALOGE("Unsupported ELF class of %s! (%u)", pName,
+            reinterpret_cast<const uint8_t *>(pMemStart)[llvm::ELF::EI_CLASS]);
+      goto bail;
+    }
+  }
   if (result->mImpl == NULL) {
     ALOGE("Out of memory when create ELF object loader for %s", pName);
     goto bail;
   }
 
   // Load the object file.
-  if (!result->mImpl->load(pMemStart, pMemSize)) {
-    ALOGE("Failed to load %s!", pName);
-    goto bail;
+  {
+    TraceSection load_trace("Section load", pName);
+    if (!result->mImpl->load(pMemStart, pMemSize)) {
+      ALOGE("Failed to load %s!", pName);
+      goto bail;
+    }
   }
 
   // Perform relocation.
-  if (!result->mImpl->relocate(pResolver)) {
-    ALOGE("Error occurred when performs relocation on %s!", pName);
-    goto bail;
+  {
+    PhaseTimer timer(kPhaseRelocation, pName);
+    if (!result->mImpl->relocate(pResolver)) {
+      ALOGE("Error occurred when performs relocation on %s!", pName);
+      goto bail;
+    }
   }
 
   // GDB debugging is enabled. Note that error occurrs during the setup of
   // debugging won't failed the object load. Only a warning is issued to notify
   // that the debugging is disabled due to the failure.
   if (pEnableGDBDebug) {
+    TraceSection gdb_trace("GDB registration", pName);
     // GDB's JIT debugging requires the source object file corresponded to the
     // process image desired to debug with. And some fields in the object file
     // must be updated to record the runtime information after it's loaded into
-    // memory. For example, GDB's JIT debugging requires an ELF file with the
-    // value of sh_addr in the section header to be the memory address that the
-    // section lives in the process image. Therefore, a writable memory with its
-    // contents initialized to the contents of pFile is created.
-    result->mDebugImage = new (std::nothrow) uint8_t [ pMemSize ];
-    if (result->mDebugImage != NULL) {
-      ::memcpy(result->mDebugImage, pMemStart, pMemSize);
-      if (!result->mImpl->prepareDebugImage(result->mDebugImage, pMemSize)) {
-        ALOGW("GDB debug for %s is enabled by the user but won't work due to "
-              "failure debug image preparation!", pName);
-      } else {
-        registerObjectWithGDB(
-            reinterpret_cast<const ObjectBuffer *>(result->mDebugImage),
-            pMemSize);
-      }
+    // memory (e.g., sh_addr in the section header has to be the memory address
+    // that the section lives in the process image.) The debug image is a copy
+    // of the headers and the debug information only. It's built when the
+    // object gets registered if the object is still mapped at that point.
+    if (pDebugSource != NULL) {
+      pDebugSource->acquire();
+      result->mDebugSource = pDebugSource;
+    } else {
+      result->mDebugImage =
+          result->mImpl->createDebugImage(pMemStart, pMemSize,
+                                          result->mDebugImageSize);
+    }
+
+    if ((result->mDebugSource == NULL) && (result->mDebugImage == NULL)) {
+      ALOGW("GDB debug for %s is enabled by the user but won't work due to "
+            "failure debug image preparation!", pName);
+    } else if (isDebuggerAttached()) {
+      result->registerWithDebugger();
     }
   }
 
+  // The functions are at their final addresses now.
+  PerfMap::Record(*result, pName);
+
   return result;
 
 bail:
@@ -128,8 +335,10 @@ ObjectLoader *ObjectLoader::Load(FileBase &pFile,
     return NULL;
   }
 
-  // Create memory map for the input file.
-  file_map = pFile.createMap(0, file_size, /* pIsReadOnly */true);
+  // Create memory map for the input file. The sections are copied out of it
+  // in order.
+  file_map = pFile.createMap(0, file_size, /* pIsReadOnly */true,
+                             FileBase::kAccessSequential);
   if ((file_map == NULL) || pFile.hasError())  {
     ALOGE("Failed to map the file %s to the memory! (%s)", input_filename,
           pFile.getErrorMessage().c_str());
@@ -138,16 +347,47 @@ ObjectLoader *ObjectLoader::Load(FileBase &pFile,
 
   // Delegate the load request.
   result = Load(file_map->getDataPtr(), file_size, input_filename, pResolver,
-                pEnableGDBDebug);
+                pEnableGDBDebug, file_map);
 
   // No whether the load is successful or not, file_map is no longer needed. On
   // success, there's a copy of the object corresponded to the pFile in the
-  // memory. Therefore, file_map can be safely released.
+  // memory. Therefore, file_map can be safely released. (The loader holds its
+  // own reference to file_map until the debug image is built, if any.)
+  //
+  // Note that librsloader allocates and copies every section it reads
+  // (including the read-only ones which never get relocated) and doesn't
+  // provide a way to adopt a caller-supplied buffer for a section. Keeping
+  // file_map alive to back those sections in place therefore buys nothing
+  // until ELFObject<>::read() learns to do so.
   file_map->release();
 
   return result;
 }
 
+ObjectLoader *ObjectLoader::LoadSharedObject(const char *pPath) {
+  ObjectLoader *result = new (std::nothrow) ObjectLoader();
+  if (result == NULL) {
+    ALOGE("Out of memory when create object loader for %s!", pPath);
+    return NULL;
+  }
+
+  DyldObjectLoaderImpl *impl = new (std::nothrow) DyldObjectLoaderImpl();
+  result->mImpl = impl;
+  if (impl == NULL) {
+    ALOGE("Out of memory when create shared object loader for %s", pPath);
+    delete result;
+    return NULL;
+  }
+
+  if (!impl->open(pPath)) {
+    ALOGE("Failed to load %s!", pPath);
+    delete result;
+    return NULL;
+  }
+
+  return result;
+}
+
 void *ObjectLoader::getSymbolAddress(const char *pName) const {
   return mImpl->getSymbolAddress(pName);
 }
@@ -156,12 +396,69 @@ size_t ObjectLoader::getSymbolSize(const char *pName) const {
   return mImpl->getSymbolSize(pName);
 }
 
+void ObjectLoader::getSymbolAddresses(
+    const android::Vector<const char *> &pNames, const char *pSuffix,
+    android::Vector<void *> &pAddrs) const {
+  mImpl->getSymbolAddresses(pNames, pSuffix, pAddrs);
+}
+
+void *ObjectLoader::getSectionAddress(unsigned pIndex) const {
+  return mImpl->getSectionAddress(pIndex);
+}
+
+bool ObjectLoader::hasWritableSections() const {
+  return mImpl->hasWritableSections();
+}
+
 bool ObjectLoader::getSymbolNameList(android::Vector<const char *>& pNameList,
                                      SymbolType pType) const {
   return mImpl->getSymbolNameList(pNameList, pType);
 }
 
+bool ObjectLoader::buildDebugImage() {
+  if (mDebugImage != NULL) {
+    return true;
+  }
+
+  if (mDebugSource == NULL) {
+    return false;
+  }
+
+  mDebugImage = mImpl->createDebugImage(mDebugSource->getDataPtr(),
+                                        mDebugSource->getDataLength(),
+                                        mDebugImageSize);
+
+  // The source is only needed to build the image.
+  mDebugSource->release();
+  mDebugSource = NULL;
+
+  return (mDebugImage != NULL);
+}
+
+bool ObjectLoader::registerWithDebugger() {
+  if (mIsDebugImageRegistered) {
+    return true;
+  }
+
+  if (!buildDebugImage()) {
+    return false;
+  }
+
+  registerObjectWithGDB(reinterpret_cast<const ObjectBuffer *>(mDebugImage),
+                        mDebugImageSize);
+  mIsDebugImageRegistered = true;
+  return true;
+}
+
 ObjectLoader::~ObjectLoader() {
+  // GDB must not read the image after it's gone.
+  if (mIsDebugImageRegistered) {
+    deregisterObjectWithGDB(
+        reinterpret_cast<const ObjectBuffer *>(mDebugImage));
+  }
+  if (mDebugSource != NULL) {
+    mDebugSource->release();
+  }
   delete mImpl;
-  delete [] reinterpret_cast<uint8_t *>(mDebugImage);
+  delete [] mDebugImage;
 }
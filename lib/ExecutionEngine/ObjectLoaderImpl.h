@@ -17,6 +17,8 @@
 #ifndef OBJECT_LOADER_IMPL_H
 #define OBJECT_LOADER_IMPL_H
 
+#include <stdint.h>
+
 #include <cstring>
 
 #include "bcc/ExecutionEngine/ObjectLoader.h"
@@ -36,12 +38,27 @@ public:
 
   virtual bool relocate(SymbolResolverInterface &pResolver) = 0;
 
-  virtual bool prepareDebugImage(void *pDebugImg, size_t pDebugImgSize) = 0;
+  // Return an object file with the debug information of the pMemSize bytes of
+  // object at pMem (which was given to load()) for GDB's JIT interface, to be
+  // freed with delete []. Only the headers and the sections which aren't
+  // loaded are copied. The addresses of the others are set to where they are
+  // loaded. pDebugImgSize is set to the size of the result. Return NULL on
+  // error.
+  virtual uint8_t *createDebugImage(const void *pMem, size_t pMemSize,
+                                    size_t &pDebugImgSize) const = 0;
 
   virtual void *getSymbolAddress(const char *pName) const = 0;
 
   virtual size_t getSymbolSize(const char *pName) const = 0;
 
+  virtual void getSymbolAddresses(const android::Vector<const char *> &pNames,
+                                  const char *pSuffix,
+                                  android::Vector<void *> &pAddrs) const = 0;
+
+  virtual void *getSectionAddress(unsigned pIndex) const = 0;
+
+  virtual bool hasWritableSections() const = 0;
+
   virtual bool getSymbolNameList(android::Vector<const char *>& pNameList,
                                  ObjectLoader::SymbolType pType) const = 0;
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/ExecutionEngine/PerfMap.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+
+#include "bcc/ExecutionEngine/ObjectLoader.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/Properties.h"
+
+using namespace bcc;
+
+namespace {
+
+#ifdef HAVE_ANDROID_OS
+const char PerfMapDir[] = "/data/local/tmp";
+#else
+const char PerfMapDir[] = "/tmp";
+#endif
+
+llvm::sys::Mutex gLock;
+
+// Read from the property on the first IsEnabled() unless SetEnabled() has
+// been called.
+bool gInitialized = false;
+bool gEnabled = false;
+
+// Opened by the first Record(). Never closed.
+FILE *gMapFile = NULL;
+bool gOpenFailed = false;
+
+FILE *GetMapFile() {
+  if ((gMapFile == NULL) && !gOpenFailed) {
+    char path[64];
+    ::snprintf(path, sizeof(path), "%s/perf-%d.map", PerfMapDir,
+               static_cast<int>(::getpid()));
+    gMapFile = ::fopen(path, "a");
+    if (gMapFile == NULL) {
+      ALOGW("Unable to open %s for the perf map! (%s)", path,
+            ::strerror(errno));
+      gOpenFailed = true;
+    }
+  }
+  return gMapFile;
+}
+
+} // end anonymous namespace
+
+void PerfMap::SetEnabled(bool pEnable) {
+  llvm::MutexGuard locked(gLock);
+  gEnabled = pEnable;
+  gInitialized = true;
+}
+
+bool PerfMap::IsEnabled() {
+  llvm::MutexGuard locked(gLock);
+  if (!gInitialized) {
+    // adb shell setprop debug.bcc.perfmap 1
+    gEnabled = (getProperty("debug.bcc.perfmap") != 0);
+    gInitialized = true;
+  }
+  return gEnabled;
+}
+
+void PerfMap::Record(const ObjectLoader &pLoader, const char *pName) {
+  if (!IsEnabled()) {
+    return;
+  }
+
+  android::Vector<const char *> functions;
+  if (!pLoader.getSymbolNameList(functions, ObjectLoader::kFunctionType)) {
+    return;
+  }
+
+  if (pName == NULL) {
+    pName = "(unknown)";
+  }
+
+  llvm::MutexGuard locked(gLock);
+  FILE *map_file = GetMapFile();
+  if (map_file == NULL) {
+    return;
+  }
+
+  for (size_t i = 0, e = functions.size(); i != e; i++) {
+    void *address = pLoader.getSymbolAddress(functions[i]);
+    size_t size = pLoader.getSymbolSize(functions[i]);
+    if ((address == NULL) || (size == 0)) {
+      continue;
+    }
+    ::fprintf(map_file, "%lx %lx %s [%s]\n",
+              static_cast<unsigned long>(reinterpret_cast<uintptr_t>(address)),
+              static_cast<unsigned long>(size), functions[i], pName);
+  }
+
+  // The profiler may read the file at any time.
+  ::fflush(map_file);
+}
@@ -16,13 +16,26 @@
 
 #include "bcc/ExecutionEngine/SymbolResolverProxy.h"
 
+#include <llvm/Support/MutexGuard.h>
+
 using namespace bcc;
 
 void *SymbolResolverProxy::getAddress(const char *pName) {
+  llvm::MutexGuard locked(mLock);
+
+  llvm::StringMap<void *>::const_iterator memo = mMemo.find(pName);
+  if (memo != mMemo.end()) {
+    mNumHits++;
+    return memo->getValue();
+  }
+
+  mNumMisses++;
+
   // Search the address of the symbol by following the chain of resolvers.
   for (size_t i = 0; i < mChain.size(); i++) {
     void *addr = mChain[i]->getAddress(pName);
     if (addr != NULL) {
+      mMemo[pName] = addr;
       return addr;
     }
   }
@@ -31,5 +44,42 @@ void *SymbolResolverProxy::getAddress(const char *pName) {
 }
 
 void SymbolResolverProxy::chainResolver(SymbolResolverInterface &pResolver) {
+  llvm::MutexGuard locked(mLock);
   mChain.push_back(&pResolver);
+  mMemo.clear();
+}
+
+void SymbolResolverProxy::invalidate() {
+  llvm::MutexGuard locked(mLock);
+  mMemo.clear();
+}
+
+unsigned SymbolResolverProxy::getNumHits() {
+  llvm::MutexGuard locked(mLock);
+  return mNumHits;
+}
+
+unsigned SymbolResolverProxy::getNumMisses() {
+  llvm::MutexGuard locked(mLock);
+  return mNumMisses;
+}
+
+void SymbolResolverProxy::setIndexedSymbols(uint32_t pVersion,
+                                            const char *const *pNames,
+                                            void *const *pAddresses,
+                                            size_t pNumSymbols) {
+  mIndexIDs.clear();
+  for (size_t i = 0; i < pNumSymbols; i++) {
+    // The first one wins.
+    mIndexIDs.GetOrCreateValue(pNames[i], static_cast<uint32_t>(i));
+  }
+  mIndexVersion = pVersion;
+  mIndexNames = pNames;
+  mIndexAddresses = pAddresses;
+  mNumIndexed = pNumSymbols;
+}
+
+uint32_t SymbolResolverProxy::getSymbolID(const char *pName) const {
+  llvm::StringMap<uint32_t>::const_iterator id = mIndexIDs.find(pName);
+  return ((id != mIndexIDs.end()) ? id->getValue() : InvalidSymbolID);
 }
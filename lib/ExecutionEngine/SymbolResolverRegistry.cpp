@@ -0,0 +1,156 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/ExecutionEngine/SymbolResolverRegistry.h"
+
+#include <new>
+
+#include <llvm/Support/MutexGuard.h>
+
+#include "bcc/ExecutionEngine/CompilerRTSymbolResolver.h"
+#include "bcc/ExecutionEngine/SymbolResolvers.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+//===----------------------------------------------------------------------===//
+// SharedSymbolTable
+//===----------------------------------------------------------------------===//
+SharedSymbolTable::~SharedSymbolTable() {
+  delete mResolver;
+}
+
+void *SharedSymbolTable::getAddress(const char *pName) {
+  llvm::MutexGuard locked(mLock);
+
+  llvm::StringMap<void *>::const_iterator memo = mMemo.find(pName);
+  if (memo != mMemo.end()) {
+    return memo->getValue();
+  }
+
+  void *addr = mResolver->getAddress(pName);
+  if (addr != NULL) {
+    mMemo[pName] = addr;
+  }
+  return addr;
+}
+
+//===----------------------------------------------------------------------===//
+// SymbolResolverRegistry
+//===----------------------------------------------------------------------===//
+SymbolResolverRegistry &SymbolResolverRegistry::GetInstance() {
+  // Leaked on purpose: the drivers may outlive the static destructors.
+  static SymbolResolverRegistry *instance = new SymbolResolverRegistry();
+  return *instance;
+}
+
+SharedSymbolTable *SymbolResolverRegistry::acquireCompilerRT() {
+  llvm::MutexGuard locked(mLock);
+
+  if (mCompilerRT == NULL) {
+    CompilerRTSymbolResolver *resolver =
+        new (std::nothrow) CompilerRTSymbolResolver();
+    if (resolver == NULL) {
+      ALOGE("Out of memory when create the compiler_rt resolver!");
+      return NULL;
+    }
+    if (resolver->hasError()) {
+      ALOGE("%s", resolver->getError());
+      delete resolver;
+      return NULL;
+    }
+
+    mCompilerRT = new (std::nothrow) SharedSymbolTable(resolver);
+    if (mCompilerRT == NULL) {
+      ALOGE("Out of memory when create the compiler_rt resolver!");
+      delete resolver;
+      return NULL;
+    }
+  }
+
+  mCompilerRT->mRefCount++;
+  return mCompilerRT;
+}
+
+SharedSymbolTable *
+SymbolResolverRegistry::acquireLookupFunction(LookupFunctionTy pLookupFunc,
+                                              void *pContext) {
+  llvm::MutexGuard locked(mLock);
+
+  std::pair<LookupFunctionTy, void *> key(pLookupFunc, pContext);
+  LookupTableMapTy::iterator it = mLookupTables.find(key);
+  if (it != mLookupTables.end()) {
+    it->second->mRefCount++;
+    return it->second;
+  }
+
+  LookupFunctionSymbolResolver<void *> *resolver =
+      new (std::nothrow) LookupFunctionSymbolResolver<void *>(pLookupFunc,
+                                                              pContext);
+  SharedSymbolTable *table = NULL;
+  if (resolver != NULL) {
+    table = new (std::nothrow) SharedSymbolTable(resolver);
+  }
+  if (table == NULL) {
+    ALOGE("Out of memory when create the resolver of the RS runtime!");
+    delete resolver;
+    return NULL;
+  }
+
+  table->mRefCount++;
+  mLookupTables[key] = table;
+  return table;
+}
+
+void SymbolResolverRegistry::release(SharedSymbolTable *pTable) {
+  if (pTable == NULL) {
+    return;
+  }
+
+  llvm::MutexGuard locked(mLock);
+  if (--pTable->mRefCount > 0) {
+    return;
+  }
+
+  if (pTable == mCompilerRT) {
+    mCompilerRT = NULL;
+  } else {
+    for (LookupTableMapTy::iterator it = mLookupTables.begin(),
+             e = mLookupTables.end(); it != e; ++it) {
+      if (it->second == pTable) {
+        mLookupTables.erase(it);
+        break;
+      }
+    }
+  }
+  delete pTable;
+}
+
+//===----------------------------------------------------------------------===//
+// SharedLookupFunctionSymbolResolver
+//===----------------------------------------------------------------------===//
+void SharedLookupFunctionSymbolResolver::rebind() {
+  SymbolResolverRegistry &registry = SymbolResolverRegistry::GetInstance();
+  registry.release(mTable);
+  mTable = NULL;
+  if (mLookupFunc != NULL) {
+    mTable = registry.acquireLookupFunction(mLookupFunc, mContext);
+  }
+}
+
+SharedLookupFunctionSymbolResolver::~SharedLookupFunctionSymbolResolver() {
+  SymbolResolverRegistry::GetInstance().release(mTable);
+}
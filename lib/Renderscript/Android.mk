@@ -22,16 +22,30 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_renderscript_SRC_FILES := \
+  RSBatchBuild.cpp \
+  RSCacheContainer.cpp \
+  RSCacheManager.cpp \
   RSCompiler.cpp \
   RSCompilerDriver.cpp \
+  RSCompilerThread.cpp \
   RSEmbedInfo.cpp \
   RSExecutable.cpp \
+  RSExecutableCache.cpp \
+  RSExportVarBlock.cpp \
+  RSExternalTable.cpp \
+  RSForEachCost.cpp \
   RSForEachExpand.cpp \
   RSInfo.cpp \
   RSInfoExtractor.cpp \
   RSInfoReader.cpp \
   RSInfoWriter.cpp \
-  RSScript.cpp
+  RSInlineAccessors.cpp \
+  RSKernelCounters.cpp \
+  RSPreciseFP.cpp \
+  RSProfile.cpp \
+  RSProfileInstrument.cpp \
+  RSScript.cpp \
+  RSSpecializeExports.cpp
 
 #=====================================================================
 # Device Static Library: libbccRenderscript
@@ -0,0 +1,350 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSCompilerDriver.h"
+
+#include <llvm/Support/Threading.h>
+
+#include "bcc/BCCContext.h"
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Initialization.h"
+#include "bcc/Support/Log.h"
+
+#include <utils/Condition.h>
+#include <utils/List.h>
+#include <utils/Mutex.h>
+#include <utils/StrongPointer.h>
+#include <utils/Thread.h>
+
+using namespace bcc;
+
+namespace {
+
+// State shared among the workers of a batch.
+struct BatchState {
+  android::Vector<RSBatchBuildItem> &mItems;
+  const char *mRuntimePath;
+  RSDriverSetupFunction mSetup;
+  void *mSetupUserData;
+  bool mDumpIR;
+
+  android::Mutex mLock;
+  // Index of the next item to build.
+  size_t mNext;
+
+  BatchState(android::Vector<RSBatchBuildItem> &pItems,
+             const char *pRuntimePath, RSDriverSetupFunction pSetup,
+             void *pSetupUserData, bool pDumpIR)
+    : mItems(pItems), mRuntimePath(pRuntimePath), mSetup(pSetup),
+      mSetupUserData(pSetupUserData), mDumpIR(pDumpIR), mNext(0) { }
+
+  // Return false if there's no item left.
+  bool takeNext(size_t &pIdx) {
+    android::Mutex::Autolock locked(mLock);
+    if (mNext >= mItems.size()) {
+      return false;
+    }
+    pIdx = mNext++;
+    return true;
+  }
+};
+
+// Build the items of the batch until there's none left.
+void RunBatchWorker(BatchState &pState) {
+  BCCContext context;
+  RSCompilerDriver driver;
+  size_t idx;
+
+  if ((pState.mSetup != NULL) &&
+      !pState.mSetup(driver, pState.mSetupUserData)) {
+    ALOGE("Failed to setup the compiler driver for batch build!");
+    // Items are failed by default. Still take them off so that no other worker
+    // waits for them.
+    while (pState.takeNext(idx)) { }
+    return;
+  }
+
+  while (pState.takeNext(idx)) {
+    RSBatchBuildItem &item = pState.mItems.editItemAt(idx);
+    item.success = driver.build(context, item.cacheDir, item.resName,
+                                item.bitcode, item.bitcodeSize,
+                                pState.mRuntimePath, NULL, pState.mDumpIR);
+  }
+}
+
+class BatchWorkerThread : public android::Thread {
+private:
+  BatchState &mState;
+
+  virtual bool threadLoop() {
+    RunBatchWorker(mState);
+    // Run only once.
+    return false;
+  }
+
+public:
+  BatchWorkerThread(BatchState &pState)
+    : android::Thread(/* canCallJava */false), mState(pState) { }
+};
+
+// Run pFunction(pData) once.
+class PipelineStageThread : public android::Thread {
+private:
+  void (*mFunction)(void *);
+  void *mData;
+
+  virtual bool threadLoop() {
+    mFunction(mData);
+    // Run only once.
+    return false;
+  }
+
+public:
+  PipelineStageThread(void (*pFunction)(void *), void *pData)
+    : android::Thread(/* canCallJava */false), mFunction(pFunction),
+      mData(pData) { }
+};
+
+} // end anonymous namespace
+
+// State shared by the two stages of a pipeline.
+struct RSCompilerDriver::PipelineState {
+  // A script parsed by the front stage, waiting for the back stage.
+  struct Parsed {
+    size_t mIdx;
+    BCCContext *mContext;
+    PendingBuild *mBuild;
+  };
+
+  android::Vector<RSBatchBuildItem> &mItems;
+  const char *mRuntimePath;
+  bool mDumpIR;
+  RSCompilerDriver &mDriver;
+
+  android::Mutex mLock;
+  android::Condition mChanged;
+  // The contexts not holding a script. The front stage waits for one.
+  android::Vector<BCCContext *> mIdleContexts;
+  android::List<Parsed> mParsed;
+  bool mFrontDone;
+
+  PipelineState(android::Vector<RSBatchBuildItem> &pItems,
+                const char *pRuntimePath, bool pDumpIR,
+                RSCompilerDriver &pDriver)
+    : mItems(pItems), mRuntimePath(pRuntimePath), mDumpIR(pDumpIR),
+      mDriver(pDriver), mFrontDone(false) { }
+
+  // Take an idle context, waiting for one if necessary.
+  BCCContext *takeContext() {
+    android::Mutex::Autolock locked(mLock);
+    while (mIdleContexts.isEmpty()) {
+      mChanged.wait(mLock);
+    }
+    BCCContext *context = mIdleContexts.top();
+    mIdleContexts.pop();
+    return context;
+  }
+
+  void releaseContext(BCCContext *pContext) {
+    android::Mutex::Autolock locked(mLock);
+    mIdleContexts.push(pContext);
+    mChanged.broadcast();
+  }
+};
+
+void RSCompilerDriver::RunPipelineFrontStage(void *pState) {
+  PipelineState &state = *static_cast<PipelineState *>(pState);
+
+  for (size_t i = 0, e = state.mItems.size(); i != e; i++) {
+    const RSBatchBuildItem &item = state.mItems[i];
+    BCCContext *context = state.takeContext();
+    PendingBuild *build =
+        state.mDriver.beginBuild(*context, item.cacheDir, item.resName,
+                                 item.bitcode, item.bitcodeSize,
+                                 state.mRuntimePath, NULL, state.mDumpIR,
+                                 /* pTier0 */false, /* pLegacyTargetAPI */0,
+                                 /* pDeviceCacheDir */NULL,
+                                 /* pConstants */NULL);
+    if (build == NULL) {
+      // The item stays failed.
+      state.releaseContext(context);
+      continue;
+    }
+
+    PipelineState::Parsed parsed;
+    parsed.mIdx = i;
+    parsed.mContext = context;
+    parsed.mBuild = build;
+
+    android::Mutex::Autolock locked(state.mLock);
+    state.mParsed.push_back(parsed);
+    state.mChanged.broadcast();
+  }
+
+  android::Mutex::Autolock locked(state.mLock);
+  state.mFrontDone = true;
+  state.mChanged.broadcast();
+}
+
+bool RSCompilerDriver::BuildBatch(android::Vector<RSBatchBuildItem> &pItems,
+                                  unsigned pNumThreads,
+                                  const char *pRuntimePath,
+                                  RSDriverSetupFunction pSetup,
+                                  void *pSetupUserData, bool pDumpIR) {
+  for (size_t i = 0, e = pItems.size(); i != e; i++) {
+    pItems.editItemAt(i).success = false;
+  }
+
+  if (pNumThreads > pItems.size()) {
+    pNumThreads = pItems.size();
+  }
+
+  // Do the one-time initializations before there are threads racing for them.
+  init::InitializeDefaultTarget();
+  RSInfo::LoadBuiltInSHA1Information();
+
+  BatchState state(pItems, pRuntimePath, pSetup, pSetupUserData, pDumpIR);
+
+  android::Vector<android::sp<BatchWorkerThread> > workers;
+  if (pNumThreads > 1) {
+    if (!llvm::llvm_start_multithreaded()) {
+      ALOGW("LLVM is not built with thread support. Build the batch "
+            "serially.");
+    } else {
+      // The calling thread is a worker, too.
+      for (unsigned i = 1; i < pNumThreads; i++) {
+        android::sp<BatchWorkerThread> worker =
+            new (std::nothrow) BatchWorkerThread(state);
+        if ((worker == NULL) ||
+            (worker->run("bcc batch") != android::NO_ERROR)) {
+          ALOGW("Failed to start worker thread #%u for batch build!", i);
+          break;
+        }
+        workers.push(worker);
+      }
+    }
+  }
+
+  RunBatchWorker(state);
+
+  for (size_t i = 0, e = workers.size(); i != e; i++) {
+    workers[i]->join();
+  }
+
+  bool result = true;
+  for (size_t i = 0, e = pItems.size(); i != e; i++) {
+    if (!pItems[i].success) {
+      ALOGE("Failed to build %s in batch!", pItems[i].resName);
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+bool RSCompilerDriver::BuildPipeline(android::Vector<RSBatchBuildItem> &pItems,
+                                     const char *pRuntimePath,
+                                     RSDriverSetupFunction pSetup,
+                                     void *pSetupUserData, bool pDumpIR,
+                                     unsigned pDepth) {
+  for (size_t i = 0, e = pItems.size(); i != e; i++) {
+    pItems.editItemAt(i).success = false;
+  }
+
+  // Do the one-time initializations before there are threads racing for them.
+  init::InitializeDefaultTarget();
+  RSInfo::LoadBuiltInSHA1Information();
+
+  RSCompilerDriver driver;
+  if ((pSetup != NULL) && !pSetup(driver, pSetupUserData)) {
+    ALOGE("Failed to setup the compiler driver for pipelined build!");
+    return false;
+  }
+
+  if ((pItems.size() < 2) || !llvm::llvm_start_multithreaded()) {
+    // Nothing to overlap.
+    BCCContext context;
+    for (size_t i = 0, e = pItems.size(); i != e; i++) {
+      RSBatchBuildItem &item = pItems.editItemAt(i);
+      item.success = driver.build(context, item.cacheDir, item.resName,
+                                  item.bitcode, item.bitcodeSize,
+                                  pRuntimePath, NULL, pDumpIR);
+    }
+  } else {
+    PipelineState state(pItems, pRuntimePath, pDumpIR, driver);
+
+    // One more context than the scripts parsed ahead for the script being
+    // compiled.
+    if (pDepth < 1) {
+      pDepth = 1;
+    }
+    android::Vector<BCCContext *> contexts;
+    for (unsigned i = 0; i <= pDepth; i++) {
+      BCCContext *context = new (std::nothrow) BCCContext();
+      if (context == NULL) {
+        break;
+      }
+      contexts.push(context);
+      state.mIdleContexts.push(context);
+    }
+
+    android::sp<PipelineStageThread> front =
+        new (std::nothrow) PipelineStageThread(RunPipelineFrontStage, &state);
+    if (contexts.isEmpty() || (front == NULL) ||
+        (front->run("bcc pipeline") != android::NO_ERROR)) {
+      ALOGW("Failed to start the pipeline. Build the batch in place.");
+      RunPipelineFrontStage(&state);
+      front.clear();
+    }
+
+    // The back stage: compile the parsed scripts in order.
+    while (true) {
+      PipelineState::Parsed parsed;
+      {
+        android::Mutex::Autolock locked(state.mLock);
+        while (state.mParsed.empty() && !state.mFrontDone) {
+          state.mChanged.wait(state.mLock);
+        }
+        if (state.mParsed.empty()) {
+          break;
+        }
+        parsed = *state.mParsed.begin();
+        state.mParsed.erase(state.mParsed.begin());
+      }
+
+      pItems.editItemAt(parsed.mIdx).success =
+          driver.finishBuild(parsed.mBuild);
+      state.releaseContext(parsed.mContext);
+    }
+
+    if (front != NULL) {
+      front->join();
+    }
+    for (size_t i = 0, e = contexts.size(); i != e; i++) {
+      delete contexts[i];
+    }
+  }
+
+  bool result = true;
+  for (size_t i = 0, e = pItems.size(); i != e; i++) {
+    if (!pItems[i].success) {
+      ALOGE("Failed to build %s in pipeline!", pItems[i].resName);
+      result = false;
+    }
+  }
+
+  return result;
+}
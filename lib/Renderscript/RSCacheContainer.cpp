@@ -0,0 +1,631 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSCacheContainer.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Support/Path.h>
+
+#include <utils/FileMap.h>
+
+#include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Renderscript/RSExecutableCache.h"
+#include "bcc/Support/CPUProfile.h"
+#include "bcc/Support/CRC32C.h"
+#include "bcc/Support/CacheWriter.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/LZ4.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Check the container header at the beginning of the pSize bytes at pData.
+// Return kReadOK if the info and the object it describes are within the range.
+RSInfo::ReadStatus CheckHeader(const uint8_t *pData, size_t pSize,
+                               const char *pPath) {
+  if (pSize < sizeof(rscache::Header)) {
+    ALOGW("Corrupted RS cache container %s! (truncated header)", pPath);
+    return RSInfo::kReadCorrupted;
+  }
+
+  const rscache::Header *header =
+      reinterpret_cast<const rscache::Header *>(pData);
+
+  if ((::memcmp(header->magic, RSCACHE_MAGIC, sizeof(header->magic)) != 0) ||
+      (::memcmp(header->version, RSCACHE_VERSION,
+                sizeof(header->version)) != 0)) {
+    ALOGV("Mismatch magic or version of RS cache container %s. Treat it as a "
+          "dirty cache.", pPath);
+    return RSInfo::kReadVersionMismatch;
+  }
+
+  if ((header->headerSize != sizeof(rscache::Header)) ||
+      (header->infoOffset < header->headerSize) ||
+      (header->infoSize > pSize) ||
+      (header->infoOffset > (pSize - header->infoSize)) ||
+      (header->objectSize == 0) ||
+      (header->objectSize > pSize) ||
+      (header->objectOffset > (pSize - header->objectSize)) ||
+      ((header->objectRawSize == 0) &&
+       ((header->objectOffset % rscache::ObjectAlignment) != 0))) {
+    ALOGW("Corrupted RS cache container %s! (data out of the range)", pPath);
+    return RSInfo::kReadCorrupted;
+  }
+
+  if ((header->bindingCount > 0) &&
+      ((header->bindingOffset < header->headerSize) ||
+       (header->bindingOffset > pSize) ||
+       (header->bindingCount > ((pSize - header->bindingOffset) /
+                                    sizeof(uint32_t))))) {
+    ALOGW("Corrupted RS cache container %s! (bindings out of the range)",
+          pPath);
+    return RSInfo::kReadCorrupted;
+  }
+
+  if (header->fallbackCount == 0) {
+    return RSInfo::kReadOK;
+  }
+
+  if ((header->fallbackOffset < header->headerSize) ||
+      (header->fallbackOffset > pSize) ||
+      (header->fallbackCount > ((pSize - header->fallbackOffset) /
+                                    sizeof(rscache::FallbackObject)))) {
+    ALOGW("Corrupted RS cache container %s! (fallbacks out of the range)",
+          pPath);
+    return RSInfo::kReadCorrupted;
+  }
+
+  const rscache::FallbackObject *fallbacks =
+      reinterpret_cast<const rscache::FallbackObject *>(
+          pData + header->fallbackOffset);
+  for (uint32_t i = 0; i < header->fallbackCount; i++) {
+    if ((fallbacks[i].objectSize == 0) ||
+        (fallbacks[i].objectSize > pSize) ||
+        (fallbacks[i].objectOffset > (pSize - fallbacks[i].objectSize)) ||
+        ((fallbacks[i].objectRawSize == 0) &&
+         ((fallbacks[i].objectOffset % rscache::ObjectAlignment) != 0))) {
+      ALOGW("Corrupted RS cache container %s! (fallback #%u out of the "
+            "range)", pPath, i);
+      return RSInfo::kReadCorrupted;
+    }
+  }
+
+  return RSInfo::kReadOK;
+}
+
+// Return the first object of the container at pData (which has passed
+// CheckHeader()) that the host can run, setting pSize to its size, pRawSize
+// to its decompressed size (0 if it's stored as is), pCRC to its CRC32C and
+// pIsFallback to whether it isn't the object the info describes. Return NULL
+// if there's none.
+const uint8_t *SelectObject(const uint8_t *pData, const char *pPath,
+                            size_t &pSize, size_t &pRawSize, uint32_t &pCRC,
+                            bool &pIsFallback) {
+  const rscache::Header *header =
+      reinterpret_cast<const rscache::Header *>(pData);
+  uint32_t host_features = CPUProfile::GetHostFeatures();
+
+  pIsFallback = false;
+  if ((header->requiredFeatures & ~host_features) == 0) {
+    pSize = header->objectSize;
+    pRawSize = header->objectRawSize;
+    pCRC = header->objectCRC;
+    return (pData + header->objectOffset);
+  }
+
+  const rscache::FallbackObject *fallbacks =
+      reinterpret_cast<const rscache::FallbackObject *>(
+          pData + header->fallbackOffset);
+  for (uint32_t i = 0; i < header->fallbackCount; i++) {
+    if ((fallbacks[i].requiredFeatures & ~host_features) == 0) {
+      ALOGV("Load the fallback #%u of RS cache container %s (features: "
+            "%#x, host: %#x)", i, pPath, fallbacks[i].requiredFeatures,
+            host_features);
+      pIsFallback = true;
+      pSize = fallbacks[i].objectSize;
+      pRawSize = fallbacks[i].objectRawSize;
+      pCRC = fallbacks[i].objectCRC;
+      return (pData + fallbacks[i].objectOffset);
+    }
+  }
+
+  ALOGD("None of the objects in RS cache container %s runs on this CPU "
+        "(features: %#x, host: %#x)", pPath, header->requiredFeatures,
+        host_features);
+  return NULL;
+}
+
+// Return true if the pSize bytes at pData have the CRC32C pCRC. Log which
+// part (pWhat) of the container pPath is corrupted otherwise.
+bool CheckCRC(const uint8_t *pData, size_t pSize, uint32_t pCRC,
+              const char *pWhat, const char *pPath) {
+  if (CRC32C::Compute(pData, pSize) != pCRC) {
+    ALOGW("Corrupted RS cache container %s! (CRC mismatch of the %s)", pPath,
+          pWhat);
+    return false;
+  }
+  return true;
+}
+
+} // end anonymous namespace
+
+android::String8 RSCacheContainer::GetPath(const char *pObjPath) {
+  llvm::SmallString<80> result(pObjPath);
+  llvm::sys::path::replace_extension(result, ".rsc");
+  return android::String8(result.c_str());
+}
+
+android::String8 RSCacheContainer::GetSharedObjectPath(const char *pObjPath) {
+  llvm::SmallString<80> result(pObjPath);
+  llvm::sys::path::replace_extension(result, ".so");
+  return android::String8(result.c_str());
+}
+
+bool RSCacheContainer::Serialize(const std::string &pInfo,
+                                 const Object *pObjects, size_t pNumObjects,
+                                 std::string &pResult,
+                                 const SourceDigest *pSource,
+                                 const RuntimeBindings *pBindings,
+                                 bool pCompress) {
+  if (pNumObjects == 0) {
+    return false;
+  }
+
+  // Compress the objects first so that their stored sizes are known. A
+  // compressed object is loaded through a copy on the heap rather than from
+  // the mapped file, so it has to be worth it.
+  std::vector<Object> objects(pObjects, pObjects + pNumObjects);
+  std::vector<std::string> compressed(pNumObjects);
+  if (pCompress) {
+    for (size_t i = 0; i < pNumObjects; i++) {
+      if (objects[i].mRawSize != 0) {
+        continue;
+      }
+      size_t image_size = objects[i].mImageSize;
+      LZ4::Compress(objects[i].mImage, image_size, compressed[i]);
+      if (compressed[i].size() <= (image_size - (image_size / 8))) {
+        objects[i].mImage = compressed[i].data();
+        objects[i].mImageSize = compressed[i].size();
+        objects[i].mRawSize = image_size;
+      }
+    }
+  }
+
+  rscache::Header header;
+  std::vector<rscache::FallbackObject> fallbacks(pNumObjects - 1);
+  size_t fallbacks_size = fallbacks.size() * sizeof(rscache::FallbackObject);
+
+  ::memset(&header, 0, sizeof(header));
+  ::memcpy(header.magic, RSCACHE_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, RSCACHE_VERSION, sizeof(header.version));
+  header.headerSize = sizeof(header);
+  header.infoOffset = sizeof(header);
+  header.infoSize = pInfo.size();
+  header.infoCRC = CRC32C::Compute(pInfo.data(), pInfo.size());
+  header.requiredFeatures = objects[0].mRequiredFeatures;
+  if (pSource != NULL) {
+    header.sourceFingerprint = pSource->mFingerprint;
+    ::memcpy(header.sourceSHA1, pSource->mSHA1, SHA1_DIGEST_LENGTH);
+  }
+
+  size_t end = header.infoOffset + header.infoSize;
+  if (!fallbacks.empty()) {
+    header.fallbackCount = fallbacks.size();
+    header.fallbackOffset = end;
+    end += fallbacks_size;
+  }
+
+  size_t bindings_size = 0;
+  if ((pBindings != NULL) && (pBindings->mCount > 0)) {
+    header.bindingVersion = pBindings->mVersion;
+    header.bindingCount = pBindings->mCount;
+    header.bindingOffset = end;
+    bindings_size = pBindings->mCount * sizeof(uint32_t);
+    end += bindings_size;
+  }
+
+  // Lay the objects out first, each at the next page boundary (unless it's
+  // compressed and thus never mapped), so that the contents are appended to
+  // a buffer of the final size.
+  std::vector<size_t> offsets(pNumObjects);
+  for (size_t i = 0; i < pNumObjects; i++) {
+    offsets[i] = end;
+    if (objects[i].mRawSize == 0) {
+      offsets[i] = (end + rscache::ObjectAlignment - 1) &
+                   ~(rscache::ObjectAlignment - 1);
+    }
+    uint32_t crc = CRC32C::Compute(objects[i].mImage, objects[i].mImageSize);
+    if (i == 0) {
+      header.objectOffset = offsets[i];
+      header.objectSize = objects[i].mImageSize;
+      header.objectRawSize = objects[i].mRawSize;
+      header.objectCRC = crc;
+    } else {
+      fallbacks[i - 1].requiredFeatures = objects[i].mRequiredFeatures;
+      fallbacks[i - 1].objectOffset = offsets[i];
+      fallbacks[i - 1].objectSize = objects[i].mImageSize;
+      fallbacks[i - 1].objectRawSize = objects[i].mRawSize;
+      fallbacks[i - 1].objectCRC = crc;
+    }
+    end = offsets[i] + objects[i].mImageSize;
+  }
+
+  pResult.clear();
+  pResult.reserve(end);
+  pResult.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  pResult.append(pInfo);
+  if (!fallbacks.empty()) {
+    pResult.append(reinterpret_cast<const char *>(&fallbacks[0]),
+                   fallbacks_size);
+  }
+  if (bindings_size > 0) {
+    pResult.append(reinterpret_cast<const char *>(pBindings->mIDs),
+                   bindings_size);
+  }
+  for (size_t i = 0; i < pNumObjects; i++) {
+    // Padding.
+    pResult.resize(offsets[i], '\0');
+    pResult.append(static_cast<const char *>(objects[i].mImage),
+                   objects[i].mImageSize);
+  }
+
+  return true;
+}
+
+bool RSCacheContainer::Write(const char *pPath, RSInfo &pInfo,
+                             const void *pImage, size_t pImageSize,
+                             AtomicOutputFile::SyncMode pSync,
+                             const SourceDigest *pSource,
+                             const RuntimeBindings *pBindings) {
+  Object object;
+  object.mImage = pImage;
+  object.mImageSize = pImageSize;
+  object.mRequiredFeatures = 0;
+  object.mRawSize = 0;
+  return Write(pPath, pInfo, &object, 1, pSync, pSource, pBindings);
+}
+
+bool RSCacheContainer::Write(const char *pPath, RSInfo &pInfo,
+                             const Object *pObjects, size_t pNumObjects,
+                             AtomicOutputFile::SyncMode pSync,
+                             const SourceDigest *pSource,
+                             const RuntimeBindings *pBindings,
+                             bool pCompress) {
+  std::string info;
+  std::string contents;
+  if (!pInfo.serialize(info)) {
+    ALOGE("Cannot serialize the RS info for RS cache container %s!", pPath);
+    return false;
+  }
+  if (!Serialize(info, pObjects, pNumObjects, contents, pSource,
+                 pBindings, pCompress)) {
+    ALOGE("No object to write to the RS cache container %s!", pPath);
+    return false;
+  }
+
+  // Written in one go to a temporary file and moved to pPath once it's
+  // complete, possibly by the writer thread of CacheWriter.
+  return CacheWriter::GetInstance().write(pPath, contents, pSync);
+}
+
+bool RSCacheContainer::ReplaceInfo(const std::string &pPath,
+                                   const void *pCurrent, size_t pCurrentSize,
+                                   const std::string &pInfo,
+                                   std::string &pResult) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(pCurrent);
+  if (CheckHeader(data, pCurrentSize, pPath.c_str()) != RSInfo::kReadOK) {
+    return false;
+  }
+
+  const rscache::Header *header =
+      reinterpret_cast<const rscache::Header *>(data);
+  const rscache::FallbackObject *fallbacks =
+      reinterpret_cast<const rscache::FallbackObject *>(
+          data + header->fallbackOffset);
+
+  // The objects get their CRC again: don't bless a corrupted one.
+  if (!CheckCRC(data + header->objectOffset, header->objectSize,
+                header->objectCRC, "object", pPath.c_str())) {
+    return false;
+  }
+  for (uint32_t i = 0; i < header->fallbackCount; i++) {
+    if (!CheckCRC(data + fallbacks[i].objectOffset, fallbacks[i].objectSize,
+                  fallbacks[i].objectCRC, "fallback object", pPath.c_str())) {
+      return false;
+    }
+  }
+
+  std::vector<Object> objects(1 + header->fallbackCount);
+  objects[0].mImage = data + header->objectOffset;
+  objects[0].mImageSize = header->objectSize;
+  objects[0].mRequiredFeatures = header->requiredFeatures;
+  objects[0].mRawSize = header->objectRawSize;
+  for (uint32_t i = 0; i < header->fallbackCount; i++) {
+    objects[i + 1].mImage = data + fallbacks[i].objectOffset;
+    objects[i + 1].mImageSize = fallbacks[i].objectSize;
+    objects[i + 1].mRequiredFeatures = fallbacks[i].requiredFeatures;
+    objects[i + 1].mRawSize = fallbacks[i].objectRawSize;
+  }
+
+  SourceDigest source;
+  source.mFingerprint = header->sourceFingerprint;
+  ::memcpy(source.mSHA1, header->sourceSHA1, SHA1_DIGEST_LENGTH);
+
+  // The table is copied out of pCurrent by Serialize().
+  RuntimeBindings bindings;
+  bindings.mVersion = header->bindingVersion;
+  bindings.mIDs = reinterpret_cast<const uint32_t *>(data +
+                                                     header->bindingOffset);
+  bindings.mCount = header->bindingCount;
+
+  return Serialize(pInfo, &objects[0], objects.size(), pResult, &source,
+                   &bindings);
+}
+
+bool RSCacheContainer::UpdateInfo(const char *pPath, RSInfo &pInfo) {
+  std::string info;
+  if (!pInfo.serialize(info)) {
+    ALOGE("Cannot serialize the RS info for RS cache container %s!", pPath);
+    return false;
+  }
+
+  // The objects are copied from the container when the update is written,
+  // so the repeated updates of a container are coalesced.
+  return CacheWriter::GetInstance().update(pPath, ReplaceInfo, info,
+                                           AtomicOutputFile::kNoSync);
+}
+
+bool RSCacheContainer::ReadSourceDigest(const char *pPath,
+                                        SourceDigest &pResult) {
+  CacheWriter::GetInstance().wait(pPath);
+
+  InputFile input(pPath);
+  if (input.hasError()) {
+    return false;
+  }
+
+  rscache::Header header;
+  if ((input.read(&header, sizeof(header)) !=
+          static_cast<ssize_t>(sizeof(header))) ||
+      (::memcmp(header.magic, RSCACHE_MAGIC, sizeof(header.magic)) != 0) ||
+      (::memcmp(header.version, RSCACHE_VERSION,
+                sizeof(header.version)) != 0) ||
+      (header.headerSize != sizeof(header)) ||
+      (header.sourceFingerprint == 0)) {
+    return false;
+  }
+
+  pResult.mFingerprint = header.sourceFingerprint;
+  ::memcpy(pResult.mSHA1, header.sourceSHA1, SHA1_DIGEST_LENGTH);
+  return true;
+}
+
+RSInfo *RSCacheContainer::ReadInfo(const char *pPath) {
+  CacheWriter::GetInstance().wait(pPath);
+
+  InputFile input(pPath);
+  if (input.hasError()) {
+    return NULL;
+  }
+
+  size_t file_size = input.getSize();
+  if (input.hasError() || (file_size == 0)) {
+    return NULL;
+  }
+
+  android::FileMap *map = input.createMap(0, file_size,
+                                          /* pIsReadOnly */true);
+  if (map == NULL) {
+    return NULL;
+  }
+
+  RSInfo *info = NULL;
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  if (CheckHeader(data, file_size, pPath) == RSInfo::kReadOK) {
+    const rscache::Header *header =
+        reinterpret_cast<const rscache::Header *>(data);
+    if (CheckCRC(data + header->infoOffset, header->infoSize,
+                 header->infoCRC, "info", pPath)) {
+      info = RSInfo::ReadFromBufferUnchecked(data + header->infoOffset,
+                                             header->infoSize, pPath);
+    }
+  }
+
+  map->release();
+  return info;
+}
+
+RSExecutable *RSCacheContainer::Load(const char *pPath,
+                                     const RSInfo::DependencyTableTy &pDeps,
+                                     SymbolResolverProxy &pResolver,
+                                     const uint8_t *pCacheSHA1,
+                                     RSInfo::ReadStatus *pStatus,
+                                     const char *pSharedObjectPath) {
+  RSInfo::ReadStatus status = RSInfo::kReadIOError;
+  RSInfo *info = NULL;
+  RSExecutable *result = NULL;
+  android::FileMap *map = NULL;
+  const uint8_t *data;
+  const rscache::Header *header;
+  size_t file_size;
+  const uint8_t *object;
+  size_t object_size;
+  size_t object_raw_size = 0;
+  uint32_t object_crc = 0;
+  uint8_t *decompressed = NULL;
+  bool is_fallback = false;
+  const uint32_t *bindings = NULL;
+  size_t num_bindings = 0;
+
+  // Let the pending write of the container (if any) complete.
+  CacheWriter::GetInstance().wait(pPath);
+
+  // RSExecutable owns the file to sync the info later.
+  InputFile *input = new (std::nothrow) InputFile(pPath);
+  if ((input == NULL) || input->hasError()) {
+    if ((input != NULL) &&
+        (input->getError().value() == llvm::errc::no_such_file_or_directory)) {
+      // Not an error on the first run.
+      status = RSInfo::kReadNotFound;
+    } else {
+      ALOGE("Unable to open RS cache container %s! (%s)", pPath,
+            ((input != NULL) ? input->getErrorMessage().c_str() :
+                               "out of memory"));
+    }
+    goto bail;
+  }
+
+  file_size = input->getSize();
+  if (input->hasError() || (file_size == 0)) {
+    ALOGE("Failed to get the size of RS cache container %s! (%s)", pPath,
+          input->getErrorMessage().c_str());
+    goto bail;
+  }
+
+  // All of it is read right away: the info, then the object the loader
+  // copies. The info stays a view of the map, so don't drop the pages behind
+  // the reads as a sequential access would.
+  map = input->createMap(0, file_size, /* pIsReadOnly */true,
+                         FileBase::kAccessWillNeed);
+  if (map == NULL) {
+    ALOGE("Failed to map RS cache container %s! (%s)", pPath,
+          input->getErrorMessage().c_str());
+    goto bail;
+  }
+
+  data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  status = CheckHeader(data, file_size, pPath);
+  if (status != RSInfo::kReadOK) {
+    goto bail;
+  }
+  header = reinterpret_cast<const rscache::Header *>(data);
+
+  if (!CheckCRC(data + header->infoOffset, header->infoSize, header->infoCRC,
+                "info", pPath)) {
+    status = RSInfo::kReadCorrupted;
+    goto bail;
+  }
+
+  // The info is a view of map. Its strings are served from the page cache.
+  info = RSInfo::ReadFromBuffer(data + header->infoOffset, header->infoSize,
+                                pPath, pDeps, &status, map);
+  if (info == NULL) {
+    goto bail;
+  }
+
+  object = SelectObject(data, pPath, object_size, object_raw_size, object_crc,
+                        is_fallback);
+  if (object == NULL) {
+    // Built on a CPU with other features. Rebuild it for this one.
+    status = RSInfo::kReadSourceChanged;
+    goto bail;
+  }
+
+  if ((pSharedObjectPath != NULL) && !is_fallback &&
+      (::access(pSharedObjectPath, R_OK) == 0)) {
+    result = RSExecutable::Create(*info, *input, pSharedObjectPath);
+    if (result != NULL) {
+      map->release();
+      if (pStatus != NULL) {
+        *pStatus = RSInfo::kReadOK;
+      }
+      return result;
+    }
+    ALOGW("Failed to load the shared object %s. Load the object in %s "
+          "instead.", pSharedObjectPath, pPath);
+  }
+
+  // One pass over the pages the loader reads anyway.
+  if (!CheckCRC(object, object_size, object_crc, "object", pPath)) {
+    status = RSInfo::kReadCorrupted;
+    goto bail;
+  }
+
+  if (object_raw_size > 0) {
+    decompressed = new (std::nothrow) uint8_t[object_raw_size];
+    if (decompressed == NULL) {
+      ALOGE("Out of memory when decompress the object in RS cache container "
+            "%s!", pPath);
+      goto bail;
+    }
+    if (!LZ4::Decompress(object, object_size, decompressed,
+                         object_raw_size)) {
+      ALOGW("Corrupted RS cache container %s! (invalid compressed object)",
+            pPath);
+      status = RSInfo::kReadCorrupted;
+      goto bail;
+    }
+    object = decompressed;
+    object_size = object_raw_size;
+  }
+
+  // The bindings are those of the first object too.
+  if (!is_fallback && (header->bindingCount > 0) &&
+      pResolver.hasIndexedSymbols() &&
+      (header->bindingVersion == pResolver.getIndexedSymbolsVersion())) {
+    bindings = reinterpret_cast<const uint32_t *>(data +
+                                                  header->bindingOffset);
+    num_bindings = header->bindingCount;
+  }
+
+  // The export locations in the info are those of the first object.
+  result = RSExecutable::Create(*info, *input, object, object_size, pResolver,
+                                /* pLocateExports */!is_fallback, bindings,
+                                num_bindings);
+  if (result == NULL) {
+    goto bail;
+  }
+
+  // Keep the verified object for the later instances of the script.
+  if ((pCacheSHA1 != NULL) && !is_fallback) {
+    RSExecutableCache::GetInstance().insert(pPath, pCacheSHA1, object,
+                                            object_size, *info);
+  }
+
+  // The loader has its own copy of the object and info holds its own
+  // reference to map.
+  map->release();
+  delete [] decompressed;
+
+  if (pStatus != NULL) {
+    *pStatus = RSInfo::kReadOK;
+  }
+
+  return result;
+
+bail:
+  if (map != NULL) {
+    map->release();
+  }
+  delete [] decompressed;
+  delete info;
+  delete input;
+
+  if (pStatus != NULL) {
+    *pStatus = status;
+  }
+
+  return NULL;
+}
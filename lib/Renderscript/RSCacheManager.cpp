@@ -0,0 +1,524 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSCacheManager.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Path.h>
+
+#include <utils/FileMap.h>
+
+#include "bcc/Renderscript/RSCacheContainer.h"
+#include "bcc/Renderscript/RSExecutableCache.h"
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/FileMutex.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+const char IndexName[] = "rscache.index";
+
+// The files of a script {res} in its cache directory.
+const char *const ScriptFileSuffixes[] = {
+  ".rsc", ".so", ".prof", ".o", ".o.info"
+};
+const size_t NumScriptFileSuffixes =
+    sizeof(ScriptFileSuffixes) / sizeof(ScriptFileSuffixes[0]);
+
+// Marks the temporary files of AtomicOutputFile ({file}.tmp{pid}.{n}.)
+const char TemporarySuffix[] = ".tmp";
+
+std::string GetScriptFilePath(const std::string &pCacheDir,
+                              const std::string &pResName, size_t pSuffix) {
+  llvm::SmallString<80> path(pCacheDir);
+  llvm::sys::path::append(path, pResName + ScriptFileSuffixes[pSuffix]);
+  return path.str();
+}
+
+bool FileExists(const std::string &pPath, uint64_t *pSize = NULL) {
+  struct stat st;
+  if (::stat(pPath.c_str(), &st) != 0) {
+    return false;
+  }
+  if (pSize != NULL) {
+    *pSize = st.st_size;
+  }
+  return true;
+}
+
+uint64_t Now() {
+  return static_cast<uint64_t>(::time(NULL));
+}
+
+// The in-memory copy of the index of a cache directory.
+class Index {
+public:
+  struct Entry {
+    std::string mName;
+    uint8_t mSHA1[SHA1_DIGEST_LENGTH];
+    uint64_t mSize;
+    uint64_t mLastUse;
+  };
+
+private:
+  std::string mCacheDir;
+  std::string mPath;
+
+  std::vector<Entry> mEntries;
+
+  // Index in mEntries of each name and of each SHA-1 (as a string of
+  // SHA1_DIGEST_LENGTH bytes.)
+  llvm::StringMap<unsigned> mByName;
+  llvm::StringMap<unsigned> mBySHA1;
+
+  static llvm::StringRef SHA1Key(const uint8_t *pSHA1) {
+    return llvm::StringRef(reinterpret_cast<const char *>(pSHA1),
+                           SHA1_DIGEST_LENGTH);
+  }
+
+  void rebuildMaps() {
+    mByName.clear();
+    mBySHA1.clear();
+    for (unsigned i = 0, e = mEntries.size(); i != e; i++) {
+      mByName[mEntries[i].mName] = i;
+      mBySHA1[SHA1Key(mEntries[i].mSHA1)] = i;
+    }
+  }
+
+  static bool ByLastUse(const Entry *pA, const Entry *pB) {
+    return (pA->mLastUse < pB->mLastUse);
+  }
+
+public:
+  Index(const char *pCacheDir)
+    : mCacheDir(pCacheDir), mPath(RSCacheManager::GetIndexPath(pCacheDir)) { }
+
+  const std::string &getPath() const
+  { return mPath; }
+
+  // Read the index. A missing or invalid index reads as empty.
+  void read();
+
+  bool write() const;
+
+  Entry *lookup(const char *pResName) {
+    llvm::StringMap<unsigned>::iterator it = mByName.find(pResName);
+    return ((it != mByName.end()) ? &mEntries[it->getValue()] : NULL);
+  }
+
+  const Entry *lookup(const uint8_t *pSHA1) const {
+    llvm::StringMap<unsigned>::const_iterator it = mBySHA1.find(SHA1Key(pSHA1));
+    return ((it != mBySHA1.end()) ? &mEntries[it->getValue()] : NULL);
+  }
+
+  void set(const char *pResName, const uint8_t *pSHA1, uint64_t pLastUse) {
+    Entry *entry = lookup(pResName);
+    if (entry == NULL) {
+      mEntries.push_back(Entry());
+      entry = &mEntries.back();
+      entry->mName = pResName;
+      entry->mSize = 0;
+    }
+    ::memcpy(entry->mSHA1, pSHA1, SHA1_DIGEST_LENGTH);
+    entry->mLastUse = pLastUse;
+    rebuildMaps();
+  }
+
+  // Measure the files of the entries and drop the entries without any.
+  uint64_t measure();
+
+  // Remove the files of the least recently used entries (but pKeep) until
+  // the others fit in pQuota.
+  void evict(uint64_t pQuota, const char *pKeep);
+};
+
+void Index::read() {
+  mEntries.clear();
+  rebuildMaps();
+
+  InputFile input(mPath);
+  if (input.hasError()) {
+    return;
+  }
+
+  size_t file_size = input.getSize();
+  if (input.hasError() || (file_size < sizeof(rscacheindex::Header))) {
+    return;
+  }
+
+  android::FileMap *map = input.createMap(0, file_size);
+  if (map == NULL) {
+    return;
+  }
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  const rscacheindex::Header *header =
+      reinterpret_cast<const rscacheindex::Header *>(data);
+  size_t entries_size =
+      static_cast<size_t>(header->numEntries) * sizeof(rscacheindex::Entry);
+
+  if ((::memcmp(header->magic, RSCACHE_INDEX_MAGIC,
+                sizeof(header->magic)) != 0) ||
+      (::memcmp(header->version, RSCACHE_INDEX_VERSION,
+                sizeof(header->version)) != 0) ||
+      (header->headerSize != sizeof(*header)) ||
+      (header->entrySize != sizeof(rscacheindex::Entry)) ||
+      ((file_size - sizeof(*header)) < entries_size) ||
+      ((file_size - sizeof(*header) - entries_size) != header->strPoolSize) ||
+      ((header->strPoolSize > 0) && (data[file_size - 1] != '\0'))) {
+    ALOGW("Start over the invalid RS cache index %s.", mPath.c_str());
+    map->release();
+    return;
+  }
+
+  const rscacheindex::Entry *entries =
+      reinterpret_cast<const rscacheindex::Entry *>(data + sizeof(*header));
+  const char *pool =
+      reinterpret_cast<const char *>(data + sizeof(*header) + entries_size);
+
+  for (uint32_t i = 0; i < header->numEntries; i++) {
+    if (entries[i].name >= header->strPoolSize) {
+      continue;
+    }
+    mEntries.push_back(Entry());
+    Entry &entry = mEntries.back();
+    entry.mName = pool + entries[i].name;
+    ::memcpy(entry.mSHA1, entries[i].sha1, SHA1_DIGEST_LENGTH);
+    entry.mSize = entries[i].size;
+    entry.mLastUse = entries[i].lastUse;
+  }
+
+  map->release();
+  rebuildMaps();
+}
+
+bool Index::write() const {
+  rscacheindex::Header header;
+  std::string pool;
+  std::vector<rscacheindex::Entry> entries(mEntries.size());
+
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    ::memcpy(entries[i].sha1, mEntries[i].mSHA1, SHA1_DIGEST_LENGTH);
+    entries[i].name = pool.size();
+    entries[i].size = mEntries[i].mSize;
+    entries[i].lastUse = mEntries[i].mLastUse;
+    pool.append(mEntries[i].mName.c_str(), mEntries[i].mName.size() + 1);
+  }
+
+  ::memset(&header, 0, sizeof(header));
+  ::memcpy(header.magic, RSCACHE_INDEX_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, RSCACHE_INDEX_VERSION, sizeof(header.version));
+  header.headerSize = sizeof(header);
+  header.entrySize = sizeof(rscacheindex::Entry);
+  header.numEntries = entries.size();
+  header.strPoolSize = pool.size();
+
+  size_t entries_size = entries.size() * sizeof(rscacheindex::Entry);
+  AtomicOutputFile output(mPath, FileBase::kBinary);
+  if (output.hasError() ||
+      (output.write(&header, sizeof(header)) != sizeof(header)) ||
+      ((entries_size > 0) &&
+       (static_cast<size_t>(output.write(&entries[0], entries_size)) !=
+            entries_size)) ||
+      ((pool.size() > 0) &&
+       (static_cast<size_t>(output.write(pool.data(), pool.size())) !=
+            pool.size())) ||
+      !output.commit()) {
+    ALOGE("Failed to write the RS cache index %s! (%s)", mPath.c_str(),
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+uint64_t Index::measure() {
+  uint64_t total = 0;
+  std::vector<Entry> alive;
+
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    Entry &entry = mEntries[i];
+    bool found = false;
+    entry.mSize = 0;
+    for (size_t j = 0; j < NumScriptFileSuffixes; j++) {
+      uint64_t size;
+      if (FileExists(GetScriptFilePath(mCacheDir, entry.mName, j), &size)) {
+        entry.mSize += size;
+        found = true;
+      }
+    }
+    if (found) {
+      total += entry.mSize;
+      alive.push_back(entry);
+    }
+  }
+
+  mEntries.swap(alive);
+  rebuildMaps();
+  return total;
+}
+
+void Index::evict(uint64_t pQuota, const char *pKeep) {
+  uint64_t total = measure();
+  if (total <= pQuota) {
+    return;
+  }
+
+  std::vector<const Entry *> order;
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    if ((pKeep == NULL) || (mEntries[i].mName != pKeep)) {
+      order.push_back(&mEntries[i]);
+    }
+  }
+  std::sort(order.begin(), order.end(), ByLastUse);
+
+  llvm::StringMap<bool> evicted;
+  for (size_t i = 0; (i < order.size()) && (total > pQuota); i++) {
+    const Entry &entry = *order[i];
+    ALOGV("Evict %s (%llu bytes) from the RS cache %s.", entry.mName.c_str(),
+          static_cast<unsigned long long>(entry.mSize), mCacheDir.c_str());
+    for (size_t j = 0; j < NumScriptFileSuffixes; j++) {
+      std::string path = GetScriptFilePath(mCacheDir, entry.mName, j);
+      if (j == 0) {
+        RSExecutableCache::GetInstance().invalidate(path.c_str());
+      }
+      ::unlink(path.c_str());
+    }
+    total -= entry.mSize;
+    evicted[entry.mName] = true;
+  }
+
+  std::vector<Entry> kept;
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    if (!evicted.count(mEntries[i].mName)) {
+      kept.push_back(mEntries[i]);
+    }
+  }
+  mEntries.swap(kept);
+  rebuildMaps();
+}
+
+// Return true if pName is a temporary file of an AtomicOutputFile whose
+// process is gone.
+bool IsStaleTemporary(const char *pName) {
+  const char *tmp = ::strstr(pName, TemporarySuffix);
+  if (tmp == NULL) {
+    return false;
+  }
+  char *end;
+  long pid = ::strtol(tmp + sizeof(TemporarySuffix) - 1, &end, 10);
+  if ((end == tmp + sizeof(TemporarySuffix) - 1) || (*end != '.')) {
+    return false;
+  }
+  return ((pid > 0) && (::kill(static_cast<pid_t>(pid), 0) != 0) &&
+          (errno == ESRCH));
+}
+
+// Read the SHA-1 of the bitcode the container at pPath was built from out of
+// its dependency table.
+bool ReadContainerSHA1(const std::string &pPath, uint8_t *pSHA1) {
+  RSInfo *info = RSCacheContainer::ReadInfo(pPath.c_str());
+  if (info == NULL) {
+    return false;
+  }
+
+  bool result = false;
+  const RSInfo::DependencyTableTy &deps = info->getDependencyTable();
+  for (size_t i = 0, e = deps.size(); i != e; i++) {
+    if (::strcmp(deps[i].first, RSInfo::BitcodeDependencyName) == 0) {
+      ::memcpy(pSHA1, deps[i].second, SHA1_DIGEST_LENGTH);
+      result = true;
+      break;
+    }
+  }
+
+  delete info;
+  return result;
+}
+
+} // end anonymous namespace
+
+std::string RSCacheManager::GetIndexPath(const char *pCacheDir) {
+  llvm::SmallString<80> path(pCacheDir);
+  llvm::sys::path::append(path, IndexName);
+  return path.str();
+}
+
+bool RSCacheManager::Record(const char *pCacheDir, const char *pResName,
+                            const uint8_t *pSHA1, uint64_t pQuota) {
+  Index index(pCacheDir);
+  FileMutex<FileBase::kWriteLock> mutex(index.getPath());
+  if (mutex.hasError() || !mutex.lock()) {
+    ALOGE("Unable to lock the RS cache index %s! (%s)",
+          index.getPath().c_str(), mutex.getErrorMessage().c_str());
+    return false;
+  }
+
+  index.read();
+  index.set(pResName, pSHA1, Now());
+  if (pQuota > 0) {
+    index.evict(pQuota, pResName);
+  }
+  return index.write();
+}
+
+bool RSCacheManager::Touch(const char *pCacheDir, const char *pResName) {
+  Index index(pCacheDir);
+  uint64_t now = Now();
+
+  // The index is replaced atomically, so the check needs no lock.
+  index.read();
+  Index::Entry *entry = index.lookup(pResName);
+  if ((entry != NULL) && ((entry->mLastUse + RecencyGranularity) > now)) {
+    return true;
+  }
+
+  FileMutex<FileBase::kWriteLock> mutex(index.getPath());
+  if (mutex.hasError() || !mutex.lock()) {
+    ALOGE("Unable to lock the RS cache index %s! (%s)",
+          index.getPath().c_str(), mutex.getErrorMessage().c_str());
+    return false;
+  }
+
+  index.read();
+  entry = index.lookup(pResName);
+  if (entry == NULL) {
+    // Recorded by its next build.
+    return true;
+  }
+  entry->mLastUse = now;
+  return index.write();
+}
+
+bool RSCacheManager::Trim(const char *pCacheDir, uint64_t pQuota,
+                          const char *pKeepResName) {
+  Index index(pCacheDir);
+  FileMutex<FileBase::kWriteLock> mutex(index.getPath());
+  if (mutex.hasError() || !mutex.lock()) {
+    ALOGE("Unable to lock the RS cache index %s! (%s)",
+          index.getPath().c_str(), mutex.getErrorMessage().c_str());
+    return false;
+  }
+
+  index.read();
+  index.evict(pQuota, pKeepResName);
+  return index.write();
+}
+
+bool RSCacheManager::Compact(const char *pCacheDir) {
+  Index index(pCacheDir);
+  FileMutex<FileBase::kWriteLock> mutex(index.getPath());
+  if (mutex.hasError() || !mutex.lock()) {
+    ALOGE("Unable to lock the RS cache index %s! (%s)",
+          index.getPath().c_str(), mutex.getErrorMessage().c_str());
+    return false;
+  }
+
+  DIR *dir = ::opendir(pCacheDir);
+  if (dir == NULL) {
+    ALOGE("Unable to open the RS cache directory %s! (%s)", pCacheDir,
+          ::strerror(errno));
+    return false;
+  }
+
+  std::string cache_dir(pCacheDir);
+  std::vector<std::string> names;
+  while (struct dirent *ent = ::readdir(dir)) {
+    if (ent->d_name[0] != '.') {
+      names.push_back(ent->d_name);
+    }
+  }
+  ::closedir(dir);
+
+  index.read();
+  uint64_t now = Now();
+
+  for (size_t i = 0, e = names.size(); i != e; i++) {
+    const std::string &name = names[i];
+    llvm::SmallString<80> path(cache_dir);
+    llvm::sys::path::append(path, name);
+
+    if (IsStaleTemporary(name.c_str())) {
+      ALOGV("Remove the stale temporary file %s.", path.c_str());
+      ::unlink(path.c_str());
+      continue;
+    }
+
+    llvm::StringRef ref(name);
+    for (size_t j = 0; j < NumScriptFileSuffixes; j++) {
+      if (!ref.endswith(ScriptFileSuffixes[j])) {
+        continue;
+      }
+      std::string res_name =
+          ref.drop_back(::strlen(ScriptFileSuffixes[j])).str();
+      std::string container = GetScriptFilePath(cache_dir, res_name, 0);
+      bool has_container = FileExists(container);
+
+      if (j == 0) {
+        // A container missing from the index.
+        uint8_t sha1[SHA1_DIGEST_LENGTH];
+        if ((index.lookup(res_name.c_str()) == NULL) &&
+            ReadContainerSHA1(container, sha1)) {
+          index.set(res_name.c_str(), sha1, now);
+        }
+      } else if ((j >= 3) ? has_container :
+                     (!has_container &&
+                      (index.lookup(res_name.c_str()) != NULL))) {
+        // A legacy pair superseded by a container, or the shared object or
+        // profile of an indexed script whose container is gone. The files
+        // of the scripts that no build recorded may not be bcc's.
+        ALOGV("Remove the stale RS cache file %s.", path.c_str());
+        ::unlink(path.c_str());
+      }
+      break;
+    }
+  }
+
+  // Drop the scripts without any file left.
+  index.measure();
+  return index.write();
+}
+
+bool RSCacheManager::Find(const char *pCacheDir, const uint8_t *pSHA1,
+                          std::string &pResName) {
+  Index index(pCacheDir);
+  index.read();
+  const Index::Entry *entry = index.lookup(pSHA1);
+  if (entry == NULL) {
+    return false;
+  }
+  pResName = entry->mName;
+  return true;
+}
@@ -16,37 +16,115 @@
 
 #include "bcc/Renderscript/RSCompiler.h"
 
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Triple.h>
 #include <llvm/IR/Module.h>
 #include <llvm/PassManager.h>
+#include <llvm/Target/TargetMachine.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
 
+#include "bcc/BCCContext.h"
 #include "bcc/Renderscript/RSExecutable.h"
 #include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Renderscript/RSProfile.h"
 #include "bcc/Renderscript/RSScript.h"
 #include "bcc/Renderscript/RSTransforms.h"
 #include "bcc/Source.h"
+#include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/Log.h"
 
 using namespace bcc;
 
+namespace {
+
+// Return the width (in bytes) of the SIMD registers available on the target
+// of pTM, or 0 if the target either has none or we don't know of them.
+unsigned GetTargetVectorWidth(const llvm::TargetMachine &pTM) {
+  llvm::StringRef features = pTM.getTargetFeatureString();
+
+  switch (llvm::Triple(pTM.getTargetTriple()).getArch()) {
+    case llvm::Triple::arm:
+    case llvm::Triple::thumb: {
+      // NEON may be turned off at runtime (e.g., for scripts requiring full
+      // floating-point precision). Only trust the feature string.
+      return (features.find("+neon") != llvm::StringRef::npos) ? 16 : 0;
+    }
+    case llvm::Triple::x86: {
+#if defined(ARCH_X86_HAVE_SSE2)
+      return 16;
+#else
+      return (features.find("+sse2") != llvm::StringRef::npos) ? 16 : 0;
+#endif
+    }
+    case llvm::Triple::x86_64: {
+      // SSE2 is part of the x86-64 baseline.
+      return 16;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+} // end anonymous namespace
+
+namespace {
+
+// The name of the source file (STT_FILE) of the objects. The same bitcode
+// gives the same object whatever it's called.
+const char ObjectSourceName[] = "<script>";
+
+// Return pPrefix followed by pSuffix in the compile arena of pContext.
+const char *ConcatInArena(BCCContext &pContext, llvm::StringRef pPrefix,
+                          llvm::StringRef pSuffix) {
+  char *result =
+      pContext.getCompileArena().Allocate<char>(pPrefix.size() +
+                                                pSuffix.size() + 1);
+  ::memcpy(result, pPrefix.data(), pPrefix.size());
+  ::memcpy(result + pPrefix.size(), pSuffix.data(), pSuffix.size());
+  result[pPrefix.size() + pSuffix.size()] = '\0';
+  return result;
+}
+
+} // end anonymous namespace
+
 bool RSCompiler::addInternalizeSymbolsPass(Script &pScript, llvm::PassManager &pPM) {
   // Add a pass to internalize the symbols that don't need to have global
   // visibility.
   RSScript &script = static_cast<RSScript &>(pScript);
   const RSInfo *info = script.getInfo();
 
+  // The names built here only live until the pass has copied them.
+  BCCContext &context = script.getSource().getContext();
+
   // The vector contains the symbols that should not be internalized.
   std::vector<const char *> export_symbols;
 
-  // Special RS functions should always be global symbols.
+  // Special RS functions should always be global symbols. In a bundle, so
+  // are those of each script under its prefix.
+  const std::vector<std::string> *bundle_prefixes = script.getBundlePrefixes();
   const char **special_functions = RSExecutable::SpecialFunctionNames;
   while (*special_functions != NULL) {
     export_symbols.push_back(*special_functions);
+    if (bundle_prefixes != NULL) {
+      for (size_t i = 0, e = bundle_prefixes->size(); i != e; i++) {
+        export_symbols.push_back(ConcatInArena(context, (*bundle_prefixes)[i],
+                                               *special_functions));
+      }
+    }
     special_functions++;
   }
 
   // Visibility of symbols appeared in rs_export_var and rs_export_func should
-  // also be preserved.
+  // also be preserved, unless the runtime doesn't use them (see
+  // RSScript::setUsedExports().)
   const RSInfo::ExportVarNameListTy &export_vars = info->getExportVarNames();
   const RSInfo::ExportFuncNameListTy &export_funcs = info->getExportFuncNames();
 
@@ -54,32 +132,71 @@ bool RSCompiler::addInternalizeSymbolsPass(Script &pScript, llvm::PassManager &p
            export_var_iter = export_vars.begin(),
            export_var_end = export_vars.end();
        export_var_iter != export_var_end; export_var_iter++) {
-    export_symbols.push_back(*export_var_iter);
+    if (script.isExportUsed(*export_var_iter)) {
+      export_symbols.push_back(*export_var_iter);
+    }
   }
 
   for (RSInfo::ExportFuncNameListTy::const_iterator
            export_func_iter = export_funcs.begin(),
            export_func_end = export_funcs.end();
        export_func_iter != export_func_end; export_func_iter++) {
-    export_symbols.push_back(*export_func_iter);
+    if (script.isExportUsed(*export_func_iter)) {
+      export_symbols.push_back(*export_func_iter);
+    }
   }
 
   // Expanded foreach functions should not be internalized, too.
   const RSInfo::ExportForeachFuncListTy &export_foreach_func =
       info->getExportForeachFuncs();
-  std::vector<std::string> expanded_foreach_funcs;
   for (RSInfo::ExportForeachFuncListTy::const_iterator
            foreach_func_iter = export_foreach_func.begin(),
            foreach_func_end = export_foreach_func.end();
        foreach_func_iter != foreach_func_end; foreach_func_iter++) {
-    std::string name(foreach_func_iter->first);
-    expanded_foreach_funcs.push_back(name.append(".expand"));
+    if (!script.isExportUsed(foreach_func_iter->first)) {
+      continue;
+    }
+    for (unsigned i = 0; i < RSInfo::kNumForeachVariants; i++) {
+      export_symbols.push_back(
+          ConcatInArena(context, foreach_func_iter->first,
+                        RSInfo::ExportForeachSuffixes[i]));
+    }
+  }
+
+  // So are the expanded accumulators and the combiners of the reductions.
+  const RSInfo::ExportReduceListTy &export_reduces = info->getExportReduces();
+  for (RSInfo::ExportReduceListTy::const_iterator
+           reduce_iter = export_reduces.begin(),
+           reduce_end = export_reduces.end();
+       reduce_iter != reduce_end; reduce_iter++) {
+    if (!script.isExportUsed(reduce_iter->name)) {
+      continue;
+    }
+    for (unsigned i = 0; i < RSInfo::kNumForeachVariants; i++) {
+      export_symbols.push_back(
+          ConcatInArena(context, reduce_iter->name,
+                        RSInfo::ExportForeachSuffixes[i]));
+    }
+    export_symbols.push_back(reduce_iter->combiner);
+  }
+
+  // So is the batched launch of the foreach functions.
+  export_symbols.push_back(RSInfo::LaunchBatchName);
+
+  // And the block of the export vars, if they're gathered.
+  export_symbols.push_back(RSInfo::ExportVarBlockName);
+
+  // The counters of an instrumented script are read by the runtime.
+  if (script.getProfileSourceSHA1() != NULL) {
+    export_symbols.push_back(RSProfile::CountersName);
+    export_symbols.push_back(RSProfile::NumCountersName);
+    export_symbols.push_back(RSProfile::SourceName);
   }
 
-  // Need to wait until ForEachExpandList is fully populated to fill in
-  // exported symbols.
-  for (size_t i = 0; i < expanded_foreach_funcs.size(); i++) {
-    export_symbols.push_back(expanded_foreach_funcs[i].c_str());
+  // Likewise for the counters of the kernels and their clock.
+  if (script.getKernelCounters()) {
+    export_symbols.push_back(RSInfo::KernelCountersName);
+    export_symbols.push_back(RSInfo::KernelClockName);
   }
 
   pPM.add(llvm::createInternalizePass(export_symbols));
@@ -100,21 +217,187 @@ bool RSCompiler::addExpandForEachPass(Script &pScript, llvm::PassManager &pPM) {
   }
 
   // Expand ForEach on CPU path to reduce launch overhead.
-  bool pEnableStepOpt = true;
+  bool pEnableStepOpt = mEnableExpandStepOpt;
+  // Precise scripts mustn't have their FP operations reordered or computed
+  // by the SIMD units, except in their relaxed kernels.
+  bool pPreciseFP =
+      (info->getFloatPrecisionRequirement() == RSInfo::FP_Full);
+  std::set<std::string> relaxed_kernels;
+  info->getRelaxedFPKernels(relaxed_kernels);
+  // The runtime binds the input and the output of a kernel to distinct
+  // allocations or to the same one (where each cell is read before it's
+  // written.) A script that otherwise overlays them opts out with
+  // "#pragma rs_foreach_may_alias".
+  bool pNoAliasInOut = (info->getPragmaValue("rs_foreach_may_alias") == NULL);
   pPM.add(createRSForEachExpandPass(info->getExportForeachFuncs(),
-                                    pEnableStepOpt));
+                                    info->getExportReduces(),
+                                    pEnableStepOpt,
+                                    getExpandVectorWidth(script),
+                                    pPreciseFP, pNoAliasInOut,
+                                    getExpandPrefetchDistance(script),
+                                    getExpandStreamBlockSize(script),
+                                    &relaxed_kernels));
   if (script.getEmbedInfo())
-    pPM.add(createRSEmbedInfoPass(info));
+    pPM.add(createRSEmbedInfoPass(info, script.getEmbedBinaryInfo()));
+
+  return true;
+}
+
+void RSCompiler::addPreciseFPPass(const RSScript &pScript,
+                                  llvm::PassManager &pPM) const {
+  // Only a full-precision script with relaxed kernels is compiled with NEON
+  // (see RSCompilerDriver::setupConfig().) The whole script computes on VFP
+  // otherwise, and all the SIMD units but NEON are IEEE 754 compliant.
+#if defined(ARCH_ARM_HAVE_NEON)
+  const RSInfo *info = pScript.getInfo();
+  std::set<std::string> relaxed_kernels;
+  if (info != NULL) {
+    info->getRelaxedFPKernels(relaxed_kernels);
+  }
+  if (!relaxed_kernels.empty()) {
+    pPM.add(createRSPreciseFPPass(relaxed_kernels));
+  }
+#endif
+}
+
+unsigned RSCompiler::getExpandVectorWidth(const RSScript &pScript) const {
+  // The widened loops only pay off if their copies of the kernel body get
+  // inlined and combined, which requires the optimizations of LTO.
+  if (!mEnableExpandWidening ||
+      (pScript.getOptimizationLevel() == RSScript::kOptLvl0)) {
+    return 0;
+  }
+
+  return GetTargetVectorWidth(getTargetMachine());
+}
+
+unsigned
+RSCompiler::getExpandPrefetchDistance(const RSScript &pScript) const {
+  // Debug builds keep the loops as simple as possible.
+  if (pScript.getOptimizationLevel() == RSScript::kOptLvl0) {
+    return 0;
+  }
+
+  return getPrefetchDistance();
+}
+
+unsigned
+RSCompiler::getExpandStreamBlockSize(const RSScript &pScript) const {
+  if (pScript.getOptimizationLevel() == RSScript::kOptLvl0) {
+    return 0;
+  }
+
+  return getStreamBlockSize();
+}
+
+bool RSCompiler::afterAddLTOPasses(Script &pScript, llvm::PassManager &pPM) {
+  RSScript &script = static_cast<RSScript &>(pScript);
+  const RSInfo *info = script.getInfo();
+
+  if (script.getOptimizationLevel() == RSScript::kOptLvl0) {
+    addPreciseFPPass(script, pPM);
+    return true;
+  }
+
+  // The LTO pipeline has inlined the kernels into their ForEach loops by now.
+  // Vectorize the loops RSForEachExpandPass didn't mark otherwise. The
+  // max-throughput profile has already run the vectorizers.
+  if (getLTOProfile() != CompilerConfig::kLTOMaxThroughput) {
+    pPM.add(llvm::createLoopRotatePass());
+    pPM.add(llvm::createLoopVectorizePass());
+
+    // Combine the kernel bodies replicated in the widened ForEach loops (see
+    // RSForEachExpandPass) into vector operations.
+    pPM.add(llvm::createSLPVectorizerPass());
+    pPM.add(llvm::createInstructionCombiningPass());
+    pPM.add(llvm::createCFGSimplificationPass());
+  }
+
+  // After the vectorizers, so that nothing puts the vectors back.
+  addPreciseFPPass(script, pPM);
+
+  // Estimate the cost of the loops as they'll be compiled.
+  if (info != NULL) {
+    pPM.add(createRSForEachCostPass(info->getExportForeachFuncs()));
+  }
 
   return true;
 }
 
 bool RSCompiler::beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM) {
+  RSScript &script = static_cast<RSScript &>(pScript);
+  const RSInfo *info = script.getInfo();
+  if (script.getExportConstants() != NULL) {
+    pPM.add(createRSSpecializeExportsPass(*script.getExportConstants()));
+  }
+
   if (!addExpandForEachPass(pScript, pPM))
     return false;
 
+  // Let the inliner of LTO turn the allocation accessors the kernels call
+  // into address computations in their loops.
+  if ((info != NULL) &&
+      (script.getOptimizationLevel() != RSScript::kOptLvl0)) {
+    pPM.add(createRSInlineAccessorsPass(info->getExportForeachFuncs(),
+                                        info->getExportReduces()));
+  }
+
+  // Right after the expansion, so that the profile sees the expanded loops
+  // and the same module in both builds.
+  if (script.getProfileSourceSHA1() != NULL) {
+    pPM.add(createRSProfileInstrumentPass(*info,
+                                          script.getProfileSourceSHA1()));
+  } else if (script.getProfile() != NULL) {
+    pPM.add(createRSProfileAnnotatePass(*info,
+                                        script.getProfile()->getCounters()));
+  }
+
+  // Once the kernels are expanded, before the inliner of LTO folds the
+  // expanded functions into their other entry points.
+  if ((info != NULL) && script.getKernelCounters() &&
+      (script.getBundlePrefixes() == NULL)) {
+    pPM.add(createRSKernelCountersPass(info->getExportForeachFuncs(),
+                                       info->getExportReduces(),
+                                       script.getKernelCycleCounters()));
+  }
+
+  // Last before the internalization, so that the block only takes the vars
+  // which survive the specialization and are used.
+  if ((info != NULL) && script.getExportVarBlock() &&
+      (script.getBundlePrefixes() == NULL)) {
+    pPM.add(createRSExportVarBlockPass(info->getExportVarNames(),
+                                       info->getObjectSlots(),
+                                       script.getUsedExports()));
+  }
+
   if (!addInternalizeSymbolsPass(pScript, pPM))
     return false;
 
   return true;
 }
+
+bool RSCompiler::beforeAddCodeGenPasses(Script &pScript,
+                                        llvm::PassManager &pPM) {
+  RSScript &script = static_cast<RSScript &>(pScript);
+
+  // After LTO, once the externals are down to the ones the loader resolves.
+  if (script.getReducedRelocations()) {
+    pPM.add(createRSExternalTablePass());
+  }
+
+  return true;
+}
+
+bool RSCompiler::beforeExecuteCodeGenPasses(Script &pScript,
+                                            llvm::PassManager &pPM) {
+  // The path of the script would end up in the object.
+  llvm::Module &module = pScript.getSource().getModule();
+  mModuleIdentifier = module.getModuleIdentifier();
+  module.setModuleIdentifier(ObjectSourceName);
+  return true;
+}
+
+bool RSCompiler::afterExecuteCodeGenPasses(Script &pScript) {
+  pScript.getSource().getModule().setModuleIdentifier(mModuleIdentifier);
+  return true;
+}
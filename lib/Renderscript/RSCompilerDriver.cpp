@@ -16,25 +16,60 @@
 
 #include "bcc/Renderscript/RSCompilerDriver.h"
 
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeValue.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
+#include "bcinfo/BitcodeTranslator.h"
 #include "bcinfo/BitcodeWrapper.h"
 
 #include "bcc/Compiler.h"
+#include "bcc/ExecutionEngine/ObjectLoader.h"
+#include "bcc/Renderscript/RSCacheContainer.h"
+#include "bcc/Renderscript/RSCacheManager.h"
 #include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Renderscript/RSExecutableCache.h"
+#include "bcc/Renderscript/RSProfile.h"
 #include "bcc/Renderscript/RSScript.h"
 #include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/TargetCompilerConfigs.h"
 #include "bcc/Source.h"
+#include "bcc/Support/AtomicOutputFile.h"
 #include "bcc/Support/FileMutex.h"
 #include "bcc/Support/Log.h"
-#include "bcc/Support/InputFile.h"
 #include "bcc/Support/Initialization.h"
+#include "bcc/Support/InputFile.h"
 #include "bcc/Support/Sha1Util.h"
 #include "bcc/Support/OutputFile.h"
+#include "bcc/Support/PhaseTimer.h"
+#include "bcc/Support/Trace.h"
+
+#include "RSCompilerThread.h"
 
 #ifdef HAVE_ANDROID_OS
 #include <cutils/properties.h>
@@ -44,26 +79,720 @@
 
 using namespace bcc;
 
+namespace {
+
+// The entry of the dependency table holding the digest of the exports a
+// script is declared to use (see RSCompilerDriver::setUsedExports().)
+const char UsedExportsDependencyName[] = "<used exports>";
+
+// The entry holding the digest of the values a specialized script is built
+// on (see RSCompilerDriver::buildSpecialized().)
+const char ExportConstantsDependencyName[] = "<export constants>";
+
+// The entry holding the digest of the emission profile the driver was told
+// to use (see RSCompilerDriver::setEmissionProfile().)
+const char EmissionProfileDependencyName[] = "<emission profile>";
+
+// The entry holding the digest of the custom runtime of the scripts (see
+// RSCompilerDriver::setCustomRuntime().)
+const char CustomRuntimeDependencyName[] = "<runtime>";
+
+// The entry holding the digest of the profile of a script (or the marker of
+// the instrumented builds.) Like the bitcode, it's named after its role
+// rather than its path (see RSInfo::BitcodeDependencyName.)
+const char ProfileDependencyName[] = "<profile>";
+
+// The suffix of the name of the specialized build of a script.
+const char SpecializedSuffix[] = "-spec";
+
+// Wait up to pTimeoutMs milliseconds for the build of the container pPath in
+// progress in another process (if any) to publish it. Return true if there
+// was one and it's over, in which case the container is worth another load.
+//
+// The builds hold a write lock on {pPath}.lock until the container is
+// written and remove the file before they release it. The lock file isn't
+// created here: without it, there's no build to wait for.
+bool WaitForPublish(const char *pPath, unsigned pTimeoutMs) {
+  InputFile lock_file(std::string(pPath) + ".lock");
+  if (lock_file.hasError()) {
+    return false;
+  }
+
+  bool contended = false;
+  bool locked = lock_file.lockWithTimeout(FileBase::kReadLock, pTimeoutMs,
+                                          &contended);
+  if (!contended) {
+    // A leftover of a build that died.
+    return false;
+  }
+
+  // The builder may have removed the file before the reopen of the lock.
+  return (locked ||
+          (lock_file.getError().value() ==
+               llvm::errc::no_such_file_or_directory));
+}
+
+// Whether the device is plugged in, according to the battery driver. A
+// device without a battery (e.g., the host) counts as charging.
+bool IsDeviceCharging() {
+  static const char BatteryStatusPath[] =
+      "/sys/class/power_supply/battery/status";
+
+  FILE *status_file = ::fopen(BatteryStatusPath, "r");
+  if (status_file == NULL) {
+    return (errno == ENOENT);
+  }
+
+  char status[16] = { '\0' };
+  bool charging = false;
+  if (::fgets(status, sizeof(status), status_file) != NULL) {
+    charging = ((::strncmp(status, "Charging", 8) == 0) ||
+                (::strncmp(status, "Full", 4) == 0));
+  }
+  ::fclose(status_file);
+  return charging;
+}
+
+// Compute the digest of the names and the values in pConstants (in the order
+// of the names.)
+void GetExportConstantsDigest(const RSScript::ExportConstantMapTy &pConstants,
+                              uint8_t pDigest[SHA1_DIGEST_LENGTH]) {
+  Sha1Util::Context context;
+  for (RSScript::ExportConstantMapTy::const_iterator
+           constant_iter = pConstants.begin(),
+           constant_end = pConstants.end();
+       constant_iter != constant_end; constant_iter++) {
+    uint32_t size = constant_iter->second.size();
+    context.update(constant_iter->first.c_str(),
+                   constant_iter->first.size() + 1);
+    context.update(reinterpret_cast<const uint8_t *>(&size), sizeof(size));
+    context.update(constant_iter->second.data(), size);
+  }
+  context.finalize(pDigest);
+}
+
+llvm::sys::Mutex gCacheStatsLock;
+RSCacheStats gCacheStats;
+
+// Record one loadScript() call into gCacheStats when it goes out of scope.
+class CacheOutcomeRecorder {
+private:
+  RSCacheStats::Outcome mOutcome;
+  llvm::sys::TimeValue mStart;
+
+public:
+  CacheOutcomeRecorder()
+    : mOutcome(RSCacheStats::kMiss), mStart(llvm::sys::TimeValue::now()) { }
+
+  void set(RSCacheStats::Outcome pOutcome)
+  { mOutcome = pOutcome; }
+
+  void set(RSInfo::ReadStatus pStatus) {
+    switch (pStatus) {
+      case RSInfo::kReadOK:                   mOutcome = RSCacheStats::kHit; break;
+      case RSInfo::kReadNotFound:             mOutcome = RSCacheStats::kMiss; break;
+      case RSInfo::kReadIOError:              mOutcome = RSCacheStats::kIOError; break;
+      case RSInfo::kReadVersionMismatch:      mOutcome = RSCacheStats::kVersionMismatch; break;
+      case RSInfo::kReadCorrupted:            mOutcome = RSCacheStats::kCorrupted; break;
+      case RSInfo::kReadLibBCCChanged:        mOutcome = RSCacheStats::kLibBCCChanged; break;
+      case RSInfo::kReadLibCompilerRTChanged: mOutcome = RSCacheStats::kLibCompilerRTChanged; break;
+      case RSInfo::kReadLibRSChanged:         mOutcome = RSCacheStats::kLibRSChanged; break;
+      case RSInfo::kReadLibCLCoreChanged:     mOutcome = RSCacheStats::kLibCLCoreChanged; break;
+      case RSInfo::kReadSourceChanged:        mOutcome = RSCacheStats::kSourceChanged; break;
+    }
+  }
+
+  ~CacheOutcomeRecorder() {
+    // Tags the section of the enclosing PhaseTimer.
+    TraceSection::Mark("Cache outcome",
+                       RSCacheStats::GetOutcomeName(mOutcome));
+
+    llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - mStart;
+    llvm::MutexGuard locked(gCacheStatsLock);
+    gCacheStats.mCount[mOutcome]++;
+    gCacheStats.mTime[mOutcome] += elapsed.seconds() +
+                                   elapsed.nanoseconds() * 1e-9;
+  }
+};
+
+// A fallback of a script for the CPUs lacking some features (see
+// RSCompilerDriver::setMultiversioning().)
+struct FallbackBuild {
+  // The CPUProfile::Features the fallback requires.
+  uint32_t mFeatures;
+  // The copy of the linked module of the script to compile. NULL once
+  // compiled.
+  llvm::Module *mModule;
+  llvm::SmallVector<char, 0> mImage;
+
+  FallbackBuild() : mFeatures(0), mModule(NULL) { }
+};
+
+// One fallback per optional feature at most.
+const unsigned MaxFallbackBuilds = 4;
+
+// Set up in pBuilds the fallbacks of pScript, whose code requires
+// pFeatures: each one drops the most demanding feature left in the previous
+// one, down to none. Return the number of fallbacks set up.
+unsigned PrepareFallbackBuilds(RSScript &pScript, uint32_t pFeatures,
+                               FallbackBuild pBuilds[MaxFallbackBuilds]) {
+  llvm::Module &module = pScript.getSource().getModule();
+  std::string error;
+  unsigned count = 0;
+
+  // Copy the function bodies too.
+  if ((pFeatures != 0) && (module.getMaterializer() != NULL) &&
+      module.MaterializeAllPermanently(&error)) {
+    ALOGW("Skip the fallbacks of %s! (%s)",
+          pScript.getSource().getIdentifier().c_str(), error.c_str());
+    return 0;
+  }
+
+  while ((pFeatures != 0) && (count < MaxFallbackBuilds)) {
+    uint32_t highest = 1u << 31;
+    while ((pFeatures & highest) == 0) {
+      highest >>= 1;
+    }
+    pFeatures &= ~highest;
+
+    pBuilds[count].mFeatures = pFeatures;
+    pBuilds[count].mModule = llvm::CloneModule(&module);
+    if (pBuilds[count].mModule == NULL) {
+      ALOGW("Out of memory when copy %s for its fallbacks!",
+            pScript.getSource().getIdentifier().c_str());
+      break;
+    }
+    count++;
+  }
+
+  return count;
+}
+
+// Compile the pCount fallbacks in pBuilds of pScript (with its info set),
+// which has just been compiled with pConfig. pCompiler is configured with
+// pConfig again on return. Return the number of the fallbacks compiled
+// (i.e., before the first one failing.)
+unsigned CompileFallbackBuilds(const CompilerConfig &pConfig,
+                               RSCompiler &pCompiler, RSScript &pScript,
+                               FallbackBuild pBuilds[MaxFallbackBuilds],
+                               unsigned pCount) {
+  unsigned i;
+  for (i = 0; i < pCount; i++) {
+    CompilerConfig *config = CreateFallbackConfig(pConfig,
+                                                  pBuilds[i].mFeatures);
+    if ((config == NULL) || (pCompiler.config(*config) != Compiler::kSuccess)) {
+      delete config;
+      break;
+    }
+    delete config;
+
+    // source takes the ownership of the module.
+    Source *source = Source::CreateFromModule(pScript.getSource().getContext(),
+                                              *pBuilds[i].mModule);
+    if (source == NULL) {
+      break;
+    }
+    pBuilds[i].mModule = NULL;
+
+    Compiler::ErrorCode result;
+    {
+      RSScript script(*source);
+      script.setInfo(pScript.getInfo());
+      script.setCompilerVersion(pScript.getCompilerVersion());
+      script.setOptimizationLevel(pScript.getOptimizationLevel());
+      script.setEmbedInfo(pScript.getEmbedInfo());
+      script.setEmbedBinaryInfo(pScript.getEmbedBinaryInfo());
+      script.setProfileSourceSHA1(pScript.getProfileSourceSHA1());
+      script.setProfile(pScript.getProfile());
+      script.setUsedExports(pScript.getUsedExports());
+      script.setExportConstants(pScript.getExportConstants());
+      script.setCancellationToken(pScript.getCancellationToken());
+      script.setExportVarBlock(pScript.getExportVarBlock());
+      script.setReducedRelocations(pScript.getReducedRelocations());
+      script.setKernelCounters(pScript.getKernelCounters(),
+                               pScript.getKernelCycleCounters());
+
+      llvm::raw_svector_ostream object_stream(pBuilds[i].mImage);
+      result = pCompiler.compile(script, object_stream, NULL);
+
+      // The info belongs to pScript.
+      script.setInfo(NULL);
+    }
+    delete source;
+
+    if (result != Compiler::kSuccess) {
+      break;
+    }
+  }
+
+  if (i < pCount) {
+    ALOGW("Failed to compile the fallback of %s requiring features %#x! "
+          "Keep %u of %u fallbacks.",
+          pScript.getSource().getIdentifier().c_str(), pBuilds[i].mFeatures,
+          i, pCount);
+  }
+
+  pCompiler.config(pConfig);
+  return i;
+}
+
+// Rough size of the code generated for an IR instruction, and of the headers,
+// the symbol table and the relocations of an object.
+const size_t ObjectBytesPerInstruction = 8;
+const size_t ObjectOverhead = 4096;
+
+// Estimate the size of the object of pModule before it's linked with the
+// runtime (after which most of the module is the library the LTO removes.)
+size_t EstimateObjectSize(const llvm::Module &pModule) {
+  llvm::DataLayout DL(&pModule);
+  size_t result = ObjectOverhead;
+
+  for (llvm::Module::const_iterator F = pModule.begin(), FE = pModule.end();
+       F != FE; ++F) {
+    for (llvm::Function::const_iterator BB = F->begin(), BBE = F->end();
+         BB != BBE; ++BB) {
+      result += BB->size() * ObjectBytesPerInstruction;
+    }
+  }
+
+  for (llvm::Module::const_global_iterator GV = pModule.global_begin(),
+           GVE = pModule.global_end(); GV != GVE; ++GV) {
+    if (!GV->isDeclaration()) {
+      result += DL.getTypeAllocSize(GV->getType()->getElementType());
+    }
+  }
+
+  return result;
+}
+
+// Keep the object just compiled into the container pPath in RSExecutableCache
+// so that the load following the build doesn't read it back from the file.
+void KeepCompiledObject(const char *pPath, const uint8_t *pCacheSHA1,
+                        const void *pImage, size_t pImageSize,
+                        const RSInfo &pInfo) {
+  // The cache clones the info from a self-contained copy, as if it had been
+  // read from the container.
+  std::string data;
+  if (!pInfo.serialize(data)) {
+    return;
+  }
+  RSInfo *info = RSInfo::ReadEmbedded(data.data(), pPath);
+  if (info != NULL) {
+    RSExecutableCache::GetInstance().insert(pPath, pCacheSHA1, pImage,
+                                            pImageSize, *info);
+    delete info;
+  }
+}
+
+// Set pResult to the digest the caches of the pBitcodeSize bytes of bitcode
+// at pBitcode are keyed by. If its wrapper records the SHA-1 of the raw
+// bitcode, that's the SHA-1 of the wrapper alone, which covers the recorded
+// SHA-1 along with the other fields. The recorded SHA-1 is only checked
+// against the raw bitcode if pVerify. Otherwise, it's the SHA-1 of it all.
+void GetBitcodeDigest(const char *pBitcode, size_t pBitcodeSize,
+                      bool pVerify, uint8_t *pResult) {
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+  const uint8_t *source_sha1 = wrapper.getSourceSHA1();
+
+  if ((source_sha1 != NULL) && pVerify) {
+    uint8_t actual_sha1[SHA1_DIGEST_LENGTH];
+    Sha1Util::GetSHA1DigestFromBuffer(actual_sha1, wrapper.getRawBitcode(),
+                                      wrapper.getRawBitcodeSize());
+    if (::memcmp(actual_sha1, source_sha1, SHA1_DIGEST_LENGTH) != 0) {
+      ALOGW("The SHA-1 in the bitcode wrapper doesn't match the bitcode. "
+            "Ignore it.");
+      source_sha1 = NULL;
+    }
+  }
+
+  if ((source_sha1 != NULL) && (wrapper.getWrapperSize() > 0)) {
+    Sha1Util::GetSHA1DigestFromBuffer(pResult, pBitcode,
+                                      wrapper.getWrapperSize());
+  } else {
+    Sha1Util::GetSHA1DigestFromBuffer(pResult, pBitcode, pBitcodeSize);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Script bundles
+//===----------------------------------------------------------------------===//
+// Set pResult to the digest of a bundle: the SHA-1 of the names and of the
+// digests of the bitcode (see GetBitcodeDigest()) of its scripts, in order.
+void GetBundleDigest(const android::Vector<RSBundleScript> &pScripts,
+                     bool pVerify, uint8_t *pResult) {
+  std::string key;
+  for (size_t i = 0, e = pScripts.size(); i != e; i++) {
+    uint8_t bitcode_sha1[SHA1_DIGEST_LENGTH];
+    GetBitcodeDigest(pScripts[i].bitcode, pScripts[i].bitcodeSize, pVerify,
+                     bitcode_sha1);
+    key.append(pScripts[i].resName, ::strlen(pScripts[i].resName) + 1);
+    key.append(reinterpret_cast<const char *>(bitcode_sha1),
+               SHA1_DIGEST_LENGTH);
+  }
+  Sha1Util::GetSHA1DigestFromBuffer(pResult, key.data(), key.size());
+}
+
+// The prefix of the global symbols of the pIndex-th script of a bundle. It
+// can't clash with the identifiers of the scripts or of the runtime.
+std::string GetBundlePrefix(size_t pIndex) {
+  return ".rs.bundle" + llvm::utostr(pIndex) + ".";
+}
+
+// {pCacheDir}/{pBundleName}.{pIndex}.info
+android::String8 GetBundleInfoPath(const char *pCacheDir,
+                                   const char *pBundleName, size_t pIndex) {
+  llvm::SmallString<80> path(pCacheDir);
+  llvm::sys::path::append(path, pBundleName);
+  android::String8 result(path.c_str());
+  result.appendFormat(".%u.info", static_cast<unsigned>(pIndex));
+  return result;
+}
+
+// Rewrite the string operand pOperand of the entries of the named metadata
+// pName in pModule: prefix it with pPrefix or, if pPrefix is empty, add
+// pIndexOffset to the index it holds.
+void RewriteMetadataOperand(llvm::Module &pModule, llvm::StringRef pName,
+                            unsigned pOperand, llvm::StringRef pPrefix,
+                            unsigned pIndexOffset) {
+  llvm::NamedMDNode *metadata = pModule.getNamedMetadata(pName);
+  if (metadata == NULL) {
+    return;
+  }
+
+  llvm::LLVMContext &context = pModule.getContext();
+  llvm::SmallVector<llvm::MDNode *, 16> nodes;
+  for (unsigned i = 0, e = metadata->getNumOperands(); i != e; i++) {
+    llvm::MDNode *node = metadata->getOperand(i);
+    llvm::MDString *string = NULL;
+    if ((node != NULL) && (node->getNumOperands() > pOperand)) {
+      string = llvm::dyn_cast_or_null<llvm::MDString>(
+                   node->getOperand(pOperand));
+    }
+    uint32_t index;
+    if ((string == NULL) || string->getString().empty() ||
+        (pPrefix.empty() && string->getString().getAsInteger(10, index))) {
+      // The extractor deals with the malformed entries.
+      nodes.push_back(node);
+      continue;
+    }
+
+    std::string value = (pPrefix.empty() ?
+                             llvm::utostr(index + pIndexOffset) :
+                             (pPrefix + string->getString()).str());
+    llvm::SmallVector<llvm::Value *, 4> operands;
+    for (unsigned j = 0, je = node->getNumOperands(); j != je; j++) {
+      operands.push_back(node->getOperand(j));
+    }
+    operands[pOperand] = llvm::MDString::get(context, value);
+    nodes.push_back(llvm::MDNode::get(context, operands));
+  }
+
+  metadata->dropAllReferences();
+  for (size_t i = 0, e = nodes.size(); i != e; i++) {
+    metadata->addOperand(nodes[i]);
+  }
+}
+
+// Prefix the names of the global symbols pModule defines (and those of its
+// exports in the RS metadata) with pPrefix, so that they don't clash with
+// the other scripts of the bundle. The variables of the scripts before it
+// in the bundle take pNumPrecedingVars object slots.
+void PrefixBundleScript(llvm::Module &pModule, const std::string &pPrefix,
+                        unsigned pNumPrecedingVars) {
+  for (llvm::Module::iterator func_iter = pModule.begin(),
+          func_end = pModule.end(); func_iter != func_end; func_iter++) {
+    if (!func_iter->isDeclaration() && !func_iter->hasLocalLinkage()) {
+      func_iter->setName(pPrefix + func_iter->getName().str());
+    }
+  }
+  for (llvm::Module::global_iterator var_iter = pModule.global_begin(),
+          var_end = pModule.global_end(); var_iter != var_end; var_iter++) {
+    // Leave the appending llvm.* arrays (e.g., llvm.used) to the linker.
+    if (!var_iter->isDeclaration() && !var_iter->hasLocalLinkage() &&
+        !var_iter->hasAppendingLinkage()) {
+      var_iter->setName(pPrefix + var_iter->getName().str());
+    }
+  }
+  for (llvm::Module::alias_iterator alias_iter = pModule.alias_begin(),
+          alias_end = pModule.alias_end(); alias_iter != alias_end;
+       alias_iter++) {
+    if (!alias_iter->hasLocalLinkage()) {
+      alias_iter->setName(pPrefix + alias_iter->getName().str());
+    }
+  }
+
+  RewriteMetadataOperand(pModule, "#rs_export_var", 0, pPrefix, 0);
+  RewriteMetadataOperand(pModule, "#rs_export_func", 0, pPrefix, 0);
+  RewriteMetadataOperand(pModule, "#rs_export_foreach_name", 0, pPrefix, 0);
+  // The accumulator and the combiner.
+  RewriteMetadataOperand(pModule, "#rs_export_reduce", 0, pPrefix, 0);
+  RewriteMetadataOperand(pModule, "#rs_export_reduce", 1, pPrefix, 0);
+  RewriteMetadataOperand(pModule, "#rs_object_slots", 0, "",
+                         pNumPrecedingVars);
+}
+
+// Parse the pIndex-th script pScript of a bundle, write its info (with the
+// dependencies pDeps of the bundle) to pInfoPath, prefix its symbols and link
+// it into pBundle (or make it the bundle if pBundle is NULL.) pNumVars is the
+// number of the export variables of the bundle so far and pPrecision the
+// floating point precision the bundle requires. Return false on error.
+bool AddBundleScript(BCCContext &pContext, const RSBundleScript &pScript,
+                     size_t pIndex, const RSInfo::DependencyTableTy &pDeps,
+                     const char *pInfoPath, AtomicOutputFile::SyncMode pSync,
+                     Source *&pBundle, unsigned &pNumVars,
+                     RSInfo::FloatPrecision &pPrecision) {
+  Source *source;
+  {
+    PhaseTimer timer(kPhaseBitcodeParse, pScript.resName);
+    source = Source::CreateFromBuffer(pContext, pScript.resName,
+                                      pScript.bitcode, pScript.bitcodeSize);
+  }
+  if (source == NULL) {
+    return false;
+  }
+  llvm::OwningPtr<Source> source_owner(source);
+  llvm::Module &module = source->getModule();
+
+  // The legacy root() is only found under its own name.
+  llvm::Function *root = module.getFunction("root");
+  if ((module.getNamedMetadata("#rs_export_foreach_name") == NULL) &&
+      (root != NULL) && !root->isDeclaration()) {
+    ALOGE("The kernels of %s aren't named. It can't be bundled!",
+          pScript.resName);
+    return false;
+  }
+
+  llvm::OwningPtr<RSInfo> info;
+  {
+    PhaseTimer timer(kPhaseExtractInfo, pScript.resName);
+    info.reset(RSInfo::ExtractFromSource(*source, pDeps));
+  }
+  if (!info) {
+    return false;
+  }
+
+  const RSInfo::PragmaListTy &pragmas = info->getPragmas();
+  for (RSInfo::PragmaListTy::const_iterator pragma_iter = pragmas.begin(),
+          pragma_end = pragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++) {
+    if ((::strcmp(pragma_iter->first, "rs_fuse") == 0) ||
+        (::strcmp(pragma_iter->first, "rs_fp_relaxed_kernels") == 0)) {
+      ALOGE("#pragma %s of %s names kernels. It can't be bundled!",
+            pragma_iter->first, pScript.resName);
+      return false;
+    }
+  }
+
+  if (pIndex == 0) {
+    pPrecision = info->getFloatPrecisionRequirement();
+  } else if (info->getFloatPrecisionRequirement() != pPrecision) {
+    ALOGE("%s requires another floating point precision than the scripts "
+          "bundled with it!", pScript.resName);
+    return false;
+  }
+
+  std::string data;
+  AtomicOutputFile info_file(pInfoPath, FileBase::kBinary);
+  if (!info->serialize(data) || info_file.hasError() ||
+      (info_file.write(data.data(), data.size()) !=
+           static_cast<ssize_t>(data.size())) ||
+      !info_file.commit(pSync)) {
+    ALOGE("Failed to write the RS info of %s to %s!", pScript.resName,
+          pInfoPath);
+    return false;
+  }
+
+  const llvm::NamedMDNode *export_vars =
+      module.getNamedMetadata("#rs_export_var");
+  PrefixBundleScript(module, GetBundlePrefix(pIndex), pNumVars);
+  if (export_vars != NULL) {
+    pNumVars += export_vars->getNumOperands();
+  }
+
+  if (pBundle == NULL) {
+    pBundle = source_owner.take();
+    return true;
+  }
+  // The source is destroyed once it's linked.
+  if (!pBundle->merge(*source)) {
+    return false;
+  }
+  source_owner.take();
+  return true;
+}
+
+} // end anonymous namespace
+
+const char *RSCacheStats::GetOutcomeName(Outcome pOutcome) {
+  switch (pOutcome) {
+    case kMemoryHit:            return "hit (memory)";
+    case kHit:                  return "hit";
+    case kSharedHit:            return "hit (shared store)";
+    case kMiss:                 return "miss";
+    case kIOError:              return "unreadable info";
+    case kVersionMismatch:      return "version mismatch";
+    case kCorrupted:            return "corrupted";
+    case kLibBCCChanged:        return "libbcc changed";
+    case kLibCompilerRTChanged: return "libcompiler_rt changed";
+    case kLibRSChanged:         return "libRS changed";
+    case kLibCLCoreChanged:     return "libclcore changed";
+    case kSourceChanged:        return "bitcode changed";
+    case kLoadFailed:           return "load failed";
+    default: {
+      break;
+    }
+  }
+  return "(unknown)";
+}
+
+void RSCompilerDriver::GetCacheStats(RSCacheStats &pStats) {
+  llvm::MutexGuard locked(gCacheStatsLock);
+  pStats = gCacheStats;
+}
+
+void RSCompilerDriver::ResetCacheStats() {
+  llvm::MutexGuard locked(gCacheStatsLock);
+  ::memset(&gCacheStats, 0, sizeof(gCacheStats));
+}
+
+void RSCompilerDriver::DumpCacheStats() {
+  RSCacheStats stats;
+  GetCacheStats(stats);
+  ALOGI("RS script cache statistics:");
+  for (unsigned i = 0; i < RSCacheStats::kNumOutcomes; i++) {
+    ALOGI("  %-24s %6u  %.3f ms",
+          RSCacheStats::GetOutcomeName(static_cast<RSCacheStats::Outcome>(i)),
+          stats.mCount[i], stats.mTime[i] * 1000);
+  }
+}
+
+#if defined(DEFAULT_ARM_CODEGEN)
+extern llvm::cl::opt<bool> EnableGlobalMerge;
+
+namespace {
+pthread_once_t global_merge_once = PTHREAD_ONCE_INIT;
+
+// EnableGlobalMerge is a process-wide option of the ARM backend, read by the
+// code generation of every compile. It's turned off once for all, and the
+// Compiler adds the pass itself to the compiles whose config asks for it.
+void DisableBackendGlobalMerge() {
+  EnableGlobalMerge = false;
+}
+} // end anonymous namespace
+#endif
+
 RSCompilerDriver::RSCompilerDriver(bool pUseCompilerRT) :
     mConfig(NULL), mCompiler(), mCompilerRuntime(NULL), mDebugContext(false),
-    mEnableGlobalMerge(true) {
-  init::Initialize();
+    mEnableGlobalMerge(true), mCacheSync(AtomicOutputFile::kNoSync),
+    mCacheQuota(0), mCompressCaches(false), mCacheWaitTimeout(0),
+    mCancelToken(NULL), mChargingCallback(NULL), mChargingUserData(NULL),
+    mParanoidCacheChecks(false),
+    mLTOProfile(CompilerConfig::kLTOBalanced), mEmissionProfile(-1),
+    mHasCustomRuntime(false), mLowMemory(false),
+    mMultiversioning(false), mProfileInstrumentation(false),
+    mEmbedBinaryInfo(false), mExportVarBlock(false),
+    mReducedRelocations(false), mKernelCounters(false),
+    mKernelCycleCounters(false), mCustomConfig(false) {
+  // The backend is initialized by the first compile (see CompilerConfig).
+  init::InitializeErrorHandler();
+#if defined(DEFAULT_ARM_CODEGEN)
+  ::pthread_once(&global_merge_once, DisableBackendGlobalMerge);
+#endif
   // Chain the symbol resolvers for compiler_rt and RS runtimes.
   if (pUseCompilerRT) {
-    mCompilerRuntime = new CompilerRTSymbolResolver();
-    mResolver.chainResolver(*mCompilerRuntime);
+    mCompilerRuntime =
+        SymbolResolverRegistry::GetInstance().acquireCompilerRT();
+    if (mCompilerRuntime != NULL) {
+      mResolver.chainResolver(*mCompilerRuntime);
+    }
   }
   mResolver.chainResolver(mRSRuntime);
 }
 
 RSCompilerDriver::~RSCompilerDriver() {
-  delete mCompilerRuntime;
+  if (mCompilerThread != NULL) {
+    mCompilerThread->stop();
+    mCompilerThread.clear();
+  }
+  for (size_t i = 0, e = mIdleCompilers.size(); i != e; i++) {
+    delete mIdleCompilers[i];
+  }
+  SymbolResolverRegistry::GetInstance().release(mCompilerRuntime);
+  delete mConfig;
+}
+
+RSCompilerDriver::CompilerSlot::~CompilerSlot() {
   delete mConfig;
 }
 
+RSCompilerDriver::CompilerSlot *RSCompilerDriver::acquireCompilerSlot() {
+  {
+    android::Mutex::Autolock locked(mIdleCompilersLock);
+    if (!mIdleCompilers.isEmpty()) {
+      CompilerSlot *slot = mIdleCompilers.top();
+      mIdleCompilers.pop();
+      return slot;
+    }
+  }
+
+  // Compiling on several threads at once requires a thread-safe LLVM.
+  if (!llvm::llvm_is_multithreaded() && !llvm::llvm_start_multithreaded()) {
+    return NULL;
+  }
+
+  return new (std::nothrow) CompilerSlot();
+}
+
+void RSCompilerDriver::releaseCompilerSlot(CompilerSlot *pSlot) {
+  android::Mutex::Autolock locked(mIdleCompilersLock);
+  if (mIdleCompilers.push(pSlot) < 0) {
+    delete pSlot;
+  }
+}
+
 RSExecutable *
 RSCompilerDriver::loadScript(const char *pCacheDir, const char *pResName,
                              const char *pBitcode, size_t pBitcodeSize) {
+  return loadScriptImpl(pCacheDir, pResName, pBitcode, pBitcodeSize, NULL);
+}
+
+void RSCompilerDriver::prefetchCacheFiles(const char *pCacheDir,
+                                          const char *pResName) const {
+  if ((pCacheDir == NULL) || (pResName == NULL)) {
+    return;
+  }
+
+  // {pCacheDir}/{pResName}.o
+  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::sys::path::append(output_path, pResName);
+  llvm::sys::path::replace_extension(output_path, ".o");
+
+  FileBase::Prefetch(RSCacheContainer::GetPath(output_path.c_str()).string());
+  if (!mSharedObjectLinker.isEmpty()) {
+    FileBase::Prefetch(
+        RSCacheContainer::GetSharedObjectPath(output_path.c_str()).string());
+  }
+  FileBase::Prefetch(RSProfile::GetPath(output_path.c_str()).string());
+}
+
+RSExecutable *
+RSCompilerDriver::loadSpecialized(
+    const char *pCacheDir, const char *pResName, const char *pBitcode,
+    size_t pBitcodeSize, const RSScript::ExportConstantMapTy &pConstants) {
+  if (pResName == NULL) {
+    ALOGE("Missing pResName");
+    return NULL;
+  }
+  android::String8 spec_name(pResName);
+  spec_name.append(SpecializedSuffix);
+  return loadScriptImpl(pCacheDir, spec_name.string(), pBitcode, pBitcodeSize,
+                        &pConstants);
+}
+
+RSExecutable *
+RSCompilerDriver::loadScriptImpl(
+    const char *pCacheDir, const char *pResName, const char *pBitcode,
+    size_t pBitcodeSize, const RSScript::ExportConstantMapTy *pConstants) {
   //android::StopWatch load_time("bcc: RSCompilerDriver::loadScript time");
   if ((pCacheDir == NULL) || (pResName == NULL)) {
     ALOGE("Missing pCacheDir and/or pResName");
@@ -76,119 +805,461 @@ RSCompilerDriver::loadScript(const char *pCacheDir, const char *pResName,
     return NULL;
   }
 
+  PhaseTimer load_timer(kPhaseCacheLoad, pResName);
+  CacheOutcomeRecorder outcome;
+
   RSInfo::DependencyTableTy dep_info;
-  uint8_t bitcode_sha1[20];
-  Sha1Util::GetSHA1DigestFromBuffer(bitcode_sha1, pBitcode, pBitcodeSize);
 
   // {pCacheDir}/{pResName}.o
   llvm::SmallString<80> output_path(pCacheDir);
   llvm::sys::path::append(output_path, pResName);
   llvm::sys::path::replace_extension(output_path, ".o");
 
-  dep_info.push(std::make_pair(output_path.c_str(), bitcode_sha1));
+  // {pCacheDir}/{pResName}.rsc
+  android::String8 container_path =
+      RSCacheContainer::GetPath(output_path.c_str());
 
-  //===--------------------------------------------------------------------===//
-  // Acquire the read lock for reading the Script object file.
-  //===--------------------------------------------------------------------===//
-  FileMutex<FileBase::kReadLock> read_output_mutex(output_path.c_str());
+  // Read the container ahead while the bitcode is hashed.
+  FileBase::Prefetch(container_path.string());
 
-  if (read_output_mutex.hasError() || !read_output_mutex.lock()) {
-    ALOGE("Unable to acquire the read lock for %s! (%s)", output_path.c_str(),
-          read_output_mutex.getErrorMessage().c_str());
-    return NULL;
+  uint8_t bitcode_sha1[SHA1_DIGEST_LENGTH];
+  getBitcodeSHA1(container_path.string(), pBitcode, pBitcodeSize,
+                 bitcode_sha1);
+
+  dep_info.push(std::make_pair(RSInfo::BitcodeDependencyName, bitcode_sha1));
+
+  // {pCacheDir}/{pResName}.prof
+  android::String8 profile_path;
+  RSProfile *profile = NULL;
+  bool profiled = addProfileDependency(output_path.c_str(), bitcode_sha1,
+                                       profile_path, profile, dep_info);
+  llvm::OwningPtr<RSProfile> profile_owner(profile);
+
+  std::set<std::string> used_exports;
+  uint8_t used_exports_digest[SHA1_DIGEST_LENGTH];
+  bool stripped = addUsedExportsDependency(pResName, used_exports,
+                                           used_exports_digest, dep_info);
+
+  uint8_t constants_digest[SHA1_DIGEST_LENGTH];
+  if (pConstants != NULL) {
+    GetExportConstantsDigest(*pConstants, constants_digest);
+    dep_info.push(std::make_pair(ExportConstantsDependencyName,
+                                 constants_digest));
+  }
+
+  bool emission_profiled = (mEmissionProfile >= 0);
+  if (emission_profiled) {
+    dep_info.push(std::make_pair(EmissionProfileDependencyName,
+                                 mEmissionProfileDigest));
+  }
+
+  if (mHasCustomRuntime) {
+    dep_info.push(std::make_pair(CustomRuntimeDependencyName,
+                                 mCustomRuntimeDigest));
   }
 
   //===--------------------------------------------------------------------===//
-  // Read the output object file.
+  // Try the in-process cache of the previously loaded objects first. It's
+  // keyed by the bitcode only, so a specialized script (whose values are
+  // checked in its info) never goes through it.
   //===--------------------------------------------------------------------===//
-  InputFile *object_file = new (std::nothrow) InputFile(output_path.c_str());
+  RSExecutableCache &exec_cache = RSExecutableCache::GetInstance();
+  RSExecutable *cached_result = NULL;
+  if (pConstants == NULL) {
+    cached_result = exec_cache.load(container_path.string(), bitcode_sha1,
+                                    mResolver);
+  }
+  if (cached_result != NULL) {
+    outcome.set(RSCacheStats::kMemoryHit);
+    return cached_result;
+  }
 
-  if ((object_file == NULL) || object_file->hasError()) {
-      //      ALOGE("Unable to open the %s for read! (%s)", output_path.c_str(),
-      //            object_file->getErrorMessage().c_str());
-    delete object_file;
-    return NULL;
+  //===--------------------------------------------------------------------===//
+  // Try the shared store.
+  //===--------------------------------------------------------------------===//
+  android::String8 shared_path;
+  if (!profiled && !stripped && (pConstants == NULL) && !emission_profiled &&
+      !mHasCustomRuntime && getSharedCachePath(bitcode_sha1, shared_path)) {
+    RSInfo::DependencyTableTy shared_dep_info;
+    shared_dep_info.push(std::make_pair(RSInfo::BitcodeDependencyName,
+                                        bitcode_sha1));
+
+    android::String8 shared_container =
+        RSCacheContainer::GetPath(shared_path.string());
+    cached_result = exec_cache.load(shared_container.string(), bitcode_sha1,
+                                    mResolver);
+    if (cached_result == NULL) {
+      cached_result = RSCacheContainer::Load(shared_container.string(),
+                                             shared_dep_info, mResolver,
+                                             bitcode_sha1);
+    }
+    if (cached_result != NULL) {
+      outcome.set(RSCacheStats::kSharedHit);
+      return cached_result;
+    }
   }
 
   //===--------------------------------------------------------------------===//
-  // Acquire the read lock on object_file for reading its RS info file.
+  // Load the RS cache container. It's published with rename() once complete,
+  // so there's no lock to take: one open and one mmap.
   //===--------------------------------------------------------------------===//
-  android::String8 info_path = RSInfo::GetPath(output_path.c_str());
+  // In the shared-object output mode, the dynamic linker shares the code of
+  // the instances instead of RSExecutableCache.
+  RSInfo::ReadStatus read_status;
+  android::String8 shared_object_path;
+  if (!mSharedObjectLinker.isEmpty()) {
+    shared_object_path =
+        RSCacheContainer::GetSharedObjectPath(output_path.c_str());
+  }
+  RSExecutable *result = NULL;
+  for (bool waited = false; ; waited = true) {
+    result = RSCacheContainer::Load(
+        container_path.string(), dep_info, mResolver,
+        ((shared_object_path.isEmpty() && (pConstants == NULL)) ?
+            bitcode_sha1 : NULL), &read_status,
+        (shared_object_path.isEmpty() ? NULL : shared_object_path.string()));
+    // A missing or stale container may be in the middle of its build by
+    // another process. Wait for it once instead of building it again.
+    if ((result != NULL) || (read_status == RSInfo::kReadOK) || waited ||
+        (mCacheWaitTimeout == 0) ||
+        !WaitForPublish(container_path.string(), mCacheWaitTimeout)) {
+      break;
+    }
+    ALOGV("Reload %s, which was just built by another process.",
+          container_path.string());
+  }
+  outcome.set(read_status);
+  if ((result == NULL) && (read_status == RSInfo::kReadOK)) {
+    // The info was accepted but the object couldn't be loaded.
+    outcome.set(RSCacheStats::kLoadFailed);
+  }
 
-  if (!object_file->lock()) {
-    ALOGE("Unable to acquire the read lock on %s for reading %s! (%s)",
-          output_path.c_str(), info_path.string(),
-          object_file->getErrorMessage().c_str());
-    delete object_file;
-    return NULL;
+  if ((result != NULL) && (mCacheQuota > 0)) {
+    RSCacheManager::Touch(pCacheDir,
+                          llvm::sys::path::stem(output_path).str().c_str());
   }
 
- //===---------------------------------------------------------------------===//
-  // Open and load the RS info file.
-  //===--------------------------------------------------------------------===//
-  InputFile info_file(info_path.string());
-  RSInfo *info = RSInfo::ReadFromFile(info_file, dep_info);
+  return result;
+}
 
-  // Release the lock on object_file.
-  object_file->unlock();
+void RSCompilerDriver::getBitcodeSHA1(const char *pContainerPath,
+                                      const char *pBitcode,
+                                      size_t pBitcodeSize,
+                                      uint8_t *pResult) const {
+  // The digest of a bitcode that records its SHA-1 costs next to nothing.
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+  if (!mParanoidCacheChecks && (wrapper.getSourceSHA1() == NULL)) {
+    RSCacheContainer::SourceDigest source;
+    if (RSCacheContainer::ReadSourceDigest(pContainerPath, source) &&
+        (source.mFingerprint ==
+             Sha1Util::GetFingerprintFromBuffer(pBitcode, pBitcodeSize))) {
+      ::memcpy(pResult, source.mSHA1, SHA1_DIGEST_LENGTH);
+      return;
+    }
+  }
 
-  if (info == NULL) {
-    delete object_file;
-    return NULL;
+  // No cache or another bitcode: the dependency check will tell.
+  GetBitcodeDigest(pBitcode, pBitcodeSize, mParanoidCacheChecks, pResult);
+}
+
+bool RSCompilerDriver::addProfileDependency(
+    const char *pObjPath, const uint8_t *pBitcodeSHA1,
+    android::String8 &pProfilePath, RSProfile *&pProfile,
+    RSInfo::DependencyTableTy &pDeps) const {
+  pProfilePath = RSProfile::GetPath(pObjPath);
+  pProfile = NULL;
+
+  if (mProfileInstrumentation) {
+    pDeps.push(std::make_pair(ProfileDependencyName,
+                              RSProfile::InstrumentedDigest));
+    return true;
   }
 
-  //===--------------------------------------------------------------------===//
-  // Create the RSExecutable.
-  //===--------------------------------------------------------------------===//
-  RSExecutable *result = RSExecutable::Create(*info, *object_file, mResolver);
-  if (result == NULL) {
-    delete object_file;
-    delete info;
-    return NULL;
+  pProfile = RSProfile::Read(pProfilePath.string(), pBitcodeSHA1);
+  if (pProfile == NULL) {
+    return false;
   }
+  pDeps.push(std::make_pair(ProfileDependencyName, pProfile->getSHA1()));
+  return true;
+}
 
-  return result;
+void RSCompilerDriver::setUsedExports(const char *pResName,
+                                      const std::set<std::string> *pNames) {
+  android::Mutex::Autolock locked(mUsedExportsLock);
+  if (pNames == NULL) {
+    mUsedExports.erase(pResName);
+  } else {
+    mUsedExports[pResName] = *pNames;
+  }
 }
 
-#if defined(DEFAULT_ARM_CODEGEN)
-extern llvm::cl::opt<bool> EnableGlobalMerge;
-#endif
+bool RSCompilerDriver::addUsedExportsDependency(
+    const char *pResName, std::set<std::string> &pNames,
+    uint8_t pDigest[SHA1_DIGEST_LENGTH],
+    RSInfo::DependencyTableTy &pDeps) const {
+  {
+    android::Mutex::Autolock locked(mUsedExportsLock);
+    std::map<std::string, std::set<std::string> >::const_iterator used =
+        mUsedExports.find(pResName);
+    if (used == mUsedExports.end()) {
+      return false;
+    }
+    pNames = used->second;
+  }
+
+  // The names are sorted (and NUL-terminated) so the digest only depends on
+  // the set.
+  Sha1Util::Context context;
+  for (std::set<std::string>::const_iterator name_iter = pNames.begin(),
+           name_end = pNames.end(); name_iter != name_end; name_iter++) {
+    context.update(name_iter->c_str(), name_iter->size() + 1);
+  }
+  context.finalize(pDigest);
+
+  pDeps.push(std::make_pair(UsedExportsDependencyName, pDigest));
+  return true;
+}
 
-bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
+bool RSCompilerDriver::getSharedCachePath(const uint8_t *pBitcodeSHA1,
+                                          android::String8 &pObjPath) const {
+  if (mSharedCacheDir.isEmpty()) {
+    return false;
+  }
+
+  // The built-in digest acts as the epoch of the store: entries compiled
+  // against other versions of libbcc, libRS or libclcore are never looked up.
+  const uint8_t *builtin_digest = RSInfo::GetBuiltInDigest();
+  if (builtin_digest == NULL) {
+    return false;
+  }
+
+  Sha1Util::Context key_context;
+  key_context.update(pBitcodeSHA1, SHA1_DIGEST_LENGTH);
+  key_context.update(builtin_digest, SHA1_DIGEST_LENGTH);
+  uint8_t key[SHA1_DIGEST_LENGTH];
+  key_context.finalize(key);
+
+  char key_name[SHA1_DIGEST_LENGTH * 2 + sizeof(".o")];
+  for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+    ::snprintf(key_name + i * 2, 3, "%02x", key[i]);
+  }
+  ::strcpy(key_name + SHA1_DIGEST_LENGTH * 2, ".o");
+
+  llvm::SmallString<80> path(mSharedCacheDir.string());
+  llvm::sys::path::append(path, key_name);
+  pObjPath.setTo(path.c_str());
+  return true;
+}
+
+bool RSCompilerDriver::linkSharedObject(const char *pOutputPath,
+                                        const void *pImage,
+                                        size_t pImageSize) const {
+  android::String8 so_path = RSCacheContainer::GetSharedObjectPath(pOutputPath);
+
+  // The input of the linker. It's never committed, so it's removed along with
+  // object_file.
+  AtomicOutputFile object_file(pOutputPath, FileBase::kBinary);
+  if (object_file.hasError() ||
+      (static_cast<size_t>(object_file.write(pImage, pImageSize)) !=
+           pImageSize)) {
+    ALOGE("Failed to write the object for the linker to %s! (%s)",
+          object_file.getName().c_str(), object_file.getErrorMessage().c_str());
+    return false;
+  }
+  object_file.close();
+
+  // The linker writes the temporary file of so_file, which is then moved to
+  // so_path as usual.
+  AtomicOutputFile so_file(so_path.string(), FileBase::kBinary);
+  if (so_file.hasError()) {
+    ALOGE("Unable to open %s for write! (%s)", so_file.getName().c_str(),
+          so_file.getErrorMessage().c_str());
+    return false;
+  }
+  so_file.close();
+
+  // argv is prepared before fork() since the child may only exec. The builds
+  // on the other slots may be splitting their own arguments.
+  android::String8 args(mSharedObjectLinkerArgs);
+  android::Vector<char *> argv;
+  argv.push(const_cast<char *>(mSharedObjectLinker.string()));
+  char *saved_arg = NULL;
+  for (char *arg = ::strtok_r(args.lockBuffer(args.size()), " ", &saved_arg);
+       arg != NULL; arg = ::strtok_r(NULL, " ", &saved_arg)) {
+    argv.push(arg);
+  }
+  argv.push(const_cast<char *>("-shared"));
+  argv.push(const_cast<char *>("-o"));
+  argv.push(const_cast<char *>(so_file.getName().c_str()));
+  argv.push(const_cast<char *>(object_file.getName().c_str()));
+  argv.push(NULL);
+
+  PhaseTimer timer(kPhaseLinkSharedObject, pOutputPath);
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::execv(argv[0], argv.editArray());
+    ::_exit(127);
+  }
+
+  int status = 0;
+  if ((pid < 0) || (::waitpid(pid, &status, 0) != pid)) {
+    ALOGE("Unable to run the linker %s! (%s)", argv[0], ::strerror(errno));
+    args.unlockBuffer();
+    return false;
+  }
+  args.unlockBuffer();
+
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+    ALOGE("The linker %s failed to link %s! (status: %d)", argv[0],
+          pOutputPath, status);
+    return false;
+  }
+
+  return so_file.commit();
+}
+
+bool RSCompilerDriver::setLTOProfile(const char *pName) {
+  CompilerConfig::LTOProfile profile;
+  if (!CompilerConfig::ParseLTOProfile(pName, profile)) {
+    ALOGE("Unknown LTO profile '%s'!", pName);
+    return false;
+  }
+  mLTOProfile = profile;
+  return true;
+}
+
+bool RSCompilerDriver::setEmissionProfile(const char *pName) {
+  CompilerConfig::EmissionProfile profile;
+  if (!CompilerConfig::ParseEmissionProfile(pName, profile)) {
+    ALOGE("Unknown emission profile '%s'!", pName);
+    return false;
+  }
+  mEmissionProfile = profile;
+  Sha1Util::GetSHA1DigestFromBuffer(mEmissionProfileDigest, pName,
+                                    ::strlen(pName));
+  return true;
+}
+
+bool RSCompilerDriver::setCustomRuntime(const char *pRuntimePath,
+                                        const char *pLinkRuntimeVersion) {
+  if ((pRuntimePath == NULL) && (pLinkRuntimeVersion == NULL)) {
+    mHasCustomRuntime = false;
+    return true;
+  }
+
+  // The digest of the library (zeros if none), then the version.
+  uint8_t runtime_sha1[SHA1_DIGEST_LENGTH] = { 0 };
+  if ((pRuntimePath != NULL) &&
+      !Sha1Util::GetSHA1DigestFromFile(runtime_sha1, pRuntimePath)) {
+    ALOGE("Unable to hash the custom runtime %s!", pRuntimePath);
+    return false;
+  }
+
+  Sha1Util::Context ctx;
+  ctx.update(runtime_sha1, SHA1_DIGEST_LENGTH);
+  if (pLinkRuntimeVersion != NULL) {
+    ctx.update(pLinkRuntimeVersion, ::strlen(pLinkRuntimeVersion));
+  }
+  ctx.finalize(mCustomRuntimeDigest);
+  mHasCustomRuntime = true;
+  return true;
+}
+
+bool RSCompilerDriver::setupConfig(const RSScript &pScript,
+                                   CompilerConfig *&pConfig) {
   bool changed = false;
 
   const llvm::CodeGenOpt::Level script_opt_level =
       static_cast<llvm::CodeGenOpt::Level>(pScript.getOptimizationLevel());
 
-  if (mConfig != NULL) {
+  if (pConfig != NULL) {
     // Renderscript bitcode may have their optimization flag configuration
     // different than the previous run of RS compilation.
-    if (mConfig->getOptimizationLevel() != script_opt_level) {
-      mConfig->setOptimizationLevel(script_opt_level);
+    if (pConfig->getOptimizationLevel() != script_opt_level) {
+      pConfig->setOptimizationLevel(script_opt_level);
       changed = true;
     }
   } else {
     // Haven't run the compiler ever.
-    mConfig = new (std::nothrow) DefaultCompilerConfig();
-    if (mConfig == NULL) {
-      // Return false since mConfig remains NULL and out-of-memory.
+    pConfig = new (std::nothrow) DefaultCompilerConfig();
+    if (pConfig == NULL) {
+      // Return false since pConfig remains NULL and out-of-memory.
       return false;
     }
-    mConfig->setOptimizationLevel(script_opt_level);
+    pConfig->setOptimizationLevel(script_opt_level);
+    changed = true;
+  }
+
+  // The script may ask for a different LTO pipeline than the driver's.
+  CompilerConfig::LTOProfile lto_profile = mLowMemory ?
+      CompilerConfig::kLTOFastCompile :
+      static_cast<CompilerConfig::LTOProfile>(mLTOProfile);
+  const char *script_lto_profile = (pScript.getInfo() != NULL) ?
+      pScript.getInfo()->getPragmaValue("rs_lto_profile") : NULL;
+  if ((script_lto_profile != NULL) &&
+      !CompilerConfig::ParseLTOProfile(script_lto_profile, lto_profile)) {
+    ALOGW("Ignore the unknown LTO profile '%s' requested by the script.",
+          script_lto_profile);
+  }
+  if (pConfig->getLTOProfile() != lto_profile) {
+    pConfig->setLTOProfile(lto_profile);
+    changed = true;
+  }
+
+  // So may it for the emission profile. The quick builds at -O0 don't spend
+  // the time of the assembler on the relaxation.
+  CompilerConfig::EmissionProfile emission_profile;
+  if (mEmissionProfile >= 0) {
+    emission_profile =
+        static_cast<CompilerConfig::EmissionProfile>(mEmissionProfile);
+  } else if (script_opt_level == llvm::CodeGenOpt::None) {
+    emission_profile = CompilerConfig::kEmitFast;
+  } else {
+    emission_profile = CompilerConfig::kEmitFastCode;
+  }
+  const char *script_emission_profile = (pScript.getInfo() != NULL) ?
+      pScript.getInfo()->getPragmaValue("rs_emission_profile") : NULL;
+  if ((script_emission_profile != NULL) &&
+      !CompilerConfig::ParseEmissionProfile(script_emission_profile,
+                                            emission_profile)) {
+    ALOGW("Ignore the unknown emission profile '%s' requested by the script.",
+          script_emission_profile);
+  }
+  changed |= pConfig->setEmissionProfile(emission_profile);
+
 #if defined(DEFAULT_ARM_CODEGEN)
-    EnableGlobalMerge = mEnableGlobalMerge;
+  // The compact code merges the globals regardless of setEnableGlobalMerge().
+  bool global_merge = (mEnableGlobalMerge ||
+                       (emission_profile == CompilerConfig::kEmitCompact));
+  if (pConfig->getEnableGlobalMerge() != global_merge) {
+    pConfig->setEnableGlobalMerge(global_merge);
+    changed = true;
+  }
 #endif
+
+  // The shared objects are linked from position-independent code.
+  llvm::Reloc::Model reloc_model = mSharedObjectLinker.isEmpty() ?
+      llvm::Reloc::Default : llvm::Reloc::PIC_;
+  if (pConfig->getRelocationModel() != reloc_model) {
+    pConfig->setRelocationModel(reloc_model);
     changed = true;
   }
 
 #if defined(DEFAULT_ARM_CODEGEN)
   // NEON should be disable when full-precision floating point is required.
+  // A script with relaxed kernels keeps it: the vector FP operations of its
+  // other functions are scalarized instead (see createRSPreciseFPPass().)
+  // The config is reused by the next script, so turn it back on otherwise.
   assert((pScript.getInfo() != NULL) && "NULL RS info!");
+  bool enable_neon = true;
   if (pScript.getInfo()->getFloatPrecisionRequirement() == RSInfo::FP_Full) {
-    // Must be ARMCompilerConfig.
-    ARMCompilerConfig *arm_config = static_cast<ARMCompilerConfig *>(mConfig);
-    changed |= arm_config->enableNEON(/* pEnable */false);
+    std::set<std::string> relaxed_kernels;
+    pScript.getInfo()->getRelaxedFPKernels(relaxed_kernels);
+    enable_neon = !relaxed_kernels.empty();
   }
+  // Must be ARMCompilerConfig.
+  ARMCompilerConfig *arm_config = static_cast<ARMCompilerConfig *>(pConfig);
+  changed |= arm_config->enableNEON(enable_neon);
 #endif
 
   return changed;
@@ -200,8 +1271,36 @@ RSCompilerDriver::compileScript(RSScript &pScript,
                                 const char *pOutputPath,
                                 const char *pRuntimePath,
                                 const RSInfo::DependencyTableTy &pDeps,
-                                bool pSkipLoad, bool pDumpIR) {
+                                bool pSkipLoad, bool pDumpIR,
+                                RSInfo *pPreparedInfo,
+                                const uint8_t *pCacheSHA1) {
   //android::StopWatch compile_time("bcc: RSCompilerDriver::compileScript time");
+  TraceSection trace("Compile", pScriptName);
+  if (mCompileLock.tryLock() != android::NO_ERROR) {
+    CompilerSlot *slot = (mCustomConfig ? NULL : acquireCompilerSlot());
+    if (slot != NULL) {
+      Compiler::ErrorCode result =
+          compileScriptWith(slot->mConfig, slot->mCompiler, pScript,
+                            pScriptName, pOutputPath, pRuntimePath, pDeps,
+                            pSkipLoad, pDumpIR, pPreparedInfo, pCacheSHA1);
+      releaseCompilerSlot(slot);
+      return result;
+    }
+    // Wait for mCompiler.
+    mCompileLock.lock();
+  }
+
+  Compiler::ErrorCode result =
+      compileScriptWith(mConfig, mCompiler, pScript, pScriptName, pOutputPath,
+                        pRuntimePath, pDeps, pSkipLoad, pDumpIR,
+                        pPreparedInfo, pCacheSHA1);
+  mCompileLock.unlock();
+  return result;
+}
+
+RSInfo *RSCompilerDriver::prepareScript(
+    RSScript &pScript, const char *pScriptName, const char *pRuntimePath,
+    const RSInfo::DependencyTableTy &pDeps) {
   RSInfo *info = NULL;
 
   //===--------------------------------------------------------------------===//
@@ -209,9 +1308,12 @@ RSCompilerDriver::compileScript(RSScript &pScript,
   //===--------------------------------------------------------------------===//
   // RS info may contains configuration (such as #optimization_level) to the
   // compiler therefore it should be extracted before compilation.
-  info = RSInfo::ExtractFromSource(pScript.getSource(), pDeps);
+  {
+    PhaseTimer timer(kPhaseExtractInfo, pScriptName);
+    info = RSInfo::ExtractFromSource(pScript.getSource(), pDeps);
+  }
   if (info == NULL) {
-    return Compiler::kErrInvalidSource;
+    return NULL;
   }
 
   //===--------------------------------------------------------------------===//
@@ -221,111 +1323,276 @@ RSCompilerDriver::compileScript(RSScript &pScript,
   // to do some transformation (e.g., expand foreach-able function.)
   pScript.setInfo(info);
 
+  // Size the buffer of the object from the script alone.
+  pScript.setObjectSizeHint(
+      EstimateObjectSize(pScript.getSource().getModule()));
+
   //===--------------------------------------------------------------------===//
   // Link RS script with Renderscript runtime.
   //===--------------------------------------------------------------------===//
-  if (!RSScript::LinkRuntime(pScript, pRuntimePath)) {
-    ALOGE("Failed to link script '%s' with Renderscript runtime!", pScriptName);
+  {
+    PhaseTimer timer(kPhaseLinkRuntime, pScriptName);
+    if (!RSScript::LinkRuntime(pScript, pRuntimePath)) {
+      ALOGE("Failed to link script '%s' with Renderscript runtime!",
+            pScriptName);
+      return NULL;
+    }
+  }
+
+  return info;
+}
+
+Compiler::ErrorCode
+RSCompilerDriver::compileScriptWith(CompilerConfig *&pConfig,
+                                    RSCompiler &pCompiler,
+                                    RSScript &pScript,
+                                    const char* pScriptName,
+                                    const char *pOutputPath,
+                                    const char *pRuntimePath,
+                                    const RSInfo::DependencyTableTy &pDeps,
+                                    bool pSkipLoad, bool pDumpIR,
+                                    RSInfo *pPreparedInfo,
+                                    const uint8_t *pCacheSHA1) {
+  RSInfo *info = pPreparedInfo;
+  if (info == NULL) {
+    info = prepareScript(pScript, pScriptName, pRuntimePath, pDeps);
+    if (info == NULL) {
+      return Compiler::kErrInvalidSource;
+    }
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Setup the config to the compiler.
+  //===--------------------------------------------------------------------===//
+  bool compiler_need_reconfigure = setupConfig(pScript, pConfig);
+
+  if (pConfig == NULL) {
+    ALOGE("Failed to setup config for RS compiler to compile %s!",
+          pOutputPath);
     return Compiler::kErrInvalidSource;
   }
 
-  {
-    // FIXME(srhines): Windows compilation can't use locking like this, but
-    // we also don't need to worry about concurrent writers of the same file.
-#ifndef USE_MINGW
-    //===------------------------------------------------------------------===//
-    // Acquire the write lock for writing output object file.
-    //===------------------------------------------------------------------===//
-    FileMutex<FileBase::kWriteLock> write_output_mutex(pOutputPath);
-
-    if (write_output_mutex.hasError() || !write_output_mutex.lock()) {
-      ALOGE("Unable to acquire the lock for writing %s! (%s)",
-            pOutputPath, write_output_mutex.getErrorMessage().c_str());
+  if (compiler_need_reconfigure) {
+    Compiler::ErrorCode err = pCompiler.config(*pConfig);
+    if (err != Compiler::kSuccess) {
+      ALOGE("Failed to config the RS compiler for %s! (%s)",pOutputPath,
+            Compiler::GetErrorString(err));
       return Compiler::kErrInvalidSource;
     }
-#endif
+  }
+
+  OutputFile *ir_file = NULL;
+  llvm::raw_fd_ostream *IRStream = NULL;
+  if (pDumpIR && mLowMemory) {
+    ALOGW("Skip dumping the IR of %s in the low-memory mode.", pScriptName);
+    pDumpIR = false;
+  }
+  if (pDumpIR) {
+    android::String8 path(pOutputPath);
+    path.append(".ll");
+    ir_file = new OutputFile(path.string(), FileBase::kTruncate);
+    IRStream = ir_file->dup();
+  }
+
+  // Run the compiler. The whole module is compiled into a single object each
+  // time, and nothing of the previous output is reused. ObjectLoader takes
+  // one object, with the references between its functions resolved within
+  // it, so it can't mix the code of two compiles. Only the shared-object mode
+  // (see linkSharedObject()) could relink the unchanged functions, and only
+  // from objects of their own, which needs the module split per function
+  // (see the FIXME of Compiler::runCodeGen().)
+  Compiler::ErrorCode compile_result;
 
-    // Open the output file for write.
-    OutputFile output_file(pOutputPath,
-                           FileBase::kTruncate | FileBase::kBinary);
+  if (pSkipLoad) {
+    // The object file itself is the product (e.g., an offline compilation.)
+    // It's written to a temporary file and renamed to pOutputPath once
+    // complete, so concurrent readers never see a partial file.
+    AtomicOutputFile output_file(pOutputPath, FileBase::kBinary);
 
     if (output_file.hasError()) {
-        ALOGE("Unable to open %s for write! (%s)", pOutputPath,
-              output_file.getErrorMessage().c_str());
+      ALOGE("Unable to open %s for write! (%s)", output_file.getName().c_str(),
+            output_file.getErrorMessage().c_str());
+      delete ir_file;
       return Compiler::kErrInvalidSource;
     }
 
-    // Setup the config to the compiler.
-    bool compiler_need_reconfigure = setupConfig(pScript);
-
-    if (mConfig == NULL) {
-      ALOGE("Failed to setup config for RS compiler to compile %s!",
-            pOutputPath);
-      return Compiler::kErrInvalidSource;
+    compile_result = pCompiler.compile(pScript, output_file, IRStream);
+    if ((compile_result == Compiler::kSuccess) &&
+        !output_file.commit(mCacheSync)) {
+      compile_result = Compiler::kErrInvalidSource;
     }
+  } else {
+    // Compile into memory and publish the object together with its info in
+    // the RS cache container afterwards. In the low-memory mode, the object
+    // is streamed to a scratch file next to pOutputPath instead and read back
+    // through a mapping. The scratch file is never committed, so it's removed
+    // along with scratch_file.
+    llvm::SmallVector<char, 0> object_image;
+    AtomicOutputFile *scratch_file = NULL;
+    android::FileMap *scratch_map = NULL;
+    const void *image = NULL;
+    size_t image_size = 0;
+    uint32_t required_features = 0;
+    FallbackBuild fallbacks[MaxFallbackBuilds];
+    unsigned num_fallbacks = 0;
+
+    if (!mLowMemory) {
+      // The fallbacks are compiled from copies of the module taken before the
+      // passes of the main compilation run on it.
+      if (mMultiversioning) {
+        required_features = GetRequiredCPUFeatures(*pConfig);
+        num_fallbacks = PrepareFallbackBuilds(pScript, required_features,
+                                              fallbacks);
+      }
+      {
+        // The code generator appends to the buffer in small pieces.
+        object_image.reserve(pScript.getObjectSizeHint());
+        llvm::raw_svector_ostream object_stream(object_image);
+        compile_result = pCompiler.compile(pScript, object_stream, IRStream);
+      }
+      image = object_image.data();
+      image_size = object_image.size();
 
-    if (compiler_need_reconfigure) {
-      Compiler::ErrorCode err = mCompiler.config(*mConfig);
-      if (err != Compiler::kSuccess) {
-        ALOGE("Failed to config the RS compiler for %s! (%s)",pOutputPath,
-              Compiler::GetErrorString(err));
-        return Compiler::kErrInvalidSource;
+      if ((compile_result == Compiler::kSuccess) && (num_fallbacks > 0)) {
+        num_fallbacks = CompileFallbackBuilds(*pConfig, pCompiler, pScript,
+                                              fallbacks, num_fallbacks);
+      }
+    } else {
+      compile_result = Compiler::kErrInvalidSource;
+      scratch_file = new (std::nothrow) AtomicOutputFile(pOutputPath,
+                                                         FileBase::kBinary);
+      if ((scratch_file == NULL) || scratch_file->hasError()) {
+        ALOGE("Unable to open the scratch file for %s! (%s)", pOutputPath,
+              ((scratch_file != NULL) ?
+                  scratch_file->getErrorMessage().c_str() : "out of memory"));
+      } else if (pCompiler.compile(pScript, *scratch_file, IRStream) ==
+                     Compiler::kSuccess) {
+        scratch_file->close();
+        InputFile scratch_input(scratch_file->getName());
+        size_t scratch_size = scratch_input.getSize();
+        if (!scratch_input.hasError() && (scratch_size > 0)) {
+          scratch_map = scratch_input.createMap(0, scratch_size);
+        }
+        if (scratch_map == NULL) {
+          ALOGE("Failed to map the scratch file of %s! (%s)", pOutputPath,
+                scratch_input.getErrorMessage().c_str());
+        } else {
+          image = scratch_map->getDataPtr();
+          image_size = scratch_size;
+          compile_result = Compiler::kSuccess;
+        }
       }
     }
 
-    OutputFile *ir_file = NULL;
-    llvm::raw_fd_ostream *IRStream = NULL;
-    if (pDumpIR) {
-      android::String8 path(pOutputPath);
-      path.append(".ll");
-      ir_file = new OutputFile(path.string(), FileBase::kTruncate);
-      IRStream = ir_file->dup();
+    // The object is complete. Take what's left to read from the module (the
+    // kernel costs, to let the runtime size its chunks) and free it, along
+    // with the linked runtime library, before the container is written and
+    // loaded. From here on, only the image and the info are used.
+    if (compile_result == Compiler::kSuccess) {
+      info->recordExportForeachCosts(pScript.getSource().getModule());
+      // And where the export vars are in their block (if they're in one.)
+      info->recordExportVarLayout(pScript.getSource().getModule());
+      pScript.getSource().releaseModule();
     }
 
-    // Run the compiler.
-    Compiler::ErrorCode compile_result = mCompiler.compile(pScript,
-                                                           output_file, IRStream);
+    if (compile_result == Compiler::kSuccess) {
+      PhaseTimer timer(kPhaseWriteInfo, pScriptName);
+      android::String8 container_path =
+          RSCacheContainer::GetPath(pOutputPath);
+
+      // Let the loads of the container locate the exports without looking
+      // their names up. Without the locations, the names are used.
+      info->recordExportSymbols(image, image_size);
+
+      // The container cached in memory (if any) is about to be replaced and so
+      // is the shared object linked from the previous one.
+      RSExecutableCache::GetInstance().invalidate(container_path.string());
+      bool existed;
+      llvm::sys::fs::remove(
+          RSCacheContainer::GetSharedObjectPath(pOutputPath).string(),
+          existed);
+
+      RSCacheContainer::Object objects[1 + MaxFallbackBuilds];
+      objects[0].mImage = image;
+      objects[0].mImageSize = image_size;
+      objects[0].mRequiredFeatures = required_features;
+      objects[0].mRawSize = 0;
+      for (unsigned i = 0; i < num_fallbacks; i++) {
+        objects[i + 1].mImage = fallbacks[i].mImage.data();
+        objects[i + 1].mImageSize = fallbacks[i].mImage.size();
+        objects[i + 1].mRequiredFeatures = fallbacks[i].mFeatures;
+        objects[i + 1].mRawSize = 0;
+      }
 
-    if (ir_file) {
-      ir_file->close();
-      delete ir_file;
+      RSCacheContainer::SourceDigest source;
+      if (pScript.getSourceSHA1() != NULL) {
+        source.mFingerprint = pScript.getSourceFingerprint();
+        ::memcpy(source.mSHA1, pScript.getSourceSHA1(), SHA1_DIGEST_LENGTH);
+      }
+
+      // Record the IDs of the runtime symbols the object uses for its loads.
+      android::Vector<uint32_t> binding_ids;
+      RSCacheContainer::RuntimeBindings bindings;
+      bindings.mCount = 0;
+      if (mResolver.hasIndexedSymbols()) {
+        android::Vector<const char *> undefined;
+        if (ObjectLoader::GetUndefinedSymbols(image, image_size, undefined)) {
+          for (size_t i = 0, e = undefined.size(); i < e; i++) {
+            binding_ids.push(mResolver.getSymbolID(undefined[i]));
+          }
+          bindings.mVersion = mResolver.getIndexedSymbolsVersion();
+          bindings.mIDs = binding_ids.array();
+          bindings.mCount = binding_ids.size();
+        } else {
+          ALOGW("Failed to list the undefined symbols of %s. Its loads will "
+                "look them up by name.", pOutputPath);
+        }
+      }
+
+      if (!RSCacheContainer::Write(container_path.string(), *info, objects,
+                                   1 + num_fallbacks, mCacheSync,
+                                   ((pScript.getSourceSHA1() != NULL) ?
+                                        &source : NULL),
+                                   &bindings, mCompressCaches)) {
+        ALOGE("Failed to write the RS cache container %s!",
+              container_path.string());
+        compile_result = Compiler::kErrInvalidSource;
+      } else {
+        if ((pCacheSHA1 != NULL) && !mLowMemory) {
+          KeepCompiledObject(container_path.string(), pCacheSHA1, image,
+                             image_size, *info);
+        }
+        if (!mSharedObjectLinker.isEmpty() &&
+            !linkSharedObject(pOutputPath, image, image_size)) {
+          // The object in the container is loaded instead.
+          ALOGW("Failed to link %s into a shared object!", pOutputPath);
+        }
+      }
     }
 
-    if (compile_result != Compiler::kSuccess) {
-      ALOGE("Unable to compile the source to file %s! (%s)", pOutputPath,
-            Compiler::GetErrorString(compile_result));
-      return Compiler::kErrInvalidSource;
+    if (scratch_map != NULL) {
+      scratch_map->release();
+    }
+    delete scratch_file;
+    for (unsigned i = 0; i < MaxFallbackBuilds; i++) {
+      delete fallbacks[i].mModule;
     }
   }
 
-  // No need to produce an RSExecutable in this case.
-  // TODO: Error handling in this case is nonexistent.
-  if (pSkipLoad) {
-    return Compiler::kSuccess;
+  if (ir_file) {
+    ir_file->close();
+    delete ir_file;
   }
 
-  {
-    android::String8 info_path = RSInfo::GetPath(pOutputPath);
-    OutputFile info_file(info_path.string(), FileBase::kTruncate);
-
-    if (info_file.hasError()) {
-      ALOGE("Failed to open the info file %s for write! (%s)",
-            info_path.string(), info_file.getErrorMessage().c_str());
-      return Compiler::kErrInvalidSource;
-    }
-
-    FileMutex<FileBase::kWriteLock> write_info_mutex(info_path.string());
-    if (write_info_mutex.hasError() || !write_info_mutex.lock()) {
-      ALOGE("Unable to acquire the lock for writing %s! (%s)",
-            info_path.string(), write_info_mutex.getErrorMessage().c_str());
-      return Compiler::kErrInvalidSource;
-    }
-
-    // Perform the write.
-    if (!info->write(info_file)) {
-      ALOGE("Failed to sync the RS info file %s!", info_path.string());
-      return Compiler::kErrInvalidSource;
+  if (compile_result != Compiler::kSuccess) {
+    // Not an error: whoever raised the token no longer wants the object.
+    if (pScript.isCancelled()) {
+      ALOGV("The compilation of %s is cancelled.", pOutputPath);
+      return Compiler::kErrCancelled;
     }
+    ALOGE("Unable to compile the source to file %s! (%s)", pOutputPath,
+          Compiler::GetErrorString(compile_result));
+    return Compiler::kErrInvalidSource;
   }
 
   return Compiler::kSuccess;
@@ -338,8 +1605,202 @@ bool RSCompilerDriver::build(BCCContext &pContext,
                              size_t pBitcodeSize,
                              const char *pRuntimePath,
                              RSLinkRuntimeCallback pLinkRuntimeCallback,
-                             bool pDumpIR) {
+                             bool pDumpIR,
+                             const CancellationToken *pCancelToken) {
+  return buildImpl(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                   pRuntimePath, pLinkRuntimeCallback, pDumpIR,
+                   /* pTier0 */false, /* pLegacyTargetAPI */0,
+                   /* pDeviceCacheDir */NULL, /* pConstants */NULL,
+                   pCancelToken);
+}
+
+RSExecutable *
+RSCompilerDriver::buildAndLoad(BCCContext &pContext, const char *pCacheDir,
+                               const char *pResName, const char *pBitcode,
+                               size_t pBitcodeSize, const char *pRuntimePath,
+                               RSLinkRuntimeCallback pLinkRuntimeCallback,
+                               bool pDumpIR) {
+  PendingBuild *build = beginBuild(pContext, pCacheDir, pResName, pBitcode,
+                                   pBitcodeSize, pRuntimePath,
+                                   pLinkRuntimeCallback, pDumpIR,
+                                   /* pTier0 */false, /* pLegacyTargetAPI */0,
+                                   /* pDeviceCacheDir */NULL,
+                                   /* pConstants */NULL);
+  if (build == NULL) {
+    return NULL;
+  }
+
+  // The build is gone after finishBuild().
+  bool in_memory = build->mKeepInMemory && !mLowMemory;
+  uint8_t bitcode_sha1[SHA1_DIGEST_LENGTH];
+  ::memcpy(bitcode_sha1, build->mBitcodeSHA1, SHA1_DIGEST_LENGTH);
+  android::String8 container_path =
+      RSCacheContainer::GetPath(build->mOutputPath.c_str());
+
+  if (!finishBuild(build)) {
+    return NULL;
+  }
+
+  RSExecutable *result = NULL;
+  if (in_memory) {
+    // Kept by compileScriptWith() (see KeepCompiledObject().)
+    result = RSExecutableCache::GetInstance().load(container_path.string(),
+                                                   bitcode_sha1, mResolver);
+  }
+  if (result == NULL) {
+    result = loadScript(pCacheDir, pResName, pBitcode, pBitcodeSize);
+  }
+  return result;
+}
+
+bool RSCompilerDriver::buildLegacy(BCCContext &pContext,
+                                   const char *pCacheDir,
+                                   const char *pResName,
+                                   const char *pBitcode,
+                                   size_t pBitcodeSize,
+                                   unsigned pTargetAPI,
+                                   const char *pRuntimePath,
+                                   RSLinkRuntimeCallback pLinkRuntimeCallback,
+                                   bool pDumpIR) {
+  return buildImpl(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                   pRuntimePath, pLinkRuntimeCallback, pDumpIR,
+                   /* pTier0 */false, pTargetAPI);
+}
+
+bool RSCompilerDriver::buildSpecialized(
+    BCCContext &pContext, const char *pCacheDir, const char *pResName,
+    const char *pBitcode, size_t pBitcodeSize,
+    const RSScript::ExportConstantMapTy &pConstants, const char *pRuntimePath,
+    RSLinkRuntimeCallback pLinkRuntimeCallback) {
+  if (pResName == NULL) {
+    ALOGE("Invalid parameter passed to RSCompilerDriver::buildSpecialized()! "
+          "(resource name: (null))");
+    return false;
+  }
+  android::String8 spec_name(pResName);
+  spec_name.append(SpecializedSuffix);
+  return buildImpl(pContext, pCacheDir, spec_name.string(), pBitcode,
+                   pBitcodeSize, pRuntimePath, pLinkRuntimeCallback,
+                   /* pDumpIR */false, /* pTier0 */false,
+                   /* pLegacyTargetAPI */0, /* pDeviceCacheDir */NULL,
+                   &pConstants);
+}
+
+bool RSCompilerDriver::buildForDevice(BCCContext &pContext,
+                                      const char *pOutDir,
+                                      const char *pDeviceCacheDir,
+                                      const char *pResName,
+                                      const char *pBitcode,
+                                      size_t pBitcodeSize,
+                                      bool pDumpIR) {
+  if (pDeviceCacheDir == NULL) {
+    ALOGE("No device cache directory to build %s for!",
+          ((pResName) ? pResName : "(null)"));
+    return false;
+  }
+  return buildImpl(pContext, pOutDir, pResName, pBitcode, pBitcodeSize,
+                   /* pRuntimePath */NULL, /* pLinkRuntimeCallback */NULL,
+                   pDumpIR, /* pTier0 */false, /* pLegacyTargetAPI */0,
+                   pDeviceCacheDir);
+}
+
+// The state of a build between beginBuild() and finishBuild(). The
+// dependency table points into it.
+struct RSCompilerDriver::PendingBuild {
+  BCCContext &mContext;
+  android::String8 mResName;
+  size_t mBitcodeSize;
+  const char *mRuntimePath;
+  bool mDumpIR;
+
+  uint8_t mBitcodeSHA1[SHA1_DIGEST_LENGTH];
+  uint64_t mBitcodeFingerprint;
+  llvm::SmallString<80> mOutputPath;
+  llvm::SmallString<80> mDeviceOutputPath;
+  android::String8 mProfilePath;
+  llvm::OwningPtr<RSProfile> mProfile;
+  std::set<std::string> mUsedExports;
+  uint8_t mUsedExportsDigest[SHA1_DIGEST_LENGTH];
+  uint8_t mConstantsDigest[SHA1_DIGEST_LENGTH];
+  RSInfo::DependencyTableTy mDeps;
+
+  // Whether the object may be kept in RSExecutableCache once it's built (see
+  // KeepCompiledObject().)
+  bool mKeepInMemory;
+
+  RSScript *mScript;
+  // Returned by prepareScript() for mScript.
+  RSInfo *mInfo;
+
+  // Held on {container}.lock from the beginning of the build until its
+  // container is written, if it could be taken (see setCacheWaitTimeout().)
+  llvm::OwningPtr<FileMutex<FileBase::kWriteLock> > mPublishLock;
+
+  PendingBuild(BCCContext &pContext, const char *pResName,
+               size_t pBitcodeSize, const char *pRuntimePath, bool pDumpIR)
+    : mContext(pContext), mResName(pResName), mBitcodeSize(pBitcodeSize),
+      mRuntimePath(pRuntimePath), mDumpIR(pDumpIR), mKeepInMemory(false),
+      mScript(NULL), mInfo(NULL) { }
+
+  ~PendingBuild() {
+    // Removed while it's still locked, and then released.
+    if (mPublishLock) {
+      ::remove(mPublishLock->getName().c_str());
+    }
+
+    if (mScript == NULL) {
+      return;
+    }
+    // Script is no longer used. Free it (and its source, which the context
+    // would otherwise keep until it's destroyed) to get more memory.
+    Source *source = &mScript->getSource();
+    delete mScript;
+    delete source;
+
+    // The LLVM context may be recycled now that the script is gone.
+    mContext.recordCompile(mBitcodeSize);
+  }
+};
+
+bool RSCompilerDriver::buildImpl(BCCContext &pContext,
+                                 const char *pCacheDir,
+                                 const char *pResName,
+                                 const char *pBitcode,
+                                 size_t pBitcodeSize,
+                                 const char *pRuntimePath,
+                                 RSLinkRuntimeCallback pLinkRuntimeCallback,
+                                 bool pDumpIR, bool pTier0,
+                                 unsigned pLegacyTargetAPI,
+                                 const char *pDeviceCacheDir,
+                                 const RSScript::ExportConstantMapTy
+                                     *pConstants,
+                                 const CancellationToken *pCancelToken) {
     //  android::StopWatch build_time("bcc: RSCompilerDriver::build time");
+  PendingBuild *build = beginBuild(pContext, pCacheDir, pResName, pBitcode,
+                                   pBitcodeSize, pRuntimePath,
+                                   pLinkRuntimeCallback, pDumpIR, pTier0,
+                                   pLegacyTargetAPI, pDeviceCacheDir,
+                                   pConstants);
+  if (build == NULL) {
+    return false;
+  }
+  build->mScript->setCancellationToken(pCancelToken);
+  return finishBuild(build);
+}
+
+RSCompilerDriver::PendingBuild *
+RSCompilerDriver::beginBuild(BCCContext &pContext,
+                             const char *pCacheDir,
+                             const char *pResName,
+                             const char *pBitcode,
+                             size_t pBitcodeSize,
+                             const char *pRuntimePath,
+                             RSLinkRuntimeCallback pLinkRuntimeCallback,
+                             bool pDumpIR, bool pTier0,
+                             unsigned pLegacyTargetAPI,
+                             const char *pDeviceCacheDir,
+                             const RSScript::ExportConstantMapTy
+                                 *pConstants) {
   //===--------------------------------------------------------------------===//
   // Check parameters.
   //===--------------------------------------------------------------------===//
@@ -347,39 +1808,160 @@ bool RSCompilerDriver::build(BCCContext &pContext,
     ALOGE("Invalid parameter passed to RSCompilerDriver::build()! (cache dir: "
           "%s, resource name: %s)", ((pCacheDir) ? pCacheDir : "(null)"),
                                     ((pResName) ? pResName : "(null)"));
-    return false;
+    return NULL;
   }
 
   if ((pBitcode == NULL) || (pBitcodeSize <= 0)) {
     ALOGE("No bitcode supplied! (bitcode: %p, size of bitcode: %u)",
           pBitcode, static_cast<unsigned>(pBitcodeSize));
-    return false;
+    return NULL;
+  }
+
+  PendingBuild *build = new (std::nothrow) PendingBuild(pContext, pResName,
+                                                        pBitcodeSize,
+                                                        pRuntimePath,
+                                                        pDumpIR);
+  if (build == NULL) {
+    ALOGE("Out of memory when build '%s'!", pResName);
+    return NULL;
   }
+  llvm::OwningPtr<PendingBuild> build_owner(build);
 
   //===--------------------------------------------------------------------===//
   // Prepare dependency information.
   //===--------------------------------------------------------------------===//
-  RSInfo::DependencyTableTy dep_info;
-  uint8_t bitcode_sha1[20];
-  Sha1Util::GetSHA1DigestFromBuffer(bitcode_sha1, pBitcode, pBitcodeSize);
+  GetBitcodeDigest(pBitcode, pBitcodeSize, mParanoidCacheChecks,
+                   build->mBitcodeSHA1);
+  build->mBitcodeFingerprint =
+      Sha1Util::GetFingerprintFromBuffer(pBitcode, pBitcodeSize);
 
   //===--------------------------------------------------------------------===//
   // Construct output path.
   // {pCacheDir}/{pResName}.o
   //===--------------------------------------------------------------------===//
-  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::SmallString<80> &output_path = build->mOutputPath;
+  output_path = pCacheDir;
   llvm::sys::path::append(output_path, pResName);
   llvm::sys::path::replace_extension(output_path, ".o");
 
-  dep_info.push(std::make_pair(output_path.c_str(), bitcode_sha1));
+  // {pDeviceCacheDir}/{pResName}.o, the path loadScript() will look the
+  // cache up with on the device.
+  if (pDeviceCacheDir != NULL) {
+    build->mDeviceOutputPath = pDeviceCacheDir;
+    llvm::sys::path::append(build->mDeviceOutputPath, pResName);
+    llvm::sys::path::replace_extension(build->mDeviceOutputPath, ".o");
+  }
+
+  // {pCacheDir}/{pResName}.prof and the used exports. Recorded after the
+  // bitcode.
+  RSProfile *profile = NULL;
+  RSInfo::DependencyTableTy extra_dep_info;
+  bool profiled = false;
+  if (pDeviceCacheDir == NULL) {
+    profiled = addProfileDependency(output_path.c_str(), build->mBitcodeSHA1,
+                                    build->mProfilePath, profile,
+                                    extra_dep_info);
+  }
+  build->mProfile.reset(profile);
+
+  bool stripped = addUsedExportsDependency(pResName, build->mUsedExports,
+                                           build->mUsedExportsDigest,
+                                           extra_dep_info);
+
+  if (pConstants != NULL) {
+    GetExportConstantsDigest(*pConstants, build->mConstantsDigest);
+    extra_dep_info.push(std::make_pair(ExportConstantsDependencyName,
+                                       build->mConstantsDigest));
+  }
+
+  bool emission_profiled = (mEmissionProfile >= 0);
+  if (emission_profiled) {
+    extra_dep_info.push(std::make_pair(EmissionProfileDependencyName,
+                                       mEmissionProfileDigest));
+  }
+
+  if (mHasCustomRuntime) {
+    extra_dep_info.push(std::make_pair(CustomRuntimeDependencyName,
+                                       mCustomRuntimeDigest));
+  } else if ((pRuntimePath != NULL) || (pLinkRuntimeCallback != NULL)) {
+    ALOGW("The cache of %s can't tell when its custom runtime changes! (see "
+          "RSCompilerDriver::setCustomRuntime())", pResName);
+  }
+
+  // Compile into the shared store instead if this process can publish to it.
+  // Scripts with a custom runtime, a profile, stripped exports, constants or
+  // an emission profile of the driver are private to their process.
+  android::String8 shared_path;
+  bool shared = false;
+  if (!pTier0 && !profiled && !stripped && (pConstants == NULL) &&
+      !emission_profiled &&
+      (pDeviceCacheDir == NULL) &&
+      (pRuntimePath == NULL) && (pLinkRuntimeCallback == NULL) &&
+      mSharedObjectLinker.isEmpty() &&
+      getSharedCachePath(build->mBitcodeSHA1, shared_path) &&
+      (::access(mSharedCacheDir.string(), W_OK) == 0)) {
+    output_path = shared_path.string();
+    shared = true;
+  }
+
+  // loadScript() looks the local container of a regular script up in
+  // RSExecutableCache first.
+  build->mKeepInMemory = (!shared && (pConstants == NULL) &&
+                          (pDeviceCacheDir == NULL) &&
+                          mSharedObjectLinker.isEmpty());
+
+  build->mDeps.push(std::make_pair(RSInfo::BitcodeDependencyName,
+                                   build->mBitcodeSHA1));
+  build->mDeps.appendVector(extra_dep_info);
+
+  // Let the loads of the container in other processes wait for it rather
+  // than build it too (see WaitForPublish().) A build of the same container
+  // already in progress keeps its lock and this one goes on without.
+  if (pDeviceCacheDir == NULL) {
+    FileMutex<FileBase::kWriteLock> *publish_lock =
+        new (std::nothrow) FileMutex<FileBase::kWriteLock>(
+            RSCacheContainer::GetPath(output_path.c_str()).string(),
+            /* pFlags */0);
+    if ((publish_lock != NULL) && !publish_lock->hasError() &&
+        publish_lock->lock(/* pNonblocking */true, /* pMaxRetry */0,
+                           /* pRetryInterval */0)) {
+      build->mPublishLock.reset(publish_lock);
+    } else {
+      delete publish_lock;
+    }
+  }
 
   //===--------------------------------------------------------------------===//
   // Load the bitcode and create script.
   //===--------------------------------------------------------------------===//
-  Source *source = Source::CreateFromBuffer(pContext, pResName,
-                                            pBitcode, pBitcodeSize);
+  // The wrapper is decoded once (in place) for the whole build.
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+
+  Source *source = NULL;
+  {
+    PhaseTimer timer(kPhaseBitcodeParse, pResName);
+    bcinfo::BitcodeTranslator translator(wrapper, pLegacyTargetAPI);
+    if ((pLegacyTargetAPI != 0) && translator.needsTranslation()) {
+      // Hand the upgraded module to the compiler as is.
+      llvm::Module *module =
+          translator.translateToModule(pContext.getLLVMContext());
+      if (module == NULL) {
+        ALOGE("Failed to translate the legacy bitcode of %s! (target API: %u)",
+              pResName, pLegacyTargetAPI);
+        return NULL;
+      }
+      module->setModuleIdentifier(pResName);
+      source = Source::CreateFromModule(pContext, *module);
+      if (source == NULL) {
+        delete module;
+      }
+    } else {
+      source = Source::CreateFromBuffer(pContext, pResName, pBitcode,
+                                        pBitcodeSize);
+    }
+  }
   if (source == NULL) {
-    return false;
+    return NULL;
   }
 
   RSScript *script = new (std::nothrow) RSScript(*source);
@@ -387,32 +1969,78 @@ bool RSCompilerDriver::build(BCCContext &pContext,
     ALOGE("Out of memory when create Script object for '%s'! (output: %s)",
           pResName, output_path.c_str());
     delete source;
-    return false;
+    return NULL;
   }
+  build->mScript = script;
 
   script->setLinkRuntimeCallback(pLinkRuntimeCallback);
+  if (stripped) {
+    script->setUsedExports(&build->mUsedExports);
+  }
+  script->setExportConstants(pConstants);
+  script->setExportVarBlock(mExportVarBlock);
+  script->setReducedRelocations(mReducedRelocations);
+  script->setKernelCounters(mKernelCounters, mKernelCycleCounters);
+  script->setSourceDigest(build->mBitcodeFingerprint, build->mBitcodeSHA1);
+  if (mProfileInstrumentation && (pDeviceCacheDir == NULL)) {
+    script->setProfileSourceSHA1(build->mBitcodeSHA1);
+  } else {
+    script->setProfile(profile);
+  }
 
   // Read information from bitcode wrapper.
-  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
   script->setCompilerVersion(wrapper.getCompilerVersion());
-  script->setOptimizationLevel(static_cast<RSScript::OptimizationLevel>(
-                                   wrapper.getOptimizationLevel()));
+  if (pTier0) {
+    script->setOptimizationLevel(RSScript::kOptLvl0);
+  } else {
+    script->setOptimizationLevel(static_cast<RSScript::OptimizationLevel>(
+                                     wrapper.getOptimizationLevel()));
+  }
 
   //===--------------------------------------------------------------------===//
-  // Compile the script
+  // Extract the info and link the runtime.
   //===--------------------------------------------------------------------===//
-  Compiler::ErrorCode status = compileScript(*script, pResName,
-                                             output_path.c_str(),
-                                             pRuntimePath, dep_info, false,
-                                             pDumpIR);
+  build->mInfo = prepareScript(*script, pResName, pRuntimePath, build->mDeps);
+  if (build->mInfo == NULL) {
+    return NULL;
+  }
 
-  // Script is no longer used. Free it to get more memory.
-  delete script;
+  return build_owner.take();
+}
+
+bool RSCompilerDriver::finishBuild(PendingBuild *pBuild) {
+  llvm::OwningPtr<PendingBuild> build_owner(pBuild);
+
+  // A token given to this build takes precedence over the driver's.
+  if (pBuild->mScript->getCancellationToken() == NULL) {
+    pBuild->mScript->setCancellationToken(mCancelToken);
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Compile the script
+  //===--------------------------------------------------------------------===//
+  Compiler::ErrorCode status = compileScript(*pBuild->mScript,
+                                             pBuild->mResName.string(),
+                                             pBuild->mOutputPath.c_str(),
+                                             pBuild->mRuntimePath,
+                                             pBuild->mDeps, false,
+                                             pBuild->mDumpIR, pBuild->mInfo,
+                                             (pBuild->mKeepInMemory ?
+                                                  pBuild->mBitcodeSHA1 : NULL));
 
   if (status != Compiler::kSuccess) {
     return false;
   }
 
+  // The builds for a device directory are pushed there as is.
+  if ((mCacheQuota > 0) && pBuild->mDeviceOutputPath.empty()) {
+    llvm::StringRef output_path = pBuild->mOutputPath.str();
+    std::string cache_dir = llvm::sys::path::parent_path(output_path).str();
+    RSCacheManager::Record(cache_dir.c_str(),
+                           llvm::sys::path::stem(output_path).str().c_str(),
+                           pBuild->mBitcodeSHA1, mCacheQuota);
+  }
+
   return true;
 }
 
@@ -429,6 +2057,10 @@ bool RSCompilerDriver::build(RSScript &pScript, const char *pOut,
   // Embed the info string directly in the ELF, since this path is for an
   // offline (host) compilation.
   pScript.setEmbedInfo(true);
+  pScript.setEmbedBinaryInfo(mEmbedBinaryInfo);
+  pScript.setExportVarBlock(mExportVarBlock);
+  pScript.setReducedRelocations(mReducedRelocations);
+  pScript.setKernelCounters(mKernelCounters, mKernelCycleCounters);
 
   Compiler::ErrorCode status = compileScript(pScript, pOut, pOut, pRuntimePath,
                                              dep_info, true);
@@ -439,3 +2071,361 @@ bool RSCompilerDriver::build(RSScript &pScript, const char *pOut,
   return true;
 }
 
+bool RSCompilerDriver::startCompilerThread() {
+  if (mCompilerThread != NULL) {
+    return true;
+  }
+
+  android::sp<RSCompilerThread> thread =
+      new (std::nothrow) RSCompilerThread(*this);
+  if (thread == NULL) {
+    ALOGE("Out of memory when create the compiler thread!");
+    return false;
+  }
+  if (thread->run("bcc compiler") != android::NO_ERROR) {
+    ALOGE("Failed to start the compiler thread!");
+    return false;
+  }
+  mCompilerThread = thread;
+  return true;
+}
+
+RSBuildJob *RSCompilerDriver::buildAsync(BCCContext &pContext,
+                                         const char *pCacheDir,
+                                         const char *pResName,
+                                         const char *pBitcode,
+                                         size_t pBitcodeSize,
+                                         const char *pRuntimePath,
+                                         RSLinkRuntimeCallback pLinkRuntimeCallback,
+                                         RSBuildCompletionCallback pCompletionCallback,
+                                         void *pUserData) {
+  if (!startCompilerThread()) {
+    return NULL;
+  }
+
+  RSBuildJob *job = new (std::nothrow) RSBuildJob(pContext, pCacheDir,
+                                                  pResName, pBitcode,
+                                                  pBitcodeSize, pRuntimePath,
+                                                  pLinkRuntimeCallback,
+                                                  pCompletionCallback,
+                                                  pUserData);
+  if (job == NULL) {
+    ALOGE("Out of memory when create the build job for %s!",
+          ((pResName) ? pResName : "(null)"));
+    return NULL;
+  }
+
+  mCompilerThread->enqueue(*job);
+
+  return job;
+}
+
+RSBuildJob *RSCompilerDriver::prefetch(BCCContext &pContext,
+                                       const char *pCacheDir,
+                                       const char *pResName,
+                                       const char *pBitcode,
+                                       size_t pBitcodeSize,
+                                       const char *pRuntimePath,
+                                       RSBuildCompletionCallback pCompletionCallback,
+                                       void *pUserData) {
+  return submitPrefetch(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                        pRuntimePath, pCompletionCallback, pUserData,
+                        RSBuildJob::kPrefetch);
+}
+
+RSBuildJob *RSCompilerDriver::prefetchWhenIdle(BCCContext &pContext,
+                                               const char *pCacheDir,
+                                               const char *pResName,
+                                               const char *pBitcode,
+                                               size_t pBitcodeSize,
+                                               const char *pRuntimePath,
+                                               RSBuildCompletionCallback pCompletionCallback,
+                                               void *pUserData) {
+  return submitPrefetch(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                        pRuntimePath, pCompletionCallback, pUserData,
+                        RSBuildJob::kIdle);
+}
+
+bool RSCompilerDriver::isCharging() const {
+  if (mChargingCallback != NULL) {
+    return mChargingCallback(mChargingUserData);
+  }
+  return IsDeviceCharging();
+}
+
+RSBuildJob *
+RSCompilerDriver::submitPrefetch(BCCContext &pContext, const char *pCacheDir,
+                                 const char *pResName, const char *pBitcode,
+                                 size_t pBitcodeSize, const char *pRuntimePath,
+                                 RSBuildCompletionCallback pCompletionCallback,
+                                 void *pUserData,
+                                 RSBuildJob::Priority pPriority) {
+  if (!startCompilerThread()) {
+    return NULL;
+  }
+
+  RSBuildJob *job = new (std::nothrow) RSBuildJob(pContext, pCacheDir,
+                                                  pResName, pBitcode,
+                                                  pBitcodeSize, pRuntimePath,
+                                                  NULL, pCompletionCallback,
+                                                  pUserData, pPriority);
+  if (job == NULL) {
+    ALOGE("Out of memory when create the prefetch job for %s!",
+          ((pResName) ? pResName : "(null)"));
+    return NULL;
+  }
+
+  mCompilerThread->enqueue(*job);
+
+  return job;
+}
+
+RSExecutable *RSCompilerDriver::buildTiered(BCCContext &pContext,
+                                            const char *pCacheDir,
+                                            const char *pResName,
+                                            const char *pBitcode,
+                                            size_t pBitcodeSize,
+                                            const char *pRuntimePath,
+                                            RSLinkRuntimeCallback pLinkRuntimeCallback,
+                                            RSBuildCompletionCallback pCompletionCallback,
+                                            void *pUserData,
+                                            RSBuildJob **pOptimizedJob) {
+  *pOptimizedJob = NULL;
+
+  if ((pCacheDir == NULL) || (pResName == NULL)) {
+    ALOGE("Missing pCacheDir and/or pResName");
+    return NULL;
+  }
+
+  if ((pBitcode == NULL) || (pBitcodeSize <= 0)) {
+    ALOGE("No bitcode supplied! (bitcode: %p, size of bitcode: %zu)",
+          pBitcode, pBitcodeSize);
+    return NULL;
+  }
+
+  android::String8 tier0_name(pResName);
+  tier0_name.append("-tier0");
+
+  // {pCacheDir}/{pResName}-tier0.o (stored in {pResName}-tier0.rsc)
+  llvm::SmallString<80> tier0_path(pCacheDir);
+  llvm::sys::path::append(tier0_path, tier0_name.string());
+  llvm::sys::path::replace_extension(tier0_path, ".o");
+
+  //===--------------------------------------------------------------------===//
+  // Use the optimized object if it has been built.
+  //===--------------------------------------------------------------------===//
+  RSExecutable *result = loadScript(pCacheDir, pResName, pBitcode,
+                                    pBitcodeSize);
+  if (result != NULL) {
+    // The -O0 object (if any) is no longer needed.
+    bool existed;
+    android::String8 tier0_container =
+        RSCacheContainer::GetPath(tier0_path.c_str());
+    RSExecutableCache::GetInstance().invalidate(tier0_container.string());
+    llvm::sys::fs::remove(tier0_container.string(), existed);
+    return result;
+  }
+
+  // Nothing to gain from tiering if the script asks for -O0 anyway.
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+  if (wrapper.getOptimizationLevel() == RSScript::kOptLvl0) {
+    if (!build(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+               pRuntimePath, pLinkRuntimeCallback)) {
+      return NULL;
+    }
+    return loadScript(pCacheDir, pResName, pBitcode, pBitcodeSize);
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Tier 0: build (if necessary) and load the -O0 object.
+  //===--------------------------------------------------------------------===//
+  result = loadScript(pCacheDir, tier0_name.string(), pBitcode, pBitcodeSize);
+  if (result == NULL) {
+    if (!buildImpl(pContext, pCacheDir, tier0_name.string(), pBitcode,
+                   pBitcodeSize, pRuntimePath, pLinkRuntimeCallback,
+                   /* pDumpIR */false, /* pTier0 */true)) {
+      return NULL;
+    }
+    result = loadScript(pCacheDir, tier0_name.string(), pBitcode,
+                        pBitcodeSize);
+    if (result == NULL) {
+      return NULL;
+    }
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Tier 1: build at the requested optimization level in the background.
+  //===--------------------------------------------------------------------===//
+  *pOptimizedJob = buildAsync(pContext, pCacheDir, pResName, pBitcode,
+                              pBitcodeSize, pRuntimePath, pLinkRuntimeCallback,
+                              pCompletionCallback, pUserData);
+  if (*pOptimizedJob == NULL) {
+    ALOGW("Failed to submit the optimized build of %s! Keep running the -O0 "
+          "version.", pResName);
+  }
+
+  return result;
+}
+
+bool RSCompilerDriver::buildBundle(BCCContext &pContext,
+                                   const char *pCacheDir,
+                                   const char *pBundleName,
+                                   const android::Vector<RSBundleScript>
+                                       &pScripts,
+                                   const char *pRuntimePath) {
+  if ((pCacheDir == NULL) || (pBundleName == NULL) || pScripts.isEmpty()) {
+    ALOGE("Invalid parameter passed to RSCompilerDriver::buildBundle()! "
+          "(cache dir: %s, bundle name: %s, %u scripts)",
+          ((pCacheDir) ? pCacheDir : "(null)"),
+          ((pBundleName) ? pBundleName : "(null)"),
+          static_cast<unsigned>(pScripts.size()));
+    return false;
+  }
+  for (size_t i = 0, e = pScripts.size(); i != e; i++) {
+    if ((pScripts[i].resName == NULL) || (pScripts[i].bitcode == NULL) ||
+        (pScripts[i].bitcodeSize <= 0)) {
+      ALOGE("Invalid script #%u in the bundle %s!", static_cast<unsigned>(i),
+            pBundleName);
+      return false;
+    }
+  }
+
+  // {pCacheDir}/{pBundleName}.o
+  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::sys::path::append(output_path, pBundleName);
+  llvm::sys::path::replace_extension(output_path, ".o");
+
+  uint8_t bundle_sha1[SHA1_DIGEST_LENGTH];
+  GetBundleDigest(pScripts, mParanoidCacheChecks, bundle_sha1);
+  RSInfo::DependencyTableTy deps;
+  deps.push(std::make_pair(RSInfo::BitcodeDependencyName, bundle_sha1));
+  if (mHasCustomRuntime) {
+    deps.push(std::make_pair(CustomRuntimeDependencyName,
+                             mCustomRuntimeDigest));
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Link the scripts into one module, each under its own prefix.
+  //===--------------------------------------------------------------------===//
+  Source *bundle = NULL;
+  unsigned num_vars = 0;
+  RSInfo::FloatPrecision precision = RSInfo::FP_Full;
+  unsigned compiler_version = 0;
+  unsigned optimization_level = RSScript::kOptLvl0;
+  size_t bitcode_size = 0;
+  std::vector<std::string> prefixes;
+  for (size_t i = 0, e = pScripts.size(); i != e; i++) {
+    android::String8 info_path = GetBundleInfoPath(pCacheDir, pBundleName, i);
+    if (!AddBundleScript(pContext, pScripts[i], i, deps, info_path.string(),
+                         mCacheSync, bundle, num_vars, precision)) {
+      ALOGE("Failed to add %s to the bundle %s!", pScripts[i].resName,
+            pBundleName);
+      delete bundle;
+      return false;
+    }
+    prefixes.push_back(GetBundlePrefix(i));
+
+    // The bundle is compiled at the highest level any of its scripts asks.
+    bcinfo::BitcodeWrapper wrapper(pScripts[i].bitcode,
+                                   pScripts[i].bitcodeSize);
+    compiler_version = std::max(compiler_version,
+                                wrapper.getCompilerVersion());
+    optimization_level = std::max(optimization_level,
+                                  wrapper.getOptimizationLevel());
+    bitcode_size += pScripts[i].bitcodeSize;
+  }
+
+  RSScript *script = new (std::nothrow) RSScript(*bundle);
+  if (script == NULL) {
+    ALOGE("Out of memory when create Script object for the bundle %s!",
+          pBundleName);
+    delete bundle;
+    return false;
+  }
+  script->setCompilerVersion(compiler_version);
+  script->setOptimizationLevel(
+      static_cast<RSScript::OptimizationLevel>(optimization_level));
+  script->setBundlePrefixes(&prefixes);
+
+  //===--------------------------------------------------------------------===//
+  // Link the runtime once and compile the bundle into its container.
+  //===--------------------------------------------------------------------===//
+  Compiler::ErrorCode status = compileScript(*script, pBundleName,
+                                             output_path.c_str(),
+                                             pRuntimePath, deps, false);
+
+  delete script;
+  delete bundle;
+  pContext.recordCompile(bitcode_size);
+
+  return (status == Compiler::kSuccess);
+}
+
+bool RSCompilerDriver::loadBundle(const char *pCacheDir,
+                                  const char *pBundleName,
+                                  const android::Vector<RSBundleScript>
+                                      &pScripts,
+                                  android::Vector<RSExecutable *> &pResult) {
+  if ((pCacheDir == NULL) || (pBundleName == NULL) || pScripts.isEmpty()) {
+    ALOGE("Missing pCacheDir, pBundleName and/or pScripts");
+    return false;
+  }
+
+  PhaseTimer load_timer(kPhaseCacheLoad, pBundleName);
+
+  // {pCacheDir}/{pBundleName}.o
+  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::sys::path::append(output_path, pBundleName);
+  llvm::sys::path::replace_extension(output_path, ".o");
+
+  uint8_t bundle_sha1[SHA1_DIGEST_LENGTH];
+  GetBundleDigest(pScripts, mParanoidCacheChecks, bundle_sha1);
+  RSInfo::DependencyTableTy deps;
+  deps.push(std::make_pair(RSInfo::BitcodeDependencyName, bundle_sha1));
+  if (mHasCustomRuntime) {
+    deps.push(std::make_pair(CustomRuntimeDependencyName,
+                             mCustomRuntimeDigest));
+  }
+
+  android::String8 container_path =
+      RSCacheContainer::GetPath(output_path.c_str());
+  llvm::OwningPtr<RSExecutable> bundle(
+      RSCacheContainer::Load(container_path.string(), deps, mResolver,
+                             /* pCacheSHA1 */NULL));
+  if (!bundle) {
+    return false;
+  }
+
+  // The views keep the image once the executable of the bundle is gone.
+  android::Vector<RSExecutable *> views;
+  views.setCapacity(pScripts.size());
+  for (size_t i = 0, e = pScripts.size(); i != e; i++) {
+    android::String8 info_path = GetBundleInfoPath(pCacheDir, pBundleName, i);
+    InputFile input(info_path.string());
+    RSInfo *info = NULL;
+    if (!input.hasError()) {
+      info = RSInfo::ReadFromFile(input, deps);
+    }
+
+    RSExecutable *view = NULL;
+    if (info != NULL) {
+      view = RSExecutable::CreateView(*bundle, *info,
+                                      GetBundlePrefix(i).c_str());
+      if (view == NULL) {
+        delete info;
+      }
+    }
+    if (view == NULL) {
+      ALOGE("Failed to load %s from the bundle %s!", pScripts[i].resName,
+            pBundleName);
+      for (size_t j = 0; j < views.size(); j++) {
+        delete views[j];
+      }
+      return false;
+    }
+    views.push(view);
+  }
+
+  pResult.appendVector(views);
+  return true;
+}
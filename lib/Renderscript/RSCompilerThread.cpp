@@ -0,0 +1,247 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RSCompilerThread.h"
+
+#include "bcc/Renderscript/RSBuildJob.h"
+#include "bcc/Renderscript/RSCompilerDriver.h"
+#include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Support/Log.h"
+
+#include <utils/AndroidThreads.h>
+#include <utils/ThreadDefs.h>
+#include <utils/Timers.h>
+
+using namespace bcc;
+
+namespace {
+
+// How often the thread checks whether the idle jobs may run while they're
+// the only ones left.
+const nsecs_t IdlePollInterval = seconds_to_nanoseconds(60);
+
+} // end anonymous namespace
+
+//===----------------------------------------------------------------------===//
+// RSBuildJob
+//===----------------------------------------------------------------------===//
+RSBuildJob::RSBuildJob(BCCContext &pContext, const char *pCacheDir,
+                       const char *pResName, const char *pBitcode,
+                       size_t pBitcodeSize, const char *pRuntimePath,
+                       RSLinkRuntimeCallback pLinkRuntimeCallback,
+                       RSBuildCompletionCallback pCompletionCallback,
+                       void *pUserData, Priority pPriority)
+  : mContext(pContext),
+    mCacheDir((pCacheDir != NULL) ? pCacheDir : ""),
+    mResName((pResName != NULL) ? pResName : ""),
+    mBitcode(pBitcode), mBitcodeSize(pBitcodeSize),
+    mRuntimePath((pRuntimePath != NULL) ? pRuntimePath : ""),
+    mHasRuntimePath(pRuntimePath != NULL),
+    mLinkRuntimeCallback(pLinkRuntimeCallback),
+    mCompletionCallback(pCompletionCallback), mUserData(pUserData),
+    mPriority(pPriority), mThread(NULL), mDone(false), mSuccess(false) {
+}
+
+void RSBuildJob::complete(bool pSuccess) {
+  // Run the callback before waking up the waiters so that the job is still
+  // alive while the callback is running.
+  if (mCompletionCallback != NULL) {
+    mCompletionCallback(this, pSuccess, mUserData);
+  }
+
+  android::Mutex::Autolock locked(mLock);
+  mSuccess = pSuccess;
+  mDone = true;
+  mThread = NULL;
+  mDoneCond.broadcast();
+}
+
+void RSBuildJob::cancel() {
+  mCancelToken.cancel();
+
+  android::Mutex::Autolock locked(mLock);
+  if (mThread != NULL) {
+    mThread->wake();
+  }
+}
+
+bool RSBuildJob::isDone() {
+  android::Mutex::Autolock locked(mLock);
+  return mDone;
+}
+
+bool RSBuildJob::wait() {
+  android::Mutex::Autolock locked(mLock);
+  while (!mDone) {
+    mDoneCond.wait(mLock);
+  }
+  return mSuccess;
+}
+
+//===----------------------------------------------------------------------===//
+// RSCompilerThread
+//===----------------------------------------------------------------------===//
+RSCompilerThread::RSCompilerThread(RSCompilerDriver &pDriver)
+  : android::Thread(/* canCallJava */false), mDriver(pDriver) {
+}
+
+void RSCompilerThread::enqueue(RSBuildJob &pJob) {
+  // Not under mLock, which RSBuildJob::cancel() takes with the lock of the
+  // job held.
+  {
+    android::Mutex::Autolock locked(pJob.mLock);
+    pJob.mThread = this;
+  }
+
+  android::Mutex::Autolock locked(mLock);
+  // Ahead of the jobs of a lower priority.
+  size_t i = 0;
+  while ((i < mQueue.size()) && (mQueue[i]->mPriority <= pJob.mPriority)) {
+    i++;
+  }
+  mQueue.insertAt(&pJob, i);
+  mQueueCond.signal();
+}
+
+void RSCompilerThread::wake() {
+  android::Mutex::Autolock locked(mLock);
+  mQueueCond.signal();
+}
+
+bool RSCompilerThread::prefetch(RSBuildJob &pJob) {
+  const char *runtime_path =
+      (pJob.mHasRuntimePath ? pJob.mRuntimePath.c_str() : NULL);
+
+  // The executable itself isn't needed: the load leaves the object in
+  // RSExecutableCache. Loading is cheap enough not to be cancelled.
+  RSExecutable *executable = mDriver.loadScript(pJob.mCacheDir.c_str(),
+                                                pJob.mResName.c_str(),
+                                                pJob.mBitcode,
+                                                pJob.mBitcodeSize);
+  if (executable != NULL) {
+    delete executable;
+    return true;
+  }
+
+  if (pJob.isCancelled()) {
+    return false;
+  }
+
+  // Build it without getting in the way of the foreground threads. The build
+  // keeps the object in RSExecutableCache too.
+  int priority = androidGetThreadPriority(0);
+  androidSetThreadPriority(0, ANDROID_PRIORITY_BACKGROUND);
+  bool success = mDriver.build(pJob.mContext, pJob.mCacheDir.c_str(),
+                               pJob.mResName.c_str(), pJob.mBitcode,
+                               pJob.mBitcodeSize, runtime_path, NULL,
+                               /* pDumpIR */false, &pJob.mCancelToken);
+  androidSetThreadPriority(0, priority);
+  return success;
+}
+
+bool RSCompilerThread::threadLoop() {
+  RSBuildJob *job = NULL;
+  android::Vector<RSBuildJob *> cancelled;
+
+  {
+    android::Mutex::Autolock locked(mLock);
+    while (true) {
+      // Drop the jobs cancelled while they were queued.
+      for (size_t i = 0; i < mQueue.size(); ) {
+        if (mQueue[i]->isCancelled()) {
+          cancelled.push(mQueue[i]);
+          mQueue.removeAt(i);
+        } else {
+          i++;
+        }
+      }
+      if (!cancelled.isEmpty()) {
+        break;
+      }
+
+      if (!mQueue.isEmpty() &&
+          ((mQueue[0]->mPriority != RSBuildJob::kIdle) ||
+           mDriver.isCharging())) {
+        job = mQueue[0];
+        mQueue.removeAt(0);
+        break;
+      }
+
+      // The idle jobs left fail in stop().
+      if (exitPending()) {
+        return false;
+      }
+      if (mQueue.isEmpty()) {
+        mQueueCond.wait(mLock);
+      } else {
+        mQueueCond.waitRelative(mLock, IdlePollInterval);
+      }
+    }
+  }
+
+  // Completed without mLock (see RSBuildJob::cancel().)
+  for (size_t i = 0, e = cancelled.size(); i != e; i++) {
+    ALOGV("Build of %s is cancelled before it started.",
+          cancelled[i]->getResName());
+    cancelled[i]->complete(false);
+  }
+  if (job == NULL) {
+    return true;
+  }
+
+  if (job->isPrefetch()) {
+    ALOGV("Compiler thread starts prefetching %s.", job->getResName());
+    job->complete(prefetch(*job));
+    return true;
+  }
+
+  ALOGV("Compiler thread starts building %s.", job->getResName());
+
+  bool success = mDriver.build(job->mContext,
+                               job->mCacheDir.c_str(),
+                               job->mResName.c_str(),
+                               job->mBitcode, job->mBitcodeSize,
+                               (job->mHasRuntimePath ?
+                                    job->mRuntimePath.c_str() : NULL),
+                               job->mLinkRuntimeCallback,
+                               /* pDumpIR */false, &job->mCancelToken);
+
+  job->complete(success);
+
+  return true;
+}
+
+void RSCompilerThread::stop() {
+  {
+    android::Mutex::Autolock locked(mLock);
+    requestExit();
+    mQueueCond.signal();
+  }
+  requestExitAndWait();
+
+  // The jobs that haven't got a chance to run fail.
+  android::Vector<RSBuildJob *> pending;
+  {
+    android::Mutex::Autolock locked(mLock);
+    pending = mQueue;
+    mQueue.clear();
+  }
+  for (size_t i = 0, e = pending.size(); i != e; i++) {
+    ALOGW("Build of %s is cancelled since the compiler is shutting down.",
+          pending[i]->getResName());
+    pending[i]->complete(false);
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_COMPILER_THREAD_H
+#define BCC_RS_COMPILER_THREAD_H
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Vector.h>
+
+namespace bcc {
+
+class RSBuildJob;
+class RSCompilerDriver;
+
+/*
+ * RSCompilerThread runs the jobs submitted to RSCompilerDriver::buildAsync()
+ * one after another, in the order they were submitted, then those of
+ * RSCompilerDriver::prefetch() and last those of
+ * RSCompilerDriver::prefetchWhenIdle(), which wait in the queue while the
+ * device isn't charging (see RSBuildJob::Priority). A job that has started
+ * runs to its end even if a job of a higher priority arrives meanwhile,
+ * unless it's cancelled.
+ */
+class RSCompilerThread : public android::Thread {
+private:
+  RSCompilerDriver &mDriver;
+
+  android::Mutex mLock;
+  android::Condition mQueueCond;
+  android::Vector<RSBuildJob *> mQueue;
+
+  virtual bool threadLoop();
+
+  // Run the job of RSCompilerDriver::prefetch(). Return whether the script
+  // could be loaded or built.
+  bool prefetch(RSBuildJob &pJob);
+
+public:
+  RSCompilerThread(RSCompilerDriver &pDriver);
+
+  void enqueue(RSBuildJob &pJob);
+
+  // Have the thread look at its queue again (e.g., for a job cancelled while
+  // it's queued.)
+  void wake();
+
+  // Wait for the running job (if any) to finish and stop the thread. The jobs
+  // still in the queue are completed as failed.
+  void stop();
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_COMPILER_THREAD_H
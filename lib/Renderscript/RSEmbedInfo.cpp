@@ -18,8 +18,11 @@
 #include "bcc/Renderscript/RSTransforms.h"
 
 #include <cstdlib>
+#include <string>
 #include <vector>
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
@@ -54,16 +57,45 @@ private:
 
   const RSInfo *mInfo;
 
+  bool mBinary;
+
+  // Embed the RSInfo as serialized by RSInfo::serialize(). The compatibility
+  // library reads its lists in place instead of parsing them.
+  bool embedBinary() {
+    std::string data;
+    if (!mInfo->serialize(data)) {
+      ALOGE("Failed to serialize the RS info of %s!",
+            M->getModuleIdentifier().c_str());
+      return false;
+    }
+
+    llvm::Constant *Init = llvm::ConstantDataArray::get(
+        *C, llvm::ArrayRef<uint8_t>(
+                reinterpret_cast<const uint8_t *>(data.data()), data.size()));
+    llvm::GlobalVariable *InfoGV =
+        new llvm::GlobalVariable(*M, Init->getType(), true,
+                                 llvm::GlobalValue::ExternalLinkage, Init,
+                                 ".rs.info.bin");
+    // Aligned for the 32-bit fields of the header and the items.
+    InfoGV->setAlignment(8);
+
+    return true;
+  }
+
 public:
-  RSEmbedInfoPass(const RSInfo *info)
+  RSEmbedInfoPass(const RSInfo *info, bool pBinary)
       : ModulePass(ID),
-        mInfo(info) {
+        mInfo(info), mBinary(pBinary) {
   }
 
   virtual bool runOnModule(llvm::Module &M) {
     this->M = &M;
     C = &M.getContext();
 
+    if (mBinary) {
+      return embedBinary();
+    }
+
     std::string str;
     llvm::raw_string_ostream s(str);
 
@@ -151,8 +183,8 @@ char RSEmbedInfoPass::ID = 0;
 namespace bcc {
 
 llvm::ModulePass *
-createRSEmbedInfoPass(const RSInfo *info) {
-  return new RSEmbedInfoPass(info);
+createRSEmbedInfoPass(const RSInfo *info, bool pBinary) {
+  return new RSEmbedInfoPass(info, pBinary);
 }
 
 }  // end namespace bcc
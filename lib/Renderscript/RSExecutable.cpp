@@ -16,28 +16,79 @@
 
 #include "bcc/Renderscript/RSExecutable.h"
 
+#include <cstring>
+#include <string>
+
 #include "bcc/Config/Config.h"
+#include "bcc/Renderscript/RSCacheContainer.h"
+#include "bcc/Renderscript/RSProfile.h"
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/CacheWriter.h"
 #include "bcc/Support/Disassembler.h"
 #include "bcc/Support/FileBase.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/OutputFile.h"
+#include "bcc/Support/Trace.h"
 #include "bcc/ExecutionEngine/SymbolResolverProxy.h"
 
+#include <llvm/ADT/SmallString.h>
+
 #include <utils/String8.h>
 
 using namespace bcc;
 
+namespace {
+
+// Compute the address of an export from its location pLocation recorded at the
+// build. Fall back to look the name up if the location is unknown.
+inline void *LocateExport(const ObjectLoader &pLoader,
+                          const std::pair<uint16_t, uint32_t> &pLocation,
+                          const char *pName, const char *pSuffix,
+                          llvm::SmallString<64> &pNameBuffer) {
+  void *section_addr = pLoader.getSectionAddress(pLocation.first);
+  if (section_addr != NULL) {
+    return reinterpret_cast<uint8_t *>(section_addr) + pLocation.second;
+  }
+
+  pNameBuffer = pName;
+  pNameBuffer += pSuffix;
+  return pLoader.getSymbolAddress(pNameBuffer.c_str());
+}
+
+// Append the address of the symbol named pPrefix (if non-NULL), pNames[i]
+// and pSuffix (if non-NULL) to pAddrs for each i, or NULL if there's none.
+template <typename NameListTy>
+void GetSymbolAddresses(const ObjectLoader &pLoader, const NameListTy &pNames,
+                        const char *pPrefix, const char *pSuffix,
+                        android::Vector<void *> &pAddrs) {
+  llvm::SmallString<64> name;
+  pAddrs.setCapacity(pAddrs.size() + pNames.size());
+  for (size_t i = 0, e = pNames.size(); i != e; i++) {
+    name = ((pPrefix != NULL) ? pPrefix : "");
+    name += pNames[i];
+    if (pSuffix != NULL) {
+      name += pSuffix;
+    }
+    pAddrs.push_back(pLoader.getSymbolAddress(name.c_str()));
+  }
+}
+
+} // end anonymous namespace
+
 const char *RSExecutable::SpecialFunctionNames[] = {
   "root",      // Graphics drawing function or compute kernel.
   "init",      // Initialization routine called implicitly on startup.
   ".rs.dtor",  // Static global destructor for a script instance.
   ".rs.info",  // Variable containing string of RS metadata info.
+  ".rs.info.bin",  // Variable containing the binary RS metadata info.
   NULL         // Must be NULL-terminated.
 };
 
 RSExecutable *RSExecutable::Create(RSInfo &pInfo,
                                    FileBase &pObjFile,
                                    SymbolResolverProxy &pResolver) {
+  TraceSection trace("Executable creation", pObjFile.getName().c_str());
+
   // Load the object file. Enable the GDB's JIT debugging if the script contains
   // debug information.
   ObjectLoader *loader = ObjectLoader::Load(pObjFile,
@@ -47,81 +98,351 @@ RSExecutable *RSExecutable::Create(RSInfo &pInfo,
     return NULL;
   }
 
+  return Create(pInfo, pObjFile, *loader);
+}
+
+RSExecutable *RSExecutable::Create(RSInfo &pInfo,
+                                   FileBase &pObjFile,
+                                   const void *pImage, size_t pImageSize,
+                                   SymbolResolverProxy &pResolver,
+                                   bool pLocateExports,
+                                   const uint32_t *pBindings,
+                                   size_t pNumBindings) {
+  TraceSection trace("Executable creation", pObjFile.getName().c_str());
+
+  // The loader only uses the resolver during the load.
+  BoundSymbolResolver bound_resolver(pResolver, pBindings, pNumBindings);
+  SymbolResolverInterface &resolver =
+      ((pBindings != NULL) ?
+          static_cast<SymbolResolverInterface &>(bound_resolver) :
+          static_cast<SymbolResolverInterface &>(pResolver));
+
+  // ObjectLoader never writes to the given memory. The relocated image lives
+  // in the memory allocated by the loader.
+  ObjectLoader *loader = ObjectLoader::Load(const_cast<void *>(pImage),
+                                            pImageSize,
+                                            pObjFile.getName().c_str(),
+                                            resolver,
+                                            pInfo.hasDebugInformation());
+  if (loader == NULL) {
+    return NULL;
+  }
+
+  RSExecutable *result = Create(pInfo, pObjFile, *loader, pLocateExports);
+  if (result != NULL) {
+    result->mIsContainer = true;
+  }
+  return result;
+}
+
+RSExecutable *RSExecutable::Create(RSInfo &pInfo,
+                                   FileBase &pObjFile,
+                                   const char *pSharedObjectPath) {
+  TraceSection trace("Executable creation", pObjFile.getName().c_str());
+
+  ObjectLoader *loader = ObjectLoader::LoadSharedObject(pSharedObjectPath);
+  if (loader == NULL) {
+    return NULL;
+  }
+
+  RSExecutable *result = Create(pInfo, pObjFile, *loader);
+  if (result != NULL) {
+    result->mIsContainer = true;
+  }
+  return result;
+}
+
+RSExecutable *RSExecutable::Create(RSInfo &pInfo,
+                                   FileBase &pObjFile,
+                                   ObjectLoader &pLoader,
+                                   bool pLocateExports) {
   // Now, all things required to build a RSExecutable object are ready.
-  RSExecutable *result = new (std::nothrow) RSExecutable(pInfo,
-                                                         pObjFile,
-                                                         *loader);
+  Image *image = new (std::nothrow) Image(pObjFile, pLoader);
+  RSExecutable *result = NULL;
+  if (image != NULL) {
+    result = new (std::nothrow) RSExecutable(pInfo, *image);
+  }
   if (result == NULL) {
     ALOGE("Out of memory when create object to hold RS result file for %s!",
           pObjFile.getName().c_str());
+    if (image != NULL) {
+      // pObjFile stays with the caller.
+      image->mObjFile = NULL;
+      delete image;
+    } else {
+      delete &pLoader;
+    }
+    return NULL;
+  }
+
+  // Use the locations recorded at the build if they're available (i.e., the
+  // info describes this very object.)
+  if (pLocateExports &&
+      (pInfo.getExportSymbols().size() == pInfo.getNumExportSymbols())) {
+    LocateExports(pInfo, pLoader, *result);
+  } else {
+    ResolveExports(pInfo, pLoader, *result);
+  }
+  result->locateExportVarBlock(pInfo);
+
+  result->copyPragmas();
+  result->indexNames(pInfo);
+
+  return result;
+}
+
+void RSExecutable::copyPragmas() {
+  // Copy pragma key/value pairs from RSInfo::getPragmas() into mPragmaKeys and
+  // mPragmaValues, respectively. The vectors are sized up front.
+  const RSInfo::PragmaListTy &pragmas = mInfo->getPragmas();
+  mPragmaKeys.setCapacity(pragmas.size());
+  mPragmaValues.setCapacity(pragmas.size());
+  for (RSInfo::PragmaListTy::const_iterator pragma_iter = pragmas.begin(),
+          pragma_end = pragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++){
+    mPragmaKeys.push_back(pragma_iter->first);
+    mPragmaValues.push_back(pragma_iter->second);
+  }
+}
+
+RSExecutable *RSExecutable::CreateView(const RSExecutable &pBundle,
+                                       RSInfo &pInfo, const char *pPrefix) {
+  RSExecutable *result = new (std::nothrow) RSExecutable(pInfo,
+                                                         *pBundle.mImage);
+  if (result == NULL) {
+    ALOGE("Out of memory when create a view of %s!",
+          pBundle.mObjFile->getName().c_str());
     return NULL;
   }
 
-  unsigned idx;
-  // Resolve addresses of RS export vars.
-  idx = 0;
-  const RSInfo::ExportVarNameListTy &export_var_names =
-      pInfo.getExportVarNames();
-  for (RSInfo::ExportVarNameListTy::const_iterator
-           var_iter = export_var_names.begin(),
-           var_end = export_var_names.end(); var_iter != var_end;
-       var_iter++, idx++) {
-    const char *name = *var_iter;
-    void *addr = result->getSymbolAddress(name);
-    if (addr == NULL) {
-        //ALOGW("RS export var at entry #%u named %s cannot be found in the result "
-        //"object!", idx, name);
+  result->mSymbolPrefix = pPrefix;
+  ResolveExports(pInfo, *result->mLoader, *result, pPrefix);
+  result->locateExportVarBlock(pInfo);
+  result->copyPragmas();
+  result->indexNames(pInfo);
+
+  return result;
+}
+
+void *RSExecutable::getPrefixedSymbolAddress(const char *pName) const {
+  llvm::SmallString<64> name(mSymbolPrefix);
+  name += pName;
+  return mLoader->getSymbolAddress(name.c_str());
+}
+
+void RSExecutable::locateExportVarBlock(const RSInfo &pInfo) {
+  const RSInfo::ExportVarLayoutListTy &layout = pInfo.getExportVarLayout();
+  if (layout.isEmpty()) {
+    return;
+  }
+
+  uint8_t *block = reinterpret_cast<uint8_t *>(
+      getPrefixedSymbolAddress(RSInfo::ExportVarBlockName));
+  if ((block == NULL) || (layout.size() != mExportVarAddrs.size())) {
+    ALOGW("The block of the export vars of %s is missing!",
+          mObjFile->getName().c_str());
+    return;
+  }
+
+  mExportVarBlock = block;
+  for (size_t i = 0, e = layout.size(); i != e; i++) {
+    if (layout[i].first != rsinfo::gInvalidExportVarOffset) {
+      mExportVarAddrs.editItemAt(i) = block + layout[i].first;
+    }
+  }
+}
+
+void RSExecutable::indexNames(const RSInfo &pInfo) {
+  mNameIndex = new (std::nothrow) NameIndex();
+  if (mNameIndex == NULL) {
+    ALOGE("Out of memory when index the names of %s!",
+          mObjFile->getName().c_str());
+    return;
+  }
+  llvm::StringMap<NamePositions> &names = mNameIndex->mNames;
+
+  // Where a kind has the same name twice, the first one wins like in the
+  // other lookups of the exports.
+  const RSInfo::ExportVarNameListTy &export_vars = pInfo.getExportVarNames();
+  for (size_t i = 0, e = export_vars.size(); i != e; i++) {
+    NamePositions &positions = names[export_vars[i]];
+    if (positions.mExportVar < 0) {
+      positions.mExportVar = i;
+    }
+  }
+
+  const RSInfo::ExportFuncNameListTy &export_funcs = pInfo.getExportFuncNames();
+  for (size_t i = 0, e = export_funcs.size(); i != e; i++) {
+    NamePositions &positions = names[export_funcs[i]];
+    if (positions.mExportFunc < 0) {
+      positions.mExportFunc = i;
     }
-    result->mExportVarAddrs.push_back(addr);
-  }
-
-  // Resolve addresses of RS export functions.
-  idx = 0;
-  const RSInfo::ExportFuncNameListTy &export_func_names =
-      pInfo.getExportFuncNames();
-  for (RSInfo::ExportFuncNameListTy::const_iterator
-           func_iter = export_func_names.begin(),
-           func_end = export_func_names.end(); func_iter != func_end;
-       func_iter++, idx++) {
-    const char *name = *func_iter;
-    void *addr = result->getSymbolAddress(name);
-    if (addr == NULL) {
-        //      ALOGW("RS export func at entry #%u named %s cannot be found in the result"
-        //" object!", idx, name);
+  }
+
+  const RSInfo::ExportForeachFuncListTy &export_foreach_funcs =
+      pInfo.getExportForeachFuncs();
+  for (size_t i = 0, e = export_foreach_funcs.size(); i != e; i++) {
+    NamePositions &positions = names[export_foreach_funcs[i].first];
+    if (positions.mExportForeach < 0) {
+      positions.mExportForeach = i;
+    }
+  }
+
+  const RSInfo::ExportReduceListTy &export_reduces = pInfo.getExportReduces();
+  for (size_t i = 0, e = export_reduces.size(); i != e; i++) {
+    NamePositions &positions = names[export_reduces[i].name];
+    if (positions.mExportReduce < 0) {
+      positions.mExportReduce = i;
     }
-    result->mExportFuncAddrs.push_back(addr);
   }
 
+  for (size_t i = 0, e = mPragmaKeys.size(); i != e; i++) {
+    NamePositions &positions = names[mPragmaKeys[i]];
+    if (positions.mPragma < 0) {
+      positions.mPragma = i;
+    }
+  }
+}
+
+RSExecutable *RSExecutable::createInstance() const {
+  if (mLoader->hasWritableSections()) {
+    ALOGV("%s has global variables. Its instances can't share the image.",
+          mObjFile->getName().c_str());
+    return NULL;
+  }
+
+  RSInfo *info = mInfo->clone();
+  if (info == NULL) {
+    return NULL;
+  }
+
+  RSExecutable *result = new (std::nothrow) RSExecutable(*info, *mImage);
+  if (result == NULL) {
+    ALOGE("Out of memory when create an instance of %s!",
+          mObjFile->getName().c_str());
+    delete info;
+    return NULL;
+  }
+
+  // The vectors share their storage until they're modified.
+  result->mIsContainer = mIsContainer;
+  result->mNameIndex = mNameIndex;
+  result->mSymbolPrefix = mSymbolPrefix;
+  result->mExportVarAddrs = mExportVarAddrs;
+  result->mExportVarBlock = mExportVarBlock;
+  result->mExportFuncAddrs = mExportFuncAddrs;
+  for (unsigned i = 0; i < RSInfo::kNumForeachVariants; i++) {
+    result->mExportForeachAddrs[i] = mExportForeachAddrs[i];
+    result->mExportReduceAddrs[i] = mExportReduceAddrs[i];
+  }
+  result->mExportReduceCombinerAddrs = mExportReduceCombinerAddrs;
+  // The strings of the pragmas are those of the new info.
+  result->copyPragmas();
+
+  return result;
+}
+
+void RSExecutable::ResolveExports(const RSInfo &pInfo,
+                                  const ObjectLoader &pLoader,
+                                  RSExecutable &pResult,
+                                  const char *pPrefix) {
+  // Resolve addresses of RS export vars and functions. A missing symbol gets
+  // a NULL address.
+  GetSymbolAddresses(pLoader, pInfo.getExportVarNames(), pPrefix, NULL,
+                     pResult.mExportVarAddrs);
+  GetSymbolAddresses(pLoader, pInfo.getExportFuncNames(), pPrefix, NULL,
+                     pResult.mExportFuncAddrs);
+
   // Resolve addresses of expanded RS foreach function.
-  idx = 0;
   const RSInfo::ExportForeachFuncListTy &export_foreach_funcs =
       pInfo.getExportForeachFuncs();
+  android::Vector<const char *> foreach_names;
+  foreach_names.setCapacity(export_foreach_funcs.size());
   for (RSInfo::ExportForeachFuncListTy::const_iterator
            foreach_iter = export_foreach_funcs.begin(),
            foreach_end = export_foreach_funcs.end();
-       foreach_iter != foreach_end; foreach_iter++, idx++) {
-    const char *func_name = foreach_iter->first;
-    android::String8 expanded_func_name(func_name);
-    expanded_func_name.append(".expand");
-    void *addr = result->getSymbolAddress(expanded_func_name.string());
-    if (addr == NULL) {
-        //      ALOGW("Expanded RS foreach at entry #%u named %s cannot be found in the "
-        //            "result object!", idx, expanded_func_name.string());
+       foreach_iter != foreach_end; foreach_iter++) {
+    foreach_names.push_back(foreach_iter->first);
+  }
+  for (unsigned i = 0; i < RSInfo::kNumForeachVariants; i++) {
+    GetSymbolAddresses(pLoader, foreach_names, pPrefix,
+                       RSInfo::ExportForeachSuffixes[i],
+                       pResult.mExportForeachAddrs[i]);
+  }
+
+  // And those of the reductions.
+  const RSInfo::ExportReduceListTy &export_reduces = pInfo.getExportReduces();
+  android::Vector<const char *> reduce_names, combiner_names;
+  reduce_names.setCapacity(export_reduces.size());
+  combiner_names.setCapacity(export_reduces.size());
+  for (RSInfo::ExportReduceListTy::const_iterator
+           reduce_iter = export_reduces.begin(),
+           reduce_end = export_reduces.end();
+       reduce_iter != reduce_end; reduce_iter++) {
+    reduce_names.push_back(reduce_iter->name);
+    combiner_names.push_back(reduce_iter->combiner);
+  }
+  for (unsigned i = 0; i < RSInfo::kNumForeachVariants; i++) {
+    GetSymbolAddresses(pLoader, reduce_names, pPrefix,
+                       RSInfo::ExportForeachSuffixes[i],
+                       pResult.mExportReduceAddrs[i]);
+  }
+  GetSymbolAddresses(pLoader, combiner_names, pPrefix, NULL,
+                     pResult.mExportReduceCombinerAddrs);
+}
+
+void RSExecutable::LocateExports(const RSInfo &pInfo,
+                                 const ObjectLoader &pLoader,
+                                 RSExecutable &pResult) {
+  const RSInfo::ExportSymbolListTy &export_symbols = pInfo.getExportSymbols();
+  RSInfo::ExportSymbolListTy::const_iterator symbol_iter =
+      export_symbols.begin();
+
+  llvm::SmallString<64> name;
+
+  const RSInfo::ExportVarNameListTy &export_vars = pInfo.getExportVarNames();
+  pResult.mExportVarAddrs.setCapacity(export_vars.size());
+  for (size_t i = 0, e = export_vars.size(); i != e; i++) {
+    pResult.mExportVarAddrs.push_back(
+        LocateExport(pLoader, *symbol_iter++, export_vars[i], "", name));
+  }
+
+  const RSInfo::ExportFuncNameListTy &export_funcs = pInfo.getExportFuncNames();
+  pResult.mExportFuncAddrs.setCapacity(export_funcs.size());
+  for (size_t i = 0, e = export_funcs.size(); i != e; i++) {
+    pResult.mExportFuncAddrs.push_back(
+        LocateExport(pLoader, *symbol_iter++, export_funcs[i], "", name));
+  }
+
+  const RSInfo::ExportForeachFuncListTy &export_foreach_funcs =
+      pInfo.getExportForeachFuncs();
+  for (unsigned v = 0; v < RSInfo::kNumForeachVariants; v++) {
+    android::Vector<void *> &addrs = pResult.mExportForeachAddrs[v];
+    addrs.setCapacity(export_foreach_funcs.size());
+    for (size_t i = 0, e = export_foreach_funcs.size(); i != e; i++) {
+      addrs.push_back(
+          LocateExport(pLoader, *symbol_iter++, export_foreach_funcs[i].first,
+                       RSInfo::ExportForeachSuffixes[v], name));
     }
-    result->mExportForeachFuncAddrs.push_back(addr);
   }
 
-  // Copy pragma key/value pairs from RSInfo::getPragmas() into mPragmaKeys and
-  // mPragmaValues, respectively.
-  const RSInfo::PragmaListTy &pragmas = pInfo.getPragmas();
-  for (RSInfo::PragmaListTy::const_iterator pragma_iter = pragmas.begin(),
-          pragma_end = pragmas.end(); pragma_iter != pragma_end;
-       pragma_iter++){
-    result->mPragmaKeys.push_back(pragma_iter->first);
-    result->mPragmaValues.push_back(pragma_iter->second);
+  const RSInfo::ExportReduceListTy &export_reduces = pInfo.getExportReduces();
+  for (unsigned v = 0; v < RSInfo::kNumForeachVariants; v++) {
+    android::Vector<void *> &addrs = pResult.mExportReduceAddrs[v];
+    addrs.setCapacity(export_reduces.size());
+    for (size_t i = 0, e = export_reduces.size(); i != e; i++) {
+      addrs.push_back(
+          LocateExport(pLoader, *symbol_iter++, export_reduces[i].name,
+                       RSInfo::ExportForeachSuffixes[v], name));
+    }
   }
 
-  return result;
+  pResult.mExportReduceCombinerAddrs.setCapacity(export_reduces.size());
+  for (size_t i = 0, e = export_reduces.size(); i != e; i++) {
+    pResult.mExportReduceCombinerAddrs.push_back(
+        LocateExport(pLoader, *symbol_iter++, export_reduces[i].combiner, "",
+                     name));
+  }
 }
 
 bool RSExecutable::syncInfo(bool pForce) {
@@ -129,32 +450,32 @@ bool RSExecutable::syncInfo(bool pForce) {
     return true;
   }
 
-  android::String8 info_path = RSInfo::GetPath(mObjFile->getName().c_str());
-  OutputFile info_file(info_path.string(), FileBase::kTruncate);
-
-  if (info_file.hasError()) {
-    ALOGE("Failed to open the info file %s for write! (%s)", info_path.string(),
-          info_file.getErrorMessage().c_str());
-    return false;
+  // The info of a view is rewritten with its bundle.
+  if (!mSymbolPrefix.empty()) {
+    mIsInfoDirty = false;
+    return true;
   }
 
-  // Operation to the RS info file need to acquire the lock on the output file
-  // first.
-  if (!mObjFile->lock(FileBase::kWriteLock)) {
-    ALOGE("Write to RS info file %s required the acquisition of the write lock "
-          "on %s but got failure! (%s)", info_path.string(),
-          mObjFile->getName().c_str(), info_file.getErrorMessage().c_str());
-    return false;
+  if (mIsContainer) {
+    if (!RSCacheContainer::UpdateInfo(mObjFile->getName().c_str(), *mInfo)) {
+      ALOGE("Failed to sync the RS info in %s!", mObjFile->getName().c_str());
+      return false;
+    }
+    mIsInfoDirty = false;
+    return true;
   }
 
-  // Perform the write.
-  if (!mInfo->write(info_file)) {
+  // Replace the info file atomically. Readers don't need to lock the object
+  // file. A write still pending for the file is replaced by this one.
+  android::String8 info_path = RSInfo::GetPath(mObjFile->getName().c_str());
+  std::string data;
+  if (!mInfo->serialize(data) ||
+      !CacheWriter::GetInstance().write(info_path.string(), data,
+                                        AtomicOutputFile::kNoSync)) {
     ALOGE("Failed to sync the RS info file %s!", info_path.string());
-    mObjFile->unlock();
     return false;
   }
 
-  mObjFile->unlock();
   mIsInfoDirty = false;
   return true;
 }
@@ -201,9 +522,45 @@ void RSExecutable::dumpDisassembly(OutputFile &pOutput) const {
   return;
 }
 
+bool RSExecutable::setKernelClock(uint64_t (*pClock)()) {
+  uint64_t (**clock)() = reinterpret_cast<uint64_t (**)()>(
+      getSymbolAddress(RSInfo::KernelClockName));
+  if (clock == NULL) {
+    return false;
+  }
+  *clock = pClock;
+  return true;
+}
+
+bool RSExecutable::writeProfile() {
+  uint64_t *counters = reinterpret_cast<uint64_t *>(
+      getSymbolAddress(RSProfile::CountersName));
+  const uint32_t *num_counters = reinterpret_cast<const uint32_t *>(
+      getSymbolAddress(RSProfile::NumCountersName));
+  const uint8_t *source_sha1 = reinterpret_cast<const uint8_t *>(
+      getSymbolAddress(RSProfile::SourceName));
+  if ((counters == NULL) || (num_counters == NULL) || (source_sha1 == NULL)) {
+    return true;
+  }
+
+  android::String8 path = RSProfile::GetPath(mObjFile->getName().c_str());
+  if (!RSProfile::Accumulate(path.string(), source_sha1, counters,
+                             *num_counters)) {
+    return false;
+  }
+
+  ::memset(counters, 0, *num_counters * sizeof(uint64_t));
+  return true;
+}
+
+RSExecutable::Image::~Image() {
+  delete mObjFile;
+  delete mLoader;
+}
+
 RSExecutable::~RSExecutable() {
+  writeProfile();
   syncInfo();
   delete mInfo;
-  delete mObjFile;
-  delete mLoader;
+  // mObjFile and mLoader go with the last instance.
 }
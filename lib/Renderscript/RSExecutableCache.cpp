@@ -0,0 +1,212 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSExecutableCache.h"
+
+#include <cstring>
+#include <new>
+
+#include <llvm/Support/MutexGuard.h>
+
+#include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/CacheWriter.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+RSExecutableCache::Entry::~Entry() {
+  delete [] mImage;
+  delete mInfo;
+}
+
+RSExecutableCache &RSExecutableCache::GetInstance() {
+  static RSExecutableCache instance;
+  return instance;
+}
+
+RSExecutableCache::RSExecutableCache()
+  : mSize(0), mBudget(DefaultBudget), mTick(0) {
+}
+
+RSExecutableCache::~RSExecutableCache() {
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    delete mEntries[i];
+  }
+}
+
+int RSExecutableCache::find(const char *pObjPath) const {
+  for (size_t i = 0, e = mEntries.size(); i != e; i++) {
+    if (mEntries[i]->mObjPath == pObjPath) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void RSExecutableCache::erase(size_t pIdx) {
+  Entry *entry = mEntries[pIdx];
+  mSize -= entry->mImageSize;
+  mEntries.removeAt(pIdx);
+  delete entry;
+}
+
+void RSExecutableCache::evict(size_t pNeeded) {
+  while (!mEntries.isEmpty() && ((mSize + pNeeded) > mBudget)) {
+    size_t lru = 0;
+    for (size_t i = 1, e = mEntries.size(); i != e; i++) {
+      if (mEntries[i]->mLastUse < mEntries[lru]->mLastUse) {
+        lru = i;
+      }
+    }
+    ALOGV("Evict %s from the RS executable cache.",
+          mEntries[lru]->mObjPath.string());
+    erase(lru);
+  }
+}
+
+void RSExecutableCache::setBudget(size_t pBudget) {
+  llvm::MutexGuard locked(mLock);
+  mBudget = pBudget;
+  evict(0);
+}
+
+size_t RSExecutableCache::getBudget() {
+  llvm::MutexGuard locked(mLock);
+  return mBudget;
+}
+
+RSExecutable *RSExecutableCache::load(const char *pObjPath,
+                                      const uint8_t *pSHA1,
+                                      SymbolResolverProxy &pResolver) {
+  llvm::MutexGuard locked(mLock);
+
+  int idx = find(pObjPath);
+  if (idx < 0) {
+    return NULL;
+  }
+
+  Entry *entry = mEntries[idx];
+  if (::memcmp(entry->mSHA1, pSHA1, SHA1_DIGEST_LENGTH) != 0) {
+    // The object in the cache was compiled from another version of the
+    // bitcode.
+    erase(idx);
+    return NULL;
+  }
+
+  // RSExecutable needs the container to sync its RS info later. Only its
+  // name is used, so a container whose first write is still queued in
+  // CacheWriter will do.
+  InputFile *object_file = new (std::nothrow) InputFile(pObjPath);
+  if ((object_file == NULL) ||
+      (object_file->hasError() &&
+       !CacheWriter::GetInstance().isPending(pObjPath))) {
+    // The file has gone, so must the entry.
+    delete object_file;
+    erase(idx);
+    return NULL;
+  }
+
+  RSInfo *info = entry->mInfo->clone();
+  if (info == NULL) {
+    delete object_file;
+    return NULL;
+  }
+
+  // The image is relocated into the memory allocated by the loader, so the
+  // entry may be evicted as soon as we return.
+  RSExecutable *result = RSExecutable::Create(*info, *object_file,
+                                              entry->mImage,
+                                              entry->mImageSize,
+                                              pResolver);
+  if (result == NULL) {
+    delete object_file;
+    delete info;
+    return NULL;
+  }
+
+  entry->mLastUse = ++mTick;
+  ALOGV("Loaded %s from the RS executable cache.", pObjPath);
+
+  return result;
+}
+
+bool RSExecutableCache::insert(const char *pObjPath, const uint8_t *pSHA1,
+                               const void *pImage, size_t pImageSize,
+                               const RSInfo &pInfo) {
+  const char *obj_path = pObjPath;
+  size_t image_size = pImageSize;
+
+  if ((pImage == NULL) || (image_size <= 0)) {
+    return false;
+  }
+
+  {
+    llvm::MutexGuard locked(mLock);
+    if (image_size > mBudget) {
+      return false;
+    }
+  }
+
+  Entry *entry = new (std::nothrow) Entry();
+  if (entry == NULL) {
+    ALOGE("Out of memory when cache RS executable %s!", obj_path);
+    return false;
+  }
+
+  entry->mObjPath.setTo(obj_path);
+  ::memcpy(entry->mSHA1, pSHA1, SHA1_DIGEST_LENGTH);
+
+  entry->mInfo = pInfo.clone();
+  entry->mImage = new (std::nothrow) uint8_t [ image_size ];
+  if ((entry->mInfo == NULL) || (entry->mImage == NULL)) {
+    ALOGE("Out of memory when cache RS executable %s!", obj_path);
+    delete entry;
+    return false;
+  }
+  entry->mImageSize = image_size;
+  ::memcpy(entry->mImage, pImage, image_size);
+
+  llvm::MutexGuard locked(mLock);
+
+  int idx = find(obj_path);
+  if (idx >= 0) {
+    erase(idx);
+  }
+
+  evict(image_size);
+  if ((mSize + image_size) > mBudget) {
+    // Budget has been lowered in the meantime.
+    delete entry;
+    return false;
+  }
+
+  entry->mLastUse = ++mTick;
+  mEntries.push(entry);
+  mSize += image_size;
+
+  return true;
+}
+
+void RSExecutableCache::invalidate(const char *pObjPath) {
+  llvm::MutexGuard locked(mLock);
+
+  int idx = find(pObjPath);
+  if (idx >= 0) {
+    erase(idx);
+  }
+}
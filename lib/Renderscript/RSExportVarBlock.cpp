@@ -0,0 +1,285 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/MathExtras.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Name of metadata node where the layout is left for
+// RSInfo::recordExportVarLayout() (should be synced with
+// RSInfoExtractor.cpp.)
+const char export_var_layout_metadata_name[] = "#rs_export_var_layout";
+
+// The block starts on a cache line of its own.
+const unsigned BlockAlignment = 64;
+
+/* RSExportVarBlockPass - This pass gathers the export vars of a script into
+ * one global, RSInfo::ExportVarBlockName, so that the runtime can set or
+ * snapshot them all with one memcpy() and the kernels reading several of
+ * them touch as few cache lines as possible. The vars are sorted by
+ * decreasing alignment (which leaves no padding but at the end of a class of
+ * alignment), the object slots first within a class (so that the runtime
+ * initializes and releases their handles a run at a time, see
+ * RSInfo::getObjectSlotRanges()), then the most referenced first and then
+ * the smaller first. Each use of a var becomes the address of its field in
+ * the block.
+ *
+ * The vars which can't move (the constant ones, those in a section of their
+ * own, the thread-local ones and those the runtime doesn't use) stay where
+ * they are. The offset and the size of each export var are left in the
+ * metadata #rs_export_var_layout, one !{i32 offset, i32 size} per export var
+ * in the order of the RS info, the offset being
+ * rsinfo::gInvalidExportVarOffset for the vars outside the block.
+ */
+class RSExportVarBlockPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  const RSInfo::ExportVarNameListTy &mVarNames;
+  const RSInfo::ObjectSlotListTy &mObjectSlots;
+  const std::set<std::string> *mUsedExports;
+
+  struct BlockVar {
+    llvm::GlobalVariable *GV;
+    unsigned Alignment;
+    bool IsObject;
+    uint64_t Size;
+    unsigned NumUses;
+    // Position in the list of export vars (breaks the ties.)
+    unsigned Index;
+
+    bool operator<(const BlockVar &Other) const {
+      if (Alignment != Other.Alignment) {
+        return (Alignment > Other.Alignment);
+      }
+      if (IsObject != Other.IsObject) {
+        return IsObject;
+      }
+      if (NumUses != Other.NumUses) {
+        return (NumUses > Other.NumUses);
+      }
+      if (Size != Other.Size) {
+        return (Size < Other.Size);
+      }
+      return (Index < Other.Index);
+    }
+  };
+
+  /// @brief Returns the number of uses of V, looking through the constant
+  ///        expressions (e.g., the GEPs into a struct.)
+  static unsigned countUses(const llvm::Value *V) {
+    unsigned NumUses = 0;
+    for (llvm::Value::const_use_iterator U = V->use_begin(),
+             UE = V->use_end(); U != UE; ++U) {
+      if (llvm::isa<llvm::ConstantExpr>(*U)) {
+        NumUses += countUses(*U);
+      } else {
+        NumUses++;
+      }
+    }
+    return NumUses;
+  }
+
+  bool canMove(const llvm::GlobalVariable &GV) const {
+    return (!GV.isDeclaration() && !GV.isConstant() &&
+            (GV.hasExternalLinkage() || GV.hasCommonLinkage()) &&
+            !GV.isThreadLocal() && !GV.hasSection() &&
+            (GV.getType()->getAddressSpace() == 0) &&
+            ((mUsedExports == NULL) ||
+             mUsedExports->count(GV.getName().str())));
+  }
+
+public:
+  RSExportVarBlockPass(const RSInfo::ExportVarNameListTy &pVarNames,
+                       const RSInfo::ObjectSlotListTy &pObjectSlots,
+                       const std::set<std::string> *pUsedExports)
+      : ModulePass(ID), mVarNames(pVarNames), mObjectSlots(pObjectSlots),
+        mUsedExports(pUsedExports) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    if (M.getNamedGlobal(RSInfo::ExportVarBlockName) != NULL) {
+      ALOGW("%s already has %s! (the export vars stay apart)",
+            M.getModuleIdentifier().c_str(), RSInfo::ExportVarBlockName);
+      return false;
+    }
+
+    std::vector<bool> IsObject(mVarNames.size(), false);
+    for (RSInfo::ObjectSlotListTy::const_iterator
+             slot_iter = mObjectSlots.begin(), slot_end = mObjectSlots.end();
+         slot_iter != slot_end; slot_iter++) {
+      if (*slot_iter < IsObject.size()) {
+        IsObject[*slot_iter] = true;
+      }
+    }
+
+    llvm::DataLayout DL(&M);
+    std::vector<BlockVar> Vars;
+    std::set<llvm::GlobalVariable *> Seen;
+    for (size_t i = 0, e = mVarNames.size(); i != e; i++) {
+      llvm::GlobalVariable *GV = M.getNamedGlobal(mVarNames[i]);
+      if ((GV == NULL) || !canMove(*GV) || !Seen.insert(GV).second) {
+        continue;
+      }
+      BlockVar Var;
+      Var.GV = GV;
+      Var.Alignment = DL.getPreferredAlignment(GV);
+      Var.IsObject = IsObject[i];
+      Var.Size = DL.getTypeAllocSize(GV->getType()->getElementType());
+      Var.NumUses = countUses(GV);
+      Var.Index = i;
+      Vars.push_back(Var);
+    }
+
+    if (Vars.empty()) {
+      return false;
+    }
+    std::sort(Vars.begin(), Vars.end());
+
+    // Lay the vars out in a packed struct, with explicit padding.
+    llvm::LLVMContext &C = M.getContext();
+    llvm::Type *Int8Ty = llvm::Type::getInt8Ty(C);
+    llvm::SmallVector<llvm::Type *, 16> FieldTypes;
+    llvm::SmallVector<llvm::Constant *, 16> FieldInits;
+    std::vector<unsigned> FieldIndices(Vars.size());
+    std::vector<uint64_t> Offsets(Vars.size());
+    uint64_t Offset = 0;
+    unsigned Alignment = BlockAlignment;
+    for (size_t i = 0, e = Vars.size(); i != e; i++) {
+      uint64_t Aligned = llvm::RoundUpToAlignment(Offset, Vars[i].Alignment);
+      if (Aligned > Offset) {
+        llvm::Type *PadTy = llvm::ArrayType::get(Int8Ty, Aligned - Offset);
+        FieldTypes.push_back(PadTy);
+        FieldInits.push_back(llvm::ConstantAggregateZero::get(PadTy));
+      }
+      FieldIndices[i] = FieldTypes.size();
+      Offsets[i] = Aligned;
+      FieldTypes.push_back(Vars[i].GV->getType()->getElementType());
+      FieldInits.push_back(Vars[i].GV->getInitializer());
+      Offset = Aligned + Vars[i].Size;
+      Alignment = std::max(Alignment, Vars[i].Alignment);
+    }
+
+    if (Offset > rsinfo::gInvalidExportVarOffset) {
+      ALOGW("The export vars of %s are too large for a block!",
+            M.getModuleIdentifier().c_str());
+      return false;
+    }
+
+    llvm::StructType *BlockTy = llvm::StructType::get(C, FieldTypes,
+                                                      /* isPacked */true);
+    llvm::GlobalVariable *Block =
+        new llvm::GlobalVariable(M, BlockTy, /* isConstant */false,
+                                 llvm::GlobalValue::ExternalLinkage,
+                                 llvm::ConstantStruct::get(BlockTy,
+                                                           FieldInits),
+                                 RSInfo::ExportVarBlockName);
+    Block->setAlignment(Alignment);
+
+    // Point the uses of each var to its field.
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(C);
+    std::vector<uint32_t> VarOffsets(mVarNames.size(),
+                                     rsinfo::gInvalidExportVarOffset);
+    std::vector<uint32_t> VarSizes(mVarNames.size(), 0);
+    for (size_t i = 0, e = Vars.size(); i != e; i++) {
+      llvm::Constant *Indices[] = {
+        llvm::ConstantInt::get(Int32Ty, 0),
+        llvm::ConstantInt::get(Int32Ty, FieldIndices[i])
+      };
+      llvm::Constant *Field =
+          llvm::ConstantExpr::getInBoundsGetElementPtr(Block, Indices);
+
+      llvm::GlobalVariable *GV = Vars[i].GV;
+      GV->replaceAllUsesWith(Field);
+      GV->eraseFromParent();
+
+      VarOffsets[Vars[i].Index] = static_cast<uint32_t>(Offsets[i]);
+      VarSizes[Vars[i].Index] = static_cast<uint32_t>(Vars[i].Size);
+    }
+
+    // A name listed twice refers to the same var.
+    for (size_t i = 0, e = mVarNames.size(); i != e; i++) {
+      if (VarOffsets[i] != rsinfo::gInvalidExportVarOffset) {
+        continue;
+      }
+      for (size_t j = 0; j != i; j++) {
+        if (::strcmp(mVarNames[i], mVarNames[j]) == 0) {
+          VarOffsets[i] = VarOffsets[j];
+          VarSizes[i] = VarSizes[j];
+          break;
+        }
+      }
+    }
+
+    llvm::NamedMDNode *LayoutMetadata =
+        M.getOrInsertNamedMetadata(export_var_layout_metadata_name);
+    LayoutMetadata->dropAllReferences();
+    for (size_t i = 0, e = mVarNames.size(); i != e; i++) {
+      llvm::Value *Layout[] = {
+        llvm::ConstantInt::get(Int32Ty, VarOffsets[i]),
+        llvm::ConstantInt::get(Int32Ty, VarSizes[i])
+      };
+      LayoutMetadata->addOperand(llvm::MDNode::get(C, Layout));
+    }
+
+    ALOGV("%zu export vars of %s are in a block of %llu bytes",
+          Vars.size(), M.getModuleIdentifier().c_str(),
+          static_cast<unsigned long long>(Offset));
+
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "Export Var Block Layout";
+  }
+
+};  // end RSExportVarBlockPass
+
+}  // end anonymous namespace
+
+char RSExportVarBlockPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSExportVarBlockPass(const RSInfo::ExportVarNameListTy &pVarNames,
+                           const RSInfo::ObjectSlotListTy &pObjectSlots,
+                           const std::set<std::string> *pUsedExports) {
+  return new RSExportVarBlockPass(pVarNames, pObjectSlots, pUsedExports);
+}
+
+}  // end namespace bcc
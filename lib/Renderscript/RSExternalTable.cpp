@@ -0,0 +1,251 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/InstIterator.h>
+
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+const char ExternalTableName[] = ".rs.external_table";
+
+// An external referenced from fewer places keeps its direct references: the
+// entry of the table would cost as many relocations as it saves.
+const unsigned MinUses = 2;
+
+/* RSExternalTablePass - This pass routes the references of the code of a
+ * script to the symbols it doesn't define (the RS runtime, libm, ...) through
+ * one internal table holding their addresses, so that the loader fills one
+ * word per external symbol instead of patching each call site (and building
+ * a stub for each of the far ones.) Each use loads the address from the
+ * table right before it, with !invariant.load so that the code generator
+ * may hoist the load out of the loops; the calls become indirect.
+ *
+ * The references to the symbols defined by the script are left to the
+ * assembler, which resolves those within .text when the code is emitted.
+ * The externals referenced from the initializers of the globals and the
+ * calls the code generator introduces (e.g., to compiler_rt) are left as
+ * they are. It runs right before the code generation.
+ */
+class RSExternalTablePass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  typedef llvm::DenseMap<const llvm::GlobalValue *, unsigned> IndexMapTy;
+
+  llvm::GlobalVariable *mTable;
+  IndexMapTy mIndices;
+
+  /// @brief Returns the number of uses of V, looking through the constant
+  ///        expressions (e.g., the bitcasts of a callee.)
+  static unsigned countUses(const llvm::Value *V) {
+    unsigned NumUses = 0;
+    for (llvm::Value::const_use_iterator U = V->use_begin(),
+             UE = V->use_end(); U != UE; ++U) {
+      if (llvm::isa<llvm::ConstantExpr>(*U)) {
+        NumUses += countUses(*U);
+      } else {
+        NumUses++;
+      }
+    }
+    return NumUses;
+  }
+
+  static bool isExternal(const llvm::GlobalValue &GV) {
+    if (!GV.isDeclaration()) {
+      return false;
+    }
+    if (const llvm::Function *F = llvm::dyn_cast<llvm::Function>(&GV)) {
+      return !F->isIntrinsic();
+    }
+    return !llvm::cast<llvm::GlobalVariable>(GV).isThreadLocal();
+  }
+
+  /// @brief Returns true if C refers to an entry of the table.
+  bool refersToTable(const llvm::Constant *C) const {
+    if (const llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(C)) {
+      return mIndices.count(GV);
+    }
+    if (!llvm::isa<llvm::ConstantExpr>(C)) {
+      return false;
+    }
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; i++) {
+      if (refersToTable(llvm::cast<llvm::Constant>(C->getOperand(i)))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Returns the value of C computed from the table before
+  ///        InsertBefore. C must refer to the table.
+  llvm::Value *materialize(llvm::Constant *C, llvm::Instruction *InsertBefore) {
+    if (llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(C)) {
+      llvm::LLVMContext &Ctx = GV->getContext();
+      llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+      llvm::Constant *Indices[] = {
+        llvm::ConstantInt::get(Int32Ty, 0),
+        llvm::ConstantInt::get(Int32Ty, mIndices.lookup(GV))
+      };
+      llvm::LoadInst *Address =
+          new llvm::LoadInst(
+              llvm::ConstantExpr::getInBoundsGetElementPtr(mTable, Indices),
+              GV->getName(), InsertBefore);
+      Address->setMetadata("invariant.load",
+                           llvm::MDNode::get(Ctx,
+                                             llvm::ArrayRef<llvm::Value *>()));
+      return new llvm::BitCastInst(Address, GV->getType(), "", InsertBefore);
+    }
+
+    llvm::Instruction *I =
+        llvm::cast<llvm::ConstantExpr>(C)->getAsInstruction();
+    I->insertBefore(InsertBefore);
+    rewriteOperands(I, I);
+    return I;
+  }
+
+  /// @brief Replaces the operands of I which refer to the table by their
+  ///        values computed before InsertBefore.
+  void rewriteOperands(llvm::Instruction *I, llvm::Instruction *InsertBefore) {
+    for (unsigned i = 0, e = I->getNumOperands(); i != e; i++) {
+      llvm::Constant *C = llvm::dyn_cast<llvm::Constant>(I->getOperand(i));
+      if ((C != NULL) && refersToTable(C)) {
+        I->setOperand(i, materialize(C, InsertBefore));
+      }
+    }
+  }
+
+public:
+  RSExternalTablePass() : ModulePass(ID), mTable(NULL) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    std::vector<llvm::GlobalValue *> Externals;
+    for (llvm::Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+      if (isExternal(*F) && (countUses(F) >= MinUses)) {
+        Externals.push_back(F);
+      }
+    }
+    for (llvm::Module::global_iterator GV = M.global_begin(),
+             GVE = M.global_end(); GV != GVE; ++GV) {
+      if (isExternal(*GV) && (countUses(GV) >= MinUses)) {
+        Externals.push_back(GV);
+      }
+    }
+
+    if (Externals.empty()) {
+      return false;
+    }
+
+    llvm::Type *Int8PtrTy = llvm::Type::getInt8PtrTy(M.getContext());
+    llvm::SmallVector<llvm::Constant *, 32> Entries;
+    mIndices.clear();
+    for (size_t i = 0, e = Externals.size(); i != e; i++) {
+      mIndices[Externals[i]] = i;
+      Entries.push_back(llvm::ConstantExpr::getBitCast(Externals[i],
+                                                       Int8PtrTy));
+    }
+    llvm::ArrayType *TableTy = llvm::ArrayType::get(Int8PtrTy,
+                                                    Entries.size());
+    mTable = new llvm::GlobalVariable(M, TableTy, /* isConstant */true,
+                                      llvm::GlobalValue::InternalLinkage,
+                                      llvm::ConstantArray::get(TableTy,
+                                                               Entries),
+                                      ExternalTableName);
+
+    // Collect the users first: the rewrite inserts instructions.
+    std::vector<llvm::Instruction *> Users;
+    for (llvm::Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+      for (llvm::inst_iterator I = llvm::inst_begin(F),
+               IE = llvm::inst_end(F); I != IE; ++I) {
+        if (llvm::isa<llvm::LandingPadInst>(*I)) {
+          continue;
+        }
+        for (unsigned i = 0, e = I->getNumOperands(); i != e; i++) {
+          llvm::Constant *C = llvm::dyn_cast<llvm::Constant>(I->getOperand(i));
+          if ((C != NULL) && refersToTable(C)) {
+            Users.push_back(&*I);
+            break;
+          }
+        }
+      }
+    }
+
+    for (size_t i = 0, e = Users.size(); i != e; i++) {
+      llvm::PHINode *PHI = llvm::dyn_cast<llvm::PHINode>(Users[i]);
+      if (PHI == NULL) {
+        rewriteOperands(Users[i], Users[i]);
+        continue;
+      }
+      // The value of an incoming edge is computed at the end of its block,
+      // once per block (a block listed twice must give the same value.)
+      llvm::DenseMap<llvm::BasicBlock *, llvm::Value *> Computed;
+      for (unsigned j = 0, je = PHI->getNumIncomingValues(); j != je; j++) {
+        llvm::Constant *C =
+            llvm::dyn_cast<llvm::Constant>(PHI->getIncomingValue(j));
+        if ((C == NULL) || !refersToTable(C)) {
+          continue;
+        }
+        llvm::BasicBlock *BB = PHI->getIncomingBlock(j);
+        llvm::Value *&V = Computed[BB];
+        if (V == NULL) {
+          V = materialize(C, BB->getTerminator());
+        }
+        PHI->setIncomingValue(j, V);
+      }
+    }
+
+    ALOGV("%zu externals of %s are reached through %s (%zu instructions)",
+          Externals.size(), M.getModuleIdentifier().c_str(), ExternalTableName,
+          Users.size());
+
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "External Table";
+  }
+
+};  // end RSExternalTablePass
+
+}  // end anonymous namespace
+
+char RSExternalTablePass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSExternalTablePass() {
+  return new RSExternalTablePass();
+}
+
+}  // end namespace bcc
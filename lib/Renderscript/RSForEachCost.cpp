@@ -0,0 +1,190 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <string>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Name of metadata node where the costs are left for
+// RSInfo::recordExportForeachCosts() (should be synced with
+// RSInfoExtractor.cpp.)
+const char foreach_cost_metadata_name[] = "#rs_foreach_cost";
+
+/* RSForEachCostPass - This pass estimates how many instructions and memory
+ * operations the "<NAME>.expand" function of each foreach function spends on
+ * a cell. It's meant to run once the kernels have been inlined and the loops
+ * vectorized, right before the code generation. The estimates are left in the
+ * metadata #rs_foreach_cost, one !{i32 instructions, i32 memory ops} per
+ * foreach function, for the RS info.
+ */
+class RSForEachCostPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  const RSInfo::ExportForeachFuncListTy &mFuncs;
+
+  /// @brief Returns the number of cells one iteration of L processes.
+  ///
+  /// This is the constant step of the induction variable of L (as created by
+  /// RSForEachExpandPass::createLoop() and possibly widened or vectorized
+  /// since) or 1 if there's no such variable.
+  static uint64_t getCellsPerIteration(const llvm::Loop *L) {
+    const llvm::BasicBlock *Latch = L->getLoopLatch();
+    if (Latch == NULL) {
+      return 1;
+    }
+
+    for (llvm::BasicBlock::const_iterator I = L->getHeader()->begin();
+         const llvm::PHINode *PN = llvm::dyn_cast<llvm::PHINode>(I); ++I) {
+      const llvm::BinaryOperator *Next = llvm::dyn_cast<llvm::BinaryOperator>(
+          PN->getIncomingValueForBlock(Latch));
+      if ((Next == NULL) || (Next->getOpcode() != llvm::Instruction::Add) ||
+          (Next->getOperand(0) != PN)) {
+        continue;
+      }
+      const llvm::ConstantInt *Step =
+          llvm::dyn_cast<llvm::ConstantInt>(Next->getOperand(1));
+      if ((Step != NULL) && !Step->isZero()) {
+        return Step->getZExtValue();
+      }
+    }
+
+    return 1;
+  }
+
+  /// @brief Estimates the cost per cell of the expanded function F.
+  ///
+  /// Each top-level loop of F walks cells. The loop with the lowest cost per
+  /// cell (e.g., the vectorized one rather than its remainder) is the one
+  /// running on most of them, so that's the estimate.
+  void estimateCost(llvm::Function &F, uint32_t &Instructions,
+                    uint32_t &MemoryOps) {
+    llvm::LoopInfo &LI = getAnalysis<llvm::LoopInfo>(F);
+
+    Instructions = 0;
+    MemoryOps = 0;
+    bool Found = false;
+    for (llvm::LoopInfo::iterator LI_I = LI.begin(), LI_E = LI.end();
+         LI_I != LI_E; ++LI_I) {
+      const llvm::Loop *L = *LI_I;
+      uint64_t NumInsts = 0, NumMemOps = 0;
+      for (llvm::Loop::block_iterator BI = L->block_begin(),
+                                      BE = L->block_end();
+           BI != BE; ++BI) {
+        for (llvm::BasicBlock::const_iterator I = (*BI)->begin(),
+                                              IE = (*BI)->end();
+             I != IE; ++I) {
+          if (llvm::isa<llvm::PHINode>(I) ||
+              llvm::isa<llvm::DbgInfoIntrinsic>(I)) {
+            continue;
+          }
+          NumInsts++;
+          if (I->mayReadOrWriteMemory()) {
+            NumMemOps++;
+          }
+        }
+      }
+
+      uint64_t Cells = getCellsPerIteration(L);
+      uint32_t CellInsts = static_cast<uint32_t>((NumInsts + Cells - 1) /
+                                                 Cells);
+      uint32_t CellMemOps = static_cast<uint32_t>((NumMemOps + Cells - 1) /
+                                                  Cells);
+      if (!Found || (CellInsts < Instructions)) {
+        Instructions = CellInsts;
+        MemoryOps = CellMemOps;
+        Found = true;
+      }
+    }
+  }
+
+public:
+  RSForEachCostPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs)
+      : ModulePass(ID), mFuncs(pForeachFuncs) {
+  }
+
+  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+    AU.addRequired<llvm::LoopInfo>();
+    AU.setPreservesAll();
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    llvm::LLVMContext &C = M.getContext();
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(C);
+
+    llvm::NamedMDNode *CostMetadata =
+        M.getOrInsertNamedMetadata(foreach_cost_metadata_name);
+    CostMetadata->dropAllReferences();
+
+    for (RSInfo::ExportForeachFuncListTy::const_iterator
+             func_iter = mFuncs.begin(), func_end = mFuncs.end();
+         func_iter != func_end; func_iter++) {
+      std::string Name(func_iter->first);
+      Name.append(RSInfo::ExportForeachSuffixes[RSInfo::kForeachExpand]);
+
+      uint32_t Instructions = 0, MemoryOps = 0;
+      llvm::Function *F = M.getFunction(Name);
+      if ((F != NULL) && !F->isDeclaration()) {
+        estimateCost(*F, Instructions, MemoryOps);
+        ALOGV("Estimated cost of %s: %u instructions, %u memory operations "
+              "per cell", Name.c_str(), Instructions, MemoryOps);
+      }
+
+      llvm::Value *Cost[] = {
+        llvm::ConstantInt::get(Int32Ty, Instructions),
+        llvm::ConstantInt::get(Int32Ty, MemoryOps)
+      };
+      CostMetadata->addOperand(llvm::MDNode::get(C, Cost));
+    }
+
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "ForEach Cost Estimation";
+  }
+
+};  // end RSForEachCostPass
+
+}  // end anonymous namespace
+
+char RSForEachCostPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSForEachCostPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs) {
+  return new RSForEachCostPass(pForeachFuncs);
+}
+
+}  // end namespace bcc
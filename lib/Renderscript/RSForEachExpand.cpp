@@ -18,10 +18,15 @@
 #include "bcc/Renderscript/RSTransforms.h"
 
 #include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <utility>
 
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
@@ -59,9 +64,56 @@ private:
 
   const RSInfo::ExportForeachFuncListTy &mFuncs;
 
+  // The accumulators of the reductions. They are expanded like pass-by-value
+  // kernels whose output is a single cell (see ExpandKernel()).
+  const RSInfo::ExportReduceListTy &mReduces;
+
   // Turns on optimization of allocation stride values.
   bool mEnableStepOpt;
 
+  // Width (in bytes) of the SIMD registers of the target. The inner loop of
+  // the kernels operating on primitive types is widened to fill it. 0 disables
+  // the widening.
+  unsigned mVectorWidth;
+
+  // The script requires full floating point precision (RSInfo::FP_Full). Its
+  // loops are left to be scalar, except those of mRelaxedKernels.
+  bool mPreciseFP;
+  std::set<std::string> mRelaxedKernels;
+
+  // The cells of the input and the output of a kernel are never accessed
+  // through each other's pointers (i.e., the allocations are distinct or the
+  // kernel runs in place, cell by cell.) The loads from the input and the
+  // stores to the output of the loops then get disjoint TBAA.
+  bool mNoAliasInOut;
+
+  // How far (in bytes) ahead of the current cell the loops prefetch their
+  // input. 0 disables the prefetching.
+  unsigned mPrefetchDistance;
+
+  // Size (in bytes) of each of the scratch buffers of the streaming entry
+  // points. 0 disables them.
+  unsigned mStreamBlockSize;
+
+  // The values needed to emit one call to a pass-by-value kernel inside the
+  // loop of its expanded function.
+  struct KernelCallInfo {
+    llvm::Function *Kernel;
+    uint32_t Signature;
+    llvm::Value *X1;
+    llvm::Type *InTy;
+    llvm::Value *InBasePtr;
+    llvm::Value *InStep;
+    llvm::Type *OutTy;
+    llvm::Value *OutBasePtr;
+    llvm::Value *OutStep;
+    bool PassOutByReference;
+    llvm::Value *Y;
+    // TBAA of the loads from the input and the stores to the output.
+    llvm::MDNode *TBAAIn;
+    llvm::MDNode *TBAAOut;
+  };
+
   uint32_t getRootSignature(llvm::Function *F) {
     const llvm::NamedMDNode *ExportForEachMetadata =
         M->getNamedMetadata("#rs_export_foreach");
@@ -212,6 +264,11 @@ private:
 
     assert(AI == F->arg_end());
 
+    // Nothing but the expanded function itself accesses the parameter
+    // structure while it runs (the kernels don't get a pointer to it.)
+    F->addAttribute(1, llvm::Attribute::NoAlias);
+    F->addAttribute(1, llvm::Attribute::NoCapture);
+
     llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", F);
     llvm::IRBuilder<> Builder(Begin);
     Builder.CreateRetVoid();
@@ -219,11 +276,972 @@ private:
     return F;
   }
 
+  /// @brief Load the field Index of the parameter structure of an expanded
+  ///        function.
+  ///
+  /// Each field used by the loop is loaded once ahead of it. The loads get
+  /// their own TBAA node so that, together with p being noalias, they stay
+  /// loop invariant after the kernel is inlined: none of the stores of the
+  /// kernel can reach the structure.
+  llvm::LoadInst *loadInvariantParam(llvm::IRBuilder<> &Builder,
+                                     llvm::Value *Arg_p, unsigned Index,
+                                     const llvm::Twine &Name = "") {
+    llvm::MDBuilder MDHelper(*C);
+    llvm::MDNode *TBAAParam = MDHelper.createTBAANode(
+        "pointer", MDHelper.createTBAARoot("RenderScript TBAA"));
+
+    llvm::LoadInst *Load =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, Index), Name);
+    Load->setMetadata("tbaa", TBAAParam);
+    return Load;
+  }
+
+  /// @brief Returns the type of the tile descriptor of the tiled entry point.
+  ///
+  /// The tiled entry point iterates over a 3D range of cells so that the
+  /// runtime is able to hand out cache-sized tiles instead of whole rows.
+  llvm::Type *getForeachTileTy() {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    /* struct RsExpandTile {
+     *   uint32_t x1, x2;
+     *   uint32_t y1, y2;
+     *   uint32_t z1, z2;
+     *   uint32_t instep, outstep;
+     *   uint32_t inystride, outystride;
+     *   uint32_t inzstride, outzstride;
+     * };
+     *
+     * All the ranges are half-open. The steps and strides are given in bytes.
+     * RsForEachStubParamStruct::in/out must point to the cell (x1, y1, z1).
+     */
+    llvm::SmallVector<llvm::Type*, 12> StructTys(12, Int32Ty);
+
+    return llvm::StructType::create(StructTys, "RsExpandTile");
+  }
+
+  /// @brief Create the tiled entry point for an expanded function.
+  ///
+  /// This creates a function with the following signature:
+  ///
+  ///   void (const RsForEachStubParamStruct *p, const RsExpandTile *tile)
+  ///
+  /// named after the expanded function followed by ".tiled". It walks the
+  /// rows of the tile and invokes the expanded function on each of them with a
+  /// private copy of the parameter structure whose in/out/y/z have been
+  /// adjusted for the row.
+  bool createTiledFunction(llvm::Function *ExpandedFunc, uint32_t Signature) {
+    llvm::Type *ForEachStubTy = llvm::cast<llvm::PointerType>(
+        ExpandedFunc->arg_begin()->getType())->getElementType();
+    llvm::Type *TilePtrTy = getForeachTileTy()->getPointerTo();
+
+    llvm::SmallVector<llvm::Type*, 2> ParamTys;
+    ParamTys.push_back(ForEachStubTy->getPointerTo());
+    ParamTys.push_back(TilePtrTy);
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *TiledFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               ExpandedFunc->getName() + ".tiled", M);
+
+    llvm::Function::arg_iterator AI = TiledFunc->arg_begin();
+    llvm::Value *Arg_p = AI;
+    AI->setName("p");
+    AI++;
+    llvm::Value *Arg_tile = AI;
+    AI->setName("tile");
+    AI++;
+
+    assert(AI == TiledFunc->arg_end());
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", TiledFunc);
+    llvm::ReturnInst::Create(*C, Begin);
+
+    llvm::IRBuilder<> Builder(TiledFunc->getEntryBlock().begin());
+
+    // Load the tile descriptor and the base pointers before entering the loops.
+    llvm::Value *X1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 0),
+                                         "x1");
+    llvm::Value *X2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 1),
+                                         "x2");
+    llvm::Value *Y1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 2),
+                                         "y1");
+    llvm::Value *Y2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 3),
+                                         "y2");
+    llvm::Value *Z1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 4),
+                                         "z1");
+    llvm::Value *Z2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 5),
+                                         "z2");
+    llvm::Value *InStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 6), "instep");
+    llvm::Value *OutStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 7), "outstep");
+
+    bool HasIn = bcinfo::MetadataExtractor::hasForEachSignatureIn(Signature);
+    bool HasOut = bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature);
+
+    llvm::Value *InBasePtr = NULL, *InYStride = NULL, *InZStride = NULL;
+    if (HasIn) {
+      InBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0));
+      InYStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 8),
+                                     "inystride");
+      InZStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 10),
+                                     "inzstride");
+    }
+
+    llvm::Value *OutBasePtr = NULL, *OutYStride = NULL, *OutZStride = NULL;
+    if (HasOut) {
+      OutBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1));
+      OutYStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 9),
+                                      "outystride");
+      OutZStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 11),
+                                      "outzstride");
+    }
+
+    // The expanded function reads y/z and the row pointers from the parameter
+    // structure, so each row gets its own copy of it.
+    llvm::Value *RowP = Builder.CreateAlloca(ForEachStubTy, 0, "row_p");
+    Builder.CreateStore(Builder.CreateLoad(Arg_p), RowP);
+
+    llvm::PHINode *IVZ, *IVY;
+    createLoop(Builder, Z1, Z2, &IVZ);
+    IVZ->setName("Z");
+    createLoop(Builder, Y1, Y2, &IVY);
+    IVY->setName("Y");
+
+    Builder.CreateStore(IVY, Builder.CreateStructGEP(RowP, 5));
+    Builder.CreateStore(IVZ, Builder.CreateStructGEP(RowP, 6));
+
+    llvm::Value *YOffset = Builder.CreateSub(IVY, Y1);
+    llvm::Value *ZOffset = Builder.CreateSub(IVZ, Z1);
+
+    if (HasIn) {
+      llvm::Value *InOffset =
+          Builder.CreateAdd(Builder.CreateMul(YOffset, InYStride),
+                            Builder.CreateMul(ZOffset, InZStride));
+      Builder.CreateStore(Builder.CreateGEP(InBasePtr, InOffset),
+                          Builder.CreateStructGEP(RowP, 0));
+    }
+
+    if (HasOut) {
+      llvm::Value *OutOffset =
+          Builder.CreateAdd(Builder.CreateMul(YOffset, OutYStride),
+                            Builder.CreateMul(ZOffset, OutZStride));
+      Builder.CreateStore(Builder.CreateGEP(OutBasePtr, OutOffset),
+                          Builder.CreateStructGEP(RowP, 1));
+    }
+
+    llvm::SmallVector<llvm::Value*, 5> ExpandedArgs;
+    ExpandedArgs.push_back(RowP);
+    ExpandedArgs.push_back(X1);
+    ExpandedArgs.push_back(X2);
+    ExpandedArgs.push_back(InStep);
+    ExpandedArgs.push_back(OutStep);
+
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+
+    return true;
+  }
+
+  /// @brief Returns the type of the span descriptor of the spans entry point.
+  llvm::Type *getForeachSpanTy() {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    /* struct RsExpandSpan {
+     *   uint32_t x1, x2;
+     *   uint32_t y, z;
+     * };
+     *
+     * The active cells [x1, x2) of the row y of the plane z.
+     */
+    llvm::SmallVector<llvm::Type*, 4> StructTys(4, Int32Ty);
+
+    return llvm::StructType::create(StructTys, "RsExpandSpan");
+  }
+
+  /// @brief Create the spans entry point for an expanded function.
+  ///
+  /// This creates a function with the following signature:
+  ///
+  ///   void (const RsForEachStubParamStruct *p, const RsExpandTile *tile,
+  ///         const RsExpandSpan *spans, uint32_t count)
+  ///
+  /// named after the expanded function followed by ".spans". It invokes the
+  /// expanded function on each of the count spans, which must lie within the
+  /// tile, and only on them: a launch on the active cells of a mask (run
+  /// length encoded into spans by the runtime) costs the active cells rather
+  /// than the whole tile. Each span gets a private copy of the parameter
+  /// structure, in/out moved from the cell (x1, y1, z1) of the tile to the
+  /// first cell of the span with the steps and strides of the tile.
+  void createSpansFunction(llvm::Function *ExpandedFunc, uint32_t Signature) {
+    llvm::Type *ForEachStubTy = llvm::cast<llvm::PointerType>(
+        ExpandedFunc->arg_begin()->getType())->getElementType();
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+
+    llvm::SmallVector<llvm::Type*, 4> ParamTys;
+    ParamTys.push_back(ForEachStubTy->getPointerTo());
+    ParamTys.push_back(getForeachTileTy()->getPointerTo());
+    ParamTys.push_back(getForeachSpanTy()->getPointerTo());
+    ParamTys.push_back(Int32Ty);
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *SpansFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               ExpandedFunc->getName() + ".spans", M);
+
+    llvm::Function::arg_iterator AI = SpansFunc->arg_begin();
+    llvm::Value *Arg_p = AI;
+    AI->setName("p");
+    AI++;
+    llvm::Value *Arg_tile = AI;
+    AI->setName("tile");
+    AI++;
+    llvm::Value *Arg_spans = AI;
+    AI->setName("spans");
+    AI++;
+    llvm::Value *Arg_count = AI;
+    AI->setName("count");
+    AI++;
+
+    assert(AI == SpansFunc->arg_end());
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", SpansFunc);
+    llvm::ReturnInst::Create(*C, Begin);
+
+    llvm::IRBuilder<> Builder(SpansFunc->getEntryBlock().begin());
+
+    // Load the origin of the tile and the base pointers before the loop.
+    llvm::Value *X1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 0),
+                                         "x1");
+    llvm::Value *Y1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 2),
+                                         "y1");
+    llvm::Value *Z1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 4),
+                                         "z1");
+    llvm::Value *InStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 6), "instep");
+    llvm::Value *OutStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 7), "outstep");
+
+    bool HasIn = bcinfo::MetadataExtractor::hasForEachSignatureIn(Signature);
+    bool HasOut = bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature);
+
+    llvm::Value *InBasePtr = NULL, *InYStride = NULL, *InZStride = NULL;
+    if (HasIn) {
+      InBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0));
+      InYStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 8),
+                                     "inystride");
+      InZStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 10),
+                                     "inzstride");
+    }
+
+    llvm::Value *OutBasePtr = NULL, *OutYStride = NULL, *OutZStride = NULL;
+    if (HasOut) {
+      OutBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1));
+      OutYStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 9),
+                                      "outystride");
+      OutZStride = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 11),
+                                      "outzstride");
+    }
+
+    llvm::Value *SpanP = Builder.CreateAlloca(ForEachStubTy, 0, "span_p");
+    Builder.CreateStore(Builder.CreateLoad(Arg_p), SpanP);
+
+    llvm::PHINode *IV;
+    createLoop(Builder, Builder.getInt32(0), Arg_count, &IV);
+    IV->setName("Span");
+
+    llvm::Value *Span = Builder.CreateGEP(Arg_spans, IV);
+    llvm::Value *SpanX1 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Span, 0), "span_x1");
+    llvm::Value *SpanX2 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Span, 1), "span_x2");
+    llvm::Value *SpanY =
+        Builder.CreateLoad(Builder.CreateStructGEP(Span, 2), "span_y");
+    llvm::Value *SpanZ =
+        Builder.CreateLoad(Builder.CreateStructGEP(Span, 3), "span_z");
+
+    Builder.CreateStore(SpanY, Builder.CreateStructGEP(SpanP, 5));
+    Builder.CreateStore(SpanZ, Builder.CreateStructGEP(SpanP, 6));
+
+    llvm::Value *XOffset = Builder.CreateSub(SpanX1, X1);
+    llvm::Value *YOffset = Builder.CreateSub(SpanY, Y1);
+    llvm::Value *ZOffset = Builder.CreateSub(SpanZ, Z1);
+
+    if (HasIn) {
+      llvm::Value *InOffset =
+          Builder.CreateAdd(Builder.CreateMul(XOffset, InStep),
+                            Builder.CreateAdd(
+                                Builder.CreateMul(YOffset, InYStride),
+                                Builder.CreateMul(ZOffset, InZStride)));
+      Builder.CreateStore(Builder.CreateGEP(InBasePtr, InOffset),
+                          Builder.CreateStructGEP(SpanP, 0));
+    }
+
+    if (HasOut) {
+      llvm::Value *OutOffset =
+          Builder.CreateAdd(Builder.CreateMul(XOffset, OutStep),
+                            Builder.CreateAdd(
+                                Builder.CreateMul(YOffset, OutYStride),
+                                Builder.CreateMul(ZOffset, OutZStride)));
+      Builder.CreateStore(Builder.CreateGEP(OutBasePtr, OutOffset),
+                          Builder.CreateStructGEP(SpanP, 1));
+    }
+
+    llvm::SmallVector<llvm::Value*, 5> ExpandedArgs;
+    ExpandedArgs.push_back(SpanP);
+    ExpandedArgs.push_back(SpanX1);
+    ExpandedArgs.push_back(SpanX2);
+    ExpandedArgs.push_back(InStep);
+    ExpandedArgs.push_back(OutStep);
+
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+  }
+
+  /// @brief Create the streaming entry point for an expanded function.
+  ///
+  /// This creates a function with the same signature as the expanded
+  /// function named after it followed by ".stream", for the allocations in
+  /// slow or uncached memory (e.g., camera buffers.) It walks the range in
+  /// blocks of as many cells as fit in mStreamBlockSize bytes: the input
+  /// cells of a block are copied with one memcpy() into a scratch buffer on
+  /// the stack, the start of the next block is prefetched, the expanded
+  /// function runs over the buffer and, if StageOut, writes its output into
+  /// a second buffer which is then copied out with one memcpy(). The bulk
+  /// copies use the widest accesses of the target instead of one load or
+  /// store per cell on the slow memory, and the kernel only touches the
+  /// cache. A side whose step is 0 (e.g., the accumulator of a reduction)
+  /// isn't staged, and a range whose cells don't fit in a buffer is passed
+  /// through to the expanded function. An output that isn't staged is still
+  /// advanced to the first cell of each block.
+  void createStreamFunction(llvm::Function *ExpandedFunc, uint32_t Signature,
+                            bool StageOut) {
+    bool HasIn = bcinfo::MetadataExtractor::hasForEachSignatureIn(Signature);
+    bool HasOut = bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature);
+    StageOut = StageOut && HasOut;
+    if ((mStreamBlockSize == 0) || (!HasIn && !StageOut)) {
+      return;
+    }
+
+    llvm::Type *ForEachStubTy = llvm::cast<llvm::PointerType>(
+        ExpandedFunc->arg_begin()->getType())->getElementType();
+    llvm::Function *StreamFunc =
+        llvm::Function::Create(ExpandedFunc->getFunctionType(),
+                               llvm::GlobalValue::ExternalLinkage,
+                               ExpandedFunc->getName() + ".stream", M);
+
+    llvm::Function::arg_iterator AI = StreamFunc->arg_begin();
+    llvm::Value *Arg_p = AI;
+    AI->setName("p");
+    AI++;
+    llvm::Value *Arg_x1 = AI;
+    AI->setName("x1");
+    AI++;
+    llvm::Value *Arg_x2 = AI;
+    AI->setName("x2");
+    AI++;
+    llvm::Value *Arg_instep = AI;
+    AI->setName("instep");
+    AI++;
+    llvm::Value *Arg_outstep = AI;
+    AI->setName("outstep");
+    AI++;
+
+    assert(AI == StreamFunc->arg_end());
+
+    llvm::BasicBlock *Begin =
+        llvm::BasicBlock::Create(*C, "Begin", StreamFunc);
+    llvm::BasicBlock *Direct =
+        llvm::BasicBlock::Create(*C, "Direct", StreamFunc);
+    llvm::BasicBlock *Check =
+        llvm::BasicBlock::Create(*C, "Check", StreamFunc);
+    llvm::BasicBlock *Loop = llvm::BasicBlock::Create(*C, "Loop", StreamFunc);
+    llvm::BasicBlock *Exit = llvm::BasicBlock::Create(*C, "Exit", StreamFunc);
+    llvm::ReturnInst::Create(*C, Exit);
+
+    llvm::IRBuilder<> Builder(Begin);
+    llvm::Type *BufferTy =
+        llvm::ArrayType::get(llvm::Type::getInt8Ty(*C), mStreamBlockSize);
+    llvm::Value *InBuffer = NULL, *OutBuffer = NULL;
+    if (HasIn) {
+      llvm::AllocaInst *Buffer = Builder.CreateAlloca(BufferTy, 0, "in_buf");
+      Buffer->setAlignment(16);
+      InBuffer = Builder.CreateConstInBoundsGEP2_32(Buffer, 0, 0);
+    }
+    if (StageOut) {
+      llvm::AllocaInst *Buffer = Builder.CreateAlloca(BufferTy, 0, "out_buf");
+      Buffer->setAlignment(16);
+      OutBuffer = Builder.CreateConstInBoundsGEP2_32(Buffer, 0, 0);
+    }
+    llvm::Value *BlockP = Builder.CreateAlloca(ForEachStubTy, 0, "block_p");
+    Builder.CreateStore(Builder.CreateLoad(Arg_p), BlockP);
+
+    // The cells per block, limited by the larger of the staged steps.
+    llvm::Value *MaxStep = Builder.getInt32(1);
+    if (HasIn) {
+      MaxStep = Builder.CreateSelect(Builder.CreateICmpUGT(Arg_instep,
+                                                           MaxStep),
+                                     Arg_instep, MaxStep);
+    }
+    if (StageOut) {
+      MaxStep = Builder.CreateSelect(Builder.CreateICmpUGT(Arg_outstep,
+                                                           MaxStep),
+                                     Arg_outstep, MaxStep);
+    }
+    llvm::Value *BlockCells =
+        Builder.CreateUDiv(Builder.getInt32(mStreamBlockSize), MaxStep,
+                           "block_cells");
+    Builder.CreateCondBr(Builder.CreateICmpEQ(BlockCells, Builder.getInt32(0)),
+                         Direct, Check);
+
+    llvm::SmallVector<llvm::Value*, 5> ExpandedArgs;
+    for (llvm::Function::arg_iterator I = StreamFunc->arg_begin(),
+             E = StreamFunc->arg_end(); I != E; ++I) {
+      ExpandedArgs.push_back(I);
+    }
+    Builder.SetInsertPoint(Direct);
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+    Builder.CreateBr(Exit);
+
+    Builder.SetInsertPoint(Check);
+    llvm::Value *InBasePtr = NULL, *OutBasePtr = NULL;
+    if (HasIn) {
+      InBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0));
+    }
+    if (HasOut) {
+      OutBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1));
+    }
+    Builder.CreateCondBr(Builder.CreateICmpULT(Arg_x1, Arg_x2), Loop, Exit);
+
+    Builder.SetInsertPoint(Loop);
+    llvm::PHINode *X = Builder.CreatePHI(Arg_x1->getType(), 2, "X");
+    X->addIncoming(Arg_x1, Check);
+    llvm::Value *Left = Builder.CreateSub(Arg_x2, X);
+    llvm::Value *Cells =
+        Builder.CreateSelect(Builder.CreateICmpULT(Left, BlockCells), Left,
+                             BlockCells, "cells");
+    llvm::Value *Offset = Builder.CreateSub(X, Arg_x1);
+    llvm::Value *Zero = Builder.getInt32(0);
+
+    llvm::Value *Dst = NULL, *OutBytes = NULL;
+    if (HasIn) {
+      llvm::Value *Src =
+          Builder.CreateGEP(InBasePtr, Builder.CreateMul(Offset, Arg_instep));
+      llvm::Value *InBytes = Builder.CreateMul(Cells, Arg_instep);
+      Builder.CreateMemCpy(InBuffer, Src, InBytes, 1);
+      Builder.CreateStore(
+          Builder.CreateSelect(Builder.CreateICmpEQ(Arg_instep, Zero), Src,
+                               InBuffer),
+          Builder.CreateStructGEP(BlockP, 0));
+
+      llvm::Value *PrefetchArgs[] = {
+        Builder.CreateGEP(Src, InBytes, "prefetch_ptr"),
+        Builder.getInt32(0),  // read
+        Builder.getInt32(3),  // keep in all the levels of the cache
+        Builder.getInt32(1)   // data cache
+      };
+      Builder.CreateCall(
+          llvm::Intrinsic::getDeclaration(M, llvm::Intrinsic::prefetch),
+          PrefetchArgs);
+    }
+    if (HasOut) {
+      Dst = Builder.CreateGEP(OutBasePtr,
+                              Builder.CreateMul(Offset, Arg_outstep));
+      if (StageOut) {
+        OutBytes = Builder.CreateMul(Cells, Arg_outstep);
+        Builder.CreateStore(
+            Builder.CreateSelect(Builder.CreateICmpEQ(Arg_outstep, Zero), Dst,
+                                 OutBuffer),
+            Builder.CreateStructGEP(BlockP, 1));
+      } else {
+        Builder.CreateStore(Dst, Builder.CreateStructGEP(BlockP, 1));
+      }
+    }
+
+    llvm::Value *XNext = Builder.CreateAdd(X, Cells, "X.next");
+    ExpandedArgs[0] = BlockP;
+    ExpandedArgs[1] = X;
+    ExpandedArgs[2] = XNext;
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+
+    if (StageOut) {
+      Builder.CreateMemCpy(Dst, OutBuffer, OutBytes, 1);
+    }
+
+    X->addIncoming(XNext, Builder.GetInsertBlock());
+    Builder.CreateCondBr(Builder.CreateICmpULT(XNext, Arg_x2), Loop, Exit);
+  }
+
+  /// @brief Create the flat entry point for an expanded function.
+  ///
+  /// This creates a function with the same signature as the tiled entry
+  /// point named after the expanded function followed by ".flat". The caller
+  /// guarantees that the rows and the planes of the tile are contiguous in
+  /// both the input and the output, so the tile is a single run of cells and
+  /// the expanded function is invoked once on all of them. This saves the row
+  /// loop and the per-row copy of the parameter structure on small-width
+  /// launches. Only the functions taking neither x nor y get a flat variant.
+  void createFlatFunction(llvm::Function *ExpandedFunc, uint32_t Signature) {
+    if (bcinfo::MetadataExtractor::hasForEachSignatureX(Signature) ||
+        bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
+      return;
+    }
+
+    llvm::Type *ForEachStubTy = llvm::cast<llvm::PointerType>(
+        ExpandedFunc->arg_begin()->getType())->getElementType();
+    llvm::Type *TilePtrTy = getForeachTileTy()->getPointerTo();
+
+    llvm::SmallVector<llvm::Type*, 2> ParamTys;
+    ParamTys.push_back(ForEachStubTy->getPointerTo());
+    ParamTys.push_back(TilePtrTy);
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *FlatFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               ExpandedFunc->getName() + ".flat", M);
+
+    llvm::Function::arg_iterator AI = FlatFunc->arg_begin();
+    llvm::Value *Arg_p = AI;
+    AI->setName("p");
+    AI++;
+    llvm::Value *Arg_tile = AI;
+    AI->setName("tile");
+    AI++;
+
+    assert(AI == FlatFunc->arg_end());
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", FlatFunc);
+    llvm::ReturnInst::Create(*C, Begin);
+
+    llvm::IRBuilder<> Builder(FlatFunc->getEntryBlock().begin());
+
+    llvm::Value *X1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 0),
+                                         "x1");
+    llvm::Value *X2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 1),
+                                         "x2");
+    llvm::Value *Y1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 2),
+                                         "y1");
+    llvm::Value *Y2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 3),
+                                         "y2");
+    llvm::Value *Z1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 4),
+                                         "z1");
+    llvm::Value *Z2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 5),
+                                         "z2");
+    llvm::Value *InStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 6), "instep");
+    llvm::Value *OutStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_tile, 7), "outstep");
+
+    // The number of cells in the tile. The expanded function returns
+    // immediately on an empty range.
+    llvm::Value *Count = Builder.CreateMul(
+        Builder.CreateMul(Builder.CreateSub(X2, X1), Builder.CreateSub(Y2, Y1)),
+        Builder.CreateSub(Z2, Z1), "count");
+
+    llvm::SmallVector<llvm::Value*, 5> ExpandedArgs;
+    ExpandedArgs.push_back(Arg_p);
+    ExpandedArgs.push_back(X1);
+    ExpandedArgs.push_back(Builder.CreateAdd(X1, Count, "flat_x2"));
+    ExpandedArgs.push_back(InStep);
+    ExpandedArgs.push_back(OutStep);
+
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+  }
+
+  /// @brief Returns the type of the descriptor of the volume entry point.
+  ///
+  /// It extends RsExpandTile with the LOD and the cubemap face ranges so
+  /// that a whole mipmapped and/or cubemap allocation is walked in one call.
+  llvm::Type *getForeachVolumeTy() {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    /* struct RsExpandVolume {
+     *   uint32_t x1, x2;
+     *   uint32_t y1, y2;
+     *   uint32_t z1, z2;
+     *   uint32_t lod1, lod2;
+     *   uint32_t face1, face2;
+     *   uint32_t instep, outstep;
+     *   uint32_t inystride, outystride;
+     *   uint32_t inzstride, outzstride;
+     *   uint32_t inlodstride, outlodstride;
+     *   uint32_t infacestride, outfacestride;
+     * };
+     *
+     * As in RsExpandTile, the ranges are half-open, the steps and strides are
+     * given in bytes and RsForEachStubParamStruct::in/out must point to the
+     * cell (x1, y1, z1, lod1, face1). Each stride moves the pointers from the
+     * first row of a plane, LOD or face to the first row of the next one.
+     */
+    llvm::SmallVector<llvm::Type*, 20> StructTys(20, Int32Ty);
+
+    return llvm::StructType::create(StructTys, "RsExpandVolume");
+  }
+
+  /// @brief Add Stride bytes to the pointer held by the alloca Cursor.
+  void advanceCursor(llvm::IRBuilder<> &Builder, llvm::Value *Cursor,
+                     llvm::Value *Stride) {
+    Builder.CreateStore(Builder.CreateGEP(Builder.CreateLoad(Cursor), Stride),
+                        Cursor);
+  }
+
+  /// @brief Create the volume entry point for an expanded function.
+  ///
+  /// This creates a function with the following signature:
+  ///
+  ///   void (const RsForEachStubParamStruct *p, const RsExpandVolume *vol)
+  ///
+  /// named after the expanded function followed by ".volume". It nests the
+  /// face, LOD, z and y loops (outermost first) around the expanded function,
+  /// so the runtime launches a kernel over all the dimensions of an
+  /// allocation with a single call instead of one per row. Unlike the tiled
+  /// entry point, the row pointers are strength reduced: each loop keeps a
+  /// cursor per pointer which it copies to the cursor of the loop it encloses
+  /// and then advances by its stride, so no index is ever multiplied.
+  void createVolumeFunction(llvm::Function *ExpandedFunc, uint32_t Signature) {
+    // The loops from the outermost to the innermost one.
+    static const unsigned NumLevels = 4;
+    static const char *const LevelNames[NumLevels] = {
+      "Face", "LOD", "Z", "Y"
+    };
+    // The field of the lower bound in RsExpandVolume (the upper bound is
+    // next to it.)
+    static const unsigned BoundFields[NumLevels] = { 8, 6, 4, 2 };
+    // The field of the input stride in RsExpandVolume (the output one is
+    // next to it.)
+    static const unsigned StrideFields[NumLevels] = { 18, 16, 14, 12 };
+    // The field of the coordinate in RsForEachStubParamStruct.
+    static const unsigned ParamFields[NumLevels] = { 8, 7, 6, 5 };
+
+    llvm::Type *ForEachStubTy = llvm::cast<llvm::PointerType>(
+        ExpandedFunc->arg_begin()->getType())->getElementType();
+    llvm::Type *VolumePtrTy = getForeachVolumeTy()->getPointerTo();
+    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
+
+    llvm::SmallVector<llvm::Type*, 2> ParamTys;
+    ParamTys.push_back(ForEachStubTy->getPointerTo());
+    ParamTys.push_back(VolumePtrTy);
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *VolumeFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               ExpandedFunc->getName() + ".volume", M);
+
+    llvm::Function::arg_iterator AI = VolumeFunc->arg_begin();
+    llvm::Value *Arg_p = AI;
+    AI->setName("p");
+    AI++;
+    llvm::Value *Arg_vol = AI;
+    AI->setName("vol");
+    AI++;
+
+    assert(AI == VolumeFunc->arg_end());
+
+    llvm::BasicBlock *Begin =
+        llvm::BasicBlock::Create(*C, "Begin", VolumeFunc);
+    llvm::ReturnInst::Create(*C, Begin);
+
+    llvm::IRBuilder<> Builder(VolumeFunc->getEntryBlock().begin());
+
+    bool HasIn = bcinfo::MetadataExtractor::hasForEachSignatureIn(Signature);
+    bool HasOut = bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature);
+
+    // Load the descriptor and set up the cursors before entering the loops.
+    // The cursors are allocas in the entry block, which mem2reg turns into
+    // induction variables of the loops.
+    llvm::Value *X1 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_vol, 0),
+                                         "x1");
+    llvm::Value *X2 = Builder.CreateLoad(Builder.CreateStructGEP(Arg_vol, 1),
+                                         "x2");
+    llvm::Value *InStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_vol, 10), "instep");
+    llvm::Value *OutStep =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_vol, 11), "outstep");
+
+    llvm::Value *Lower[NumLevels], *Upper[NumLevels];
+    llvm::Value *InStride[NumLevels], *OutStride[NumLevels];
+    llvm::Value *InCursor[NumLevels], *OutCursor[NumLevels];
+    for (unsigned L = 0; L < NumLevels; L++) {
+      Lower[L] = Builder.CreateLoad(
+          Builder.CreateStructGEP(Arg_vol, BoundFields[L]));
+      Upper[L] = Builder.CreateLoad(
+          Builder.CreateStructGEP(Arg_vol, BoundFields[L] + 1));
+      InStride[L] = OutStride[L] = InCursor[L] = OutCursor[L] = NULL;
+      if (HasIn) {
+        InStride[L] = Builder.CreateLoad(
+            Builder.CreateStructGEP(Arg_vol, StrideFields[L]));
+        InCursor[L] = Builder.CreateAlloca(VoidPtrTy);
+      }
+      if (HasOut) {
+        OutStride[L] = Builder.CreateLoad(
+            Builder.CreateStructGEP(Arg_vol, StrideFields[L] + 1));
+        OutCursor[L] = Builder.CreateAlloca(VoidPtrTy);
+      }
+    }
+
+    if (HasIn) {
+      Builder.CreateStore(Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0)),
+                          InCursor[0]);
+    }
+    if (HasOut) {
+      Builder.CreateStore(Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1)),
+                          OutCursor[0]);
+    }
+
+    // The expanded function reads the coordinates and the row pointers from
+    // the parameter structure, so the loops work on a copy of it. Each loop
+    // stores its coordinate there once per iteration.
+    llvm::Value *RowP = Builder.CreateAlloca(ForEachStubTy, 0, "row_p");
+    Builder.CreateStore(Builder.CreateLoad(Arg_p), RowP);
+
+    llvm::BasicBlock *Exits[NumLevels];
+    for (unsigned L = 0; L < NumLevels; L++) {
+      llvm::PHINode *IV;
+      Exits[L] = createLoop(Builder, Lower[L], Upper[L], &IV);
+      IV->setName(LevelNames[L]);
+      Builder.CreateStore(IV, Builder.CreateStructGEP(RowP, ParamFields[L]));
+
+      // The enclosed loop starts where this iteration does.
+      if (L + 1 < NumLevels) {
+        if (HasIn) {
+          Builder.CreateStore(Builder.CreateLoad(InCursor[L]),
+                              InCursor[L + 1]);
+        }
+        if (HasOut) {
+          Builder.CreateStore(Builder.CreateLoad(OutCursor[L]),
+                              OutCursor[L + 1]);
+        }
+      }
+    }
+
+    if (HasIn) {
+      Builder.CreateStore(Builder.CreateLoad(InCursor[NumLevels - 1]),
+                          Builder.CreateStructGEP(RowP, 0));
+    }
+    if (HasOut) {
+      Builder.CreateStore(Builder.CreateLoad(OutCursor[NumLevels - 1]),
+                          Builder.CreateStructGEP(RowP, 1));
+    }
+
+    llvm::SmallVector<llvm::Value*, 5> ExpandedArgs;
+    ExpandedArgs.push_back(RowP);
+    ExpandedArgs.push_back(X1);
+    ExpandedArgs.push_back(X2);
+    ExpandedArgs.push_back(InStep);
+    ExpandedArgs.push_back(OutStep);
+
+    Builder.CreateCall(ExpandedFunc, ExpandedArgs);
+
+    // Advance the cursor of each loop at the end of its body, i.e., after the
+    // row (for the innermost one) or right after the loop it encloses.
+    for (unsigned L = NumLevels; L-- > 0; ) {
+      if (L + 1 < NumLevels) {
+        Builder.SetInsertPoint(Exits[L + 1]->begin());
+      }
+      if (HasIn) {
+        advanceCursor(Builder, InCursor[L], InStride[L]);
+      }
+      if (HasOut) {
+        advanceCursor(Builder, OutCursor[L], OutStride[L]);
+      }
+    }
+  }
+
+  /// @brief Returns true if T is a scalar or a small vector type.
+  static bool isWidenableType(llvm::Type *T) {
+    if (T->isVectorTy()) {
+      return (T->getVectorNumElements() <= 4);
+    }
+    return (T->isIntegerTy() || T->isFloatingPointTy());
+  }
+
+  /// @brief Get the number of kernel invocations per iteration of the widened
+  ///        inner loop.
+  ///
+  /// Returns 1 if the loop should not be widened. This is the case unless the
+  /// kernel is inlinable, the step values are known at compile time and the
+  /// in/out element types are scalars or small vectors.
+  unsigned getWidenFactor(llvm::DataLayout *DL, const KernelCallInfo &Info) {
+    if (mVectorWidth == 0) {
+      return 1;
+    }
+
+    llvm::Function *F = Info.Kernel;
+    if (F->isDeclaration() || F->hasFnAttribute(llvm::Attribute::NoInline)) {
+      return 1;
+    }
+
+    uint64_t MaxElementSize = 0;
+    llvm::Type *Tys[] = { Info.InTy, Info.OutTy };
+    llvm::Value *Steps[] = { Info.InStep, Info.OutStep };
+    for (unsigned i = 0; i < 2; i++) {
+      if (Tys[i] == NULL) {
+        continue;
+      }
+      if (!llvm::isa<llvm::ConstantInt>(Steps[i])) {
+        return 1;
+      }
+      llvm::Type *ET = llvm::cast<llvm::PointerType>(Tys[i])->getElementType();
+      if (!isWidenableType(ET)) {
+        return 1;
+      }
+      uint64_t ETSize = DL->getTypeAllocSize(ET);
+      if (ETSize > MaxElementSize) {
+        MaxElementSize = ETSize;
+      }
+    }
+
+    if (MaxElementSize == 0) {
+      return 1;
+    }
+
+    // Keep the widened body reasonably small for byte-sized elements.
+    static const unsigned MaxWidenFactor = 8;
+    unsigned Factor = mVectorWidth / MaxElementSize;
+    if (Factor > MaxWidenFactor) {
+      Factor = MaxWidenFactor;
+    }
+
+    // The widened loop steps by Factor, which we round down to a power of two
+    // so that the trip count can be computed with a simple mask.
+    while (Factor & (Factor - 1)) {
+      Factor &= (Factor - 1);
+    }
+
+    return (Factor < 2) ? 1 : Factor;
+  }
+
+  /// @brief Attach the loop ID metadata to the loop whose induction variable
+  ///        is IV (as created by createLoop()).
+  ///
+  /// The ID marks the loop as an expanded ForEach loop for the loop
+  /// vectorizer scheduled after LTO (see RSCompiler::afterAddLTOPasses()). If
+  /// Vectorize is false, it also tells the vectorizer to leave the loop alone.
+  void markForEachLoop(llvm::PHINode *IV, bool Vectorize) {
+    llvm::SmallVector<llvm::Value*, 2> Ops;
+
+    // The first operand of a loop ID is the ID itself.
+    llvm::MDNode *Temp =
+        llvm::MDNode::getTemporary(*C, llvm::ArrayRef<llvm::Value*>());
+    Ops.push_back(Temp);
+
+    if (!Vectorize) {
+      llvm::Value *WidthHint[] = {
+        llvm::MDString::get(*C, "llvm.vectorizer.width"),
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(*C), 1)
+      };
+      Ops.push_back(llvm::MDNode::get(*C, WidthHint));
+    }
+
+    llvm::MDNode *LoopID = llvm::MDNode::get(*C, Ops);
+    LoopID->replaceOperandWith(0, LoopID);
+    llvm::MDNode::deleteTemporary(Temp);
+
+    // The latch is the header of the single-block loop.
+    IV->getParent()->getTerminator()->setMetadata("llvm.loop", LoopID);
+  }
+
+  /// @brief Returns whether the loops of the kernel F must be left scalar.
+  bool isPreciseFP(const llvm::Function *F) const {
+    return mPreciseFP && !mRelaxedKernels.count(F->getName());
+  }
+
+  /// @brief Emit a prefetch of the input cell mPrefetchDistance bytes ahead
+  ///        of the cell IV.
+  ///
+  /// The distance is rounded up to a whole number of cells of Step bytes.
+  /// Nothing is emitted unless the step is known at compile time (see
+  /// getStepValue()); a prefetch never faults, so it may run past the end of
+  /// the allocation.
+  void emitPrefetch(llvm::IRBuilder<> &Builder, llvm::Value *BasePtr,
+                    llvm::Value *X1, llvm::Value *Step, llvm::Value *IV) {
+    llvm::ConstantInt *ConstStep = llvm::dyn_cast<llvm::ConstantInt>(Step);
+    if ((mPrefetchDistance == 0) || (BasePtr == NULL) || (ConstStep == NULL) ||
+        ConstStep->isZero()) {
+      return;
+    }
+
+    uint64_t StepSize = ConstStep->getZExtValue();
+    uint64_t Cells = (mPrefetchDistance + StepSize - 1) / StepSize;
+
+    llvm::Value *Offset = Builder.CreateSub(IV, X1);
+    Offset = Builder.CreateAdd(Offset, Builder.getInt32(Cells));
+    Offset = Builder.CreateMul(Offset, Step);
+    llvm::Value *Ptr = Builder.CreateGEP(BasePtr, Offset, "prefetch_ptr");
+
+    llvm::Value *Args[] = {
+      Builder.CreatePointerCast(Ptr, llvm::Type::getInt8PtrTy(*C)),
+      Builder.getInt32(0),  // read
+      Builder.getInt32(3),  // keep in all the levels of the cache
+      Builder.getInt32(1)   // data cache
+    };
+    llvm::Function *Prefetch =
+        llvm::Intrinsic::getDeclaration(M, llvm::Intrinsic::prefetch);
+    Builder.CreateCall(Prefetch, Args);
+  }
+
+  /// @brief Emit one call to a pass-by-value kernel for the cell IV.
+  void emitKernelCall(llvm::IRBuilder<> &Builder, const KernelCallInfo &Info,
+                      llvm::Value *IV) {
+    // Populate the actual call to kernel().
+    llvm::SmallVector<llvm::Value*, 8> RootArgs;
+
+    llvm::Value *InPtr = NULL;
+    llvm::Value *OutPtr = NULL;
+
+    // Calculate the current input and output pointers
+    //
+    // We always calculate the input/output pointers with a GEP operating on i8
+    // values and only cast at the very end to OutTy. This is because the step
+    // between two values is given in bytes.
+    //
+    // TODO: We could further optimize the output by using a GEP operation of
+    // type 'OutTy' in cases where the element type of the allocation allows.
+    if (Info.OutBasePtr) {
+      llvm::Value *OutOffset = Builder.CreateSub(IV, Info.X1);
+      OutOffset = Builder.CreateMul(OutOffset, Info.OutStep);
+      OutPtr = Builder.CreateGEP(Info.OutBasePtr, OutOffset);
+      OutPtr = Builder.CreatePointerCast(OutPtr, Info.OutTy);
+    }
+    if (Info.InBasePtr) {
+      llvm::Value *InOffset = Builder.CreateSub(IV, Info.X1);
+      InOffset = Builder.CreateMul(InOffset, Info.InStep);
+      InPtr = Builder.CreateGEP(Info.InBasePtr, InOffset);
+      InPtr = Builder.CreatePointerCast(InPtr, Info.InTy);
+    }
+
+    if (Info.PassOutByReference) {
+      RootArgs.push_back(OutPtr);
+    }
+
+    if (InPtr) {
+      llvm::LoadInst *In = Builder.CreateLoad(InPtr, "In");
+      In->setMetadata("tbaa", Info.TBAAIn);
+      RootArgs.push_back(In);
+    }
+
+    llvm::Value *X = IV;
+    if (bcinfo::MetadataExtractor::hasForEachSignatureX(Info.Signature)) {
+      RootArgs.push_back(X);
+    }
+
+    if (Info.Y) {
+      RootArgs.push_back(Info.Y);
+    }
+
+    llvm::Value *RetVal = Builder.CreateCall(Info.Kernel, RootArgs);
+
+    if (OutPtr && !Info.PassOutByReference) {
+      llvm::StoreInst *Store = Builder.CreateStore(RetVal, OutPtr);
+      Store->setMetadata("tbaa", Info.TBAAOut);
+    }
+  }
+
   /// @brief Create an empty loop
   ///
   /// Create a loop of the form:
   ///
-  /// for (i = LowerBound; i < UpperBound; i++)
+  /// for (i = LowerBound; i < UpperBound; i += Step)
   ///   ;
   ///
   /// After the loop has been created, the builder is set such that
@@ -235,11 +1253,14 @@ private:
   /// @param LowerBound The first value of the loop iterator
   /// @param UpperBound The maximal value of the loop iterator
   /// @param LoopIV A reference that will be set to the loop iterator.
+  /// @param Step The increment of the loop iterator. UpperBound - LowerBound
+  ///             must be a multiple of it.
   /// @return The BasicBlock that will be executed after the loop.
   llvm::BasicBlock *createLoop(llvm::IRBuilder<> &Builder,
                                llvm::Value *LowerBound,
                                llvm::Value *UpperBound,
-                               llvm::PHINode **LoopIV) {
+                               llvm::PHINode **LoopIV,
+                               unsigned Step = 1) {
     assert(LowerBound->getType() == UpperBound->getType());
 
     llvm::BasicBlock *CondBB, *AfterBB, *HeaderBB;
@@ -268,7 +1289,7 @@ private:
     Builder.SetInsertPoint(HeaderBB);
     IV = Builder.CreatePHI(LowerBound->getType(), 2, "X");
     IV->addIncoming(LowerBound, CondBB);
-    IVNext = Builder.CreateNUWAdd(IV, Builder.getInt32(1));
+    IVNext = Builder.CreateNUWAdd(IV, Builder.getInt32(Step));
     IV->addIncoming(IVNext, HeaderBB);
     Cond = Builder.CreateICmpULT(IVNext, UpperBound);
     Builder.CreateCondBr(Cond, HeaderBB, AfterBB);
@@ -280,14 +1301,26 @@ private:
 
 public:
   RSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                      bool pEnableStepOpt)
+                      const RSInfo::ExportReduceListTy &pReduces,
+                      bool pEnableStepOpt, unsigned pVectorWidth,
+                      bool pPreciseFP, bool pNoAliasInOut,
+                      unsigned pPrefetchDistance, unsigned pStreamBlockSize,
+                      const std::set<std::string> *pRelaxedKernels)
       : ModulePass(ID), M(NULL), C(NULL), mFuncs(pForeachFuncs),
-        mEnableStepOpt(pEnableStepOpt) {
+        mReduces(pReduces), mEnableStepOpt(pEnableStepOpt),
+        mVectorWidth(pVectorWidth), mPreciseFP(pPreciseFP),
+        mNoAliasInOut(pNoAliasInOut), mPrefetchDistance(pPrefetchDistance),
+        mStreamBlockSize(pStreamBlockSize) {
+    if (pRelaxedKernels != NULL) {
+      mRelaxedKernels = *pRelaxedKernels;
+    }
   }
 
   /* Performs the actual optimization on a selected function. On success, the
    * Module will contain a new function of the name "<NAME>.expand" that
-   * invokes <NAME>() in a loop with the appropriate parameters.
+   * invokes <NAME>() in a loop with the appropriate parameters, as well as
+   * its tiled entry point "<NAME>.expand.tiled", its volume and spans entry
+   * points and, if possible, its flat entry point "<NAME>.expand.flat".
    */
   bool ExpandFunction(llvm::Function *F, uint32_t Signature) {
     ALOGV("Expanding ForEach-able Function %s", F->getName().str().c_str());
@@ -341,7 +1374,7 @@ public:
       InTy = Args->getType();
       InStep = getStepValue(&DL, InTy, Arg_instep);
       InStep->setName("instep");
-      InBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0));
+      InBasePtr = loadInvariantParam(Builder, Arg_p, 0);
       Args++;
     }
 
@@ -351,15 +1384,15 @@ public:
       OutTy = Args->getType();
       OutStep = getStepValue(&DL, OutTy, Arg_outstep);
       OutStep->setName("outstep");
-      OutBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1));
+      OutBasePtr = loadInvariantParam(Builder, Arg_p, 1);
       Args++;
     }
 
     llvm::Value *UsrData = NULL;
     if (bcinfo::MetadataExtractor::hasForEachSignatureUsrData(Signature)) {
       llvm::Type *UsrDataTy = Args->getType();
-      UsrData = Builder.CreatePointerCast(Builder.CreateLoad(
-          Builder.CreateStructGEP(Arg_p, 2)), UsrDataTy);
+      UsrData = Builder.CreatePointerCast(
+          loadInvariantParam(Builder, Arg_p, 2), UsrDataTy);
       UsrData->setName("UsrData");
       Args++;
     }
@@ -370,7 +1403,7 @@ public:
 
     llvm::Value *Y = NULL;
     if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
-      Y = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 5), "Y");
+      Y = loadInvariantParam(Builder, Arg_p, 5, "Y");
       Args++;
     }
 
@@ -378,6 +1411,8 @@ public:
 
     llvm::PHINode *IV;
     createLoop(Builder, Arg_x1, Arg_x2, &IV);
+    markForEachLoop(IV, /* Vectorize */!isPreciseFP(F));
+    emitPrefetch(Builder, InBasePtr, Arg_x1, InStep, IV);
 
     // Populate the actual call to kernel().
     llvm::SmallVector<llvm::Value*, 8> RootArgs;
@@ -429,13 +1464,37 @@ public:
 
     Builder.CreateCall(F, RootArgs);
 
-    return true;
+    createFlatFunction(ExpandedFunc, Signature);
+
+    createVolumeFunction(ExpandedFunc, Signature);
+
+    createSpansFunction(ExpandedFunc, Signature);
+
+    // The out of root() may be read before it's written.
+    createStreamFunction(ExpandedFunc, Signature, /* StageOut */false);
+
+    return createTiledFunction(ExpandedFunc, Signature);
   }
 
   /* Expand a pass-by-value kernel.
+   *
+   * If IsReduction is true, F is the accumulator of a reduction: it takes
+   * the accumulator by reference in place of the output and returns void.
+   * Every cell of the range is then folded into the single accumulator at
+   * p->out (i.e., the out step is 0), which the runtime provides per thread
+   * and later merges with the combiner. The loop carries the accumulator, so
+   * it's neither widened nor vectorized.
    */
-  bool ExpandKernel(llvm::Function *F, uint32_t Signature) {
+  bool ExpandKernel(llvm::Function *F, uint32_t Signature,
+                    bool IsReduction = false) {
     bccAssert(bcinfo::MetadataExtractor::hasForEachSignatureKernel(Signature));
+    if (IsReduction &&
+        (!bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature) ||
+         !F->getReturnType()->isVoidTy())) {
+      ALOGE("Accumulator %s must take the accumulator by reference and return "
+            "void!", F->getName().str().c_str());
+      return false;
+    }
     ALOGV("Expanding kernel Function %s", F->getName().str().c_str());
 
     // TODO: Refactor this to share functionality with ExpandFunction.
@@ -470,12 +1529,19 @@ public:
     llvm::IRBuilder<> Builder(ExpandedFunc->getEntryBlock().begin());
 
     // Create TBAA meta-data.
-    llvm::MDNode *TBAARenderScript, *TBAAAllocation, *TBAAPointer;
+    llvm::MDNode *TBAARenderScript, *TBAAAllocation;
 
     llvm::MDBuilder MDHelper(*C);
     TBAARenderScript = MDHelper.createTBAARoot("RenderScript TBAA");
     TBAAAllocation = MDHelper.createTBAANode("allocation", TBAARenderScript);
-    TBAAPointer = MDHelper.createTBAANode("pointer", TBAARenderScript);
+
+    // Sibling nodes don't alias each other. Both still alias the other
+    // accesses to "allocation".
+    llvm::MDNode *TBAAIn = TBAAAllocation, *TBAAOut = TBAAAllocation;
+    if (mNoAliasInOut) {
+      TBAAIn = MDHelper.createTBAANode("allocation in", TBAAAllocation);
+      TBAAOut = MDHelper.createTBAANode("allocation out", TBAAAllocation);
+    }
 
     // Collect and construct the arguments for the kernel().
     // Note that we load any loop-invariant arguments before entering the Loop.
@@ -494,10 +1560,13 @@ public:
         OutTy = OutBaseTy->getPointerTo();
         // We don't increment Args, since we are using the actual return type.
       }
-      OutStep = getStepValue(&DL, OutTy, Arg_outstep);
-      OutStep->setName("outstep");
-      OutBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 1));
-      OutBasePtr->setMetadata("tbaa", TBAAPointer);
+      if (IsReduction) {
+        OutStep = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*C), 0);
+      } else {
+        OutStep = getStepValue(&DL, OutTy, Arg_outstep);
+        OutStep->setName("outstep");
+      }
+      OutBasePtr = loadInvariantParam(Builder, Arg_p, 1);
     }
 
     llvm::Type *InBaseTy = NULL;
@@ -508,8 +1577,7 @@ public:
       InTy =InBaseTy->getPointerTo();
       InStep = getStepValue(&DL, InTy, Arg_instep);
       InStep->setName("instep");
-      InBasePtr = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 0));
-      InBasePtr->setMetadata("tbaa", TBAAPointer);
+      InBasePtr = loadInvariantParam(Builder, Arg_p, 0);
       Args++;
     }
 
@@ -523,69 +1591,186 @@ public:
 
     llvm::Value *Y = NULL;
     if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
-      Y = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 5), "Y");
+      Y = loadInvariantParam(Builder, Arg_p, 5, "Y");
       Args++;
     }
 
     bccAssert(Args == F->arg_end());
 
+    KernelCallInfo Info;
+    Info.Kernel = F;
+    Info.Signature = Signature;
+    Info.X1 = Arg_x1;
+    Info.InTy = InTy;
+    Info.InBasePtr = InBasePtr;
+    Info.InStep = InStep;
+    Info.OutTy = OutTy;
+    Info.OutBasePtr = OutBasePtr;
+    Info.OutStep = OutStep;
+    Info.PassOutByReference = PassOutByReference;
+    Info.Y = Y;
+    Info.TBAAIn = TBAAIn;
+    Info.TBAAOut = TBAAOut;
+
+    // If possible, first run a widened loop which invokes the kernel on
+    // WidenFactor consecutive cells per iteration. The copies of the (inlined)
+    // kernel body are later combined into SIMD operations by the vectorizer.
+    // The remaining cells are handled by the scalar loop below.
+    llvm::Value *ScalarX1 = Arg_x1;
+    unsigned WidenFactor = IsReduction ? 1 : getWidenFactor(&DL, Info);
+    if (WidenFactor > 1) {
+      ALOGV("Widening the loop of %s by %u", F->getName().str().c_str(),
+            WidenFactor);
+      llvm::Value *Count = Builder.CreateSub(Arg_x2, Arg_x1);
+      Count = Builder.CreateAnd(Count, ~(WidenFactor - 1));
+      // An empty range (x2 <= x1) wraps Count around. Keep the scalar loop
+      // from starting below x1 then.
+      llvm::Value *WideX2 =
+          Builder.CreateSelect(Builder.CreateICmpULT(Arg_x1, Arg_x2),
+                               Builder.CreateAdd(Arg_x1, Count), Arg_x1,
+                               "wide_x2");
+
+      llvm::PHINode *WideIV;
+      llvm::BasicBlock *AfterWideLoop =
+          createLoop(Builder, Arg_x1, WideX2, &WideIV, WidenFactor);
+      // Its body is combined by the SLP vectorizer instead.
+      markForEachLoop(WideIV, /* Vectorize */false);
+      // One prefetch per iteration covers the WidenFactor cells.
+      emitPrefetch(Builder, InBasePtr, Arg_x1, InStep, WideIV);
+      for (unsigned i = 0; i < WidenFactor; i++) {
+        llvm::Value *CellIV = WideIV;
+        if (i != 0) {
+          CellIV = Builder.CreateNUWAdd(WideIV, Builder.getInt32(i));
+        }
+        emitKernelCall(Builder, Info, CellIV);
+      }
+
+      Builder.SetInsertPoint(AfterWideLoop->begin());
+      ScalarX1 = WideX2;
+    }
+
     llvm::PHINode *IV;
-    createLoop(Builder, Arg_x1, Arg_x2, &IV);
+    createLoop(Builder, ScalarX1, Arg_x2, &IV);
+    // The remainder of a widened loop is too short to be vectorized.
+    markForEachLoop(IV, /* Vectorize */(WidenFactor == 1) && !IsReduction &&
+                        !isPreciseFP(F));
+    // The remainder of a widened loop is too short to need it.
+    if (WidenFactor == 1) {
+      emitPrefetch(Builder, InBasePtr, Arg_x1, InStep, IV);
+    }
 
-    // Populate the actual call to kernel().
-    llvm::SmallVector<llvm::Value*, 8> RootArgs;
+    emitKernelCall(Builder, Info, IV);
 
-    llvm::Value *InPtr = NULL;
-    llvm::Value *OutPtr = NULL;
+    createFlatFunction(ExpandedFunc, Signature);
 
-    // Calculate the current input and output pointers
-    //
-    // We always calculate the input/output pointers with a GEP operating on i8
-    // values and only cast at the very end to OutTy. This is because the step
-    // between two values is given in bytes.
-    //
-    // TODO: We could further optimize the output by using a GEP operation of
-    // type 'OutTy' in cases where the element type of the allocation allows.
-    if (OutBasePtr) {
-      llvm::Value *OutOffset = Builder.CreateSub(IV, Arg_x1);
-      OutOffset = Builder.CreateMul(OutOffset, OutStep);
-      OutPtr = Builder.CreateGEP(OutBasePtr, OutOffset);
-      OutPtr = Builder.CreatePointerCast(OutPtr, OutTy);
-    }
-    if (InBasePtr) {
-      llvm::Value *InOffset = Builder.CreateSub(IV, Arg_x1);
-      InOffset = Builder.CreateMul(InOffset, InStep);
-      InPtr = Builder.CreateGEP(InBasePtr, InOffset);
-      InPtr = Builder.CreatePointerCast(InPtr, InTy);
-    }
+    createVolumeFunction(ExpandedFunc, Signature);
 
-    if (PassOutByReference) {
-      RootArgs.push_back(OutPtr);
-    }
+    createSpansFunction(ExpandedFunc, Signature);
 
-    if (InPtr) {
-      llvm::LoadInst *In = Builder.CreateLoad(InPtr, "In");
-      In->setMetadata("tbaa", TBAAAllocation);
-      RootArgs.push_back(In);
+    createStreamFunction(ExpandedFunc, Signature,
+                         /* StageOut */!IsReduction);
+
+    return createTiledFunction(ExpandedFunc, Signature);
+  }
+
+  /// @brief Build the body of the fused kernel Name (see
+  ///        RSInfo::FusedForeachSeparator).
+  ///
+  /// The fused kernel takes the input of the first kernel of the chain (and x
+  /// and/or y as in Signature) and returns the output of the last one. It
+  /// calls the kernels in order, so once they are inlined the intermediate
+  /// values stay in registers rather than round-tripping through an
+  /// allocation. Returns NULL if the kernels can't be chained.
+  llvm::Function *createFusedKernel(llvm::StringRef Name, uint32_t Signature) {
+    llvm::SmallVector<llvm::StringRef, 4> StageNames;
+    Name.split(StageNames, RSInfo::FusedForeachSeparator);
+
+    llvm::SmallVector<llvm::Function*, 4> Stages;
+    llvm::SmallVector<uint32_t, 4> StageSignatures;
+    llvm::Type *ValTy = NULL;
+    for (unsigned i = 0, e = StageNames.size(); i != e; i++) {
+      llvm::Function *F = M->getFunction(StageNames[i]);
+      uint32_t StageSignature = 0;
+      for (RSInfo::ExportForeachFuncListTy::const_iterator
+               func_iter = mFuncs.begin(), func_end = mFuncs.end();
+           func_iter != func_end; func_iter++) {
+        if (StageNames[i] == func_iter->first) {
+          StageSignature = func_iter->second;
+          break;
+        }
+      }
+
+      unsigned NumArgs = 1;
+      if (bcinfo::MetadataExtractor::hasForEachSignatureX(StageSignature)) {
+        NumArgs++;
+      }
+      if (bcinfo::MetadataExtractor::hasForEachSignatureY(StageSignature)) {
+        NumArgs++;
+      }
+
+      // Each kernel takes the result of the previous one.
+      if ((F == NULL) || F->isDeclaration() ||
+          (F->arg_size() != NumArgs) || F->getReturnType()->isVoidTy() ||
+          ((ValTy != NULL) && (F->arg_begin()->getType() != ValTy))) {
+        ALOGE("Unable to fuse %s into %s!", StageNames[i].str().c_str(),
+              Name.str().c_str());
+        return NULL;
+      }
+
+      Stages.push_back(F);
+      StageSignatures.push_back(StageSignature);
+      ValTy = F->getReturnType();
     }
 
-    llvm::Value *X = IV;
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    llvm::SmallVector<llvm::Type*, 3> ParamTys;
+    ParamTys.push_back(Stages[0]->arg_begin()->getType());
     if (bcinfo::MetadataExtractor::hasForEachSignatureX(Signature)) {
-      RootArgs.push_back(X);
+      ParamTys.push_back(Int32Ty);
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
+      ParamTys.push_back(Int32Ty);
     }
 
-    if (Y) {
-      RootArgs.push_back(Y);
+    llvm::FunctionType *FT = llvm::FunctionType::get(ValTy, ParamTys, false);
+    llvm::Function *FusedFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage, Name, M);
+    FusedFunc->addFnAttr(llvm::Attribute::AlwaysInline);
+
+    llvm::Function::arg_iterator AI = FusedFunc->arg_begin();
+    llvm::Value *Val = AI;
+    AI->setName("in");
+    AI++;
+    llvm::Value *X = NULL, *Y = NULL;
+    if (bcinfo::MetadataExtractor::hasForEachSignatureX(Signature)) {
+      X = AI;
+      AI->setName("x");
+      AI++;
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
+      Y = AI;
+      AI->setName("y");
+      AI++;
     }
 
-    llvm::Value *RetVal = Builder.CreateCall(F, RootArgs);
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", FusedFunc);
+    llvm::IRBuilder<> Builder(Begin);
 
-    if (OutPtr && !PassOutByReference) {
-      llvm::StoreInst *Store = Builder.CreateStore(RetVal, OutPtr);
-      Store->setMetadata("tbaa", TBAAAllocation);
+    for (unsigned i = 0, e = Stages.size(); i != e; i++) {
+      llvm::SmallVector<llvm::Value*, 3> Args;
+      Args.push_back(Val);
+      if (bcinfo::MetadataExtractor::hasForEachSignatureX(StageSignatures[i])) {
+        Args.push_back(X);
+      }
+      if (bcinfo::MetadataExtractor::hasForEachSignatureY(StageSignatures[i])) {
+        Args.push_back(Y);
+      }
+      Val = Builder.CreateCall(Stages[i], Args);
     }
 
-    return true;
+    Builder.CreateRet(Val);
+
+    return FusedFunc;
   }
 
   /// @brief Checks if pointers to allocation internals are exposed
@@ -637,9 +1822,10 @@ public:
          FI != FE; ++FI) {
       llvm::Function *F = M.getFunction(*FI);
 
+      // The run-time library is linked lazily, so functions never called by
+      // the script are not in the module.
       if (!F) {
-        ALOGE("Missing run-time function '%s'", FI->c_str());
-        return true;
+        continue;
       }
 
       if (F->getNumUses() > 0) {
@@ -669,6 +1855,118 @@ public:
     TBAARenderScript->replaceAllUsesWith(TBAAMergedRS);
   }
 
+  /// @brief Create the batched launch entry point of the module.
+  ///
+  /// This creates a function with the following signature:
+  ///
+  ///   void (const RsLaunchDesc *descs, uint32_t count)
+  ///
+  /// named RSInfo::LaunchBatchName, where
+  ///
+  ///   struct RsLaunchDesc {
+  ///     uint32_t slot;  // The index in RSInfo::getExportForeachFuncs().
+  ///     const RsForEachStubParamStruct *p;
+  ///     RsExpandVolume vol;
+  ///   };
+  ///
+  /// p->in and p->out point to the first cell of the launch like for the
+  /// volume entry point. The launches run in order, each through a switch on
+  /// its slot, so "<NAME>.expand.volume" is a direct call and a graph of
+  /// small launches costs the runtime a single indirect call. A descriptor
+  /// whose slot has no volume function is skipped. Nothing is created if the
+  /// module has no volume function.
+  void createLaunchBatchFunction() {
+    llvm::SmallVector<std::pair<unsigned, llvm::Function*>, 8> Slots;
+    unsigned Slot = 0;
+    for (RSInfo::ExportForeachFuncListTy::const_iterator
+             func_iter = mFuncs.begin(), func_end = mFuncs.end();
+         func_iter != func_end; func_iter++, Slot++) {
+      std::string Name(func_iter->first);
+      Name.append(RSInfo::ExportForeachSuffixes[RSInfo::kForeachExpandVolume]);
+      llvm::Function *VolumeFunc = M->getFunction(Name);
+      if (VolumeFunc != NULL) {
+        Slots.push_back(std::make_pair(Slot, VolumeFunc));
+      }
+    }
+    if (Slots.empty()) {
+      return;
+    }
+
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
+
+    // Each volume function has its own copy of the parameter structure type,
+    // so the descriptor holds p as a void * cast for each call.
+    llvm::SmallVector<llvm::Type*, 3> DescTys;
+    DescTys.push_back(Int32Ty);                // uint32_t slot
+    DescTys.push_back(VoidPtrTy);              // p
+    DescTys.push_back(getForeachVolumeTy());   // RsExpandVolume vol
+    llvm::Type *DescTy = llvm::StructType::create(DescTys, "RsLaunchDesc");
+
+    llvm::SmallVector<llvm::Type*, 2> ParamTys;
+    ParamTys.push_back(DescTy->getPointerTo());
+    ParamTys.push_back(Int32Ty);
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *BatchFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               RSInfo::LaunchBatchName, M);
+
+    llvm::Function::arg_iterator AI = BatchFunc->arg_begin();
+    llvm::Value *Arg_descs = AI;
+    AI->setName("descs");
+    AI++;
+    llvm::Value *Arg_count = AI;
+    AI->setName("count");
+    AI++;
+
+    assert(AI == BatchFunc->arg_end());
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", BatchFunc);
+    llvm::ReturnInst::Create(*C, Begin);
+
+    llvm::IRBuilder<> Builder(BatchFunc->getEntryBlock().begin());
+
+    llvm::PHINode *IV;
+    createLoop(Builder, Builder.getInt32(0), Arg_count, &IV);
+    IV->setName("I");
+
+    llvm::Value *Desc = Builder.CreateGEP(Arg_descs, IV, "desc");
+    llvm::Value *SlotVal =
+        Builder.CreateLoad(Builder.CreateStructGEP(Desc, 0), "slot");
+    llvm::Value *P = Builder.CreateLoad(Builder.CreateStructGEP(Desc, 1), "p");
+    llvm::Value *Vol = Builder.CreateStructGEP(Desc, 2, "vol");
+
+    // Every launch block joins the rest of the loop body.
+    llvm::BasicBlock *DispatchBB = Builder.GetInsertBlock();
+    llvm::BasicBlock *NextBB =
+        llvm::SplitBlock(DispatchBB, Builder.GetInsertPoint(), this);
+    DispatchBB->getTerminator()->eraseFromParent();
+    Builder.SetInsertPoint(DispatchBB);
+    llvm::SwitchInst *Switch =
+        Builder.CreateSwitch(SlotVal, NextBB, Slots.size());
+
+    for (unsigned i = 0, e = Slots.size(); i != e; i++) {
+      llvm::Function *VolumeFunc = Slots[i].second;
+      llvm::FunctionType *VolumeFT = VolumeFunc->getFunctionType();
+
+      llvm::BasicBlock *LaunchBB =
+          llvm::BasicBlock::Create(*C, "Launch", BatchFunc, NextBB);
+      Builder.SetInsertPoint(LaunchBB);
+
+      llvm::SmallVector<llvm::Value*, 2> VolumeArgs;
+      VolumeArgs.push_back(
+          Builder.CreatePointerCast(P, VolumeFT->getParamType(0)));
+      VolumeArgs.push_back(
+          Builder.CreatePointerCast(Vol, VolumeFT->getParamType(1)));
+      Builder.CreateCall(VolumeFunc, VolumeArgs);
+      Builder.CreateBr(NextBB);
+
+      Switch->addCase(Builder.getInt32(Slots[i].first), LaunchBB);
+    }
+  }
+
   virtual bool runOnModule(llvm::Module &M) {
     bool Changed = false;
     this->M = &M;
@@ -682,6 +1980,10 @@ public:
       const char *name = func_iter->first;
       uint32_t signature = func_iter->second;
       llvm::Function *kernel = M.getFunction(name);
+      if ((kernel == NULL) &&
+          (::strstr(name, RSInfo::FusedForeachSeparator) != NULL)) {
+        kernel = createFusedKernel(name, signature);
+      }
       if (kernel) {
         if (bcinfo::MetadataExtractor::hasForEachSignatureKernel(signature)) {
           Changed |= ExpandKernel(kernel, signature);
@@ -697,6 +1999,19 @@ public:
       }
     }
 
+    for (RSInfo::ExportReduceListTy::const_iterator
+             reduce_iter = mReduces.begin(), reduce_end = mReduces.end();
+         reduce_iter != reduce_end; reduce_iter++) {
+      llvm::Function *accumulator = M.getFunction(reduce_iter->name);
+      if (accumulator) {
+        Changed |= ExpandKernel(accumulator, reduce_iter->signature,
+                                /* IsReduction */true);
+        accumulator->setLinkage(llvm::GlobalValue::InternalLinkage);
+      }
+    }
+
+    createLaunchBatchFunction();
+
     if (!AllocsExposed) {
       connectRenderScriptTBAAMetadata(M);
     }
@@ -718,8 +2033,16 @@ namespace bcc {
 
 llvm::ModulePass *
 createRSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                          bool pEnableStepOpt){
-  return new RSForEachExpandPass(pForeachFuncs, pEnableStepOpt);
+                          const RSInfo::ExportReduceListTy &pReduces,
+                          bool pEnableStepOpt, unsigned pVectorWidth,
+                          bool pPreciseFP, bool pNoAliasInOut,
+                          unsigned pPrefetchDistance,
+                          unsigned pStreamBlockSize,
+                          const std::set<std::string> *pRelaxedKernels) {
+  return new RSForEachExpandPass(pForeachFuncs, pReduces, pEnableStepOpt,
+                                 pVectorWidth, pPreciseFP, pNoAliasInOut,
+                                 pPrefetchDistance, pStreamBlockSize,
+                                 pRelaxedKernels);
 }
 
 } // end namespace bcc
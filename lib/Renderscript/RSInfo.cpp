@@ -25,12 +25,17 @@
 #include <new>
 #include <string>
 
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+
+#include "bcc/Support/CPUProfile.h"
 #include "bcc/Support/FileBase.h"
 #include "bcc/Support/Log.h"
 
 #ifdef HAVE_ANDROID_OS
 #include <cutils/properties.h>
 #endif
+#include <utils/FileMap.h>
 
 using namespace bcc;
 
@@ -38,6 +43,25 @@ const char RSInfo::LibBCCPath[] = "/system/lib/libbcc.so";
 const char RSInfo::LibCompilerRTPath[] = "/system/lib/libcompiler_rt.so";
 const char RSInfo::LibRSPath[] = "/system/lib/libRS.so";
 const char RSInfo::LibCLCorePath[] = "/system/lib/libclcore.bc";
+
+const char *const RSInfo::ExportForeachSuffixes[kNumForeachVariants] = {
+  ".expand",        // kForeachExpand
+  ".expand.tiled",  // kForeachExpandTiled
+  ".expand.flat",   // kForeachExpandFlat
+  ".expand.volume", // kForeachExpandVolume
+  ".expand.spans",  // kForeachExpandSpans
+  ".expand.stream", // kForeachExpandStream
+};
+const char RSInfo::FusedForeachSeparator[] = "+";
+
+const char RSInfo::LaunchBatchName[] = ".rs.launch_batch";
+
+const char RSInfo::ExportVarBlockName[] = ".rs.export_var_block";
+
+const char RSInfo::KernelCountersName[] = ".rs.kernel_counters";
+const char RSInfo::KernelClockName[] = ".rs.kernel_clock";
+
+const char RSInfo::BitcodeDependencyName[] = "<bitcode>";
 const char RSInfo::LibCLCoreDebugPath[] = "/system/lib/libclcore_debug.bc";
 #if defined(ARCH_X86_HAVE_SSE2)
 const char RSInfo::LibCLCoreX86Path[] = "/system/lib/libclcore_x86.bc";
@@ -55,8 +79,23 @@ const uint8_t *RSInfo::LibCLCoreDebugSHA1 = NULL;
 const uint8_t *RSInfo::LibCLCoreNEONSHA1 = NULL;
 #endif
 
+uint8_t RSInfo::BuiltInDigest[SHA1_DIGEST_LENGTH];
+
+namespace {
+
+llvm::sys::Mutex gBuiltInDigestLock;
+bool gBuiltInDigestComputed = false;
+bool gHasBuiltInDigest = false;
+
+// Serializes LoadBuiltInSHA1Information(). The caches may be loaded from
+// several threads at once.
+llvm::sys::Mutex gBuiltInSHA1Lock;
+
+} // end anonymous namespace
+
 bool RSInfo::LoadBuiltInSHA1Information() {
 #ifdef TARGET_BUILD
+  llvm::MutexGuard locked(gBuiltInSHA1Lock);
   if (LibBCCSHA1 != NULL) {
     // Loaded before.
     return true;
@@ -88,6 +127,73 @@ bool RSInfo::LoadBuiltInSHA1Information() {
 #endif  // TARGET_BUILD
 }
 
+bool RSInfo::ComputeBuiltInDigest(uint8_t pResult[SHA1_DIGEST_LENGTH]) {
+#ifdef TARGET_BUILD
+  if (!LoadBuiltInSHA1Information()) {
+    return false;
+  }
+
+  const uint8_t *digests[] = {
+    LibBCCSHA1,
+    LibCompilerRTSHA1,
+    LibRSSHA1,
+    LibCLCoreSHA1,
+    LibCLCoreDebugSHA1,
+#if defined(ARCH_ARM_HAVE_NEON)
+    LibCLCoreNEONSHA1,
+#endif
+  };
+  static const unsigned NumDigests = sizeof(digests) / sizeof(digests[0]);
+
+  uint8_t buffer[NumDigests * SHA1_DIGEST_LENGTH];
+  for (unsigned i = 0; i < NumDigests; i++) {
+    if (digests[i] == NULL) {
+      ALOGE("Missing SHA-1 of a built-in dependency (#%u)!", i);
+      return false;
+    }
+    ::memcpy(buffer + i * SHA1_DIGEST_LENGTH, digests[i], SHA1_DIGEST_LENGTH);
+  }
+
+  // The objects are tuned for the CPU they were compiled on (see the
+  // CompilerConfigs of the targets.) Another profile has to recompile them.
+  std::string profile = CPUProfile::GetHost().getDescription();
+
+  Sha1Util::Context context;
+  context.update(buffer, sizeof(buffer));
+  context.update(profile.c_str(), profile.size());
+  context.finalize(pResult);
+  return true;
+#elif !defined(_WIN32)
+  // There's no libbcc.sha1.so on the host. Hash the image (libbcc.so or the
+  // tool statically linked with it) which contains this function instead.
+  Dl_info image;
+  if ((::dladdr(reinterpret_cast<void *>(&RSInfo::ComputeBuiltInDigest),
+                &image) == 0) || (image.dli_fname == NULL)) {
+    ALOGE("Unable to locate the image of libbcc!");
+    return false;
+  }
+  return Sha1Util::GetSHA1DigestFromFile(pResult, image.dli_fname);
+#else
+  return false;
+#endif
+}
+
+const uint8_t *RSInfo::GetBuiltInDigest() {
+  llvm::MutexGuard locked(gBuiltInDigestLock);
+  if (!gBuiltInDigestComputed) {
+    gHasBuiltInDigest = ComputeBuiltInDigest(BuiltInDigest);
+    gBuiltInDigestComputed = true;
+  }
+  return ((gHasBuiltInDigest) ? BuiltInDigest : NULL);
+}
+
+void RSInfo::SetBuiltInDigest(const uint8_t pDigest[SHA1_DIGEST_LENGTH]) {
+  llvm::MutexGuard locked(gBuiltInDigestLock);
+  ::memcpy(BuiltInDigest, pDigest, SHA1_DIGEST_LENGTH);
+  gHasBuiltInDigest = true;
+  gBuiltInDigestComputed = true;
+}
+
 android::String8 RSInfo::GetPath(const char *pFilename) {
   android::String8 result(pFilename);
   result.append(".info");
@@ -103,24 +209,24 @@ android::String8 RSInfo::GetPath(const char *pFilename) {
                    (X)[12], (X)[13], (X)[14], (X)[15], (X)[16], (X)[17],      \
                    (X)[18], (X)[19]);
 
-bool RSInfo::CheckDependency(const RSInfo &pInfo,
-                             const char *pInputFilename,
-                             const DependencyTableTy &pDeps) {
+RSInfo::ReadStatus RSInfo::ClassifyBuiltInChange(const RSInfo &pInfo,
+                                                 const char *pInputFilename) {
   // Built-in dependencies are libbcc.so, libRS.so and libclcore.bc plus
-  // libclcore_neon.bc if NEON is available on the target device.
+  // libclcore_neon.bc if NEON is available on the target device. They're only
+  // recorded on the target.
 #if !defined(ARCH_ARM_HAVE_NEON)
   static const unsigned NumBuiltInDependencies = 5;
 #else
   static const unsigned NumBuiltInDependencies = 6;
 #endif
 
-  LoadBuiltInSHA1Information();
-
-  if (pInfo.mDependencyTable.size() != (pDeps.size() + NumBuiltInDependencies)) {
-    ALOGD("Number of dependencies recorded mismatch (%lu v.s. %lu) in %s!",
-          static_cast<unsigned long>(pInfo.mDependencyTable.size()),
-          static_cast<unsigned long>(pDeps.size()), pInputFilename);
-    return false;
+  if (!LoadBuiltInSHA1Information() ||
+      (pInfo.mDependencyTable.size() < NumBuiltInDependencies)) {
+    // Nothing to tell which built-in has changed. On the host, the digest
+    // covers the image containing libbcc.
+    ALOGD("Cache %s is dirty due to %s has been updated.", pInputFilename,
+          LibBCCPath);
+    return kReadLibBCCChanged;
   } else {
     // Built-in dependencies always go first.
     const std::pair<const char *, const uint8_t *> &cache_libbcc_dep =
@@ -145,7 +251,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibBCCPath, LibBCCSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libbcc_dep.first,
                                      cache_libbcc_dep.second);
-        return false;
+        return kReadLibBCCChanged;
     }
 
     // Check libcompiler_rt.so.
@@ -156,7 +262,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibCompilerRTPath, LibCompilerRTSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libcompiler_rt_dep.first,
                                      cache_libcompiler_rt_dep.second);
-        return false;
+        return kReadLibCompilerRTChanged;
     }
 
     // Check libRS.so.
@@ -166,7 +272,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibRSPath, LibRSSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libRS_dep.first,
                                      cache_libRS_dep.second);
-        return false;
+        return kReadLibRSChanged;
     }
 
     // Check libclcore.bc.
@@ -177,7 +283,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibCLCorePath, LibCLCoreSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libclcore_dep.first,
                                      cache_libclcore_dep.second);
-        return false;
+        return kReadLibCLCoreChanged;
     }
 
     // Check libclcore_debug.bc.
@@ -188,7 +294,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibCLCoreDebugPath, LibCLCoreDebugSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libclcore_debug_dep.first,
                                      cache_libclcore_debug_dep.second);
-        return false;
+        return kReadLibCLCoreChanged;
     }
 
 #if defined(ARCH_ARM_HAVE_NEON)
@@ -200,30 +306,81 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
         PRINT_DEPENDENCY("current - ", LibCLCoreNEONPath, LibCLCoreNEONSHA1);
         PRINT_DEPENDENCY("cache - ", cache_libclcore_neon_dep.first,
                                      cache_libclcore_neon_dep.second);
-        return false;
+        return kReadLibCLCoreChanged;
     }
 #endif
 
-    for (unsigned i = 0; i < pDeps.size(); i++) {
-      const std::pair<const char *, const uint8_t *> &cache_dep =
-          pInfo.mDependencyTable[i + NumBuiltInDependencies];
-
-      if ((::strcmp(pDeps[i].first, cache_dep.first) != 0) ||
-          (::memcmp(pDeps[i].second, cache_dep.second,
-                    SHA1_DIGEST_LENGTH) != 0)) {
-        ALOGD("Cache %s is dirty due to the source it dependends on has been "
-              "changed:", pInputFilename);
-        PRINT_DEPENDENCY("given - ", pDeps[i].first, pDeps[i].second);
-        PRINT_DEPENDENCY("cache - ", cache_dep.first, cache_dep.second);
-        return false;
-      }
+  }
+
+  // The digest differs but the recorded SHA-1s don't (e.g., the set of
+  // built-ins has changed.)
+  ALOGD("Cache %s is dirty due to the built-in dependencies have been updated.",
+        pInputFilename);
+  return kReadLibBCCChanged;
+}
+
+RSInfo::ReadStatus RSInfo::CheckDependency(const RSInfo &pInfo,
+                                           const char *pInputFilename,
+                                           const DependencyTableTy &pDeps) {
+  // All the built-in dependencies are covered by a single digest.
+  const uint8_t *builtin_digest = GetBuiltInDigest();
+  if ((builtin_digest == NULL) ||
+      (::memcmp(pInfo.mHeader.builtInDigest, builtin_digest,
+                SHA1_DIGEST_LENGTH) != 0)) {
+    return ClassifyBuiltInChange(pInfo, pInputFilename);
+  }
+
+  // Dependencies given by the caller go after the built-in ones.
+  if (pInfo.mDependencyTable.size() < pDeps.size()) {
+    ALOGD("Number of dependencies recorded mismatch (%lu v.s. %lu) in %s!",
+          static_cast<unsigned long>(pInfo.mDependencyTable.size()),
+          static_cast<unsigned long>(pDeps.size()), pInputFilename);
+    return kReadSourceChanged;
+  }
+
+  const unsigned first_dep = pInfo.mDependencyTable.size() - pDeps.size();
+  for (unsigned i = 0; i < pDeps.size(); i++) {
+    const std::pair<const char *, const uint8_t *> &cache_dep =
+        pInfo.mDependencyTable[i + first_dep];
+
+    if ((::strcmp(pDeps[i].first, cache_dep.first) != 0) ||
+        (::memcmp(pDeps[i].second, cache_dep.second,
+                  SHA1_DIGEST_LENGTH) != 0)) {
+      ALOGD("Cache %s is dirty due to the source it dependends on has been "
+            "changed:", pInputFilename);
+      PRINT_DEPENDENCY("given - ", pDeps[i].first, pDeps[i].second);
+      PRINT_DEPENDENCY("cache - ", cache_dep.first, cache_dep.second);
+      return kReadSourceChanged;
     }
   }
 
-  return true;
+  return kReadOK;
+}
+
+namespace {
+
+// Alignment of each list in the arena of RSInfo.
+const size_t ArenaAlignment = 8;
+
+inline size_t AlignArenaOffset(size_t pOffset) {
+  return ((pOffset + ArenaAlignment - 1) & ~(ArenaAlignment - 1));
 }
 
-RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL) {
+// Reserve pCapacity items of pList at *pOffset of pArena (or just advance
+// *pOffset if pArena is NULL.)
+template<typename ItemType>
+void ReserveArenaList(rsinfo::ArenaList<ItemType> &pList, size_t pCapacity,
+                      char *pArena, size_t *pOffset) {
+  if (pArena != NULL) {
+    pList.reset(reinterpret_cast<ItemType *>(pArena + *pOffset), pCapacity);
+  }
+  *pOffset = AlignArenaOffset(*pOffset + pCapacity * sizeof(ItemType));
+}
+
+} // end anonymous namespace
+
+RSInfo::RSInfo(size_t pStringPoolSize, const ListCapacities &pCapacities)
+  : mArena(NULL), mStringPool(NULL), mView(NULL) {
   ::memset(&mHeader, 0, sizeof(mHeader));
 
   ::memcpy(mHeader.magic, RSINFO_MAGIC, sizeof(mHeader.magic));
@@ -237,42 +394,210 @@ RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL) {
   mHeader.exportVarNameList.itemSize = sizeof(rsinfo::ExportVarNameItem);
   mHeader.exportFuncNameList.itemSize = sizeof(rsinfo::ExportFuncNameItem);
   mHeader.exportForeachFuncList.itemSize = sizeof(rsinfo::ExportForeachFuncItem);
+  mHeader.exportReduceList.itemSize = sizeof(rsinfo::ExportReduceItem);
+  mHeader.exportSymbolList.itemSize = sizeof(rsinfo::ExportSymbolItem);
+  mHeader.exportForeachCostList.itemSize =
+      sizeof(rsinfo::ExportForeachCostItem);
+  mHeader.exportVarLayoutList.itemSize = sizeof(rsinfo::ExportVarLayoutItem);
+  mHeader.objectSlotRangeList.itemSize = sizeof(rsinfo::ObjectSlotRangeItem);
+
+  const size_t num_foreach_variants = kNumForeachVariants;
+  size_t num_export_symbols =
+      pCapacities.exportVarNames + pCapacities.exportFuncNames +
+      num_foreach_variants * pCapacities.exportForeachFuncs +
+      (num_foreach_variants + 1) * pCapacities.exportReduces;
+  if (num_export_symbols < pCapacities.exportSymbols) {
+    num_export_symbols = pCapacities.exportSymbols;
+  }
+  size_t num_foreach_costs = pCapacities.exportForeachFuncs;
+  if (num_foreach_costs < pCapacities.exportForeachCosts) {
+    num_foreach_costs = pCapacities.exportForeachCosts;
+  }
+  size_t num_var_layouts = pCapacities.exportVarNames;
+  if (num_var_layouts < pCapacities.exportVarLayout) {
+    num_var_layouts = pCapacities.exportVarLayout;
+  }
+  // A run holds at least one slot.
+  size_t num_slot_ranges = pCapacities.objectSlots;
+  if (num_slot_ranges < pCapacities.objectSlotRanges) {
+    num_slot_ranges = pCapacities.objectSlotRanges;
+  }
 
-  if (pStringPoolSize > 0) {
-    mHeader.strPoolSize = pStringPoolSize;
-    mStringPool = new (std::nothrow) char [ mHeader.strPoolSize ];
-    if (mStringPool == NULL) {
-      ALOGE("Out of memory when allocate memory for string pool in RSInfo "
-            "constructor (size: %u)!", mHeader.strPoolSize);
+  // Lay out the lists and then the string pool in the arena. The first pass
+  // only computes the size.
+  size_t arena_size = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    size_t offset = 0;
+    ReserveArenaList(mPragmas, pCapacities.pragmas, mArena, &offset);
+    ReserveArenaList(mObjectSlots, pCapacities.objectSlots, mArena, &offset);
+    ReserveArenaList(mExportVarNames, pCapacities.exportVarNames, mArena,
+                     &offset);
+    ReserveArenaList(mExportFuncNames, pCapacities.exportFuncNames, mArena,
+                     &offset);
+    ReserveArenaList(mExportForeachFuncs, pCapacities.exportForeachFuncs,
+                     mArena, &offset);
+    ReserveArenaList(mExportReduces, pCapacities.exportReduces, mArena,
+                     &offset);
+    ReserveArenaList(mExportSymbols, num_export_symbols, mArena, &offset);
+    ReserveArenaList(mExportForeachCosts, num_foreach_costs, mArena, &offset);
+    ReserveArenaList(mExportVarLayout, num_var_layouts, mArena, &offset);
+    ReserveArenaList(mObjectSlotRanges, num_slot_ranges, mArena, &offset);
+
+    if (pass == 0) {
+      arena_size = offset + pStringPoolSize;
+      mArena = new (std::nothrow) char [ arena_size ];
+      if (mArena == NULL) {
+        ALOGE("Out of memory when allocate the arena in RSInfo constructor "
+              "(size: %lu)!", static_cast<unsigned long>(arena_size));
+        return;
+      }
+    } else if (pStringPoolSize > 0) {
+      mHeader.strPoolSize = pStringPoolSize;
+      mStringPool = mArena + offset;
+      // The pool is sized for the worst case. What's left unused is written
+      // out as zeros rather than whatever the heap had there.
+      ::memset(mStringPool, 0, pStringPoolSize);
     }
   }
 }
 
 RSInfo::~RSInfo() {
-  delete [] mStringPool;
+  if (mView != NULL) {
+    // mStringPool points into the mapping.
+    mView->release();
+  }
+  delete [] mArena;
 }
 
-bool RSInfo::layout(off_t initial_offset) {
-  mHeader.dependencyTable.offset = initial_offset +
-                                   mHeader.headerSize +
-                                   mHeader.strPoolSize;
-  mHeader.dependencyTable.count = mDependencyTable.size();
+RSInfo *RSInfo::clone() const {
+  ListCapacities capacities;
+  capacities.pragmas = mPragmas.size();
+  capacities.objectSlots = mObjectSlots.size();
+  capacities.exportVarNames = mExportVarNames.size();
+  capacities.exportFuncNames = mExportFuncNames.size();
+  capacities.exportForeachFuncs = mExportForeachFuncs.size();
+  capacities.exportReduces = mExportReduces.size();
+  capacities.exportSymbols = mExportSymbols.size();
+  capacities.exportForeachCosts = mExportForeachCosts.size();
+  capacities.exportVarLayout = mExportVarLayout.size();
+  capacities.objectSlotRanges = mObjectSlotRanges.size();
+
+  RSInfo *result = new (std::nothrow) RSInfo(mHeader.strPoolSize, capacities);
+  if (result == NULL) {
+    ALOGE("Out of memory when clone RSInfo!");
+    return NULL;
+  } else if (result->mArena == NULL) {
+    // RSInfo constructor has already logged the error.
+    delete result;
+    return NULL;
+  }
+
+  ::memcpy(&result->mHeader, &mHeader, sizeof(mHeader));
+  if (mHeader.strPoolSize > 0) {
+    ::memcpy(result->mStringPool, mStringPool, mHeader.strPoolSize);
+  }
+
+  // The strings in the lists point into the string pool. Make the ones of the
+  // clone point into its own copy.
+  const char *pool_begin = mStringPool;
+  const char *pool_end = mStringPool + mHeader.strPoolSize;
+#define REBASE(_ptr, _type) \
+  ((((_ptr) >= pool_begin) && ((_ptr) < pool_end)) ?                        \
+      reinterpret_cast<_type>(result->mStringPool + ((_ptr) - pool_begin)) : \
+      (_ptr))
+
+  for (DependencyTableTy::const_iterator dep_iter = mDependencyTable.begin(),
+          dep_end = mDependencyTable.end(); dep_iter != dep_end; dep_iter++) {
+    const char *sha1 = reinterpret_cast<const char *>(dep_iter->second);
+    result->mDependencyTable.push(
+        std::make_pair(REBASE(dep_iter->first, const char *),
+                       reinterpret_cast<const uint8_t *>(
+                            REBASE(sha1, const char *))));
+  }
+
+  for (PragmaListTy::const_iterator pragma_iter = mPragmas.begin(),
+        pragma_end = mPragmas.end(); pragma_iter != pragma_end; pragma_iter++) {
+    result->mPragmas.push(
+        std::make_pair(REBASE(pragma_iter->first, const char *),
+                       REBASE(pragma_iter->second, const char *)));
+  }
+
+  result->mObjectSlots.append(mObjectSlots);
+
+  for (ExportVarNameListTy::const_iterator var_iter = mExportVarNames.begin(),
+          var_end = mExportVarNames.end(); var_iter != var_end; var_iter++) {
+    result->mExportVarNames.push(REBASE(*var_iter, const char *));
+  }
+
+  for (ExportFuncNameListTy::const_iterator func_iter = mExportFuncNames.begin(),
+        func_end = mExportFuncNames.end(); func_iter != func_end; func_iter++) {
+    result->mExportFuncNames.push(REBASE(*func_iter, const char *));
+  }
+
+  for (ExportForeachFuncListTy::const_iterator
+          foreach_iter = mExportForeachFuncs.begin(),
+          foreach_end = mExportForeachFuncs.end(); foreach_iter != foreach_end;
+          foreach_iter++) {
+    result->mExportForeachFuncs.push(
+        std::make_pair(REBASE(foreach_iter->first, const char *),
+                       foreach_iter->second));
+  }
+
+  for (ExportReduceListTy::const_iterator
+          reduce_iter = mExportReduces.begin(),
+          reduce_end = mExportReduces.end(); reduce_iter != reduce_end;
+          reduce_iter++) {
+    ExportReduce reduce = *reduce_iter;
+    reduce.name = REBASE(reduce.name, const char *);
+    reduce.combiner = REBASE(reduce.combiner, const char *);
+    result->mExportReduces.push(reduce);
+  }
+#undef REBASE
+
+  result->mExportSymbols.append(mExportSymbols);
+  result->mExportForeachCosts.append(mExportForeachCosts);
+  result->mExportVarLayout.append(mExportVarLayout);
+  result->mObjectSlotRanges.append(mObjectSlotRanges);
+
+  return result;
+}
+
+bool RSInfo::layout(off_t initial_offset, rsinfo::Header &pHeader) const {
+  pHeader.dependencyTable.offset = initial_offset +
+                                   pHeader.headerSize +
+                                   pHeader.strPoolSize;
+  pHeader.dependencyTable.count = mDependencyTable.size();
 
 #define AFTER(_list) ((_list).offset + (_list).itemSize * (_list).count)
-  mHeader.pragmaList.offset = AFTER(mHeader.dependencyTable);
-  mHeader.pragmaList.count = mPragmas.size();
+  pHeader.pragmaList.offset = AFTER(pHeader.dependencyTable);
+  pHeader.pragmaList.count = mPragmas.size();
 
-  mHeader.objectSlotList.offset = AFTER(mHeader.pragmaList);
-  mHeader.objectSlotList.count = mObjectSlots.size();
+  pHeader.objectSlotList.offset = AFTER(pHeader.pragmaList);
+  pHeader.objectSlotList.count = mObjectSlots.size();
 
-  mHeader.exportVarNameList.offset = AFTER(mHeader.objectSlotList);
-  mHeader.exportVarNameList.count = mExportVarNames.size();
+  pHeader.exportVarNameList.offset = AFTER(pHeader.objectSlotList);
+  pHeader.exportVarNameList.count = mExportVarNames.size();
 
-  mHeader.exportFuncNameList.offset = AFTER(mHeader.exportVarNameList);
-  mHeader.exportFuncNameList.count = mExportFuncNames.size();
+  pHeader.exportFuncNameList.offset = AFTER(pHeader.exportVarNameList);
+  pHeader.exportFuncNameList.count = mExportFuncNames.size();
 
-  mHeader.exportForeachFuncList.offset = AFTER(mHeader.exportFuncNameList);
-  mHeader.exportForeachFuncList.count = mExportForeachFuncs.size();
+  pHeader.exportForeachFuncList.offset = AFTER(pHeader.exportFuncNameList);
+  pHeader.exportForeachFuncList.count = mExportForeachFuncs.size();
+
+  pHeader.exportReduceList.offset = AFTER(pHeader.exportForeachFuncList);
+  pHeader.exportReduceList.count = mExportReduces.size();
+
+  pHeader.exportSymbolList.offset = AFTER(pHeader.exportReduceList);
+  pHeader.exportSymbolList.count = mExportSymbols.size();
+
+  pHeader.exportForeachCostList.offset = AFTER(pHeader.exportSymbolList);
+  pHeader.exportForeachCostList.count = mExportForeachCosts.size();
+
+  pHeader.exportVarLayoutList.offset = AFTER(pHeader.exportForeachCostList);
+  pHeader.exportVarLayoutList.count = mExportVarLayout.size();
+
+  pHeader.objectSlotRangeList.offset = AFTER(pHeader.exportVarLayoutList);
+  pHeader.objectSlotRangeList.count = mObjectSlotRanges.size();
 #undef AFTER
 
   return true;
@@ -332,12 +657,69 @@ void RSInfo::dump() const {
     ALOGV("name: %s, signature: %05x", foreach_iter->first,
                                        foreach_iter->second);
   }
+
+  DUMP_LIST_HEADER("RS reduce list", mHeader.exportReduceList);
+  for (ExportReduceListTy::const_iterator
+          reduce_iter = mExportReduces.begin(),
+          reduce_end = mExportReduces.end(); reduce_iter != reduce_end;
+          reduce_iter++) {
+    ALOGV("name: %s, combiner: %s, signature: %05x", reduce_iter->name,
+          reduce_iter->combiner, reduce_iter->signature);
+  }
+
+  DUMP_LIST_HEADER("RS export symbols", mHeader.exportSymbolList);
+  for (ExportSymbolListTy::const_iterator
+          symbol_iter = mExportSymbols.begin(),
+          symbol_end = mExportSymbols.end(); symbol_iter != symbol_end;
+          symbol_iter++) {
+    ALOGV("section: %u, offset: 0x%x", symbol_iter->first,
+                                         symbol_iter->second);
+  }
+
+  DUMP_LIST_HEADER("RS export foreach costs", mHeader.exportForeachCostList);
+  for (ExportForeachCostListTy::const_iterator
+          cost_iter = mExportForeachCosts.begin(),
+          cost_end = mExportForeachCosts.end(); cost_iter != cost_end;
+          cost_iter++) {
+    ALOGV("instructions: %u, memory ops: %u", cost_iter->first,
+                                              cost_iter->second);
+  }
+
+  DUMP_LIST_HEADER("RS export var layout", mHeader.exportVarLayoutList);
+  for (ExportVarLayoutListTy::const_iterator
+          layout_iter = mExportVarLayout.begin(),
+          layout_end = mExportVarLayout.end(); layout_iter != layout_end;
+          layout_iter++) {
+    ALOGV("offset: 0x%x, size: %u", layout_iter->first, layout_iter->second);
+  }
+
+  DUMP_LIST_HEADER("RS object slot ranges", mHeader.objectSlotRangeList);
+  for (ObjectSlotRangeListTy::const_iterator
+          range_iter = mObjectSlotRanges.begin(),
+          range_end = mObjectSlotRanges.end(); range_iter != range_end;
+          range_iter++) {
+    ALOGV("offset: 0x%x, size: %u", range_iter->first, range_iter->second);
+  }
 #undef DUMP_LIST_HEADER
 
 #endif // LOG_NDEBUG
   return;
 }
 
+size_t RSInfo::getExportVarBlockSize() const {
+  size_t size = 0;
+  for (ExportVarLayoutListTy::const_iterator
+          layout_iter = mExportVarLayout.begin(),
+          layout_end = mExportVarLayout.end(); layout_iter != layout_end;
+          layout_iter++) {
+    if ((layout_iter->first != rsinfo::gInvalidExportVarOffset) &&
+        ((layout_iter->first + layout_iter->second) > size)) {
+      size = layout_iter->first + layout_iter->second;
+    }
+  }
+  return size;
+}
+
 const char *RSInfo::getStringFromPool(rsinfo::StringIndexTy pStrIdx) const {
   // String pool uses direct indexing. Ensure that the pStrIdx is within the
   // range.
@@ -417,3 +799,35 @@ RSInfo::FloatPrecision RSInfo::getFloatPrecisionRequirement() const {
 
   return result;
 }
+
+void RSInfo::getRelaxedFPKernels(std::set<std::string> &pKernels) const {
+  pKernels.clear();
+
+  const char *list = getPragmaValue("rs_fp_relaxed_kernels");
+  if ((list == NULL) || (getFloatPrecisionRequirement() != FP_Full)) {
+    return;
+  }
+
+  // The names are separated by commas and/or spaces.
+  static const char separators[] = ", \t";
+  while (*list != '\0') {
+    size_t length = ::strcspn(list, separators);
+    if (length > 0) {
+      pKernels.insert(std::string(list, length));
+      list += length;
+    } else {
+      list++;
+    }
+  }
+}
+
+const char *RSInfo::getPragmaValue(const char *pKey) const {
+  for (PragmaListTy::const_iterator pragma_iter = mPragmas.begin(),
+           pragma_end = mPragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++) {
+    if (::strcmp(pragma_iter->first, pKey) == 0) {
+      return pragma_iter->second;
+    }
+  }
+  return NULL;
+}
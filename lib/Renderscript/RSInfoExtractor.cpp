@@ -19,6 +19,12 @@
 //===----------------------------------------------------------------------===//
 #include "bcc/Renderscript/RSInfo.h"
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
@@ -50,6 +56,19 @@ const llvm::StringRef export_foreach_name_metadata_name("#rs_export_foreach_name
 // Name of metadata node where exported ForEach signature information resides
 const llvm::StringRef export_foreach_metadata_name("#rs_export_foreach");
 
+// Name of metadata node where exported reductions reside. Each entry is
+// !{!"accumulator", !"combiner", !"signature"}.
+const llvm::StringRef export_reduce_metadata_name("#rs_export_reduce");
+
+// Name of metadata node where RSForEachCostPass leaves the estimated cost of
+// each foreach function (should be synced with RSForEachCost.cpp.)
+const llvm::StringRef foreach_cost_metadata_name("#rs_foreach_cost");
+
+// Name of metadata node where RSExportVarBlockPass leaves the offset and the
+// size of each export var in the block (should be synced with
+// RSExportVarBlock.cpp.)
+const llvm::StringRef export_var_layout_metadata_name("#rs_export_var_layout");
+
 // Name of metadata node where RS object slot info resides (should be
 const llvm::StringRef object_slot_metadata_name("#rs_object_slots");
 
@@ -60,6 +79,10 @@ inline llvm::StringRef getStringFromOperand(const llvm::Value *pString) {
   return llvm::StringRef();
 }
 
+inline size_t getNumOperands(const llvm::NamedMDNode *pMetadata) {
+  return ((pMetadata != NULL) ? pMetadata->getNumOperands() : 0);
+}
+
 template<size_t NumOperands>
 inline size_t getMetadataStringLength(const llvm::NamedMDNode *pMetadata) {
   if (pMetadata == NULL) {
@@ -105,6 +128,50 @@ const char *writeString(const llvm::StringRef &pString, char *pStringPool,
   return pStringWriteStart;
 }
 
+// Compute the name and the signature of the function fusing the chain of
+// kernels pChain (the value of "#pragma rs_fuse".) Only the first pNumFuncs
+// entries of pFuncs are looked up, so fused kernels don't chain further.
+// Return false if the chain is invalid.
+bool getFusedForeach(const RSInfo::ExportForeachFuncListTy &pFuncs,
+                     size_t pNumFuncs, llvm::StringRef pChain,
+                     std::string &pName, uint32_t &pSignature) {
+  llvm::SmallVector<llvm::StringRef, 4> stages;
+  pChain.split(stages, ",");
+  if (stages.size() < 2) {
+    return false;
+  }
+
+  pName.clear();
+  // in, out and kernel.
+  pSignature = 0x23;
+  for (unsigned i = 0, e = stages.size(); i != e; i++) {
+    llvm::StringRef stage = stages[i].trim();
+    size_t j = 0;
+    while ((j < pNumFuncs) && (stage != pFuncs[j].first)) {
+      j++;
+    }
+    if (j == pNumFuncs) {
+      return false;
+    }
+
+    // Each kernel has to take its input by value and return its output,
+    // without usrData.
+    uint32_t signature = pFuncs[j].second;
+    if ((signature & 0x27) != 0x23) {
+      return false;
+    }
+    // The fused function takes x and y if any of the kernels does.
+    pSignature |= (signature & 0x18);
+
+    if (!pName.empty()) {
+      pName += RSInfo::FusedForeachSeparator;
+    }
+    pName += stage;
+  }
+
+  return true;
+}
+
 bool writeDependency(const std::string &pSourceName, const uint8_t *pSHA1,
                      char *pStringPool, off_t *pWriteStart,
                      RSInfo::DependencyTableTy &pDepTable) {
@@ -141,6 +208,8 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
       module.getNamedMetadata(export_foreach_name_metadata_name);
   const llvm::NamedMDNode *export_foreach_signature =
       module.getNamedMetadata(export_foreach_metadata_name);
+  const llvm::NamedMDNode *export_reduce =
+      module.getNamedMetadata(export_reduce_metadata_name);
   const llvm::NamedMDNode *object_slots =
       module.getNamedMetadata(object_slot_metadata_name);
 
@@ -163,16 +232,36 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
   string_pool_size += getMetadataStringLength<1>(export_func);
   string_pool_size += getMetadataStringLength<1>(export_foreach_name);
 
+  // The names of the fused kernels (see "#pragma rs_fuse" below) are never
+  // longer than the value of their pragma.
+  size_t num_fused_foreach_funcs = 0;
+  if (pragma != NULL) {
+    for (unsigned i = 0, e = pragma->getNumOperands(); i != e; i++) {
+      llvm::MDNode *node = pragma->getOperand(i);
+      if ((node != NULL) && (node->getNumOperands() >= 2) &&
+          (getStringFromOperand(node->getOperand(0)) == "rs_fuse")) {
+        string_pool_size +=
+            getStringFromOperand(node->getOperand(1)).size() + 1;
+        num_fused_foreach_funcs++;
+      }
+    }
+  }
+  string_pool_size += getMetadataStringLength<2>(export_reduce);
+
   // Don't forget to reserve the space for the dependency informationin string
-  // pool.
-  string_pool_size += ::strlen(LibBCCPath) + 1 + SHA1_DIGEST_LENGTH;
-  string_pool_size += ::strlen(LibCompilerRTPath) + 1 + SHA1_DIGEST_LENGTH;
-  string_pool_size += ::strlen(LibRSPath) + 1 + SHA1_DIGEST_LENGTH;
-  string_pool_size += ::strlen(LibCLCorePath) + 1 + SHA1_DIGEST_LENGTH;
-  string_pool_size += ::strlen(LibCLCoreDebugPath) + 1 + SHA1_DIGEST_LENGTH;
+  // pool. The SHA-1s of the built-in dependencies are only available on the
+  // target.
+  const bool has_builtin_sha1 = LoadBuiltInSHA1Information();
+  if (has_builtin_sha1) {
+    string_pool_size += ::strlen(LibBCCPath) + 1 + SHA1_DIGEST_LENGTH;
+    string_pool_size += ::strlen(LibCompilerRTPath) + 1 + SHA1_DIGEST_LENGTH;
+    string_pool_size += ::strlen(LibRSPath) + 1 + SHA1_DIGEST_LENGTH;
+    string_pool_size += ::strlen(LibCLCorePath) + 1 + SHA1_DIGEST_LENGTH;
+    string_pool_size += ::strlen(LibCLCoreDebugPath) + 1 + SHA1_DIGEST_LENGTH;
 #if defined(ARCH_ARM_HAVE_NEON)
-  string_pool_size += ::strlen(LibCLCoreNEONPath) + 1 + SHA1_DIGEST_LENGTH;
+    string_pool_size += ::strlen(LibCLCoreNEONPath) + 1 + SHA1_DIGEST_LENGTH;
 #endif
+  }
   for (unsigned i = 0, e = pDeps.size(); i != e; i++) {
     // +1 for null-terminator
     string_pool_size += ::strlen(/* name */pDeps[i].first) + 1;
@@ -180,16 +269,32 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
     string_pool_size += SHA1_DIGEST_LENGTH;
   }
 
-  // Allocate result object
-  result = new (std::nothrow) RSInfo(string_pool_size);
+  // Allocate result object. Every list has room for all its metadata
+  // entries, so none of the push() below fails.
+  {
+    ListCapacities capacities;
+    capacities.pragmas = getNumOperands(pragma);
+    capacities.exportVarNames = getNumOperands(export_var);
+    capacities.exportFuncNames = getNumOperands(export_func);
+    // The legacy "root" or the functions of #rs_export_foreach_name, followed
+    // by the fused kernels.
+    capacities.exportForeachFuncs = getNumOperands(export_foreach_name) +
+                                    num_fused_foreach_funcs + 1;
+    capacities.exportReduces = getNumOperands(export_reduce);
+    if (object_slots != NULL) {
+      capacities.objectSlots = getNumOperands(export_var) + 1;
+    }
+
+    result = new (std::nothrow) RSInfo(string_pool_size, capacities);
+  }
   if (result == NULL) {
     ALOGE("Out of memory when create RSInfo object for %s!", module_name);
     goto bail;
   }
 
-  // Check string pool.
-  if (result->mStringPool == NULL) {
-    ALOGE("Out of memory when allocate string pool in RSInfo object for %s!",
+  // Check the arena.
+  if (result->mArena == NULL) {
+    ALOGE("Out of memory when allocate the arena in RSInfo object for %s!",
           module_name);
     goto bail;
   }
@@ -335,6 +440,72 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
                       &cur_string_pool_offset), 0x1f));
   }
 
+  //===--------------------------------------------------------------------===//
+  // #pragma rs_fuse
+  //===--------------------------------------------------------------------===//
+  // The fused kernels are appended to the foreach functions, so the slots of
+  // the others don't change. RSForEachExpandPass builds their bodies.
+  {
+    const size_t num_foreach_funcs = result->mExportForeachFuncs.size();
+    for (PragmaListTy::const_iterator pragma_iter = result->mPragmas.begin(),
+             pragma_end = result->mPragmas.end();
+         pragma_iter != pragma_end; pragma_iter++) {
+      if (::strcmp(pragma_iter->first, "rs_fuse") != 0) {
+        continue;
+      }
+
+      std::string fused_name;
+      uint32_t fused_signature;
+      if (!getFusedForeach(result->mExportForeachFuncs, num_foreach_funcs,
+                           pragma_iter->second, fused_name, fused_signature)) {
+        ALOGW("Invalid chain of kernels '%s' in #pragma rs_fuse of %s (skip)!",
+              pragma_iter->second, module_name);
+        continue;
+      }
+
+      result->mExportForeachFuncs.push(std::make_pair(
+            writeString(fused_name, result->mStringPool,
+                        &cur_string_pool_offset), fused_signature));
+    }
+  }
+
+  //===--------------------------------------------------------------------===//
+  // #rs_export_reduce
+  //===--------------------------------------------------------------------===//
+  if (export_reduce != NULL) {
+    for (unsigned i = 0, e = export_reduce->getNumOperands(); i < e; i++) {
+      llvm::MDNode *node = export_reduce->getOperand(i);
+      if ((node == NULL) || (node->getNumOperands() < 3)) {
+        ALOGE("Entry #%u at #rs_export_reduce is malformed in %s!", i,
+              module_name);
+        goto bail;
+      }
+
+      llvm::StringRef name = getStringFromOperand(node->getOperand(0));
+      llvm::StringRef combiner = getStringFromOperand(node->getOperand(1));
+      llvm::StringRef signature_string =
+          getStringFromOperand(node->getOperand(2));
+
+      if (name.empty() || combiner.empty() || signature_string.empty()) {
+        ALOGE("Entry #%u at #rs_export_reduce has an empty field in %s!", i,
+              module_name);
+        goto bail;
+      }
+
+      RSInfo::ExportReduce reduce;
+      if (signature_string.getAsInteger(10, reduce.signature)) {
+        ALOGE("Non-integer signature value '%s' for reduction %s found in %s!",
+              signature_string.str().c_str(), name.str().c_str(), module_name);
+        goto bail;
+      }
+      reduce.name = writeString(name, result->mStringPool,
+                                &cur_string_pool_offset);
+      reduce.combiner = writeString(combiner, result->mStringPool,
+                                    &cur_string_pool_offset);
+      result->mExportReduces.push(reduce);
+    }
+  }
+
   //===--------------------------------------------------------------------===//
   // #rs_object_slots
   //===--------------------------------------------------------------------===//
@@ -354,6 +525,10 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
           ALOGE("Non-integer object slot value '%s' in %s!", val.str().c_str(),
                 module.getModuleIdentifier().c_str());
           goto bail;
+        } else if (slot >= result->mObjectSlots.size()) {
+          ALOGE("Object slot %u out of the range in %s!", slot,
+                module.getModuleIdentifier().c_str());
+          goto bail;
         } else {
           result->mObjectSlots.editItemAt(slot) = 1;
         }
@@ -362,9 +537,22 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
   }
 #undef FOR_EACH_NODE_IN
 
-  if (LoadBuiltInSHA1Information()) {
+  //===--------------------------------------------------------------------===//
+  // Record the digest of the built-in dependencies. It's all the cache check
+  // needs to compare for them.
+  //===--------------------------------------------------------------------===//
+  {
+    const uint8_t *builtin_digest = GetBuiltInDigest();
+    if (builtin_digest != NULL) {
+      ::memcpy(result->mHeader.builtInDigest, builtin_digest,
+               SHA1_DIGEST_LENGTH);
+    }
+  }
+
+  if (has_builtin_sha1) {
     //===------------------------------------------------------------------===//
-    // Record built-in dependency information.
+    // Record built-in dependency information. These are kept to tell which
+    // one has changed once the digest differs.
     //===------------------------------------------------------------------===//
     if (!writeDependency(LibBCCPath, LibBCCSHA1,
                          result->mStringPool, &cur_string_pool_offset,
@@ -403,16 +591,16 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
       goto bail;
     }
 #endif
+  }
 
-    //===------------------------------------------------------------------===//
-    // Record dependency information.
-    //===------------------------------------------------------------------===//
-    for (unsigned i = 0, e = pDeps.size(); i != e; i++) {
-      if (!writeDependency(/* name */pDeps[i].first, /* SHA-1 */pDeps[i].second,
-                           result->mStringPool, &cur_string_pool_offset,
-                           result->mDependencyTable)) {
-        goto bail;
-      }
+  //===--------------------------------------------------------------------===//
+  // Record dependency information.
+  //===--------------------------------------------------------------------===//
+  for (unsigned i = 0, e = pDeps.size(); i != e; i++) {
+    if (!writeDependency(/* name */pDeps[i].first, /* SHA-1 */pDeps[i].second,
+                         result->mStringPool, &cur_string_pool_offset,
+                         result->mDependencyTable)) {
+      goto bail;
     }
   }
 
@@ -424,7 +612,9 @@ RSInfo *RSInfo::ExtractFromSource(const Source &pSource,
   result->mHeader.hasDebugInformation =
       static_cast<uint8_t>(module.getNamedMetadata("llvm.dbg.cu") != NULL);
 
-  assert((cur_string_pool_offset == string_pool_size) &&
+  // The space reserved for the names of the fused kernels may not be used up
+  // (e.g., if a chain is invalid.)
+  assert((cur_string_pool_offset <= string_pool_size) &&
             "Unexpected string pool size!");
 
   return result;
@@ -433,3 +623,105 @@ bail:
   delete result;
   return NULL;
 }
+
+void RSInfo::recordExportForeachCosts(const llvm::Module &pModule) {
+  const llvm::NamedMDNode *foreach_cost =
+      pModule.getNamedMetadata(foreach_cost_metadata_name);
+
+  mExportForeachCosts.clear();
+  if ((foreach_cost == NULL) ||
+      (foreach_cost->getNumOperands() != mExportForeachFuncs.size())) {
+    return;
+  }
+
+  // The arena always has room for a cost per foreach function.
+  for (unsigned i = 0, e = foreach_cost->getNumOperands(); i != e; i++) {
+    const llvm::MDNode *node = foreach_cost->getOperand(i);
+    const llvm::ConstantInt *instructions = NULL, *memory_ops = NULL;
+    if ((node != NULL) && (node->getNumOperands() == 2)) {
+      instructions = llvm::dyn_cast<llvm::ConstantInt>(node->getOperand(0));
+      memory_ops = llvm::dyn_cast<llvm::ConstantInt>(node->getOperand(1));
+    }
+
+    if ((instructions == NULL) || (memory_ops == NULL)) {
+      ALOGW("Invalid entry #%u at %s in %s! (skip all)", i,
+            foreach_cost_metadata_name.data(),
+            pModule.getModuleIdentifier().c_str());
+      mExportForeachCosts.clear();
+      return;
+    }
+
+    mExportForeachCosts.push(std::make_pair(
+        static_cast<uint32_t>(instructions->getZExtValue()),
+        static_cast<uint32_t>(memory_ops->getZExtValue())));
+  }
+}
+
+void RSInfo::recordExportVarLayout(const llvm::Module &pModule) {
+  const llvm::NamedMDNode *var_layout =
+      pModule.getNamedMetadata(export_var_layout_metadata_name);
+
+  mExportVarLayout.clear();
+  mObjectSlotRanges.clear();
+  if ((var_layout == NULL) ||
+      (var_layout->getNumOperands() != mExportVarNames.size())) {
+    return;
+  }
+
+  // The arena always has room for a layout per export var.
+  for (unsigned i = 0, e = var_layout->getNumOperands(); i != e; i++) {
+    const llvm::MDNode *node = var_layout->getOperand(i);
+    const llvm::ConstantInt *offset = NULL, *size = NULL;
+    if ((node != NULL) && (node->getNumOperands() == 2)) {
+      offset = llvm::dyn_cast<llvm::ConstantInt>(node->getOperand(0));
+      size = llvm::dyn_cast<llvm::ConstantInt>(node->getOperand(1));
+    }
+
+    if ((offset == NULL) || (size == NULL)) {
+      ALOGW("Invalid entry #%u at %s in %s! (skip all)", i,
+            export_var_layout_metadata_name.data(),
+            pModule.getModuleIdentifier().c_str());
+      mExportVarLayout.clear();
+      return;
+    }
+
+    mExportVarLayout.push(std::make_pair(
+        static_cast<uint32_t>(offset->getZExtValue()),
+        static_cast<uint32_t>(size->getZExtValue())));
+  }
+
+  // Merge the object slots in the block into runs (a var listed twice
+  // overlaps itself.)
+  llvm::SmallVector<std::pair<uint32_t, uint32_t>, 16> slots;
+  for (ObjectSlotListTy::const_iterator slot_iter = mObjectSlots.begin(),
+          slot_end = mObjectSlots.end(); slot_iter != slot_end; slot_iter++) {
+    if (*slot_iter >= mExportVarLayout.size()) {
+      continue;
+    }
+    const std::pair<uint32_t, uint32_t> &layout =
+        mExportVarLayout[*slot_iter];
+    if ((layout.first != rsinfo::gInvalidExportVarOffset) &&
+        (layout.second > 0)) {
+      slots.push_back(layout);
+    }
+  }
+  std::sort(slots.begin(), slots.end());
+
+  // The arena always has room for a range per object slot.
+  std::pair<uint32_t, uint32_t> range(0, 0);
+  for (unsigned i = 0, e = slots.size(); i != e; i++) {
+    uint32_t range_end = range.first + range.second;
+    if ((range.second > 0) && (slots[i].first <= range_end)) {
+      range.second = std::max(range_end, slots[i].first + slots[i].second) -
+                     range.first;
+      continue;
+    }
+    if (range.second > 0) {
+      mObjectSlotRanges.push(range);
+    }
+    range = slots[i];
+  }
+  if (range.second > 0) {
+    mObjectSlotRanges.push(range);
+  }
+}
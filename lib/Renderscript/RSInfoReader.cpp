@@ -15,7 +15,8 @@
  */
 
 //===----------------------------------------------------------------------===//
-// This file implements RSInfo::ReadFromFile()
+// This file implements RSInfo::ReadFromFile(), RSInfo::ReadFromBuffer(),
+// RSInfo::ReadFromBufferUnchecked() and RSInfo::ReadEmbedded()
 //===----------------------------------------------------------------------===//
 
 #include "bcc/Renderscript/RSInfo.h"
@@ -26,6 +27,7 @@
 
 #include "bcc/Support/Log.h"
 #include "bcc/Support/InputFile.h"
+#include "bcc/Support/Trace.h"
 
 using namespace bcc;
 
@@ -152,6 +154,80 @@ helper_read_list_item<rsinfo::ExportForeachFuncItem, RSInfo::ExportForeachFuncLi
   return true;
 }
 
+// Procee ExportReduceItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::ExportReduceItem, RSInfo::ExportReduceListTy>(
+    const rsinfo::ExportReduceItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::ExportReduceListTy &pResult)
+{
+  RSInfo::ExportReduce reduce;
+  reduce.name = pInfo.getStringFromPool(pItem.name);
+  reduce.combiner = pInfo.getStringFromPool(pItem.combiner);
+  reduce.signature = pItem.signature;
+
+  if (reduce.name == NULL) {
+    ALOGE("Invalid string index %d for name in RS export reduces.", pItem.name);
+    return false;
+  }
+
+  if (reduce.combiner == NULL) {
+    ALOGE("Invalid string index %d for combiner in RS export reduces.",
+          pItem.combiner);
+    return false;
+  }
+
+  pResult.push(reduce);
+  return true;
+}
+
+// Procee ExportSymbolItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::ExportSymbolItem, RSInfo::ExportSymbolListTy>(
+    const rsinfo::ExportSymbolItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::ExportSymbolListTy &pResult)
+{
+  pResult.push(std::make_pair(pItem.section, pItem.offset));
+  return true;
+}
+
+// Procee ExportForeachCostItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::ExportForeachCostItem,
+                      RSInfo::ExportForeachCostListTy>(
+    const rsinfo::ExportForeachCostItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::ExportForeachCostListTy &pResult)
+{
+  pResult.push(std::make_pair(pItem.instructions, pItem.memoryOps));
+  return true;
+}
+
+// Procee ExportVarLayoutItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::ExportVarLayoutItem,
+                      RSInfo::ExportVarLayoutListTy>(
+    const rsinfo::ExportVarLayoutItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::ExportVarLayoutListTy &pResult)
+{
+  pResult.push(std::make_pair(pItem.offset, pItem.size));
+  return true;
+}
+
+// Procee ObjectSlotRangeItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::ObjectSlotRangeItem,
+                      RSInfo::ObjectSlotRangeListTy>(
+    const rsinfo::ObjectSlotRangeItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::ObjectSlotRangeListTy &pResult)
+{
+  pResult.push(std::make_pair(pItem.offset, pItem.size));
+  return true;
+}
+
 template<typename ItemType, typename ItemContainer>
 inline bool helper_read_list(const uint8_t *pData,
                              const RSInfo &pInfo,
@@ -159,7 +235,8 @@ inline bool helper_read_list(const uint8_t *pData,
                              ItemContainer &pResult) {
   const ItemType *item;
 
-  // Out-of-range exception has been checked.
+  // Out-of-range exception has been checked. The lists in the arena have
+  // been reserved with the counts in the header.
   for (uint32_t i = 0; i < pHeader.count; i++) {
     item = reinterpret_cast<const ItemType *>(pData +
                                               pHeader.offset +
@@ -173,43 +250,109 @@ inline bool helper_read_list(const uint8_t *pData,
 
 } // end anonymous namespace
 
-RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps) {
+RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps,
+                             ReadStatus *pStatus) {
   android::FileMap *map = NULL;
   RSInfo *result = NULL;
-  const uint8_t *data;
-  const rsinfo::Header *header;
   size_t filesize;
   const char *input_filename = pInput.getName().c_str();
   const off_t cur_input_offset = pInput.tell();
+  TraceSection trace("RS info read", input_filename);
+
+  if (pStatus != NULL) {
+    *pStatus = kReadIOError;
+  }
 
   if (pInput.hasError()) {
     ALOGE("Invalid RS info file %s! (%s)", input_filename,
                                            pInput.getErrorMessage().c_str());
-    goto bail;
+    return NULL;
   }
 
   filesize = pInput.getSize();
   if (pInput.hasError()) {
     ALOGE("Failed to get the size of RS info file %s! (%s)",
           input_filename, pInput.getErrorMessage().c_str());
-    goto bail;
+    return NULL;
   }
 
-  // Create memory map for the file.
+  // Create memory map for the file. The lists are read in order.
   map = pInput.createMap(/* pOffset */cur_input_offset,
-                         /* pLength */filesize - cur_input_offset);
+                         /* pLength */filesize - cur_input_offset,
+                         /* pIsReadOnly */true, FileBase::kAccessSequential);
   if (map == NULL) {
     ALOGE("Failed to map RS info file %s to the memory! (%s)",
           input_filename, pInput.getErrorMessage().c_str());
-    goto bail;
+    return NULL;
+  }
+
+  // The result is a view of map (if it's successfully created.)
+  result = ReadFromBuffer(reinterpret_cast<const uint8_t *>(map->getDataPtr()),
+                          filesize - cur_input_offset, input_filename, pDeps,
+                          pStatus, map);
+
+  map->release();
+
+  return result;
+} // RSInfo::ReadFromFile
+
+RSInfo *RSInfo::ReadFromBuffer(const uint8_t *pData, size_t pSize,
+                               const char *pName,
+                               const DependencyTableTy &pDeps,
+                               ReadStatus *pStatus,
+                               android::FileMap *pView) {
+  return ReadFromBufferImpl(pData, pSize, pName, &pDeps, pStatus, pView);
+}
+
+RSInfo *RSInfo::ReadFromBufferUnchecked(const uint8_t *pData, size_t pSize,
+                                        const char *pName) {
+  return ReadFromBufferImpl(pData, pSize, pName, /* pDeps */NULL,
+                            /* pStatus */NULL, /* pView */NULL);
+}
+
+RSInfo *RSInfo::ReadEmbedded(const void *pData, const char *pName) {
+  const rsinfo::Header *header =
+      reinterpret_cast<const rsinfo::Header *>(pData);
+  if (header == NULL) {
+    ALOGE("No embedded RS info in %s!", pName);
+    return NULL;
+  }
+
+  // The symbol has no size. serialize() puts objectSlotRangeList last.
+  size_t size = header->objectSlotRangeList.offset +
+                header->objectSlotRangeList.count *
+                    header->objectSlotRangeList.itemSize;
+  if (size < sizeof(rsinfo::Header)) {
+    size = sizeof(rsinfo::Header);
   }
 
-  data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  return ReadFromBufferImpl(reinterpret_cast<const uint8_t *>(pData), size,
+                            pName, /* pDeps */NULL, /* pStatus */NULL,
+                            /* pView */NULL);
+}
+
+RSInfo *RSInfo::ReadFromBufferImpl(const uint8_t *pData, size_t pSize,
+                                   const char *pName,
+                                   const DependencyTableTy *pDeps,
+                                   ReadStatus *pStatus,
+                                   android::FileMap *pView) {
+  RSInfo *result = NULL;
+  ReadStatus status = kReadCorrupted;
+  const uint8_t *data = pData;
+  const rsinfo::Header *header;
+  const size_t filesize = pSize;
+  const char *input_filename = pName;
+
+  if (pSize < sizeof(rsinfo::Header)) {
+    ALOGW("Corrupted RS info file %s! (truncated header)", input_filename);
+    goto bail;
+  }
 
   // Header starts at the beginning of the file.
   header = reinterpret_cast<const rsinfo::Header *>(data);
 
   // Check the magic.
+  status = kReadVersionMismatch;
   if (::memcmp(header->magic, RSINFO_MAGIC, sizeof(header->magic)) != 0) {
     ALOGV("Wrong magic found in the RS info file %s. Treat it as a dirty "
           "cache.", input_filename);
@@ -227,13 +370,22 @@ RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps)
   }
 
   // Check the size.
+  status = kReadCorrupted;
   if ((header->headerSize != sizeof(rsinfo::Header)) ||
       (header->dependencyTable.itemSize != sizeof(rsinfo::DependencyTableItem)) ||
       (header->pragmaList.itemSize != sizeof(rsinfo::PragmaItem)) ||
       (header->objectSlotList.itemSize != sizeof(rsinfo::ObjectSlotItem)) ||
       (header->exportVarNameList.itemSize != sizeof(rsinfo::ExportVarNameItem)) ||
       (header->exportFuncNameList.itemSize != sizeof(rsinfo::ExportFuncNameItem)) ||
-      (header->exportForeachFuncList.itemSize != sizeof(rsinfo::ExportForeachFuncItem))) {
+      (header->exportForeachFuncList.itemSize != sizeof(rsinfo::ExportForeachFuncItem)) ||
+      (header->exportReduceList.itemSize != sizeof(rsinfo::ExportReduceItem)) ||
+      (header->exportSymbolList.itemSize != sizeof(rsinfo::ExportSymbolItem)) ||
+      (header->exportForeachCostList.itemSize !=
+          sizeof(rsinfo::ExportForeachCostItem)) ||
+      (header->exportVarLayoutList.itemSize !=
+          sizeof(rsinfo::ExportVarLayoutItem)) ||
+      (header->objectSlotRangeList.itemSize !=
+          sizeof(rsinfo::ObjectSlotRangeItem))) {
     ALOGW("Corrupted RS info file %s! (unexpected size found)", input_filename);
     goto bail;
   }
@@ -247,48 +399,77 @@ RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps)
       (LIST_DATA_RANGE(header->objectSlotList) > filesize) ||
       (LIST_DATA_RANGE(header->exportVarNameList) > filesize) ||
       (LIST_DATA_RANGE(header->exportFuncNameList) > filesize) ||
-      (LIST_DATA_RANGE(header->exportForeachFuncList) > filesize)) {
+      (LIST_DATA_RANGE(header->exportForeachFuncList) > filesize) ||
+      (LIST_DATA_RANGE(header->exportReduceList) > filesize) ||
+      (LIST_DATA_RANGE(header->exportSymbolList) > filesize) ||
+      (LIST_DATA_RANGE(header->exportForeachCostList) > filesize) ||
+      (LIST_DATA_RANGE(header->exportVarLayoutList) > filesize) ||
+      (LIST_DATA_RANGE(header->objectSlotRangeList) > filesize)) {
     ALOGW("Corrupted RS info file %s! (data out of the range)", input_filename);
     goto bail;
   }
 #undef LIST_DATA_RANGE
 
-  // File seems ok, create result RSInfo object.
-  result = new (std::nothrow) RSInfo(header->strPoolSize);
-  if (result == NULL) {
+  // File seems ok, create result RSInfo object with the lists sized by the
+  // header. A view doesn't need its own string pool.
+  {
+    ListCapacities capacities;
+    capacities.pragmas = header->pragmaList.count;
+    capacities.objectSlots = header->objectSlotList.count;
+    capacities.exportVarNames = header->exportVarNameList.count;
+    capacities.exportFuncNames = header->exportFuncNameList.count;
+    capacities.exportForeachFuncs = header->exportForeachFuncList.count;
+    capacities.exportReduces = header->exportReduceList.count;
+    capacities.exportSymbols = header->exportSymbolList.count;
+    capacities.exportForeachCosts = header->exportForeachCostList.count;
+    capacities.exportVarLayout = header->exportVarLayoutList.count;
+    capacities.objectSlotRanges = header->objectSlotRangeList.count;
+
+    result = new (std::nothrow) RSInfo((pView != NULL) ? 0 :
+                                                         header->strPoolSize,
+                                       capacities);
+  }
+  if ((result == NULL) || (result->mArena == NULL)) {
     ALOGE("Out of memory when create RSInfo object for %s!", input_filename);
+    status = kReadIOError;
     goto bail;
   }
 
-  // Make advice on our access pattern.
-  map->advise(android::FileMap::SEQUENTIAL);
-
   // Copy the header.
   ::memcpy(&result->mHeader, header, sizeof(rsinfo::Header));
 
-  if (header->strPoolSize > 0) {
-    // Copy the string pool. The string pool is immediately after the header at
-    // the offset header->headerSize.
-    if (result->mStringPool == NULL) {
-      ALOGE("Out of memory when allocate string pool for RS info file %s!",
-            input_filename);
-      goto bail;
-    }
+  if ((header->strPoolSize > 0) && (pView != NULL)) {
+    // Serve the strings from the mapping. The string pool is immediately after
+    // the header at the offset header->headerSize.
+    result->mStringPool =
+        const_cast<char *>(reinterpret_cast<const char *>(data) +
+                           result->mHeader.headerSize);
+    result->mView = pView;
+    pView->acquire();
+  } else if (header->strPoolSize > 0) {
+    // Copy the string pool into the arena.
     ::memcpy(result->mStringPool, data + result->mHeader.headerSize,
              result->mHeader.strPoolSize);
   }
 
   // Populate all the data to the result object.
+  result->mDependencyTable.setCapacity(header->dependencyTable.count);
   if (!helper_read_list<rsinfo::DependencyTableItem, DependencyTableTy>
         (data, *result, header->dependencyTable, result->mDependencyTable)) {
     goto bail;
   }
 
   // Check dependency to see whether the cache is dirty or not.
-  if (!CheckDependency(*result, pInput.getName().c_str(), pDeps)) {
-    goto bail;
+  if (pDeps != NULL) {
+    status = CheckDependency(*result, input_filename, *pDeps);
+    if (status != kReadOK) {
+      goto bail;
+    }
   }
 
+  // The remaining failures are caused by bad contents.
+  status = kReadCorrupted;
+
   if (!helper_read_list<rsinfo::PragmaItem, PragmaListTy>
         (data, *result, header->pragmaList, result->mPragmas)) {
     goto bail;
@@ -314,17 +495,46 @@ RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps)
     goto bail;
   }
 
-  // Clean up.
-  map->release();
+  if (!helper_read_list<rsinfo::ExportReduceItem, ExportReduceListTy>
+        (data, *result, header->exportReduceList, result->mExportReduces)) {
+    goto bail;
+  }
 
-  return result;
+  if (!helper_read_list<rsinfo::ExportSymbolItem, ExportSymbolListTy>
+        (data, *result, header->exportSymbolList, result->mExportSymbols)) {
+    goto bail;
+  }
 
-bail:
-  if (map != NULL) {
-    map->release();
+  if (!helper_read_list<rsinfo::ExportForeachCostItem, ExportForeachCostListTy>
+        (data, *result, header->exportForeachCostList,
+         result->mExportForeachCosts)) {
+    goto bail;
+  }
+
+  if (!helper_read_list<rsinfo::ExportVarLayoutItem, ExportVarLayoutListTy>
+        (data, *result, header->exportVarLayoutList,
+         result->mExportVarLayout)) {
+    goto bail;
   }
 
+  if (!helper_read_list<rsinfo::ObjectSlotRangeItem, ObjectSlotRangeListTy>
+        (data, *result, header->objectSlotRangeList,
+         result->mObjectSlotRanges)) {
+    goto bail;
+  }
+
+  if (pStatus != NULL) {
+    *pStatus = kReadOK;
+  }
+
+  return result;
+
+bail:
   delete result;
 
+  if (pStatus != NULL) {
+    *pStatus = status;
+  }
+
   return NULL;
-} // RSInfo::ReadFromFile
+} // RSInfo::ReadFromBufferImpl
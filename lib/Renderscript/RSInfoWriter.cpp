@@ -15,11 +15,22 @@
  */
 
 //===----------------------------------------------------------------------===//
-// This file implements RSInfo::write()
+// This file implements RSInfo::write(), RSInfo::serialize() and
+// RSInfo::recordExportSymbols()
 //===----------------------------------------------------------------------===//
 
 #include "bcc/Renderscript/RSInfo.h"
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/ELF.h>
+
+#include "bcc/Assert.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/OutputFile.h"
 
@@ -27,18 +38,111 @@ using namespace bcc;
 
 namespace {
 
+// The string pool of a serialized info. Each distinct string is stored once
+// and a string which ends another one (e.g., "root" and "foo.root") points
+// into its tail. The SHA-1 digests come first, right after the empty string
+// at index 0, so that the pool still ends with a NUL.
+class StringPool {
+private:
+  typedef llvm::StringMap<rsinfo::StringIndexTy> IndexMapTy;
+
+  IndexMapTy mIndices;
+  IndexMapTy mDigestIndices;
+  // The distinct strings and digests in the order they were added.
+  std::vector<llvm::StringRef> mStrings;
+  std::vector<llvm::StringRef> mDigests;
+  std::string mPool;
+
+  // Order the strings by their reversed contents, each right after the
+  // strings it ends.
+  static bool ReversedGreater(llvm::StringRef pA, llvm::StringRef pB) {
+    size_t i = pA.size(), j = pB.size();
+    while ((i > 0) && (j > 0)) {
+      --i;
+      --j;
+      if (pA[i] != pB[j]) {
+        return (static_cast<unsigned char>(pA[i]) >
+                static_cast<unsigned char>(pB[j]));
+      }
+    }
+    return (i > 0);
+  }
+
+public:
+  void addString(const char *pString) {
+    llvm::StringRef string(pString);
+    if (!string.empty() && !mIndices.count(string)) {
+      mIndices[string] = rsinfo::gInvalidStringIndex;
+      mStrings.push_back(string);
+    }
+  }
+
+  void addDigest(const uint8_t *pDigest) {
+    llvm::StringRef digest(reinterpret_cast<const char *>(pDigest),
+                           SHA1_DIGEST_LENGTH);
+    if (!mDigestIndices.count(digest)) {
+      mDigestIndices[digest] = rsinfo::gInvalidStringIndex;
+      mDigests.push_back(digest);
+    }
+  }
+
+  // Lay the pool out once everything is added.
+  void finalize() {
+    mPool.assign(1, '\0');
+    for (size_t i = 0, e = mDigests.size(); i != e; i++) {
+      mDigestIndices[mDigests[i]] = mPool.size();
+      mPool.append(mDigests[i].data(), mDigests[i].size());
+    }
+
+    std::vector<llvm::StringRef> strings(mStrings);
+    std::stable_sort(strings.begin(), strings.end(), ReversedGreater);
+    llvm::StringRef last;
+    rsinfo::StringIndexTy last_index = 0;
+    for (size_t i = 0, e = strings.size(); i != e; i++) {
+      if (!last.empty() && last.endswith(strings[i])) {
+        mIndices[strings[i]] = last_index + last.size() - strings[i].size();
+        continue;
+      }
+      last = strings[i];
+      last_index = mPool.size();
+      mIndices[last] = last_index;
+      mPool.append(last.data(), last.size());
+      mPool.push_back('\0');
+    }
+  }
+
+  rsinfo::StringIndexTy getIndex(const char *pString) const {
+    if (*pString == '\0') {
+      return 0;
+    }
+    IndexMapTy::const_iterator index = mIndices.find(pString);
+    return (index != mIndices.end()) ? index->getValue() :
+                                       rsinfo::gInvalidStringIndex;
+  }
+
+  rsinfo::StringIndexTy getDigestIndex(const uint8_t *pDigest) const {
+    IndexMapTy::const_iterator index =
+        mDigestIndices.find(llvm::StringRef(
+            reinterpret_cast<const char *>(pDigest), SHA1_DIGEST_LENGTH));
+    return (index != mDigestIndices.end()) ? index->getValue() :
+                                             rsinfo::gInvalidStringIndex;
+  }
+
+  const std::string &getPool() const
+  { return mPool; }
+};
+
 template<typename ItemType, typename ItemContainer> inline bool
-helper_adapt_list_item(ItemType &pResult, const RSInfo &pInfo,
+helper_adapt_list_item(ItemType &pResult, const StringPool &pPool,
                        const typename ItemContainer::const_iterator &pItem);
 
 template<> inline bool
 helper_adapt_list_item<rsinfo::DependencyTableItem, RSInfo::DependencyTableTy>(
     rsinfo::DependencyTableItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::DependencyTableTy::const_iterator &pItem) {
-  pResult.id = pInfo.getStringIdxInPool(pItem->first);
-  pResult.sha1 =
-      pInfo.getStringIdxInPool(reinterpret_cast<const char *>(pItem->second));
+  pResult.id = pPool.getIndex(pItem->first);
+  pResult.sha1 = pPool.getDigestIndex(pItem->second);
 
   if (pResult.id == rsinfo::gInvalidStringIndex) {
     ALOGE("RS dependency table contains invalid source id string '%s'.",
@@ -58,10 +162,10 @@ helper_adapt_list_item<rsinfo::DependencyTableItem, RSInfo::DependencyTableTy>(
 template<> inline bool
 helper_adapt_list_item<rsinfo::PragmaItem, RSInfo::PragmaListTy>(
     rsinfo::PragmaItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::PragmaListTy::const_iterator &pItem) {
-  pResult.key = pInfo.getStringIdxInPool(pItem->first);
-  pResult.value = pInfo.getStringIdxInPool(pItem->second);
+  pResult.key = pPool.getIndex(pItem->first);
+  pResult.value = pPool.getIndex(pItem->second);
 
   if (pResult.key == rsinfo::gInvalidStringIndex) {
     ALOGE("RS pragma list contains invalid string '%s' for key.", pItem->first);
@@ -80,7 +184,7 @@ helper_adapt_list_item<rsinfo::PragmaItem, RSInfo::PragmaListTy>(
 template<> inline bool
 helper_adapt_list_item<rsinfo::ObjectSlotItem, RSInfo::ObjectSlotListTy>(
     rsinfo::ObjectSlotItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::ObjectSlotListTy::const_iterator &pItem) {
   pResult.slot = *pItem;
   return true;
@@ -89,9 +193,9 @@ helper_adapt_list_item<rsinfo::ObjectSlotItem, RSInfo::ObjectSlotListTy>(
 template<> inline bool
 helper_adapt_list_item<rsinfo::ExportVarNameItem, RSInfo::ExportVarNameListTy>(
     rsinfo::ExportVarNameItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::ExportVarNameListTy::const_iterator &pItem) {
-  pResult.name = pInfo.getStringIdxInPool(*pItem);
+  pResult.name = pPool.getIndex(*pItem);
 
   if (pResult.name == rsinfo::gInvalidStringIndex) {
     ALOGE("RS export vars contains invalid string '%s' for name.", *pItem);
@@ -105,9 +209,9 @@ template<> inline bool
 helper_adapt_list_item<rsinfo::ExportFuncNameItem,
                        RSInfo::ExportFuncNameListTy>(
     rsinfo::ExportFuncNameItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::ExportFuncNameListTy::const_iterator &pItem) {
-  pResult.name = pInfo.getStringIdxInPool(*pItem);
+  pResult.name = pPool.getIndex(*pItem);
 
   if (pResult.name == rsinfo::gInvalidStringIndex) {
     ALOGE("RS export funcs contains invalid string '%s' for name.", *pItem);
@@ -121,9 +225,9 @@ template<> inline bool
 helper_adapt_list_item<rsinfo::ExportForeachFuncItem,
                        RSInfo::ExportForeachFuncListTy>(
     rsinfo::ExportForeachFuncItem &pResult,
-    const RSInfo &pInfo,
+    const StringPool &pPool,
     const RSInfo::ExportForeachFuncListTy::const_iterator &pItem) {
-  pResult.name = pInfo.getStringIdxInPool(pItem->first);
+  pResult.name = pPool.getIndex(pItem->first);
   pResult.signature = pItem->second;
 
   if (pResult.name == rsinfo::gInvalidStringIndex) {
@@ -135,98 +239,402 @@ helper_adapt_list_item<rsinfo::ExportForeachFuncItem,
   return true;
 }
 
+template<> inline bool
+helper_adapt_list_item<rsinfo::ExportReduceItem, RSInfo::ExportReduceListTy>(
+    rsinfo::ExportReduceItem &pResult,
+    const StringPool &pPool,
+    const RSInfo::ExportReduceListTy::const_iterator &pItem) {
+  pResult.name = pPool.getIndex(pItem->name);
+  pResult.combiner = pPool.getIndex(pItem->combiner);
+  pResult.signature = pItem->signature;
+
+  if (pResult.name == rsinfo::gInvalidStringIndex) {
+    ALOGE("RS export reduce contains invalid string '%s' for name.",
+          pItem->name);
+    return false;
+  }
+
+  if (pResult.combiner == rsinfo::gInvalidStringIndex) {
+    ALOGE("RS export reduce contains invalid string '%s' for combiner.",
+          pItem->combiner);
+    return false;
+  }
+
+  return true;
+}
+
+template<> inline bool
+helper_adapt_list_item<rsinfo::ExportSymbolItem, RSInfo::ExportSymbolListTy>(
+    rsinfo::ExportSymbolItem &pResult,
+    const StringPool &pPool,
+    const RSInfo::ExportSymbolListTy::const_iterator &pItem) {
+  pResult.section = pItem->first;
+  pResult.offset = pItem->second;
+  return true;
+}
+
+template<> inline bool
+helper_adapt_list_item<rsinfo::ExportForeachCostItem,
+                       RSInfo::ExportForeachCostListTy>(
+    rsinfo::ExportForeachCostItem &pResult,
+    const StringPool &pPool,
+    const RSInfo::ExportForeachCostListTy::const_iterator &pItem) {
+  pResult.instructions = pItem->first;
+  pResult.memoryOps = pItem->second;
+  return true;
+}
+
+template<> inline bool
+helper_adapt_list_item<rsinfo::ExportVarLayoutItem,
+                       RSInfo::ExportVarLayoutListTy>(
+    rsinfo::ExportVarLayoutItem &pResult,
+    const StringPool &pPool,
+    const RSInfo::ExportVarLayoutListTy::const_iterator &pItem) {
+  pResult.offset = pItem->first;
+  pResult.size = pItem->second;
+  return true;
+}
+
+template<> inline bool
+helper_adapt_list_item<rsinfo::ObjectSlotRangeItem,
+                       RSInfo::ObjectSlotRangeListTy>(
+    rsinfo::ObjectSlotRangeItem &pResult,
+    const StringPool &pPool,
+    const RSInfo::ObjectSlotRangeListTy::const_iterator &pItem) {
+  pResult.offset = pItem->first;
+  pResult.size = pItem->second;
+  return true;
+}
+
 template<typename ItemType, typename ItemContainer>
-inline bool helper_write_list(OutputFile &pOutput,
-                              const RSInfo &pInfo,
-                              const rsinfo::ListHeader &pHeader,
-                              ItemContainer &pList) {
+inline bool helper_append_list(std::string &pResult,
+                               const StringPool &pPool,
+                               const rsinfo::ListHeader &pHeader,
+                               const ItemContainer &pList) {
   ItemType item;
 
+  // The list starts where layout() has put it.
+  bccAssert(pResult.size() == pHeader.offset);
   for (typename ItemContainer::const_iterator item_iter = pList.begin(),
           item_end = pList.end(); item_iter != item_end; item_iter++) {
     // Convert each entry in the pList to ItemType.
     if (!helper_adapt_list_item<ItemType, ItemContainer>(item,
-                                                         pInfo,
+                                                         pPool,
                                                          item_iter)) {
       return false;
     }
-    // And write out an item.
-    if (pOutput.write(&item, sizeof(item)) != sizeof(item)) {
-      ALOGE("Cannot write out item of %s for RSInfo file %s! (%s)",
-            rsinfo::GetItemTypeName<ItemType>(), pOutput.getName().c_str(),
-            pOutput.getErrorMessage().c_str());
+    // And append an item.
+    pResult.append(reinterpret_cast<const char *>(&item), sizeof(item));
+  }
+
+  return true;
+}
+
+// Symbol name => (section index, offset in the section)
+typedef llvm::StringMap<std::pair<uint16_t, uint32_t> > SymbolLocationMapTy;
+
+// Collect the location of every symbol defined in an allocated section of the
+// relocatable ELF object pImage of class pClass (whose headers and symbols are
+// Ehdr, Shdr and Sym.) Return false if pImage isn't such an object or it's
+// malformed.
+template <typename Ehdr, typename Shdr, typename Sym>
+bool helper_collect_symbols(const uint8_t *pImage, size_t pImageSize,
+                            unsigned char pClass,
+                            SymbolLocationMapTy &pResult) {
+  if (pImageSize < sizeof(Ehdr)) {
+    return false;
+  }
+
+  const Ehdr *elf_header = reinterpret_cast<const Ehdr *>(pImage);
+
+  // The symbol values are the offsets in their sections only in a relocatable
+  // object.
+  if ((::memcmp(elf_header->e_ident, llvm::ELF::ElfMagic,
+                ::strlen(llvm::ELF::ElfMagic)) != 0) ||
+      (elf_header->e_ident[llvm::ELF::EI_CLASS] != pClass) ||
+      (elf_header->e_ident[llvm::ELF::EI_DATA] != llvm::ELF::ELFDATA2LSB) ||
+      (elf_header->e_type != llvm::ELF::ET_REL) ||
+      (elf_header->e_shentsize != sizeof(Shdr)) ||
+      (elf_header->e_shoff > pImageSize) ||
+      ((pImageSize - elf_header->e_shoff) / sizeof(Shdr) <
+          elf_header->e_shnum)) {
+    return false;
+  }
+
+  const unsigned num_sections = elf_header->e_shnum;
+  const Shdr *section_header_table =
+      reinterpret_cast<const Shdr *>(pImage + elf_header->e_shoff);
+
+#define SECTION_IN_RANGE(_shdr)   (((_shdr).sh_offset <= pImageSize) &&    ((_shdr).sh_size <= (pImageSize - (_shdr).sh_offset)))
+
+  for (unsigned i = 0; i < num_sections; i++) {
+    const Shdr &symtab = section_header_table[i];
+    if (symtab.sh_type != llvm::ELF::SHT_SYMTAB) {
+      continue;
+    }
+
+    if ((symtab.sh_link >= num_sections) ||
+        (symtab.sh_entsize != sizeof(Sym)) ||
+        !SECTION_IN_RANGE(symtab) ||
+        !SECTION_IN_RANGE(section_header_table[symtab.sh_link])) {
       return false;
     }
+
+    const Shdr &strtab = section_header_table[symtab.sh_link];
+    const char *strings =
+        reinterpret_cast<const char *>(pImage + strtab.sh_offset);
+    const Sym *symbols =
+        reinterpret_cast<const Sym *>(pImage + symtab.sh_offset);
+
+    for (size_t j = 0, e = symtab.sh_size / sizeof(Sym); j != e; j++) {
+      const Sym &symbol = symbols[j];
+
+      // Skip the undefined, absolute and common symbols.
+      if ((symbol.st_shndx == llvm::ELF::SHN_UNDEF) ||
+          (symbol.st_shndx >= llvm::ELF::SHN_LORESERVE) ||
+          (symbol.st_shndx >= num_sections) ||
+          !(section_header_table[symbol.st_shndx].sh_flags &
+                llvm::ELF::SHF_ALLOC) ||
+          (symbol.st_name >= strtab.sh_size)) {
+        continue;
+      }
+
+      const char *name = strings + symbol.st_name;
+      size_t name_length = ::strnlen(name, strtab.sh_size - symbol.st_name);
+      if ((name_length == 0) ||
+          (name_length == (strtab.sh_size - symbol.st_name))) {
+        // Empty or not terminated.
+        continue;
+      }
+
+      // Like ObjectLoader, the first symbol wins if there're more than one with
+      // the same name.
+      llvm::StringRef key(name, name_length);
+      if (pResult.find(key) == pResult.end()) {
+        pResult[key] = std::make_pair(
+            static_cast<uint16_t>(symbol.st_shndx),
+            static_cast<uint32_t>(symbol.st_value));
+      }
+    }
+
+    // There's at most one symbol table in an object.
+    break;
   }
+#undef SECTION_IN_RANGE
 
   return true;
 }
 
+// Dispatch helper_collect_symbols() on the class of pImage.
+bool helper_collect_symbols(const uint8_t *pImage, size_t pImageSize,
+                            SymbolLocationMapTy &pResult) {
+  if (pImageSize < llvm::ELF::EI_NIDENT) {
+    return false;
+  }
+
+  switch (pImage[llvm::ELF::EI_CLASS]) {
+    case llvm::ELF::ELFCLASS32: {
+      return helper_collect_symbols<llvm::ELF::Elf32_Ehdr,
+                                    llvm::ELF::Elf32_Shdr,
+                                    llvm::ELF::Elf32_Sym>(
+          pImage, pImageSize, llvm::ELF::ELFCLASS32, pResult);
+    }
+    case llvm::ELF::ELFCLASS64: {
+      return helper_collect_symbols<llvm::ELF::Elf64_Ehdr,
+                                    llvm::ELF::Elf64_Shdr,
+                                    llvm::ELF::Elf64_Sym>(
+          pImage, pImageSize, llvm::ELF::ELFCLASS64, pResult);
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+inline void helper_record_symbol(const SymbolLocationMapTy &pSymbols,
+                                 llvm::StringRef pName,
+                                 RSInfo::ExportSymbolListTy &pResult) {
+  SymbolLocationMapTy::const_iterator symbol = pSymbols.find(pName);
+  if (symbol != pSymbols.end()) {
+    pResult.push(symbol->getValue());
+  } else {
+    // Unknown.
+    pResult.push(std::make_pair(static_cast<uint16_t>(llvm::ELF::SHN_UNDEF),
+                                static_cast<uint32_t>(0)));
+  }
+}
+
 } // end anonymous namespace
 
-bool RSInfo::write(OutputFile &pOutput) {
-  off_t initial_offset = pOutput.tell();
-  const char *output_filename = pOutput.getName().c_str();
+bool RSInfo::recordExportSymbols(const void *pImage, size_t pImageSize) {
+  SymbolLocationMapTy symbols;
 
-  if (pOutput.hasError()) {
-    ALOGE("Invalid RS info file %s for output! (%s)",
-          output_filename, pOutput.getErrorMessage().c_str());
+  mExportSymbols.clear();
+
+  if (!helper_collect_symbols(reinterpret_cast<const uint8_t *>(pImage),
+                              pImageSize, symbols)) {
+    ALOGW("Unable to record the export symbols (invalid ELF object)!");
     return false;
   }
 
-  // Layout.
-  if (!layout(initial_offset)) {
-    return false;
+  // The arena always has room for getNumExportSymbols() locations.
+  for (ExportVarNameListTy::const_iterator var_iter = mExportVarNames.begin(),
+          var_end = mExportVarNames.end(); var_iter != var_end; var_iter++) {
+    helper_record_symbol(symbols, *var_iter, mExportSymbols);
   }
 
-  // Write header.
-  if (pOutput.write(&mHeader, sizeof(mHeader)) != sizeof(mHeader)) {
-    ALOGE("Cannot write out the header for RSInfo file %s! (%s)",
-          output_filename, pOutput.getErrorMessage().c_str());
-    return false;
+  for (ExportFuncNameListTy::const_iterator func_iter = mExportFuncNames.begin(),
+        func_end = mExportFuncNames.end(); func_iter != func_end; func_iter++) {
+    helper_record_symbol(symbols, *func_iter, mExportSymbols);
   }
 
-  // Write string pool.
-  if (static_cast<size_t>(pOutput.write(mStringPool, mHeader.strPoolSize))
-          != mHeader.strPoolSize) {
-    ALOGE("Cannot write out the string pool for RSInfo file %s! (%s)",
-          output_filename, pOutput.getErrorMessage().c_str());
-    return false;
+  // All the variants of the first kind, then the ones of the second kind and so
+  // on. See RSExecutable::Create().
+  llvm::SmallString<64> name;
+  for (unsigned i = 0; i < kNumForeachVariants; i++) {
+    for (ExportForeachFuncListTy::const_iterator
+            foreach_iter = mExportForeachFuncs.begin(),
+            foreach_end = mExportForeachFuncs.end();
+         foreach_iter != foreach_end; foreach_iter++) {
+      name = foreach_iter->first;
+      name += ExportForeachSuffixes[i];
+      helper_record_symbol(symbols, name.str(), mExportSymbols);
+    }
   }
 
-  // Write dependencyTable.
-  if (!helper_write_list<rsinfo::DependencyTableItem, DependencyTableTy>
-        (pOutput, *this, mHeader.dependencyTable, mDependencyTable)) {
-    return false;
+  // Likewise for the reductions, followed by their combiners.
+  for (unsigned i = 0; i < kNumForeachVariants; i++) {
+    for (ExportReduceListTy::const_iterator
+            reduce_iter = mExportReduces.begin(),
+            reduce_end = mExportReduces.end();
+         reduce_iter != reduce_end; reduce_iter++) {
+      name = reduce_iter->name;
+      name += ExportForeachSuffixes[i];
+      helper_record_symbol(symbols, name.str(), mExportSymbols);
+    }
   }
 
-  // Write pragmaList.
-  if (!helper_write_list<rsinfo::PragmaItem, PragmaListTy>
-        (pOutput, *this, mHeader.pragmaList, mPragmas)) {
+  for (ExportReduceListTy::const_iterator reduce_iter = mExportReduces.begin(),
+          reduce_end = mExportReduces.end();
+       reduce_iter != reduce_end; reduce_iter++) {
+    helper_record_symbol(symbols, reduce_iter->combiner, mExportSymbols);
+  }
+
+  return true;
+}
+
+bool RSInfo::serialize(std::string &pResult) const {
+  // Layout. The offsets are relative to the beginning of the header (which is
+  // how ReadFromBuffer() interprets them) so that the info can be embedded at
+  // any position, e.g., in an RS cache container or in an object.
+  //
+  // The string pool is rebuilt from the lists rather than copied from
+  // mStringPool, which is reserved for the worst case and holds the same
+  // string as many times as it's referenced.
+  StringPool pool;
+  for (DependencyTableTy::const_iterator dep_iter = mDependencyTable.begin(),
+          dep_end = mDependencyTable.end(); dep_iter != dep_end; dep_iter++) {
+    pool.addString(dep_iter->first);
+    pool.addDigest(dep_iter->second);
+  }
+  for (PragmaListTy::const_iterator pragma_iter = mPragmas.begin(),
+          pragma_end = mPragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++) {
+    pool.addString(pragma_iter->first);
+    pool.addString(pragma_iter->second);
+  }
+  for (ExportVarNameListTy::const_iterator var_iter = mExportVarNames.begin(),
+          var_end = mExportVarNames.end(); var_iter != var_end; var_iter++) {
+    pool.addString(*var_iter);
+  }
+  for (ExportFuncNameListTy::const_iterator
+          func_iter = mExportFuncNames.begin(),
+          func_end = mExportFuncNames.end(); func_iter != func_end;
+       func_iter++) {
+    pool.addString(*func_iter);
+  }
+  for (ExportForeachFuncListTy::const_iterator
+          foreach_iter = mExportForeachFuncs.begin(),
+          foreach_end = mExportForeachFuncs.end(); foreach_iter != foreach_end;
+       foreach_iter++) {
+    pool.addString(foreach_iter->first);
+  }
+  for (ExportReduceListTy::const_iterator reduce_iter = mExportReduces.begin(),
+          reduce_end = mExportReduces.end(); reduce_iter != reduce_end;
+       reduce_iter++) {
+    pool.addString(reduce_iter->name);
+    pool.addString(reduce_iter->combiner);
+  }
+  pool.finalize();
+
+  rsinfo::Header header = mHeader;
+  header.strPoolSize = pool.getPool().size();
+  if (!layout(0, header)) {
     return false;
   }
 
-  // Write objectSlotList.
-  if (!helper_write_list<rsinfo::ObjectSlotItem, ObjectSlotListTy>
-        (pOutput, *this, mHeader.objectSlotList, mObjectSlots)) {
+  std::string result;
+  result.reserve(header.objectSlotRangeList.offset +
+                 header.objectSlotRangeList.count *
+                     header.objectSlotRangeList.itemSize);
+
+  // Header and string pool.
+  result.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  result.append(pool.getPool());
+
+  if (!helper_append_list<rsinfo::DependencyTableItem, DependencyTableTy>
+          (result, pool, header.dependencyTable, mDependencyTable) ||
+      !helper_append_list<rsinfo::PragmaItem, PragmaListTy>
+          (result, pool, header.pragmaList, mPragmas) ||
+      !helper_append_list<rsinfo::ObjectSlotItem, ObjectSlotListTy>
+          (result, pool, header.objectSlotList, mObjectSlots) ||
+      !helper_append_list<rsinfo::ExportVarNameItem, ExportVarNameListTy>
+          (result, pool, header.exportVarNameList, mExportVarNames) ||
+      !helper_append_list<rsinfo::ExportFuncNameItem, ExportFuncNameListTy>
+          (result, pool, header.exportFuncNameList, mExportFuncNames) ||
+      !helper_append_list<rsinfo::ExportForeachFuncItem,
+                          ExportForeachFuncListTy>
+          (result, pool, header.exportForeachFuncList, mExportForeachFuncs) ||
+      !helper_append_list<rsinfo::ExportReduceItem, ExportReduceListTy>
+          (result, pool, header.exportReduceList, mExportReduces) ||
+      !helper_append_list<rsinfo::ExportSymbolItem, ExportSymbolListTy>
+          (result, pool, header.exportSymbolList, mExportSymbols) ||
+      !helper_append_list<rsinfo::ExportForeachCostItem,
+                          ExportForeachCostListTy>
+          (result, pool, header.exportForeachCostList,
+           mExportForeachCosts) ||
+      !helper_append_list<rsinfo::ExportVarLayoutItem, ExportVarLayoutListTy>
+          (result, pool, header.exportVarLayoutList, mExportVarLayout) ||
+      !helper_append_list<rsinfo::ObjectSlotRangeItem, ObjectSlotRangeListTy>
+          (result, pool, header.objectSlotRangeList, mObjectSlotRanges)) {
     return false;
   }
 
-  // Write exportVarNameList.
-  if (!helper_write_list<rsinfo::ExportVarNameItem, ExportVarNameListTy>
-        (pOutput, *this, mHeader.exportVarNameList, mExportVarNames)) {
+  pResult.append(result);
+  return true;
+}
+
+bool RSInfo::write(OutputFile &pOutput) {
+  const char *output_filename = pOutput.getName().c_str();
+
+  if (pOutput.hasError()) {
+    ALOGE("Invalid RS info file %s for output! (%s)",
+          output_filename, pOutput.getErrorMessage().c_str());
     return false;
   }
 
-  // Write exportFuncNameList.
-  if (!helper_write_list<rsinfo::ExportFuncNameItem, ExportFuncNameListTy>
-        (pOutput, *this, mHeader.exportFuncNameList, mExportFuncNames)) {
+  // The whole info is written at once.
+  std::string data;
+  if (!serialize(data)) {
+    ALOGE("Cannot serialize the RS info for RSInfo file %s!",
+          output_filename);
     return false;
   }
 
-  // Write exportForeachFuncList.
-  if (!helper_write_list<rsinfo::ExportForeachFuncItem, ExportForeachFuncListTy>
-        (pOutput, *this, mHeader.exportForeachFuncList, mExportForeachFuncs)) {
+  if (static_cast<size_t>(pOutput.write(data.data(), data.size())) !=
+          data.size()) {
+    ALOGE("Cannot write out the RSInfo file %s! (%s)", output_filename,
+          pOutput.getErrorMessage().c_str());
     return false;
   }
 
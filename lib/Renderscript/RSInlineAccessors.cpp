@@ -0,0 +1,184 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <string>
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CallSite.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+/* RSInlineAccessorsPass - This pass gets the allocation accessors of the
+ * runtime (rsGetElementAt*(), rsSetElementAt*() and rsAllocationGetDim*())
+ * called from the kernels inlined into their expanded ForEach loops. The
+ * accessors linked from libclcore compute the address of the cell from the
+ * base pointer and the strides of the allocation, so once inlined their calls
+ * become pointer arithmetic on values LICM hoists out of the loop, and the
+ * loop vectorizer no longer gives up on a gather-style kernel because of a
+ * call. The accessors reachable from the loops lose any noinline and get an
+ * inline hint, which raises the threshold of the inliner for them; the
+ * larger ones (e.g., for 3D allocations) may still stay out of line. It runs
+ * after RSForEachExpandPass, before the inliner of LTO.
+ *
+ * The accessors only declared in the module are resolved from the runtime
+ * when the script is loaded and remain calls.
+ */
+class RSInlineAccessorsPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  const RSInfo::ExportForeachFuncListTy &mFuncs;
+  const RSInfo::ExportReduceListTy &mReduces;
+
+  /// @brief Returns the source name of the mangled name Name, e.g.,
+  ///        "rsGetElementAt_int" for "_Z18rsGetElementAt_int13rs_allocationj",
+  ///        or Name itself if it's not mangled.
+  static llvm::StringRef getUnmangledName(llvm::StringRef Name) {
+    if (!Name.startswith("_Z")) {
+      return Name;
+    }
+    llvm::StringRef Rest = Name.substr(2);
+    size_t NumDigits = Rest.find_first_not_of("0123456789");
+    unsigned Length;
+    if ((NumDigits == 0) || (NumDigits == llvm::StringRef::npos) ||
+        Rest.substr(0, NumDigits).getAsInteger(10, Length) ||
+        (Length > Rest.size() - NumDigits)) {
+      return Name;
+    }
+    return Rest.substr(NumDigits, Length);
+  }
+
+  static bool isAllocationAccessor(const llvm::Function &F) {
+    llvm::StringRef Name = getUnmangledName(F.getName());
+    return (Name.startswith("rsGetElementAt") ||
+            Name.startswith("rsSetElementAt") ||
+            Name.startswith("rsAllocationGetDim"));
+  }
+
+  /// @brief Adds the expanded function of Name to Worklist if it's in M.
+  static void addExpandedFunction(llvm::Module &M, const char *Name,
+                                  llvm::SmallVectorImpl<llvm::Function *>
+                                      &Worklist) {
+    std::string ExpandedName(Name);
+    ExpandedName.append(RSInfo::ExportForeachSuffixes[RSInfo::kForeachExpand]);
+    llvm::Function *F = M.getFunction(ExpandedName);
+    if ((F != NULL) && !F->isDeclaration()) {
+      Worklist.push_back(F);
+    }
+  }
+
+public:
+  RSInlineAccessorsPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                        const RSInfo::ExportReduceListTy &pReduces)
+      : ModulePass(ID), mFuncs(pForeachFuncs), mReduces(pReduces) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    // The other entry points of a kernel all call its "<NAME>.expand".
+    llvm::SmallVector<llvm::Function *, 16> Worklist;
+    for (RSInfo::ExportForeachFuncListTy::const_iterator
+             func_iter = mFuncs.begin(), func_end = mFuncs.end();
+         func_iter != func_end; func_iter++) {
+      addExpandedFunction(M, func_iter->first, Worklist);
+    }
+    for (RSInfo::ExportReduceListTy::const_iterator
+             reduce_iter = mReduces.begin(), reduce_end = mReduces.end();
+         reduce_iter != reduce_end; reduce_iter++) {
+      addExpandedFunction(M, reduce_iter->name, Worklist);
+    }
+
+    // Walk the functions the loops reach through direct calls.
+    llvm::SmallPtrSet<llvm::Function *, 32> Visited;
+    unsigned NumInlined = 0, NumExternal = 0;
+    while (!Worklist.empty()) {
+      llvm::Function *F = Worklist.pop_back_val();
+      if (!Visited.insert(F)) {
+        continue;
+      }
+
+      for (llvm::Function::iterator BB = F->begin(), BE = F->end();
+           BB != BE; ++BB) {
+        for (llvm::BasicBlock::iterator I = BB->begin(), IE = BB->end();
+             I != IE; ++I) {
+          llvm::CallSite CS(I);
+          llvm::Function *Callee = (CS ? CS.getCalledFunction() : NULL);
+          if ((Callee == NULL) || Callee->isIntrinsic()) {
+            continue;
+          }
+
+          if (Callee->isDeclaration()) {
+            if (isAllocationAccessor(*Callee) && !Visited.count(Callee)) {
+              ALOGV("%s is called from a ForEach loop of %s but is resolved "
+                    "from the runtime", Callee->getName().str().c_str(),
+                    M.getModuleIdentifier().c_str());
+              Visited.insert(Callee);
+              NumExternal++;
+            }
+            continue;
+          }
+
+          if (isAllocationAccessor(*Callee) &&
+              !Callee->hasFnAttribute(llvm::Attribute::AlwaysInline) &&
+              !Callee->hasFnAttribute(llvm::Attribute::InlineHint)) {
+            Callee->removeFnAttr(llvm::Attribute::NoInline);
+            Callee->addFnAttr(llvm::Attribute::InlineHint);
+            NumInlined++;
+          }
+          Worklist.push_back(Callee);
+        }
+      }
+    }
+
+    ALOGV("%u allocation accessors of %s hinted for inlining into the ForEach "
+          "loops (%u resolved from the runtime)", NumInlined,
+          M.getModuleIdentifier().c_str(), NumExternal);
+
+    return (NumInlined > 0);
+  }
+
+  virtual const char *getPassName() const {
+    return "Allocation Accessor Inlining";
+  }
+
+};  // end RSInlineAccessorsPass
+
+}  // end anonymous namespace
+
+char RSInlineAccessorsPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSInlineAccessorsPass(const RSInfo::ExportForeachFuncListTy
+                                &pForeachFuncs,
+                            const RSInfo::ExportReduceListTy &pReduces) {
+  return new RSInlineAccessorsPass(pForeachFuncs, pReduces);
+}
+
+}  // end namespace bcc
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <string>
+#include <vector>
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+/* RSKernelCountersPass - This pass makes the "<NAME>.expand" function of each
+ * foreach function and reduction count, into the global
+ * RSInfo::KernelCountersName, the number of times it's called and the number
+ * of cells it's called on: three uint64_t per kernel (the calls, the cells
+ * and the time spent in the calls), the foreach functions first and then the
+ * reductions, in the order of the RS info. The other entry points of a
+ * kernel count through its "<NAME>.expand". The counters are atomic
+ * (monotonic) so that the threads of a launch don't lose each other's
+ * counts; that's one atomic add per call, not per cell.
+ *
+ * The time is only counted if asked for at the build, from the clock the
+ * runtime puts in RSInfo::KernelClockName (e.g., reading the cycle counter
+ * of the PMU, where it's accessible, or clock_gettime()), and not at all
+ * while there's no clock.
+ */
+class RSKernelCountersPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  std::vector<std::string> mNames;
+  bool mCycles;
+
+  enum {
+    kCalls,
+    kCells,
+    kTime,
+
+    kNumCountersPerKernel
+  };
+
+  /// @brief Returns a new internal function which returns the time of the
+  ///        clock of the runtime (0 while there's no clock.)
+  static llvm::Function *createClockReader(llvm::Module &M) {
+    llvm::LLVMContext &C = M.getContext();
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(C);
+    llvm::FunctionType *ClockTy = llvm::FunctionType::get(Int64Ty, false);
+    llvm::PointerType *ClockPtrTy = ClockTy->getPointerTo();
+
+    llvm::GlobalVariable *Clock = new llvm::GlobalVariable(
+        M, ClockPtrTy, /* isConstant */false,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantPointerNull::get(ClockPtrTy),
+        RSInfo::KernelClockName);
+
+    llvm::Function *Reader =
+        llvm::Function::Create(ClockTy, llvm::GlobalValue::InternalLinkage,
+                               std::string(RSInfo::KernelClockName) + ".read",
+                               &M);
+    llvm::BasicBlock *Entry = llvm::BasicBlock::Create(C, "entry", Reader);
+    llvm::BasicBlock *Call = llvm::BasicBlock::Create(C, "call", Reader);
+    llvm::BasicBlock *None = llvm::BasicBlock::Create(C, "none", Reader);
+
+    llvm::IRBuilder<> Builder(Entry);
+    llvm::Value *ClockFunc = Builder.CreateLoad(Clock, "clock");
+    Builder.CreateCondBr(Builder.CreateIsNull(ClockFunc), None, Call);
+
+    Builder.SetInsertPoint(Call);
+    Builder.CreateRet(Builder.CreateCall(ClockFunc));
+
+    Builder.SetInsertPoint(None);
+    Builder.CreateRet(Builder.getInt64(0));
+
+    return Reader;
+  }
+
+  static void emitAdd(llvm::IRBuilder<> &Builder,
+                      llvm::GlobalVariable *Counters, unsigned Index,
+                      llvm::Value *Value) {
+    llvm::Value *Idx[] = { Builder.getInt32(0), Builder.getInt32(Index) };
+    Builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                            Builder.CreateInBoundsGEP(Counters, Idx),
+                            Value, llvm::Monotonic);
+  }
+
+public:
+  RSKernelCountersPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                       const RSInfo::ExportReduceListTy &pReduces,
+                       bool pCycles)
+      : ModulePass(ID), mCycles(pCycles) {
+    const char *suffix = RSInfo::ExportForeachSuffixes[RSInfo::kForeachExpand];
+    for (RSInfo::ExportForeachFuncListTy::const_iterator
+             foreach_iter = pForeachFuncs.begin(),
+             foreach_end = pForeachFuncs.end();
+         foreach_iter != foreach_end; foreach_iter++) {
+      mNames.push_back(std::string(foreach_iter->first) + suffix);
+    }
+    for (RSInfo::ExportReduceListTy::const_iterator
+             reduce_iter = pReduces.begin(), reduce_end = pReduces.end();
+         reduce_iter != reduce_end; reduce_iter++) {
+      mNames.push_back(std::string(reduce_iter->name) + suffix);
+    }
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    if (mNames.empty()) {
+      return false;
+    }
+
+    // The globals are external so that they survive the LTO and the runtime
+    // finds them in the object.
+    llvm::LLVMContext &C = M.getContext();
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(C);
+    llvm::ArrayType *CountersTy =
+        llvm::ArrayType::get(Int64Ty, kNumCountersPerKernel * mNames.size());
+    llvm::GlobalVariable *Counters = new llvm::GlobalVariable(
+        M, CountersTy, /* isConstant */false,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::Constant::getNullValue(CountersTy), RSInfo::KernelCountersName);
+    Counters->setAlignment(64);
+
+    llvm::Function *ClockReader = (mCycles ? createClockReader(M) : NULL);
+
+    unsigned NumInstrumented = 0;
+    for (size_t i = 0, e = mNames.size(); i != e; i++) {
+      llvm::Function *F = M.getFunction(mNames[i]);
+      if ((F == NULL) || F->isDeclaration() || (F->arg_size() < 3)) {
+        continue;
+      }
+      unsigned Base = kNumCountersPerKernel * i;
+
+      // The expanded functions take (p, x1, x2, ...).
+      llvm::Function::arg_iterator AI = F->arg_begin();
+      llvm::Value *X1 = ++AI;
+      llvm::Value *X2 = ++AI;
+
+      llvm::IRBuilder<> Builder(F->getEntryBlock().getFirstInsertionPt());
+      emitAdd(Builder, Counters, Base + kCalls, Builder.getInt64(1));
+      emitAdd(Builder, Counters, Base + kCells,
+              Builder.CreateZExt(Builder.CreateSub(X2, X1), Int64Ty));
+
+      if (ClockReader != NULL) {
+        llvm::Value *Start = Builder.CreateCall(ClockReader, "start");
+        for (llvm::Function::iterator BB = F->begin(), BE = F->end();
+             BB != BE; ++BB) {
+          llvm::ReturnInst *Ret =
+              llvm::dyn_cast<llvm::ReturnInst>(BB->getTerminator());
+          if (Ret == NULL) {
+            continue;
+          }
+          Builder.SetInsertPoint(Ret);
+          llvm::Value *End = Builder.CreateCall(ClockReader, "end");
+          emitAdd(Builder, Counters, Base + kTime,
+                  Builder.CreateSub(End, Start));
+        }
+      }
+      NumInstrumented++;
+    }
+
+    ALOGV("%u kernels of %s count their calls%s", NumInstrumented,
+          M.getModuleIdentifier().c_str(),
+          ((ClockReader != NULL) ? " and time" : ""));
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "RS Kernel Counters";
+  }
+
+};  // end RSKernelCountersPass
+
+}  // end anonymous namespace
+
+char RSKernelCountersPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSKernelCountersPass(const RSInfo::ExportForeachFuncListTy
+                               &pForeachFuncs,
+                           const RSInfo::ExportReduceListTy &pReduces,
+                           bool pCycles) {
+  return new RSKernelCountersPass(pForeachFuncs, pReduces, pCycles);
+}
+
+}  // end namespace bcc
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <set>
+#include <string>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Suffix of the expanded functions of a kernel (see RSForEachExpandPass.)
+const char expand_suffix[] = ".expand";
+
+// Suffix of the functions of the accelerated math library (should be synced
+// with RSScript.cpp.)
+const char relaxed_library_suffix[] = ".neon";
+
+/* RSPreciseFPPass - This pass keeps the functions of a full-precision script
+ * that is compiled with NEON (since some of its kernels are relaxed, see
+ * RSInfo::getRelaxedFPKernels()) off the NEON floating point unit, which
+ * flushes the denormals to zero and rounds to nearest only. Their vector
+ * floating point operations are split into scalar ones, which are computed
+ * by VFP in IEEE 754 mode. The loads, the stores and the shuffles of the
+ * vectors are left alone since they don't compute.
+ */
+class RSPreciseFPPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  std::set<std::string> mRelaxedKernels;
+
+  /// @brief Returns whether F may compute with relaxed precision.
+  bool isRelaxed(const llvm::Function &F) const {
+    llvm::StringRef Name = F.getName();
+    if (Name.endswith(relaxed_library_suffix)) {
+      return true;
+    }
+    size_t Pos = Name.find(expand_suffix);
+    if (Pos != llvm::StringRef::npos) {
+      Name = Name.substr(0, Pos);
+    }
+    return mRelaxedKernels.count(Name);
+  }
+
+  static bool isFPVector(const llvm::Type *T) {
+    const llvm::VectorType *VT = llvm::dyn_cast<llvm::VectorType>(T);
+    return (VT != NULL) && VT->getElementType()->isFloatingPointTy();
+  }
+
+  /// @brief Returns whether the lanes of the intrinsic ID are computed
+  ///        independently from the same lanes of its operands.
+  static bool isElementwiseIntrinsic(llvm::Intrinsic::ID ID) {
+    switch (ID) {
+      case llvm::Intrinsic::sqrt:
+      case llvm::Intrinsic::fabs:
+      case llvm::Intrinsic::floor:
+      case llvm::Intrinsic::ceil:
+      case llvm::Intrinsic::trunc:
+      case llvm::Intrinsic::rint:
+      case llvm::Intrinsic::nearbyint:
+      case llvm::Intrinsic::pow:
+      case llvm::Intrinsic::fma:
+      case llvm::Intrinsic::fmuladd:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  /// @brief Returns whether I computes on floating point vectors and can be
+  ///        computed lane by lane instead.
+  static bool needsScalarizing(const llvm::Instruction &I) {
+    if (const llvm::IntrinsicInst *II =
+            llvm::dyn_cast<llvm::IntrinsicInst>(&I)) {
+      return isElementwiseIntrinsic(II->getIntrinsicID()) &&
+             isFPVector(II->getType());
+    }
+
+    switch (I.getOpcode()) {
+      case llvm::Instruction::FAdd:
+      case llvm::Instruction::FSub:
+      case llvm::Instruction::FMul:
+      case llvm::Instruction::FDiv:
+      case llvm::Instruction::FRem:
+      case llvm::Instruction::FPTrunc:
+      case llvm::Instruction::FPExt:
+      case llvm::Instruction::SIToFP:
+      case llvm::Instruction::UIToFP:
+        return isFPVector(I.getType());
+      case llvm::Instruction::FCmp:
+      case llvm::Instruction::FPToSI:
+      case llvm::Instruction::FPToUI:
+        return isFPVector(I.getOperand(0)->getType());
+      default:
+        return false;
+    }
+  }
+
+  /// @brief Replaces I with the equivalent scalar operations on each lane.
+  void scalarize(llvm::Instruction *I) {
+    llvm::Module *M = I->getParent()->getParent()->getParent();
+    llvm::VectorType *ResultTy = llvm::cast<llvm::VectorType>(I->getType());
+    llvm::Type *ElementTy = ResultTy->getElementType();
+    llvm::IRBuilder<> Builder(I);
+
+    llvm::Function *ScalarIntrinsic = NULL;
+    unsigned NumOperands = I->getNumOperands();
+    if (llvm::IntrinsicInst *II = llvm::dyn_cast<llvm::IntrinsicInst>(I)) {
+      ScalarIntrinsic = llvm::Intrinsic::getDeclaration(M,
+                                                        II->getIntrinsicID(),
+                                                        ElementTy);
+      NumOperands = II->getNumArgOperands();
+    }
+
+    llvm::Value *Result = llvm::UndefValue::get(ResultTy);
+    for (unsigned Lane = 0, E = ResultTy->getNumElements(); Lane != E;
+         Lane++) {
+      llvm::SmallVector<llvm::Value *, 3> Ops;
+      for (unsigned i = 0; i < NumOperands; i++) {
+        Ops.push_back(Builder.CreateExtractElement(I->getOperand(i),
+                                                   Builder.getInt32(Lane)));
+      }
+
+      llvm::Value *Scalar;
+      if (ScalarIntrinsic != NULL) {
+        Scalar = Builder.CreateCall(ScalarIntrinsic, Ops);
+      } else if (llvm::FCmpInst *Cmp = llvm::dyn_cast<llvm::FCmpInst>(I)) {
+        Scalar = Builder.CreateFCmp(Cmp->getPredicate(), Ops[0], Ops[1]);
+      } else if (llvm::CastInst *Cast = llvm::dyn_cast<llvm::CastInst>(I)) {
+        Scalar = Builder.CreateCast(Cast->getOpcode(), Ops[0], ElementTy);
+      } else {
+        Scalar = Builder.CreateBinOp(
+            llvm::cast<llvm::BinaryOperator>(I)->getOpcode(), Ops[0], Ops[1]);
+      }
+
+      Result = Builder.CreateInsertElement(Result, Scalar,
+                                           Builder.getInt32(Lane));
+    }
+
+    Result->takeName(I);
+    I->replaceAllUsesWith(Result);
+    I->eraseFromParent();
+  }
+
+public:
+  RSPreciseFPPass(const std::set<std::string> &pRelaxedKernels)
+      : ModulePass(ID), mRelaxedKernels(pRelaxedKernels) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    llvm::SmallVector<llvm::Instruction *, 32> Worklist;
+
+    for (llvm::Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+      if (F->isDeclaration() || isRelaxed(*F)) {
+        continue;
+      }
+      for (llvm::Function::iterator BB = F->begin(), BBE = F->end();
+           BB != BBE; ++BB) {
+        for (llvm::BasicBlock::iterator I = BB->begin(), IE = BB->end();
+             I != IE; ++I) {
+          if (needsScalarizing(*I)) {
+            Worklist.push_back(I);
+          }
+        }
+      }
+    }
+
+    ALOGV("Scalarize %u vector floating point operations for full precision",
+          static_cast<unsigned>(Worklist.size()));
+    for (unsigned i = 0, e = Worklist.size(); i != e; i++) {
+      scalarize(Worklist[i]);
+    }
+
+    return !Worklist.empty();
+  }
+
+  virtual const char *getPassName() const {
+    return "Full-Precision Floating Point Scalarization";
+  }
+
+};  // end RSPreciseFPPass
+
+}  // end anonymous namespace
+
+char RSPreciseFPPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSPreciseFPPass(const std::set<std::string> &pRelaxedKernels) {
+  return new RSPreciseFPPass(pRelaxedKernels);
+}
+
+}  // end namespace bcc
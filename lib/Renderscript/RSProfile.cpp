@@ -0,0 +1,137 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSProfile.h"
+
+#include <cstring>
+#include <new>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/system_error.h>
+
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+
+#include <utils/FileMap.h>
+
+using namespace bcc;
+
+const char RSProfile::CountersName[] = ".rs.profile.counters";
+const char RSProfile::NumCountersName[] = ".rs.profile.num_counters";
+const char RSProfile::SourceName[] = ".rs.profile.source";
+
+const uint8_t RSProfile::InstrumentedDigest[SHA1_DIGEST_LENGTH] = { 0 };
+
+android::String8 RSProfile::GetPath(const char *pObjPath) {
+  llvm::SmallString<80> result(pObjPath);
+  llvm::sys::path::replace_extension(result, ".prof");
+  return android::String8(result.c_str());
+}
+
+RSProfile *RSProfile::Read(const char *pPath, const uint8_t *pSourceSHA1) {
+  InputFile input(pPath);
+  if (input.hasError()) {
+    if (input.getError().value() != llvm::errc::no_such_file_or_directory) {
+      ALOGW("Unable to open the RS profile %s! (%s)", pPath,
+            input.getErrorMessage().c_str());
+    }
+    return NULL;
+  }
+
+  size_t file_size = input.getSize();
+  if (input.hasError() || (file_size < sizeof(rsprofile::Header))) {
+    ALOGW("Invalid RS profile %s!", pPath);
+    return NULL;
+  }
+
+  android::FileMap *map = input.createMap(0, file_size);
+  if (map == NULL) {
+    ALOGW("Failed to map the RS profile %s! (%s)", pPath,
+          input.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  const rsprofile::Header *header =
+      reinterpret_cast<const rsprofile::Header *>(data);
+  RSProfile *result = NULL;
+
+  if ((::memcmp(header->magic, RSPROFILE_MAGIC, sizeof(header->magic)) != 0) ||
+      (::memcmp(header->version, RSPROFILE_VERSION,
+                sizeof(header->version)) != 0) ||
+      (header->headerSize != sizeof(*header)) ||
+      (header->numCounters != ((file_size - sizeof(*header)) /
+                                  sizeof(uint64_t)))) {
+    ALOGW("Ignore the invalid RS profile %s.", pPath);
+  } else if (::memcmp(header->sourceSHA1, pSourceSHA1,
+                      SHA1_DIGEST_LENGTH) != 0) {
+    ALOGD("Ignore the RS profile %s of another version of the script.", pPath);
+  } else {
+    result = new (std::nothrow) RSProfile();
+    if (result == NULL) {
+      ALOGE("Out of memory when read the RS profile %s!", pPath);
+    } else {
+      const uint8_t *counters = data + sizeof(*header);
+      result->mPath.setTo(pPath);
+      result->mCounters.resize(header->numCounters);
+      if (header->numCounters > 0) {
+        ::memcpy(&result->mCounters[0], counters,
+                 header->numCounters * sizeof(uint64_t));
+      }
+      Sha1Util::GetSHA1DigestFromBuffer(result->mSHA1, data, file_size);
+    }
+  }
+
+  map->release();
+  return result;
+}
+
+bool RSProfile::Accumulate(const char *pPath, const uint8_t *pSourceSHA1,
+                           const uint64_t *pCounters, size_t pNumCounters) {
+  rsprofile::Header header;
+  ::memset(&header, 0, sizeof(header));
+  ::memcpy(header.magic, RSPROFILE_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, RSPROFILE_VERSION, sizeof(header.version));
+  header.headerSize = sizeof(header);
+  ::memcpy(header.sourceSHA1, pSourceSHA1, SHA1_DIGEST_LENGTH);
+  header.numCounters = pNumCounters;
+
+  std::vector<uint64_t> counters(pCounters, pCounters + pNumCounters);
+  RSProfile *previous = Read(pPath, pSourceSHA1);
+  if ((previous != NULL) && (previous->mCounters.size() == pNumCounters)) {
+    for (size_t i = 0; i < pNumCounters; i++) {
+      counters[i] += previous->mCounters[i];
+    }
+  }
+  delete previous;
+
+  AtomicOutputFile output(pPath, FileBase::kBinary);
+  size_t counters_size = pNumCounters * sizeof(uint64_t);
+  if (output.hasError() ||
+      (output.write(&header, sizeof(header)) != sizeof(header)) ||
+      ((counters_size > 0) &&
+       (static_cast<size_t>(output.write(&counters[0], counters_size)) !=
+            counters_size)) ||
+      !output.commit()) {
+    ALOGE("Failed to write the RS profile %s! (%s)", pPath,
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Renderscript/RSProfile.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Collect the names of the functions of pInfo to profile: the invokables, the
+// kernels and the reductions, as well as their expanded functions.
+void GetProfiledFunctionNames(const RSInfo &pInfo,
+                              std::set<std::string> &pNames) {
+  const RSInfo::ExportFuncNameListTy &funcs = pInfo.getExportFuncNames();
+  for (RSInfo::ExportFuncNameListTy::const_iterator func_iter = funcs.begin(),
+           func_end = funcs.end(); func_iter != func_end; func_iter++) {
+    pNames.insert(*func_iter);
+  }
+
+  std::vector<std::string> kernels;
+  const RSInfo::ExportForeachFuncListTy &foreach_funcs =
+      pInfo.getExportForeachFuncs();
+  for (RSInfo::ExportForeachFuncListTy::const_iterator
+           foreach_iter = foreach_funcs.begin(),
+           foreach_end = foreach_funcs.end();
+       foreach_iter != foreach_end; foreach_iter++) {
+    kernels.push_back(foreach_iter->first);
+  }
+
+  const RSInfo::ExportReduceListTy &reduces = pInfo.getExportReduces();
+  for (RSInfo::ExportReduceListTy::const_iterator
+           reduce_iter = reduces.begin(), reduce_end = reduces.end();
+       reduce_iter != reduce_end; reduce_iter++) {
+    kernels.push_back(reduce_iter->name);
+  }
+
+  for (size_t i = 0; i < kernels.size(); i++) {
+    pNames.insert(kernels[i]);
+    for (unsigned j = 0; j < RSInfo::kNumForeachVariants; j++) {
+      pNames.insert(kernels[i] + RSInfo::ExportForeachSuffixes[j]);
+    }
+  }
+}
+
+// The profiled functions of pM in the order of pM, along with the conditional
+// branches of each of them in the order of its blocks. This order is the
+// layout of the profile (see RSProfile), so both passes below must see the
+// same module: they run at the same point of the pipeline.
+struct ProfiledFunction {
+  llvm::Function *mFunc;
+  llvm::SmallVector<llvm::BranchInst *, 8> mBranches;
+};
+
+size_t CollectProfiledFunctions(llvm::Module &pM,
+                                const std::set<std::string> &pNames,
+                                std::vector<ProfiledFunction> &pResult) {
+  size_t num_counters = 0;
+
+  for (llvm::Module::iterator F = pM.begin(), FE = pM.end(); F != FE; ++F) {
+    if (F->isDeclaration() || !pNames.count(F->getName())) {
+      continue;
+    }
+
+    pResult.push_back(ProfiledFunction());
+    ProfiledFunction &profiled = pResult.back();
+    profiled.mFunc = F;
+    for (llvm::Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE;
+         ++BB) {
+      llvm::BranchInst *Br =
+          llvm::dyn_cast<llvm::BranchInst>(BB->getTerminator());
+      if ((Br != NULL) && Br->isConditional()) {
+        profiled.mBranches.push_back(Br);
+      }
+    }
+
+    num_counters += 1 + 2 * profiled.mBranches.size();
+  }
+
+  return num_counters;
+}
+
+/* RSProfileInstrumentPass - This pass makes each profiled function count how
+ * many times it's entered and each of its conditional branches count how many
+ * times it goes either way into the global array .rs.profile.counters (see
+ * RSProfile.) The counters are plain (non-atomic) increments.
+ */
+class RSProfileInstrumentPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  std::set<std::string> mNames;
+  uint8_t mSourceSHA1[SHA1_DIGEST_LENGTH];
+
+  static void emitIncrement(llvm::IRBuilder<> &Builder,
+                            llvm::GlobalVariable *Counters,
+                            llvm::Value *Index) {
+    llvm::Value *Idx[] = { Builder.getInt32(0), Index };
+    llvm::Value *Ptr = Builder.CreateInBoundsGEP(Counters, Idx);
+    llvm::Value *Count = Builder.CreateLoad(Ptr);
+    Builder.CreateStore(Builder.CreateAdd(Count, Builder.getInt64(1)), Ptr);
+  }
+
+public:
+  RSProfileInstrumentPass(const RSInfo &pInfo, const uint8_t *pSourceSHA1)
+      : ModulePass(ID) {
+    GetProfiledFunctionNames(pInfo, mNames);
+    ::memcpy(mSourceSHA1, pSourceSHA1, SHA1_DIGEST_LENGTH);
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    llvm::LLVMContext &C = M.getContext();
+    std::vector<ProfiledFunction> Funcs;
+    size_t NumCounters = CollectProfiledFunctions(M, mNames, Funcs);
+
+    // The globals are external so that they survive the LTO and the runtime
+    // finds them in the object.
+    llvm::ArrayType *CountersTy =
+        llvm::ArrayType::get(llvm::Type::getInt64Ty(C), NumCounters);
+    llvm::GlobalVariable *Counters = new llvm::GlobalVariable(
+        M, CountersTy, /* isConstant */false,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::Constant::getNullValue(CountersTy), RSProfile::CountersName);
+
+    new llvm::GlobalVariable(
+        M, llvm::Type::getInt32Ty(C), /* isConstant */true,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), NumCounters),
+        RSProfile::NumCountersName);
+
+    llvm::Constant *Source = llvm::ConstantDataArray::get(
+        C, llvm::ArrayRef<uint8_t>(mSourceSHA1, SHA1_DIGEST_LENGTH));
+    new llvm::GlobalVariable(M, Source->getType(), /* isConstant */true,
+                             llvm::GlobalValue::ExternalLinkage, Source,
+                             RSProfile::SourceName);
+
+    uint32_t Index = 0;
+    for (size_t i = 0; i < Funcs.size(); i++) {
+      llvm::Function *F = Funcs[i].mFunc;
+      llvm::IRBuilder<> Builder(F->getEntryBlock().getFirstInsertionPt());
+      emitIncrement(Builder, Counters, Builder.getInt32(Index++));
+
+      for (size_t j = 0; j < Funcs[i].mBranches.size(); j++) {
+        llvm::BranchInst *Br = Funcs[i].mBranches[j];
+        Builder.SetInsertPoint(Br);
+        llvm::Value *Edge = Builder.CreateSelect(Br->getCondition(),
+                                                 Builder.getInt32(Index),
+                                                 Builder.getInt32(Index + 1));
+        emitIncrement(Builder, Counters, Edge);
+        Index += 2;
+      }
+    }
+
+    ALOGV("Instrumented %u functions of %s with %u counters",
+          static_cast<unsigned>(Funcs.size()),
+          M.getModuleIdentifier().c_str(), static_cast<unsigned>(NumCounters));
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "RS Profile Instrumentation";
+  }
+
+};  // end RSProfileInstrumentPass
+
+/* RSProfileAnnotatePass - This pass applies the counters of an RSProfile
+ * collected from the same module: the conditional branches get their
+ * branch_weights (used by the block placement and the branch probability
+ * analyses), the functions that never ran are optimized for size (which also
+ * keeps their loops from being unrolled) and the hot ones get an inline hint.
+ */
+class RSProfileAnnotatePass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  std::set<std::string> mNames;
+  std::vector<uint64_t> mCounters;
+
+  // A function entered at least 1/HotFraction times as often as the most
+  // entered one is hot.
+  static const uint64_t HotFraction = 8;
+
+  static bool isExpanded(const llvm::Function &F) {
+    return (F.getName().find(
+        RSInfo::ExportForeachSuffixes[RSInfo::kForeachExpand]) !=
+            llvm::StringRef::npos);
+  }
+
+public:
+  RSProfileAnnotatePass(const RSInfo &pInfo,
+                        const std::vector<uint64_t> &pCounters)
+      : ModulePass(ID), mCounters(pCounters) {
+    GetProfiledFunctionNames(pInfo, mNames);
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    std::vector<ProfiledFunction> Funcs;
+    size_t NumCounters = CollectProfiledFunctions(M, mNames, Funcs);
+    if (NumCounters != mCounters.size()) {
+      ALOGW("Ignore the profile of %s with %u counters (expected: %u)",
+            M.getModuleIdentifier().c_str(),
+            static_cast<unsigned>(mCounters.size()),
+            static_cast<unsigned>(NumCounters));
+      return false;
+    }
+
+    uint64_t MaxEntries = 0;
+    for (size_t i = 0, Index = 0; i < Funcs.size(); i++) {
+      if (!isExpanded(*Funcs[i].mFunc) && (mCounters[Index] > MaxEntries)) {
+        MaxEntries = mCounters[Index];
+      }
+      Index += 1 + 2 * Funcs[i].mBranches.size();
+    }
+
+    llvm::MDBuilder MDB(M.getContext());
+    size_t Index = 0;
+    for (size_t i = 0; i < Funcs.size(); i++) {
+      llvm::Function *F = Funcs[i].mFunc;
+      uint64_t Entries = mCounters[Index++];
+
+      if (Entries == 0) {
+        F->addFnAttr(llvm::Attribute::OptimizeForSize);
+      } else if (!isExpanded(*F) &&
+                 (Entries >= (MaxEntries / HotFraction))) {
+        F->addFnAttr(llvm::Attribute::InlineHint);
+      }
+
+      for (size_t j = 0; j < Funcs[i].mBranches.size(); j++) {
+        uint64_t Taken = mCounters[Index];
+        uint64_t NotTaken = mCounters[Index + 1];
+        Index += 2;
+        if ((Taken == 0) && (NotTaken == 0)) {
+          continue;
+        }
+
+        // Scale the counts down to the 32-bit weights. The weights are
+        // never 0, as an edge that didn't run in the profile may still run.
+        uint64_t Scale = (std::max(Taken, NotTaken) >> 31) + 1;
+        Funcs[i].mBranches[j]->setMetadata(
+            llvm::LLVMContext::MD_prof,
+            MDB.createBranchWeights(static_cast<uint32_t>(Taken / Scale) + 1,
+                                    static_cast<uint32_t>(NotTaken / Scale) +
+                                        1));
+      }
+    }
+
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "RS Profile Annotation";
+  }
+
+};  // end RSProfileAnnotatePass
+
+}  // end anonymous namespace
+
+char RSProfileInstrumentPass::ID = 0;
+char RSProfileAnnotatePass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSProfileInstrumentPass(const RSInfo &pInfo,
+                              const uint8_t *pSourceSHA1) {
+  return new RSProfileInstrumentPass(pInfo, pSourceSHA1);
+}
+
+llvm::ModulePass *
+createRSProfileAnnotatePass(const RSInfo &pInfo,
+                            const std::vector<uint64_t> &pCounters) {
+  return new RSProfileAnnotatePass(pInfo, pCounters);
+}
+
+}  // end namespace bcc
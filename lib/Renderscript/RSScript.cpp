@@ -16,12 +16,84 @@
 
 #include "bcc/Renderscript/RSScript.h"
 
+#include <set>
+#include <string>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include "bcc/BCCContext.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Source.h"
 #include "bcc/Support/Log.h"
 
 using namespace bcc;
 
+#if defined(ARCH_ARM_HAVE_NEON)
+namespace {
+
+// Suffix of the functions of the accelerated math library linked for the
+// relaxed kernels of a full-precision script (see
+// RSInfo::getRelaxedFPKernels().)
+const char relaxed_library_suffix[] = ".neon";
+
+// Make the calls of the kernels pKernels in pModule to the functions that
+// pLibrary defines call them under their names with relaxed_library_suffix
+// instead. The calls of the functions the kernels call are left alone.
+// Return the number of calls redirected or -1 on error.
+int RedirectRelaxedCalls(llvm::Module &pModule,
+                         const std::set<std::string> &pKernels,
+                         llvm::Module &pLibrary) {
+  int count = 0;
+
+  for (std::set<std::string>::const_iterator kernel_iter = pKernels.begin(),
+           kernel_end = pKernels.end(); kernel_iter != kernel_end;
+       kernel_iter++) {
+    llvm::Function *kernel = pModule.getFunction(*kernel_iter);
+    std::string error;
+    if (kernel == NULL) {
+      ALOGW("Ignore the unknown relaxed kernel '%s'.", kernel_iter->c_str());
+      continue;
+    }
+    if (kernel->isMaterializable() && kernel->Materialize(&error)) {
+      ALOGE("Failed to materialize the kernel '%s'! (%s)",
+            kernel_iter->c_str(), error.c_str());
+      return -1;
+    }
+
+    for (llvm::Function::iterator bb_iter = kernel->begin(),
+             bb_end = kernel->end(); bb_iter != bb_end; bb_iter++) {
+      for (llvm::BasicBlock::iterator inst_iter = bb_iter->begin(),
+               inst_end = bb_iter->end(); inst_iter != inst_end; inst_iter++) {
+        llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(inst_iter);
+        llvm::Function *callee =
+            (call != NULL) ? call->getCalledFunction() : NULL;
+        if ((callee == NULL) || !callee->isDeclaration() ||
+            callee->isMaterializable() || callee->isIntrinsic()) {
+          continue;
+        }
+
+        llvm::Function *definition = pLibrary.getFunction(callee->getName());
+        if ((definition == NULL) || (definition->isDeclaration() &&
+                                     !definition->isMaterializable())) {
+          continue;
+        }
+
+        call->setCalledFunction(pModule.getOrInsertFunction(
+            callee->getName().str() + relaxed_library_suffix,
+            callee->getFunctionType(), callee->getAttributes()));
+        count++;
+      }
+    }
+  }
+
+  return count;
+}
+
+} // end anonymous namespace
+#endif
+
 bool RSScript::LinkRuntime(RSScript &pScript, const char *rt_path) {
   // Using the same context with the source in pScript.
   BCCContext &context = pScript.getSource().getContext();
@@ -46,7 +118,16 @@ bool RSScript::LinkRuntime(RSScript &pScript, const char *rt_path) {
     core_lib = rt_path;
   }
 
-  Source *libclcore_source = Source::CreateFromFile(context, core_lib);
+  // The callback is allowed to change the library module. Only share the
+  // library kept in the context if there's none.
+  bool share_library = (pScript.mLinkRuntimeCallback == NULL);
+
+  Source *libclcore_source = NULL;
+  if (share_library) {
+    libclcore_source = context.getOrLoadLibrary(core_lib);
+  } else {
+    libclcore_source = Source::CreateFromFile(context, core_lib);
+  }
   if (libclcore_source == NULL) {
     ALOGE("Failed to load Renderscript library '%s' to link!", core_lib);
     return false;
@@ -57,8 +138,48 @@ bool RSScript::LinkRuntime(RSScript &pScript, const char *rt_path) {
         &pScript.getSource().getModule(), &libclcore_source->getModule());
   }
 
-  if (!pScript.getSource().merge(*libclcore_source,
-                                 /* pPreserveSource */false)) {
+#if defined(ARCH_ARM_HAVE_NEON)
+  // The relaxed kernels of a full-precision script use the accelerated
+  // library. It's linked first under suffixed names so that the precise one
+  // resolves the rest of the script (including what the accelerated
+  // functions call.)
+  std::set<std::string> relaxed_kernels;
+  if ((info != NULL) && (rt_path == NULL) && share_library) {
+    info->getRelaxedFPKernels(relaxed_kernels);
+  }
+  if (!relaxed_kernels.empty()) {
+    Source *neon_source = context.getOrLoadLibrary(RSInfo::LibCLCoreNEONPath);
+    if (neon_source == NULL) {
+      ALOGE("Failed to load Renderscript library '%s' to link!",
+            RSInfo::LibCLCoreNEONPath);
+      return false;
+    }
+
+    int redirected = RedirectRelaxedCalls(pScript.getSource().getModule(),
+                                          relaxed_kernels,
+                                          neon_source->getModule());
+    if (redirected < 0) {
+      return false;
+    }
+    if ((redirected > 0) &&
+        !pScript.getSource().mergeReferenced(*neon_source,
+                                             relaxed_library_suffix)) {
+      ALOGE("Failed to link Renderscript library '%s'!",
+            RSInfo::LibCLCoreNEONPath);
+      return false;
+    }
+  }
+#endif
+
+  if (share_library) {
+    // Only bring in the library functions the script actually uses. This
+    // keeps the module small for LTO.
+    if (!pScript.getSource().mergeReferenced(*libclcore_source)) {
+      ALOGE("Failed to link Renderscript library '%s'!", core_lib);
+      return false;
+    }
+  } else if (!pScript.getSource().merge(*libclcore_source,
+                                        /* pPreserveSource */false)) {
     ALOGE("Failed to link Renderscript library '%s'!", core_lib);
     delete libclcore_source;
     return false;
@@ -70,11 +191,21 @@ bool RSScript::LinkRuntime(RSScript &pScript, const char *rt_path) {
 RSScript::RSScript(Source &pSource)
   : Script(pSource), mInfo(NULL), mCompilerVersion(0),
     mOptimizationLevel(kOptLvl3), mLinkRuntimeCallback(NULL),
-    mEmbedInfo(false) { }
+    mEmbedInfo(false), mEmbedBinaryInfo(false), mProfileSourceSHA1(NULL),
+    mProfile(NULL), mUsedExports(NULL), mExportConstants(NULL),
+    mObjectSizeHint(0), mSourceFingerprint(0), mSourceSHA1(NULL),
+    mBundlePrefixes(NULL), mExportVarBlock(false),
+    mReducedRelocations(false), mKernelCounters(false),
+    mKernelCycleCounters(false) { }
 
 bool RSScript::doReset() {
   mInfo = NULL;
   mCompilerVersion = 0;
   mOptimizationLevel = kOptLvl3;
+  mProfileSourceSHA1 = NULL;
+  mProfile = NULL;
+  mObjectSizeHint = 0;
+  mSourceFingerprint = 0;
+  mSourceSHA1 = NULL;
   return true;
 }
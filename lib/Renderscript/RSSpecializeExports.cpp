@@ -0,0 +1,189 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <cstring>
+#include <string>
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+/* RSSpecializeExportsPass - This pass folds the export variables given with
+ * their values (see RSScript::setExportConstants()) into the script. The
+ * uses of each of them in the code are redirected to an internal constant
+ * copy, which the LTO propagates through the kernels and their expanded
+ * loops (e.g., a constant radius lets the inner loop of a convolution be
+ * unrolled.) The export itself is initialized with the value and stays
+ * writable and visible to the runtime, but the code ignores the later
+ * writes to it.
+ */
+class RSSpecializeExportsPass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  RSScript::ExportConstantMapTy mConstants;
+
+  /// @brief Returns the constant of type T stored in the Size bytes at Data
+  ///        (in the layout DL of the target) or NULL if T can't be
+  ///        specialized (e.g., it holds pointers or RS objects.)
+  static llvm::Constant *getConstant(const llvm::DataLayout &DL,
+                                     llvm::Type *T, const uint8_t *Data,
+                                     size_t Size) {
+    if (DL.getTypeStoreSize(T) > Size) {
+      return NULL;
+    }
+
+    if (llvm::IntegerType *IT = llvm::dyn_cast<llvm::IntegerType>(T)) {
+      unsigned NumBytes = (IT->getBitWidth() + 7) / 8;
+      if (NumBytes > sizeof(uint64_t)) {
+        return NULL;
+      }
+      // The targets are little-endian.
+      uint64_t Value = 0;
+      for (unsigned i = 0; i < NumBytes; i++) {
+        Value |= static_cast<uint64_t>(Data[i]) << (8 * i);
+      }
+      return llvm::ConstantInt::get(IT, llvm::APInt(IT->getBitWidth(),
+                                                    Value));
+    } else if (T->isFloatTy()) {
+      float Value;
+      ::memcpy(&Value, Data, sizeof(Value));
+      return llvm::ConstantFP::get(T, Value);
+    } else if (T->isDoubleTy()) {
+      double Value;
+      ::memcpy(&Value, Data, sizeof(Value));
+      return llvm::ConstantFP::get(T, Value);
+    } else if (llvm::SequentialType *ST =
+                   llvm::dyn_cast<llvm::SequentialType>(T)) {
+      unsigned NumElements;
+      if (llvm::VectorType *VT = llvm::dyn_cast<llvm::VectorType>(T)) {
+        NumElements = VT->getNumElements();
+      } else if (llvm::ArrayType *AT = llvm::dyn_cast<llvm::ArrayType>(T)) {
+        NumElements = AT->getNumElements();
+      } else {
+        // Pointers.
+        return NULL;
+      }
+
+      llvm::Type *ElementTy = ST->getElementType();
+      uint64_t Stride = DL.getTypeAllocSize(ElementTy);
+      llvm::SmallVector<llvm::Constant *, 16> Elements;
+      for (unsigned i = 0; i < NumElements; i++) {
+        llvm::Constant *Element = getConstant(DL, ElementTy,
+                                              Data + i * Stride,
+                                              Size - i * Stride);
+        if (Element == NULL) {
+          return NULL;
+        }
+        Elements.push_back(Element);
+      }
+
+      if (T->isVectorTy()) {
+        return llvm::ConstantVector::get(Elements);
+      }
+      return llvm::ConstantArray::get(llvm::cast<llvm::ArrayType>(T),
+                                      Elements);
+    } else if (llvm::StructType *ST = llvm::dyn_cast<llvm::StructType>(T)) {
+      const llvm::StructLayout *Layout = DL.getStructLayout(ST);
+      llvm::SmallVector<llvm::Constant *, 8> Elements;
+      for (unsigned i = 0, e = ST->getNumElements(); i != e; i++) {
+        uint64_t Offset = Layout->getElementOffset(i);
+        llvm::Constant *Element = getConstant(DL, ST->getElementType(i),
+                                              Data + Offset, Size - Offset);
+        if (Element == NULL) {
+          return NULL;
+        }
+        Elements.push_back(Element);
+      }
+      return llvm::ConstantStruct::get(ST, Elements);
+    }
+
+    return NULL;
+  }
+
+public:
+  RSSpecializeExportsPass(const RSScript::ExportConstantMapTy &pConstants)
+      : ModulePass(ID), mConstants(pConstants) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    llvm::DataLayout DL(&M);
+    bool Changed = false;
+
+    for (RSScript::ExportConstantMapTy::const_iterator
+             I = mConstants.begin(), E = mConstants.end(); I != E; ++I) {
+      llvm::GlobalVariable *GV = M.getNamedGlobal(I->first);
+      if ((GV == NULL) || GV->isDeclaration()) {
+        ALOGW("Unable to specialize %s on the missing export variable %s!",
+              M.getModuleIdentifier().c_str(), I->first.c_str());
+        continue;
+      }
+
+      llvm::Type *T = GV->getType()->getElementType();
+      llvm::Constant *Value =
+          getConstant(DL, T, reinterpret_cast<const uint8_t *>(
+                                 I->second.data()), I->second.size());
+      if (Value == NULL) {
+        ALOGW("Unable to specialize %s on the export variable %s (of "
+              "unsupported type or size %u)", M.getModuleIdentifier().c_str(),
+              I->first.c_str(), static_cast<unsigned>(I->second.size()));
+        continue;
+      }
+
+      llvm::GlobalVariable *Copy =
+          new llvm::GlobalVariable(M, T, /* isConstant */true,
+                                   llvm::GlobalValue::InternalLinkage, Value,
+                                   I->first + ".const");
+      Copy->setAlignment(GV->getAlignment());
+      GV->replaceAllUsesWith(Copy);
+      GV->setInitializer(Value);
+      Changed = true;
+    }
+
+    return Changed;
+  }
+
+  virtual const char *getPassName() const {
+    return "RS Export Variable Specialization";
+  }
+
+};  // end RSSpecializeExportsPass
+
+}  // end anonymous namespace
+
+char RSSpecializeExportsPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSSpecializeExportsPass(const RSScript::ExportConstantMapTy &pConstants) {
+  return new RSSpecializeExportsPass(pConstants);
+}
+
+}  // end namespace bcc
@@ -22,14 +22,24 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_support_SRC_FILES := \
+  AtomicOutputFile.cpp \
+  CPUProfile.cpp \
+  CRC32C.cpp \
+  CacheWriter.cpp \
+  CompileServer.cpp \
   CompilerConfig.cpp \
+  CompilerStats.cpp \
   Disassembler.cpp \
   FileBase.cpp \
   Initialization.cpp \
   InputFile.cpp \
+  LZ4.cpp \
   OutputFile.cpp \
+  PhaseTimer.cpp \
+  Sha1Hardware.cpp \
   Sha1Util.cpp \
-  TargetCompilerConfigs.cpp
+  TargetCompilerConfigs.cpp \
+  Trace.cpp
 
 #=====================================================================
 # Device Static Library: libbccSupport
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/AtomicOutputFile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Atomic.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Distinguishes the temporary files of the threads in this process.
+volatile llvm::sys::cas_flag gTemporaryFileCounter = 0;
+
+#if !defined(_WIN32)
+// Flush the directory entries of the directory containing pFilename.
+bool SyncParentDirectory(const std::string &pFilename) {
+  llvm::SmallString<80> dir(pFilename);
+  llvm::sys::path::remove_filename(dir);
+  if (dir.empty()) {
+    dir = ".";
+  }
+
+  int fd;
+  do {
+    fd = ::open(dir.c_str(), O_RDONLY);
+  } while ((fd < 0) && (errno == EINTR));
+
+  if (fd < 0) {
+    ALOGE("Unable to open the directory %s for sync! (%s)", dir.c_str(),
+          ::strerror(errno));
+    return false;
+  }
+
+  bool result = (::fsync(fd) == 0);
+  if (!result) {
+    ALOGE("Failed to sync the directory %s! (%s)", dir.c_str(),
+          ::strerror(errno));
+  }
+  ::close(fd);
+  return result;
+}
+#endif
+
+} // end anonymous namespace
+
+std::string AtomicOutputFile::GetTemporaryName(const std::string &pFilename) {
+  char suffix[32];
+  ::snprintf(suffix, sizeof(suffix), ".tmp%d.%u",
+             static_cast<int>(::getpid()),
+             static_cast<unsigned>(
+                 llvm::sys::AtomicIncrement(&gTemporaryFileCounter)));
+  return pFilename + suffix;
+}
+
+AtomicOutputFile::AtomicOutputFile(const std::string &pFilename,
+                                   unsigned pFlags)
+  : OutputFile(GetTemporaryName(pFilename), pFlags | FileBase::kTruncate),
+    mFinalName(pFilename), mCommitted(false) { }
+
+AtomicOutputFile::~AtomicOutputFile() {
+  if (!mCommitted) {
+    close();
+    bool existed;
+    llvm::sys::fs::remove(getName(), existed);
+  }
+}
+
+bool AtomicOutputFile::commit(SyncMode pSync) {
+  if (hasError()) {
+    ALOGE("Unable to commit %s to %s! (%s)", getName().c_str(),
+          mFinalName.c_str(), getErrorMessage().c_str());
+    return false;
+  }
+
+#if !defined(_WIN32)
+  int sync_result = 0;
+  if (pSync == kSyncAll) {
+    sync_result = ::fsync(mFD);
+  } else if (pSync == kSyncData) {
+#if defined(__APPLE__)
+    sync_result = ::fsync(mFD);
+#else
+    sync_result = ::fdatasync(mFD);
+#endif
+  }
+  if (sync_result != 0) {
+    detectError();
+    ALOGE("Failed to sync %s! (%s)", getName().c_str(),
+          getErrorMessage().c_str());
+    return false;
+  }
+#endif
+
+  close();
+
+  llvm::error_code err = llvm::sys::fs::rename(getName(), mFinalName);
+  if (err) {
+    ALOGE("Unable to move %s to %s! (%s)", getName().c_str(),
+          mFinalName.c_str(), err.message().c_str());
+    return false;
+  }
+  mCommitted = true;
+
+#if !defined(_WIN32)
+  if ((pSync == kSyncAll) && !SyncParentDirectory(mFinalName)) {
+    // The new contents are in place anyway.
+    ALOGW("%s may not survive a power loss.", mFinalName.c_str());
+  }
+#endif
+
+  return true;
+}
@@ -0,0 +1,522 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CPUProfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#endif
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/Properties.h"
+
+using namespace bcc;
+
+namespace {
+
+// Tuning of a detected CPU. The CPUs which aren't listed are given to LLVM as
+// they were detected.
+struct ProfileEntry {
+  const char *mName;
+  const char *mCPU;
+  // Comma-separated. NULL if there's none.
+  const char *mFeatures;
+  unsigned mPrefetchDistance;
+};
+
+const ProfileEntry ProfileDatabase[] = {
+  // LLVM has scheduling models for Cortex-A8, Cortex-A9 and Swift. The other
+  // ARM cores get the closest of them: Cortex-A8 for the in-order ones and
+  // Cortex-A9 for the out-of-order ones. The cores from Cortex-A7 on have
+  // VFPv4.
+  { "cortex-a7", "cortex-a8", "+vfp4", 0 },
+  { "cortex-a12", "cortex-a9", "+vfp4", 0 },
+  { "cortex-a15", "cortex-a15", "+vfp4", 0 },
+  { "cortex-a17", "cortex-a9", "+vfp4", 0 },
+  { "krait", "cortex-a9", "+vfp4", 0 },
+  { "scorpion", "cortex-a8", NULL, 0 },
+
+  // big.LITTLE. The threads of a launch run on both clusters, so the kernels
+  // are scheduled for the out-of-order model, which doesn't slow down the
+  // in-order cores much, and the prefetching covers the longer latency of the
+  // memory seen from the LITTLE cores.
+  { "cortex-a15+cortex-a7", "cortex-a9", "+vfp4", 512 },
+  { "cortex-a17+cortex-a7", "cortex-a9", "+vfp4", 512 },
+};
+
+const ProfileEntry *LookupProfile(const std::string &pName) {
+  for (unsigned i = 0; i < (sizeof(ProfileDatabase) /
+                            sizeof(ProfileDatabase[0])); i++) {
+    if (pName == ProfileDatabase[i].mName) {
+      return &ProfileDatabase[i];
+    }
+  }
+  return NULL;
+}
+
+#if defined(__arm__)
+// Return the name of the ARM core given by the "CPU implementer" and the "CPU
+// part" of /proc/cpuinfo, or NULL if it's unknown.
+const char *GetARMCoreName(unsigned pImplementer, unsigned pPart) {
+  if (pImplementer == 0x41) {
+    switch (pPart) {
+      case 0xc05: return "cortex-a5";
+      case 0xc07: return "cortex-a7";
+      case 0xc08: return "cortex-a8";
+      case 0xc09: return "cortex-a9";
+      case 0xc0d: return "cortex-a12";
+      case 0xc0e: return "cortex-a17";
+      case 0xc0f: return "cortex-a15";
+    }
+  } else if (pImplementer == 0x51) {
+    switch (pPart) {
+      case 0x00f:
+      case 0x02d: return "scorpion";
+      case 0x04d:
+      case 0x06f: return "krait";
+    }
+  }
+  return NULL;
+}
+
+// Set pNames to the kinds of cores listed in /proc/cpuinfo. The kernel only
+// lists the cores which are online, so a big.LITTLE device running on one
+// cluster looks like a homogeneous one. Return false if a core is unknown.
+bool DetectARMCores(std::vector<std::string> &pNames) {
+  FILE *cpuinfo = ::fopen("/proc/cpuinfo", "r");
+  if (cpuinfo == NULL) {
+    return false;
+  }
+
+  bool known = true;
+  unsigned implementer = 0;
+  char line[256];
+  while (::fgets(line, sizeof(line), cpuinfo) != NULL) {
+    const char *value = ::strchr(line, ':');
+    if (value == NULL) {
+      continue;
+    }
+    if (::strncmp(line, "CPU implementer", 15) == 0) {
+      implementer = ::strtoul(value + 1, NULL, 0);
+    } else if (::strncmp(line, "CPU part", 8) == 0) {
+      const char *name = GetARMCoreName(implementer, ::strtoul(value + 1,
+                                                               NULL, 0));
+      if (name == NULL) {
+        known = false;
+      } else if (std::find(pNames.begin(), pNames.end(),
+                           std::string(name)) == pNames.end()) {
+        pNames.push_back(name);
+      }
+    }
+  }
+  ::fclose(cpuinfo);
+
+  return (known && !pNames.empty());
+}
+#endif // defined(__arm__)
+
+#if defined(__i386__) || defined(__x86_64__)
+// Add the SIMD extensions of the host to pFeatures. llvm::sys::getHostCPUName()
+// only implies them for the CPUs it knows and getHostCPUFeatures() doesn't
+// support x86.
+void DetectX86Features(std::vector<std::string> &pFeatures) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return;
+  }
+
+  if (ecx & (1 << 0)) {
+    pFeatures.push_back("+sse3");
+  }
+  if (ecx & (1 << 9)) {
+    pFeatures.push_back("+ssse3");
+  }
+  if (ecx & (1 << 19)) {
+    pFeatures.push_back("+sse41");
+  }
+  if (ecx & (1 << 20)) {
+    pFeatures.push_back("+sse42");
+  }
+
+  // AVX also needs the OS to save the YMM registers (OSXSAVE and XCR0.)
+  if ((ecx & (1 << 28)) && (ecx & (1 << 27))) {
+    unsigned xcr0_lo, xcr0_hi;
+    // xgetbv, which old assemblers don't know.
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+                         : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) == 0x6) {
+      pFeatures.push_back("+avx");
+    }
+  }
+}
+#endif // defined(__i386__) || defined(__x86_64__)
+
+void DetectHostProfile(CPUProfile &pProfile) {
+  std::vector<std::string> names;
+
+#if defined(__arm__)
+  if (DetectARMCores(names)) {
+    std::sort(names.begin(), names.end());
+  } else {
+    names.clear();
+  }
+#endif
+
+  if (names.empty()) {
+    std::string host_cpu = llvm::sys::getHostCPUName();
+    if (!host_cpu.empty()) {
+      names.push_back(host_cpu);
+    }
+  }
+
+  if (!names.empty()) {
+    pProfile.mName = names[0];
+    for (size_t i = 1, e = names.size(); i != e; i++) {
+      pProfile.mName += '+';
+      pProfile.mName += names[i];
+    }
+  }
+
+  // A single kind of core is given to LLVM as is unless the database says
+  // otherwise. The mixes have to be listed.
+  if ((names.size() == 1) && (pProfile.mName != "generic")) {
+    pProfile.mCPU = pProfile.mName;
+  }
+
+#if defined(__i386__) || defined(__x86_64__)
+  DetectX86Features(pProfile.mFeatures);
+#endif
+
+  const ProfileEntry *entry = LookupProfile(pProfile.mName);
+  if (entry == NULL) {
+    return;
+  }
+
+  pProfile.mCPU = entry->mCPU;
+  pProfile.mPrefetchDistance = entry->mPrefetchDistance;
+  if (entry->mFeatures != NULL) {
+    const char *features = entry->mFeatures;
+    while (*features != '\0') {
+      const char *end = ::strchr(features, ',');
+      if (end == NULL) {
+        end = features + ::strlen(features);
+      }
+      pProfile.mFeatures.push_back(std::string(features, end));
+      features = ((*end == ',') ? (end + 1) : end);
+    }
+  }
+}
+
+// Set pNames to the LLVM subtarget features of the host which
+// llvm::sys::getHostCPUFeatures() reports as present (it only supports ARM.)
+void DetectLLVMFeatures(std::vector<std::string> &pNames) {
+  llvm::StringMap<bool> host_features;
+  if (!llvm::sys::getHostCPUFeatures(host_features)) {
+    return;
+  }
+  for (llvm::StringMap<bool>::const_iterator it = host_features.begin(),
+           e = host_features.end(); it != e; ++it) {
+    if (it->getValue()) {
+      pNames.push_back(it->getKey().str());
+    }
+  }
+  std::sort(pNames.begin(), pNames.end());
+}
+
+uint32_t DetectHostFeatures(const std::vector<std::string> &pLLVMFeatures) {
+  uint32_t features = 0;
+
+#if defined(__arm__)
+  if (std::find(pLLVMFeatures.begin(), pLLVMFeatures.end(),
+                std::string("neon")) != pLLVMFeatures.end()) {
+    features |= CPUProfile::kFeatureNEON;
+  }
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+  std::vector<std::string> attributes;
+  DetectX86Features(attributes);
+  for (size_t i = 0, e = attributes.size(); i != e; i++) {
+    if (attributes[i] == "+ssse3") {
+      features |= CPUProfile::kFeatureSSSE3;
+    } else if (attributes[i] == "+sse41") {
+      features |= CPUProfile::kFeatureSSE41;
+    } else if (attributes[i] == "+avx") {
+      features |= CPUProfile::kFeatureAVX;
+    }
+  }
+#endif
+
+  return features;
+}
+
+// What's detected of the host, once per process. Guarded by
+// gHostProfileLock.
+llvm::sys::Mutex gHostProfileLock;
+bool gHostDetected = false;
+CPUProfile gDetectedProfile;
+uint32_t gHostFeatures = 0;
+std::vector<std::string> gLLVMFeatures;
+std::string gSnapshotPath;
+
+bool gHostProfileSelected = false;
+CPUProfile gHostProfile;
+
+//===----------------------------------------------------------------------===//
+// Snapshot (see CPUProfile::SetSnapshotPath())
+//===----------------------------------------------------------------------===//
+const char SnapshotMagic[] = "bcc-cpu-profile 1";
+
+// The key of the snapshots valid for this process: the image containing
+// libbcc (by its size and modification time) and the kernel. Empty if it
+// can't be told, in which case no snapshot is used.
+std::string GetSnapshotKey() {
+#if !defined(_WIN32)
+  Dl_info image;
+  struct stat image_stat;
+  struct utsname kernel;
+  if ((::dladdr(reinterpret_cast<void *>(&CPUProfile::GetHost),
+                &image) == 0) || (image.dli_fname == NULL) ||
+      (::stat(image.dli_fname, &image_stat) != 0) ||
+      (::uname(&kernel) != 0)) {
+    return std::string();
+  }
+
+  char buffer[64];
+  ::snprintf(buffer, sizeof(buffer), "%llu:%llu:",
+             static_cast<unsigned long long>(image_stat.st_size),
+             static_cast<unsigned long long>(image_stat.st_mtime));
+  std::string key(buffer);
+  key += kernel.release;
+  key += ':';
+  key += kernel.version;
+  return key;
+#else
+  return std::string();
+#endif
+}
+
+void SplitList(const std::string &pList, std::vector<std::string> &pResult) {
+  size_t begin = 0;
+  while (begin < pList.size()) {
+    size_t end = pList.find(',', begin);
+    if (end == std::string::npos) {
+      end = pList.size();
+    }
+    if (end > begin) {
+      pResult.push_back(pList.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+}
+
+std::string JoinList(const std::vector<std::string> &pList) {
+  std::string result;
+  for (size_t i = 0, e = pList.size(); i != e; i++) {
+    if (i > 0) {
+      result += ',';
+    }
+    result += pList[i];
+  }
+  return result;
+}
+
+// Fill the detection from the snapshot at gSnapshotPath. Return false (and
+// leave it alone) if there's no valid snapshot for pKey.
+bool LoadSnapshot(const std::string &pKey) {
+  FILE *snapshot = ::fopen(gSnapshotPath.c_str(), "r");
+  if (snapshot == NULL) {
+    return false;
+  }
+
+  CPUProfile profile;
+  uint32_t host_features = 0;
+  std::vector<std::string> llvm_features;
+  bool has_magic = false, has_key = false;
+  char line[1024];
+  while (::fgets(line, sizeof(line), snapshot) != NULL) {
+    std::string entry(line);
+    if (!entry.empty() && (entry[entry.size() - 1] == '\n')) {
+      entry.erase(entry.size() - 1);
+    }
+    if (entry == SnapshotMagic) {
+      has_magic = true;
+      continue;
+    }
+
+    size_t space = entry.find(' ');
+    std::string field = entry.substr(0, space);
+    std::string value = ((space != std::string::npos) ?
+                         entry.substr(space + 1) : std::string());
+    if (field == "key") {
+      has_key = (value == pKey);
+    } else if (field == "name") {
+      profile.mName = value;
+    } else if (field == "cpu") {
+      profile.mCPU = value;
+    } else if (field == "features") {
+      SplitList(value, profile.mFeatures);
+    } else if (field == "prefetch") {
+      profile.mPrefetchDistance = ::strtoul(value.c_str(), NULL, 0);
+    } else if (field == "host-features") {
+      host_features = ::strtoul(value.c_str(), NULL, 0);
+    } else if (field == "llvm-features") {
+      SplitList(value, llvm_features);
+    }
+  }
+  ::fclose(snapshot);
+
+  if (!has_magic || !has_key) {
+    ALOGV("The CPU profile snapshot %s is stale.", gSnapshotPath.c_str());
+    return false;
+  }
+
+  gDetectedProfile = profile;
+  gHostFeatures = host_features;
+  gLLVMFeatures.swap(llvm_features);
+  return true;
+}
+
+void SaveSnapshot(const std::string &pKey) {
+  char buffer[32];
+  std::string contents(SnapshotMagic);
+  contents += "\nkey ";
+  contents += pKey;
+  contents += "\nname ";
+  contents += gDetectedProfile.mName;
+  contents += "\ncpu ";
+  contents += gDetectedProfile.mCPU;
+  contents += "\nfeatures ";
+  contents += JoinList(gDetectedProfile.mFeatures);
+  ::snprintf(buffer, sizeof(buffer), "\nprefetch %u",
+             gDetectedProfile.mPrefetchDistance);
+  contents += buffer;
+  ::snprintf(buffer, sizeof(buffer), "\nhost-features 0x%x", gHostFeatures);
+  contents += buffer;
+  contents += "\nllvm-features ";
+  contents += JoinList(gLLVMFeatures);
+  contents += '\n';
+
+  // All the processes detect the same, so the last writer may win.
+  AtomicOutputFile output(gSnapshotPath);
+  if (output.hasError() ||
+      (output.write(contents.data(), contents.size()) !=
+          static_cast<ssize_t>(contents.size())) ||
+      !output.commit()) {
+    ALOGW("Unable to write the CPU profile snapshot %s!",
+          gSnapshotPath.c_str());
+  }
+}
+
+void DetectHostLocked() {
+  if (gHostDetected) {
+    return;
+  }
+  gHostDetected = true;
+
+  std::string key;
+  if (!gSnapshotPath.empty()) {
+    key = GetSnapshotKey();
+    if (!key.empty() && LoadSnapshot(key)) {
+      return;
+    }
+  }
+
+  DetectHostProfile(gDetectedProfile);
+  DetectLLVMFeatures(gLLVMFeatures);
+  gHostFeatures = DetectHostFeatures(gLLVMFeatures);
+
+  if (!key.empty()) {
+    SaveSnapshot(key);
+  }
+}
+
+} // end anonymous namespace
+
+std::string CPUProfile::getDescription() const {
+  std::string result(mName);
+  result += " (cpu: ";
+  result += (mCPU.empty() ? "default" : mCPU);
+  result += ", features:";
+  if (mFeatures.empty()) {
+    result += " none";
+  }
+  for (size_t i = 0, e = mFeatures.size(); i != e; i++) {
+    result += ' ';
+    result += mFeatures[i];
+  }
+  if (mPrefetchDistance != 0) {
+    char prefetch[32];
+    ::snprintf(prefetch, sizeof(prefetch), ", prefetch: %u",
+               mPrefetchDistance);
+    result += prefetch;
+  }
+  result += ')';
+  return result;
+}
+
+void CPUProfile::SetSnapshotPath(const char *pPath) {
+  llvm::MutexGuard locked(gHostProfileLock);
+  if (gHostDetected) {
+    ALOGW("The host is already detected. Ignore the CPU profile snapshot "
+          "%s.", pPath);
+    return;
+  }
+  gSnapshotPath = ((pPath != NULL) ? pPath : "");
+}
+
+const CPUProfile &CPUProfile::GetHost() {
+  llvm::MutexGuard locked(gHostProfileLock);
+  if (!gHostProfileSelected) {
+    if (!getProperty("debug.rs.no-cpu-profile")) {
+      DetectHostLocked();
+      gHostProfile = gDetectedProfile;
+    }
+    ALOGV("CPU profile: %s", gHostProfile.getDescription().c_str());
+    gHostProfileSelected = true;
+  }
+  return gHostProfile;
+}
+
+uint32_t CPUProfile::GetHostFeatures() {
+  llvm::MutexGuard locked(gHostProfileLock);
+  DetectHostLocked();
+  return gHostFeatures;
+}
+
+bool CPUProfile::HasHostLLVMFeature(const char *pName) {
+  llvm::MutexGuard locked(gHostProfileLock);
+  DetectHostLocked();
+  return std::binary_search(gLLVMFeatures.begin(), gLLVMFeatures.end(),
+                            std::string(pName));
+}
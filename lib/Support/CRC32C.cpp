@@ -0,0 +1,212 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CRC32C.h"
+
+#include <cstring>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && !defined(__ARM_FEATURE_CRC32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+using namespace bcc;
+
+namespace {
+
+// The reflected Castagnoli polynomial.
+const uint32_t Polynomial = 0x82f63b78;
+
+//===----------------------------------------------------------------------===//
+// Software
+//===----------------------------------------------------------------------===//
+struct CRCTable {
+  uint32_t mEntries[256];
+
+  CRCTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (unsigned j = 0; j < 8; j++) {
+        crc = ((crc & 1) ? ((crc >> 1) ^ Polynomial) : (crc >> 1));
+      }
+      mEntries[i] = crc;
+    }
+  }
+};
+
+const CRCTable gTable;
+
+uint32_t ComputeInSoftware(const uint8_t *pData, size_t pSize, uint32_t pCRC) {
+  for (size_t i = 0; i < pSize; i++) {
+    pCRC = gTable.mEntries[(pCRC ^ pData[i]) & 0xff] ^ (pCRC >> 8);
+  }
+  return pCRC;
+}
+
+//===----------------------------------------------------------------------===//
+// Hardware
+//===----------------------------------------------------------------------===//
+#if defined(__i386__) || defined(__x86_64__)
+#define HAVE_HARDWARE_CRC32C 1
+
+bool DetectHardware() {
+  unsigned eax, ebx, ecx, edx;
+  // SSE4.2.
+  return (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 20)));
+}
+
+inline uint32_t CRC8(uint32_t pCRC, uint8_t pData) {
+  __asm__("crc32b %1, %0" : "+r"(pCRC) : "rm"(pData));
+  return pCRC;
+}
+
+#if defined(__x86_64__)
+typedef uint64_t WordTy;
+
+inline uint32_t CRCWord(uint32_t pCRC, uint64_t pData) {
+  uint64_t crc = pCRC;
+  __asm__("crc32q %1, %0" : "+r"(crc) : "rm"(pData));
+  return static_cast<uint32_t>(crc);
+}
+#else
+typedef uint32_t WordTy;
+
+inline uint32_t CRCWord(uint32_t pCRC, uint32_t pData) {
+  __asm__("crc32l %1, %0" : "+r"(pCRC) : "rm"(pData));
+  return pCRC;
+}
+#endif
+
+#elif defined(__ARM_FEATURE_CRC32)
+#define HAVE_HARDWARE_CRC32C 1
+
+// Compiled for a CPU which has them.
+bool DetectHardware() {
+  return true;
+}
+
+inline uint32_t CRC8(uint32_t pCRC, uint8_t pData) {
+  return __crc32cb(pCRC, pData);
+}
+
+#if defined(__aarch64__)
+typedef uint64_t WordTy;
+
+inline uint32_t CRCWord(uint32_t pCRC, uint64_t pData) {
+  return __crc32cd(pCRC, pData);
+}
+#else
+typedef uint32_t WordTy;
+
+inline uint32_t CRCWord(uint32_t pCRC, uint32_t pData) {
+  return __crc32cw(pCRC, pData);
+}
+#endif
+
+#elif defined(__aarch64__)
+#define HAVE_HARDWARE_CRC32C 1
+
+// The kernel reports the extension in the HWCAP of the auxiliary vector.
+// Read it from /proc (getauxval() isn't in every libc we build against.)
+bool DetectHardware() {
+  const unsigned long AT_HWCAP_TYPE = 16;
+  const unsigned long HWCAP_CRC32_BIT = 1UL << 7;
+
+  int fd = ::open("/proc/self/auxv", O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool result = false;
+  unsigned long entry[2];
+  while (::read(fd, entry, sizeof(entry)) ==
+             static_cast<ssize_t>(sizeof(entry))) {
+    if (entry[0] == AT_HWCAP_TYPE) {
+      result = ((entry[1] & HWCAP_CRC32_BIT) != 0);
+      break;
+    }
+  }
+  ::close(fd);
+  return result;
+}
+
+// The instructions are enabled for these only (the rest of the file stays
+// runnable on the CPUs without the extension.)
+inline uint32_t CRC8(uint32_t pCRC, uint8_t pData) {
+  uint32_t data = pData;
+  __asm__(".arch armv8-a+crc\n\t"
+          "crc32cb %w0, %w0, %w1" : "+r"(pCRC) : "r"(data));
+  return pCRC;
+}
+
+typedef uint64_t WordTy;
+
+inline uint32_t CRCWord(uint32_t pCRC, uint64_t pData) {
+  __asm__(".arch armv8-a+crc\n\t"
+          "crc32cx %w0, %w0, %x1" : "+r"(pCRC) : "r"(pData));
+  return pCRC;
+}
+#endif
+
+#if defined(HAVE_HARDWARE_CRC32C)
+uint32_t ComputeInHardware(const uint8_t *pData, size_t pSize, uint32_t pCRC) {
+  // Up to the first aligned word, then a word at a time.
+  while ((pSize > 0) &&
+         ((reinterpret_cast<uintptr_t>(pData) & (sizeof(WordTy) - 1)) != 0)) {
+    pCRC = CRC8(pCRC, *pData++);
+    pSize--;
+  }
+  while (pSize >= sizeof(WordTy)) {
+    WordTy word;
+    ::memcpy(&word, pData, sizeof(word));
+    pCRC = CRCWord(pCRC, word);
+    pData += sizeof(WordTy);
+    pSize -= sizeof(WordTy);
+  }
+  while (pSize > 0) {
+    pCRC = CRC8(pCRC, *pData++);
+    pSize--;
+  }
+  return pCRC;
+}
+#endif
+
+} // end anonymous namespace
+
+bool CRC32C::HasHardwareSupport() {
+#if defined(HAVE_HARDWARE_CRC32C)
+  static const bool has_hardware = DetectHardware();
+  return has_hardware;
+#else
+  return false;
+#endif
+}
+
+uint32_t CRC32C::Compute(const void *pData, size_t pSize, uint32_t pCRC) {
+  const uint8_t *data = static_cast<const uint8_t *>(pData);
+  uint32_t crc = ~pCRC;
+#if defined(HAVE_HARDWARE_CRC32C)
+  if (HasHardwareSupport()) {
+    return ~ComputeInHardware(data, pSize, crc);
+  }
+#endif
+  return ~ComputeInSoftware(data, pSize, crc);
+}
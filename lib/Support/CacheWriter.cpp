@@ -0,0 +1,267 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CacheWriter.h"
+
+#include <new>
+
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+
+#include <utils/FileMap.h>
+
+using namespace bcc;
+
+class CacheWriter::WriterThread : public android::Thread {
+private:
+  CacheWriter &mWriter;
+
+  virtual bool threadLoop() {
+    return mWriter.writeNext();
+  }
+
+public:
+  WriterThread(CacheWriter &pWriter)
+    : android::Thread(/* canCallJava */false), mWriter(pWriter) { }
+};
+
+CacheWriter &CacheWriter::GetInstance() {
+  // Leaked on purpose: the writer thread may still be running at exit.
+  static CacheWriter *instance = new CacheWriter();
+  return *instance;
+}
+
+CacheWriter::CacheWriter() : mAsynchronous(false) {
+}
+
+bool CacheWriter::Run(const std::string &pPath, const Job &pJob) {
+  const std::string *contents = &pJob.mData;
+  std::string updated;
+
+  if (pJob.mUpdate != NULL) {
+    InputFile input(pPath);
+    size_t file_size = 0;
+    android::FileMap *map = NULL;
+    if (!input.hasError()) {
+      file_size = input.getSize();
+      if (!input.hasError() && (file_size > 0)) {
+        map = input.createMap(0, file_size);
+      }
+    }
+    if (map == NULL) {
+      ALOGE("Unable to read %s for update! (%s)", pPath.c_str(),
+            input.getErrorMessage().c_str());
+      return false;
+    }
+
+    bool updated_ok = pJob.mUpdate(pPath, map->getDataPtr(), file_size,
+                                   pJob.mData, updated);
+    map->release();
+    if (!updated_ok) {
+      return false;
+    }
+    contents = &updated;
+  }
+
+  AtomicOutputFile output(pPath, FileBase::kBinary);
+  if (output.hasError()) {
+    ALOGE("Unable to open %s for write! (%s)", output.getName().c_str(),
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  if (static_cast<size_t>(output.write(contents->data(), contents->size())) !=
+          contents->size()) {
+    ALOGE("Failed to write %s! (%s)", output.getName().c_str(),
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  return output.commit(pJob.mSync);
+}
+
+bool CacheWriter::isBusyLocked(const std::string &pPath) const {
+  return ((mPending.find(pPath) != mPending.end()) || (mWriting == pPath));
+}
+
+bool CacheWriter::enqueue(const std::string &pPath, Job &pJob) {
+  android::Mutex::Autolock locked(mLock);
+  if (!mAsynchronous) {
+    return false;
+  }
+
+  if (mThread == NULL) {
+    mThread = new (std::nothrow) WriterThread(*this);
+    if ((mThread == NULL) ||
+        (mThread->run("bcc cache writer") != android::NO_ERROR)) {
+      ALOGW("Failed to start the cache writer thread. Write the cache in "
+            "place.");
+      mThread.clear();
+      mAsynchronous = false;
+      return false;
+    }
+  }
+
+  std::map<std::string, Job>::iterator pending = mPending.find(pPath);
+  if (pending == mPending.end()) {
+    Job &job = mPending[pPath];
+    job.mData.swap(pJob.mData);
+    job.mUpdate = pJob.mUpdate;
+    job.mSync = pJob.mSync;
+    mOrder.push_back(pPath);
+    mChanged.broadcast();
+    return true;
+  }
+
+  Job &job = pending->second;
+  if (pJob.mUpdate == NULL) {
+    // Overwritten in full.
+    job.mData.swap(pJob.mData);
+    job.mUpdate = NULL;
+  } else if (job.mUpdate == NULL) {
+    // Update the pending contents right away.
+    std::string result;
+    if (!pJob.mUpdate(pPath, job.mData.data(), job.mData.size(), pJob.mData,
+                      result)) {
+      ALOGE("Failed to update the pending contents of %s!", pPath.c_str());
+    } else {
+      job.mData.swap(result);
+    }
+  } else if (job.mUpdate == pJob.mUpdate) {
+    // The later update supersedes the pending one.
+    job.mData.swap(pJob.mData);
+  } else {
+    // The two updates can't be merged.
+    return false;
+  }
+
+  // The merged write is flushed as much as either of them asked.
+  if (pJob.mSync > job.mSync) {
+    job.mSync = pJob.mSync;
+  }
+  return true;
+}
+
+bool CacheWriter::writeNext() {
+  std::string path;
+  Job job;
+
+  {
+    android::Mutex::Autolock locked(mLock);
+    while (mOrder.empty()) {
+      if (!mAsynchronous) {
+        return false;
+      }
+      mChanged.wait(mLock);
+    }
+
+    path = mOrder.front();
+    mOrder.pop_front();
+    std::map<std::string, Job>::iterator pending = mPending.find(path);
+    job.mData.swap(pending->second.mData);
+    job.mUpdate = pending->second.mUpdate;
+    job.mSync = pending->second.mSync;
+    mPending.erase(pending);
+    mWriting = path;
+  }
+
+  if (!Run(path, job)) {
+    ALOGE("Failed to write %s in the background!", path.c_str());
+  }
+
+  android::Mutex::Autolock locked(mLock);
+  mWriting.clear();
+  mChanged.broadcast();
+  return true;
+}
+
+void CacheWriter::setAsynchronous(bool pAsynchronous) {
+  android::sp<WriterThread> thread;
+
+  {
+    android::Mutex::Autolock locked(mLock);
+    if (pAsynchronous || !mAsynchronous) {
+      // The writer thread is started by the first write.
+      mAsynchronous = pAsynchronous;
+      return;
+    }
+
+    while (!mOrder.empty() || !mWriting.empty()) {
+      mChanged.wait(mLock);
+    }
+    mAsynchronous = false;
+    mChanged.broadcast();
+    thread = mThread;
+    mThread.clear();
+  }
+
+  if (thread != NULL) {
+    thread->join();
+  }
+}
+
+bool CacheWriter::isAsynchronous() {
+  android::Mutex::Autolock locked(mLock);
+  return mAsynchronous;
+}
+
+bool CacheWriter::write(const std::string &pPath, std::string &pContents,
+                        AtomicOutputFile::SyncMode pSync) {
+  Job job;
+  job.mData.swap(pContents);
+  job.mUpdate = NULL;
+  job.mSync = pSync;
+
+  if (enqueue(pPath, job)) {
+    return true;
+  }
+  return Run(pPath, job);
+}
+
+bool CacheWriter::update(const std::string &pPath, UpdateFunction pUpdate,
+                         std::string &pData,
+                         AtomicOutputFile::SyncMode pSync) {
+  Job job;
+  job.mData.swap(pData);
+  job.mUpdate = pUpdate;
+  job.mSync = pSync;
+
+  if (enqueue(pPath, job)) {
+    return true;
+  }
+  // The update reads the current contents.
+  wait(pPath);
+  return Run(pPath, job);
+}
+
+void CacheWriter::wait(const std::string &pPath) {
+  android::Mutex::Autolock locked(mLock);
+  while (isBusyLocked(pPath)) {
+    mChanged.wait(mLock);
+  }
+}
+
+bool CacheWriter::isPending(const std::string &pPath) {
+  android::Mutex::Autolock locked(mLock);
+  return isBusyLocked(pPath);
+}
+
+void CacheWriter::flush() {
+  android::Mutex::Autolock locked(mLock);
+  while (!mOrder.empty() || !mWriting.empty()) {
+    mChanged.wait(mLock);
+  }
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CompileServer.h"
+
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+const char CompileServer::SocketEnvironmentVariable[] = "BCC_SERVER_SOCKET";
+
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+
+// A request: this header (sent along with the standard input, output and
+// error of the client), then payloadSize bytes of NUL-terminated strings, the
+// working directory followed by the arguments. The reply is the int32_t exit
+// status.
+struct RequestHeader {
+  uint32_t magic;
+  uint32_t payloadSize;
+};
+
+const uint32_t RequestMagic = 0x62636331; // "bcc1"
+
+// Bound the requests a broken client could send.
+const uint32_t MaxPayloadSize = 1024 * 1024;
+
+const int NumForwardedFds = 3;
+
+bool WriteFully(int pFd, const void *pData, size_t pSize) {
+  const char *data = static_cast<const char *>(pData);
+  while (pSize > 0) {
+    ssize_t written = ::write(pFd, data, pSize);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    pSize -= written;
+  }
+  return true;
+}
+
+bool ReadFully(int pFd, void *pData, size_t pSize) {
+  char *data = static_cast<char *>(pData);
+  while (pSize > 0) {
+    ssize_t nread = ::read(pFd, data, pSize);
+    if (nread < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (nread == 0) {
+      return false;
+    }
+    data += nread;
+    pSize -= nread;
+  }
+  return true;
+}
+
+bool FillAddress(const char *pSocketPath, struct sockaddr_un &pAddress) {
+  if (::strlen(pSocketPath) >= sizeof(pAddress.sun_path)) {
+    ALOGE("Socket path %s is too long!", pSocketPath);
+    return false;
+  }
+  ::memset(&pAddress, 0, sizeof(pAddress));
+  pAddress.sun_family = AF_UNIX;
+  ::strcpy(pAddress.sun_path, pSocketPath);
+  return true;
+}
+
+// Receive the header of a request on pConnection and the descriptors that
+// come with it. Return false on error.
+bool ReceiveHeader(int pConnection, RequestHeader &pHeader,
+                   int pFds[NumForwardedFds]) {
+  struct iovec iov;
+  iov.iov_base = &pHeader;
+  iov.iov_len = sizeof(pHeader);
+
+  char control[CMSG_SPACE(sizeof(int) * NumForwardedFds)];
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t nread;
+  do {
+    nread = ::recvmsg(pConnection, &msg, 0);
+  } while ((nread < 0) && (errno == EINTR));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if ((nread != static_cast<ssize_t>(sizeof(pHeader))) || (cmsg == NULL) ||
+      (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+      (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * NumForwardedFds))) {
+    return false;
+  }
+  ::memcpy(pFds, CMSG_DATA(cmsg), sizeof(int) * NumForwardedFds);
+
+  return ((pHeader.magic == RequestMagic) &&
+          (pHeader.payloadSize <= MaxPayloadSize));
+}
+
+// Run the request on pConnection with pMain in this (forked) process and
+// exit with its status.
+void HandleRequest(int pConnection, CompileServer::MainFunction pMain) {
+  // The tool may wait for its own children.
+  ::signal(SIGCHLD, SIG_DFL);
+
+  RequestHeader header;
+  int fds[NumForwardedFds];
+  if (!ReceiveHeader(pConnection, header, fds)) {
+    ALOGE("Invalid request to the compile server!");
+    ::_exit(EXIT_FAILURE);
+  }
+
+  std::vector<char> payload(header.payloadSize + 1, '\0');
+  if ((header.payloadSize > 0) &&
+      !ReadFully(pConnection, &payload[0], header.payloadSize)) {
+    ALOGE("Truncated request to the compile server!");
+    ::_exit(EXIT_FAILURE);
+  }
+
+  // Split the strings.
+  std::vector<char *> args;
+  for (size_t i = 0; i < header.payloadSize; i += ::strlen(&payload[i]) + 1) {
+    args.push_back(&payload[i]);
+  }
+  if (args.size() < 2) {
+    ALOGE("Empty request to the compile server!");
+    ::_exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < NumForwardedFds; i++) {
+    ::dup2(fds[i], i);
+    ::close(fds[i]);
+  }
+  if (::chdir(args[0]) != 0) {
+    ::fprintf(stderr, "Unable to change to the directory %s! (%s)\n", args[0],
+              ::strerror(errno));
+    ::_exit(EXIT_FAILURE);
+  }
+
+  int argc = args.size() - 1;
+  args.push_back(NULL);
+  int32_t status = pMain(argc, &args[1]);
+
+  // Everything the tool printed reaches the client before it exits.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  ::fflush(NULL);
+
+  WriteFully(pConnection, &status, sizeof(status));
+  ::_exit(status);
+}
+
+} // end anonymous namespace
+
+bool CompileServer::Serve(const char *pSocketPath, MainFunction pMain) {
+  struct sockaddr_un address;
+  if (!FillAddress(pSocketPath, address)) {
+    return false;
+  }
+
+  int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) {
+    ALOGE("Unable to create the socket of the compile server! (%s)",
+          ::strerror(errno));
+    return false;
+  }
+
+  // A server which has gone away leaves its socket behind.
+  ::unlink(pSocketPath);
+  if ((::bind(server, reinterpret_cast<struct sockaddr *>(&address),
+              sizeof(address)) != 0) ||
+      (::listen(server, SOMAXCONN) != 0)) {
+    ALOGE("Unable to listen on %s! (%s)", pSocketPath, ::strerror(errno));
+    ::close(server);
+    return false;
+  }
+
+  // The children reap themselves.
+  ::signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    int connection = ::accept(server, NULL, NULL);
+    if (connection < 0) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      ALOGE("Failed to accept a client on %s! (%s)", pSocketPath,
+            ::strerror(errno));
+      break;
+    }
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      ::close(server);
+      HandleRequest(connection, pMain);
+    } else if (pid < 0) {
+      ALOGE("Unable to fork for the client on %s! (%s)", pSocketPath,
+            ::strerror(errno));
+    }
+    ::close(connection);
+  }
+
+  ::close(server);
+  return false;
+}
+
+int CompileServer::Forward(const char *pSocketPath, int pArgc, char **pArgv) {
+  struct sockaddr_un address;
+  if (!FillAddress(pSocketPath, address)) {
+    return -1;
+  }
+
+  char cwd[PATH_MAX];
+  if (::getcwd(cwd, sizeof(cwd)) == NULL) {
+    return -1;
+  }
+
+  std::string payload(cwd, ::strlen(cwd) + 1);
+  for (int i = 0; i < pArgc; i++) {
+    payload.append(pArgv[i], ::strlen(pArgv[i]) + 1);
+  }
+  if (payload.size() > MaxPayloadSize) {
+    return -1;
+  }
+
+  int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) {
+    return -1;
+  }
+  if (::connect(connection, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) != 0) {
+    ALOGV("No compile server on %s (%s). Run locally.", pSocketPath,
+          ::strerror(errno));
+    ::close(connection);
+    return -1;
+  }
+
+  RequestHeader header;
+  header.magic = RequestMagic;
+  header.payloadSize = payload.size();
+
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+
+  char control[CMSG_SPACE(sizeof(int) * NumForwardedFds)];
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * NumForwardedFds);
+  int fds[NumForwardedFds] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  ::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t written;
+  do {
+    written = ::sendmsg(connection, &msg, 0);
+  } while ((written < 0) && (errno == EINTR));
+
+  int32_t status = -1;
+  if ((written != static_cast<ssize_t>(sizeof(header))) ||
+      !WriteFully(connection, payload.data(), payload.size())) {
+    ALOGW("Failed to send the request to the compile server on %s! (%s)",
+          pSocketPath, ::strerror(errno));
+  } else if (!ReadFully(connection, &status, sizeof(status))) {
+    // The child died. Whatever it did is lost, so don't retry locally.
+    ::fprintf(stderr, "The compile server on %s failed to complete the "
+                      "request!\n", pSocketPath);
+    status = EXIT_FAILURE;
+  }
+
+  ::close(connection);
+  return status;
+}
+
+#else  // defined(_WIN32)
+
+bool CompileServer::Serve(const char *pSocketPath, MainFunction pMain) {
+  ALOGE("The compile server isn't supported on this host!");
+  return false;
+}
+
+int CompileServer::Forward(const char *pSocketPath, int pArgc, char **pArgv) {
+  return -1;
+}
+
+#endif // !defined(_WIN32)
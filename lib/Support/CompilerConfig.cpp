@@ -16,15 +16,67 @@
 
 #include "bcc/Support/CompilerConfig.h"
 
+#include <cstring>
+
 #include <llvm/CodeGen/SchedulerRegistry.h>
 #include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/TargetRegistry.h>
 
+#include "bcc/Support/Initialization.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/TargetCompilerConfigs.h"
 
 using namespace bcc;
 
+namespace {
+
+const char *const LTOProfileNames[] = {
+  "fast-compile",   // kLTOFastCompile
+  "balanced",       // kLTOBalanced
+  "max-throughput", // kLTOMaxThroughput
+};
+
+const char *const EmissionProfileNames[] = {
+  "fast-emit",      // kEmitFast
+  "compact",        // kEmitCompact
+  "fast-code",      // kEmitFastCode
+};
+
+} // end anonymous namespace
+
+const char *CompilerConfig::GetLTOProfileName(LTOProfile pProfile) {
+  return LTOProfileNames[pProfile];
+}
+
+bool CompilerConfig::ParseLTOProfile(const char *pName, LTOProfile &pResult) {
+  for (unsigned i = 0;
+       i < (sizeof(LTOProfileNames) / sizeof(LTOProfileNames[0])); i++) {
+    if (::strcmp(pName, LTOProfileNames[i]) == 0) {
+      pResult = static_cast<LTOProfile>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *
+CompilerConfig::GetEmissionProfileName(EmissionProfile pProfile) {
+  return EmissionProfileNames[pProfile];
+}
+
+bool CompilerConfig::ParseEmissionProfile(const char *pName,
+                                          EmissionProfile &pResult) {
+  for (unsigned i = 0;
+       i < (sizeof(EmissionProfileNames) / sizeof(EmissionProfileNames[0]));
+       i++) {
+    if (::strcmp(pName, EmissionProfileNames[i]) == 0) {
+      pResult = static_cast<EmissionProfile>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
 CompilerConfig::CompilerConfig(const std::string &pTriple)
   : mTriple(pTriple), mTarget(NULL) {
   //===--------------------------------------------------------------------===//
@@ -63,6 +115,31 @@ CompilerConfig::CompilerConfig(const std::string &pTriple)
   //===--------------------------------------------------------------------===//
   mOptLevel = llvm::CodeGenOpt::Default;
 
+  //===--------------------------------------------------------------------===//
+  // Default setting for LTO pipeline
+  //===--------------------------------------------------------------------===//
+  mLTOProfile = kLTOBalanced;
+
+  //===--------------------------------------------------------------------===//
+  // Default setting for code emission (relax all the instructions)
+  //===--------------------------------------------------------------------===//
+  mEmissionProfile = kEmitFast;
+
+  //===--------------------------------------------------------------------===//
+  // Default setting for software prefetching (rely on the hardware)
+  //===--------------------------------------------------------------------===//
+  mPrefetchDistance = 0;
+
+  //===--------------------------------------------------------------------===//
+  // Default setting for the streaming entry points (a page per buffer)
+  //===--------------------------------------------------------------------===//
+  mStreamBlockSize = 4096;
+
+  //===--------------------------------------------------------------------===//
+  // Default setting for the merging of the globals (see RSCompilerDriver)
+  //===--------------------------------------------------------------------===//
+  mEnableGlobalMerge = false;
+
   //===--------------------------------------------------------------------===//
   // Default setting for architecture type
   //===--------------------------------------------------------------------===//
@@ -75,6 +152,9 @@ CompilerConfig::CompilerConfig(const std::string &pTriple)
 }
 
 bool CompilerConfig::initializeTarget() {
+  // The tools taking any target have initialized all the backends already.
+  init::InitializeDefaultTarget();
+
   std::string error;
   mTarget = llvm::TargetRegistry::lookupTarget(mTriple, error);
   if (mTarget != NULL) {
@@ -95,6 +175,21 @@ void CompilerConfig::initializeArch() {
   return;
 }
 
+void CompilerConfig::setTriple(const std::string &pTriple) {
+  mTriple = pTriple;
+  initializeTarget();
+  initializeArch();
+  return;
+}
+
+bool CompilerConfig::setEmissionProfile(EmissionProfile pProfile) {
+  if (mEmissionProfile == pProfile) {
+    return false;
+  }
+  mEmissionProfile = pProfile;
+  return true;
+}
+
 void CompilerConfig::setFeatureString(const std::vector<std::string> &pAttrs) {
   llvm::SubtargetFeatures f;
 
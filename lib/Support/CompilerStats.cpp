@@ -0,0 +1,52 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CompilerStats.h"
+
+#include <string>
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace bcc;
+
+void CompilerStats::print(llvm::raw_ostream &pOut) const {
+  double total_wall_time = mLTOTime + mCodeGenTime;
+  double lto_percent = (total_wall_time > 0) ?
+                           (100.0 * mLTOTime / total_wall_time) : 0;
+  double codegen_percent = (total_wall_time > 0) ?
+                               (100.0 * mCodeGenTime / total_wall_time) : 0;
+
+  pOut << "===" << std::string(73, '-') << "===\n"
+       << "                        bcc pass execution report\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << llvm::format("  Total Execution Time: %.4f seconds (wall clock)\n",
+                       total_wall_time)
+       << llvm::format("  Functions: %lu -> %lu after LTO\n",
+                       static_cast<unsigned long>(mFunctionsBeforeLTO),
+                       static_cast<unsigned long>(mFunctionsAfterLTO))
+       << llvm::format("  Instructions: %lu -> %lu after LTO\n",
+                       static_cast<unsigned long>(mInstructionsBeforeLTO),
+                       static_cast<unsigned long>(mInstructionsAfterLTO))
+       << llvm::format("  Object size: %llu bytes\n\n",
+                       static_cast<unsigned long long>(mObjectSize))
+       << "   ---Wall Time---  --- Name ---\n"
+       << llvm::format("  %7.4f (%5.1f%%)  LTO\n", mLTOTime, lto_percent)
+       << llvm::format("  %7.4f (%5.1f%%)  Code generation\n", mCodeGenTime,
+                       codegen_percent)
+       << "\n";
+  pOut.flush();
+}
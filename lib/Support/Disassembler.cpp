@@ -20,6 +20,7 @@
 #if USE_DISASSEMBLER
 
 #include <string>
+#include <vector>
 
 #include <llvm/IR/LLVMContext.h>
 
@@ -27,14 +28,17 @@
 #include <llvm/MC/MCDisassembler.h>
 #include <llvm/MC/MCInst.h>
 #include <llvm/MC/MCInstPrinter.h>
+#include <llvm/MC/MCInstrAnalysis.h>
 #include <llvm/MC/MCInstrInfo.h>
 #include <llvm/MC/MCRegisterInfo.h>
 #include <llvm/MC/MCSubtargetInfo.h>
 
+#include <llvm/Support/Format.h>
 #include <llvm/Support/MemoryObject.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "bcc/Support/Initialization.h"
 #include "bcc/Support/OutputFile.h"
 #include "bcc/Support/Log.h"
 
@@ -61,126 +65,348 @@ public:
   }
 };
 
-} // namespace anonymous
+// The MC objects of a target needed to decode and print its instructions.
+class TargetDisassembler {
+private:
+  const llvm::MCSubtargetInfo *mSubtargetInfo;
+  const llvm::MCDisassembler *mDisassembler;
+  const llvm::MCInstrInfo *mInstrInfo;
+  const llvm::MCRegisterInfo *mRegInfo;
+  const llvm::MCAsmInfo *mAsmInfo;
+  const llvm::MCInstrAnalysis *mInstrAnalysis;
+  llvm::MCInstPrinter *mInstPrinter;
 
-namespace bcc {
+  TargetDisassembler(const TargetDisassembler &); // DISABLED.
+  void operator=(const TargetDisassembler &); // DISABLED.
 
-DisassembleResult Disassemble(llvm::raw_ostream &pOutput, const char *pTriple,
-                              const char *pFuncName, const uint8_t *pFunc,
-                              size_t pFuncSize) {
-  DisassembleResult result = kDisassembleSuccess;
-  uint64_t i = 0;
+public:
+  TargetDisassembler()
+    : mSubtargetInfo(NULL), mDisassembler(NULL), mInstrInfo(NULL),
+      mRegInfo(NULL), mAsmInfo(NULL), mInstrAnalysis(NULL),
+      mInstPrinter(NULL) { }
+
+  ~TargetDisassembler() {
+    delete mInstPrinter;
+    delete mInstrAnalysis;
+    delete mAsmInfo;
+    delete mRegInfo;
+    delete mInstrInfo;
+    delete mDisassembler;
+    delete mSubtargetInfo;
+  }
 
-  const llvm::MCSubtargetInfo *subtarget_info = NULL;
-  const llvm::MCDisassembler *disassembler = NULL;
-  const llvm::MCInstrInfo *mc_inst_info = NULL;
-  const llvm::MCRegisterInfo *mc_reg_info = NULL;
-  const llvm::MCAsmInfo *asm_info = NULL;
-  llvm::MCInstPrinter *inst_printer = NULL;
+  bcc::DisassembleResult init(const char *pTriple) {
+    // A driver which only loaded scripts hasn't initialized the backend yet.
+    bcc::init::InitializeDefaultTarget();
 
-  BufferMemoryObject *input_function = NULL;
+    std::string error;
+    const llvm::Target* target =
+        llvm::TargetRegistry::lookupTarget(pTriple, error);
 
-  std::string error;
-  const llvm::Target* target =
-      llvm::TargetRegistry::lookupTarget(pTriple, error);
+    if (target == NULL) {
+      ALOGE("Invalid target triple for disassembler: %s (%s)!",
+            pTriple, error.c_str());
+      return bcc::kDisassembleUnknownTarget;
+    }
 
-  if (target == NULL) {
-    ALOGE("Invalid target triple for disassembler: %s (%s)!",
-          pTriple, error.c_str());
-    return kDisassembleUnknownTarget;
-  }
+    mSubtargetInfo =
+        target->createMCSubtargetInfo(pTriple, /* CPU */"", /* Features */"");
+    if (mSubtargetInfo == NULL) {
+      return bcc::kDisassembleFailedSetup;
+    }
 
-  subtarget_info =
-      target->createMCSubtargetInfo(pTriple, /* CPU */"", /* Features */"");;
+    mDisassembler = target->createMCDisassembler(*mSubtargetInfo);
+    mInstrInfo = target->createMCInstrInfo();
+    mRegInfo = target->createMCRegInfo(pTriple);
+    mAsmInfo = target->createMCAsmInfo(pTriple);
 
-  if (subtarget_info == NULL) {
-    result = kDisassembleFailedSetup;
-    goto bail;
+    if ((mDisassembler == NULL) || (mInstrInfo == NULL) ||
+        (mRegInfo == NULL) || (mAsmInfo == NULL)) {
+      return bcc::kDisassembleFailedSetup;
+    }
+
+    mInstPrinter = target->createMCInstPrinter(mAsmInfo->getAssemblerDialect(),
+                                               *mAsmInfo, *mInstrInfo,
+                                               *mRegInfo, *mSubtargetInfo);
+    if (mInstPrinter == NULL) {
+      return bcc::kDisassembleFailedSetup;
+    }
+
+    // Only needed to find the loops.
+    mInstrAnalysis = target->createMCInstrAnalysis(mInstrInfo);
+
+    return bcc::kDisassembleSuccess;
   }
 
-  disassembler = target->createMCDisassembler(*subtarget_info);
+  // Decode the instruction at pOffset of pInput into pInst and pSize.
+  // Return false if the encoding is invalid (pSize is then 1, to skip the
+  // byte.)
+  bool decode(const BufferMemoryObject &pInput, uint64_t pOffset,
+              const char *pFuncName, const char *pTriple, llvm::MCInst &pInst,
+              uint64_t &pSize) const {
+    llvm::MCDisassembler::DecodeStatus decode_result =
+        mDisassembler->getInstruction(pInst, pSize, pInput, pOffset,
+                                      llvm::nulls(), llvm::nulls());
 
-  mc_inst_info = target->createMCInstrInfo();
+    switch (decode_result) {
+      case llvm::MCDisassembler::Fail: {
+        ALOGW("Invalid instruction encoding encountered at %llu of function %s "
+              "under %s.", pOffset, pFuncName, pTriple);
+        pSize = 1;
+        return false;
+      }
+      case llvm::MCDisassembler::SoftFail: {
+        ALOGW("Potentially undefined instruction encoding encountered at %llu "
+              "of function %s under %s.", pOffset, pFuncName, pTriple);
+        // fall-through
+      }
+      case llvm::MCDisassembler::Success : {
+        break;
+      }
+    }
+    return true;
+  }
 
-  mc_reg_info = target->createMCRegInfo(pTriple);
+  void print(const llvm::MCInst &pInst, llvm::raw_ostream &pOutput) const
+  { mInstPrinter->printInst(&pInst, pOutput, /* Annot */""); }
 
-  asm_info = target->createMCAsmInfo(pTriple);
+  // Set pTarget to the offset a branch at pOffset goes to if it's a direct
+  // one.
+  bool getBranchTarget(const llvm::MCInst &pInst, uint64_t pOffset,
+                       uint64_t pSize, uint64_t &pTarget) const {
+    return ((mInstrAnalysis != NULL) && mInstrAnalysis->isBranch(pInst) &&
+            mInstrAnalysis->evaluateBranch(pInst, pOffset, pSize, pTarget));
+  }
 
-  if ((disassembler == NULL) || (mc_inst_info == NULL) ||
-      (mc_reg_info == NULL) || (asm_info == NULL)) {
-    result = kDisassembleFailedSetup;
-    goto bail;
+  const llvm::MCInstrDesc &getDesc(const llvm::MCInst &pInst) const
+  { return mInstrInfo->get(pInst.getOpcode()); }
+
+  // Whether an operand of pInst is in a register class of 128 bits or more.
+  bool isVectorInst(const llvm::MCInst &pInst) const {
+    const llvm::MCInstrDesc &desc = getDesc(pInst);
+    for (unsigned i = 0, e = desc.getNumOperands(); i != e; i++) {
+      int reg_class = desc.OpInfo[i].RegClass;
+      if ((reg_class >= 0) &&
+          (static_cast<unsigned>(reg_class) < mRegInfo->getNumRegClasses()) &&
+          (mRegInfo->getRegClass(reg_class).getSize() >= 16)) {
+        return true;
+      }
+    }
+    return false;
   }
+};
 
-  inst_printer = target->createMCInstPrinter(asm_info->getAssemblerDialect(),
-                                             *asm_info, *mc_inst_info,
-                                             *mc_reg_info, *subtarget_info);
+struct DecodedInst {
+  uint64_t mOffset;
+  uint64_t mSize;
+  bool mValid;
+  llvm::MCInst mInst;
+  // The number of the innermost loop the instruction is in (from 1), 0 if
+  // none.
+  unsigned mLoop;
+};
+
+struct LoopSummary {
+  uint64_t mBegin;
+  uint64_t mEnd;
+  unsigned mNumInsts;
+  unsigned mNumLoads;
+  unsigned mNumStores;
+  unsigned mNumVectorInsts;
+  uint64_t mNumSamples;
+
+  LoopSummary(uint64_t pBegin, uint64_t pEnd)
+    : mBegin(pBegin), mEnd(pEnd), mNumInsts(0), mNumLoads(0), mNumStores(0),
+      mNumVectorInsts(0), mNumSamples(0) { }
+};
 
-  if (inst_printer == NULL) {
-    result = kDisassembleFailedSetup;
-    goto bail;
+uint64_t GetSamples(const bcc::DisassemblySamplesTy *pSamples,
+                    const DecodedInst &pInst) {
+  if (pSamples == NULL) {
+    return 0;
+  }
+  uint64_t count = 0;
+  for (bcc::DisassemblySamplesTy::const_iterator
+           sample_iter = pSamples->lower_bound(pInst.mOffset),
+           sample_end = pSamples->end();
+       (sample_iter != sample_end) &&
+           (sample_iter->first < pInst.mOffset + pInst.mSize);
+       sample_iter++) {
+    count += sample_iter->second;
   }
+  return count;
+}
 
-  input_function = new (std::nothrow) BufferMemoryObject(pFunc, pFuncSize);
+} // namespace anonymous
+
+namespace bcc {
 
-  if (input_function == NULL) {
-    result = kDisassembleOutOfMemory;
-    goto bail;
+DisassembleResult Disassemble(llvm::raw_ostream &pOutput, const char *pTriple,
+                              const char *pFuncName, const uint8_t *pFunc,
+                              size_t pFuncSize) {
+  TargetDisassembler disassembler;
+  DisassembleResult result = disassembler.init(pTriple);
+  if (result != kDisassembleSuccess) {
+    return result;
   }
 
+  BufferMemoryObject input_function(pFunc, pFuncSize);
+
   // Disassemble the given function
   pOutput << "Disassembled code: " << pFuncName << "\n";
 
+  uint64_t i = 0;
   while (i < pFuncSize) {
     llvm::MCInst inst;
     uint64_t inst_size;
 
-    llvm::MCDisassembler::DecodeStatus decode_result =
-        disassembler->getInstruction(inst, inst_size, *input_function, i,
-                                     llvm::nulls(), llvm::nulls());
+    if (disassembler.decode(input_function, i, pFuncName, pTriple, inst,
+                            inst_size)) {
+      const uint8_t *inst_addr = pFunc + i;
+
+      pOutput.indent(4);
+      pOutput << "0x";
+      pOutput.write_hex(reinterpret_cast<uintptr_t>(inst_addr));
+      pOutput << ": 0x";
+      pOutput.write_hex(*reinterpret_cast<const uint32_t *>(inst_addr));
+      disassembler.print(inst, pOutput);
+      pOutput << "\n";
+    }
 
-    switch (decode_result) {
-      case llvm::MCDisassembler::Fail: {
-        ALOGW("Invalid instruction encoding encountered at %llu of function %s "
-              "under %s.", i, pFuncName, pTriple);
-        i++;
+    i += inst_size;
+  }
+
+  pOutput << "\n";
+
+  return kDisassembleSuccess;
+}
+
+DisassembleResult DisassembleLoops(llvm::raw_ostream &pOutput,
+                                   const char *pTriple, const char *pFuncName,
+                                   const uint8_t *pFunc, size_t pFuncSize,
+                                   const DisassemblySamplesTy *pSamples) {
+  TargetDisassembler disassembler;
+  DisassembleResult result = disassembler.init(pTriple);
+  if (result != kDisassembleSuccess) {
+    return result;
+  }
+
+  BufferMemoryObject input_function(pFunc, pFuncSize);
+
+  // Decode the whole function first: the loops are only known once their
+  // backward branches are seen.
+  std::vector<DecodedInst> insts;
+  std::vector<LoopSummary> loops;
+  for (uint64_t i = 0; i < pFuncSize; ) {
+    insts.push_back(DecodedInst());
+    DecodedInst &decoded = insts.back();
+    decoded.mOffset = i;
+    decoded.mLoop = 0;
+    decoded.mValid = disassembler.decode(input_function, i, pFuncName, pTriple,
+                                         decoded.mInst, decoded.mSize);
+
+    uint64_t target;
+    if (decoded.mValid &&
+        disassembler.getBranchTarget(decoded.mInst, i, decoded.mSize,
+                                     target) &&
+        (target <= i)) {
+      loops.push_back(LoopSummary(target, i + decoded.mSize));
+    }
+    i += decoded.mSize;
+  }
+
+  // Keep the innermost loops, i.e., those no other loop is nested in.
+  std::vector<LoopSummary> innermost;
+  for (size_t i = 0, e = loops.size(); i != e; i++) {
+    bool has_inner = false;
+    for (size_t j = 0; (j != e) && !has_inner; j++) {
+      has_inner = ((j != i) && (loops[j].mBegin >= loops[i].mBegin) &&
+                   (loops[j].mEnd <= loops[i].mEnd) &&
+                   ((loops[j].mEnd - loops[j].mBegin) <
+                        (loops[i].mEnd - loops[i].mBegin)));
+    }
+    if (!has_inner) {
+      innermost.push_back(loops[i]);
+    }
+  }
+
+  uint64_t total_samples = 0;
+  for (size_t i = 0, e = insts.size(); i != e; i++) {
+    DecodedInst &decoded = insts[i];
+    uint64_t samples = GetSamples(pSamples, decoded);
+    total_samples += samples;
+
+    for (size_t j = 0, je = innermost.size(); j != je; j++) {
+      LoopSummary &loop = innermost[j];
+      if ((decoded.mOffset < loop.mBegin) || (decoded.mOffset >= loop.mEnd)) {
+        continue;
+      }
+      decoded.mLoop = j + 1;
+      loop.mNumSamples += samples;
+      if (!decoded.mValid) {
         break;
       }
-      case llvm::MCDisassembler::SoftFail: {
-        ALOGW("Potentially undefined instruction encoding encountered at %llu "
-              "of function %s under %s.", i, pFuncName, pTriple);
-        // fall-through
+      const llvm::MCInstrDesc &desc = disassembler.getDesc(decoded.mInst);
+      loop.mNumInsts++;
+      if (desc.mayLoad()) {
+        loop.mNumLoads++;
       }
-      case llvm::MCDisassembler::Success : {
-        const uint8_t *inst_addr = pFunc + i;
+      if (desc.mayStore()) {
+        loop.mNumStores++;
+      }
+      if (disassembler.isVectorInst(decoded.mInst)) {
+        loop.mNumVectorInsts++;
+      }
+      break;
+    }
+  }
 
-        pOutput.indent(4);
-        pOutput << "0x";
-        pOutput.write_hex(reinterpret_cast<uintptr_t>(inst_addr));
-        pOutput << ": 0x";
-        pOutput.write_hex(*reinterpret_cast<const uint32_t *>(inst_addr));
-        inst_printer->printInst(&inst, pOutput, /* Annot */"");
-        pOutput << "\n";
+  pOutput << "Loop report: " << pFuncName << " (" << pFuncSize << " bytes, "
+          << innermost.size() << " innermost loops)\n";
 
-        i += inst_size;
-        break;
-      }
+  for (size_t i = 0, e = insts.size(); i != e; i++) {
+    const DecodedInst &decoded = insts[i];
+    if (decoded.mLoop != 0) {
+      pOutput << llvm::format("  L%-3u|", decoded.mLoop);
+    } else {
+      pOutput << "      ";
+    }
+    if (pSamples != NULL) {
+      pOutput << llvm::format(" %8llu", static_cast<unsigned long long>(
+                                            GetSamples(pSamples, decoded)));
+    }
+    pOutput << llvm::format("  +0x%04llx:",
+                            static_cast<unsigned long long>(decoded.mOffset));
+    if (decoded.mValid) {
+      disassembler.print(decoded.mInst, pOutput);
+    } else {
+      pOutput << "\t<invalid>";
     }
+    pOutput << "\n";
   }
 
-  pOutput << "\n";
+  for (size_t i = 0, e = innermost.size(); i != e; i++) {
+    const LoopSummary &loop = innermost[i];
+    pOutput << llvm::format("  L%u [+0x%llx, +0x%llx): ",
+                            static_cast<unsigned>(i + 1),
+                            static_cast<unsigned long long>(loop.mBegin),
+                            static_cast<unsigned long long>(loop.mEnd))
+            << llvm::format("%u instructions, %u loads, %u stores, ",
+                            loop.mNumInsts, loop.mNumLoads, loop.mNumStores)
+            << llvm::format("%u vector, %u scalar", loop.mNumVectorInsts,
+                            loop.mNumInsts - loop.mNumVectorInsts);
+    if ((pSamples != NULL) && (total_samples > 0)) {
+      pOutput << llvm::format(", %llu samples (%.1f%%)",
+                              static_cast<unsigned long long>(
+                                  loop.mNumSamples),
+                              100.0 * loop.mNumSamples / total_samples);
+    }
+    pOutput << "\n";
+  }
 
-bail:
-  // Clean up
-  delete input_function;
-  delete inst_printer;
-  delete asm_info;
-  delete mc_reg_info;
-  delete mc_inst_info;
-  delete disassembler;
-  delete subtarget_info;
+  pOutput << "\n";
 
-  return result;
+  return kDisassembleSuccess;
 }
 
 DisassembleResult Disassemble(OutputFile &pOutput, const char *pTriple,
@@ -225,4 +451,11 @@ bcc::DisassembleResult bcc::Disassemble(OutputFile &pOutput,
   return bcc::kDisassemblerNotAvailable;
 }
 
+bcc::DisassembleResult
+bcc::DisassembleLoops(llvm::raw_ostream &pOutput, const char *pTriple,
+                      const char *pFuncName, const uint8_t *pFunc,
+                      size_t pFuncSize, const DisassemblySamplesTy *pSamples) {
+  return bcc::kDisassemblerNotAvailable;
+}
+
 #endif // USE_DISASSEMBLER
@@ -17,7 +17,9 @@
 #include "bcc/Support/FileBase.h"
 
 #include "bcc/Support/Log.h"
+#include "bcc/Support/Trace.h"
 
+#include <stdint.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -42,6 +44,31 @@ int flock(int fd, int operation) {
 }
 #endif  // _WIN32
 
+namespace {
+
+android::FileMap::MapAdvice
+GetMapAdvice(enum FileBase::AccessPatternEnum pPattern) {
+  switch (pPattern) {
+    case FileBase::kAccessSequential: return android::FileMap::SEQUENTIAL;
+    case FileBase::kAccessRandom:     return android::FileMap::RANDOM;
+    case FileBase::kAccessWillNeed:   return android::FileMap::WILLNEED;
+    default:                          return android::FileMap::NORMAL;
+  }
+}
+
+#if defined(__linux__)
+int GetFileAdvice(enum FileBase::AccessPatternEnum pPattern) {
+  switch (pPattern) {
+    case FileBase::kAccessSequential: return POSIX_FADV_SEQUENTIAL;
+    case FileBase::kAccessRandom:     return POSIX_FADV_RANDOM;
+    case FileBase::kAccessWillNeed:   return POSIX_FADV_WILLNEED;
+    default:                          return POSIX_FADV_NORMAL;
+  }
+}
+#endif
+
+} // end anonymous namespace
+
 FileBase::FileBase(const std::string &pFilename,
                    unsigned pOpenFlags,
                    unsigned pFlags)
@@ -148,6 +175,9 @@ bool FileBase::lock(enum LockModeEnum pMode,
     return true;
   }
 
+  // Including the time waiting for the other holders.
+  TraceSection trace("File lock", mName.c_str());
+
   // Determine the lock operation (2nd argument) to the flock().
   if (pMode == kReadLock) {
     lock_operation = LOCK_SH;
@@ -206,6 +236,38 @@ bool FileBase::lock(enum LockModeEnum pMode,
   return false;
 }
 
+bool FileBase::lockWithTimeout(enum LockModeEnum pMode, unsigned pTimeoutMs,
+                               bool *pContended) {
+  uint64_t remaining = static_cast<uint64_t>(pTimeoutMs) * 1000;
+  useconds_t backoff = kInitialLockBackoff;
+  bool first = true;
+
+  while (true) {
+    if (lock(pMode, /* pNonblocking */true, /* pMaxRetry */0,
+             /* pRetryInterval */0)) {
+      if (first && (pContended != NULL)) {
+        *pContended = false;
+      }
+      return true;
+    }
+    if (first && (pContended != NULL)) {
+      *pContended = !hasError();
+    }
+    first = false;
+
+    if (hasError() || (remaining == 0)) {
+      return false;
+    }
+
+    useconds_t wait = ((backoff < remaining) ? backoff : remaining);
+    ::usleep(wait);
+    remaining -= wait;
+    if (backoff < kMaxLockBackoff) {
+      backoff *= 2;
+    }
+  }
+}
+
 void FileBase::unlock() {
   if (mFD < 0) {
     return;
@@ -223,7 +285,8 @@ void FileBase::unlock() {
 }
 
 android::FileMap *FileBase::createMap(off_t pOffset, size_t pLength,
-                                      bool pIsReadOnly) {
+                                      bool pIsReadOnly,
+                                      enum AccessPatternEnum pPattern) {
   if (mFD < 0 || hasError()) {
     return NULL;
   }
@@ -240,9 +303,46 @@ android::FileMap *FileBase::createMap(off_t pOffset, size_t pLength,
     return NULL;
   }
 
+  if (pPattern != kAccessNormal) {
+    map->advise(GetMapAdvice(pPattern));
+  }
+
   return map;
 }
 
+bool FileBase::advise(enum AccessPatternEnum pPattern, off_t pOffset,
+                      off_t pLength) {
+  if (mFD < 0 || hasError()) {
+    return false;
+  }
+
+#if defined(__linux__)
+  return (::posix_fadvise(mFD, pOffset, pLength,
+                          GetFileAdvice(pPattern)) == 0);
+#else
+  return false;
+#endif
+}
+
+bool FileBase::Prefetch(const char *pPath) {
+#if defined(__linux__)
+  int fd;
+  do {
+    fd = ::open(pPath, O_RDONLY);
+  } while ((fd < 0) && (errno == EINTR));
+  if (fd < 0) {
+    return false;
+  }
+
+  // The read-ahead is queued and runs after the file is closed.
+  bool result = (::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0);
+  ::close(fd);
+  return result;
+#else
+  return false;
+#endif
+}
+
 size_t FileBase::getSize() {
   if (mFD < 0 || hasError()) {
     return static_cast<size_t>(-1);
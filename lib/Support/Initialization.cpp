@@ -16,6 +16,8 @@
 
 #include "bcc/Support/Initialization.h"
 
+#include <pthread.h>
+
 #include <cstdlib>
 
 #include <llvm/Support/ErrorHandling.h>
@@ -32,53 +34,75 @@ void llvm_error_handler(void *pUserData, const std::string &pMessage,
   ::exit(1);
 }
 
-} // end anonymous namespace
-
-void bcc::init::Initialize() {
-  static bool is_initialized = false;
-
-  if (is_initialized) {
-    return;
-  }
+pthread_once_t error_handler_once = PTHREAD_ONCE_INIT;
+pthread_once_t default_target_once = PTHREAD_ONCE_INIT;
+pthread_once_t all_targets_once = PTHREAD_ONCE_INIT;
 
+void InstallErrorHandler() {
   // Setup error handler for LLVM.
   llvm::remove_fatal_error_handler();
   llvm::install_fatal_error_handler(llvm_error_handler, NULL);
+}
+
+#if USE_DISASSEMBLER
+# define INITIALIZE_DISASSEMBLER(_target) \
+    LLVMInitialize ## _target ## Disassembler()
+#else
+# define INITIALIZE_DISASSEMBLER(_target) ((void) 0)
+#endif
+
+// Register everything of the backend _target with the target registry.
+#define INITIALIZE_BACKEND(_target)               \
+  do {                                            \
+    LLVMInitialize ## _target ## AsmPrinter();    \
+    LLVMInitialize ## _target ## AsmParser();     \
+    INITIALIZE_DISASSEMBLER(_target);             \
+    LLVMInitialize ## _target ## TargetMC();      \
+    LLVMInitialize ## _target ## TargetInfo();    \
+    LLVMInitialize ## _target ## Target();        \
+  } while (false)
+
+void InitializeDefaultBackend() {
+#if defined(DEFAULT_ARM_CODEGEN)
+  INITIALIZE_BACKEND(ARM);
+#elif defined(DEFAULT_MIPS_CODEGEN)
+  INITIALIZE_BACKEND(Mips);
+#elif defined(DEFAULT_X86_CODEGEN) || defined(DEFAULT_X86_64_CODEGEN)
+  INITIALIZE_BACKEND(X86);
+#endif
+}
 
+void InitializeAllBackends() {
+  // The LLVMInitialize*() are idempotent, so the default backend may have
+  // been initialized already.
 #if defined(PROVIDE_ARM_CODEGEN)
-  LLVMInitializeARMAsmPrinter();
-  LLVMInitializeARMAsmParser();
-# if USE_DISASSEMBLER
-  LLVMInitializeARMDisassembler();
-# endif
-  LLVMInitializeARMTargetMC();
-  LLVMInitializeARMTargetInfo();
-  LLVMInitializeARMTarget();
+  INITIALIZE_BACKEND(ARM);
 #endif
 
 #if defined(PROVIDE_MIPS_CODEGEN)
-  LLVMInitializeMipsAsmPrinter();
-  LLVMInitializeMipsAsmParser();
-# if USE_DISASSEMBLER
-  LLVMInitializeMipsDisassembler();
-# endif
-  LLVMInitializeMipsTargetMC();
-  LLVMInitializeMipsTargetInfo();
-  LLVMInitializeMipsTarget();
+  INITIALIZE_BACKEND(Mips);
 #endif
 
 #if defined(PROVIDE_X86_CODEGEN)
-  LLVMInitializeX86AsmPrinter();
-  LLVMInitializeX86AsmParser();
-# if USE_DISASSEMBLER
-  LLVMInitializeX86Disassembler();
-# endif
-  LLVMInitializeX86TargetMC();
-  LLVMInitializeX86TargetInfo();
-  LLVMInitializeX86Target();
+  INITIALIZE_BACKEND(X86);
 #endif
+}
+
+#undef INITIALIZE_BACKEND
+#undef INITIALIZE_DISASSEMBLER
+
+} // end anonymous namespace
 
-  is_initialized = true;
+void bcc::init::InitializeErrorHandler() {
+  ::pthread_once(&error_handler_once, InstallErrorHandler);
+}
 
-  return;
+void bcc::init::InitializeDefaultTarget() {
+  InitializeErrorHandler();
+  ::pthread_once(&default_target_once, InitializeDefaultBackend);
+}
+
+void bcc::init::Initialize() {
+  InitializeErrorHandler();
+  ::pthread_once(&all_targets_once, InitializeAllBackends);
 }
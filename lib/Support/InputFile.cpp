@@ -16,6 +16,8 @@
 
 #include "bcc/Support/InputFile.h"
 
+#include <utils/FileMap.h>
+
 #include "bcc/Support/Log.h"
 
 using namespace bcc;
@@ -51,3 +53,27 @@ ssize_t InputFile::read(void *pBuf, size_t count) {
   // unreachable
   return 0;
 }
+
+android::FileMap *InputFile::MapFile(const std::string &pFilename) {
+  InputFile input(pFilename);
+  if (input.hasError()) {
+    ALOGE("Unable to open %s! (%s)", pFilename.c_str(),
+          input.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  size_t size = input.getSize();
+  if (input.hasError() || (size == 0)) {
+    ALOGE("Failed to get the size of %s! (%s)", pFilename.c_str(),
+          input.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  android::FileMap *map = input.createMap(0, size, /* pIsReadOnly */true);
+  if (map == NULL) {
+    ALOGE("Failed to map %s! (%s)", pFilename.c_str(),
+          input.getErrorMessage().c_str());
+  }
+
+  return map;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/LZ4.h"
+
+#include <stdint.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace bcc;
+
+namespace {
+
+// The constraints of the format: a match is at least MinMatch bytes long and
+// at most MaxOffset bytes back, the last match starts at least MFLimit bytes
+// before the end of the block and the last LastLiterals bytes are literals.
+const size_t MinMatch = 4;
+const size_t MaxOffset = 65535;
+const size_t MFLimit = 12;
+const size_t LastLiterals = 5;
+
+// The 4-byte sequences are hashed into 1 << HashLog slots.
+const unsigned HashLog = 12;
+
+// A length that doesn't fit in its 4 bits of the token.
+const size_t RunMask = 15;
+
+inline uint32_t Read32(const uint8_t *pData) {
+  uint32_t value;
+  ::memcpy(&value, pData, sizeof(value));
+  return value;
+}
+
+inline uint32_t Hash(uint32_t pSequence) {
+  return ((pSequence * 2654435761U) >> (32 - HashLog));
+}
+
+// Append the part of pLength beyond RunMask.
+void WriteLength(std::string &pResult, size_t pLength) {
+  while (pLength >= 255) {
+    pResult.push_back(static_cast<char>(255));
+    pLength -= 255;
+  }
+  pResult.push_back(static_cast<char>(pLength));
+}
+
+// Append the sequence of the literals pLiterals[0, pNumLiterals) followed by
+// the match of pMatchLength bytes at pOffset (if pMatchLength isn't 0.)
+void WriteSequence(std::string &pResult, const uint8_t *pLiterals,
+                   size_t pNumLiterals, size_t pOffset, size_t pMatchLength) {
+  size_t token = pResult.size();
+  pResult.push_back('\0');
+
+  unsigned literal_bits = ((pNumLiterals >= RunMask) ? RunMask : pNumLiterals);
+  if (pNumLiterals >= RunMask) {
+    WriteLength(pResult, pNumLiterals - RunMask);
+  }
+  pResult.append(reinterpret_cast<const char *>(pLiterals), pNumLiterals);
+
+  unsigned match_bits = 0;
+  if (pMatchLength > 0) {
+    pResult.push_back(static_cast<char>(pOffset & 0xff));
+    pResult.push_back(static_cast<char>(pOffset >> 8));
+
+    size_t length = pMatchLength - MinMatch;
+    match_bits = ((length >= RunMask) ? RunMask : length);
+    if (length >= RunMask) {
+      WriteLength(pResult, length - RunMask);
+    }
+  }
+
+  pResult[token] = static_cast<char>((literal_bits << 4) | match_bits);
+}
+
+// Read the part of a length beyond RunMask at pInput into pLength. Return
+// false if it runs past pEnd.
+bool ReadLength(const uint8_t *&pInput, const uint8_t *pEnd,
+                size_t &pLength) {
+  uint8_t byte;
+  do {
+    if (pInput >= pEnd) {
+      return false;
+    }
+    byte = *pInput++;
+    pLength += byte;
+  } while (byte == 255);
+  return true;
+}
+
+} // end anonymous namespace
+
+void LZ4::Compress(const void *pSrc, size_t pSrcSize, std::string &pResult) {
+  const uint8_t *src = static_cast<const uint8_t *>(pSrc);
+
+  pResult.clear();
+  pResult.reserve(pSrcSize + (pSrcSize / 255) + 16);
+
+  size_t anchor = 0;
+  if (pSrcSize > MFLimit) {
+    // The positions of the last sequence of each hash.
+    std::vector<uint32_t> table(1 << HashLog, 0);
+    size_t match_limit = pSrcSize - MFLimit;
+    size_t end_limit = pSrcSize - LastLiterals;
+
+    size_t pos = 0;
+    while (pos < match_limit) {
+      uint32_t sequence = Read32(src + pos);
+      uint32_t &slot = table[Hash(sequence)];
+      size_t ref = slot;
+      slot = pos;
+
+      if ((ref >= pos) || ((pos - ref) > MaxOffset) ||
+          (Read32(src + ref) != sequence)) {
+        pos++;
+        continue;
+      }
+
+      // Take the bytes before the match that it covers too.
+      while ((pos > anchor) && (ref > 0) && (src[pos - 1] == src[ref - 1])) {
+        pos--;
+        ref--;
+      }
+
+      size_t length = MinMatch;
+      while (((pos + length) < end_limit) &&
+             (src[pos + length] == src[ref + length])) {
+        length++;
+      }
+
+      WriteSequence(pResult, src + anchor, pos - anchor, pos - ref, length);
+      pos += length;
+      anchor = pos;
+    }
+  }
+
+  WriteSequence(pResult, src + anchor, pSrcSize - anchor, 0, 0);
+}
+
+bool LZ4::Decompress(const void *pSrc, size_t pSrcSize,
+                     void *pDst, size_t pDstSize) {
+  const uint8_t *input = static_cast<const uint8_t *>(pSrc);
+  const uint8_t *input_end = input + pSrcSize;
+  uint8_t *output_begin = static_cast<uint8_t *>(pDst);
+  uint8_t *output = output_begin;
+  uint8_t *output_end = output_begin + pDstSize;
+
+  while (input < input_end) {
+    unsigned token = *input++;
+
+    size_t num_literals = (token >> 4);
+    if ((num_literals == RunMask) &&
+        !ReadLength(input, input_end, num_literals)) {
+      return false;
+    }
+    if ((num_literals > static_cast<size_t>(input_end - input)) ||
+        (num_literals > static_cast<size_t>(output_end - output))) {
+      return false;
+    }
+    ::memcpy(output, input, num_literals);
+    input += num_literals;
+    output += num_literals;
+
+    // The last sequence has no match.
+    if (input == input_end) {
+      break;
+    }
+
+    if ((input_end - input) < 2) {
+      return false;
+    }
+    size_t offset = input[0] | (input[1] << 8);
+    input += 2;
+    if ((offset == 0) ||
+        (offset > static_cast<size_t>(output - output_begin))) {
+      return false;
+    }
+
+    size_t length = (token & RunMask);
+    if ((length == RunMask) && !ReadLength(input, input_end, length)) {
+      return false;
+    }
+    length += MinMatch;
+    if (length > static_cast<size_t>(output_end - output)) {
+      return false;
+    }
+
+    const uint8_t *match = output - offset;
+    if (offset >= length) {
+      ::memcpy(output, match, length);
+      output += length;
+    } else {
+      // The match overlaps the bytes it produces (e.g., a run.)
+      for (size_t i = 0; i < length; i++) {
+        *output++ = *match++;
+      }
+    }
+  }
+
+  return (output == output_end);
+}
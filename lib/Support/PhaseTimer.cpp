@@ -0,0 +1,194 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/PhaseTimer.h"
+
+#include <string>
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/TimeValue.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace bcc;
+
+namespace {
+
+llvm::sys::Mutex gLock;
+
+PhaseCallback gCallback = NULL;
+void *gCallbackUserData = NULL;
+
+bool gAccumulate = false;
+
+struct PhaseTotal {
+  PhaseStats mStats;
+  unsigned mCount;
+};
+
+PhaseTotal gTotals[kNumCompilePhases];
+
+// Whether any PhaseTimer should measure. Updated under gLock but read without
+// it: a timer which races with SetCallback() at worst misses one report.
+volatile bool gEnabled = false;
+
+void GetTimes(double &pWallTime, double &pCPUTime) {
+  llvm::sys::TimeValue elapsed, user, sys;
+  llvm::sys::Process::GetTimeUsage(elapsed, user, sys);
+  pWallTime = elapsed.seconds() + elapsed.nanoseconds() * 1e-9;
+  pCPUTime = (user.seconds() + sys.seconds()) +
+             (user.nanoseconds() + sys.nanoseconds()) * 1e-9;
+}
+
+long GetPeakRSS() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    // In bytes on Darwin.
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+#endif
+  return 0;
+}
+
+} // end anonymous namespace
+
+PhaseTimer::PhaseTimer(CompilePhase pPhase, const char *pName)
+  : mTrace(GetPhaseName(pPhase), pName), mPhase(pPhase), mName(pName),
+    mActive(gEnabled), mStartWallTime(0),
+    mStartCPUTime(0), mStartPeakRSS(0) {
+  if (mActive) {
+    mStartPeakRSS = GetPeakRSS();
+    GetTimes(mStartWallTime, mStartCPUTime);
+  }
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (!mActive) {
+    return;
+  }
+
+  PhaseStats stats;
+  double wall_time, cpu_time;
+  GetTimes(wall_time, cpu_time);
+  stats.mWallTime = wall_time - mStartWallTime;
+  stats.mCPUTime = cpu_time - mStartCPUTime;
+  stats.mPeakRSS = GetPeakRSS();
+  stats.mPeakRSSDelta = stats.mPeakRSS - mStartPeakRSS;
+
+  PhaseCallback callback;
+  void *user_data;
+  {
+    llvm::MutexGuard locked(gLock);
+    if (gAccumulate) {
+      PhaseTotal &total = gTotals[mPhase];
+      total.mStats.mWallTime += stats.mWallTime;
+      total.mStats.mCPUTime += stats.mCPUTime;
+      total.mStats.mPeakRSSDelta += stats.mPeakRSSDelta;
+      if (stats.mPeakRSS > total.mStats.mPeakRSS) {
+        total.mStats.mPeakRSS = stats.mPeakRSS;
+      }
+      total.mCount++;
+    }
+    callback = gCallback;
+    user_data = gCallbackUserData;
+  }
+
+  // Don't hold gLock in the callback in case it starts a timer itself.
+  if (callback != NULL) {
+    callback(mPhase, mName, stats, user_data);
+  }
+}
+
+const char *PhaseTimer::GetPhaseName(CompilePhase pPhase) {
+  switch (pPhase) {
+    case kPhaseBitcodeParse:  return "Bitcode parse";
+    case kPhaseExtractInfo:   return "Metadata extraction";
+    case kPhaseLinkRuntime:   return "Runtime link";
+    case kPhaseLTO:           return "LTO";
+    case kPhaseCodeGen:       return "Code generation";
+    case kPhaseWriteInfo:     return "Info write";
+    case kPhaseCacheLoad:     return "Cache load";
+    case kPhaseRelocation:    return "Relocation";
+    case kPhaseLinkSharedObject: return "Shared object link";
+    default: {
+      break;
+    }
+  }
+  return "(unknown)";
+}
+
+void PhaseTimer::SetCallback(PhaseCallback pCallback, void *pUserData) {
+  llvm::MutexGuard locked(gLock);
+  gCallback = pCallback;
+  gCallbackUserData = pUserData;
+  gEnabled = (gCallback != NULL) || gAccumulate;
+}
+
+void PhaseTimer::EnableAccumulation(bool pEnable) {
+  llvm::MutexGuard locked(gLock);
+  gAccumulate = pEnable;
+  gEnabled = (gCallback != NULL) || gAccumulate;
+}
+
+void PhaseTimer::PrintReport(llvm::raw_ostream &pOut) {
+  llvm::MutexGuard locked(gLock);
+
+  double total_wall_time = 0;
+  for (unsigned i = 0; i < kNumCompilePhases; i++) {
+    total_wall_time += gTotals[i].mStats.mWallTime;
+  }
+
+  pOut << "===" << std::string(73, '-') << "===\n"
+       << "                      bcc compile and load phase report\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << llvm::format("  Total Execution Time: %.4f seconds (wall clock)\n\n",
+                       total_wall_time)
+       << "   ---Wall Time---   --CPU Time--  Peak RSS +KiB  Peak RSS KiB  "
+          "Count  Name ---\n";
+
+  for (unsigned i = 0; i < kNumCompilePhases; i++) {
+    PhaseTotal &total = gTotals[i];
+    if (total.mCount == 0) {
+      continue;
+    }
+    double percent = (total_wall_time > 0) ?
+                         (100.0 * total.mStats.mWallTime / total_wall_time) : 0;
+    pOut << llvm::format("  %7.4f (%5.1f%%)  %10.4f  %13ld",
+                         total.mStats.mWallTime, percent,
+                         total.mStats.mCPUTime, total.mStats.mPeakRSSDelta)
+         << llvm::format("  %12ld  %5u  %s\n", total.mStats.mPeakRSS,
+                         total.mCount,
+                         GetPhaseName(static_cast<CompilePhase>(i)));
+    total.mStats.mWallTime = 0;
+    total.mStats.mCPUTime = 0;
+    total.mStats.mPeakRSSDelta = 0;
+    total.mStats.mPeakRSS = 0;
+    total.mCount = 0;
+  }
+  pOut << "\n";
+  pOut.flush();
+}
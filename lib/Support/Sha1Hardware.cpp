@@ -0,0 +1,334 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Sha1Hardware.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace bcc;
+
+namespace {
+
+//===----------------------------------------------------------------------===//
+// x86 (SHA extensions)
+//===----------------------------------------------------------------------===//
+#if defined(__i386__) || defined(__x86_64__)
+#define HAVE_HARDWARE_SHA1 1
+
+bool DetectHardware() {
+  unsigned eax, ebx, ecx, edx;
+  // SSSE3 (for pshufb.)
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1 << 9))) {
+    return false;
+  }
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  // SHA.
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return ((ebx & (1 << 29)) != 0);
+}
+
+// The instructions take their operands in SSE registers. The compiler isn't
+// asked for the extensions (the rest of the file stays runnable on the CPUs
+// without them), so they're written in assembly.
+typedef uint32_t VectorTy __attribute__((vector_size(16)));
+
+inline VectorTy Load(const void *pData) {
+  VectorTy v;
+  ::memcpy(&v, pData, sizeof(v));
+  return v;
+}
+
+inline VectorTy ShuffleBytes(VectorTy pV, VectorTy pMask) {
+  __asm__("pshufb %1, %0" : "+x"(pV) : "x"(pMask));
+  return pV;
+}
+
+// {A, B, C, D} to {D, C, B, A}, the order of sha1rnds4.
+inline VectorTy ReverseWords(VectorTy pV) {
+  VectorTy result;
+  __asm__("pshufd $0x1b, %1, %0" : "=x"(result) : "x"(pV));
+  return result;
+}
+
+// Four rounds with the function and the constant of the rounds 20 * F to
+// 20 * F + 19.
+template <int F>
+inline VectorTy Rounds(VectorTy pABCD, VectorTy pE) {
+  __asm__("sha1rnds4 %2, %1, %0" : "+x"(pABCD) : "x"(pE), "i"(F));
+  return pABCD;
+}
+
+inline VectorTy NextE(VectorTy pE, VectorTy pMessage) {
+  __asm__("sha1nexte %1, %0" : "+x"(pE) : "x"(pMessage));
+  return pE;
+}
+
+inline VectorTy Message1(VectorTy pA, VectorTy pB) {
+  __asm__("sha1msg1 %1, %0" : "+x"(pA) : "x"(pB));
+  return pA;
+}
+
+inline VectorTy Message2(VectorTy pA, VectorTy pB) {
+  __asm__("sha1msg2 %1, %0" : "+x"(pA) : "x"(pB));
+  return pA;
+}
+
+// The rounds 4 * G to 4 * G + 3. pMessage holds the four last groups of words
+// of the schedule, the one of these rounds in pMessage[G % 4]. E alternates
+// between the two of pE, the other one keeping ABCD for the next rounds.
+template <int G>
+inline void Group(VectorTy &pABCD, VectorTy pE[2], VectorTy pMessage[4]) {
+  VectorTy &e = pE[G % 2];
+  const VectorTy &message = pMessage[G % 4];
+  if (G == 0) {
+    e += message;
+  } else {
+    e = NextE(e, message);
+  }
+  pE[(G + 1) % 2] = pABCD;
+  if ((G >= 3) && (G <= 18)) {
+    pMessage[(G + 1) % 4] = Message2(pMessage[(G + 1) % 4], message);
+  }
+  pABCD = Rounds<G / 5>(pABCD, e);
+  if ((G >= 1) && (G <= 16)) {
+    pMessage[(G + 3) % 4] = Message1(pMessage[(G + 3) % 4], message);
+  }
+  if ((G >= 2) && (G <= 17)) {
+    pMessage[(G + 2) % 4] ^= message;
+  }
+}
+
+void ProcessBlocksInHardware(uint32_t pState[5], const uint8_t *pData,
+                             size_t pNumBlocks) {
+  // The words of the blocks are big-endian.
+  static const uint8_t ByteReversal[16] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+  };
+  const VectorTy mask = Load(ByteReversal);
+
+  VectorTy abcd = ReverseWords(Load(pState));
+  uint32_t e_words[4] = { 0, 0, 0, pState[4] };
+  VectorTy e0 = Load(e_words);
+
+  for (size_t i = 0; i < pNumBlocks; i++, pData += 64) {
+    VectorTy abcd_saved = abcd;
+    VectorTy e0_saved = e0;
+
+    VectorTy message[4];
+    for (unsigned j = 0; j < 4; j++) {
+      message[j] = ShuffleBytes(Load(pData + 16 * j), mask);
+    }
+
+    VectorTy e[2] = { e0, e0 };
+    Group<0>(abcd, e, message);
+    Group<1>(abcd, e, message);
+    Group<2>(abcd, e, message);
+    Group<3>(abcd, e, message);
+    Group<4>(abcd, e, message);
+    Group<5>(abcd, e, message);
+    Group<6>(abcd, e, message);
+    Group<7>(abcd, e, message);
+    Group<8>(abcd, e, message);
+    Group<9>(abcd, e, message);
+    Group<10>(abcd, e, message);
+    Group<11>(abcd, e, message);
+    Group<12>(abcd, e, message);
+    Group<13>(abcd, e, message);
+    Group<14>(abcd, e, message);
+    Group<15>(abcd, e, message);
+    Group<16>(abcd, e, message);
+    Group<17>(abcd, e, message);
+    Group<18>(abcd, e, message);
+    Group<19>(abcd, e, message);
+
+    e0 = NextE(e[0], e0_saved);
+    abcd += abcd_saved;
+  }
+
+  abcd = ReverseWords(abcd);
+  ::memcpy(pState, &abcd, 4 * sizeof(uint32_t));
+  ::memcpy(e_words, &e0, sizeof(e_words));
+  pState[4] = e_words[3];
+}
+
+//===----------------------------------------------------------------------===//
+// AArch64 (SHA-1 instructions of the crypto extension)
+//===----------------------------------------------------------------------===//
+#elif defined(__aarch64__)
+#define HAVE_HARDWARE_SHA1 1
+
+// The kernel reports the extension in the HWCAP of the auxiliary vector.
+// Read it from /proc (getauxval() isn't in every libc we build against.)
+bool DetectHardware() {
+  const unsigned long AT_HWCAP_TYPE = 16;
+  const unsigned long HWCAP_SHA1_BIT = 1UL << 5;
+
+  int fd = ::open("/proc/self/auxv", O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool result = false;
+  unsigned long entry[2];
+  while (::read(fd, entry, sizeof(entry)) ==
+             static_cast<ssize_t>(sizeof(entry))) {
+    if (entry[0] == AT_HWCAP_TYPE) {
+      result = ((entry[1] & HWCAP_SHA1_BIT) != 0);
+      break;
+    }
+  }
+  ::close(fd);
+  return result;
+}
+
+// The instructions are enabled for these only (the rest of the file stays
+// runnable on the CPUs without the extension.)
+inline uint32_t FixedRotate(uint32_t pA) {
+  uint32_t result;
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1h %s0, %s1" : "=w"(result) : "w"(pA));
+  return result;
+}
+
+inline uint32x4_t Choose(uint32x4_t pABCD, uint32_t pE, uint32x4_t pW) {
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1c %q0, %s1, %2.4s" : "+w"(pABCD) : "w"(pE), "w"(pW));
+  return pABCD;
+}
+
+inline uint32x4_t Parity(uint32x4_t pABCD, uint32_t pE, uint32x4_t pW) {
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1p %q0, %s1, %2.4s" : "+w"(pABCD) : "w"(pE), "w"(pW));
+  return pABCD;
+}
+
+inline uint32x4_t Majority(uint32x4_t pABCD, uint32_t pE, uint32x4_t pW) {
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1m %q0, %s1, %2.4s" : "+w"(pABCD) : "w"(pE), "w"(pW));
+  return pABCD;
+}
+
+// The next four words of the schedule from the last sixteen, pA being the
+// oldest four.
+inline uint32x4_t NextMessage(uint32x4_t pA, uint32x4_t pB, uint32x4_t pC,
+                              uint32x4_t pD) {
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1su0 %0.4s, %1.4s, %2.4s" : "+w"(pA) : "w"(pB), "w"(pC));
+  __asm__(".arch armv8-a+crypto\n\t"
+          "sha1su1 %0.4s, %1.4s" : "+w"(pA) : "w"(pD));
+  return pA;
+}
+
+// The rounds 4 * G to 4 * G + 3. pMessage holds the four last groups of words
+// of the schedule, the one of these rounds in pMessage[G % 4].
+template <int G>
+inline void Group(uint32x4_t &pABCD, uint32_t &pE, uint32x4_t pMessage[4]) {
+  const uint32_t k = (G < 5) ? 0x5a827999 :
+                     (G < 10) ? 0x6ed9eba1 :
+                     (G < 15) ? 0x8f1bbcdc : 0xca62c1d6;
+  uint32x4_t w = vaddq_u32(pMessage[G % 4], vdupq_n_u32(k));
+  // E of the next rounds.
+  uint32_t e = FixedRotate(vgetq_lane_u32(pABCD, 0));
+  if (G < 5) {
+    pABCD = Choose(pABCD, pE, w);
+  } else if ((G >= 10) && (G < 15)) {
+    pABCD = Majority(pABCD, pE, w);
+  } else {
+    pABCD = Parity(pABCD, pE, w);
+  }
+  pE = e;
+  if (G < 16) {
+    pMessage[G % 4] = NextMessage(pMessage[G % 4], pMessage[(G + 1) % 4],
+                                  pMessage[(G + 2) % 4],
+                                  pMessage[(G + 3) % 4]);
+  }
+}
+
+void ProcessBlocksInHardware(uint32_t pState[5], const uint8_t *pData,
+                             size_t pNumBlocks) {
+  uint32x4_t abcd = vld1q_u32(pState);
+  uint32_t e = pState[4];
+
+  for (size_t i = 0; i < pNumBlocks; i++, pData += 64) {
+    uint32x4_t abcd_saved = abcd;
+    uint32_t e_saved = e;
+
+    // The words of the blocks are big-endian.
+    uint32x4_t message[4];
+    for (unsigned j = 0; j < 4; j++) {
+      message[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(pData + 16 * j)));
+    }
+
+    Group<0>(abcd, e, message);
+    Group<1>(abcd, e, message);
+    Group<2>(abcd, e, message);
+    Group<3>(abcd, e, message);
+    Group<4>(abcd, e, message);
+    Group<5>(abcd, e, message);
+    Group<6>(abcd, e, message);
+    Group<7>(abcd, e, message);
+    Group<8>(abcd, e, message);
+    Group<9>(abcd, e, message);
+    Group<10>(abcd, e, message);
+    Group<11>(abcd, e, message);
+    Group<12>(abcd, e, message);
+    Group<13>(abcd, e, message);
+    Group<14>(abcd, e, message);
+    Group<15>(abcd, e, message);
+    Group<16>(abcd, e, message);
+    Group<17>(abcd, e, message);
+    Group<18>(abcd, e, message);
+    Group<19>(abcd, e, message);
+
+    abcd = vaddq_u32(abcd, abcd_saved);
+    e += e_saved;
+  }
+
+  vst1q_u32(pState, abcd);
+  pState[4] = e;
+}
+#endif
+
+} // end anonymous namespace
+
+bool sha1hw::IsAvailable() {
+#if defined(HAVE_HARDWARE_SHA1)
+  static const bool has_hardware = DetectHardware();
+  return has_hardware;
+#else
+  return false;
+#endif
+}
+
+void sha1hw::ProcessBlocks(uint32_t pState[5], const uint8_t *pData,
+                           size_t pNumBlocks) {
+#if defined(HAVE_HARDWARE_SHA1)
+  ProcessBlocksInHardware(pState, pData, pNumBlocks);
+#else
+  assert(false && "No SHA-1 instructions on this target!");
+#endif
+}
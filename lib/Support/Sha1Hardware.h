@@ -0,0 +1,47 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BCC_SUPPORT_SHA1_HARDWARE_H
+#define BCC_SUPPORT_SHA1_HARDWARE_H
+
+#include <stdint.h>
+
+#include <cstddef>
+
+namespace bcc {
+
+/*
+ * The SHA-1 block transforms of the CPUs which have SHA-1 instructions (the
+ * SHA extensions of x86, the crypto extension of ARMv8.) Sha1Util falls back
+ * on the SHA-1 of the C library (or sha1.c on the host) elsewhere.
+ */
+namespace sha1hw {
+
+// Return true if ProcessBlocks() can run on this CPU. Detected on the first
+// call.
+bool IsAvailable();
+
+// Run the compression function over the pNumBlocks 64-byte blocks at pData,
+// updating the five words of pState (A to E.)
+void ProcessBlocks(uint32_t pState[5], const uint8_t *pData,
+                   size_t pNumBlocks);
+
+} // end namespace sha1hw
+
+} // end namespace bcc
+
+#endif // BCC_SUPPORT_SHA1_HARDWARE_H
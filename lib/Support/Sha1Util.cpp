@@ -20,11 +20,147 @@
 
 #include <cstring>
 
+#include <utils/FileMap.h>
+
 #include "bcc/Support/Log.h"
 #include "bcc/Support/InputFile.h"
 
+#include "Sha1Hardware.h"
+
 using namespace bcc;
 
+namespace {
+
+// Make sure Sha1Util::Context::mStorage is large enough to hold SHA1_CTX.
+typedef char SHA1ContextFitsInStorage[
+    (sizeof(SHA1_CTX) <= 24 * sizeof(uint32_t)) ? 1 : -1];
+
+// Mapped files are fed to SHA1Update() in chunks of this size. This bounds
+// the argument to SHA1Update() (which takes unsigned long) and keeps the
+// working set small while the kernel reads ahead.
+const size_t HashChunkSize = 1024 * 1024;
+
+inline SHA1_CTX *ToSHA1Context(uint32_t *pStorage) {
+  return reinterpret_cast<SHA1_CTX *>(pStorage);
+}
+
+//===----------------------------------------------------------------------===//
+// The context of the SHA-1 instructions (see sha1hw), in place of SHA1_CTX
+//===----------------------------------------------------------------------===//
+struct BlockContext {
+  uint32_t mState[5];
+  // Number of bytes hashed, the low word first.
+  uint32_t mLength[2];
+  uint8_t mBuffer[64];
+};
+
+typedef char BlockContextFitsInStorage[
+    (sizeof(BlockContext) <= 24 * sizeof(uint32_t)) ? 1 : -1];
+
+inline BlockContext *ToBlockContext(uint32_t *pStorage) {
+  return reinterpret_cast<BlockContext *>(pStorage);
+}
+
+void BlockInit(BlockContext *pContext) {
+  pContext->mState[0] = 0x67452301;
+  pContext->mState[1] = 0xefcdab89;
+  pContext->mState[2] = 0x98badcfe;
+  pContext->mState[3] = 0x10325476;
+  pContext->mState[4] = 0xc3d2e1f0;
+  pContext->mLength[0] = pContext->mLength[1] = 0;
+}
+
+void BlockUpdate(BlockContext *pContext, const uint8_t *pData, size_t pSize) {
+  uint64_t length = ((static_cast<uint64_t>(pContext->mLength[1]) << 32) |
+                     pContext->mLength[0]);
+  size_t buffered = static_cast<size_t>(length & 63);
+  length += pSize;
+  pContext->mLength[0] = static_cast<uint32_t>(length);
+  pContext->mLength[1] = static_cast<uint32_t>(length >> 32);
+
+  // Complete the buffered block, then hash the whole blocks straight from
+  // pData.
+  if (buffered > 0) {
+    size_t fill = (pSize < (64 - buffered)) ? pSize : (64 - buffered);
+    ::memcpy(pContext->mBuffer + buffered, pData, fill);
+    pData += fill;
+    pSize -= fill;
+    if ((buffered + fill) < 64) {
+      return;
+    }
+    sha1hw::ProcessBlocks(pContext->mState, pContext->mBuffer, 1);
+  }
+  if (pSize >= 64) {
+    sha1hw::ProcessBlocks(pContext->mState, pData, pSize / 64);
+    pData += pSize & ~static_cast<size_t>(63);
+    pSize &= 63;
+  }
+  ::memcpy(pContext->mBuffer, pData, pSize);
+}
+
+void BlockFinal(uint8_t pResult[SHA1_DIGEST_LENGTH], BlockContext *pContext) {
+  uint64_t length = ((static_cast<uint64_t>(pContext->mLength[1]) << 32) |
+                     pContext->mLength[0]);
+  uint64_t bits = length * 8;
+
+  // 0x80, the zeros up to 56 bytes in the last block and the length in bits.
+  uint8_t padding[64 + 8];
+  size_t buffered = static_cast<size_t>(length & 63);
+  size_t padding_size = (buffered < 56) ? (56 - buffered) : (120 - buffered);
+  padding[0] = 0x80;
+  ::memset(padding + 1, 0, padding_size - 1);
+  for (unsigned i = 0; i < 8; i++) {
+    padding[padding_size + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+  BlockUpdate(pContext, padding, padding_size + 8);
+
+  for (unsigned i = 0; i < 5; i++) {
+    uint32_t word = pContext->mState[i];
+    pResult[4 * i] = static_cast<uint8_t>(word >> 24);
+    pResult[4 * i + 1] = static_cast<uint8_t>(word >> 16);
+    pResult[4 * i + 2] = static_cast<uint8_t>(word >> 8);
+    pResult[4 * i + 3] = static_cast<uint8_t>(word);
+  }
+}
+
+} // end anonymous namespace
+
+bool Sha1Util::HasHardwareSupport() {
+  return sha1hw::IsAvailable();
+}
+
+void Sha1Util::Context::reset() {
+  if (HasHardwareSupport()) {
+    BlockInit(ToBlockContext(mStorage));
+    return;
+  }
+  SHA1Init(ToSHA1Context(mStorage));
+}
+
+void Sha1Util::Context::update(const uint8_t *pData, size_t pSize) {
+  if (HasHardwareSupport()) {
+    BlockUpdate(ToBlockContext(mStorage), pData, pSize);
+    return;
+  }
+  while (pSize > 0) {
+    size_t chunk = (pSize > HashChunkSize) ? HashChunkSize : pSize;
+    SHA1Update(ToSHA1Context(mStorage),
+               reinterpret_cast<const unsigned char *>(pData),
+               static_cast<unsigned long>(chunk));
+    pData += chunk;
+    pSize -= chunk;
+  }
+}
+
+void Sha1Util::Context::finalize(uint8_t pResult[SHA1_DIGEST_LENGTH]) {
+  if (HasHardwareSupport()) {
+    BlockFinal(pResult, ToBlockContext(mStorage));
+  } else {
+    SHA1Final(pResult, ToSHA1Context(mStorage));
+  }
+  reset();
+}
+
 bool Sha1Util::GetSHA1DigestFromFile(uint8_t pResult[SHA1_DIGEST_LENGTH],
                                      const char *pFilename) {
   InputFile file(pFilename);
@@ -35,43 +171,99 @@ bool Sha1Util::GetSHA1DigestFromFile(uint8_t pResult[SHA1_DIGEST_LENGTH],
     return false;
   }
 
-  SHA1_CTX sha1_context;
-  SHA1Init(&sha1_context);
+  Context context;
+
+  // Hash straight from the page cache if the file can be mapped. This avoids
+  // both the read() syscalls and the copy into a user buffer.
+  size_t file_size = file.getSize();
+  if (file_size == 0) {
+    context.finalize(pResult);
+    return true;
+  }
+
+  android::FileMap *map = file.createMap(0, file_size, /* pIsReadOnly */true);
+  if (map != NULL) {
+    map->advise(android::FileMap::SEQUENTIAL);
+    context.update(reinterpret_cast<const uint8_t *>(map->getDataPtr()),
+                   map->getDataLength());
+    map->release();
+    context.finalize(pResult);
+    return true;
+  }
+
+  // Fall back to buffered reads (e.g., the file lives on a file system that
+  // doesn't support mmap.) A failed createMap() leaves an error on file, so
+  // read through a fresh descriptor.
+  ALOGV("Unable to map %s for SHA-1 checksum calculation (%s). Reading it "
+        "instead.", pFilename, file.getErrorMessage().c_str());
+
+  InputFile reader(pFilename);
+  if (reader.hasError()) {
+    ALOGE("Unable to reopen the file %s for SHA-1 checksum calculation! (%s)",
+          pFilename, reader.getErrorMessage().c_str());
+    return false;
+  }
 
-  char buf[256];
+  char buf[4096];
   while (true) {
-    ssize_t nread = file.read(buf, sizeof(buf));
+    ssize_t nread = reader.read(buf, sizeof(buf));
 
     if (nread < 0) {
       // Some errors occurred during file reading.
       return false;
     }
 
-    SHA1Update(&sha1_context,
-               reinterpret_cast<unsigned char *>(buf),
-               static_cast<unsigned long>(nread));
+    context.update(buf, static_cast<size_t>(nread));
 
     if (static_cast<size_t>(nread) < sizeof(buf)) {
       break;
     }
   }
 
-  SHA1Final(pResult, &sha1_context);
+  context.finalize(pResult);
 
   return true;
 }
 
 bool Sha1Util::GetSHA1DigestFromBuffer(uint8_t pResult[SHA1_DIGEST_LENGTH],
                                        const uint8_t *pData, size_t pSize) {
-  SHA1_CTX sha1_context;
+  Context context;
+  context.update(pData, pSize);
+  context.finalize(pResult);
+  return true;
+}
 
-  SHA1Init(&sha1_context);
+uint64_t Sha1Util::GetFingerprintFromBuffer(const uint8_t *pData,
+                                            size_t pSize) {
+  // MurmurHash64A: one multiply per 8 bytes.
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = 0xcbf29ce484222325ULL ^ (static_cast<uint64_t>(pSize) * m);
 
-  SHA1Update(&sha1_context,
-             reinterpret_cast<const unsigned char *>(pData),
-             static_cast<unsigned long>(pSize));
+  const uint8_t *end = pData + (pSize & ~static_cast<size_t>(7));
+  for (; pData != end; pData += 8) {
+    uint64_t k;
+    // The buffer may be unaligned.
+    ::memcpy(&k, pData, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
 
-  SHA1Final(pResult, &sha1_context);
+  size_t tail = pSize & 7;
+  if (tail > 0) {
+    uint64_t k = 0;
+    for (size_t i = 0; i < tail; i++) {
+      k |= static_cast<uint64_t>(pData[i]) << (8 * i);
+    }
+    h ^= k;
+    h *= m;
+  }
 
-  return true;
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
 }
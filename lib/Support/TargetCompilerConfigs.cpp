@@ -14,11 +14,15 @@
  * limitations under the License.
  */
 
+#include "bcc/Support/CPUProfile.h"
 #include "bcc/Support/Properties.h"
 #include "bcc/Support/TargetCompilerConfigs.h"
 
-#include "llvm/ADT/StringMap.h"
-#include "llvm/Support/Host.h"
+#include <new>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
 
 // Get ARM version number (i.e., __ARM_ARCH__)
 #ifdef __arm__
@@ -46,12 +50,33 @@ bool ARMBaseCompilerConfig::HasThumb2() {
 #endif
 }
 
+namespace {
+
+// The feature vectors already built, indexed by [pInThumbMode][pEnableNEON].
+llvm::sys::Mutex gFeatureVectorLock;
+bool gFeatureVectorBuilt[2][2];
+std::vector<std::string> gFeatureVectors[2][2];
+
+} // end anonymous namespace
+
 void
 ARMBaseCompilerConfig::GetFeatureVector(std::vector<std::string> &pAttributes,
                                         bool pInThumbMode, bool pEnableNEON) {
-  llvm::StringMap<bool> Features;
-  llvm::sys::getHostCPUFeatures(Features);
+  // The answer only depends on the arguments in a process.
+  llvm::MutexGuard locked(gFeatureVectorLock);
+  std::vector<std::string> &features = gFeatureVectors[pInThumbMode]
+                                                      [pEnableNEON];
+  if (!gFeatureVectorBuilt[pInThumbMode][pEnableNEON]) {
+    BuildFeatureVector(features, pInThumbMode, pEnableNEON);
+    gFeatureVectorBuilt[pInThumbMode][pEnableNEON] = true;
+  }
+  pAttributes.insert(pAttributes.end(), features.begin(), features.end());
+}
 
+void
+ARMBaseCompilerConfig::BuildFeatureVector(
+    std::vector<std::string> &pAttributes, bool pInThumbMode,
+    bool pEnableNEON) {
 #if defined(ARCH_ARM_HAVE_VFP)
 #  if defined(TARGET_CPU_VARIANT_ARM11)
   pAttributes.push_back("+vfp2");
@@ -72,7 +97,7 @@ ARMBaseCompilerConfig::GetFeatureVector(std::vector<std::string> &pAttributes,
     }
   }
 
-  if (pEnableNEON && Features.count("neon") && Features["neon"]) {
+  if (pEnableNEON && CPUProfile::HasHostLLVMFeature("neon")) {
     pAttributes.push_back("+neon");
   } else {
     pAttributes.push_back("-neon");
@@ -80,25 +105,47 @@ ARMBaseCompilerConfig::GetFeatureVector(std::vector<std::string> &pAttributes,
   }
 
   if (!getProperty("debug.rs.arm-no-hwdiv")) {
-    if (Features.count("hwdiv-arm") && Features["hwdiv-arm"])
+    if (CPUProfile::HasHostLLVMFeature("hwdiv-arm"))
       pAttributes.push_back("+hwdiv-arm");
 
-    if (Features.count("hwdiv") && Features["hwdiv"])
+    if (CPUProfile::HasHostLLVMFeature("hwdiv"))
       pAttributes.push_back("+hwdiv");
   }
 
+#if defined(TARGET_BUILD) && defined(__arm__)
+  const std::vector<std::string> &profile_features =
+      CPUProfile::GetHost().mFeatures;
+  pAttributes.insert(pAttributes.end(), profile_features.begin(),
+                     profile_features.end());
+#endif
+
   return;
 }
 
 ARMBaseCompilerConfig::ARMBaseCompilerConfig(const std::string &pTriple,
                                              bool pInThumbMode)
-  : CompilerConfig(pTriple), mInThumbMode(pInThumbMode) {
+  : CompilerConfig(pTriple), mInThumbMode(pInThumbMode),
+    mDefaultThumbMode(pInThumbMode) {
 
   // Enable NEON by default.
   mEnableNEON = true;
 
-  if (!getProperty("debug.rs.arm-no-tune-for-cpu"))
-    setCPU(llvm::sys::getHostCPUName());
+  // The hardware prefetchers of many ARM cores don't keep up with streaming
+  // kernels. Fetch a few cache lines ahead.
+  setPrefetchDistance(256);
+
+  // Keep both of the scratch buffers of the streaming entry points within the
+  // smallest L1 data caches.
+  setStreamBlockSize(2048);
+
+  // Only the compiler on the device tunes for the CPU it runs on.
+#if defined(TARGET_BUILD) && defined(__arm__)
+  const CPUProfile &profile = CPUProfile::GetHost();
+  if (!getProperty("debug.rs.arm-no-tune-for-cpu") && !profile.mCPU.empty())
+    setCPU(profile.mCPU);
+  if (profile.mPrefetchDistance != 0)
+    setPrefetchDistance(profile.mPrefetchDistance);
+#endif
 
   std::vector<std::string> attributes;
   GetFeatureVector(attributes, mInThumbMode, mEnableNEON);
@@ -120,4 +167,129 @@ bool ARMBaseCompilerConfig::enableNEON(bool pEnable) {
 #endif
   return false;
 }
+
+bool ARMBaseCompilerConfig::setEmissionProfile(EmissionProfile pProfile) {
+  bool changed = CompilerConfig::setEmissionProfile(pProfile);
+
+  // Thumb-1 would trade too much speed (and the VFP) for the size.
+  bool in_thumb_mode = ((pProfile == kEmitCompact) && HasThumb2()) ?
+                           true : mDefaultThumbMode;
+  if (mInThumbMode != in_thumb_mode) {
+    setTriple(in_thumb_mode ? DEFAULT_THUMB_TRIPLE_STRING :
+                              DEFAULT_ARM_TRIPLE_STRING);
+    std::vector<std::string> attributes;
+    GetFeatureVector(attributes, in_thumb_mode, mEnableNEON);
+    setFeatureString(attributes);
+    mInThumbMode = in_thumb_mode;
+    changed = true;
+  }
+
+  return changed;
+}
 #endif // defined(PROVIDE_ARM_CODEGEN)
+
+//===----------------------------------------------------------------------===//
+// X86 and X86_64
+//===----------------------------------------------------------------------===//
+#if defined(PROVIDE_X86_CODEGEN)
+
+X86FamilyCompilerConfigBase::X86FamilyCompilerConfigBase(
+    const std::string &pTriple) : CompilerConfig(pTriple) {
+  // Disable frame pointer elimination optimization on x86 family.
+  getTargetOptions().NoFramePointerElim = true;
+  getTargetOptions().UseInitArray = true;
+
+  // Only the compiler on the device tunes for the CPU it runs on. The host
+  // tools (e.g., bcc_compat) produce code for other machines.
+#if defined(TARGET_BUILD) && (defined(__i386__) || defined(__x86_64__))
+  const CPUProfile &profile = CPUProfile::GetHost();
+  if (!profile.mCPU.empty()) {
+    setCPU(profile.mCPU);
+  }
+  if (!profile.mFeatures.empty()) {
+    setFeatureString(profile.mFeatures);
+  }
+  if (profile.mPrefetchDistance != 0) {
+    setPrefetchDistance(profile.mPrefetchDistance);
+  }
+#endif
+
+  return;
+}
+#endif // defined(PROVIDE_X86_CODEGEN)
+
+//===----------------------------------------------------------------------===//
+// Multiversioning
+//===----------------------------------------------------------------------===//
+namespace {
+
+// The subtarget features of LLVM behind each CPUProfile::Feature. Disabling
+// one of them also disables the ones that depend on it (e.g., -sse41 turns
+// off SSE4.2 and AVX too.)
+const struct {
+  uint32_t mFeature;
+  const char *mName;
+} VersionedFeatures[] = {
+  { CPUProfile::kFeatureNEON, "neon" },
+  { CPUProfile::kFeatureSSSE3, "ssse3" },
+  { CPUProfile::kFeatureSSE41, "sse41" },
+  { CPUProfile::kFeatureAVX, "avx" },
+};
+
+const unsigned NumVersionedFeatures =
+    sizeof(VersionedFeatures) / sizeof(VersionedFeatures[0]);
+
+} // end anonymous namespace
+
+uint32_t bcc::GetRequiredCPUFeatures(const CompilerConfig &pConfig) {
+  // The last mention of a feature in the string wins.
+  uint32_t result = 0;
+  llvm::StringRef features(pConfig.getFeatureString());
+  while (!features.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> split = features.split(',');
+    llvm::StringRef feature = split.first;
+    features = split.second;
+    if (feature.size() < 2) {
+      continue;
+    }
+    for (unsigned i = 0; i < NumVersionedFeatures; i++) {
+      if (feature.substr(1) == VersionedFeatures[i].mName) {
+        if (feature[0] == '+') {
+          result |= VersionedFeatures[i].mFeature;
+        } else {
+          result &= ~VersionedFeatures[i].mFeature;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+CompilerConfig *bcc::CreateFallbackConfig(const CompilerConfig &pConfig,
+                                          uint32_t pFeatures) {
+  CompilerConfig *result = new (std::nothrow) CompilerConfig(pConfig);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  // The features given explicitly override the ones the CPU implies. Only
+  // the features of the target are mentioned (LLVM warns about the others.)
+  uint32_t dropped = GetRequiredCPUFeatures(pConfig) & ~pFeatures;
+  std::vector<std::string> attributes;
+  llvm::StringRef features(pConfig.getFeatureString());
+  while (!features.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> split = features.split(',');
+    if (!split.first.empty()) {
+      attributes.push_back(split.first.str());
+    }
+    features = split.second;
+  }
+  for (unsigned i = 0; i < NumVersionedFeatures; i++) {
+    if (dropped & VersionedFeatures[i].mFeature) {
+      attributes.push_back(std::string("-") + VersionedFeatures[i].mName);
+    }
+  }
+  result->setFeatureString(attributes);
+
+  return result;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/Trace.h"
+
+#include <cstdio>
+
+#if !defined(RS_SERVER) && defined(HAVE_ANDROID_OS)
+#define ATRACE_TAG ATRACE_TAG_RS
+#include <cutils/trace.h>
+#define BCC_HAVE_ATRACE
+#endif
+
+using namespace bcc;
+
+namespace {
+
+#if defined(BCC_HAVE_ATRACE)
+void BeginSection(const char *pSection, const char *pName) {
+  // The title is truncated rather than allocated.
+  char title[128];
+  if (pName != NULL) {
+    ::snprintf(title, sizeof(title), "bcc:%s %s", pSection, pName);
+  } else {
+    ::snprintf(title, sizeof(title), "bcc:%s", pSection);
+  }
+  atrace_begin(ATRACE_TAG, title);
+}
+#endif
+
+} // end anonymous namespace
+
+TraceSection::TraceSection(const char *pSection, const char *pName)
+  : mActive(IsEnabled()) {
+#if defined(BCC_HAVE_ATRACE)
+  if (mActive) {
+    BeginSection(pSection, pName);
+  }
+#endif
+}
+
+TraceSection::~TraceSection() {
+#if defined(BCC_HAVE_ATRACE)
+  // Had the tracing been turned off in between, the end is simply ignored.
+  if (mActive) {
+    atrace_end(ATRACE_TAG);
+  }
+#endif
+}
+
+bool TraceSection::IsEnabled() {
+#if defined(BCC_HAVE_ATRACE)
+  return atrace_is_tag_enabled(ATRACE_TAG);
+#else
+  return false;
+#endif
+}
+
+void TraceSection::Mark(const char *pSection, const char *pName) {
+#if defined(BCC_HAVE_ATRACE)
+  if (IsEnabled()) {
+    BeginSection(pSection, pName);
+    atrace_end(ATRACE_TAG);
+  }
+#endif
+}
@@ -77,8 +77,6 @@ A million repetitions of "a"
   34AA973C D4C4DAA4 F61EEB2B DBAD2731 6534016F
 */
 
-#define SHA1HANDSOFF    /*Copies data before messing with it.*/
-
 /*#define CMDLINE        * include main() and file processing */
 //#ifdef CMDLINE
 //# undef CMDLINE         /* Never include main() for libbcc */
@@ -93,9 +91,7 @@ A million repetitions of "a"
 #include <dos.h>
 #include <process.h>   /*  prototype for exit() - JHB
                needed for Win32, but chokes Linux - MPJ */
-#define X_LITTLE_ENDIAN /* This should be #define'd if true.*/
 #else
-# define X_LITTLE_ENDIAN
 # include <unistd.h>
 # include <stdlib.h>
 #endif
@@ -103,8 +99,19 @@ A million repetitions of "a"
 
 #define LINESIZE 2048
 
-static void SHA1Transform(unsigned long state[5],
-    const unsigned char buffer[64]);
+/* Tweaked for libbcc:
+ *  - Use uint32_t for the state so that the rotations are right on LP64
+ *    hosts, too.
+ *  - The message schedule lives on the stack instead of in a static
+ *    workspace, which makes hashing thread-safe (scripts may be built in
+ *    parallel.) The input is loaded big-endian straight from the caller's
+ *    buffer, so SHA1HANDSOFF's extra copy is no longer needed.
+ *  - SHA1Update() hashes whole blocks directly from the input and
+ *    SHA1Final() appends the padding with a single update, instead of one
+ *    update per padding byte.
+ */
+
+static void SHA1Transform(uint32_t state[5], const unsigned char buffer[64]);
 
 #define rol(value,bits) \
  (((value)<<(bits))|((value)>>(32-(bits))))
@@ -112,14 +119,12 @@ static void SHA1Transform(unsigned long state[5],
 /* blk0() and blk() perform the initial expand. */
 /* I got the idea of expanding during the round function from
    SSLeay */
-#ifdef X_LITTLE_ENDIAN
-#define blk0(i) (block->l[i]=(rol(block->l[i],24)&0xFF00FF00) \
-    |(rol(block->l[i],8)&0x00FF00FF))
-#else
-#define blk0(i) block->l[i]
-#endif
-#define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15] \
-    ^block->l[(i+2)&15]^block->l[i&15],1))
+#define blk0(i) (block[i] = ((uint32_t)buffer[4*(i)] << 24) | \
+                            ((uint32_t)buffer[4*(i)+1] << 16) | \
+                            ((uint32_t)buffer[4*(i)+2] << 8) | \
+                            ((uint32_t)buffer[4*(i)+3]))
+#define blk(i) (block[i&15] = rol(block[(i+13)&15]^block[(i+8)&15] \
+    ^block[(i+2)&15]^block[i&15],1))
 
 /* (R0+R1), R2, R3, R4 are the different operations used in SHA1 */
 #define R0(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk0(i)+0x5A827999+rol(v,5);w=rol(w,30);
@@ -131,22 +136,10 @@ static void SHA1Transform(unsigned long state[5],
 
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 
-static void SHA1Transform(unsigned long state[5],
-    const unsigned char buffer[64])
+static void SHA1Transform(uint32_t state[5], const unsigned char buffer[64])
 {
-unsigned long a, b, c, d, e;
-typedef union {
-    unsigned char c[64];
-    unsigned long l[16];
-} CHAR64LONG16;
-CHAR64LONG16* block;
-#ifdef SHA1HANDSOFF
-static unsigned char workspace[64];
-    block = (CHAR64LONG16*)workspace;
-    memcpy(block, buffer, 64);
-#else
-    block = (CHAR64LONG16*)buffer;
-#endif
+uint32_t a, b, c, d, e;
+uint32_t block[16];
     /* Copy context->state[] to working vars */
     a = state[0];
     b = state[1];
@@ -188,10 +181,6 @@ static unsigned char workspace[64];
     state[2] += c;
     state[3] += d;
     state[4] += e;
-    /* Wipe variables */
-/*    a = b = c = d = e = 0; Nice try, but the compiler
-optimizes this out, anyway, and it produces an annoying
-warning. */
 }
 
 
@@ -215,11 +204,12 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data,
     unsigned long len)  /* JHB */
 {
     unsigned long i, j; /* JHB */
+    uint32_t len_lo = (uint32_t)len << 3;
 
     j = (context->count[0] >> 3) & 63;
-    if ((context->count[0] += len << 3) < (len << 3))
+    if ((context->count[0] += len_lo) < len_lo)
         context->count[1]++;
-    context->count[1] += (len >> 29);
+    context->count[1] += (uint32_t)((uint64_t)len >> 29);
     if ((j + len) > 63)
     {
         memcpy(&context->buffer[j], data, (i = 64-j));
@@ -241,7 +231,9 @@ void SHA1Final(unsigned char digest[HASHSIZE], SHA1_CTX*
 context)
 {
 unsigned long i;    /* JHB */
+unsigned long pad_len;
 unsigned char finalcount[8];
+unsigned char padding[64 + 8];
 
     for (i = 0; i < 8; i++)
     {
@@ -249,25 +241,22 @@ unsigned char finalcount[8];
             0:1)]>>((3-(i&3))*8))&255);
         /* Endian independent */
     }
-    SHA1Update(context, (unsigned char *)"\200", 1);
-    while ((context->count[0] & 504) != 448) {
-        SHA1Update(context, (unsigned char *)"\0", 1);
-    }
-    SHA1Update(context, finalcount, 8);
+    /* 0x80, then zeros up to 56 bytes (mod 64), then the bit count. */
+    pad_len = 64 - ((context->count[0] >> 3) & 63);
+    if (pad_len < 9)
+        pad_len += 64;
+    memset(padding, 0, pad_len - 8);
+    padding[0] = 0x80;
+    memcpy(&padding[pad_len - 8], finalcount, 8);
+    SHA1Update(context, padding, pad_len);
     /* Should cause a SHA1Transform() */
     for (i = 0; i < HASHSIZE; i++) {
         digest[i] = (unsigned char)
          ((context->state[i>>2] >> ((3-(i & 3)) * 8) ) & 255);
     }
     /* Wipe variables */
-    memset(context->buffer, 0, 64);
-    memset(context->state, 0, HASHSIZE);
-    memset(context->count, 0, 8);
+    memset(context, 0, sizeof(*context));
     memset(&finalcount, 0, 8);
-#ifdef SHA1HANDSOFF
-    /* make SHA1Transform overwrite it's own static vars */
-    SHA1Transform(context->state, context->buffer);
-#endif
 }
 
 
@@ -4,9 +4,11 @@
 #ifndef _DALVIK_SHA1
 #define _DALVIK_SHA1
 
+#include <stdint.h>
+
 typedef struct {
-    unsigned long state[5];
-    unsigned long count[2];
+    uint32_t state[5];
+    uint32_t count[2];
     unsigned char buffer[64];
 } SHA1_CTX;
 
@@ -14,20 +14,32 @@
  * limitations under the License.
  */
 
+#include <map>
 #include <string>
 #include <vector>
 
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <llvm/ADT/OwningPtr.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/SmallString.h>
 #include <llvm/Config/config.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/system_error.h>
 
+#include <utils/FileMap.h>
+
 #include <bcc/BCCContext.h>
 #include <bcc/Compiler.h>
 #include <bcc/Config/BuildInfo.h>
@@ -37,12 +49,19 @@
 #include <bcc/ExecutionEngine/SymbolResolverProxy.h>
 #include <bcc/ExecutionEngine/SymbolResolvers.h>
 #include <bcc/Renderscript/RSCompilerDriver.h>
+#include <bcc/Renderscript/RSInfo.h>
+#include <bcc/Renderscript/RSScript.h>
 #include <bcc/Script.h>
 #include <bcc/Source.h>
+#include <bcc/Support/CacheWriter.h>
+#include <bcc/Support/CompileServer.h>
 #include <bcc/Support/CompilerConfig.h>
+#include <bcc/Support/CompilerStats.h>
+#include <bcc/Support/Disassembler.h>
 #include <bcc/Support/Initialization.h>
 #include <bcc/Support/InputFile.h>
 #include <bcc/Support/OutputFile.h>
+#include <bcc/Support/PhaseTimer.h>
 #include <bcc/Support/TargetCompilerConfigs.h>
 
 using namespace bcc;
@@ -52,15 +71,27 @@ using namespace bcc;
 //===----------------------------------------------------------------------===//
 namespace {
 
-llvm::cl::opt<std::string>
-OptInputFilename(llvm::cl::Positional, llvm::cl::ValueRequired,
-                 llvm::cl::desc("<input bitcode file>"));
+llvm::cl::list<std::string>
+OptInputFilenames(llvm::cl::Positional, llvm::cl::ZeroOrMore,
+                  llvm::cl::desc("<input bitcode files>"));
 
 llvm::cl::opt<std::string>
-OptOutputFilename("o", llvm::cl::desc("Specify the output filename"),
+OptOutputFilename("o", llvm::cl::desc("Specify the output filename (ignored "
+                                      "when multiple inputs are given, each "
+                                      "output is then named after its input)"),
                   llvm::cl::value_desc("filename"),
                   llvm::cl::init("bcc_output"));
 
+llvm::cl::opt<unsigned>
+OptNumJobs("j", llvm::cl::desc("Number of inputs to compile in parallel"),
+           llvm::cl::value_desc("jobs"), llvm::cl::Prefix,
+           llvm::cl::init(1));
+
+llvm::cl::opt<bool>
+OptPipeline("pipeline", llvm::cl::desc("Parse the next inputs while the "
+                                       "previous one is compiled with a "
+                                       "single compiler, instead of -j"));
+
 llvm::cl::opt<std::string>
 OptBCLibFilename("bclib", llvm::cl::desc("Specify the bclib filename"),
                  llvm::cl::value_desc("bclib"));
@@ -74,6 +105,62 @@ llvm::cl::opt<bool>
 OptEmitLLVM("emit-llvm",
             llvm::cl::desc("Emit an LLVM-IR version of the generated program"));
 
+llvm::cl::opt<bool>
+OptTimePhases("time-phases",
+              llvm::cl::desc("Report the time and memory spent in each phase "
+                             "of the compilation"));
+
+llvm::cl::opt<bool>
+OptAsyncWrites("async-writes",
+               llvm::cl::desc("Write the caches from a background thread while "
+                              "the next inputs are compiled"));
+
+llvm::cl::opt<bool>
+OptCompilerStats("compiler-stats",
+                 llvm::cl::desc("Report the time spent in the LTO and the code "
+                                "generation passes, and the size of the IR and "
+                                "of the object of each input"));
+
+//===----------------------------------------------------------------------===//
+// Loop Report Options
+//===----------------------------------------------------------------------===//
+llvm::cl::opt<bool>
+OptLoopReport("loop-report",
+              llvm::cl::desc("Compile the input into <output_path>/<o>.o and "
+                             "print the annotated disassembly of its .expand "
+                             "functions and a summary of their innermost "
+                             "loops (requires a build with the MC "
+                             "disassembler)"));
+
+llvm::cl::opt<std::string>
+OptLoopReportSamples("loop-report-samples",
+                     llvm::cl::desc("Overlay the samples of a profile on "
+                                    "-loop-report, one \"<function> <hex "
+                                    "offset> <count>\" per line"),
+                     llvm::cl::value_desc("filename"));
+
+//===----------------------------------------------------------------------===//
+// Ahead-of-time Compilation Options
+//===----------------------------------------------------------------------===//
+llvm::cl::opt<std::string>
+OptDeviceCacheDir("device-cache-dir",
+                  llvm::cl::desc("Write the RS cache containers of the inputs "
+                                 "to the output path, ready to be installed "
+                                 "in the given cache directory of a device"),
+                  llvm::cl::value_desc("dir"));
+
+llvm::cl::opt<std::string>
+OptBuiltInDigest("builtin-digest",
+                 llvm::cl::desc("The digest of the built-in dependencies of "
+                                "the device to build the caches for (as "
+                                "printed by -print-builtin-digest on it)"),
+                 llvm::cl::value_desc("40 hex digits"));
+
+llvm::cl::opt<bool>
+OptPrintBuiltInDigest("print-builtin-digest",
+                      llvm::cl::desc("Print the digest of the built-in "
+                                     "dependencies of this system and exit"));
+
 #ifdef TARGET_BUILD
 const std::string OptTargetTriple(DEFAULT_TARGET_TRIPLE_STRING);
 #else
@@ -116,6 +203,16 @@ void BCCVersionPrinter() {
   return;
 }
 
+// The inputs of a batch are compiled in parallel.
+llvm::sys::Mutex StatsLock;
+
+void PrintCompilerStats(const char *pName, const CompilerStats &pStats,
+                        void *pUserData) {
+  llvm::MutexGuard locked(StatsLock);
+  llvm::errs() << pName << ":\n";
+  pStats.print(llvm::errs());
+}
+
 } // end anonymous namespace
 
 static inline
@@ -147,6 +244,10 @@ bool ConfigCompiler(RSCompilerDriver &pRSCD) {
   pRSCD.setConfig(config);
   Compiler::ErrorCode result = RSC->config(*config);
 
+  if (OptCompilerStats) {
+    RSC->setStatsCallback(PrintCompilerStats, NULL);
+  }
+
   if (result != Compiler::kSuccess) {
     llvm::errs() << "Failed to configure the compiler! (detail: "
                  << Compiler::GetErrorString(result) << ")\n";
@@ -179,36 +280,90 @@ bool CompileScript(Compiler &pCompiler, Script &pScript,
   return true;
 }
 
-int main(int argc, char **argv) {
-  llvm::cl::SetVersionPrinter(BCCVersionPrinter);
-  llvm::cl::ParseCommandLineOptions(argc, argv);
-  init::Initialize();
+static bool SetupDriver(RSCompilerDriver &pRSCD, void *pUserData) {
+  return ConfigCompiler(pRSCD);
+}
 
-  BCCContext context;
-  RSCompilerDriver RSCD;
+// The inputs are mapped rather than read, so the pages of a large batch are
+// only brought in (and kept) by the worker compiling them.
+static void ReleaseInputs(std::vector<android::FileMap *> &pInputs) {
+  for (unsigned i = 0, e = pInputs.size(); i != e; i++) {
+    pInputs[i]->release();
+  }
+  pInputs.clear();
+}
 
-  llvm::OwningPtr<llvm::MemoryBuffer> input_data;
+static int BuildBatch() {
+  // The names of the outputs live here.
+  std::vector<std::string> res_names;
+  std::vector<android::FileMap *> inputs;
+  android::Vector<RSBatchBuildItem> items;
+
+  for (unsigned i = 0, e = OptInputFilenames.size(); i != e; i++) {
+    res_names.push_back(llvm::sys::path::stem(OptInputFilenames[i]));
+  }
+
+  for (unsigned i = 0, e = OptInputFilenames.size(); i != e; i++) {
+    android::FileMap *input = InputFile::MapFile(OptInputFilenames[i]);
+    if (input == NULL) {
+      ReleaseInputs(inputs);
+      return EXIT_FAILURE;
+    }
+    inputs.push_back(input);
+
+    RSBatchBuildItem item;
+    item.cacheDir = OptOutputPath.c_str();
+    item.resName = res_names[i].c_str();
+    item.bitcode = static_cast<const char *>(input->getDataPtr());
+    item.bitcodeSize = input->getDataLength();
+    item.success = false;
+    items.push(item);
+  }
 
-  llvm::error_code ec =
-      llvm::MemoryBuffer::getFile(OptInputFilename.c_str(), input_data);
-  if (ec != llvm::error_code::success()) {
-    ALOGE("Failed to load bitcode from path %s! (%s)",
-          OptInputFilename.c_str(), ec.message().c_str());
+  bool built;
+  if (OptPipeline) {
+    built = RSCompilerDriver::BuildPipeline(items, OptBCLibFilename.c_str(),
+                                            SetupDriver, NULL, OptEmitLLVM);
+  } else {
+    built = RSCompilerDriver::BuildBatch(items, OptNumJobs,
+                                         OptBCLibFilename.c_str(),
+                                         SetupDriver, NULL, OptEmitLLVM);
+  }
+  ReleaseInputs(inputs);
+
+  return (built ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// The libraries preloaded by a compile server (see RunServer()) are in the
+// global context.
+static BCCContext *GetContext() {
+  return BCCContext::GetOrCreateGlobalContext();
+}
+
+static int BuildSingle() {
+  BCCContext *context = GetContext();
+  if (context == NULL) {
     return EXIT_FAILURE;
   }
+  RSCompilerDriver RSCD;
 
-  llvm::MemoryBuffer *input_memory = input_data.take();
+  android::FileMap *input = InputFile::MapFile(OptInputFilenames[0]);
+  if (input == NULL) {
+    return EXIT_FAILURE;
+  }
 
-  const char *bitcode = input_memory->getBufferStart();
-  size_t bitcodeSize = input_memory->getBufferSize();
+  const char *bitcode = static_cast<const char *>(input->getDataPtr());
+  size_t bitcodeSize = input->getDataLength();
 
   if (!ConfigCompiler(RSCD)) {
     ALOGE("Failed to configure compiler");
+    input->release();
     return EXIT_FAILURE;
   }
-  bool built = RSCD.build(context, OptOutputPath.c_str(),
+  bool built = RSCD.build(*context, OptOutputPath.c_str(),
       OptOutputFilename.c_str(), bitcode, bitcodeSize,
       OptBCLibFilename.c_str(), NULL, OptEmitLLVM);
+  input->release();
 
   if (!built) {
     return EXIT_FAILURE;
@@ -216,3 +371,312 @@ int main(int argc, char **argv) {
 
   return EXIT_SUCCESS;
 }
+
+typedef std::map<std::string, DisassemblySamplesTy> FunctionSamplesTy;
+
+static bool ReadLoopReportSamples(const std::string &pPath,
+                                  FunctionSamplesTy &pResult) {
+  FILE *samples_file = ::fopen(pPath.c_str(), "r");
+  if (samples_file == NULL) {
+    llvm::errs() << "Unable to open the samples `" << pPath << "'!\n";
+    return false;
+  }
+
+  char line[512];
+  char function[256];
+  unsigned long long offset, count;
+  unsigned line_no = 0;
+  bool success = true;
+  while (::fgets(line, sizeof(line), samples_file) != NULL) {
+    line_no++;
+    if ((line[0] == '#') || (line[0] == '\n')) {
+      continue;
+    }
+    if (::sscanf(line, "%255s %llx %llu", function, &offset, &count) != 3) {
+      llvm::errs() << pPath << ":" << line_no << ": invalid sample!\n";
+      success = false;
+      break;
+    }
+    pResult[function][offset] += count;
+  }
+
+  ::fclose(samples_file);
+  return success;
+}
+
+// Print the loop report of the .expand functions of the relocatable object
+// pObjectPath. The functions are read from the object as they are, before
+// any relocation.
+static bool PrintLoopReport(const char *pObjectPath,
+                            const FunctionSamplesTy &pSamples) {
+  llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+  if (llvm::MemoryBuffer::getFile(pObjectPath, buffer)) {
+    llvm::errs() << "Unable to read `" << pObjectPath << "'!\n";
+    return false;
+  }
+  llvm::OwningPtr<llvm::object::ObjectFile>
+      object(llvm::object::ObjectFile::createObjectFile(buffer.take()));
+  if (!object) {
+    llvm::errs() << "`" << pObjectPath << "' isn't a valid object!\n";
+    return false;
+  }
+
+  llvm::error_code ec;
+  unsigned num_functions = 0;
+  for (llvm::object::symbol_iterator symbol = object->begin_symbols(),
+           symbol_end = object->end_symbols();
+       !ec && (symbol != symbol_end); symbol.increment(ec)) {
+    llvm::StringRef name;
+    llvm::object::SymbolRef::Type type;
+    if (symbol->getName(name) || symbol->getType(type) ||
+        (type != llvm::object::SymbolRef::ST_Function) ||
+        (name.find(".expand") == llvm::StringRef::npos)) {
+      continue;
+    }
+
+    uint64_t address, size, section_address;
+    llvm::StringRef contents;
+    llvm::object::section_iterator section = object->end_sections();
+    if (symbol->getAddress(address) || symbol->getSize(size) ||
+        symbol->getSection(section) || (section == object->end_sections()) ||
+        section->getContents(contents) ||
+        section->getAddress(section_address) ||
+        (address < section_address) ||
+        (address - section_address + size > contents.size())) {
+      llvm::errs() << "Unable to locate the code of " << name << "!\n";
+      continue;
+    }
+
+    FunctionSamplesTy::const_iterator samples = pSamples.find(name.str());
+    DisassembleResult result =
+        DisassembleLoops(llvm::outs(), OptTargetTriple.c_str(),
+                         name.str().c_str(),
+                         reinterpret_cast<const uint8_t *>(contents.data()) +
+                             (address - section_address),
+                         size,
+                         ((samples != pSamples.end()) ?
+                              &samples->second : NULL));
+    if (result == kDisassemblerNotAvailable) {
+      llvm::errs() << "bcc was built without the MC disassembler "
+                      "(libbcc_DEBUG_MC_DISASSEMBLER)!\n";
+      return false;
+    } else if (result != kDisassembleSuccess) {
+      llvm::errs() << "Failed to disassemble " << name << "! (error code="
+                   << static_cast<unsigned>(result) << ")\n";
+      return false;
+    }
+    num_functions++;
+  }
+
+  if (num_functions == 0) {
+    llvm::errs() << "No .expand function in `" << pObjectPath << "'!\n";
+    return false;
+  }
+  return true;
+}
+
+static int BuildLoopReport() {
+  FunctionSamplesTy samples;
+  if (!OptLoopReportSamples.empty() &&
+      !ReadLoopReportSamples(OptLoopReportSamples, samples)) {
+    return EXIT_FAILURE;
+  }
+
+  BCCContext *context = GetContext();
+  RSCompilerDriver RSCD;
+  if ((context == NULL) || !ConfigCompiler(RSCD)) {
+    return EXIT_FAILURE;
+  }
+
+  android::FileMap *input = InputFile::MapFile(OptInputFilenames[0]);
+  if (input == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  Source *source =
+      Source::CreateFromBuffer(*context, OptOutputFilename.c_str(),
+                               static_cast<const char *>(input->getDataPtr()),
+                               input->getDataLength());
+  if (source == NULL) {
+    input->release();
+    return EXIT_FAILURE;
+  }
+
+  llvm::SmallString<80> object_path(OptOutputPath);
+  llvm::sys::path::append(object_path, OptOutputFilename + ".o");
+
+  bool built;
+  {
+    RSScript script(*source);
+    built = RSCD.build(script, object_path.c_str(),
+                       OptBCLibFilename.c_str());
+  }
+  delete source;
+  input->release();
+
+  if (!built || !PrintLoopReport(object_path.c_str(), samples)) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static bool ParseDigest(const std::string &pHex,
+                        uint8_t pDigest[SHA1_DIGEST_LENGTH]) {
+  if (pHex.size() != 2 * SHA1_DIGEST_LENGTH) {
+    return false;
+  }
+  for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+    unsigned byte;
+    if ((::sscanf(pHex.c_str() + 2 * i, "%2x", &byte) != 1) ||
+        !isxdigit(pHex[2 * i]) || !isxdigit(pHex[2 * i + 1])) {
+      return false;
+    }
+    pDigest[i] = static_cast<uint8_t>(byte);
+  }
+  return true;
+}
+
+static int PrintBuiltInDigest() {
+  const uint8_t *digest = RSInfo::GetBuiltInDigest();
+  if (digest == NULL) {
+    llvm::errs() << "The digest of the built-in dependencies is unavailable!\n";
+    return EXIT_FAILURE;
+  }
+  for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+    llvm::outs() << llvm::format("%02x", digest[i]);
+  }
+  llvm::outs() << "\n";
+  return EXIT_SUCCESS;
+}
+
+// Build the cache of each input for -device-cache-dir, one after the other.
+// Each one is named after its input.
+static int BuildForDevice() {
+#ifndef TARGET_BUILD
+  if (OptBuiltInDigest.empty()) {
+    llvm::errs() << "-device-cache-dir requires the -builtin-digest of the "
+                    "device!\n";
+    return EXIT_FAILURE;
+  }
+#endif
+  if (!OptBuiltInDigest.empty()) {
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    if (!ParseDigest(OptBuiltInDigest, digest)) {
+      llvm::errs() << "Invalid built-in digest `" << OptBuiltInDigest
+                   << "'!\n";
+      return EXIT_FAILURE;
+    }
+    RSInfo::SetBuiltInDigest(digest);
+  }
+
+  BCCContext *context = GetContext();
+  RSCompilerDriver RSCD;
+  if ((context == NULL) || !ConfigCompiler(RSCD)) {
+    return EXIT_FAILURE;
+  }
+
+  for (unsigned i = 0, e = OptInputFilenames.size(); i != e; i++) {
+    std::string res_name = llvm::sys::path::stem(OptInputFilenames[i]);
+    android::FileMap *input = InputFile::MapFile(OptInputFilenames[i]);
+    if (input == NULL) {
+      return EXIT_FAILURE;
+    }
+
+    bool built = RSCD.buildForDevice(
+        *context, OptOutputPath.c_str(), OptDeviceCacheDir.c_str(),
+        res_name.c_str(), static_cast<const char *>(input->getDataPtr()),
+        input->getDataLength(), OptEmitLLVM);
+    input->release();
+    if (!built) {
+      llvm::errs() << "Failed to build the cache of `" << OptInputFilenames[i]
+                   << "'!\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int BuildMain(int argc, char **argv) {
+  llvm::cl::SetVersionPrinter(BCCVersionPrinter);
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  init::Initialize();
+
+  if (OptPrintBuiltInDigest) {
+    return PrintBuiltInDigest();
+  }
+
+  if (OptInputFilenames.empty()) {
+    llvm::errs() << "No input bitcode file!\n";
+    return EXIT_FAILURE;
+  }
+
+  if (OptTimePhases) {
+    PhaseTimer::EnableAccumulation();
+  }
+
+  if (OptAsyncWrites) {
+    RSCompilerDriver::setAsyncCacheWrites(true);
+  }
+
+  int status;
+  if (OptLoopReport) {
+    status = BuildLoopReport();
+  } else if (!OptDeviceCacheDir.empty()) {
+    status = BuildForDevice();
+  } else if (OptInputFilenames.size() > 1) {
+    status = BuildBatch();
+  } else {
+    status = BuildSingle();
+  }
+
+  // Complete the writes queued to the background before exiting.
+  CacheWriter::GetInstance().flush();
+
+  if (OptTimePhases) {
+    PhaseTimer::PrintReport(llvm::errs());
+  }
+
+  return status;
+}
+
+// "bcc -server <socket> [<bclib> ...]" initializes the backends, loads the
+// given runtime libraries and serves the invocations of bcc run with
+// BCC_SERVER_SOCKET=<socket> in their environment (see CompileServer) until
+// it's killed. The libraries are shared with the requests passing the same
+// paths to -bclib.
+static int RunServer(const char *pSocketPath, int pNumLibs, char **pLibs) {
+  init::Initialize();
+  RSInfo::LoadBuiltInSHA1Information();
+
+  BCCContext *context = GetContext();
+  if (context == NULL) {
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < pNumLibs; i++) {
+    if (context->getOrLoadLibrary(pLibs[i]) == NULL) {
+      llvm::errs() << "Failed to load the runtime library `" << pLibs[i]
+                   << "'!\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  CompileServer::Serve(pSocketPath, BuildMain);
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+  if ((argc >= 3) && (::strcmp(argv[1], "-server") == 0)) {
+    return RunServer(argv[2], argc - 3, argv + 3);
+  }
+
+  const char *server = ::getenv(CompileServer::SocketEnvironmentVariable);
+  if (server != NULL) {
+    int status = CompileServer::Forward(server, argc, argv);
+    if (status >= 0) {
+      return status;
+    }
+  }
+
+  return BuildMain(argc, argv);
+}
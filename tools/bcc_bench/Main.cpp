@@ -0,0 +1,394 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// bcc_bench measures the latency of the stages a script goes through, from
+// the bitcode to a loaded RSExecutable, over a corpus of bitcode files. Each
+// stage of each input is run a number of times and reported as one JSON
+// object per line on the standard output:
+//
+//   {"input":"foo.bc","benchmark":"build-cold","iterations":10,
+//    "median_ms":123.456,"p95_ms":130.001,"min_ms":120.5,"max_ms":131.2,
+//    "peak_rss_kb":45678}
+//
+// peak_rss_kb is the peak resident set size of the process once the stage
+// is done (so it's monotonic over a run.) build-cold also reports the median
+// time spent in the LTO and the code generation passes and the size of the
+// object emitted (see CompilerStats):
+//
+//   ...,"peak_rss_kb":45678,"lto_ms":61.234,"codegen_ms":40.321,
+//   "object_bytes":23456}
+//
+// The benchmarks are:
+//
+//   translate   bcinfo::BitcodeTranslator::translate()
+//   extract     bcinfo::MetadataExtractor::extract()
+//   build-cold  RSCompilerDriver::build() without a cache
+//   build-warm  RSCompilerDriver::build() over the existing cache
+//   load        RSCompilerDriver::loadScript() from the cache directory (i.e.,
+//               RSCacheContainer::Load() and RSExecutable::Create())
+//   load-memory RSCompilerDriver::loadScript() served by RSExecutableCache
+//
+// build-warm and the loads need the cache left by build-cold (or an earlier
+// run.) The symbols from the RS runtime are bound to a stub that aborts, so
+// the loaded scripts must not be run.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TimeValue.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <bcinfo/BitcodeTranslator.h>
+#include <bcinfo/BitcodeWrapper.h>
+#include <bcinfo/MetadataExtractor.h>
+
+#include <bcc/BCCContext.h>
+#include <bcc/Renderscript/RSCacheContainer.h>
+#include <bcc/Renderscript/RSCompilerDriver.h>
+#include <bcc/Renderscript/RSExecutable.h>
+#include <bcc/Renderscript/RSExecutableCache.h>
+#include <bcc/Support/CompilerStats.h>
+#include <bcc/Support/Initialization.h>
+
+#include "ToolUtil.h"
+
+using namespace bcc;
+
+namespace {
+
+llvm::cl::list<std::string>
+OptInputFilenames(llvm::cl::Positional, llvm::cl::OneOrMore,
+                  llvm::cl::desc("<input bitcode files>"));
+
+llvm::cl::opt<unsigned>
+OptIterations("n", llvm::cl::desc("Number of runs of each benchmark "
+                                  "(default: 10)"),
+              llvm::cl::value_desc("iterations"), llvm::cl::init(10));
+
+llvm::cl::opt<std::string>
+OptBCLibFilename("bclib", llvm::cl::desc("Specify the bclib filename"),
+                 llvm::cl::value_desc("bclib"));
+
+llvm::cl::opt<std::string>
+OptOutputPath("output_path", llvm::cl::desc("Specify the cache directory of "
+                                            "the builds (default: .)"),
+              llvm::cl::value_desc("output path"),
+              llvm::cl::init("."));
+
+llvm::cl::list<std::string>
+OptBenchmarks("benchmark", llvm::cl::desc("Run only the given benchmark "
+                                          "(may be repeated)"),
+              llvm::cl::value_desc("name"), llvm::cl::ZeroOrMore);
+
+void UnresolvedSymbolStub() {
+  llvm::errs() << "bcc_bench: a script called into the RS runtime!\n";
+  ::abort();
+}
+
+void *LookupRuntimeSymbol(void *pContext, const char *pName) {
+  return reinterpret_cast<void *>(&UnresolvedSymbolStub);
+}
+
+long GetPeakRSS() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+#endif
+  return 0;
+}
+
+bool IsSelected(const char *pBenchmark) {
+  if (OptBenchmarks.empty()) {
+    return true;
+  }
+  return (std::find(OptBenchmarks.begin(), OptBenchmarks.end(),
+                    std::string(pBenchmark)) != OptBenchmarks.end());
+}
+
+// Return the pPercent-th percentile (nearest rank) of the sorted pTimes.
+double GetPercentile(const std::vector<double> &pTimes, unsigned pPercent) {
+  size_t rank = (pTimes.size() * pPercent + 99) / 100;
+  return pTimes[(rank > 0) ? (rank - 1) : 0];
+}
+
+// The input under benchmark.
+struct Input {
+  std::string mPath;
+  std::string mResName;
+  const char *mBitcode;
+  size_t mBitcodeSize;
+  unsigned mTargetAPI;
+};
+
+// Interface of a benchmark. run() is timed; setUp() and tearDown() are run
+// before and after each run, respectively, and aren't. After the runs of an
+// input, takeResults() appends the fields of the benchmark's own measures (if
+// any) to the JSON object of the runs, and forgets them.
+class Benchmark {
+public:
+  virtual const char *getName() const = 0;
+  virtual bool setUp(const Input &pInput) { return true; }
+  virtual bool run(const Input &pInput) = 0;
+  virtual void tearDown(const Input &pInput) { }
+  virtual void takeResults(std::string &pLine) { }
+  virtual ~Benchmark() { }
+};
+
+class TranslateBenchmark : public Benchmark {
+public:
+  virtual const char *getName() const { return "translate"; }
+  virtual bool run(const Input &pInput) {
+    bcinfo::BitcodeTranslator translator(pInput.mBitcode, pInput.mBitcodeSize,
+                                         pInput.mTargetAPI);
+    return translator.translate();
+  }
+};
+
+class ExtractBenchmark : public Benchmark {
+public:
+  virtual const char *getName() const { return "extract"; }
+  virtual bool run(const Input &pInput) {
+    bcinfo::MetadataExtractor extractor(pInput.mBitcode, pInput.mBitcodeSize);
+    return extractor.extract();
+  }
+};
+
+class BuildBenchmark : public Benchmark {
+private:
+  RSCompilerDriver &mDriver;
+  bool mCold;
+
+  // The phases of each compilation, in milliseconds, and the size of the last
+  // object.
+  std::vector<double> mLTOTimes;
+  std::vector<double> mCodeGenTimes;
+  uint64_t mObjectSize;
+
+  static void RecordStats(const char *pName, const CompilerStats &pStats,
+                          void *pUserData) {
+    BuildBenchmark *self = static_cast<BuildBenchmark *>(pUserData);
+    self->mLTOTimes.push_back(pStats.mLTOTime * 1e3);
+    self->mCodeGenTimes.push_back(pStats.mCodeGenTime * 1e3);
+    self->mObjectSize = pStats.mObjectSize;
+  }
+
+public:
+  BuildBenchmark(RSCompilerDriver &pDriver, bool pCold)
+    : mDriver(pDriver), mCold(pCold), mObjectSize(0) { }
+
+  virtual const char *getName() const
+  { return (mCold ? "build-cold" : "build-warm"); }
+
+  virtual bool setUp(const Input &pInput) {
+    if (mCold) {
+      llvm::SmallString<80> path(OptOutputPath);
+      llvm::sys::path::append(path, pInput.mResName + ".rsc");
+      bool existed;
+      llvm::sys::fs::remove(path.str(), existed);
+      mDriver.getCompiler()->setStatsCallback(RecordStats, this);
+    }
+    return true;
+  }
+
+  virtual bool run(const Input &pInput) {
+    BCCContext context;
+    return mDriver.build(context, OptOutputPath.c_str(),
+                         pInput.mResName.c_str(), pInput.mBitcode,
+                         pInput.mBitcodeSize,
+                         (OptBCLibFilename.empty() ?
+                              NULL : OptBCLibFilename.c_str()));
+  }
+
+  virtual void takeResults(std::string &pLine) {
+    if (mCold && !mLTOTimes.empty()) {
+      std::sort(mLTOTimes.begin(), mLTOTimes.end());
+      std::sort(mCodeGenTimes.begin(), mCodeGenTimes.end());
+      char numbers[128];
+      ::snprintf(numbers, sizeof(numbers),
+                 ",\"lto_ms\":%.3f,\"codegen_ms\":%.3f,\"object_bytes\":%llu",
+                 GetPercentile(mLTOTimes, 50),
+                 GetPercentile(mCodeGenTimes, 50),
+                 static_cast<unsigned long long>(mObjectSize));
+      pLine += numbers;
+    }
+    mLTOTimes.clear();
+    mCodeGenTimes.clear();
+    mObjectSize = 0;
+  }
+
+  virtual void tearDown(const Input &pInput) {
+    mDriver.getCompiler()->setStatsCallback(NULL, NULL);
+  }
+};
+
+class LoadBenchmark : public Benchmark {
+private:
+  RSCompilerDriver &mDriver;
+  bool mFromMemory;
+  RSExecutable *mResult;
+
+public:
+  LoadBenchmark(RSCompilerDriver &pDriver, bool pFromMemory)
+    : mDriver(pDriver), mFromMemory(pFromMemory), mResult(NULL) { }
+
+  virtual const char *getName() const
+  { return (mFromMemory ? "load-memory" : "load"); }
+
+  virtual bool setUp(const Input &pInput) {
+    llvm::SmallString<80> path(OptOutputPath);
+    llvm::sys::path::append(path, pInput.mResName + ".o");
+    android::String8 container_path = RSCacheContainer::GetPath(path.c_str());
+    if (!mFromMemory) {
+      RSExecutableCache::GetInstance().invalidate(container_path.string());
+      return true;
+    }
+    // Make sure the in-process cache has the script.
+    delete mDriver.loadScript(OptOutputPath.c_str(), pInput.mResName.c_str(),
+                              pInput.mBitcode, pInput.mBitcodeSize);
+    return true;
+  }
+
+  virtual bool run(const Input &pInput) {
+    mResult = mDriver.loadScript(OptOutputPath.c_str(),
+                                 pInput.mResName.c_str(), pInput.mBitcode,
+                                 pInput.mBitcodeSize);
+    return (mResult != NULL);
+  }
+
+  virtual void tearDown(const Input &pInput) {
+    delete mResult;
+    mResult = NULL;
+  }
+};
+
+bool RunBenchmark(Benchmark &pBenchmark, const Input &pInput) {
+  std::vector<double> times;
+
+  for (unsigned i = 0; i < OptIterations; i++) {
+    if (!pBenchmark.setUp(pInput)) {
+      return false;
+    }
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    bool success = pBenchmark.run(pInput);
+    llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - start;
+    pBenchmark.tearDown(pInput);
+
+    if (!success) {
+      llvm::errs() << "bcc_bench: " << pBenchmark.getName() << " of "
+                   << pInput.mPath << " failed!\n";
+      std::string discarded;
+      pBenchmark.takeResults(discarded);
+      return false;
+    }
+    times.push_back(elapsed.seconds() * 1e3 + elapsed.nanoseconds() * 1e-6);
+  }
+
+  std::sort(times.begin(), times.end());
+
+  std::string line("{\"input\":");
+  tools::AppendJSONString(line, pInput.mPath);
+  line += ",\"benchmark\":";
+  tools::AppendJSONString(line, pBenchmark.getName());
+
+  char numbers[256];
+  ::snprintf(numbers, sizeof(numbers),
+             ",\"iterations\":%u,\"median_ms\":%.3f,\"p95_ms\":%.3f,"
+             "\"min_ms\":%.3f,\"max_ms\":%.3f,\"peak_rss_kb\":%ld",
+             static_cast<unsigned>(times.size()), GetPercentile(times, 50),
+             GetPercentile(times, 95), times.front(), times.back(),
+             GetPeakRSS());
+  line += numbers;
+  pBenchmark.takeResults(line);
+  line += '}';
+
+  llvm::outs() << line << "\n";
+  llvm::outs().flush();
+  return true;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  init::Initialize();
+
+  if (OptIterations == 0) {
+    llvm::errs() << "bcc_bench: -n must be positive!\n";
+    return EXIT_FAILURE;
+  }
+
+  RSCompilerDriver driver(/* pUseCompilerRT */false);
+  driver.setRSRuntimeLookupFunction(LookupRuntimeSymbol);
+
+  TranslateBenchmark translate;
+  ExtractBenchmark extract;
+  BuildBenchmark build_cold(driver, /* pCold */true);
+  BuildBenchmark build_warm(driver, /* pCold */false);
+  LoadBenchmark load(driver, /* pFromMemory */false);
+  LoadBenchmark load_memory(driver, /* pFromMemory */true);
+
+  // build-warm and the loads use the cache build-cold leaves.
+  Benchmark *benchmarks[] = {
+    &translate, &extract, &build_cold, &build_warm, &load, &load_memory
+  };
+
+  int status = EXIT_SUCCESS;
+  for (unsigned i = 0, e = OptInputFilenames.size(); i != e; i++) {
+    tools::MappedInputFile map;
+    if (!map.map(OptInputFilenames[i])) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    Input input;
+    input.mPath = OptInputFilenames[i];
+    input.mResName = llvm::sys::path::stem(OptInputFilenames[i]);
+    input.mBitcode = map.getData();
+    input.mBitcodeSize = map.getSize();
+    input.mTargetAPI = bcinfo::BitcodeWrapper(input.mBitcode,
+                                              input.mBitcodeSize)
+                           .getTargetAPI();
+
+    for (unsigned j = 0; j < (sizeof(benchmarks) / sizeof(benchmarks[0]));
+         j++) {
+      if (IsSelected(benchmarks[j]->getName()) &&
+          !RunBenchmark(*benchmarks[j], input)) {
+        status = EXIT_FAILURE;
+      }
+    }
+  }
+
+  return status;
+}
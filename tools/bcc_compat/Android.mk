@@ -35,7 +35,7 @@ LOCAL_C_INCLUDES := \
   $(LOCAL_PATH)/../../include
 
 ifndef USE_MINGW
-LOCAL_LDLIBS = -ldl
+LOCAL_LDLIBS = -lpthread -ldl
 endif
 
 LOCAL_SRC_FILES := Main.cpp
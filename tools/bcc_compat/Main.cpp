@@ -18,13 +18,20 @@
 #include <vector>
 
 #include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/SmallString.h>
 #include <llvm/Config/config.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/system_error.h>
 
@@ -37,6 +44,7 @@
 #include <bcc/Renderscript/RSCompilerDriver.h>
 #include <bcc/Script.h>
 #include <bcc/Source.h>
+#include <bcc/Support/CompileServer.h>
 #include <bcc/Support/CompilerConfig.h>
 #include <bcc/Support/Initialization.h>
 #include <bcc/Support/InputFile.h>
@@ -90,6 +98,24 @@ OptOptLevel("O", llvm::cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] "
 llvm::cl::opt<bool>
 OptC("c", llvm::cl::desc("Compile and assemble, but do not link."));
 
+llvm::cl::opt<bool>
+OptSeparate("separate",
+            llvm::cl::desc("With -c, compile each input to an object of its "
+                           "own named after it (in the directory given to -o, "
+                           "if any) instead of merging them"));
+
+llvm::cl::opt<unsigned>
+OptNumJobs("j", llvm::cl::desc("Number of inputs to compile in parallel with "
+                               "-separate"),
+           llvm::cl::value_desc("jobs"), llvm::cl::Prefix,
+           llvm::cl::init(1));
+
+llvm::cl::opt<bool>
+OptEmbedBinaryInfo("embed-binary-info",
+                   llvm::cl::desc("Embed the RS info in the binary encoding "
+                                  "(.rs.info.bin) instead of as text "
+                                  "(.rs.info)"));
+
 //===----------------------------------------------------------------------===//
 // Linker Options
 //===----------------------------------------------------------------------===//
@@ -258,7 +284,107 @@ std::string DetermineOutputFilename(const std::string &pOutputPath) {
   return output_path.c_str();
 }
 
-int main(int argc, char **argv) {
+// The inputs of -separate, handed out to the workers in order.
+struct SeparateBuild {
+  llvm::sys::Mutex mLock;
+  unsigned mNext;
+  bool mFailed;
+
+  SeparateBuild() : mNext(0), mFailed(false) { }
+};
+
+static std::string GetSeparateOutputFilename(const std::string &pInput) {
+  llvm::SmallString<200> output_path;
+  if (!OptOutputFilename.empty()) {
+    output_path = OptOutputFilename;
+    llvm::sys::path::append(output_path, llvm::sys::path::filename(pInput));
+  } else {
+    output_path = pInput;
+  }
+  llvm::sys::path::replace_extension(output_path, "o");
+  return output_path.c_str();
+}
+
+// Compile the inputs of pState until there's none left, each to its own
+// object. The worker has its context and its driver, so the runtime library
+// is loaded once per worker and the inputs compile in parallel.
+static void *SeparateWorker(void *pState) {
+  SeparateBuild &state = *static_cast<SeparateBuild *>(pState);
+  BCCContext context;
+  RSCompilerDriver rscd(false);
+  bool configured = ConfigCompiler(rscd);
+  rscd.setEmbedBinaryInfo(OptEmbedBinaryInfo);
+
+  while (true) {
+    unsigned i;
+    {
+      llvm::MutexGuard locked(state.mLock);
+      if (!configured) {
+        state.mFailed = true;
+      }
+      if (state.mFailed || (state.mNext >= OptInputFilenames.size())) {
+        break;
+      }
+      i = state.mNext++;
+    }
+
+    const std::string &input = OptInputFilenames[i];
+    std::string output = GetSeparateOutputFilename(input);
+    Source *source = Source::CreateFromFile(context, input);
+    RSScript *script = NULL;
+    if (source != NULL) {
+      script = new (std::nothrow) RSScript(*source);
+    }
+    bool built = ((script != NULL) &&
+                  rscd.build(*script, output.c_str(),
+                             OptRuntimePath.c_str()));
+    delete script;
+    delete source;
+
+    if (!built) {
+      llvm::MutexGuard locked(state.mLock);
+      llvm::errs() << "Failed to compile `" << input << "'!\n";
+      state.mFailed = true;
+    }
+  }
+
+  return NULL;
+}
+
+static int BuildSeparate() {
+  SeparateBuild state;
+  unsigned num_jobs = OptNumJobs;
+  if (num_jobs > OptInputFilenames.size()) {
+    num_jobs = OptInputFilenames.size();
+  }
+
+#if !defined(_WIN32)
+  std::vector<pthread_t> workers;
+  if ((num_jobs > 1) && llvm::llvm_start_multithreaded()) {
+    // The calling thread is a worker, too.
+    for (unsigned i = 1; i < num_jobs; i++) {
+      pthread_t worker;
+      if (::pthread_create(&worker, NULL, SeparateWorker, &state) != 0) {
+        llvm::errs() << "Failed to start worker thread #" << i << "!\n";
+        break;
+      }
+      workers.push_back(worker);
+    }
+  }
+
+  SeparateWorker(&state);
+
+  for (unsigned i = 0, e = workers.size(); i != e; i++) {
+    ::pthread_join(workers[i], NULL);
+  }
+#else
+  SeparateWorker(&state);
+#endif
+
+  return (state.mFailed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static int BuildMain(int argc, char **argv) {
   llvm::cl::SetVersionPrinter(BCCVersionPrinter);
   llvm::cl::ParseCommandLineOptions(argc, argv);
   init::Initialize();
@@ -269,13 +395,27 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  BCCContext context;
+  if (OptSeparate) {
+    if (!OptC) {
+      llvm::errs() << "-separate requires -c!\n";
+      return EXIT_FAILURE;
+    }
+    return BuildSeparate();
+  }
+
+  // The libraries preloaded by a compile server (see RunServer()) are in the
+  // global context.
+  BCCContext *context = BCCContext::GetOrCreateGlobalContext();
+  if (context == NULL) {
+    return EXIT_FAILURE;
+  }
   RSCompilerDriver rscd(false);
   Compiler compiler;
 
   if (!ConfigCompiler(rscd)) {
     return EXIT_FAILURE;
   }
+  rscd.setEmbedBinaryInfo(OptEmbedBinaryInfo);
 
   std::string OutputFilename = DetermineOutputFilename(OptOutputFilename);
   if (OutputFilename.empty()) {
@@ -283,7 +423,7 @@ int main(int argc, char **argv) {
   }
 
   RSScript *s = NULL;
-  s = PrepareRSScript(context, OptInputFilenames);
+  s = PrepareRSScript(*context, OptInputFilenames);
   if (!rscd.build(*s, OutputFilename.c_str(), OptRuntimePath.c_str())) {
     fprintf(stderr, "Failed to compile script!");
     return EXIT_FAILURE;
@@ -291,3 +431,38 @@ int main(int argc, char **argv) {
 
   return EXIT_SUCCESS;
 }
+
+// "bcc_compat -server <socket> [<rt-path> ...]", see RunServer() of bcc.
+static int RunServer(const char *pSocketPath, int pNumLibs, char **pLibs) {
+  init::Initialize();
+
+  BCCContext *context = BCCContext::GetOrCreateGlobalContext();
+  if (context == NULL) {
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < pNumLibs; i++) {
+    if (context->getOrLoadLibrary(pLibs[i]) == NULL) {
+      fprintf(stderr, "Failed to load the runtime library `%s'!\n", pLibs[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  CompileServer::Serve(pSocketPath, BuildMain);
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+  if ((argc >= 3) && (::strcmp(argv[1], "-server") == 0)) {
+    return RunServer(argv[2], argc - 3, argv + 3);
+  }
+
+  const char *server = ::getenv(CompileServer::SocketEnvironmentVariable);
+  if (server != NULL) {
+    int status = CompileServer::Forward(server, argc, argv);
+    if (status >= 0) {
+      return status;
+    }
+  }
+
+  return BuildMain(argc, argv);
+}
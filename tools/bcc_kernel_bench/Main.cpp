@@ -0,0 +1,428 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// bcc_kernel_bench measures the throughput of the code RSForEachExpandPass
+// generates. Each input is built once per variant of the expansion, loaded,
+// and the "<NAME>.expand" function of each of its ForEach kernels is called
+// directly over a one-dimensional launch of -cells cells, with a
+// RsForEachStubParamStruct filled in the way the runtime does. The runs are
+// reported as one JSON object per line on the standard output:
+//
+//   {"input":"foo.bc","kernel":"root","variant":"widened","cells":1048576,
+//    "in_bytes":16,"out_bytes":16,"iterations":20,"median_ms":1.234,
+//    "min_ms":1.200,"cells_per_s":849737114.2,"bytes_per_s":27191587654.4}
+//
+// bytes_per_s counts the bytes read from the input and written to the output
+// of the launch. The variants are:
+//
+//   no-step-opt  the loops step by the instep and outstep given at launch
+//   step-opt     the loops step by the element sizes known at compile time
+//   widened      step-opt with the inner loops widened to the SIMD width
+//                (the default of RSCompiler)
+//
+// The element sizes are taken from the kernel's prototype. The symbols from
+// the RS runtime are bound to a stub that aborts, so only the kernels that
+// don't call into the runtime (e.g., to read other allocations) can be run.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TimeValue.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <bcinfo/BitcodeTranslator.h>
+#include <bcinfo/BitcodeWrapper.h>
+#include <bcinfo/MetadataExtractor.h>
+
+#include <bcc/BCCContext.h>
+#include <bcc/Renderscript/RSCompiler.h>
+#include <bcc/Renderscript/RSCompilerDriver.h>
+#include <bcc/Renderscript/RSExecutable.h>
+#include <bcc/Renderscript/RSInfo.h>
+#include <bcc/Source.h>
+#include <bcc/Support/Initialization.h>
+
+#include "ToolUtil.h"
+
+using namespace bcc;
+
+namespace {
+
+llvm::cl::list<std::string>
+OptInputFilenames(llvm::cl::Positional, llvm::cl::OneOrMore,
+                  llvm::cl::desc("<input bitcode files>"));
+
+llvm::cl::opt<unsigned>
+OptIterations("n", llvm::cl::desc("Number of launches of each kernel "
+                                  "(default: 20)"),
+              llvm::cl::value_desc("iterations"), llvm::cl::init(20));
+
+llvm::cl::opt<unsigned>
+OptCells("cells", llvm::cl::desc("Number of cells of each launch "
+                                 "(default: 1048576)"),
+         llvm::cl::value_desc("cells"), llvm::cl::init(1 << 20));
+
+llvm::cl::opt<unsigned>
+OptVoidElementSize("void-element-size",
+                   llvm::cl::desc("Element size in bytes of the void * "
+                                  "inputs and outputs (default: 4)"),
+                   llvm::cl::value_desc("size"), llvm::cl::init(4));
+
+llvm::cl::opt<std::string>
+OptBCLibFilename("bclib", llvm::cl::desc("Specify the bclib filename"),
+                 llvm::cl::value_desc("bclib"));
+
+llvm::cl::opt<std::string>
+OptOutputPath("output_path", llvm::cl::desc("Specify the cache directory of "
+                                            "the builds (default: .)"),
+              llvm::cl::value_desc("output path"),
+              llvm::cl::init("."));
+
+llvm::cl::list<std::string>
+OptKernels("kernel", llvm::cl::desc("Run only the given kernel "
+                                    "(may be repeated)"),
+           llvm::cl::value_desc("name"), llvm::cl::ZeroOrMore);
+
+llvm::cl::list<std::string>
+OptVariants("variant", llvm::cl::desc("Run only the given variant "
+                                      "(may be repeated)"),
+            llvm::cl::value_desc("name"), llvm::cl::ZeroOrMore);
+
+void UnresolvedSymbolStub() {
+  llvm::errs() << "bcc_kernel_bench: a kernel called into the RS runtime!\n";
+  ::abort();
+}
+
+void *LookupRuntimeSymbol(void *pContext, const char *pName) {
+  return reinterpret_cast<void *>(&UnresolvedSymbolStub);
+}
+
+bool IsSelected(const llvm::cl::list<std::string> &pList, const char *pName) {
+  if (pList.empty()) {
+    return true;
+  }
+  return (std::find(pList.begin(), pList.end(),
+                    std::string(pName)) != pList.end());
+}
+
+// Mirror of the RsForEachStubParamStruct of RSForEachExpandPass. usr_len is
+// an i32 there.
+struct ForEachStubParams {
+  const void *in;
+  void *out;
+  const void *usr;
+  uint32_t usr_len;
+  uint32_t x;
+  uint32_t y;
+  uint32_t z;
+  uint32_t lod;
+  uint32_t face;
+  uint32_t ar[16];
+};
+
+typedef void (*ExpandFunction)(const ForEachStubParams *p, uint32_t x1,
+                               uint32_t x2, uint32_t instep,
+                               uint32_t outstep);
+
+// Zeroed buffer passed as the usrData of the kernels taking one.
+const size_t UsrDataSize = 4096;
+
+struct Variant {
+  const char *mName;
+  bool mStepOpt;
+  bool mWidening;
+};
+
+// Widening needs the constant steps, so there's no fourth variant.
+const Variant Variants[] = {
+  { "no-step-opt", false, false },
+  { "step-opt", true, false },
+  { "widened", true, true },
+};
+
+// A ForEach kernel of the input and the sizes of its elements (0 if it has no
+// input or output.)
+struct Kernel {
+  std::string mName;
+  size_t mInSize;
+  size_t mOutSize;
+};
+
+size_t GetElementSize(const llvm::DataLayout &pDL, llvm::Type *pType,
+                      bool pByValue) {
+  if (!pByValue) {
+    llvm::PointerType *ptr_type = llvm::dyn_cast<llvm::PointerType>(pType);
+    if (ptr_type == NULL) {
+      return 0;
+    }
+    pType = ptr_type->getElementType();
+    if (pType->isIntegerTy(8) || pType->isVoidTy()) {
+      // const void *in or void *out.
+      return OptVoidElementSize;
+    }
+  }
+  return pDL.getTypeAllocSize(pType);
+}
+
+// Collect the kernels of the script pBitcode to run (those with an input or
+// an output) into pKernels. Return false on error.
+bool GetKernels(const char *pPath, const char *pBitcode, size_t pBitcodeSize,
+                std::vector<Kernel> &pKernels) {
+  bcinfo::MetadataExtractor extractor(pBitcode, pBitcodeSize);
+  if (!extractor.extract()) {
+    llvm::errs() << "bcc_kernel_bench: failed to read the metadata of "
+                 << pPath << "!\n";
+    return false;
+  }
+
+  BCCContext context;
+  Source *source = Source::CreateFromBuffer(context, pPath, pBitcode,
+                                            pBitcodeSize);
+  if (source == NULL) {
+    return false;
+  }
+  const llvm::Module &module = source->getModule();
+  llvm::DataLayout data_layout(&module);
+
+  for (size_t i = 0, e = extractor.getExportForEachSignatureCount(); i != e;
+       i++) {
+    const char *name = extractor.getExportForEachNameList()[i];
+    uint32_t sig = extractor.getExportForEachSignatureList()[i];
+    if (!IsSelected(OptKernels, name)) {
+      continue;
+    }
+
+    const llvm::Function *func = module.getFunction(name);
+    if (func == NULL) {
+      continue;
+    }
+
+    Kernel kernel;
+    kernel.mName = name;
+    kernel.mInSize = kernel.mOutSize = 0;
+
+    // A pass-by-value kernel takes its input cell and returns its output
+    // cell. The others take pointers to both.
+    bool by_value = bcinfo::MetadataExtractor::hasForEachSignatureKernel(sig);
+    llvm::Function::const_arg_iterator arg = func->arg_begin();
+    if (bcinfo::MetadataExtractor::hasForEachSignatureIn(sig) &&
+        (arg != func->arg_end())) {
+      kernel.mInSize = GetElementSize(data_layout, arg->getType(), by_value);
+      ++arg;
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureOut(sig)) {
+      if (by_value) {
+        kernel.mOutSize = GetElementSize(data_layout, func->getReturnType(),
+                                         /* pByValue */true);
+      } else if (arg != func->arg_end()) {
+        kernel.mOutSize = GetElementSize(data_layout, arg->getType(),
+                                         /* pByValue */false);
+      }
+    }
+
+    if ((kernel.mInSize != 0) || (kernel.mOutSize != 0)) {
+      pKernels.push_back(kernel);
+    }
+  }
+
+  delete source;
+  return true;
+}
+
+// Launch pExpand over pKernel -n times and report the run.
+void RunKernel(const std::string &pInput, const Variant &pVariant,
+               const Kernel &pKernel, ExpandFunction pExpand) {
+  std::vector<uint8_t> in(pKernel.mInSize * OptCells);
+  std::vector<uint8_t> out(pKernel.mOutSize * OptCells);
+  std::vector<uint8_t> usr(UsrDataSize);
+
+  ForEachStubParams params;
+  ::memset(&params, 0, sizeof(params));
+  params.in = (in.empty() ? NULL : &in[0]);
+  params.out = (out.empty() ? NULL : &out[0]);
+  params.usr = &usr[0];
+  params.usr_len = UsrDataSize;
+
+  uint32_t instep = pKernel.mInSize;
+  uint32_t outstep = pKernel.mOutSize;
+
+  // Fault the buffers in and warm the caches before the timed launches.
+  pExpand(&params, 0, OptCells, instep, outstep);
+
+  std::vector<double> times;
+  for (unsigned i = 0; i < OptIterations; i++) {
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    pExpand(&params, 0, OptCells, instep, outstep);
+    llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - start;
+    times.push_back(elapsed.seconds() * 1e3 + elapsed.nanoseconds() * 1e-6);
+  }
+
+  std::sort(times.begin(), times.end());
+  double median_ms = times[times.size() / 2];
+  double seconds = ((median_ms > 0) ? (median_ms * 1e-3) : 1e-9);
+  double cells_per_s = OptCells / seconds;
+  double bytes_per_s = cells_per_s * (pKernel.mInSize + pKernel.mOutSize);
+
+  std::string line("{\"input\":");
+  tools::AppendJSONString(line, pInput);
+  line += ",\"kernel\":";
+  tools::AppendJSONString(line, pKernel.mName);
+  line += ",\"variant\":";
+  tools::AppendJSONString(line, pVariant.mName);
+
+  char numbers[256];
+  ::snprintf(numbers, sizeof(numbers),
+             ",\"cells\":%u,\"in_bytes\":%u,\"out_bytes\":%u,"
+             "\"iterations\":%u,\"median_ms\":%.3f,\"min_ms\":%.3f,"
+             "\"cells_per_s\":%.1f,\"bytes_per_s\":%.1f}",
+             static_cast<unsigned>(OptCells),
+             static_cast<unsigned>(pKernel.mInSize),
+             static_cast<unsigned>(pKernel.mOutSize),
+             static_cast<unsigned>(times.size()), median_ms, times.front(),
+             cells_per_s, bytes_per_s);
+  line += numbers;
+
+  llvm::outs() << line << "\n";
+  llvm::outs().flush();
+}
+
+// Build pBitcode as pVariant and run its kernels in pKernels. Return false on
+// error.
+bool RunVariant(RSCompilerDriver &pDriver, const std::string &pInput,
+                const std::string &pResName, const char *pBitcode,
+                size_t pBitcodeSize, const Variant &pVariant,
+                const std::vector<Kernel> &pKernels) {
+  RSCompiler *compiler = pDriver.getCompiler();
+  compiler->setEnableExpandStepOpt(pVariant.mStepOpt);
+  compiler->setEnableExpandWidening(pVariant.mWidening);
+
+  // The variants aren't part of the cache key. Build each one from scratch
+  // under its own name.
+  std::string res_name = pResName + "." + pVariant.mName;
+  llvm::SmallString<80> path(OptOutputPath);
+  llvm::sys::path::append(path, res_name + ".rsc");
+  bool existed;
+  llvm::sys::fs::remove(path.str(), existed);
+
+  BCCContext context;
+  if (!pDriver.build(context, OptOutputPath.c_str(), res_name.c_str(),
+                     pBitcode, pBitcodeSize,
+                     (OptBCLibFilename.empty() ?
+                          NULL : OptBCLibFilename.c_str()))) {
+    llvm::errs() << "bcc_kernel_bench: failed to build " << pInput << " ("
+                 << pVariant.mName << ")!\n";
+    return false;
+  }
+
+  RSExecutable *executable = pDriver.loadScript(OptOutputPath.c_str(),
+                                                res_name.c_str(), pBitcode,
+                                                pBitcodeSize);
+  if (executable == NULL) {
+    llvm::errs() << "bcc_kernel_bench: failed to load " << pInput << " ("
+                 << pVariant.mName << ")!\n";
+    return false;
+  }
+
+  const RSInfo::ExportForeachFuncListTy &funcs =
+      executable->getInfo().getExportForeachFuncs();
+  const android::Vector<void *> &addrs =
+      executable->getExportForeachFuncAddrs();
+
+  for (size_t i = 0, e = pKernels.size(); i != e; i++) {
+    ExpandFunction expand = NULL;
+    for (size_t j = 0; (j < funcs.size()) && (j < addrs.size()); j++) {
+      if (pKernels[i].mName == funcs[j].first) {
+        expand = reinterpret_cast<ExpandFunction>(addrs[j]);
+        break;
+      }
+    }
+    if (expand == NULL) {
+      llvm::errs() << "bcc_kernel_bench: " << pKernels[i].mName
+                   << ".expand is missing from " << pInput << "!\n";
+      continue;
+    }
+    RunKernel(pInput, pVariant, pKernels[i], expand);
+  }
+
+  delete executable;
+  return true;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  init::Initialize();
+
+  if ((OptIterations == 0) || (OptCells == 0)) {
+    llvm::errs() << "bcc_kernel_bench: -n and -cells must be positive!\n";
+    return EXIT_FAILURE;
+  }
+
+  RSCompilerDriver driver(/* pUseCompilerRT */false);
+  driver.setRSRuntimeLookupFunction(LookupRuntimeSymbol);
+
+  int status = EXIT_SUCCESS;
+  for (unsigned i = 0, e = OptInputFilenames.size(); i != e; i++) {
+    const std::string &input = OptInputFilenames[i];
+    tools::MappedInputFile map;
+    if (!map.map(input)) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    const char *bitcode = map.getData();
+    size_t bitcode_size = map.getSize();
+    unsigned target_api = bcinfo::BitcodeWrapper(bitcode, bitcode_size)
+                              .getTargetAPI();
+
+    // The prototypes of the kernels are read from the bitcode upgraded to the
+    // current format.
+    bcinfo::BitcodeTranslator translator(bitcode, bitcode_size, target_api);
+    std::vector<Kernel> kernels;
+    if (!translator.translate() ||
+        !GetKernels(input.c_str(), translator.getTranslatedBitcode(),
+                    translator.getTranslatedBitcodeSize(), kernels)) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    std::string res_name = llvm::sys::path::stem(input);
+    for (unsigned j = 0; j < (sizeof(Variants) / sizeof(Variants[0])); j++) {
+      if (IsSelected(OptVariants, Variants[j].mName) &&
+          !RunVariant(driver, input, res_name, bitcode, bitcode_size,
+                      Variants[j], kernels)) {
+        status = EXIT_FAILURE;
+      }
+    }
+  }
+
+  return status;
+}
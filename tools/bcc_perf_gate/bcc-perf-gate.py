@@ -0,0 +1,410 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""Compare the performance of two builds of libbcc over a bitcode corpus.
+
+The dependencies of the RS info of every script include the SHA-1 of libbcc,
+so an update of libbcc recompiles all the scripts of a device: a regression
+of the compiler or of the code it generates hits all of them at once. This
+gate runs bcc_bench and bcc_kernel_bench of a baseline and of a candidate
+build over the same inputs, several times each (alternating the builds so
+that a drift of the machine hits both), and compares:
+
+  - the latency of each stage of bcc_bench (translate, extract, build-cold,
+    build-warm, load and load-memory) and of the LTO and code generation
+    phases of build-cold,
+  - the size of the object of each input,
+  - the throughput (cells per second) of each variant of each kernel of
+    bcc_kernel_bench.
+
+A timing is a regression if the medians differ by more than --threshold
+percent in the wrong direction and the one-sided Mann-Whitney U test over the
+runs gives a p-value below --alpha. The object sizes are deterministic and
+only compared against --size-threshold. The exit status is 1 if there's a
+regression, 2 on error and 0 otherwise.
+
+The build directories are laid out like out/host/<os>-x86: the executables
+in bin/ and libbcc (and libLLVM, libbcinfo) in lib/. Give a device build the
+same layout and run the gate on the device.
+"""
+
+from __future__ import print_function
+
+import json
+import math
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# The samples are ms (lower is better) unless listed here.
+HIGHER_IS_BETTER = set(['cells_per_s'])
+
+# The fields of the stages of bcc_bench which are compared.
+BENCH_FIELDS = ['median_ms', 'lto_ms', 'codegen_ms']
+
+def collect_inputs(paths):
+    """Return the bitcode files of paths, descending into the directories."""
+    inputs = []
+    for path in paths:
+        if not os.path.isdir(path):
+            inputs.append(path)
+            continue
+        for root, dirs, files in os.walk(path):
+            dirs.sort()
+            for name in sorted(files):
+                if name.endswith('.bc'):
+                    inputs.append(os.path.join(root, name))
+    return inputs
+
+def get_env(build_dir):
+    env = dict(os.environ)
+    lib_dir = os.path.join(build_dir, 'lib')
+    for var in ('LD_LIBRARY_PATH', 'DYLD_LIBRARY_PATH'):
+        if env.get(var):
+            env[var] = lib_dir + os.pathsep + env[var]
+        else:
+            env[var] = lib_dir
+    return env
+
+def run_tool(build_dir, tool, args):
+    """Run tool of build_dir with args and return the JSON objects it printed
+    (None if it failed without printing any.)"""
+    cmd = [os.path.join(build_dir, 'bin', tool)] + args
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE, env=get_env(build_dir))
+    out, err = proc.communicate()
+    if not isinstance(out, str):
+        out = out.decode('utf-8', 'replace')
+        err = err.decode('utf-8', 'replace')
+
+    results = []
+    for line in out.splitlines():
+        line = line.strip()
+        if line.startswith('{'):
+            try:
+                results.append(json.loads(line))
+            except ValueError:
+                pass
+
+    if proc.returncode != 0:
+        print('warning: %s exited with %d:\n%s' %
+              (' '.join(cmd), proc.returncode, err.strip()), file=sys.stderr)
+        if not results:
+            return None
+    return results
+
+class Samples(object):
+    """The samples of the metrics of one build, keyed by (input, benchmark,
+    field)."""
+
+    def __init__(self):
+        self.timings = {}
+        self.sizes = {}
+
+    def add_timing(self, key, value):
+        self.timings.setdefault(key, []).append(float(value))
+
+    def add_bench(self, results):
+        for result in results:
+            name = result['input']
+            for field in BENCH_FIELDS:
+                if field in result:
+                    self.add_timing((name, result['benchmark'], field),
+                                    result[field])
+            if 'object_bytes' in result:
+                self.sizes[(name, 'object', 'bytes')] = result['object_bytes']
+
+    def add_kernel_bench(self, results):
+        for result in results:
+            name = result['input']
+            benchmark = '%s/%s' % (result['kernel'], result['variant'])
+            self.add_timing((name, benchmark, 'cells_per_s'),
+                            result['cells_per_s'])
+
+def run_builds(options, inputs, work_dir):
+    builds = [('baseline', options.baseline), ('candidate', options.candidate)]
+    samples = dict((label, Samples()) for label, _ in builds)
+
+    common_args = []
+    if options.bclib:
+        common_args.append('-bclib=' + options.bclib)
+
+    for run in range(options.runs):
+        # Alternate which build goes first.
+        order = builds if (run % 2 == 0) else list(reversed(builds))
+        for label, build_dir in order:
+            print('run %d/%d: %s' % (run + 1, options.runs, label),
+                  file=sys.stderr)
+
+            output_path = os.path.join(work_dir, label)
+            if os.path.exists(output_path):
+                shutil.rmtree(output_path)
+            os.makedirs(output_path)
+
+            results = run_tool(build_dir, 'bcc_bench',
+                               common_args +
+                               ['-n=%d' % options.iterations,
+                                '-output_path=' + output_path] + inputs)
+            if results is None:
+                return None
+            samples[label].add_bench(results)
+
+            if options.no_kernels:
+                continue
+            # A kernel calling into the runtime aborts its process, so run
+            # each input apart.
+            for path in inputs:
+                results = run_tool(build_dir, 'bcc_kernel_bench',
+                                   common_args +
+                                   ['-n=%d' % options.kernel_iterations,
+                                    '-cells=%d' % options.cells,
+                                    '-output_path=' + output_path, path])
+                if results:
+                    samples[label].add_kernel_bench(results)
+
+    return samples['baseline'], samples['candidate']
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if n % 2:
+        return values[n // 2]
+    return (values[n // 2 - 1] + values[n // 2]) / 2.0
+
+def count_u_distribution(n1, n2):
+    """Return the number of arrangements of n1 and n2 untied samples giving
+    each value of U (that of the first sample.)"""
+    # counts[i][j] is the distribution for i and j samples.
+    counts = [[None] * (n2 + 1) for _ in range(n1 + 1)]
+    for i in range(n1 + 1):
+        for j in range(n2 + 1):
+            if i == 0 or j == 0:
+                counts[i][j] = [1]
+                continue
+            # The largest sample is of the first (it beats the j others) or
+            # of the second.
+            first = [0] * j + counts[i - 1][j]
+            second = counts[i][j - 1]
+            size = max(len(first), len(second))
+            counts[i][j] = [(first[k] if k < len(first) else 0) +
+                            (second[k] if k < len(second) else 0)
+                            for k in range(size)]
+    return counts[n1][n2]
+
+def mann_whitney_greater(xs, ys):
+    """Return the p-value of the one-sided Mann-Whitney U test of the samples
+    xs being greater than ys."""
+    n1, n2 = len(xs), len(ys)
+    if n1 == 0 or n2 == 0:
+        return 1.0
+
+    # Rank the pooled samples, the ties taking their average rank.
+    pooled = sorted([(x, 0) for x in xs] + [(y, 1) for y in ys])
+    ranks = [0.0] * len(pooled)
+    tie_term = 0.0
+    i = 0
+    while i < len(pooled):
+        j = i
+        while j + 1 < len(pooled) and pooled[j + 1][0] == pooled[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2.0 + 1
+        t = j - i + 1
+        tie_term += t ** 3 - t
+        i = j + 1
+    r1 = sum(ranks[k] for k in range(len(pooled)) if pooled[k][1] == 0)
+    u = r1 - n1 * (n1 + 1) / 2.0
+
+    # The exact distribution for the small samples without ties.
+    if tie_term == 0 and n1 * n2 <= 400:
+        counts = count_u_distribution(n1, n2)
+        total = float(sum(counts))
+        return sum(counts[int(math.ceil(u)):]) / total
+
+    # The normal approximation otherwise, with the correction for the ties
+    # and for the continuity.
+    n = n1 + n2
+    mean = n1 * n2 / 2.0
+    variance = n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (u - mean - 0.5) / math.sqrt(variance)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+class Comparison(object):
+    def __init__(self, key, baseline, candidate, change, p_value, status):
+        self.key = key
+        self.baseline = baseline
+        self.candidate = candidate
+        # In percent, positive if the candidate is worse.
+        self.change = change
+        self.p_value = p_value
+        self.status = status
+
+    def to_json(self):
+        return {'input': self.key[0], 'benchmark': self.key[1],
+                'metric': self.key[2], 'baseline': self.baseline,
+                'candidate': self.candidate, 'change_percent': self.change,
+                'p_value': self.p_value, 'status': self.status}
+
+def compare(options, baseline, candidate):
+    comparisons = []
+
+    for key in sorted(set(baseline.timings) & set(candidate.timings)):
+        xs, ys = baseline.timings[key], candidate.timings[key]
+        base, cand = median(xs), median(ys)
+        if key[2] in HIGHER_IS_BETTER:
+            # Worse is slower: the baseline is greater.
+            change = ((base - cand) / base * 100) if base else 0.0
+            p_worse = mann_whitney_greater(xs, ys)
+            p_better = mann_whitney_greater(ys, xs)
+        else:
+            change = ((cand - base) / base * 100) if base else 0.0
+            p_worse = mann_whitney_greater(ys, xs)
+            p_better = mann_whitney_greater(xs, ys)
+
+        if change > options.threshold and p_worse < options.alpha:
+            status, p_value = 'regression', p_worse
+        elif -change > options.threshold and p_better < options.alpha:
+            status, p_value = 'improvement', p_better
+        else:
+            status, p_value = 'unchanged', min(p_worse, p_better)
+        comparisons.append(Comparison(key, base, cand, change, p_value,
+                                      status))
+
+    for key in sorted(set(baseline.sizes) & set(candidate.sizes)):
+        base, cand = baseline.sizes[key], candidate.sizes[key]
+        change = (float(cand - base) / base * 100) if base else 0.0
+        if change > options.size_threshold:
+            status = 'regression'
+        elif -change > options.size_threshold:
+            status = 'improvement'
+        else:
+            status = 'unchanged'
+        comparisons.append(Comparison(key, base, cand, change, None, status))
+
+    missing = ((set(baseline.timings) | set(baseline.sizes)) ^
+               (set(candidate.timings) | set(candidate.sizes)))
+    for key in sorted(missing):
+        print('warning: %s %s %s was only measured with one of the builds' %
+              key, file=sys.stderr)
+
+    return comparisons
+
+def print_report(comparisons, verbose):
+    for status in ('regression', 'improvement', 'unchanged'):
+        selected = [c for c in comparisons if c.status == status]
+        if not selected or (status == 'unchanged' and not verbose):
+            continue
+        print('%s (%d):' % (status, len(selected)))
+        for c in selected:
+            p_value = ('' if c.p_value is None else
+                       '  p=%.4f' % c.p_value)
+            print('  %-24s %-28s %-12s %14.3f -> %14.3f  %+7.2f%%%s' %
+                  (c.key[0], c.key[1], c.key[2], c.baseline, c.candidate,
+                   c.change, p_value))
+
+    # The geometric mean over the corpus of the ratio candidate / baseline of
+    # each metric (of each variant for the kernels.)
+    print('overall (candidate / baseline):')
+    by_metric = {}
+    for c in comparisons:
+        if c.baseline > 0 and c.candidate > 0:
+            if c.key[2] == 'cells_per_s':
+                metric = '%s %s' % (c.key[1].split('/')[-1], c.key[2])
+            else:
+                metric = '%s %s' % (c.key[1], c.key[2])
+            by_metric.setdefault(metric, []).append(
+                float(c.candidate) / c.baseline)
+    for metric in sorted(by_metric):
+        ratios = by_metric[metric]
+        mean = math.exp(sum(math.log(r) for r in ratios) / len(ratios))
+        print('  %-41s %+7.2f%% (%d)' % (metric, (mean - 1) * 100,
+                                         len(ratios)))
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] --baseline DIR --candidate DIR '
+              'INPUT.bc|DIR...')
+    parser.add_option('--baseline', help='build directory of the reference')
+    parser.add_option('--candidate', help='build directory under test')
+    parser.add_option('--runs', type='int', default=6,
+                      help='runs of the tools with each build (default: 6)')
+    parser.add_option('-n', dest='iterations', type='int', default=5,
+                      help='iterations of each stage of bcc_bench per run '
+                           '(default: 5)')
+    parser.add_option('--kernel-iterations', type='int', default=20,
+                      help='launches of each kernel per run (default: 20)')
+    parser.add_option('--cells', type='int', default=1 << 20,
+                      help='cells of each kernel launch (default: 1048576)')
+    parser.add_option('--no-kernels', action='store_true', default=False,
+                      help="don't run bcc_kernel_bench")
+    parser.add_option('--bclib', help='bclib given to both builds')
+    parser.add_option('--alpha', type='float', default=0.05,
+                      help='significance level (default: 0.05)')
+    parser.add_option('--threshold', type='float', default=3.0,
+                      help='smallest change of a timing (in percent) '
+                           'reported (default: 3)')
+    parser.add_option('--size-threshold', type='float', default=0.5,
+                      help='smallest change of an object size (in percent) '
+                           'reported (default: 0.5)')
+    parser.add_option('--json', help='write the comparisons to this file')
+    parser.add_option('--work-dir', help='directory of the caches of the '
+                                         'builds (default: a temporary one)')
+    parser.add_option('-v', '--verbose', action='store_true', default=False,
+                      help='list the unchanged metrics as well')
+    options, args = parser.parse_args()
+
+    if not options.baseline or not options.candidate or not args:
+        parser.print_usage(sys.stderr)
+        return 2
+    if options.runs < 2:
+        print('error: --runs must be at least 2', file=sys.stderr)
+        return 2
+
+    inputs = collect_inputs(args)
+    if not inputs:
+        print('error: no bitcode files in %s' % ' '.join(args),
+              file=sys.stderr)
+        return 2
+
+    work_dir = options.work_dir or tempfile.mkdtemp(prefix='bcc-perf-gate-')
+    try:
+        samples = run_builds(options, inputs, work_dir)
+    finally:
+        if not options.work_dir:
+            shutil.rmtree(work_dir, ignore_errors=True)
+    if samples is None:
+        return 2
+
+    comparisons = compare(options, samples[0], samples[1])
+    print_report(comparisons, options.verbose)
+    if options.json:
+        f = open(options.json, 'w')
+        json.dump([c.to_json() for c in comparisons], f, indent=2,
+                  sort_keys=True)
+        f.close()
+
+    if [c for c in comparisons if c.status == 'regression']:
+        return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
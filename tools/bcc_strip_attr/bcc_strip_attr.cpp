@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/IR/LLVMContext.h"
@@ -22,12 +23,24 @@
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/SystemUtils.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/system_error.h"
+
+#include <vector>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 using namespace llvm;
 
 static cl::list<std::string>
@@ -42,6 +55,15 @@ static cl::opt<bool>
 OutputAssembly("S",
                cl::desc("Write output as LLVM assembly"), cl::Hidden);
 
+static cl::opt<bool>
+InPlace("in-place",
+        cl::desc("Strip each input file in place (required for several "
+                 "inputs)"));
+
+static cl::opt<unsigned>
+NumJobs("j", cl::desc("Number of files stripped in parallel"), cl::init(1),
+        cl::value_desc("N"));
+
 namespace {
   class StripAttributes : public ModulePass {
   public:
@@ -88,63 +110,212 @@ static RegisterPass<StripAttributes> RPSA("StripAttributes",
     "Strip Function Attributes Pass");
 
 
-static inline std::auto_ptr<Module> LoadFile(const char *argv0,
-                                             const std::string &FN,
-                                             LLVMContext& Context) {
-  SMDiagnostic Err;
-  Module* Result = ParseIRFile(FN, Err, Context);
-  if (Result) {
-    return std::auto_ptr<Module>(Result);   // Load successful!
+// The workers report their errors under this lock, one message at a time.
+static sys::Mutex ErrorLock;
+
+static void ReportError(const char *argv0, const std::string &Message) {
+  MutexGuard Locked(ErrorLock);
+  errs() << argv0 << ": " << Message << '\n';
+}
+
+static bool HasStrippedAttributes(const Module &M) {
+  for (Module::const_iterator I = M.begin(), E = M.end(); I != E; ++I) {
+    if (I->hasFnAttribute("target-cpu") ||
+        I->hasFnAttribute("target-features")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Write M (or the unchanged input at Buffer if M is NULL) to OutputPath. An
+// input stripped in place is replaced atomically: it may still be mapped.
+static bool WriteOutput(const char *argv0, const std::string &OutputPath,
+                        bool Replace, Module *M, const MemoryBuffer &Buffer) {
+  std::string TempPath = Replace ? (OutputPath + ".strip-tmp") : OutputPath;
+  std::string ErrorInfo;
+  tool_output_file Out(TempPath.c_str(), ErrorInfo, sys::fs::F_Binary);
+  if (!ErrorInfo.empty()) {
+    ReportError(argv0, ErrorInfo);
+    return false;
+  }
+
+  if (M == NULL) {
+    Out.os().write(Buffer.getBufferStart(), Buffer.getBufferSize());
+  } else if (OutputAssembly) {
+    Out.os() << *M;
+  } else if (Replace || !CheckBitcodeOutputToConsole(Out.os(), true)) {
+    WriteBitcodeToFile(M, Out.os());
+  }
+
+  Out.os().close();
+  if (Out.os().has_error()) {
+    Out.os().clear_error();
+    ReportError(argv0, "error writing '" + TempPath + "'");
+    return false;
   }
 
-  Err.print(argv0, errs());
-  return std::auto_ptr<Module>();
+  if (Replace) {
+    if (error_code EC = sys::fs::rename(TempPath, OutputPath)) {
+      ReportError(argv0, "unable to replace '" + OutputPath + "': " +
+                         EC.message());
+      return false;
+    }
+  }
+  Out.keep();
+  return true;
 }
 
+// Strip the attributes of the file InputPath into OutputPath (or in place if
+// Replace). A file none of whose functions carries them is left alone (when
+// stripped in place) or copied verbatim: the bodies of its functions aren't
+// even read. The others are rewritten whole: their attribute groups can't be
+// patched in place since the bitstream has no room to shrink a record.
+static bool StripFile(const char *argv0, const std::string &InputPath,
+                      const std::string &OutputPath, bool Replace) {
+  OwningPtr<MemoryBuffer> BufferOwner;
+  if (error_code EC = MemoryBuffer::getFileOrSTDIN(InputPath, BufferOwner)) {
+    ReportError(argv0, "error loading file '" + InputPath + "': " +
+                       EC.message());
+    return false;
+  }
+  MemoryBuffer *Buffer = BufferOwner.get();
+  const unsigned char *Start =
+      reinterpret_cast<const unsigned char *>(Buffer->getBufferStart());
+  bool IsBitcode = isBitcode(Start, Start + Buffer->getBufferSize());
+
+  // A context per file keeps the memory of the long runs bounded.
+  LLVMContext Context;
+  OwningPtr<Module> M;
+  std::string ErrorMessage;
+  if (IsBitcode) {
+    // The module takes the buffer.
+    M.reset(getLazyBitcodeModule(BufferOwner.take(), Context, &ErrorMessage));
+  } else {
+    SMDiagnostic Err;
+    M.reset(ParseIR(BufferOwner.take(), Err, Context));
+    if (!M) {
+      std::string Diagnostic;
+      raw_string_ostream OS(Diagnostic);
+      Err.print(argv0, OS);
+      ErrorMessage = OS.str();
+    }
+  }
+  if (!M) {
+    ReportError(argv0, "error loading file '" + InputPath + "': " +
+                       ErrorMessage);
+    return false;
+  }
+
+  // The output of a text input being bitcode, it's converted anyway.
+  if (!HasStrippedAttributes(*M) && !OutputAssembly &&
+      (Replace || IsBitcode)) {
+    return (Replace || WriteOutput(argv0, OutputPath, false, NULL, *Buffer));
+  }
+
+  if (M->MaterializeAllPermanently(&ErrorMessage)) {
+    ReportError(argv0, "error reading '" + InputPath + "': " + ErrorMessage);
+    return false;
+  }
+
+  // Perform the actual function attribute stripping.
+  PassManager PM;
+  PM.add(createStripAttributePass());
+  PM.run(*M);
+
+  if (verifyModule(*M)) {
+    ReportError(argv0, "stripped module '" + InputPath + "' is broken!");
+    return false;
+  }
+
+  return WriteOutput(argv0, OutputPath, Replace, M.get(), *Buffer);
+}
+
+namespace {
+  // The files stripped in place by the workers.
+  struct StripQueue {
+    const char *Argv0;
+    sys::Mutex Lock;
+    unsigned Next;
+    bool Failed;
+
+    StripQueue(const char *argv0) : Argv0(argv0), Next(0), Failed(false) {
+    }
+  };
+}
+
+static void *RunStripWorker(void *Data) {
+  StripQueue &Queue = *static_cast<StripQueue *>(Data);
+  while (true) {
+    unsigned Idx;
+    {
+      MutexGuard Locked(Queue.Lock);
+      if (Queue.Next >= InputFilenames.size()) {
+        break;
+      }
+      Idx = Queue.Next++;
+    }
+    if (!StripFile(Queue.Argv0, InputFilenames[Idx], InputFilenames[Idx],
+                   /* Replace */true)) {
+      MutexGuard Locked(Queue.Lock);
+      Queue.Failed = true;
+    }
+  }
+  return NULL;
+}
 
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal();
   PrettyStackTraceProgram X(argc, argv);
 
-  LLVMContext &Context = getGlobalContext();
   llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
   cl::ParseCommandLineOptions(argc, argv, "strip function attribute pass\n");
 
-  std::string ErrorMessage;
-
-  std::auto_ptr<Module> M(LoadFile(argv[0], InputFilenames[0], Context));
-  if (M.get() == 0) {
-    errs() << argv[0] << ": error loading file '"
-           << InputFilenames[0] << "'\n";
+  if (InputFilenames.empty()) {
+    errs() << argv[0] << ": no input file\n";
     return 1;
   }
 
-  // Perform the actual function attribute stripping.
-  PassManager PM;
-  PM.add(createStripAttributePass());
-  PM.run(*M.get());
-
-  std::string ErrorInfo;
-  tool_output_file Out(OutputFilename.c_str(), ErrorInfo,
-                       sys::fs::F_Binary);
-  if (!ErrorInfo.empty()) {
-    errs() << ErrorInfo << '\n';
-    return 1;
+  if (!InPlace) {
+    if (InputFilenames.size() > 1) {
+      errs() << argv[0] << ": several inputs are only stripped -in-place\n";
+      return 1;
+    }
+    return StripFile(argv[0], InputFilenames[0], OutputFilename,
+                     /* Replace */false) ? 0 : 1;
   }
 
-  if (verifyModule(*M)) {
-    errs() << argv[0] << ": stripped module is broken!\n";
+  if (OutputFilename.getNumOccurrences() > 0) {
+    errs() << argv[0] << ": -o can't be used with -in-place\n";
     return 1;
   }
 
-  if (OutputAssembly) {
-    Out.os() << *M;
-  } else if (!CheckBitcodeOutputToConsole(Out.os(), true)) {
-    WriteBitcodeToFile(M.get(), Out.os());
+  StripQueue Queue(argv[0]);
+  unsigned NumWorkers = NumJobs;
+  if (NumWorkers > InputFilenames.size()) {
+    NumWorkers = InputFilenames.size();
   }
 
-  Out.keep();
+  // This thread is a worker too.
+#if !defined(_WIN32)
+  std::vector<pthread_t> Workers;
+  if ((NumWorkers > 1) && llvm_start_multithreaded()) {
+    for (unsigned i = 1; i < NumWorkers; i++) {
+      pthread_t Worker;
+      if (pthread_create(&Worker, NULL, RunStripWorker, &Queue) != 0) {
+        break;
+      }
+      Workers.push_back(Worker);
+    }
+  }
+#endif
+  RunStripWorker(&Queue);
+#if !defined(_WIN32)
+  for (size_t i = 0, e = Workers.size(); i != e; i++) {
+    pthread_join(Workers[i], NULL);
+  }
+#endif
 
-  return 0;
+  return Queue.Failed ? 1 : 0;
 }
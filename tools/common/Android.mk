@@ -0,0 +1,46 @@
+#
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+LOCAL_PATH := $(call my-dir)
+
+#=====================================================================
+# Host Static Library: libbccToolUtil
+#=====================================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libbccToolUtil
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_CLASS := STATIC_LIBRARIES
+
+LOCAL_SRC_FILES := ToolUtil.cpp
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+#=====================================================================
+# Device Static Library: libbccToolUtil
+#=====================================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libbccToolUtil
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_CLASS := STATIC_LIBRARIES
+
+LOCAL_SRC_FILES := ToolUtil.cpp
+
+include external/stlport/libstlport.mk
+include $(BUILD_STATIC_LIBRARY)
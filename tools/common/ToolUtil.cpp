@@ -0,0 +1,97 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ToolUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bcc {
+namespace tools {
+
+void AppendJSONString(std::string &pOut, const char *pString) {
+  pOut += '"';
+  for (; (pString != NULL) && (*pString != '\0'); pString++) {
+    unsigned char c = *pString;
+    if ((c == '"') || (c == '\\')) {
+      pOut += '\\';
+      pOut += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      ::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      pOut += escaped;
+    } else {
+      pOut += c;
+    }
+  }
+  pOut += '"';
+}
+
+bool MappedInputFile::map(const std::string &pPath) {
+  unmap();
+
+  int fd = ::open(pPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ::fprintf(stderr, "Unable to open %s! (%s)\n", pPath.c_str(),
+              ::strerror(errno));
+    return false;
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) < 0) {
+    ::fprintf(stderr, "Unable to stat %s! (%s)\n", pPath.c_str(),
+              ::strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  if (!S_ISREG(file_stat.st_mode) || (file_stat.st_size == 0)) {
+    ::fprintf(stderr, "%s is not a non-empty regular file!\n", pPath.c_str());
+    ::close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(file_stat.st_size);
+  void *data = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file is closed.
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    ::fprintf(stderr, "Unable to map %s! (%s)\n", pPath.c_str(),
+              ::strerror(errno));
+    return false;
+  }
+
+  mData = static_cast<const char *>(data);
+  mSize = size;
+  return true;
+}
+
+void MappedInputFile::unmap() {
+  if (mData != NULL) {
+    ::munmap(const_cast<char *>(mData), mSize);
+    mData = NULL;
+    mSize = 0;
+  }
+}
+
+} // end namespace tools
+} // end namespace bcc
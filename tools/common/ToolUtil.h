@@ -0,0 +1,72 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BCC_TOOLS_TOOL_UTIL_H
+#define BCC_TOOLS_TOOL_UTIL_H
+
+#include <cstddef>
+#include <string>
+
+// Helpers shared by the host tools (bcinfo, bcc_bench and bcc_kernel_bench).
+// They only depend on libc so that bcinfo, which doesn't link libbcc, can use
+// them too.
+
+namespace bcc {
+namespace tools {
+
+// Append pString to pOut as a quoted JSON string with '"', '\\' and the
+// control characters escaped. A NULL pString is written as "".
+void AppendJSONString(std::string &pOut, const char *pString);
+
+inline void AppendJSONString(std::string &pOut, const std::string &pString) {
+  AppendJSONString(pOut, pString.c_str());
+}
+
+// A whole, non-empty regular file mapped read-only. The pages are shared with
+// the page cache and only the parts that are touched are brought in.
+class MappedInputFile {
+private:
+  const char *mData;
+  size_t mSize;
+
+public:
+  MappedInputFile() : mData(NULL), mSize(0) { }
+
+  ~MappedInputFile()
+  { unmap(); }
+
+  // Map pPath, dropping any previous mapping. Print why to stderr and return
+  // false on error.
+  bool map(const std::string &pPath);
+
+  void unmap();
+
+  inline const char *getData() const
+  { return mData; }
+
+  inline size_t getSize() const
+  { return mSize; }
+
+private:
+  MappedInputFile(const MappedInputFile &); // DISABLED.
+  void operator=(const MappedInputFile &); // DISABLED.
+};
+
+} // end namespace tools
+} // end namespace bcc
+
+#endif  // BCC_TOOLS_TOOL_UTIL_H